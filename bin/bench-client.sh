@@ -0,0 +1,30 @@
+#!/bin/bash
+#
+# File : bench-client.sh
+#
+#   benchmark xsync-client event pipeline with a synthetic file tree.
+#   events are processed by the real client code but not sent to servers
+#   or kafka. prints events/s, per-stage p50/p99 latency and cpu/event.
+#
+#   bench-client.sh [WATCHED_DIR [DEPTH [FANOUT [FILES [RATE [SECONDS]]]]]]
+#
+#   WATCHED_DIR must be (under) a path watched by xsync-client,
+#     default: /tmp/xclient/test-log (see watch-test/test-log)
+#
+# init created: 2018-11-23
+# last updated: 2018-11-23
+#
+########################################################################
+# NOTE: readlink -f not support by MaxOS-X
+_file=$(readlink -f $0)
+
+_cdir=$(dirname $_file)
+_name=$(basename $_file)
+
+TARGETDIR=$(dirname $_cdir)/target
+
+BENCHDIR=${1:-/tmp/xclient/test-log}
+
+mkdir -p "$BENCHDIR"
+
+$TARGETDIR/xsync-client --bench="$(readlink -f $BENCHDIR),${2:-2},${3:-4},${4:-100},${5:-0},${6:-10}"
@@ -11,7 +11,11 @@ function kafka_config(intab)
     local outab = {
         result = "ERROR",
         bootstrap_servers = "localhost:9092",
-        socket_timeout_ms = "1000"
+        socket_timeout_ms = "1000",
+        -- 没有返回 message 时事件消息的格式: "text" (默认), "json", "binary" (见 evrecord.h)
+        -- event_format = "binary",
+        -- 后台刷新 topic 分区数的间隔 (毫秒), "0" 表示不刷新
+        metadata_refresh_ms = "30000"
     }
 
     ---[[
@@ -70,7 +74,14 @@ function on_event_task(intab)
         result = "ERROR",
         loglevel = "INFO",
         kafka_topic = table.concat({intab.clientid, "_", intab.pathid, "_", get_topic(intab.file)}),
-        kafka_partition = "0"
+
+        -- 不指定 kafka_partition 时按消息 key 的一致性哈希选择分区:
+        --   事件消息的 key 为 "clientid|pathid|route", 按行发送时为文件名.
+        --   同一个 key 的消息在同一个分区, 保持顺序
+        -- kafka_partition = "0",
+
+        -- "1": 按行发送文件新增的内容 (消息 key 为文件名), 不发送事件消息
+        kafka_lines = "0"
     }
 
     -- 指定输出的消息
@@ -2,7 +2,7 @@
 -- xsync-client 目录过滤脚本
 -- version: 0.1
 -- create: 2018-10-16
--- update: 2018-11-09
+-- update: 2018-11-29
 
 
 -- filter_path
@@ -61,6 +61,92 @@ function filter_file(intab)
 end
 
 
+-- filter_files
+-- 成批过滤文件: intab 是文件记录的数组, 每个记录同 filter_file 的 intab
+--   {path, file, mtime, size}. 记录表被 xsync-client 复用, 不能保存引用!
+-- 返回数组 outab[i] 是第 i 个文件的结论:
+--   "SUCCESS" 或 "ACCEPT": 接受; "REJECT": 拒绝; "RELOAD": 拒绝并且重新加载脚本
+--   也可以是表 {result = 结论, message = 日志消息}
+-- 定义了 filter_files 时 xsync-client 不再逐个调用 filter_file
+function filter_files(intab)
+    local outab = {}
+
+    for i, rec in ipairs(intab) do
+        --[[
+        print(table.concat({
+                "path-filter-1.lua"
+                ,"::"
+                ,"filter_files("
+                ,"path="
+                ,rec.path
+                ,";file="
+                ,rec.file
+                ,";mtime="
+                ,rec.mtime
+                ,";size="
+                ,rec.size
+                ,")"
+            }))
+        --]]
+
+        outab[i] = "SUCCESS"
+    end
+
+    outab.result = "SUCCESS"
+    return outab
+end
+
+
+-- filter_files_ffi
+-- LuaJIT 后端 (LUACTX_USE_LUAJIT): 成批过滤文件, 直接读写 C 内存 (见 watch_event.h 的 WATCH_EVENT_FFI_CDEF).
+--   inrecs:  struct watch_event_buf_t 数组 {wd, mask, len, name, pathlen, pathname, mtime, size, ...}
+--   outrecs: struct watch_filter_out_t 数组 {verdict, msglen, message}, verdict 默认 XS_FILTER_ACCEPT
+--   count:   文件数, 下标从 0 开始
+-- 名字只在需要时转换为 lua 字符串: ffi.string(ev.name, ev.len). 不能保留 inrecs 和 outrecs!
+-- 定义了 filter_files_ffi 时 xsync-client 不再调用 filter_files 和 filter_file.
+-- PUC Lua 没有 ffi 模块, 不定义这个函数
+local has_ffi, ffi = pcall(require, "ffi")
+
+if has_ffi
+then
+    -- 结构类型在 xsync-client 加载脚本之后定义, 第一次调用时才取得
+    local evptr_t, outptr_t
+
+    function filter_files_ffi(inrecs, outrecs, count)
+        if not evptr_t
+        then
+            evptr_t = ffi.typeof("const struct watch_event_buf_t *")
+            outptr_t = ffi.typeof("struct watch_filter_out_t *")
+        end
+
+        local ev = ffi.cast(evptr_t, inrecs)
+        local out = ffi.cast(outptr_t, outrecs)
+
+        for i = 0, count - 1
+        do
+            --[[
+            print(table.concat({
+                    "path-filter-1.lua"
+                    ,"::"
+                    ,"filter_files_ffi("
+                    ,"path="
+                    ,ffi.string(ev[i].pathname, ev[i].pathlen)
+                    ,";file="
+                    ,ffi.string(ev[i].name, ev[i].len)
+                    ,";mtime="
+                    ,tostring(ev[i].mtime)
+                    ,";size="
+                    ,tostring(ev[i].size)
+                    ,")"
+                }))
+            --]]
+
+            out[i].verdict = ffi.C.XS_FILTER_ACCEPT
+        end
+    end
+end
+
+
 -- inotify_watch_on_query
 -- 询问是否添加路径监视
 function inotify_watch_on_query(intab)
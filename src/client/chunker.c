@@ -0,0 +1,245 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: chunker.c
+ *   content-defined chunking (FastCDC with gear hash)
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-12
+ *
+ * @update: 2018-11-12 11:05:40
+ */
+
+#include "client_api.h"
+
+#include "chunker.h"
+
+
+/**
+ * gear table: 256 个 64 位随机数.
+ *   由固定种子的 splitmix64 生成, 保证所有客户端 (不同版本) 得到相同的切点.
+ */
+static ub8 gear_table[256];
+
+static pthread_once_t gear_table_once = PTHREAD_ONCE_INIT;
+
+#define GEAR_TABLE_SEED    0x7873796e63636463ULL
+
+
+static void gear_table_init (void)
+{
+    int i;
+    ub8 z, x = GEAR_TABLE_SEED;
+
+    for (i = 0; i < 256; i++) {
+        x += 0x9e3779b97f4a7c15ULL;
+
+        z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+        gear_table[i] = z ^ (z >> 31);
+    }
+}
+
+
+/**
+ * 高位 bits 个 1: fp 每字节左移 1 位, 高位包含了最近 64 字节的信息
+ */
+static inline ub8 gear_mask (int bits)
+{
+    if (bits <= 0) {
+        return 0;
+    }
+
+    if (bits >= 64) {
+        return (ub8) -1;
+    }
+
+    return ((((ub8) 1) << bits) - 1) << (64 - bits);
+}
+
+
+extern XS_VOID XS_chunker_init (xs_chunker_t *chunker, ub4 minsize, ub4 avgsize, ub4 maxsize)
+{
+    int bits = 0;
+
+    pthread_once(&gear_table_once, gear_table_init);
+
+    if (avgsize < 64) {
+        avgsize = 64;
+    }
+
+    while ((((ub4) 1) << (bits + 1)) <= avgsize) {
+        bits++;
+    }
+
+    /* round down to power of 2 */
+    avgsize = ((ub4) 1) << bits;
+
+    if (minsize > avgsize) {
+        minsize = avgsize;
+    }
+
+    if (maxsize < avgsize) {
+        maxsize = avgsize;
+    }
+
+    chunker->minsize = minsize;
+    chunker->avgsize = avgsize;
+    chunker->maxsize = maxsize;
+
+    /* normalization level 2 */
+    chunker->mask_s = gear_mask(bits + 2);
+    chunker->mask_l = gear_mask(bits - 2);
+
+    LOGGER_DEBUG("chunker: min=%u avg=%u max=%u", minsize, avgsize, maxsize);
+}
+
+
+extern ub4 XS_chunker_cut (const xs_chunker_t *chunker, const ub1 *data, ub4 len, int eof)
+{
+    ub4 i, normal, limit;
+    ub8 fp = 0;
+
+    if (len <= chunker->minsize) {
+        return (eof? len : 0);
+    }
+
+    limit = (len > chunker->maxsize? chunker->maxsize : len);
+    normal = (limit < chunker->avgsize? limit : chunker->avgsize);
+
+    for (i = chunker->minsize; i < normal; i++) {
+        fp = (fp << 1) + gear_table[data[i]];
+
+        if (! (fp & chunker->mask_s)) {
+            return i + 1;
+        }
+    }
+
+    for (; i < limit; i++) {
+        fp = (fp << 1) + gear_table[data[i]];
+
+        if (! (fp & chunker->mask_l)) {
+            return i + 1;
+        }
+    }
+
+    if (limit == chunker->maxsize || eof) {
+        return limit;
+    }
+
+    /* need more data */
+    return 0;
+}
+
+
+extern XS_RESULT XS_chunker_scan_file (const xs_chunker_t *chunker, int fd, ub8 offset, ub8 endpos, chunker_cb_t chunk_cb, void *arg)
+{
+    XS_RESULT res = XS_SUCCESS;
+
+    XSChunkDesc_t desc;
+
+    /* 缓冲区至少能容纳 2 个最大块, 每次读满后连续切分, 剩余部分移到头部 */
+    ub4 bufsize = chunker->maxsize * 2;
+    ub1 *buf = (ub1 *) mem_alloc_unset(bufsize);
+
+    ub4 len = 0;
+    ub8 readpos = offset;
+
+    int eof = 0;
+
+    bzero(&desc, sizeof(desc));
+
+    while (res == XS_SUCCESS && (len > 0 || ! eof)) {
+        ub4 pos, cut;
+
+        /* fill buffer */
+        while (! eof && len < bufsize) {
+            ssize_t cb;
+            size_t want = bufsize - len;
+
+            if (endpos && readpos + want > endpos) {
+                want = (size_t) (endpos - readpos);
+            }
+
+            if (want == 0) {
+                eof = 1;
+                break;
+            }
+
+            cb = pread(fd, buf + len, want, (off_t) readpos);
+
+            if (cb < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                LOGGER_ERROR("pread error(%d): %s", errno, strerror(errno));
+                res = XS_E_FILE;
+                break;
+            }
+
+            if (cb == 0) {
+                eof = 1;
+                break;
+            }
+
+            len += (ub4) cb;
+            readpos += (ub8) cb;
+        }
+
+        if (res != XS_SUCCESS) {
+            break;
+        }
+
+        pos = 0;
+
+        while (pos < len && (cut = XS_chunker_cut(chunker, buf + pos, len - pos, eof)) > 0) {
+            desc.length = cut;
+            XS_chunk_digest(buf + pos, cut, desc.digest);
+
+            res = chunk_cb(&desc, offset, buf + pos, arg);
+            if (res != XS_SUCCESS) {
+                break;
+            }
+
+            offset += cut;
+            pos += cut;
+        }
+
+        /* move tail to head */
+        if (pos < len) {
+            memmove(buf, buf + pos, len - pos);
+        }
+
+        len -= pos;
+    }
+
+    mem_free(buf);
+
+    return res;
+}
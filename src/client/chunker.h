@@ -0,0 +1,113 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: chunker.h
+ *   content-defined chunking (FastCDC with gear hash)
+ *
+ *   Wen Xia, et al. FastCDC: a Fast and Efficient Content-Defined Chunking
+ *     Approach for Data Deduplication. USENIX ATC'16
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-12
+ *
+ * @update: 2018-11-12 11:05:40
+ */
+
+#ifndef CHUNKER_H_INCLUDED
+#define CHUNKER_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+#include "../xsync-protocol.h"
+
+#include "../common/common_util.h"
+
+#include <openssl/sha.h>
+
+
+/**
+ * xs_chunker_t
+ *
+ *   切分参数. 客户端所有线程共享, 只读.
+ *
+ *   [0, minsize) 不判断切点; [minsize, avgsize) 使用较严格的 mask_s;
+ *   [avgsize, maxsize) 使用较宽松的 mask_l (normalized chunking),
+ *   使块长度集中在 avgsize 附近.
+ */
+typedef struct xs_chunker_t
+{
+    ub4 minsize;
+    ub4 avgsize;
+    ub4 maxsize;
+
+    ub8 mask_s;
+    ub8 mask_l;
+} xs_chunker_t;
+
+
+/**
+ * 每切出一个块调用一次:
+ *   desc   - 块摘要和长度
+ *   offset - 块在文件中的偏移
+ *   data   - 块数据 (desc->length 字节), 只在回调期间有效
+ *
+ * 返回 XS_SUCCESS 继续, 否则停止切分并把返回值作为结果返回
+ */
+typedef int (*chunker_cb_t) (const XSChunkDesc_t *desc, ub8 offset, const ub1 *data, void *arg);
+
+
+extern XS_VOID XS_chunker_init (xs_chunker_t *chunker, ub4 minsize, ub4 avgsize, ub4 maxsize);
+
+/**
+ * XS_chunker_cut
+ *   返回 data 中第一个块的长度. 如果 len 不足 maxsize 并且没有找到切点,
+ *   eof 为 0 时返回 0 (需要更多数据), eof 为 1 时返回 len.
+ */
+extern ub4 XS_chunker_cut (const xs_chunker_t *chunker, const ub1 *data, ub4 len, int eof);
+
+/**
+ * XS_chunker_scan_file
+ *   从 offset 开始切分文件直到 endpos (不包括), 对每个块计算 SHA-256 并回调.
+ */
+extern XS_RESULT XS_chunker_scan_file (const xs_chunker_t *chunker, int fd, ub8 offset, ub8 endpos, chunker_cb_t chunk_cb, void *arg);
+
+
+__no_warning_unused(static)
+inline void XS_chunk_digest (const ub1 *data, ub4 len, ub1 digest[XS_CHUNK_HASH_SIZE])
+{
+    SHA256(data, (size_t) len, digest);
+}
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* CHUNKER_H_INCLUDED */
@@ -30,11 +30,12 @@
  *
  * @create: 2018-01-24
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-23 16:20:08
  */
 
 #include "client.h"
 #include "server_conn.h"
+#include "conn_reactor.h"
 
 void run_interactive (int threads);
 
@@ -145,6 +146,25 @@ int main (int argc, char *argv[])
         }
     }
 
+    /**
+     * 异步日志必须在 daemon() 之后启动: fork 不复制写线程
+     */
+    if (opts.log_async != -1) {
+        logger_async_start(XSYNC_LOGGER_ASYNC_RINGSIZE, opts.log_async, opts.log_file);
+    }
+
+    if (opts.bench[0] && ! opts.trace_sample) {
+        // 基准测试的延迟来自事件跟踪, 跟踪全部事件
+        opts.trace_sample = 1;
+        snprintf(opts.trace_file, sizeof(opts.trace_file), "/tmp/%s.bench.trace", APP_NAME);
+    }
+
+    if (opts.trace_sample > 0) {
+        if (evtrace_open(opts.trace_file, XSYNC_EVTRACE_CAPACITY, opts.trace_sample) != 0) {
+            LOGGER_ERROR("evtrace open fail: %s", opts.trace_file);
+        }
+    }
+
     /**
      * 注册信号处理函数
      */
@@ -206,6 +226,14 @@ void run_forever (xs_appopts_t *opts)
             XS_client_conf_save_config(client, opts->save_config);
         }
 
+        if (opts->bench[0]) {
+            /** 基准测试: 生成器线程在结束时退出进程 */
+            if (XS_client_bench_start(client, opts->bench) != XS_SUCCESS) {
+                XS_client_release(&client);
+                return;
+            }
+        }
+
         /** 启动客户端服务程序, 永远运行 */
         XS_client_bootstrap(client);
 
@@ -306,23 +334,38 @@ static void * thread_func (void *arg)
 
     XS_server_conn xcon = 0;
 
+    xs_conn_reactor_t *reactor = 0;
+
     int tid = pthread_self();
 
     printf("thread#%lld start (clientid='%s' password='%s')...\n", (long long) tid, xsrvopts->clientid, xsrvopts->password);
 
     do {
-        xres = XS_server_conn_create(xsrvopts, xsrvopts->clientid, xsrvopts->password, &xcon);
+        xres = XS_conn_reactor_create(&reactor);
 
         if (xres != XS_SUCCESS) {
-            printf("failed to connect server.\n");
+            printf("failed to create reactor.\n");
             break;
         }
 
+        XS_server_conn_create(xsrvopts, xsrvopts->clientid, xsrvopts->password, &xcon);
+
+        XS_conn_reactor_add(reactor, xcon);
+
+        if (XS_conn_reactor_start(reactor) != XS_SUCCESS) {
+            printf("failed to start reactor.\n");
+            XS_server_conn_release(&xcon);
+            break;
+        }
+
+        // reactor 负责连接, 握手和心跳
         sleep(60);
 
         XS_server_conn_release(&xcon);
     } while(0);
 
+    XS_conn_reactor_free(&reactor);
+
     printf("thread#%d end.\n", tid);
     return ((void*) 0);
 }
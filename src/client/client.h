@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-24
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-23 16:20:08
  */
 
 #ifndef CLIENT_H_INCLUDED
@@ -49,6 +49,9 @@ extern "C" {
 #include "../common/cshell.h"
 #include "../common/common_util.h"
 #include "../common/readconf.h"
+#include "../common/evtrace.h"
+
+#include "client_bench.h"
 
 /**
  * print usage for app
@@ -109,6 +112,22 @@ void print_usage(void)
         "\t                                    \033[35m 'stderr' - using appender stderr\033[0m\n"
         "\t                                    \033[35m 'syslog' - using appender syslog\033[0m\n"
         "\n"
+        "\t-Y, --log-async=<POLICY[,FILE]> \033[35m asynchronous logging. POLICY when ring is full:\033[0m\n"
+        "\t                                    \033[35m 'drop'  - drop records and report the count (default)\033[0m\n"
+        "\t                                    \033[35m 'block' - wait for the background writer\033[0m\n"
+        "\t                                    \033[35m FILE: append to FILE directly instead of log4c appender\033[0m\n"
+        "\n"
+        "\t-M, --metrics=<ADDR>         \033[35m serve metrics in prometheus text format on ADDR:\033[0m\n"
+        "\t                                    \033[35m 'unix:/path/to/sock' - unix domain socket\033[0m\n"
+        "\t                                    \033[35m 'host:port' - tcp, or 'port' for 127.0.0.1:port\033[0m\n"
+        "\n"
+        "\t-T, --trace=<RATE[,FILE]>    \033[35m trace 1 of every RATE events into ring FILE (default: /tmp/" APP_NAME ".trace)\033[0m\n"
+        "\t                                    \033[35m see per-stage latency by: xsync-evtrace FILE\033[0m\n"
+        "\n"
+        "\t-B, --bench=<DIR[,DEPTH[,FANOUT[,FILES[,RATE[,SECONDS]]]]]>\n"
+        "\t                                    \033[35m benchmark event pipeline with a synthetic tree under watched DIR,\033[0m\n"
+        "\t                                    \033[35m events are not sent to servers or kafka. report and exit.\033[0m\n"
+        "\n"
         "\t-s, --sweep-interval=<SECONDS>  \033[35m specify sweep interval in seconds. %d (default)\033[0m\n"
         "\n"
         "\t-k, --kafka                  \033[35m logging event to kafka enabled.\033[0m\n"
@@ -164,6 +183,8 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
 
     opts->sweep_interval = XSYNC_SWEEP_INTERVAL_SECONDS;
 
+    opts->log_async = -1;
+
     *save_config = 0;
 
     /* command arguments */
@@ -175,6 +196,10 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
         {"log4c-rcpath", required_argument, 0, 'O'},
         {"priority", required_argument, 0, 'P'},
         {"appender", required_argument, 0, 'A'},
+        {"log-async", optional_argument, 0, 'Y'},
+        {"metrics", required_argument, 0, 'M'},
+        {"trace", required_argument, 0, 'T'},
+        {"bench", required_argument, 0, 'B'},
         {"sweep-interval", required_argument, 0, 's'},
         {"kafka", optional_argument, 0, 'k'},
         {"threads", required_argument, 0, 't'},
@@ -223,7 +248,7 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
     }
 
     /* parse command arguments */
-    while ((ret = getopt_long(argc, argv, "hVC:WO:k::P:A:t:q:s:N:p:DKLS::Im:", lopts, 0)) != EOF) {
+    while ((ret = getopt_long(argc, argv, "hVC:WO:k::P:A:Y::M:T:B:t:q:s:N:p:DKLS::Im:", lopts, 0)) != EOF) {
         switch (ret) {
         case 'D':
             opts->isdaemon = 1;
@@ -328,6 +353,57 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
             }
             break;
 
+        case 'Y':
+            opts->log_async = LOGGER_ASYNC_DROP;
+
+            if (optarg) {
+                char *logfile = strchr(optarg, ',');
+
+                if (logfile) {
+                    *logfile++ = 0;
+
+                    ret = snprintf(opts->log_file, sizeof(opts->log_file), "%s", logfile);
+                    if (ret <= 0 || ret >= sizeof(opts->log_file)) {
+                        fprintf(stderr, "\033[1;31m[error]\033[0m specified invalid log file: %s\n", logfile);
+                        exit(-1);
+                    }
+                }
+
+                opts->log_async = logger_async_policy_from_string(optarg);
+                if (opts->log_async == -1) {
+                    fprintf(stderr, "\033[1;31m[error]\033[0m specified invalid log-async policy: \033[31m%s\033[0m\n", optarg);
+                    exit(-1);
+                }
+            }
+            break;
+
+        case 'M':
+            ret = snprintf(opts->metrics, sizeof(opts->metrics), "%s", optarg);
+            if (ret <= 0 || ret >= sizeof(opts->metrics)) {
+                fprintf(stderr, "\033[1;31m[error]\033[0m specified invalid metrics address: %s\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        case 'T':
+            if (evtrace_parse_option(optarg, &opts->trace_sample, opts->trace_file, sizeof(opts->trace_file), "/tmp/" APP_NAME ".trace") == -1) {
+                fprintf(stderr, "\033[1;31m[error]\033[0m specified invalid trace: %s\n", optarg);
+                exit(-1);
+            }
+            break;
+
+        case 'B':
+            do {
+                xs_bench_opts_t bench;
+
+                ret = snprintf(opts->bench, sizeof(opts->bench), "%s", optarg);
+                if (ret <= 0 || ret >= sizeof(opts->bench) || XS_client_bench_parse(optarg, &bench) != 0) {
+                    fprintf(stderr, "\033[1;31m[error]\033[0m specified invalid bench: %s\n", optarg);
+                    exit(-1);
+                }
+            } while (0);
+            break;
+
         case 't':
             threads = atoi(optarg);
             break;
@@ -4,7 +4,7 @@
 #
 # @version: 0.4.4
 # @create: 2018-05-18 14:00:00
-# @update: 2018-11-09 17:06:23
+# @update: 2018-11-30 18:10:52
 #######################################################################
 prefix = .
 
@@ -17,9 +17,19 @@ TARGET := ${APPNAME}-${VERSION}
 
 LIB_PREFIX := ${TARGET_DIR}/../libs/lib
 
-TGT_LDFLAGS := -L${TARGET_DIR} -L${LIB_PREFIX}/lua/5.3 \
+# make LUAJIT=1: 使用 LuaJIT 2.1 (FFI) 代替 Lua 5.3 (see "../luacontext/luacontext.mk").
+#   cjson 也必须是按 LuaJIT 编译的 (lib/lua/5.1/cjson.so)
+ifdef LUAJIT
+    LIB_LUA := ${LIB_PREFIX}/libluajit-5.1.a
+    LUA_CMOD := lua/5.1
+else
+    LIB_LUA := ${LIB_PREFIX}/liblua.a
+    LUA_CMOD := lua/5.3
+endif
+
+TGT_LDFLAGS := -L${TARGET_DIR} -L${LIB_PREFIX}/${LUA_CMOD} \
 	-Wl,--soname=cjson.so \
-	-Wl,--rpath='./lib:../lib/lua/5.3:${LIB_PREFIX}/lua/5.3'
+	-Wl,--rpath='./lib:../lib/${LUA_CMOD}:${LIB_PREFIX}/${LUA_CMOD}'
 
 # ldd xsync-client
 # readelf -d xsync-client
@@ -33,7 +43,7 @@ TGT_LDLIBS  := \
 	${LIB_PREFIX}/libz.a \
 	${LIB_PREFIX}/libinotifytools.a \
 	${LIB_PREFIX}/libluacontext.a \
-	${LIB_PREFIX}/liblua.a \
+	${LIB_LUA} \
 	${LIB_PREFIX}/libjemalloc.a \
 	-lcjson \
 	-lm \
@@ -48,7 +58,17 @@ SOURCES := \
 	client_api.c \
 	client_conf.c \
 	watch_entry.c \
-	server_conn.c
+	server_conn.c \
+	chunker.c \
+	stream_mux.c \
+	conn_reactor.c \
+	fanout.c \
+	client_metrics.c \
+	client_bench.c \
+	event_checkpoint.c \
+	watch_repair.c \
+	watch_crawl.c \
+	sync_progress.c
 
 
 # see "../xsync-config.h" for definitions
@@ -59,6 +79,10 @@ SOURCES := \
 #  XSYNC_CLIENT_THREADS=4
 #  XSYNC_CLIENT_QUEUES=256
 #  XSYNC_USE_STATIC_PATHID_TABLE
+#  XSYNC_HAVE_ZSTD
+#  XSYNC_HAVE_LZ4
+#    enable zstd/lz4 for XSYN compression (see "../xsync-compress.h"),
+#    also need add libzstd.a/liblz4.a to TGT_LDLIBS. zlib is always used.
 #
 SRC_DEFS := NDEBUG \
 	XSYNC_CLIENT_APPNAME='"${APPNAME}"' \
@@ -69,6 +93,10 @@ SRC_DEFS := NDEBUG \
 	XSYNC_WATCH_PATHID_MAX=256 \
     MEMAPI_USE_LIBJEMALLOC
 
+ifdef LUAJIT
+    SRC_DEFS += LUACTX_USE_LUAJIT
+endif
+
 
 SRC_INCDIRS := \
     . \
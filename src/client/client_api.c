@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-25
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 20:05:37
  */
 
 /******************************************************************************
@@ -107,8 +107,12 @@
 #include "client_conf.h"
 #include "watch_entry.h"
 #include "watch_event.h"
+#include "fanout.h"
+#include "sync_progress.h"
+#include "client_metrics.h"
 
 #include "../common/common_util.h"
+#include "../common/evrecord.h"
 
 #include "../kafkatools/kafkatools.h"
 
@@ -119,9 +123,16 @@
 #define SWEEP_TIME_OVERLAP  5
 
 
-static int send_kafka_message(kafkatools_producer_api_t *api, const char *kafka_topic, int kafka_partition, const char *msg, int msglen)
+/**
+ * 发送事件消息到 kafka (同步). kafka_partition 为 RD_KAFKA_PARTITION_UA 时
+ *   按 key 的一致性哈希选择分区. 最多等待 XSYNC_KAFKA_DELIVERY_TIMEOUT_MS
+ *   毫秒, 超时的消息留在日志中由后台重新发送
+ */
+static int send_kafka_message(kafkatools_producer_api_t *api, const char *kafka_topic, int kafka_partition,
+    const char *key, int keylen, const char *msg, int msglen)
 {
     int ret;
+    uint64_t t0;
 
     kt_topic topic = api->kt_get_topic(api->producer, kafka_topic);
 
@@ -132,11 +143,17 @@ static int send_kafka_message(kafkatools_producer_api_t *api, const char *kafka_
         LOGGER_TRACE("topic(%p): %s", topic, api->kt_topic_name(topic));
     }
 
-    ret = api->kt_produce_message_sync(api->producer, msg, msglen, topic, kafka_partition, -1);
+    t0 = metrics_now_us();
+
+    ret = api->kt_produce_keyed_sync(api->producer, msg, msglen, topic, key, keylen, kafka_partition, XSYNC_KAFKA_DELIVERY_TIMEOUT_MS);
+
+    metrics_histogram_since(xs_client_metrics.kafka_delivery_seconds, t0);
 
     if (ret == KAFKATOOLS_SUCCESS) {
         LOGGER_TRACE("kafkatools_produce_message_sync success: %s", msg);
     } else {
+        metrics_counter_inc(xs_client_metrics.kafka_errors);
+
         LOGGER_ERROR("kafkatools_produce_message_sync fail: %s", api->kt_producer_get_errstr(api->producer));
     }
 
@@ -144,6 +161,370 @@ static int send_kafka_message(kafkatools_producer_api_t *api, const char *kafka_
 }
 
 
+/**
+ * 按行发送文件新增的内容到 kafka (异步). 返回发送的行数, 失败返回 -1
+ */
+static int send_kafka_lines(kafkatools_producer_api_t *api, kt_tailer tailer, const char *kafka_topic, int kafka_partition, const char *pathfile)
+{
+    int lines;
+
+    kt_topic topic = api->kt_get_topic(api->producer, kafka_topic);
+
+    if (! topic) {
+        LOGGER_ERROR("no topic: %s", api->kt_producer_get_errstr(api->producer));
+        return (-1);
+    }
+
+    lines = api->kt_tail_file(tailer, api->producer, topic, kafka_partition, pathfile);
+
+    if (lines < 0) {
+        metrics_counter_inc(xs_client_metrics.kafka_errors);
+
+        LOGGER_ERROR("kafkatools_tail_file fail: %s", api->kt_producer_get_errstr(api->producer));
+        return (-1);
+    }
+
+    metrics_counter_add(xs_client_metrics.kafka_lines, lines);
+
+    LOGGER_TRACE("kafkatools_tail_file success: %d lines (%s)", lines, pathfile);
+
+    return lines;
+}
+
+
+/**
+ * 重放日志中没有确认的事件消息 (同步发送): 启动时, 和运行期间后台重试.
+ *   返回 0 表示投递成功
+ */
+static int on_kafka_replay (const xs_event_pending_t *pending, void *arg)
+{
+    char topic[256];
+
+    perthread_data *perdata = (perthread_data *) arg;
+
+    if (pending->topiclen <= 0 || pending->topiclen >= (int) sizeof(topic)) {
+        LOGGER_ERROR("invalid topic in journal: seq=%"PRIu64, pending->seq);
+        return (-1);
+    }
+
+    memcpy(topic, pending->topic, pending->topiclen);
+    topic[pending->topiclen] = 0;
+
+    LOGGER_DEBUG("replay event to kafka (%s:%d): seq=%"PRIu64" key=%.*s", topic, pending->partition,
+        pending->seq, pending->keylen, pending->key);
+
+    return send_kafka_message(&perdata->kt_producer_api, topic, pending->partition,
+        pending->key, pending->keylen, pending->msg, pending->msglen);
+}
+
+
+/**
+ * 客户端在 watch 目录下的状态文件: watch/<clientid><suffix>
+ */
+static char * client_watch_file (XS_client client, const char *suffix, char *pathbuf)
+{
+    memcpy(pathbuf, client->apphome, client->apphome_len);
+    pathbuf[client->apphome_len] = 0;
+
+    *strrchr(pathbuf, '/') = '\0';
+    *strrchr(pathbuf, '/') = '\0';
+
+    strcat(pathbuf, "/watch/");
+    strcat(pathbuf, client->clientid);
+    strcat(pathbuf, suffix);
+
+    return pathbuf;
+}
+
+
+/**
+ * 按行发送的文件的确认偏移前进 (投递报告之后)
+ */
+static void on_kafka_lines_committed (const char *pathfile, int64_t offset, void *arg)
+{
+    LOGGER_DEBUG("kafka lines committed: offset=%"PRId64" (%s)", offset, pathfile);
+}
+
+
+/**
+ * 没有事件时处理 kafka 投递报告, 使按行发送的文件偏移及时确认
+ */
+static void client_kafka_poll (XS_client client)
+{
+    int i;
+
+    if (client->kafka_tailer) {
+        for (i = 0; i < client->threads; ++i) {
+            perthread_data *perdata = (perthread_data *) client->thread_args[i];
+
+            if (perdata->kafka_producer_ready) {
+                perdata->kt_producer_api.kt_producer_poll(perdata->kt_producer_api.producer, 0);
+            }
+        }
+    }
+}
+
+
+/**
+ * 重新加载脚本, 不重启监视: 先创建全部新的脚本环境, 任何一个失败都保留旧的脚本.
+ *   过滤环境在写锁内替换 (等待正在过滤的批次); 工作线程的新环境通过 luactx_next 发布,
+ *   工作线程在处理下一个事件之前换用. kafka producer 不重新创建 (kafka_config 不重新调用)
+ */
+static int client_lua_reload (XS_client client, const char *events_lua)
+{
+    int i, filter_files, filter_ffi;
+
+    lua_context luactx, *luactx_next;
+
+    uint64_t t0 = metrics_now_us();
+
+    luactx = XS_client_filter_luactx_create(events_lua, &filter_files, &filter_ffi);
+    if (! luactx) {
+        return 0;
+    }
+
+    luactx_next = (lua_context *) mem_alloc_zero(client->threads, sizeof(lua_context));
+
+    for (i = 0; i < client->threads; ++i) {
+        luactx_next[i] = perthread_luactx_create(i + 1, events_lua);
+
+        if (! luactx_next[i]) {
+            while (i-- > 0) {
+                LuaCtxFree(&luactx_next[i]);
+            }
+
+            mem_free(luactx_next);
+            LuaCtxFree(&luactx);
+            return 0;
+        }
+    }
+
+    // 替换过滤环境
+    pthread_rwlock_wrlock(&client->luactx_lock);
+    do {
+        lua_context old = client->luactx;
+
+        client->luactx = luactx;
+        client->lua_filter_files = filter_files;
+        client->lua_filter_ffi = filter_ffi;
+
+        luactx = old;
+    } while (0);
+    pthread_rwlock_unlock(&client->luactx_lock);
+
+    LuaCtxFree(&luactx);
+
+    // 发布工作线程的新环境
+    for (i = 0; i < client->threads; ++i) {
+        perthread_data *perdata = (perthread_data *) client->thread_args[i];
+
+        // 工作线程还没有换用的上一次的新环境
+        lua_context stale = __interlock_set(&perdata->luactx_next, luactx_next[i]);
+
+        LuaCtxFree(&stale);
+    }
+
+    mem_free(luactx_next);
+
+    LOGGER_NOTICE("lua scripts reloaded in %"PRIu64" us: %s", metrics_now_us() - t0, events_lua);
+
+    return 1;
+}
+
+
+/**
+ * 检查脚本: 脚本文件修改 (每 XSYNC_LUA_RELOAD_CHECK_MS 检查一次) 或者
+ *   filter_file 返回 RELOAD 时重新加载. 只在 inotify 线程调用
+ */
+static void client_lua_poll (XS_client client)
+{
+    int reload;
+    uint64_t now_us;
+    const char *changed = 0;
+
+    char events_lua[PATH_MAX];
+
+    if (! client->luactx) {
+        return;
+    }
+
+    reload = (client->lua_reload? __interlock_set(&client->lua_reload, 0) : 0);
+
+    now_us = metrics_now_us();
+
+    if (! reload) {
+        if (now_us < client->lua_check_us) {
+            return;
+        }
+
+        client->lua_check_us = now_us + XSYNC_LUA_RELOAD_CHECK_MS * 1000;
+
+        // client->luactx 只在本线程替换, 检查脚本文件不需要锁
+        if (! LuaCtxScriptChanged(client->luactx, &changed)) {
+            return;
+        }
+
+        LOGGER_NOTICE("lua script changed: %s", changed);
+    } else {
+        LOGGER_NOTICE("lua script reload requested by filter");
+    }
+
+    snprintf(events_lua, sizeof(events_lua), "%sevents-filter.lua", client->watch_config);
+
+    if (client_lua_reload(client, events_lua)) {
+        metrics_counter_inc(xs_client_metrics.lua_reloads);
+    } else {
+        metrics_counter_inc(xs_client_metrics.lua_reload_errors);
+
+        LOGGER_ERROR("lua scripts reload fail, keep using old scripts: %s", events_lua);
+
+        // 脚本再次修改之前不重试
+        LuaCtxScriptRefresh(client->luactx);
+    }
+}
+
+
+/**
+ * 解析 sid 列表: "1,2,5". 忽略没有连接的 sid. 返回 sid 的数目
+ */
+static int parse_sid_list (perthread_data *perdata, const char *sidlist, int sids[])
+{
+    int sid, nsids = 0;
+
+    int sidmax = pv_cast_to_int(perdata->server_conns[0]);
+
+    const char *p = sidlist;
+
+    while (p && *p) {
+        sid = atoi(p);
+
+        if (sid > 0 && sid <= sidmax && perdata->server_conns[sid] && nsids < XSYNC_SERVER_MAXID) {
+            sids[nsids++] = sid;
+        }
+
+        p = strchr(p, ',');
+        if (p) {
+            p++;
+        }
+    }
+
+    return nsids;
+}
+
+
+/**
+ * 默认的 sid 列表: 全部有连接的服务器. 返回 sid 的数目
+ */
+static int default_sid_list (perthread_data *perdata, int sids[])
+{
+    int sid, nsids = 0;
+
+    int sidmax = pv_cast_to_int(perdata->server_conns[0]);
+
+    for (sid = 1; sid <= sidmax && nsids < XSYNC_SERVER_MAXID; sid++) {
+        if (perdata->server_conns[sid]) {
+            sids[nsids++] = sid;
+        }
+    }
+
+    return nsids;
+}
+
+
+/**
+ * 同步文件到多个服务器: 文件只读一次, 各服务器独立推进.
+ *   条目先向全部服务器提交注册再逐个等待, 同时提交的注册 (其他工作线程,
+ *   sweep) 合并为每个服务器一个 XLGB
+ */
+static void sync_file_to_servers (perthread_data *perdata, XS_client client, const char *pathfile, const int sids[], int nsids, watch_event_regs_t *entryregs, evtrace_rec_t *trace)
+{
+    int i, fd, remaining;
+
+    struct stat sb;
+
+    XSLogBatchEntry_t entry;
+    XS_entry_reg regs[XSYNC_SERVER_MAXID];
+
+    xs_fanout_t *fanout;
+
+    fd = open(pathfile, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1) {
+        LOGGER_ERROR("open error(%d): %s. (%s)", errno, strerror(errno), pathfile);
+        return;
+    }
+
+    if (fstat(fd, &sb) == -1 || ! S_ISREG(sb.st_mode)) {
+        close(fd);
+        return;
+    }
+
+    bzero(&entry, sizeof(entry));
+    entry.modtime = (ub8) sb.st_mtime;
+    entry.filesize = (ub8) sb.st_size;
+
+    fanout = XS_fanout_create(fd, (ub8) sb.st_size, pathfile);
+
+    XS_fanout_set_progress(fanout, client->sync_progress, entry.modtime);
+
+    for (i = 0; i < nsids; i++) {
+        if (entryregs && sids[i] <= entryregs->sidmax && entryregs->regs[sids[i]]) {
+            // sweep 已经提交: 取得注册的引用
+            regs[i] = entryregs->regs[sids[i]];
+            entryregs->regs[sids[i]] = 0;
+        } else {
+            regs[i] = XS_server_conn_register(perdata->server_conns[sids[i]], &entry, pathfile);
+        }
+    }
+
+    for (i = 0; i < nsids; i++) {
+        ub8 offset = 0;
+
+        // 由服务端 (XLGB) 分配条目 ID
+        ub8 entryid = XS_server_conn_register_wait(perdata->server_conns[sids[i]], regs[i], XSYNC_FANOUT_REQUEST_MS);
+
+        XS_entry_reg_release(regs[i]);
+
+        if (! entryid) {
+            LOGGER_WARN("server-%d: register entry failed (%s)", sids[i], pathfile);
+            continue;
+        }
+
+        // 断点续传: 文件没有改变时从上次确认的偏移开始
+        if (client->sync_progress &&
+            XS_sync_progress_get(client->sync_progress, sids[i], entryid, entry.filesize, entry.modtime, &offset) &&
+            offset == entry.filesize) {
+            LOGGER_DEBUG("server-%d: already synced %ju bytes (%s)", sids[i], offset, pathfile);
+            continue;
+        }
+
+        XS_fanout_add_target(fanout, sids[i], perdata->server_conns[sids[i]], entryid, offset);
+    }
+
+    evtrace_stamp(trace, EVTRACE_SEND);
+
+    remaining = XS_fanout_run(fanout, XSYNC_FANOUT_STALL_MS);
+
+    evtrace_stamp(trace, EVTRACE_ACK);
+
+    for (i = 0; i < fanout->ntargets; i++) {
+        xs_fanout_target_t *target = &fanout->targets[i];
+
+        if (target->state == XS_FANOUT_DONE) {
+            LOGGER_DEBUG("server-%d: synced %ju bytes (%s)", target->sid, target->acked, pathfile);
+        } else {
+            LOGGER_WARN("server-%d: pending at offset=%ju/%ju (%s)", target->sid, target->acked, fanout->endpos, pathfile);
+        }
+    }
+
+    LOGGER_DEBUG("fanout %s: targets=%d remaining=%d reads=%ju skipped=%ju chunks (%ju bytes)", pathfile, fanout->ntargets, remaining,
+        fanout->reads, fanout->chunks_skipped, fanout->bytes_skipped);
+
+    XS_fanout_free(fanout);
+
+    close(fd);
+}
+
+
 static void do_event_task (thread_context_t *thread_ctx)
 {
     threadpool_task_t *task = thread_ctx->task;
@@ -155,16 +536,41 @@ static void do_event_task (thread_context_t *thread_ctx)
         char *message;
 
         char *kafka_topic;
-        int partition = 0;
 
-        // TODO:
-        int sid = 0;
+        // 默认按 key (clientid|pathid|route) 选择分区, 同一个目录的事件有序
+        int partition = RD_KAFKA_PARTITION_UA;
+
+        // 1: 按行发送文件的新增内容, 而不是事件消息
+        int kafka_lines = 0;
+
+        uint64_t t0 = metrics_now_us();
+
+        // 事件路由到的服务器
+        int sids[XSYNC_SERVER_MAXID];
+        int nsids;
 
         perthread_data *perdata = (perthread_data *) thread_ctx->thread_arg;
         XS_client client = (XS_client) perdata->xclient;
 
-        red_black_node_t *node = (red_black_node_t *) task->argument;
-        XS_watch_event event = (XS_watch_event) node->object;
+        XS_watch_event event = (XS_watch_event) task->argument;
+
+        evtrace_stamp(event->trace, EVTRACE_WORKER);
+
+        if (perdata->luactx_next) {
+            // 脚本已经重新加载: 在两个事件之间换用新的脚本环境
+            lua_context luactx_next = __interlock_set(&perdata->luactx_next, 0);
+
+            if (luactx_next) {
+                LuaCtxFree(&perdata->luactx);
+                perdata->luactx = luactx_next;
+
+                LOGGER_DEBUG("[thread-%d] lua context reloaded", perdata->threadid);
+            }
+        }
+
+        // 事件记录: 字段引用 v_* 缓冲区和 pathname, 不复制
+        evrecord_t rec;
+        struct timeval tv;
 
         bzero(perdata->buffer, sizeof(perdata->buffer));
 
@@ -175,33 +581,26 @@ static void do_event_task (thread_context_t *thread_ctx)
         char *v_event =  v_event_buf(perdata);
         char *v_clientid =  v_clientid_buf(perdata);
         char *v_pathid =  v_pathid_buf(perdata);
-        char *v_file =  v_file_buf(perdata);
         char *v_route =  v_route_buf(perdata);
-        char *v_path =  v_path_buf(perdata);
         char *v_eventmsg =  v_eventmsg_buf(perdata);
 
+        // 事件所在的目录 (以 '/' 结尾)
+        char pathname[PATH_MAX];
+
+        if (watch_event_pathname(client->pathtab, event, pathname, sizeof(pathname)) <= 0) {
+            LOGGER_FATAL("should never run to this: invalid event pathid(=%u)", event->pathid);
+            exit(-10);
+        }
+
         ok = 0;
 
         __inotifytools_lock();
         {
-            if (xs_client_find_wpath_inlock(client, event->pathname,
+            if (xs_client_find_wpath_inlock(client, pathname,
                 perdata->buffer, sizeof(perdata->buffer),
                 v_clientid, v_clientid_cb(perdata),
                 v_pathid, v_pathid_cb(perdata),
                 v_route, v_route_cb(perdata)) != -1) {
-                /**
-                 * 查找路由成功, 设置字段值
-                 */
-                snprintf(v_type_buf(perdata), v_type_cb(perdata), "%d", task->flags);
-
-                now_time_str(v_time_buf(perdata), v_time_cb(perdata));
-
-                snprintf(v_thread, v_thread_cb(perdata), "%d", perdata->threadid);
-                snprintf(v_event, v_event_cb(perdata), "%s", inotifytools_event_to_str_safe(event->mask, v_eventmsg));
-                snprintf(v_file, v_file_cb(perdata), "%s", event->name);
-                snprintf(v_path, v_path_cb(perdata), "%s", event->pathname);
-                snprintf(v_sid, v_sid_cb(perdata), "%d", sid);
-
                 // 默认的 kafka 消息
                 kafka_topic = v_pathid;
 
@@ -215,38 +614,91 @@ static void do_event_task (thread_context_t *thread_ctx)
             exit(-10);
         }
 
+        /**
+         * 查找路由成功, 设置字段值. 字符串字段只在调用脚本时才格式化
+         */
+        gettimeofday(&tv, 0);
+
+        rec.fields = EVRECORD_F_ALL;
+        rec.seq = 0;
+        rec.type = (uint32_t) task->flags;
+        rec.time_us = (uint64_t) tv.tv_sec * 1000000 + (uint64_t) tv.tv_usec;
+        rec.thread = (uint32_t) perdata->threadid;
+        rec.mask = event->mask;
+
+        evrecord_set_str(&rec.clientid, v_clientid, strlen(v_clientid));
+        evrecord_set_str(&rec.pathid, v_pathid, strlen(v_pathid));
+        evrecord_set_str(&rec.path, pathname, strlen(pathname));
+        evrecord_set_str(&rec.file, event->name, event->len? strlen(event->name) : 0);
+        evrecord_set_str(&rec.route, v_route, strlen(v_route));
+
+        if (client->kafka_checkpoint && perdata->kafka_producer_ready) {
+            // 事件序号: 读者按文件去掉重放和重试产生的重复消息
+            rec.seq = XS_event_checkpoint_next_seq(client->kafka_checkpoint);
+        } else {
+            rec.fields &= ~EVRECORD_F_SEQ;
+        }
+
+        nsids = default_sid_list(perdata, sids);
+
         msglen = 0;
         message = 0;
 
         if (perdata->luactx) {
             // 使用脚本过滤事件消息
             if (LuaCtxLockState(perdata->luactx)) {
+                int callret;
+                uint64_t tlua;
+
+                snprintf(v_type, v_type_cb(perdata), "%u", rec.type);
+                snprintf(v_thread, v_thread_cb(perdata), "%u", rec.thread);
+                snprintf(v_event, v_event_cb(perdata), "%s", inotifytools_event_to_str_safe(event->mask, v_eventmsg));
+                evrecord_time_str(rec.time_us, v_time, v_time_cb(perdata));
+
+                for (rec.nsids = 0; rec.nsids < nsids; rec.nsids++) {
+                    rec.sids[rec.nsids] = (uint8_t) sids[rec.nsids];
+                }
+                evrecord_sids_str(&rec, v_sid, v_sid_cb(perdata));
+
                 const char *keys[] = {
                     "type", "time", "clientid", "thread", "sid", "event", "pathid", "path", "file", "route"
                 };
 
                 const char *values[] = {
-                    v_type, v_time, v_clientid, v_thread, v_sid, v_event, v_pathid, v_path, v_file, v_route
+                    v_type, v_time, v_clientid, v_thread, v_sid, v_event, v_pathid, pathname, (event->len? event->name : ""), v_route
                 };
 
-                if (LuaCtxCallMany(perdata->luactx, "on_event_task", keys, values, sizeof(keys)/sizeof(keys[0])) == LUACTX_SUCCESS) {
+                tlua = metrics_now_us();
+                callret = LuaCtxCallMany(perdata->luactx, "on_event_task", keys, values, sizeof(keys)/sizeof(keys[0]));
+                metrics_histogram_since(xs_client_metrics.lua_task_seconds, tlua);
+
+                evtrace_stamp(event->trace, EVTRACE_LUA);
+
+                if (callret == LUACTX_SUCCESS) {
                     char *result;
 
                     if (LuaCtxGetValueByKey(perdata->luactx, "result", 6, &result) && !strcmp(result, "SUCCESS")) {
                         // 得到用户处理后的消息
                         msglen = LuaCtxGetValueByKey(perdata->luactx, "message", 7, &message);
 
+                        // 用户指定同步到哪些服务器, 例如: sids = "1,3"
+                        if (LuaCtxGetValueByKey(perdata->luactx, "sids", 4, &result)) {
+                            nsids = parse_sid_list(perdata, result, sids);
+                        }
+
                         if (perdata->kafka_producer_ready) {
                             // 如果要求写入 kafka, 取得当前文件的 kafka 配置: topic, partition
                             if (LuaCtxGetValueByKey(perdata->luactx, "kafka_partition", 15, &result)) {
                                 partition = atoi(result);
-                            } else {
-                                LOGGER_WARN("using default kafka partition: %d", partition);
                             }
 
                             if (! LuaCtxGetValueByKey(perdata->luactx, "kafka_topic", 11, &kafka_topic)) {
                                 LOGGER_WARN("using default kafka topic: %s", kafka_topic);
                             }
+
+                            if (LuaCtxGetValueByKey(perdata->luactx, "kafka_lines", 11, &result)) {
+                                kafka_lines = (atoi(result) == 1);
+                            }
                         }
                     } else {
                         LOGGER_WARN("on_event_task() result not SUCCESS");
@@ -259,9 +711,17 @@ static void do_event_task (thread_context_t *thread_ctx)
             }
         }
 
+        // 消息中的 sid 列表是最终路由到的服务器
+        for (rec.nsids = 0; rec.nsids < nsids; rec.nsids++) {
+            rec.sids[rec.nsids] = (uint8_t) sids[rec.nsids];
+        }
+
         if (! message) {
-            msglen = snprintf(v_eventmsg, v_eventmsg_cb(perdata), "{%s|%s|%s|%s|%s|%s|%s|%s|%s|%s}",
-                v_type, v_time, v_clientid, v_thread, v_sid, v_event, v_pathid, event->pathname, event->name, v_route);
+            if (perdata->event_format == EVRECORD_FMT_BINARY) {
+                msglen = evrecord_encode(&rec, v_eventmsg, v_eventmsg_cb(perdata));
+            } else {
+                msglen = evrecord_format(&rec, perdata->event_format, v_eventmsg, v_eventmsg_cb(perdata));
+            }
 
             if (msglen > 0 && msglen < v_eventmsg_cb(perdata)) {
                 message = v_eventmsg;
@@ -272,24 +732,121 @@ static void do_event_task (thread_context_t *thread_ctx)
         }
 
         if (perdata->kafka_producer_ready) {
-            // 发送消息到 kafka (同步)
-            LOGGER_DEBUG("send event to kafka (%s:%d)", kafka_topic, partition);
+            if (kafka_lines && client->kafka_tailer) {
+                // 文件新增的行发送到 kafka (异步), 投递报告之后确认偏移
+                if (event->len && ! (event->mask & IN_ISDIR)) {
+                    char pathfile[XSYNC_PATHFILE_MAXLEN + 1];
+
+                    if (snprintf(pathfile, sizeof(pathfile), "%s%s", pathname, event->name) < (int) sizeof(pathfile)) {
+                        LOGGER_DEBUG("send lines to kafka (%s:%d): %s", kafka_topic, partition, pathfile);
+
+                        send_kafka_lines(&perdata->kt_producer_api, client->kafka_tailer, kafka_topic, partition, pathfile);
+                    }
+                }
+            } else {
+                // 消息的 key: 同一个 key 的消息在同一个分区
+                char kafka_key[XSYNC_PATHFILE_MAXLEN + 1];
+
+                int keylen = snprintf(kafka_key, sizeof(kafka_key), "%.*s|%.*s|%.*s",
+                    (int) rec.clientid.len, rec.clientid.str,
+                    (int) rec.pathid.len, rec.pathid.str,
+                    (int) rec.route.len, rec.route.str);
+
+                if (keylen >= (int) sizeof(kafka_key)) {
+                    keylen = (int) sizeof(kafka_key) - 1;
+                }
+
+                if (rec.seq) {
+                    // 发送之前写入日志: 没有确认的消息在重启之后重放
+                    char filekey[XSYNC_PATHFILE_MAXLEN + 1];
 
-            send_kafka_message(&perdata->kt_producer_api, kafka_topic, partition, message, msglen);
+                    xs_event_pending_t pending;
+
+                    int filekeylen = snprintf(filekey, sizeof(filekey), "%.*s|%s%s",
+                        (int) rec.pathid.len, rec.pathid.str, pathname, (event->len? event->name : ""));
+
+                    if (filekeylen >= (int) sizeof(filekey)) {
+                        filekeylen = (int) sizeof(filekey) - 1;
+                    }
+
+                    pending.seq = rec.seq;
+                    pending.time_us = rec.time_us;
+                    pending.partition = partition;
+                    pending.topic = kafka_topic;
+                    pending.topiclen = (int) strlen(kafka_topic);
+                    pending.key = kafka_key;
+                    pending.keylen = keylen;
+                    pending.filekey = filekey;
+                    pending.filekeylen = filekeylen;
+                    pending.msg = message;
+                    pending.msglen = msglen;
+
+                    XS_event_checkpoint_pending(client->kafka_checkpoint, &pending);
+                }
+
+                // 发送消息到 kafka (同步)
+                LOGGER_DEBUG("send event to kafka (%s:%d): key=%s", kafka_topic, partition, kafka_key);
+
+                if (send_kafka_message(&perdata->kt_producer_api, kafka_topic, partition, kafka_key, keylen, message, msglen) == KAFKATOOLS_SUCCESS) {
+                    if (rec.seq) {
+                        XS_event_checkpoint_delivered(client->kafka_checkpoint, rec.seq);
+                    }
+                }
+            }
         }
 
-        // 发送消息到日志文件. TODO: 得到 loglevel
-        LOGGER_DEBUG("event(%d)=%s", msglen, message);
+#ifndef LOGGER_DEBUG_DISABLED
+        // 发送消息到日志文件. 二进制消息按文本格式输出. TODO: 得到 loglevel
+        if (message == v_eventmsg && perdata->event_format == EVRECORD_FMT_BINARY) {
+            char textmsg[XSYNC_PATHFILE_MAXLEN * 2];
+
+            if (evrecord_format(&rec, EVRECORD_FMT_TEXT, textmsg, sizeof(textmsg)) > 0) {
+                LOGGER_DEBUG("event(%d)=%s", msglen, textmsg);
+            }
+        } else {
+            LOGGER_DEBUG("event(%d)=%s", msglen, message);
+        }
+#endif
+
+        if (client->bench) {
+            // null sink
+            nsids = 0;
+        }
+
+        if (nsids && event->len && ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) || event->entryregs) && ! (event->mask & IN_ISDIR)) {
+            char pathfile[XSYNC_PATHFILE_MAXLEN + 1];
+
+            if (snprintf(pathfile, sizeof(pathfile), "%s%s", pathname, event->name) < (int) sizeof(pathfile)) {
+                sync_file_to_servers(perdata, client, pathfile, sids, nsids, event->entryregs, event->trace);
+            }
+        }
 
         // 使用完毕必须删除 !!
         event_rbtree_lock();
         {
-            node->object = 0;
-            watch_event_free(event);
-
-            rbtree_remove_at(&client->event_rbtree, node);
+            event_rbtree_erase(&client->event_rbtree, event);
         }
         event_rbtree_unlock();
+
+        // 跟踪记录写入 ring 文件
+        evtrace_end(event->trace);
+        event->trace = 0;
+
+        watch_event_free(client->pathtab, event);
+
+        metrics_histogram_since(xs_client_metrics.event_task_seconds, t0);
+    } else if (task->flags == 101) {
+        // 后台重试: 用这个工作线程的 producer 重新发送投递失败的事件消息
+        perthread_data *perdata = (perthread_data *) thread_ctx->thread_arg;
+        XS_client client = (XS_client) task->argument;
+
+        if (perdata->kafka_producer_ready && client->kafka_checkpoint) {
+            metrics_counter_add(xs_client_metrics.kafka_replayed,
+                XS_event_checkpoint_retry(client->kafka_checkpoint, XSYNC_KAFKA_DELIVERY_TIMEOUT_MS * 2,
+                    XSYNC_KAFKA_RETRY_BATCH, on_kafka_replay, (void *) perdata));
+        }
+
+        __interlock_set(&client->kafka_retry_queued, 0);
     } else {
         LOGGER_ERROR("unknown event task flags(=%d)", task->flags);
     }
@@ -303,52 +860,75 @@ __no_warning_unused(static)
 XS_RESULT client_add_inotify_event (XS_client client, struct watch_event_buf_t *evbuf)
 {
     int result;
-    red_black_node_t *node;
+    XS_watch_event event;
+    struct rb_node *parent;
+    struct rb_node **link;
 
     if (XS_client_threadpool_unused_queues(client) < 1) {
         LOGGER_WARN("threadpool queues is full");
         return XS_E_POOL;
     }
 
-    result = XS_ERROR;
-
     event_rbtree_lock();
 
-    node = rbtree_find(&client->event_rbtree, evbuf);
+    // 一次查找同时得到插入位置
+    event = event_rbtree_lookup(&client->event_rbtree, evbuf, &parent, &link);
 
-    if (node) {
+    if (event) {
         event_rbtree_unlock();
 
-        LOGGER_WARN("existing node(=%p)", node);
+        metrics_counter_inc(xs_client_metrics.events_coalesced);
+
+        // 合并的事件不跟踪
+        evtrace_free(evbuf->trace);
+        evbuf->trace = 0;
+
+        watch_event_buf_drop_entryregs(evbuf);
+
+        LOGGER_WARN("existing event(=%p)", event);
         return XS_SUCCESS;
-    } else {
-        int is_new_node;
+    }
 
-        XS_watch_event newevent = watch_event_clone((const watch_event_t *) evbuf);
+    // 目录路径只保存一份, 事件引用它的 id
+    evbuf->pathid = pathtab_intern_path(client->pathtab, evbuf->pathname, evbuf->pathlen);
 
-        node = rbtree_insert_unique(&client->event_rbtree, (void *)newevent, &is_new_node);
-        if (node) {
-            if (is_new_node) {
-                result = threadpool_add(client->pool, do_event_task, (void*)node, 100);
+    if (evbuf->pathid == PATHTAB_NONE) {
+        event_rbtree_unlock();
 
-                if (result) {
-                    LOGGER_ERROR("threadpool_add node(=%p) fail: %s", node, threadpool_error_messages[-result]);
-                    node->object = 0;
-                    watch_event_free(newevent);
-                    rbtree_remove_at(&client->event_rbtree, node);
-                    result = XS_E_POOL;
-                } else {
-                    //!-- LOGGER_DEBUG("threadpool_add node(=%p) success", node);
-                    result = XS_SUCCESS;
-                }
-            } else {
-                LOGGER_ERROR("should never run to this: rbtree_insert_unique existed");
-                watch_event_free(newevent);
-            }
-        } else {
-            LOGGER_ERROR("should never run to this: rbtree_insert_unique unexpected");
-            watch_event_free(newevent);
-        }
+        evtrace_free(evbuf->trace);
+        evbuf->trace = 0;
+
+        watch_event_buf_drop_entryregs(evbuf);
+
+        LOGGER_ERROR("pathtab_intern_path fail: %s", evbuf->pathname);
+        return XS_E_OUTMEM;
+    }
+
+    // 不存在时才复制事件, 节点嵌入在事件中
+    event = watch_event_clone(evbuf);
+
+    event_rbtree_link(&client->event_rbtree, event, parent, link);
+
+    // 跟踪记录随事件交给工作线程, 必须在 threadpool_add 之前记录
+    evtrace_stamp(event->trace, EVTRACE_ENQUEUE);
+
+    result = threadpool_add(client->pool, do_event_task, (void*) event, 100);
+
+    if (result) {
+        LOGGER_ERROR("threadpool_add event(=%p) fail: %s", event, threadpool_error_messages[-result]);
+        event_rbtree_erase(&client->event_rbtree, event);
+
+        // 跟踪记录和注册仍属于 evbuf, 重试时使用
+        event->trace = 0;
+        event->entryregs = 0;
+        watch_event_free(client->pathtab, event);
+        result = XS_E_POOL;
+    } else {
+        //!-- LOGGER_DEBUG("threadpool_add event(=%p) success", event);
+        metrics_counter_inc(xs_client_metrics.events_dispatched);
+        evbuf->trace = 0;
+        evbuf->entryregs = 0;
+        result = XS_SUCCESS;
     }
 
     event_rbtree_unlock();
@@ -421,130 +1001,481 @@ int filter_watch_path (XS_client client, const char *path, char pathbuf[PATH_MAX
         }
     }
 
-    // 调用外部脚本, 过滤监视路径
-    ret = FILTER_WPATH_ACCEPT;
+    // 调用外部脚本, 过滤监视路径
+    ret = FILTER_WPATH_ACCEPT;
+
+    do {
+        lua_context luactx = client_luactx_lock(client);
+
+        if (luactx) {
+            LuaCtxCall(luactx, "filter_path", "path", abspath);
+
+            // TODO: ret
+
+            client_luactx_unlock(client, luactx);
+        }
+    } while (0);
+
+    if (ret == FILTER_WPATH_ACCEPT) {
+        // 接受目录
+        LOGGER_DEBUG("ACCEPT(=%d): %s", ret, abspath);
+
+        wd = inotifytools_wd_from_filename_s(abspath);
+        if (wd < 1) {
+            // 接受的监视目录不存在, 只修复这个目录, 本次不再递归
+            LOGGER_ERROR("path not in watch: %s -> %s", client->watch_config, abspath);
+
+            XS_watch_repair_add(client->watch_repair, WATCH_REPAIR_ADD, abspath);
+            return 0;
+        }
+        return wd;
+    }
+
+    if (ret == FILTER_WPATH_REJECT) {
+        // 拒绝目录
+        LOGGER_DEBUG("REJECT(=%d): %s", ret, abspath);
+
+        wd = inotifytools_wd_from_filename_s(abspath);
+        if (wd > 0) {
+            // 拒绝的监视目录存在, 删除监视
+            if (inotifytools_remove_watch_by_wd_s(wd)) {
+                // 移除监视成功, 不再递归
+                LOGGER_INFO("remove watch path(wd=%d) ok: %s", wd, abspath);
+                return 0;
+            } else {
+                // 移除监视失败, 稍后重试
+                LOGGER_ERROR("remove watch path(wd=%d) failed: %s", wd, abspath);
+
+                XS_watch_repair_add(client->watch_repair, WATCH_REPAIR_REMOVE, abspath);
+                return 0;
+            }
+        }
+
+        // 拒绝目录已经被移除监视, 不再递归
+        return 0;
+    }
+
+    if (ret == FILTER_WPATH_RELOAD) {
+        // 重新同步监视
+        LOGGER_DEBUG("RELOAD(=%d): %s", ret, abspath);
+        return (-1);
+    }
+
+    LOGGER_ERROR("UNEXPECTED(=%d): %s", ret, abspath);
+    return 0;
+}
+
+
+/**
+ * 文件名包含非法字符返回 1
+ */
+__no_warning_unused(static)
+int filter_illegal_name (XS_client client, const char *name, int len)
+{
+    int i;
+    char ch;
+
+    char *p = client->illegal_name_chars;
+
+    if ( *p ) {
+        for (i = 0; i < len; i++) {
+            ch = name[i];
+
+            p = client->illegal_name_chars + 1;
+
+            while (*p) {
+                if (ch == *p++) {
+                    metrics_counter_inc(xs_client_metrics.events_filtered);
+
+                    LOGGER_WARN("illegal file: '%s'", name);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * 脚本返回的结论 (result):
+ *   "SUCCESS", "ACCEPT" - 接受
+ *   "REJECT"            - 拒绝
+ *   "RELOAD"            - 拒绝, 并且重新加载脚本 (不重启监视)
+ * 没有结论或者脚本出错时接受文件, 不因为脚本错误丢失事件
+ */
+__no_warning_unused(static)
+int filter_file_verdict (const char *verdict)
+{
+    if (! verdict || ! strcmp(verdict, "SUCCESS") || ! strcmp(verdict, "ACCEPT")) {
+        return FILTER_WPATH_ACCEPT;
+    }
+
+    if (! strcmp(verdict, "REJECT")) {
+        return FILTER_WPATH_REJECT;
+    }
+
+    if (! strcmp(verdict, "RELOAD")) {
+        return FILTER_WPATH_RELOAD;
+    }
+
+    LOGGER_WARN("filter result not expected: %s", verdict);
+    return FILTER_WPATH_ACCEPT;
+}
+
+
+/**
+ * 返回值:
+ *   1: 接受
+ *   0: 拒绝
+ *  -1: 拒绝并且重新加载脚本
+ */
+__no_warning_unused(static)
+int filter_file_retcode (const struct watch_event_buf_t *evbuf, int retcode)
+{
+    if (retcode == FILTER_WPATH_ACCEPT) {
+        LOGGER_DEBUG("ACCEPT(=%d): {%s%s}", retcode, evbuf->pathname, evbuf->name);
+        return 1;
+    }
+
+    if (retcode == FILTER_WPATH_REJECT) {
+        metrics_counter_inc(xs_client_metrics.events_filtered);
+
+        LOGGER_DEBUG("REJECT(=%d): {%s%s}", retcode, evbuf->pathname, evbuf->name);
+        return 0;
+    }
+
+    if (retcode == FILTER_WPATH_RELOAD) {
+        LOGGER_WARN("RELOAD(=%d): {%s%s}", retcode, evbuf->pathname, evbuf->name);
+        return (-1);
+    }
+
+    LOGGER_ERROR("UNEXPECTED(=%d): {%s%s}", retcode, evbuf->pathname, evbuf->name);
+    return 0;
+}
+
+
+/**
+ * 逐个过滤文件: luactx 由调用者锁定 (client_luactx_lock), 为 0 时只过滤非法字符
+ */
+__no_warning_unused(static)
+int filter_watch_file (XS_client client, lua_context luactx, struct watch_event_buf_t *evbuf)
+{
+    int retcode = FILTER_WPATH_ACCEPT;
+
+    if (! evbuf->pathname || ! evbuf->name) {
+        LOGGER_ERROR("application error: null name");
+        return 0;
+    }
+
+    // 过滤掉包含非法字符的文件名
+    if (filter_illegal_name(client, evbuf->name, evbuf->len)) {
+        return 0;
+    }
+
+    // 调用脚本过滤文件名
+    if (luactx) {
+        char str_mtime[24];
+        char str_size[24];
+
+        const char *keys[] = {"path", "file", "mtime", "size"};
+        const char *values[] = {evbuf->pathname, evbuf->name, str_mtime, str_size};
+
+        uint64_t tlua = metrics_now_us();
+
+        // 只在调用脚本时格式化为字符串
+        snprintf(str_mtime, sizeof(str_mtime), "%"PRId64"", evbuf->mtime);
+        snprintf(str_size, sizeof(str_size), "%"PRId64"", evbuf->size);
+
+        if (LuaCtxCallMany(luactx, "filter_file", keys, values, sizeof(keys)/sizeof(keys[0])) == LUACTX_SUCCESS) {
+            char *result;
+
+            if (LuaCtxGetValueByKey(luactx, "result", 6, &result)) {
+                retcode = filter_file_verdict(result);
+            }
+        }
+
+        metrics_histogram_since(xs_client_metrics.lua_filter_seconds, tlua);
+        metrics_counter_inc(xs_client_metrics.lua_filter_files);
+    }
+
+    return filter_file_retcode(evbuf, retcode);
+}
+
+
+/**
+ * 成批过滤文件 (LuaJIT FFI): 脚本 filter_files_ffi 直接读批次中的事件,
+ *   结论写入预先分配的 outs, 不创建 lua 字符串和表. luactx 由调用者锁定
+ */
+__no_warning_unused(static)
+void filter_watch_files_ffi (XS_client client, lua_context luactx, watch_event_batch_t *batch, int results[])
+{
+    int i, retcode;
+
+    watch_filter_out_t outs[XSYNC_FILTER_BATCH_MAXNUM];
+
+    for (i = 0; i < batch->count; i++) {
+        // 过滤掉包含非法字符的文件名. 这些事件仍然在批次中, 结论被忽略
+        results[i] = (filter_illegal_name(client, batch->events[i].name, batch->events[i].len)? 0 : 1);
+
+        outs[i].verdict = FILTER_WPATH_ACCEPT;
+        outs[i].msglen = 0;
+        outs[i].message[0] = 0;
+    }
+
+    do {
+        uint64_t tlua = metrics_now_us();
+
+        if (LuaCtxCallFFI(luactx, "filter_files_ffi", batch->events, outs, batch->count) != LUACTX_SUCCESS) {
+            LOGGER_WARN("LuaCtxCallFFI fail: %s", LuaCtxGetError(luactx));
+
+            // 脚本出错时接受全部文件
+            for (i = 0; i < batch->count; i++) {
+                outs[i].verdict = FILTER_WPATH_ACCEPT;
+                outs[i].msglen = 0;
+            }
+        }
+
+        metrics_histogram_since(xs_client_metrics.lua_filter_seconds, tlua);
+        metrics_counter_add(xs_client_metrics.lua_filter_files, batch->count);
+    } while (0);
+
+    for (i = 0; i < batch->count; i++) {
+        if (! results[i]) {
+            continue;
+        }
+
+        if (outs[i].msglen > 0) {
+            LOGGER_DEBUG("filter_files_ffi(%s%s): %.*s", batch->events[i].pathname, batch->events[i].name,
+                (outs[i].msglen < WATCH_FILTER_MESSAGE_MAXLEN? outs[i].msglen : WATCH_FILTER_MESSAGE_MAXLEN), outs[i].message);
+        }
+
+        retcode = outs[i].verdict;
+
+        if (retcode != FILTER_WPATH_ACCEPT && retcode != FILTER_WPATH_REJECT && retcode != FILTER_WPATH_RELOAD) {
+            LOGGER_WARN("filter verdict not expected: %d", retcode);
+            retcode = FILTER_WPATH_ACCEPT;
+        }
+
+        results[i] = filter_file_retcode(&batch->events[i], retcode);
+    }
+}
+
+
+/**
+ * 成批过滤文件 (filter_files): 整批只调用一次脚本. luactx 由调用者锁定
+ */
+__no_warning_unused(static)
+void filter_watch_files_batch (XS_client client, lua_context luactx, watch_event_batch_t *batch, int results[])
+{
+    int i, rows;
+
+    // 交给脚本的事件在批次中的索引
+    int rowindex[XSYNC_FILTER_BATCH_MAXNUM];
+
+    // 脚本的结论, 默认接受
+    int retcodes[XSYNC_FILTER_BATCH_MAXNUM];
+
+    rows = 0;
+
+    // 过滤掉包含非法字符的文件名
+    for (i = 0; i < batch->count; i++) {
+        if (filter_illegal_name(client, batch->events[i].name, batch->events[i].len)) {
+            results[i] = 0;
+        } else {
+            retcodes[rows] = FILTER_WPATH_ACCEPT;
+            rowindex[rows++] = i;
+        }
+    }
+
+    if (! rows) {
+        return;
+    }
+
+    do {
+        // 每个文件 4 个字段: values[i * 4 + k]
+        const char *keys[] = {"path", "file", "mtime", "size"};
+        const char *values[XSYNC_FILTER_BATCH_MAXNUM * 4];
+
+        char str_mtime[XSYNC_FILTER_BATCH_MAXNUM][24];
+        char str_size[XSYNC_FILTER_BATCH_MAXNUM][24];
+
+        uint64_t tlua = metrics_now_us();
+
+        for (i = 0; i < rows; i++) {
+            const struct watch_event_buf_t *evbuf = &batch->events[rowindex[i]];
+
+            snprintf(str_mtime[i], sizeof(str_mtime[i]), "%"PRId64"", evbuf->mtime);
+            snprintf(str_size[i], sizeof(str_size[i]), "%"PRId64"", evbuf->size);
+
+            values[i * 4 + 0] = evbuf->pathname;
+            values[i * 4 + 1] = evbuf->name;
+            values[i * 4 + 2] = str_mtime[i];
+            values[i * 4 + 3] = str_size[i];
+        }
+
+        if (LuaCtxCallBatch(luactx, "filter_files", keys, 4, values, rows) == LUACTX_SUCCESS) {
+            for (i = 0; i < rows; i++) {
+                char *verdict, *message;
+
+                if (LuaCtxGetVerdict(luactx, i, &verdict)) {
+                    retcodes[i] = filter_file_verdict(verdict);
+                }
+
+                if (LuaCtxGetMessage(luactx, i, &message)) {
+                    LOGGER_DEBUG("filter_files(%s%s): %s", batch->events[rowindex[i]].pathname, batch->events[rowindex[i]].name, message);
+                }
+            }
+        } else {
+            LOGGER_WARN("LuaCtxCallBatch fail: %s", LuaCtxGetError(luactx));
+        }
+
+        metrics_histogram_since(xs_client_metrics.lua_filter_seconds, tlua);
+        metrics_counter_add(xs_client_metrics.lua_filter_files, rows);
+    } while (0);
+
+    for (i = 0; i < rows; i++) {
+        results[rowindex[i]] = filter_file_retcode(&batch->events[rowindex[i]], retcodes[i]);
+    }
+}
+
+
+/**
+ * 成批过滤文件, results[i] 是第 i 个事件的结果 (同 filter_watch_file).
+ *   LuaJIT 后端优先调用 filter_files_ffi; 脚本定义了 filter_files 时整批只调用一次脚本,
+ *   否则逐个调用 filter_file. 整批持有同一个脚本环境: 重新加载脚本不会发生在批次中间
+ */
+__no_warning_unused(static)
+void filter_watch_files (XS_client client, watch_event_batch_t *batch, int results[])
+{
+    int i;
+
+    lua_context luactx = client_luactx_lock(client);
+
+    if (luactx && client->lua_filter_ffi) {
+        filter_watch_files_ffi(client, luactx, batch, results);
+    } else if (luactx && client->lua_filter_files) {
+        filter_watch_files_batch(client, luactx, batch, results);
+    } else {
+        for (i = 0; i < batch->count; i++) {
+            results[i] = filter_watch_file(client, luactx, &batch->events[i]);
+        }
+    }
+
+    if (luactx) {
+        client_luactx_unlock(client, luactx);
+    }
+}
+
 
-    if (LuaCtxLockState(client->luactx)) {
-        LuaCtxCall(client->luactx, "filter_path", "path", abspath);
+/**
+ * sweep 接受的文件向每个就绪的服务器提交注册 (不等待). 注册随事件交给
+ *   工作线程, 由第一个等待结果的线程与队列中的其他条目合并发送
+ */
+static void sweep_register_batch (XS_client client, watch_event_batch_t *batch, const int results[])
+{
+    int i, sid, sidmax;
+
+    char pathfile[XSYNC_PATHFILE_MAXLEN + 1];
 
-        // TODO: ret
+    XSLogBatchEntry_t entry;
 
-        LuaCtxUnlockState(client->luactx);
+    sidmax = XS_client_get_server_maxid(client);
+
+    if (client->bench || ! sidmax) {
+        return;
     }
 
-    if (ret == FILTER_WPATH_ACCEPT) {
-        // 接受目录
-        LOGGER_DEBUG("ACCEPT(=%d): %s", ret, abspath);
+    for (i = 0; i < batch->count; i++) {
+        struct watch_event_buf_t *evbuf = &batch->events[i];
 
-        wd = inotifytools_wd_from_filename_s(abspath);
-        if (wd < 1) {
-            // 接受的监视目录不存在, 重启监视
-            LOGGER_ERROR("path not in watch: %s -> %s", client->watch_config, abspath);
-            return (-1);
+        if (results[i] <= 0 ||
+            snprintf(pathfile, sizeof(pathfile), "%s%s", evbuf->pathname, evbuf->name) >= (int) sizeof(pathfile)) {
+            continue;
         }
-        return wd;
-    }
 
-    if (ret == FILTER_WPATH_REJECT) {
-        // 拒绝目录
-        LOGGER_DEBUG("REJECT(=%d): %s", ret, abspath);
+        bzero(&entry, sizeof(entry));
 
-        wd = inotifytools_wd_from_filename_s(abspath);
-        if (wd > 0) {
-            // 拒绝的监视目录存在, 删除监视
-            if (inotifytools_remove_watch_by_wd_s(wd)) {
-                // 移除监视成功, 不再递归
-                LOGGER_INFO("remove watch path(wd=%d) ok: %s", wd, abspath);
-                return 0;
-            } else {
-                // 移除监视失败, 重启监视
-                LOGGER_ERROR("remove watch path(wd=%d) failed: %s", wd, abspath);
-                return (-1);
+        entry.modtime = (ub8) evbuf->mtime;
+        entry.filesize = (ub8) evbuf->size;
+
+        for (sid = 1; sid <= sidmax; sid++) {
+            xs_server_conn_t *sconn = client->server_conns[sid];
+
+            if (! sconn || ! XS_server_conn_is_ready(sconn)) {
+                continue;
             }
-        }
 
-        // 拒绝目录已经被移除监视, 不再递归
-        return 0;
-    }
+            if (! evbuf->entryregs) {
+                evbuf->entryregs = (watch_event_regs_t *) mem_alloc_zero(1, sizeof(watch_event_regs_t) + sizeof(XS_entry_reg) * (sidmax + 1));
+                evbuf->entryregs->sidmax = sidmax;
+            }
 
-    if (ret == FILTER_WPATH_RELOAD) {
-        // 重置
-        LOGGER_DEBUG("RELOAD(=%d): %s", ret, abspath);
-        return (-1);
+            evbuf->entryregs->regs[sid] = XS_server_conn_register(sconn, &entry, pathfile);
+        }
     }
-
-    LOGGER_ERROR("UNEXPECTED(=%d): %s", ret, abspath);
-    return 0;
 }
 
 
+/**
+ * 成批过滤文件事件, 接受的事件加入任务队列 (队列忙时每 retry_ms 重试), 然后清空批次.
+ *   脚本要求 RELOAD 时设置 lua_reload, 由 inotify 线程重新加载脚本
+ */
 __no_warning_unused(static)
-int filter_watch_file (XS_client client, struct watch_event_buf_t *evbuf)
+void client_flush_event_batch (XS_client client, watch_event_batch_t *batch, int retry_ms)
 {
-    int retcode = FILTER_WPATH_ACCEPT;
+    int i, reload = 0;
 
-    char *p = client->illegal_name_chars;
+    int results[XSYNC_FILTER_BATCH_MAXNUM];
 
-    if (! evbuf->pathname || ! evbuf->name) {
-        LOGGER_ERROR("application error: null name");
-        return 0;
+    if (! batch->count) {
+        return;
     }
 
-    // 过滤掉包含非法字符的文件名
-    if ( *p ) {
-        int i;
-        char ch;
-        int illegal = 0;
+    filter_watch_files(client, batch, results);
 
-        for (i = 0; i < evbuf->len; i++) {
-            ch = evbuf->name[i];
+    if (batch == &client->sweep_batch) {
+        // sweep 发现的文件: 每个服务器一个请求批量注册
+        sweep_register_batch(client, batch, results);
+    }
 
-            p = client->illegal_name_chars + 1;
+    for (i = 0; i < batch->count; i++) {
+        struct watch_event_buf_t *evbuf = &batch->events[i];
 
-            while (!illegal && *p) {
-                if (ch == *p++) {
-                    illegal = 1;
-                }
-            }
+        evtrace_stamp(evbuf->trace, EVTRACE_FILTER);
 
-            if (illegal) {
-                LOGGER_WARN("illegal file: '%s'", evbuf->name);
-                return 0;
+        if (results[i] > 0) {
+            // 循环直到添加成功
+            while (client_add_inotify_event(client, evbuf) == XS_E_POOL) {
+                sleep_ms(retry_ms);
+            }
+        } else {
+            if (results[i] == -1) {
+                reload = 1;
             }
-        }
-    }
-
-    // 调用脚本过滤文件名
-    if (LuaCtxLockState(client->luactx)) {
-        const char *keys[] = {"path", "file", "mtime", "size"};
-        const char *values[] = {evbuf->pathname, evbuf->name, evbuf->str_mtime, evbuf->str_size};
-
-        LuaCtxCallMany(client->luactx, "filter_file", keys, values, sizeof(keys)/sizeof(keys[0]));
 
-        // TODO: retcode
+            LOGGER_TRACE("reject file: %s%s", evbuf->pathname, evbuf->name);
+        }
 
-        LuaCtxUnlockState(client->luactx);
-    }
+        if (evbuf->trace) {
+            // 被拒绝的事件丢弃跟踪记录
+            evtrace_free(evbuf->trace);
+            evbuf->trace = 0;
+        }
 
-    if (retcode == FILTER_WPATH_ACCEPT) {
-        LOGGER_DEBUG("ACCEPT(=%d): {%s%s}", retcode, evbuf->pathname, evbuf->name);
-        return 1;
+        watch_event_buf_drop_entryregs(evbuf);
     }
 
-    if (retcode == FILTER_WPATH_REJECT) {
-        LOGGER_DEBUG("REJECT(=%d): {%s%s}", retcode, evbuf->pathname, evbuf->name);
-        return 0;
-    }
+    watch_event_batch_reset(batch);
 
-    if (retcode == FILTER_WPATH_RELOAD) {
-        LOGGER_WARN("RELOAD(=%d): {%s%s}", retcode, evbuf->pathname, evbuf->name);
-        return (-1);
+    if (reload) {
+        // 要求重新加载脚本
+        __interlock_set(&client->lua_reload, 1);
     }
-
-    LOGGER_ERROR("UNEXPECTED(=%d): {%s%s}", retcode, evbuf->pathname, evbuf->name);
-    return 0;
 }
 
+
 /**
  * 返回值:
  *   1: 继续
@@ -559,6 +1490,9 @@ int lscb_sweep_watch_path (const char *path, int pathlen, struct mydirent *myent
 
     char msgbuf[256];
 
+    // 子目录的绝对路径, 同时是 listdir 的缓冲
+    char pathbuf[PATH_MAX];
+
     struct watch_event_buf_t evbuf;
     bzero(&evbuf, sizeof(evbuf));
 
@@ -575,14 +1509,14 @@ int lscb_sweep_watch_path (const char *path, int pathlen, struct mydirent *myent
         // path 是目录
         if (myent->islnk) {
             // path 是目录链接
-            evbuf.wd = filter_watch_path((XS_client) arg1, path, evbuf.pathname);
+            evbuf.wd = filter_watch_path((XS_client) arg1, path, pathbuf);
 
             if (evbuf.wd > 0) {
                 if (arg2) {
                     // 当前子目录不支持符号链接
-                    LOGGER_ERROR("child dir link not supported: %s -> %s", path, evbuf.pathname);
+                    LOGGER_ERROR("child dir link not supported: %s -> %s", path, pathbuf);
                 } else {
-                    listdir(path, evbuf.pathname, sizeof(evbuf.pathname), (listdir_callback_t) lscb_sweep_watch_path, arg1, int_cast_to_pv(evbuf.wd));
+                    listdir(path, pathbuf, sizeof(pathbuf), (listdir_callback_t) lscb_sweep_watch_path, arg1, int_cast_to_pv(evbuf.wd));
                 }
             } else if (evbuf.wd == -1) {
                 client_set_inotify_reload(client, 1);
@@ -591,14 +1525,12 @@ int lscb_sweep_watch_path (const char *path, int pathlen, struct mydirent *myent
         } else {
             // path 是物理目录
             if (arg2) {
-                evbuf.wd = filter_watch_path(client, path, evbuf.pathname);
+                evbuf.wd = filter_watch_path(client, path, pathbuf);
 
                 if (evbuf.wd > 0) {
-                    char * wpath = evbuf.pathname;
-
-                    LOGGER_TRACE("sweep path(wd=%d): %s", evbuf.wd, wpath);
+                    LOGGER_TRACE("sweep path(wd=%d): %s", evbuf.wd, pathbuf);
 
-                    listdir(path, evbuf.pathname, sizeof(evbuf.pathname), (listdir_callback_t) lscb_sweep_watch_path, arg1, int_cast_to_pv(evbuf.wd));
+                    listdir(path, pathbuf, sizeof(pathbuf), (listdir_callback_t) lscb_sweep_watch_path, arg1, int_cast_to_pv(evbuf.wd));
 
                 } else if (evbuf.wd == -1) {
                     client_set_inotify_reload(client, 1);
@@ -614,58 +1546,49 @@ int lscb_sweep_watch_path (const char *path, int pathlen, struct mydirent *myent
             char *name = strrchr(path, '/');
 
             if (name && *name++) {
-                int result;
+                // 文件事件不递归, sweep 线程只有一个, 共用 client->sweep_arena
+                watch_event_arena_t *arena = &client->sweep_arena;
+
+                watch_event_arena_reset(arena);
 
                 evbuf.wd = pv_cast_to_int(arg2);
                 evbuf.mask = IN_CLOSE_NOWRITE;
                 evbuf.cookie = 0;
                 evbuf.len = 0;
 
+                // 文件名指向 path, 回调期间不变
+                evbuf.name = name;
+
                 if (evbuf.wd > 0) {
                     __inotifytools_lock();
                     {
-                        // 监视的绝对目录: evbuf.pathname
+                        // 监视的绝对目录属于 inotifytools, 复制到 arena
                         char *abspath = inotifytools_filename_from_wd(evbuf.wd);
 
                         if (abspath) {
                             evbuf.pathlen = strlen(abspath);
-                            memcpy(evbuf.pathname, abspath, evbuf.pathlen);
-                            evbuf.pathname[evbuf.pathlen] = 0;
+                            evbuf.pathname = watch_event_arena_put(arena, abspath, evbuf.pathlen);
 
                             evbuf.len = (int) strlen(name);
-
-                            if (evbuf.len < sizeof(evbuf.name)) {
-                                memcpy(evbuf.name, name, evbuf.len);
-                                evbuf.name[evbuf.len] = '\0';
-                            } else {
-                                // error name buffer
-                                evbuf.len = 0;
-                            }
                         }
                     }
                     __inotifytools_unlock();
                 } else {
-                    // 监视的绝对目录: evbuf.pathname
+                    // 监视的绝对目录: path 中文件名之前的部分
                     evbuf.pathlen = name - path;
-                    memcpy(evbuf.pathname, path, evbuf.pathlen);
-                    evbuf.pathname[evbuf.pathlen] = 0;
+                    evbuf.pathname = watch_event_arena_put(arena, path, evbuf.pathlen);
 
                     evbuf.wd = 0;
                     evbuf.len = (int) strlen(name);
-
-                    if (evbuf.len < sizeof(evbuf.name)) {
-                        memcpy(evbuf.name, name, evbuf.len);
-                        evbuf.name[evbuf.len] = '\0';
-                    } else {
-                        // error name buffer
-                        evbuf.len = 0;
-                    }
                 }
 
-                result = 0;
+                if (! evbuf.pathname || evbuf.len > NAME_MAX) {
+                    // error name buffer
+                    evbuf.len = 0;
+                }
 
                 if (evbuf.len) {
-                    red_black_node_t *node = 0;
+                    XS_watch_event event = 0;
 
                     LOGGER_TRACE("sweep event(wd=%d)[%s]: %s", evbuf.wd, inotifytools_event_to_str_safe(evbuf.mask, msgbuf), name);
 
@@ -673,19 +1596,22 @@ int lscb_sweep_watch_path (const char *path, int pathlen, struct mydirent *myent
                      * 判断当前文件是否正在任务队列中处理, 如果在, 则忽略之
                      */
                     if (pthread_mutex_lock(&client->rbtree_lock) == 0) {
-                        node = rbtree_find(&client->event_rbtree, &evbuf);
+                        event = event_rbtree_find(&client->event_rbtree, &evbuf);
 
                         pthread_mutex_unlock(&client->rbtree_lock);
 
-                        if (! node) {
+                        if (event) {
+                            metrics_counter_inc(xs_client_metrics.events_coalesced);
+                        } else {
                             if (myent->mtime > ready_time - SWEEP_TIME_OVERLAP) {
                                 // 仅仅对最后更改时间在 ready_time 之后的文件做处理
-                                snprintf(evbuf.str_mtime, sizeof(evbuf.str_mtime), "%"PRId64"", myent->mtime);
-                                snprintf(evbuf.str_size, sizeof(evbuf.str_size), "%"PRId64"", myent->size);
+                                evbuf.mtime = myent->mtime;
+                                evbuf.size = myent->size;
 
-                                result = filter_watch_file(client, &evbuf);
-
-                                client->sweep_files++;
+                                // 攒成一批过滤 (filter_files)
+                                if (watch_event_batch_add(&client->sweep_batch, &evbuf)) {
+                                    client->sweep_files++;
+                                }
                             }
                         }
                     } else {
@@ -693,15 +1619,9 @@ int lscb_sweep_watch_path (const char *path, int pathlen, struct mydirent *myent
                     }
                 }
 
-                if (result > 0) {
+                if (client->sweep_batch.count == XSYNC_FILTER_BATCH_MAXNUM) {
                     // 添加任务到线程池, 如果任务队列忙, 则重试
-                    while (client_add_inotify_event(client, &evbuf) == XS_E_POOL) {
-                        sleep_ms(LOOP_SLEEP_TIME_MS * 10);
-                    }
-                } else if (result == -1) {
-                    // 要求重启服务
-                    client_set_inotify_reload(client, 1);
-                    return 0;
+                    client_flush_event_batch(client, &client->sweep_batch, LOOP_SLEEP_TIME_MS * 10);
                 }
             }
         }
@@ -711,7 +1631,7 @@ int lscb_sweep_watch_path (const char *path, int pathlen, struct mydirent *myent
             return 1;
         } else {
             // 忽略子目录的文件链接
-            char *abspath = realpath(path, evbuf.pathname);
+            char *abspath = realpath(path, pathbuf);
 
             if (abspath) {
                 LOGGER_WARN("ignored file link: %s -> %s", path, abspath);
@@ -759,6 +1679,121 @@ void xs_inotifytools_restart(XS_client client)
 }
 
 
+/**
+ * 修复一个目录: 添加或者删除目录及其子目录的监视. 只在 inotify 线程调用
+ */
+static int client_watch_repair_cb (int op, const char *path, void *arg)
+{
+    int ok;
+
+    struct stat sbuf;
+
+    XS_client client = (XS_client) arg;
+
+    if (op == WATCH_REPAIR_ADD) {
+        if (lstat(path, &sbuf) != 0 || ! S_ISDIR(sbuf.st_mode)) {
+            // 目录已经不存在: 不需要监视
+            return 1;
+        }
+
+        // 已经监视的子目录重复添加得到同一个 wd
+        __inotifytools_lock();
+        ok = inotifytools_watch_recursively(path, INOTI_EVENTS_MASK, on_inotify_add_wpath, client);
+        __inotifytools_unlock();
+    } else {
+        __inotifytools_lock();
+        ok = XS_client_remove_watch_tree(client, path);
+        __inotifytools_unlock();
+    }
+
+    return (ok? 1 : 0);
+}
+
+
+/**
+ * 同步监视: 只添加和删除变化的 pathid 目录, 失败时按退避时间重试.
+ *   XML 配置不支持增量同步, 仍然重启全部监视
+ */
+static void client_watch_resync (XS_client client)
+{
+    int changes;
+
+    if (! client->from_watch) {
+        xs_inotifytools_restart(client);
+        return;
+    }
+
+    changes = XS_client_conf_sync_watch(client);
+
+    if (changes < 0) {
+        client->watch_resync_retries++;
+        client->watch_resync_us = metrics_now_us() + watch_repair_backoff_us(client->watch_resync_retries);
+
+        LOGGER_WARN("sync watch fail, retry(%d) in %"PRIu64" ms", client->watch_resync_retries,
+            watch_repair_backoff_us(client->watch_resync_retries) / 1000);
+    } else {
+        client->watch_resync_retries = 0;
+        client->watch_resync_us = 0;
+
+        metrics_counter_add(xs_client_metrics.watch_pathid_changes, changes);
+    }
+}
+
+
+/**
+ * 执行到期的目录修复; watch_config 修改或者上次同步失败时同步 pathid.
+ *   只在 inotify 线程调用
+ */
+static void client_watch_poll (XS_client client)
+{
+    int gaveup;
+
+    struct stat sbuf;
+
+    uint64_t now_us = metrics_now_us();
+
+    if (now_us < client->watch_poll_us) {
+        return;
+    }
+
+    client->watch_poll_us = now_us + XSYNC_WATCH_REPAIR_BACKOFF_MS * 1000 / 2;
+
+    gaveup = XS_watch_repair_run(client->watch_repair, client_watch_repair_cb, (void *) client);
+
+    if (gaveup) {
+        // 放弃的目录由 sweep 重新发现 (filter_watch_path)
+        metrics_counter_add(xs_client_metrics.watch_repair_failures, gaveup);
+    }
+
+    if (client->watch_resync_us && now_us >= client->watch_resync_us) {
+        client_watch_resync(client);
+    }
+
+    if (! client->from_watch || now_us < client->watch_check_us) {
+        return;
+    }
+
+    client->watch_check_us = now_us + XSYNC_WATCH_RECONF_CHECK_MS * 1000;
+
+    if (stat(client->watch_config, &sbuf) != 0) {
+        LOGGER_ERROR("stat error(%d): %s (%s)", errno, strerror(errno), client->watch_config);
+        return;
+    }
+
+    if (sbuf.st_mtim.tv_sec != client->watch_config_mtime || sbuf.st_mtim.tv_nsec != client->watch_config_mtime_ns) {
+        if (client->watch_config_mtime) {
+            LOGGER_NOTICE("watch config changed: %s", client->watch_config);
+
+            client_watch_resync(client);
+        }
+
+        // 启动时只记录修改时间
+        client->watch_config_mtime = sbuf.st_mtim.tv_sec;
+        client->watch_config_mtime_ns = sbuf.st_mtim.tv_nsec;
+    }
+}
+
+
 /***********************************************************************
  *
  * XS_client application api
@@ -778,12 +1813,21 @@ XS_RESULT XS_client_create (xs_appopts_t *opts, XS_client *outClient)
 
     client = (XS_client) mem_alloc_zero(1, sizeof(xs_client_t));
 
+    // 加载监视目录时脚本回调就需要读锁
+    pthread_rwlock_init(&client->luactx_lock, 0);
+
     /* xsync-client app home dir */
     memcpy(client->apphome, opts->apphome, opts->apphome_len);
     client->apphome_len = opts->apphome_len;
 
     client->kafka = opts->kafka;
 
+    if (opts->bench[0]) {
+        // 基准测试不写 kafka
+        client->bench = 1;
+        client->kafka = 0;
+    }
+
     if (opts->clientid[0]) {
         // 通过命令行参数设置了 clientid
         memcpy(client->clientid, opts->clientid, XSYNC_CLIENTID_MAXLEN);
@@ -820,12 +1864,13 @@ XS_RESULT XS_client_create (xs_appopts_t *opts, XS_client *outClient)
     LOGGER_WARN("using wd_pathid_table[XSYNC_WATCH_PATHID_MAX=%d]. see XSYNC_USE_STATIC_PATHID_TABLE in client.mk", XSYNC_WATCH_PATHID_MAX);
 #else
     LOGGER_INFO("wd_pathid_rbtree init");
-    rbtree_init(&client->wd_pathid_rbtree, (fn_comp_func*) wd_pathid_rbtree_cmp);
+    rb_root_init(&client->wd_pathid_rbtree);
+    client->wd_pathid_count = 0;
 #endif
 
     // 初始化 event_rbtree
     LOGGER_DEBUG("event_rbtree");
-    rbtree_init(&client->event_rbtree, (fn_comp_func*) event_rbtree_cmp);
+    rb_root_init(&client->event_rbtree);
 
     /**
      * initialize and watch the entire directory tree from the current working
@@ -892,6 +1937,20 @@ XS_RESULT XS_client_create (xs_appopts_t *opts, XS_client *outClient)
         client->thread_args[i] = perthread_data_create(client, SERVERS, i+1, luascriptfile);
     }
 
+    for (i = 0; i < THREADS && client->kafka; ++i) {
+        perthread_data *perdata = (perthread_data *) client->thread_args[i];
+
+        if (perdata->kafka_producer_ready) {
+            // 全部线程共用一个跟踪器: 同一文件的事件可能由不同的线程处理
+            if (perdata->kt_producer_api.kt_tailer_create(XSYNC_KAFKA_LINEBREAK,
+                    on_kafka_lines_committed, (void *) client, &client->kafka_tailer) != KAFKATOOLS_SUCCESS) {
+                LOGGER_ERROR("kafkatools_tailer_create fail");
+                client->kafka_tailer = 0;
+            }
+            break;
+        }
+    }
+
     LOGGER_DEBUG("threadpool_create: (threads=%d, queues=%d)", THREADS, QUEUES);
     client->pool = threadpool_create(THREADS, QUEUES, client->thread_args, 0);
     if (! client->pool) {
@@ -905,6 +1964,54 @@ XS_RESULT XS_client_create (xs_appopts_t *opts, XS_client *outClient)
 
     threadlock_init(&client->rbtree_lock);
 
+    client->pathtab = pathtab_create();
+    if (! client->pathtab) {
+        xs_client_delete((void*) client);
+
+        LOGGER_FATAL("pathtab_create error: Out of memory");
+
+        // 失败退出程序
+        exit(XS_ERROR);
+    }
+
+    if (XS_watch_repair_create(&client->watch_repair) != XS_SUCCESS) {
+        xs_client_delete((void*) client);
+
+        LOGGER_FATAL("XS_watch_repair_create error");
+
+        // 失败退出程序
+        exit(XS_ERROR);
+    }
+
+    // 注册统计指标, 启动本地统计服务
+    XS_client_metrics_register(client);
+
+    for (i = 0; i < THREADS && client->kafka; ++i) {
+        perthread_data *perdata = (perthread_data *) client->thread_args[i];
+
+        if (perdata->kafka_producer_ready) {
+            // 事件消息的日志: 重放上次没有确认的消息
+            client_watch_file(client, ".kafka-journal", client->buffer);
+
+            if (XS_event_checkpoint_open(client->buffer, &client->kafka_checkpoint) != XS_SUCCESS) {
+                LOGGER_FATAL("XS_event_checkpoint_open fail: %s", client->buffer);
+
+                xs_client_delete((void*) client);
+                exit(XS_ERROR);
+            }
+
+            metrics_counter_add(xs_client_metrics.kafka_replayed,
+                XS_event_checkpoint_replay(client->kafka_checkpoint, on_kafka_replay, (void *) perdata));
+            break;
+        }
+    }
+
+    if (opts->metrics[0]) {
+        if (metrics_serve_start(opts->metrics) != 0) {
+            LOGGER_ERROR("metrics serve start fail: %s", opts->metrics);
+        }
+    }
+
     /**
      * output XS_client
      */
@@ -963,73 +2070,75 @@ int on_inotify_add_wpath (int flag, const char *wpath, void *arg)
 {
     int err, i, num;
 
+    lua_context luactx;
+
     XS_client client = (XS_client) arg;
 
     if (flag == INO_WATCH_ON_QUERY) {
         LOGGER_INFO("INO_WATCH_ON_QUERY: %s", wpath);
 
-        if (LuaCtxLockState(client->luactx)) {
-            err = LuaCtxCall(client->luactx, "inotify_watch_on_query", "wpath", wpath);
+        if ((luactx = client_luactx_lock(client)) != 0) {
+            err = LuaCtxCall(luactx, "inotify_watch_on_query", "wpath", wpath);
 
             if (! err) {
-                num = LuaCtxNumPairs(client->luactx);
+                num = LuaCtxNumPairs(luactx);
 
                 for (i = 0; i < num; i++) {
                     char *key, *value;
 
-                    LuaCtxGetKey(client->luactx, i, &key);
+                    LuaCtxGetKey(luactx, i, &key);
 
-                    LuaCtxGetValue(client->luactx, i, &value);
+                    LuaCtxGetValue(luactx, i, &value);
 
                     printf("inotify_watch_on_query output table[%d] = {%s => %s}\n", i, key, value);
                 }
             }
 
-            LuaCtxUnlockState(client->luactx);
+            client_luactx_unlock(client, luactx);
         }
     } else if (flag == INO_WATCH_ON_READY) {
         LOGGER_INFO("INO_WATCH_ON_READY: %s", wpath);
 
-        if (LuaCtxLockState(client->luactx)) {
-            err = LuaCtxCall(client->luactx, "inotify_watch_on_ready", "wpath", wpath);
+        if ((luactx = client_luactx_lock(client)) != 0) {
+            err = LuaCtxCall(luactx, "inotify_watch_on_ready", "wpath", wpath);
 
             if (! err) {
-                num = LuaCtxNumPairs(client->luactx);
+                num = LuaCtxNumPairs(luactx);
 
                 for (i = 0; i < num; i++) {
                     char *key, *value;
 
-                    LuaCtxGetKey(client->luactx, i, &key);
+                    LuaCtxGetKey(luactx, i, &key);
 
-                    LuaCtxGetValue(client->luactx, i, &value);
+                    LuaCtxGetValue(luactx, i, &value);
 
                     printf("inotify_watch_on_ready output table[%d] = {%s => %s}\n", i, key, value);
                 }
             }
 
-            LuaCtxUnlockState(client->luactx);
+            client_luactx_unlock(client, luactx);
         }
     } else if (flag == INO_WATCH_ON_ERROR) {
         LOGGER_ERROR("INO_WATCH_ON_ERROR: %s", wpath);
 
-        if (LuaCtxLockState(client->luactx)) {
-            err = LuaCtxCall(client->luactx, "inotify_watch_on_error", "wpath", wpath);
+        if ((luactx = client_luactx_lock(client)) != 0) {
+            err = LuaCtxCall(luactx, "inotify_watch_on_error", "wpath", wpath);
 
             if (! err) {
-                num = LuaCtxNumPairs(client->luactx);
+                num = LuaCtxNumPairs(luactx);
 
                 for (i = 0; i < num; i++) {
                     char *key, *value;
 
-                    LuaCtxGetKey(client->luactx, i, &key);
+                    LuaCtxGetKey(luactx, i, &key);
 
-                    LuaCtxGetValue(client->luactx, i, &value);
+                    LuaCtxGetValue(luactx, i, &value);
 
                     printf("inotify_watch_on_error output table[%d] = {%s => %s}\n", i, key, value);
                 }
             }
 
-            LuaCtxUnlockState(client->luactx);
+            client_luactx_unlock(client, luactx);
         }
     }
 
@@ -1046,15 +2155,7 @@ static time_t restore_timepoint (XS_client client, char *tmpbuf, ssize_t bufsize
     time_t tp = 0;
 
     // 生成 watch 目录下的 .timepoint 文件
-    memcpy(tmpbuf, client->apphome, client->apphome_len);
-    tmpbuf[client->apphome_len] = 0;
-
-    *strrchr(tmpbuf, '/') = '\0';
-    *strrchr(tmpbuf, '/') = '\0';
-
-    strcat(tmpbuf, "/watch/");
-    strcat(tmpbuf, client->clientid);
-    strcat(tmpbuf, ".sweep-timepoint");
+    client_watch_file(client, ".sweep-timepoint", tmpbuf);
 
     LOGGER_DEBUG("read timepoint: %s", tmpbuf);
 
@@ -1099,15 +2200,7 @@ static void save_timepoint (XS_client client, time_t tp, char *tmpbuf, ssize_t b
     int fd;
 
     // 生成 watch 目录下的 .timepoint 文件
-    memcpy(tmpbuf, client->apphome, client->apphome_len);
-    tmpbuf[client->apphome_len] = 0;
-
-    *strrchr(tmpbuf, '/') = '\0';
-    *strrchr(tmpbuf, '/') = '\0';
-
-    strcat(tmpbuf, "/watch/");
-    strcat(tmpbuf, client->clientid);
-    strcat(tmpbuf, ".sweep-timepoint");
+    client_watch_file(client, ".sweep-timepoint", tmpbuf);
 
     LOGGER_DEBUG("write file: %s", tmpbuf);
 
@@ -1136,6 +2229,24 @@ static void save_timepoint (XS_client client, time_t tp, char *tmpbuf, ssize_t b
 /**
  * 刷新目录树工作者函数: 刷新超时尽量短 ( < 1s)
  */
+/**
+ * 日志中有投递失败的事件消息时, 加入一个重试任务 (同时最多一个)
+ */
+static void client_queue_kafka_retry (XS_client client)
+{
+    if (! client->kafka_checkpoint || ! XS_event_checkpoint_pendings(client->kafka_checkpoint)) {
+        return;
+    }
+
+    if (__interlock_set(&client->kafka_retry_queued, 1) == 0) {
+        if (threadpool_add(client->pool, do_event_task, (void*) client, 101) != 0) {
+            // 队列满: 下一次再试
+            __interlock_set(&client->kafka_retry_queued, 0);
+        }
+    }
+}
+
+
 static void sweep_worker (void *arg)
 {
     int64_t sweeps;
@@ -1149,6 +2260,9 @@ static void sweep_worker (void *arg)
     unsigned int elapsed_seconds = 0;
     unsigned int interval_seconds = client->sweep_interval;
 
+    // kafka 重试按自己的期限 (单调时钟), 与刷新间隔无关
+    uint64_t next_retry_us = metrics_now_us() + XSYNC_KAFKA_RETRY_SECONDS * 1000000ULL;
+
     if (interval_seconds < 1) {
         interval_seconds = (unsigned int) 4294967295L;
     }
@@ -1159,7 +2273,8 @@ static void sweep_worker (void *arg)
         sweeps = __interlock_get(&client->sweep_count);
 
         if (sweeps == 0) {
-            // 启动后首次立即刷新. 从文件中恢复保存的时间点
+            // 启动后首次立即刷新. 从文件中恢复保存的时间点.
+            //   不能从日志中最后一个事件开始: 崩溃时已经入队但是没有写入日志的事件会丢失
             ready_time = restore_timepoint(client, pathbuf, sizeof(pathbuf));
 
             // 设置刷新时间起点
@@ -1168,6 +2283,12 @@ static void sweep_worker (void *arg)
             // 等待刷新时间间隔
             while(elapsed_seconds++ < interval_seconds) {
                 sleep(1);
+
+                if (metrics_now_us() >= next_retry_us) {
+                    client_queue_kafka_retry(client);
+
+                    next_retry_us = metrics_now_us() + XSYNC_KAFKA_RETRY_SECONDS * 1000000ULL;
+                }
             }
 
             elapsed_seconds = 0;
@@ -1185,6 +2306,9 @@ static void sweep_worker (void *arg)
         // 刷新文件的最后修改时间总是 >= ready_time
         listdir(client->watch_config, pathbuf, sizeof(pathbuf), (listdir_callback_t) lscb_sweep_watch_path, (void*) client, 0);
 
+        // 最后一批不满的文件
+        client_flush_event_batch(client, &client->sweep_batch, LOOP_SLEEP_TIME_MS * 10);
+
         // 记录结束刷新时间
         end = time(NULL);
 
@@ -1210,43 +2334,60 @@ XS_VOID XS_client_bootstrap (XS_client client)
 
     struct inotify_event *inevent;
 
+    // 当前事件的目录和文件名保存在 arena 中
+    watch_event_arena_t arena;
+
     struct watch_event_buf_t evbuf;
     bzero(&evbuf, sizeof(evbuf));
 
+    /* 事件序号, 用于跟踪记录 */
+    uint64_t evseq = 0;
+
     pthread_t sweep_thread_id;
 
     /**
-     * connect to servers for each threads
+     * connect to servers: 每个服务器只有一个连接 (XMUX), 所有线程共享.
+     *   连接由 reactor 线程异步建立 (并行), 断开之后自动重连
      */
     LOGGER_INFO("create connections to servers");
 
+    // 每个 (条目, 服务器) 已确认的偏移: 重启之后断点续传
+    client_watch_file(client, ".sync-progress", client->buffer);
+
+    if (XS_sync_progress_open(client->buffer, &client->sync_progress) != XS_SUCCESS) {
+        LOGGER_ERROR("XS_sync_progress_open fail: %s", client->buffer);
+        client->sync_progress = 0;
+    } else {
+        LOGGER_INFO("sync progress: %jd entries (%s)", XS_sync_progress_entries(client->sync_progress), client->buffer);
+    }
+
     if (XS_client_get_server_maxid(client) == 0) {
         LOGGER_WARN("no servers: see reference for how to add server!");
+    } else if (XS_conn_reactor_create(&client->reactor) != XS_SUCCESS) {
+        LOGGER_FATAL("XS_conn_reactor_create failed");
+        exit(-1);
     } else {
         int i, sid;
 
-        for (i = 0; i < client->threads; ++i) {
-            perthread_data * perdata = (perthread_data *) client->thread_args[i];
+        for (sid = 1; sid <= XS_client_get_server_maxid(client); sid++) {
+            xs_server_opts * srv = XS_client_get_server_opts(client, sid);
 
-            for (sid = 1; sid <= XS_client_get_server_maxid(client); sid++) {
-                xs_server_opts * srv = XS_client_get_server_opts(client, sid);
+            XS_server_conn_create(srv, client->clientid, client->password, &client->server_conns[sid]);
 
-                XS_server_conn_create(srv, client->clientid, client->password, &perdata->server_conns[sid]);
+            XS_conn_reactor_add(client->reactor, client->server_conns[sid]);
 
-                if (perdata->server_conns[sid]->sockfd == -1) {
-                    LOGGER_ERROR("[thread_%d] connect server-%d (%s:%d)",
-                        perdata->threadid,
-                        sid,
-                        srv->host,
-                        srv->port);
-                } else {
-                    LOGGER_INFO("[thread_%d] connected server-%d (%s:%d)",
-                        perdata->threadid,
-                        sid,
-                        srv->host,
-                        srv->port);
-                }
+            for (i = 0; i < client->threads; ++i) {
+                perthread_data * perdata = (perthread_data *) client->thread_args[i];
+
+                perdata->server_conns[sid] = (XS_server_conn) RefObjectRetain((void**) &client->server_conns[sid]);
             }
+
+            LOGGER_INFO("server-%d (%s:%d)", sid, srv->host, srv->port);
+        }
+
+        if (XS_conn_reactor_start(client->reactor) != XS_SUCCESS) {
+            LOGGER_FATAL("XS_conn_reactor_start failed");
+            exit(-1);
         }
     }
 
@@ -1274,13 +2415,28 @@ XS_VOID XS_client_bootstrap (XS_client client)
      * http://inotify-tools.sourceforge.net/api/inotifytools_8h.html
      */
     for (;;) {
+        if (evbuf.trace) {
+            // 上一个事件被忽略或者拒绝, 丢弃跟踪记录
+            evtrace_free(evbuf.trace);
+            evbuf.trace = 0;
+        }
+
         if (client_is_inotify_reload(client)) {
-            xs_inotifytools_restart(client);
+            // 同步监视之前处理已经读到的文件事件
+            client_flush_event_batch(client, &client->inotify_batch, 1);
+
             client_set_inotify_reload(client, 0);
+            client_watch_resync(client);
 
             LOGGER_NOTICE("inotify total watches=%d", inotifytools_get_num_watches_s());
         }
 
+        // 脚本修改时重新加载, 不重启监视
+        client_lua_poll(client);
+
+        // 重试失败的目录, watch_config 修改时同步 pathid
+        client_watch_poll(client);
+
         __inotifytools_lock();
         {
             // 必须是立即返回
@@ -1288,6 +2444,15 @@ XS_VOID XS_client_bootstrap (XS_client client)
 
             if (! inevent) {
                 __inotifytools_unlock();
+
+                if (client->inotify_batch.count) {
+                    // 没有更多立即可读的事件: 成批过滤已经读到的文件
+                    client_flush_event_batch(client, &client->inotify_batch, 1);
+                    continue;
+                }
+
+                client_kafka_poll(client);
+
                 sleep_ms(LOOP_SLEEP_TIME_MS);
                 continue;
             }
@@ -1299,7 +2464,7 @@ XS_VOID XS_client_bootstrap (XS_client client)
                 continue;
             }
 
-            if (! inotify_event_dump((watch_event_t *)&evbuf, PATH_MAX, inevent)) {
+            if (! inotify_event_dump(&evbuf, &arena, inevent)) {
                 __inotifytools_unlock();
 
                 LOGGER_ERROR("unexpected for event: %s", inotifytools_event_to_str(inevent->mask));
@@ -1311,6 +2476,9 @@ XS_VOID XS_client_bootstrap (XS_client client)
         if (evbuf.mask & IN_ISDIR) {
             int len, wd;
 
+            // 目录事件之前读到的文件事件先处理
+            client_flush_event_batch(client, &client->inotify_batch, 1);
+
             len = snprintf(pathbuf, sizeof(pathbuf), "%s%s/", evbuf.pathname, evbuf.name);
             if (len < 0 || len >= sizeof(pathbuf)) {
                 LOGGER_FATAL("pathbuf was truncated for: '%s%s/'", evbuf.pathname, evbuf.name);
@@ -1328,7 +2496,7 @@ XS_VOID XS_client_bootstrap (XS_client client)
                     } else {
                         LOGGER_ERROR("inotify remove wpath fail: (%d: %s)", wd, pathbuf);
 
-                        client_set_inotify_reload(client, 1);
+                        XS_watch_repair_add(client->watch_repair, WATCH_REPAIR_REMOVE, pathbuf);
                     }
                 }
             } else if (evbuf.mask & (IN_CREATE | IN_MOVED_TO)) {
@@ -1345,7 +2513,7 @@ XS_VOID XS_client_bootstrap (XS_client client)
                     } else {
                         LOGGER_ERROR("inotify add wpath fail: (%s)", pathbuf);
 
-                        client_set_inotify_reload(client, 1);
+                        XS_watch_repair_add(client->watch_repair, WATCH_REPAIR_ADD, pathbuf);
                     }
                 }
             } else if (evbuf.mask & IN_CLOSE) {
@@ -1355,16 +2523,23 @@ XS_VOID XS_client_bootstrap (XS_client client)
             LOGGER_NOTICE("inotify total watches=%d", inotifytools_get_num_watches_s());
             continue;
         } else if (evbuf.mask & INOTI_EVENTS_MASK) {
-            red_black_node_t *node;
+            XS_watch_event event;
+
+            metrics_counter_inc(xs_client_metrics.events_received);
+
+            evbuf.trace = evtrace_begin(++evseq);
+            evtrace_stamp(evbuf.trace, EVTRACE_INOTIFY);
 
             /**
              * 判断当前文件是否正在任务队列中处理, 如果在, 则忽略之
              */
             event_rbtree_lock();
-            node = rbtree_find(&client->event_rbtree, (watch_event_t *)&evbuf);
+            event = event_rbtree_find(&client->event_rbtree, &evbuf);
             event_rbtree_unlock();
 
-            if (! node) {
+            if (event) {
+                metrics_counter_inc(xs_client_metrics.events_coalesced);
+            } else {
                 int len, err;
                 struct stat sbuf;
 
@@ -1389,16 +2564,21 @@ XS_VOID XS_client_bootstrap (XS_client client)
                 /**
                  * evbuf.len 总是等于 strlen(evbuf.name)
                  */
-                snprintf(evbuf.str_mtime, sizeof(evbuf.str_mtime), "%"PRId64"", sbuf.st_mtime);
-                snprintf(evbuf.str_size, sizeof(evbuf.str_size), "%"PRId64"", sbuf.st_size);
-
-                if (filter_watch_file(client, &evbuf) > 0) {
-                    // 循环直到添加成功
-                    while (client_add_inotify_event(client, &evbuf) == XS_E_POOL) {
-                        sleep_ms(1);
+                evbuf.mtime = sbuf.st_mtime;
+                evbuf.size = sbuf.st_size;
+
+                if (watch_event_batch_find(&client->inotify_batch, &evbuf) != -1) {
+                    // 同一批中已经有这个文件的事件
+                    metrics_counter_inc(xs_client_metrics.events_coalesced);
+                } else if (watch_event_batch_add(&client->inotify_batch, &evbuf)) {
+                    // 跟踪记录交给批次. 读完立即可读的事件 (或者批次满) 之后成批过滤
+                    evbuf.trace = 0;
+
+                    if (client->inotify_batch.count == XSYNC_FILTER_BATCH_MAXNUM) {
+                        client_flush_event_batch(client, &client->inotify_batch, 1);
                     }
                 } else {
-                    LOGGER_TRACE("reject file: %s%s", evbuf.pathname, evbuf.name);
+                    LOGGER_ERROR("watch_event_batch_add fail: %s%s", evbuf.pathname, evbuf.name);
                 }
             }
 
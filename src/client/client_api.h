@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-24
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-23 16:20:08
  */
 
 #ifndef CLIENT_API_H_INCLUDED
@@ -83,6 +83,20 @@ typedef struct xs_appopts_t
 
     int from_watch;
 
+    /* LOGGER_ASYNC_DROP, LOGGER_ASYNC_BLOCK; -1: 同步日志 */
+    int log_async;
+    char log_file[FILENAME_MAXLEN + 1];
+
+    /* 本地统计服务地址: "unix:/path", "host:port" 或者 "port". 空: 不启动 */
+    char metrics[FILENAME_MAXLEN + 1];
+
+    /* 事件跟踪: 每 trace_sample 个事件跟踪 1 个, 写入 trace_file. 0: 不跟踪 */
+    int trace_sample;
+    char trace_file[FILENAME_MAXLEN + 1];
+
+    /* 基准测试: "DIR[,DEPTH[,FANOUT[,FILES[,RATE[,SECONDS]]]]]" (see client_bench.h). 空: 正常运行 */
+    char bench[FILENAME_MAXLEN + 1];
+
     char clientid[XSYNC_CLIENTID_MAXLEN + 1];
     char password[XSYNC_PASSWORD_MAXLEN + 1];
 
@@ -0,0 +1,509 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: client_bench.c
+ *   客户端事件处理的基准测试 (--bench)
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-23
+ *
+ * @update: 2018-11-23 16:20:08
+ */
+
+#include "client_api.h"
+#include "client_conf.h"
+#include "client_metrics.h"
+#include "client_bench.h"
+
+#include "../common/evtrace.h"
+
+
+typedef struct xs_bench_t
+{
+    XS_client client;
+
+    xs_bench_opts_t opts;
+
+    /* 生成的目录 (以 '/' 结尾), dirs[0] 是生成树的根 */
+    int ndirs;
+    char **dirs;
+
+    pthread_t thread;
+} xs_bench_t;
+
+
+/* 延迟样本: 每个阶段一组 + total */
+typedef struct xs_bench_samples_t
+{
+    uint64_t head;
+
+    uint64_t *values[EVTRACE_STAGES + 1];
+    size_t counts[EVTRACE_STAGES + 1];
+    size_t capacity;
+} xs_bench_samples_t;
+
+
+static uint64_t cputime_us (clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+
+static int cmp_uint64 (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+int XS_client_bench_parse (const char *spec, xs_bench_opts_t *bench)
+{
+    int i, n, len;
+    const char *p;
+    int *nums[5];
+    long ndirs, level;
+
+    bzero(bench, sizeof(*bench));
+
+    bench->depth = XS_BENCH_DEPTH_DEFAULT;
+    bench->fanout = XS_BENCH_FANOUT_DEFAULT;
+    bench->files = XS_BENCH_FILES_DEFAULT;
+    bench->rate = XS_BENCH_RATE_DEFAULT;
+    bench->seconds = XS_BENCH_SECONDS_DEFAULT;
+
+    nums[0] = &bench->depth;
+    nums[1] = &bench->fanout;
+    nums[2] = &bench->files;
+    nums[3] = &bench->rate;
+    nums[4] = &bench->seconds;
+
+    p = strchr(spec, ',');
+    len = (p? (int) (p - spec) : (int) strlen(spec));
+
+    if (len <= 0 || len + 1 >= (int) sizeof(bench->dir)) {
+        return (-1);
+    }
+
+    memcpy(bench->dir, spec, len);
+    if (bench->dir[len - 1] != '/') {
+        bench->dir[len++] = '/';
+    }
+    bench->dir[len] = 0;
+
+    for (i = 0; p && i < 5; i++) {
+        char *endp;
+
+        n = (int) strtol(p + 1, &endp, 10);
+        if (endp == p + 1 || (*endp && *endp != ',') || n < 0) {
+            return (-1);
+        }
+
+        *nums[i] = n;
+
+        p = (*endp? endp : 0);
+    }
+
+    if (p || bench->fanout < 1 || bench->files < 1 || bench->seconds < 1) {
+        return (-1);
+    }
+
+    ndirs = 1;
+    level = 1;
+    for (i = 0; i < bench->depth; i++) {
+        level *= bench->fanout;
+        ndirs += level;
+
+        if (ndirs > XS_BENCH_DIRS_MAX) {
+            return (-1);
+        }
+    }
+
+    return 0;
+}
+
+
+static int bench_wait_watched (const char *dir, int seconds)
+{
+    int ms;
+
+    for (ms = 0; ms < seconds * 1000; ms += 10) {
+        if (inotifytools_wd_from_filename_s(dir) > 0) {
+            return 0;
+        }
+
+        sleep_ms(10);
+    }
+
+    return (-1);
+}
+
+
+/**
+ * 按层生成目录树: 每个目录有 fanout 个子目录
+ */
+static int bench_make_tree (xs_bench_t *bench)
+{
+    int i, k, first, last;
+
+    char path[PATH_MAX];
+
+    bench->dirs = (char **) mem_alloc_zero(XS_BENCH_DIRS_MAX, sizeof(char *));
+
+    snprintf(path, sizeof(path), "%sxsync-bench.%d/", bench->opts.dir, (int) getpid());
+
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        LOGGER_ERROR("mkdir error(%d): %s (%s)", errno, strerror(errno), path);
+        return (-1);
+    }
+
+    bench->dirs[bench->ndirs++] = strdup(path);
+
+    first = 0;
+    last = 1;
+
+    for (i = 0; i < bench->opts.depth; i++) {
+        int j;
+
+        // 新目录由 inotify 线程添加监视, 上一层全部被监视之后才生成下一层
+        for (j = first; j < last; j++) {
+            if (bench_wait_watched(bench->dirs[j], XS_BENCH_WAIT_SECONDS) != 0) {
+                LOGGER_ERROR("bench dir not watched: %s", bench->dirs[j]);
+                return (-1);
+            }
+        }
+
+        for (j = first; j < last; j++) {
+            for (k = 0; k < bench->opts.fanout; k++) {
+                if (snprintf(path, sizeof(path), "%sd%d/", bench->dirs[j], k) >= (int) sizeof(path)) {
+                    LOGGER_ERROR("path too long: %s", bench->dirs[j]);
+                    return (-1);
+                }
+
+                if (mkdir(path, 0755) && errno != EEXIST) {
+                    LOGGER_ERROR("mkdir error(%d): %s (%s)", errno, strerror(errno), path);
+                    return (-1);
+                }
+
+                bench->dirs[bench->ndirs++] = strdup(path);
+            }
+        }
+
+        first = last;
+        last = bench->ndirs;
+    }
+
+    for (i = first; i < bench->ndirs; i++) {
+        if (bench_wait_watched(bench->dirs[i], XS_BENCH_WAIT_SECONDS) != 0) {
+            LOGGER_ERROR("bench dir not watched: %s", bench->dirs[i]);
+            return (-1);
+        }
+    }
+
+    return 0;
+}
+
+
+static void bench_remove_tree (xs_bench_t *bench)
+{
+    int i;
+    char path[PATH_MAX];
+
+    for (i = 0; bench->ndirs && i < bench->opts.files; i++) {
+        snprintf(path, sizeof(path), "%sf%d.dat", bench->dirs[i % bench->ndirs], i);
+        unlink(path);
+    }
+
+    // 子目录在父目录之后生成, 逆序删除
+    for (i = bench->ndirs - 1; i >= 0; i--) {
+        rmdir(bench->dirs[i]);
+        free(bench->dirs[i]);
+    }
+
+    mem_free(bench->dirs);
+    bench->dirs = 0;
+}
+
+
+/**
+ * 追加写文件, 返回写的次数
+ */
+static uint64_t bench_write_files (xs_bench_t *bench)
+{
+    int fd, len;
+    uint64_t n = 0;
+
+    char path[PATH_MAX];
+    char line[128];
+
+    uint64_t t0 = metrics_now_us();
+    uint64_t tend = t0 + (uint64_t) bench->opts.seconds * 1000000;
+
+    for (;;) {
+        uint64_t now = metrics_now_us();
+
+        if (now >= tend) {
+            break;
+        }
+
+        if (bench->opts.rate > 0) {
+            uint64_t due = t0 + n * 1000000 / bench->opts.rate;
+
+            if (due > now) {
+                usleep((useconds_t) (due - now));
+                continue;
+            }
+        }
+
+        snprintf(path, sizeof(path), "%sf%d.dat", bench->dirs[n % bench->opts.files % bench->ndirs], (int) (n % bench->opts.files));
+
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd == -1) {
+            LOGGER_ERROR("open error(%d): %s (%s)", errno, strerror(errno), path);
+            break;
+        }
+
+        len = snprintf(line, sizeof(line), "%ju %ju\n", (uintmax_t) n, (uintmax_t) now);
+
+        if (write(fd, line, len) != len) {
+            LOGGER_ERROR("write error(%d): %s (%s)", errno, strerror(errno), path);
+        }
+
+        close(fd);
+
+        n++;
+    }
+
+    return n;
+}
+
+
+/**
+ * 等待任务队列和事件树为空, 并且完成数不再增加
+ */
+static void bench_drain (xs_bench_t *bench)
+{
+    int ms, idle = 0;
+
+    XS_client client = bench->client;
+
+    uint64_t done, last = metrics_histogram_count(xs_client_metrics.event_task_seconds);
+
+    for (ms = 0; ms < XS_BENCH_WAIT_SECONDS * 1000 && idle < 5; ms += 100) {
+        int empty;
+
+        sleep_ms(100);
+
+        event_rbtree_lock();
+        empty = (client->event_rbtree.rb_node == 0);
+        event_rbtree_unlock();
+
+        done = metrics_histogram_count(xs_client_metrics.event_task_seconds);
+
+        idle = ((empty && done == last)? idle + 1 : 0);
+
+        last = done;
+    }
+}
+
+
+static void bench_sample_add (const evtrace_rec_t *rec, void *arg)
+{
+    int s, first = -1, prev = -1;
+
+    xs_bench_samples_t *smp = (xs_bench_samples_t *) arg;
+
+    // 只统计本次运行写入的记录
+    if (rec->seq <= smp->head) {
+        return;
+    }
+
+    for (s = 0; s < EVTRACE_STAGES; s++) {
+        if (rec->stages & (1U << s)) {
+            if (prev == -1) {
+                first = s;
+            } else {
+                smp->values[s][smp->counts[s]++] = rec->ts[s] - rec->ts[prev];
+            }
+            prev = s;
+        }
+    }
+
+    if (prev > first) {
+        smp->values[EVTRACE_STAGES][smp->counts[EVTRACE_STAGES]++] = rec->ts[prev] - rec->ts[first];
+    }
+}
+
+
+static void bench_report_latency (uint64_t head)
+{
+    int s;
+
+    xs_bench_samples_t smp;
+
+    const evtrace_hdr_t *hdr = evtrace_ring_hdr();
+
+    if (! hdr) {
+        printf("latency: no trace ring\n");
+        return;
+    }
+
+    bzero(&smp, sizeof(smp));
+
+    smp.head = head;
+    smp.capacity = (size_t) hdr->capacity;
+
+    for (s = 0; s <= EVTRACE_STAGES; s++) {
+        smp.values[s] = (uint64_t *) mem_alloc_unset(smp.capacity * sizeof(uint64_t));
+    }
+
+    evtrace_ring_foreach(hdr, bench_sample_add, &smp);
+
+    printf("%-10s %10s %10s %10s %10s\n", "stage", "count", "p50(us)", "p99(us)", "max(us)");
+
+    for (s = 0; s <= EVTRACE_STAGES; s++) {
+        size_t n = smp.counts[s];
+        uint64_t *v = smp.values[s];
+
+        if (n) {
+            qsort(v, n, sizeof(uint64_t), cmp_uint64);
+
+            printf("%-10s %10zu %10.1f %10.1f %10.1f\n", (s < EVTRACE_STAGES? evtrace_stage_names[s] : "total"), n,
+                v[(n - 1) / 2] / 1000.0, v[(size_t) ((n - 1) * 0.99)] / 1000.0, v[n - 1] / 1000.0);
+        }
+
+        mem_free(v);
+    }
+}
+
+
+static void * bench_thread (void *arg)
+{
+    xs_bench_t *bench = (xs_bench_t *) arg;
+
+    uint64_t writes, received, coalesced, filtered, done;
+    uint64_t t0, cpu0, gencpu0, head0;
+
+    double elapsed, cpu;
+
+    const evtrace_hdr_t *hdr;
+
+    if (bench_wait_watched(bench->opts.dir, XS_BENCH_WAIT_SECONDS) != 0) {
+        LOGGER_FATAL("bench dir not watched: %s", bench->opts.dir);
+        exit(XS_ERROR);
+    }
+
+    if (bench_make_tree(bench) != 0) {
+        bench_remove_tree(bench);
+        exit(XS_ERROR);
+    }
+
+    LOGGER_NOTICE("bench start: dirs=%d files=%d rate=%d seconds=%d (%s)",
+        bench->ndirs, bench->opts.files, bench->opts.rate, bench->opts.seconds, bench->dirs[0]);
+
+    hdr = evtrace_ring_hdr();
+    head0 = (hdr? hdr->head : 0);
+
+    received = metrics_counter_get(xs_client_metrics.events_received);
+    coalesced = metrics_counter_get(xs_client_metrics.events_coalesced);
+    filtered = metrics_counter_get(xs_client_metrics.events_filtered);
+    done = metrics_histogram_count(xs_client_metrics.event_task_seconds);
+
+    t0 = metrics_now_us();
+    cpu0 = cputime_us(CLOCK_PROCESS_CPUTIME_ID);
+    gencpu0 = cputime_us(CLOCK_THREAD_CPUTIME_ID);
+
+    writes = bench_write_files(bench);
+
+    // 生成器的 CPU 不计入事件处理
+    gencpu0 = cputime_us(CLOCK_THREAD_CPUTIME_ID) - gencpu0;
+
+    bench_drain(bench);
+
+    elapsed = (metrics_now_us() - t0) / 1000000.0;
+    cpu = (double) (cputime_us(CLOCK_PROCESS_CPUTIME_ID) - cpu0 - gencpu0);
+
+    received = metrics_counter_get(xs_client_metrics.events_received) - received;
+    coalesced = metrics_counter_get(xs_client_metrics.events_coalesced) - coalesced;
+    filtered = metrics_counter_get(xs_client_metrics.events_filtered) - filtered;
+    done = metrics_histogram_count(xs_client_metrics.event_task_seconds) - done;
+
+    printf("\n* %s bench: depth=%d fanout=%d dirs=%d files=%d rate=%d seconds=%d threads=%d\n",
+        XSYNC_CLIENT_APPNAME, bench->opts.depth, bench->opts.fanout, bench->ndirs,
+        bench->opts.files, bench->opts.rate, bench->opts.seconds, bench->client->threads);
+
+    printf("writes=%ju received=%ju coalesced=%ju filtered=%ju done=%ju elapsed=%.3fs\n",
+        (uintmax_t) writes, (uintmax_t) received, (uintmax_t) coalesced, (uintmax_t) filtered, (uintmax_t) done, elapsed);
+
+    printf("events/s=%.1f cpu/event=%.1fus\n",
+        done / elapsed, (done? cpu / done : 0.0));
+
+    bench_report_latency(head0);
+
+    fflush(stdout);
+
+    LOGGER_NOTICE("bench end: done=%ju events/s=%.1f cpu/event=%.1fus", (uintmax_t) done, done / elapsed, (done? cpu / done : 0.0));
+
+    bench_remove_tree(bench);
+
+    mem_free(bench);
+
+    exit(0);
+
+    return 0;
+}
+
+
+XS_RESULT XS_client_bench_start (XS_client client, const char *spec)
+{
+    int err;
+
+    xs_bench_t *bench = (xs_bench_t *) mem_alloc_zero(1, sizeof(xs_bench_t));
+
+    if (XS_client_bench_parse(spec, &bench->opts) != 0) {
+        LOGGER_ERROR("invalid bench: %s", spec);
+        mem_free(bench);
+        return XS_E_PARAM;
+    }
+
+    bench->client = client;
+
+    err = pthread_create(&bench->thread, 0, bench_thread, (void *) bench);
+    if (err) {
+        LOGGER_ERROR("pthread_create error(%d): %s", err, strerror(err));
+        mem_free(bench);
+        return XS_ERROR;
+    }
+
+    pthread_detach(bench->thread);
+
+    return XS_SUCCESS;
+}
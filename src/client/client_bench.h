@@ -0,0 +1,108 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: client_bench.h
+ *   客户端事件处理的基准测试 (--bench)
+ *
+ *   在被监视的目录 DIR 下生成合成的目录树 (深度 DEPTH, 每层 FANOUT 个
+ *   子目录, 共 FILES 个文件), 以 RATE 次/秒 (0: 不限) 追加写文件
+ *   SECONDS 秒. 事件经过真实的 inotify 读取, filter_watch_file,
+ *   client_add_inotify_event 和 do_event_task, 但是不发送到服务器和
+ *   kafka (null sink). 结束后输出:
+ *
+ *     - 每秒处理的事件数
+ *     - 每个阶段和总的延迟 p50/p99 (来自事件跟踪, see "../common/evtrace.h")
+ *     - 每个事件的 CPU 时间 (不含生成器线程)
+ *
+ *   然后删除生成的目录树并退出进程.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-23
+ *
+ * @update: 2018-11-23 16:20:08
+ */
+
+#ifndef CLIENT_BENCH_H_INCLUDED
+#define CLIENT_BENCH_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "client_api.h"
+
+
+#define XS_BENCH_DEPTH_DEFAULT       2
+#define XS_BENCH_FANOUT_DEFAULT      4
+#define XS_BENCH_FILES_DEFAULT       100
+#define XS_BENCH_RATE_DEFAULT        0
+#define XS_BENCH_SECONDS_DEFAULT     10
+
+/* 生成的目录总数上限 */
+#define XS_BENCH_DIRS_MAX            4096
+
+/* 等待目录被监视和事件处理完成的最长时间 (秒) */
+#define XS_BENCH_WAIT_SECONDS        60
+
+
+typedef struct xs_bench_opts_t
+{
+    /* 被监视的目录, 以 '/' 结尾 */
+    char dir[FILENAME_MAXLEN + 1];
+
+    int depth;
+    int fanout;
+    int files;
+
+    /* 每秒追加写的次数. 0: 不限 */
+    int rate;
+
+    int seconds;
+} xs_bench_opts_t;
+
+
+/**
+ * XS_client_bench_parse
+ *   解析 "DIR[,DEPTH[,FANOUT[,FILES[,RATE[,SECONDS]]]]]"
+ *
+ * returns:
+ *   0 - success
+ *  -1 - invalid spec
+ */
+extern int XS_client_bench_parse (const char *spec, xs_bench_opts_t *bench);
+
+
+/**
+ * XS_client_bench_start
+ *   启动生成器线程. 必须在 XS_client_bootstrap 之前调用.
+ */
+extern XS_RESULT XS_client_bench_start (XS_client client, const char *spec);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* CLIENT_BENCH_H_INCLUDED */
@@ -30,42 +30,62 @@
  *
  * @create: 2018-01-26
  *
- * @update: 2018-11-09 14:31:18
+ * @update: 2018-11-30 20:21:48
  */
 
 #include "client_api.h"
 
 #include "client_conf.h"
+#include "client_metrics.h"
+#include "watch_crawl.h"
 
 #include "../common/readconf.h"
 
 
-void * perthread_data_create (XS_client client, int servers, int threadid, const char *events_lua)
+lua_context perthread_luactx_create (int threadid, const char *events_lua)
 {
-    perthread_data *perdata = (perthread_data *) mem_alloc_zero(1, sizeof(perthread_data));
+    int err;
 
-    if (events_lua) {
-        LOGGER_NOTICE("[thread-%d] loading: %s", threadid, events_lua);
+    lua_context luactx = 0;
 
-        do {
-            luareglib_t lib_cjson;
+    luareglib_t lib_cjson;
 
-            strcpy(lib_cjson.libname, "cjson");
+    strcpy(lib_cjson.libname, "cjson");
 
-            // 定义加载函数, 需要链接: cjson.so
-            LUALIB_API int luaopen_cjson (lua_State * L);
+    // 定义加载函数, 需要链接: cjson.so
+    LUALIB_API int luaopen_cjson (lua_State * L);
 
-            lib_cjson.openlibfunc = luaopen_cjson;
-            lib_cjson.isglobal = 1;
-            lib_cjson.nextlib = 0;
+    lib_cjson.openlibfunc = luaopen_cjson;
+    lib_cjson.isglobal = 1;
+    lib_cjson.nextlib = 0;
 
-            if (LuaCtxNew(events_lua, LUACTX_THREAD_MODE_SINGLE, &lib_cjson, &perdata->luactx) != LUACTX_SUCCESS) {
-                LOGGER_FATAL("LuaCtxNew fail");
+    LOGGER_NOTICE("[thread-%d] loading: %s", threadid, events_lua);
 
-                mem_free(perdata);
-                exit(-1);
-            }
-        } while (0);
+    err = LuaCtxNew(events_lua, LUACTX_THREAD_MODE_SINGLE, &lib_cjson, &luactx);
+    if (err != LUACTX_SUCCESS) {
+        LOGGER_ERROR("[thread-%d] LuaCtxNew fail(%d): %s", threadid, err, events_lua);
+        return 0;
+    }
+
+    return luactx;
+}
+
+
+void * perthread_data_create (XS_client client, int servers, int threadid, const char *events_lua)
+{
+    perthread_data *perdata = (perthread_data *) mem_alloc_zero(1, sizeof(perthread_data));
+
+    perdata->event_format = EVRECORD_FMT_TEXT;
+
+    if (events_lua) {
+        perdata->luactx = perthread_luactx_create(threadid, events_lua);
+
+        if (! perdata->luactx) {
+            LOGGER_FATAL("LuaCtxNew fail");
+
+            mem_free(perdata);
+            exit(-1);
+        }
     }
 
     if (client->kafka) {
@@ -79,9 +99,22 @@ void * perthread_data_create (XS_client client, int servers, int threadid, const
                 char *result = 0;
                 char *bootstrap_servers = 0;
                 char *socket_timeout_ms = 0;
+                char *metadata_refresh_ms = 0;
+                char *event_format = 0;
 
                 if (LuaCtxGetValueByKey(perdata->luactx, "result", 6, &result) && !strcmp(result, "SUCCESS")) {
 
+                    // 事件消息格式: "text" (默认), "json", "binary" (需要读者支持 evrecord)
+                    if (LuaCtxGetValueByKey(perdata->luactx, "event_format", 12, &event_format)) {
+                        if (! strcmp(event_format, "binary")) {
+                            perdata->event_format = EVRECORD_FMT_BINARY;
+                        } else if (! strcmp(event_format, "json")) {
+                            perdata->event_format = EVRECORD_FMT_JSON;
+                        } else if (strcmp(event_format, "text")) {
+                            LOGGER_WARN("[thread-%d] unknown event_format: %s (using text)", threadid, event_format);
+                        }
+                    }
+
                     if (LuaCtxGetValueByKey(perdata->luactx, "bootstrap_servers", 17, &bootstrap_servers)) {
                         char default_timeout_ms[] = "1000";
 
@@ -90,18 +123,30 @@ void * perthread_data_create (XS_client client, int servers, int threadid, const
                             socket_timeout_ms = default_timeout_ms;
                         }
 
+                        // 后台刷新 topic 分区数的间隔 (毫秒)
+                        char default_refresh_ms[] = XSYNC_KAFKA_METADATA_REFRESH_MS;
+
+                        LuaCtxGetValueByKey(perdata->luactx, "metadata_refresh_ms", 19, &metadata_refresh_ms);
+                        if (! metadata_refresh_ms) {
+                            metadata_refresh_ms = default_refresh_ms;
+                        }
+
                         LOGGER_INFO("[thread-%d] create kafka producer (bootstrap.servers=%s)", threadid, bootstrap_servers);
 
                         do {
                             const char *names[] = {
                                 "bootstrap.servers",
                                 "socket.timeout.ms",
+                                KAFKATOOLS_PROP_METADATA_REFRESH_MS,
+                                KAFKATOOLS_PROP_IDEMPOTENCE,
                                 0
                             };
 
                             const char *values[] = {
                                 bootstrap_servers,
                                 socket_timeout_ms,
+                                metadata_refresh_ms,
+                                "true",
                                 0
                             };
 
@@ -181,6 +226,13 @@ void perthread_data_free (perthread_data *perdata)
 
     LuaCtxFree(&perdata->luactx);
 
+    do {
+        // 工作线程没有取走的新脚本
+        lua_context luactx_next = __interlock_set(&perdata->luactx_next, 0);
+
+        LuaCtxFree(&luactx_next);
+    } while (0);
+
     mem_free(perdata);
 }
 
@@ -192,6 +244,9 @@ void xs_client_delete (void *pv)
 
     XS_client client = (XS_client) pv;
 
+    // 统计服务的回调引用 pool 和 inotify, 必须先停止
+    metrics_serve_stop();
+
     LOGGER_TRACE("inotifytools_cleanup()");
     inotifytools_cleanup_s();
 
@@ -200,7 +255,45 @@ void xs_client_delete (void *pv)
         threadpool_destroy(client->pool, 0);
     }
 
+    // 工作线程已经停止, 不再写跟踪记录
+    evtrace_close();
+
+    if (client->kafka_checkpoint) {
+        XS_event_checkpoint_close(client->kafka_checkpoint);
+        client->kafka_checkpoint = 0;
+    }
+
+    if (client->sync_progress) {
+        XS_sync_progress_close(client->sync_progress);
+        client->sync_progress = 0;
+    }
+
+    watch_event_batch_free(&client->sweep_batch);
+    watch_event_batch_free(&client->inotify_batch);
+
     if (client->thread_args) {
+        if (client->kafka_tailer) {
+            kafkatools_producer_api_t *api = 0;
+
+            // 跟踪器的批次引用 mmap 区域: 先等待全部 producer 投递完成
+            for (i = 0; i < client->threads; ++i) {
+                perthread_data * perdata = client->thread_args[i];
+
+                if (perdata && perdata->kafka_producer_ready) {
+                    api = &perdata->kt_producer_api;
+
+                    if (api->kt_producer_flush(api->producer, 5000) != KAFKATOOLS_SUCCESS) {
+                        LOGGER_WARN("kafka flush: %s", api->kt_producer_get_errstr(api->producer));
+                    }
+                }
+            }
+
+            if (api) {
+                api->kt_tailer_destroy(client->kafka_tailer);
+            }
+            client->kafka_tailer = 0;
+        }
+
         for (i = 0; i < client->threads; ++i) {
             perthread_data * perdata = client->thread_args[i];
             client->thread_args[i] = 0;
@@ -209,17 +302,44 @@ void xs_client_delete (void *pv)
         mem_free(client->thread_args);
     }
 
+    XS_conn_reactor_free(&client->reactor);
+
+    for (i = 1; i <= XSYNC_SERVER_MAXID; i++) {
+        XS_server_conn conn = client->server_conns[i];
+
+        if (conn) {
+            client->server_conns[i] = 0;
+
+            XS_server_conn_release(&conn);
+        }
+    }
+
     LOGGER_TRACE("clean event_rbtree");
     threadlock_destroy(&client->rbtree_lock);
     do {
-        // TODO:
-        rbtree_clean(&client->event_rbtree);
+        watch_event_t *event;
+
+        while ((event = event_rbtree_first(&client->event_rbtree)) != 0) {
+            event_rbtree_erase(&client->event_rbtree, event);
+            watch_event_free(client->pathtab, event);
+        }
     } while (0);
 
+    if (client->pathtab) {
+        pathtab_free(client->pathtab);
+        client->pathtab = 0;
+    }
+
+    if (client->watch_repair) {
+        XS_watch_repair_free(client->watch_repair);
+        client->watch_repair = 0;
+    }
+
     LOGGER_TRACE("pthread_cond_destroy");
     pthread_cond_destroy(&client->condition);
 
     LuaCtxFree(&client->luactx);
+    pthread_rwlock_destroy(&client->luactx_lock);
 
 #ifdef XSYNC_USE_STATIC_PATHID_TABLE
     for (i = 0; i < XSYNC_WATCH_PATHID_MAX; i++) {
@@ -230,8 +350,15 @@ void xs_client_delete (void *pv)
         }
     }
 #else
-    // TODO:
-    rbtree_clean(&client->wd_pathid_rbtree);
+    do {
+        struct wd_pathid_t *wdp;
+
+        while ((wdp = wd_pathid_rbtree_first(&client->wd_pathid_rbtree)) != 0) {
+            wd_pathid_rbtree_erase(&client->wd_pathid_rbtree, wdp);
+            mem_free(wdp);
+        }
+        client->wd_pathid_count = 0;
+    } while (0);
 #endif
 
     LOGGER_TRACE("~XS_client(%p)", client);
@@ -280,13 +407,9 @@ int xs_client_find_wpath_inlock (XS_client client, const char *wpath, char *path
         }
 #else
         do {
-            red_black_node_t *node;
-            struct wd_pathid_t wdpbuf;
-
-            wdpbuf.wd = wd;
-            node = rbtree_find(&client->wd_pathid_rbtree, &wdpbuf);
-            if (node) {
-                pathid = ((struct wd_pathid_t *) node->object)->pathid;
+            struct wd_pathid_t *wdp = wd_pathid_rbtree_find(&client->wd_pathid_rbtree, &wd);
+            if (wdp) {
+                pathid = wdp->pathid;
             }
         } while (0);
 #endif
@@ -342,6 +465,124 @@ int xs_client_find_wpath_inlock (XS_client client, const char *wpath, char *path
 }
 
 
+/**
+ * 记录 pathid 目录的 wd. 在 inotifytools 锁内调用. 失败返回 0
+ */
+static int client_set_wd_pathid (XS_client client, int wd_pathid, const char *name)
+{
+#ifdef XSYNC_USE_STATIC_PATHID_TABLE
+    if (wd_pathid < 0 || wd_pathid >= XSYNC_WATCH_PATHID_MAX) {
+        LOGGER_ERROR("too many watch pathid(wd=%d) in table. see XSYNC_WATCH_PATHID_MAX (=%d) in client.mk", wd_pathid, XSYNC_WATCH_PATHID_MAX);
+        return 0;
+    } else {
+        int len = strlen(name);
+
+        char *pathid = client->wd_pathid_table[wd_pathid];
+        if (pathid) {
+            // 如果已经存在则先删除
+            mem_free(pathid);
+        }
+
+        pathid = mem_alloc(len + 1);
+        memcpy(pathid, name, len);
+        pathid[len] = '\0';
+
+        client->wd_pathid_table[wd_pathid] = pathid;
+    }
+#else
+    if (wd_pathid < 0 || client->wd_pathid_count >= XSYNC_WATCH_PATHID_MAX) {
+        LOGGER_ERROR("too many watch pathid(wd=%d) in tree. see XSYNC_WATCH_PATHID_MAX (=%d) in client.mk", wd_pathid, XSYNC_WATCH_PATHID_MAX);
+        return 0;
+    } else {
+        struct wd_pathid_t * exist;
+        int len = strlen(name);
+        struct wd_pathid_t * wdpObject = (struct wd_pathid_t *) mem_alloc_zero(1, sizeof(*wdpObject) + len + 1);
+
+        wdpObject->wd = wd_pathid;
+        wdpObject->len = len;
+        memcpy(wdpObject->pathid, name, len + 1);
+
+        exist = wd_pathid_rbtree_insert(&client->wd_pathid_rbtree, &wdpObject->wd, wdpObject);
+        if (exist) {
+            // 如果已经存在则原位替换
+            rb_replace_node(&exist->rbnode, &wdpObject->rbnode, &client->wd_pathid_rbtree);
+            mem_free(exist);
+        } else {
+            client->wd_pathid_count++;
+        }
+    }
+#endif
+
+    return 1;
+}
+
+
+/**
+ * wd 对应的 pathid, 不是 pathid 目录返回 0. 在 inotifytools 锁内调用
+ */
+static const char * client_get_wd_pathid (XS_client client, int wd)
+{
+#ifdef XSYNC_USE_STATIC_PATHID_TABLE
+    return ((wd >= 0 && wd < XSYNC_WATCH_PATHID_MAX)? client->wd_pathid_table[wd] : 0);
+#else
+    struct wd_pathid_t *wdp = wd_pathid_rbtree_find(&client->wd_pathid_rbtree, &wd);
+
+    return (wdp? wdp->pathid : 0);
+#endif
+}
+
+
+/**
+ * 删除 pathid 目录的 wd 记录. 在 inotifytools 锁内调用
+ */
+static void client_del_wd_pathid (XS_client client, int wd)
+{
+#ifdef XSYNC_USE_STATIC_PATHID_TABLE
+    if (wd >= 0 && wd < XSYNC_WATCH_PATHID_MAX && client->wd_pathid_table[wd]) {
+        mem_free(client->wd_pathid_table[wd]);
+        client->wd_pathid_table[wd] = 0;
+    }
+#else
+    struct wd_pathid_t *wdp = wd_pathid_rbtree_find(&client->wd_pathid_rbtree, &wd);
+
+    if (wdp) {
+        wd_pathid_rbtree_erase(&client->wd_pathid_rbtree, wdp);
+        client->wd_pathid_count--;
+
+        mem_free(wdp);
+    }
+#endif
+}
+
+
+/**
+ * 全部 pathid 目录的 wd. 在 inotifytools 锁内调用. 返回 wd 的数目
+ */
+static int client_list_wd_pathids (XS_client client, int wds[XSYNC_WATCH_PATHID_MAX])
+{
+    int num = 0;
+
+#ifdef XSYNC_USE_STATIC_PATHID_TABLE
+    int wd;
+
+    for (wd = 0; wd < XSYNC_WATCH_PATHID_MAX; wd++) {
+        if (client->wd_pathid_table[wd]) {
+            wds[num++] = wd;
+        }
+    }
+#else
+    struct wd_pathid_t *wdp;
+
+    for (wdp = wd_pathid_rbtree_first(&client->wd_pathid_rbtree);
+        wdp && num < XSYNC_WATCH_PATHID_MAX; wdp = wd_pathid_rbtree_next(wdp)) {
+        wds[num++] = wdp->wd;
+    }
+#endif
+
+    return num;
+}
+
+
 __no_warning_unused(static)
 int client_init_watch_path (const char *path, int pathlen, struct mydirent *myent, void *arg1, void *arg2)
 {
@@ -371,61 +612,10 @@ int client_init_watch_path (const char *path, int pathlen, struct mydirent *myen
                         // 添加目录监视成功
                         int wd_pathid = inotifytools_wd_from_filename(abspath);
 
-#ifdef XSYNC_USE_STATIC_PATHID_TABLE
-                        if (wd_pathid < 0 || wd_pathid >= XSYNC_WATCH_PATHID_MAX) {
-                            LOGGER_ERROR("too many watch pathid(wd=%d) in table. see XSYNC_WATCH_PATHID_MAX (=%d) in client.mk", wd_pathid, XSYNC_WATCH_PATHID_MAX);
-
-                            __inotifytools_unlock();
-                            return (-4);
-                        } else {
-                            int len = strlen(myent->ent.d_name);
-
-                            char *pathid = client->wd_pathid_table[wd_pathid];
-                            if (pathid) {
-                                // 如果已经存在则先删除
-                                mem_free(pathid);
-                            }
-
-                            pathid = mem_alloc(len + 1);
-                            memcpy(pathid, myent->ent.d_name, len);
-                            pathid[len] = '\0';
-
-                            client->wd_pathid_table[wd_pathid] = pathid;
-                        }
-#else
-                        if (wd_pathid < 0 || rbtree_size(&client->wd_pathid_rbtree) >= XSYNC_WATCH_PATHID_MAX) {
-                            LOGGER_ERROR("too many watch pathid(wd=%d) in tree. see XSYNC_WATCH_PATHID_MAX (=%d) in client.mk", wd_pathid, XSYNC_WATCH_PATHID_MAX);
-
+                        if (! client_set_wd_pathid(client, wd_pathid, myent->ent.d_name)) {
                             __inotifytools_unlock();
                             return (-4);
-                        } else {
-                            int is_new_node;
-                            red_black_node_t * node;
-                            int len = strlen(myent->ent.d_name);
-                            struct wd_pathid_t * wdpObject = (struct wd_pathid_t *) mem_alloc_zero(1, sizeof(*wdpObject) + len + 1);
-
-                            wdpObject->wd = wd_pathid;
-                            wdpObject->len = len;
-                            memcpy(wdpObject->pathid, myent->ent.d_name, len + 1);
-
-                            node = rbtree_insert_unique(&client->wd_pathid_rbtree, (void *) wdpObject, &is_new_node);
-                            if (! is_new_node) {
-                                // 如果已经存在则先删除
-                                void * object = node->object;
-                                rbtree_remove_at(&client->wd_pathid_rbtree, node);
-                                mem_free(object);
-
-                                // 再次插入节点
-                                rbtree_insert_unique(&client->wd_pathid_rbtree, (void *) wdpObject, &is_new_node);
-                                if (! is_new_node) {
-                                    LOGGER_ERROR("should never run to this! see rbtree_insert_unique() in red_black_tree.c");
-
-                                    __inotifytools_unlock();
-                                    return (-4);
-                                }
-                            }
                         }
-#endif
                     }
                 }
                 __inotifytools_unlock();
@@ -442,13 +632,468 @@ int client_init_watch_path (const char *path, int pathlen, struct mydirent *myen
 }
 
 
+/**
+ * 后序遍历删除子目录的监视: arg1 是删除失败的计数
+ */
+__no_warning_unused(static)
+int lscb_remove_watch_tree (const char *path, int pathlen, struct mydirent *myent, void *arg1, void *arg2)
+{
+    if (myent->isdir && ! myent->islnk) {
+        int wd;
+
+        char pathbuf[PATH_MAX];
+
+        listdir(path, pathbuf, sizeof(pathbuf), (listdir_callback_t) lscb_remove_watch_tree, arg1, 0);
+
+        wd = inotifytools_wd_from_filename(path);
+
+        if (wd > 0 && ! inotifytools_remove_watch_by_wd(wd)) {
+            LOGGER_ERROR("inotify remove wpath fail: (%d: %s)", wd, path);
+
+            (*(int *) arg1)++;
+        }
+    }
+
+    return 1;
+}
+
+
+/**
+ * 删除目录 (以 '/' 结尾) 及其全部子目录的监视. 在 inotifytools 锁内调用.
+ *   已经不存在的目录的监视由内核删除 (IN_IGNORED), 不算失败. 全部成功返回 1
+ */
+int XS_client_remove_watch_tree (XS_client client, const char *path)
+{
+    int wd, failures = 0;
+
+    char pathbuf[PATH_MAX];
+
+    struct stat sbuf;
+
+    if (lstat(path, &sbuf) == 0 && S_ISDIR(sbuf.st_mode)) {
+        listdir(path, pathbuf, sizeof(pathbuf), (listdir_callback_t) lscb_remove_watch_tree, (void *) &failures, 0);
+    }
+
+    wd = inotifytools_wd_from_filename(path);
+
+    if (wd > 0 && ! inotifytools_remove_watch_by_wd(wd)) {
+        if (lstat(path, &sbuf) == 0) {
+            LOGGER_ERROR("inotify remove wpath fail: (%d: %s)", wd, path);
+
+            failures++;
+        }
+    }
+
+    return (failures? 0 : 1);
+}
+
+
+/**
+ * 只添加新的或者指向了其他目录的 pathid 链接: arg2 是 sync_watch_t
+ */
+typedef struct sync_watch_t
+{
+    int changes;
+    int failures;
+} sync_watch_t;
+
+
+__no_warning_unused(static)
+int lscb_sync_watch_path (const char *path, int pathlen, struct mydirent *myent, void *arg1, void *arg2)
+{
+    XS_client client = (XS_client) arg1;
+
+    sync_watch_t *sync = (sync_watch_t *) arg2;
+
+    if (myent->isdir && myent->islnk) {
+        int wd;
+        const char *pathid;
+
+        char pathbuf[PATH_MAX];
+
+        if (! realpath(path, pathbuf)) {
+            LOGGER_WARN("realpath error(%d): %s - (%s)", errno, strerror(errno), path);
+            return 1;
+        }
+
+        slashpath(pathbuf, sizeof(pathbuf));
+
+        __inotifytools_lock();
+        wd = inotifytools_wd_from_filename(pathbuf);
+        pathid = (wd > 0? client_get_wd_pathid(client, wd) : 0);
+
+        if (pathid && ! strcmp(pathid, myent->ent.d_name)) {
+            // 没有变化
+            __inotifytools_unlock();
+            return 1;
+        }
+        __inotifytools_unlock();
+
+        LOGGER_NOTICE("add watch pathid: %s (%s)", myent->ent.d_name, pathbuf);
+
+        if (client_init_watch_path(path, pathlen, myent, arg1, 0) == 1) {
+            sync->changes++;
+        } else {
+            sync->failures++;
+        }
+    }
+
+    return 1;
+}
+
+
+/**
+ * 比较 watch_config 下的 pathid 链接和当前监视的 pathid 目录 (wd_pathid),
+ *   只删除和添加变化的 pathid 目录, 没有变化的目录不重新遍历, 监视不中断.
+ *
+ * 返回值:
+ *  >= 0: 变化的 pathid 数目
+ *    -1: 有 pathid 目录添加或者删除失败, 稍后重试
+ */
+int XS_client_conf_sync_watch (XS_client client)
+{
+    int i, num, wd;
+
+    int wds[XSYNC_WATCH_PATHID_MAX];
+
+    char linkbuf[PATH_MAX];
+    char pathbuf[PATH_MAX];
+
+    sync_watch_t sync = {0, 0};
+
+    // 删除已经不存在或者指向了其他目录的 pathid
+    __inotifytools_lock();
+
+    num = client_list_wd_pathids(client, wds);
+
+    for (i = 0; i < num; i++) {
+        struct stat sbuf;
+
+        const char *wdpath;
+        const char *pathid = client_get_wd_pathid(client, wds[i]);
+
+        snprintf(linkbuf, sizeof(linkbuf), "%s%s", client->watch_config, pathid);
+
+        if (lstat(linkbuf, &sbuf) == 0 && S_ISLNK(sbuf.st_mode) && realpath(linkbuf, pathbuf)) {
+            slashpath(pathbuf, sizeof(pathbuf));
+
+            wd = inotifytools_wd_from_filename(pathbuf);
+
+            if (wd == wds[i]) {
+                continue;
+            }
+        }
+
+        wdpath = inotifytools_filename_from_wd(wds[i]);
+
+        LOGGER_NOTICE("remove watch pathid: %s (%s)", pathid, (wdpath? wdpath : "(null)"));
+
+        if (wdpath) {
+            // 删除监视之后 wdpath 不再有效
+            snprintf(pathbuf, sizeof(pathbuf), "%s", wdpath);
+
+            if (! XS_client_remove_watch_tree(client, pathbuf)) {
+                sync.failures++;
+                continue;
+            }
+        }
+
+        client_del_wd_pathid(client, wds[i]);
+        sync.changes++;
+    }
+
+    __inotifytools_unlock();
+
+    // 添加新的 pathid
+    if (listdir(client->watch_config, linkbuf, sizeof(linkbuf), (listdir_callback_t) lscb_sync_watch_path, (void*) client, (void*) &sync) != 0) {
+        LOGGER_ERROR("listdir fail: %s", client->watch_config);
+        return (-1);
+    }
+
+    if (sync.changes || sync.failures) {
+        LOGGER_NOTICE("sync watch pathid: changes=%d failures=%d", sync.changes, sync.failures);
+    }
+
+    return (sync.failures? (-1) : sync.changes);
+}
+
+
+/**
+ * 创建过滤用的脚本环境 (多线程共用): 检查 module_version() 和批量过滤函数.
+ *   启动和重新加载脚本时调用. 失败返回 0
+ */
+lua_context XS_client_filter_luactx_create (const char *events_lua, int *filter_files, int *filter_ffi)
+{
+    int err;
+    char *result = 0;
+
+    lua_context luactx = 0;
+
+    *filter_files = 0;
+    *filter_ffi = 0;
+
+    err = LuaCtxNew(events_lua, LUACTX_THREAD_MODE_MULTI, NULL, &luactx);
+    if (err != LUACTX_SUCCESS) {
+        LOGGER_ERROR("LuaCtxNew fail(%d): %s", err, events_lua);
+        return 0;
+    }
+
+    if (LuaCtxCall(luactx, "module_version", NULL, NULL) != LUACTX_SUCCESS) {
+        LOGGER_ERROR("LuaCtxCall module_version() fail: %s", LuaCtxGetError(luactx));
+    } else {
+        if (LuaCtxGetValueByKey(luactx, "result", 6, &result) && ! strcmp(result, "SUCCESS")) {
+            char * version;
+            char * author;
+
+            if (LuaCtxGetValueByKey(luactx, "version", 7, &version) && LuaCtxGetValueByKey(luactx, "author", 6, &author)) {
+                LOGGER_NOTICE("version=%s, author=%s", version, author);
+            } else {
+                result = 0;
+                LOGGER_ERROR("LuaCtxCall module_version() fail: version or author not found");
+            }
+        } else {
+            result = 0;
+            LOGGER_ERROR("LuaCtxCall module_version() fail");
+        }
+    }
+
+    if (! result) {
+        LuaCtxFree(&luactx);
+        return 0;
+    }
+
+    *filter_files = LuaCtxHasFunction(luactx, "filter_files");
+
+    if (*filter_files) {
+        LOGGER_NOTICE("filter files in batch: filter_files() (batch=%d)", XSYNC_FILTER_BATCH_MAXNUM);
+    }
+
+    if (LuaCtxHasFFI(luactx) && LuaCtxHasFunction(luactx, "filter_files_ffi")) {
+        // 脚本和 C 代码的结构定义必须一致, 否则使用字符串接口
+        if (LuaCtxFFIDef(luactx, WATCH_EVENT_FFI_CDEF) != LUACTX_SUCCESS) {
+            LOGGER_ERROR("LuaCtxFFIDef fail: %s", LuaCtxGetError(luactx));
+        } else if (LuaCtxFFISizeof(luactx, "struct watch_event_buf_t") != (int) sizeof(struct watch_event_buf_t) ||
+            LuaCtxFFISizeof(luactx, "struct watch_filter_out_t") != (int) sizeof(watch_filter_out_t)) {
+            LOGGER_ERROR("ffi cdef not match C structs: filter_files_ffi() not used");
+        } else {
+            *filter_ffi = 1;
+
+            LOGGER_NOTICE("filter files in batch: filter_files_ffi() (batch=%d)", XSYNC_FILTER_BATCH_MAXNUM);
+        }
+    }
+
+    return luactx;
+}
+
+
+/**
+ * 启动时并行遍历的线程数. 脚本定义了 inotify_watch_on_* 回调时需要
+ *   inotifytools 逐个目录回调, 返回 1 (不并行)
+ */
+static int client_watch_crawl_threads (XS_client client)
+{
+    lua_context luactx;
+
+    int hooks = 0;
+
+    if (XSYNC_WATCH_CRAWL_THREADS <= 1) {
+        return 1;
+    }
+
+    if ((luactx = client_luactx_lock(client)) != 0) {
+        hooks = LuaCtxHasFunction(luactx, "inotify_watch_on_query") ||
+                LuaCtxHasFunction(luactx, "inotify_watch_on_ready") ||
+                LuaCtxHasFunction(luactx, "inotify_watch_on_error");
+
+        client_luactx_unlock(client, luactx);
+    }
+
+    if (hooks) {
+        LOGGER_NOTICE("inotify_watch_on_* defined in lua: add watch dirs one by one");
+        return 1;
+    }
+
+    return XSYNC_WATCH_CRAWL_THREADS;
+}
+
+
+/* watch_config 下的全部 pathid 链接 */
+typedef struct crawl_watch_t
+{
+    int num;
+
+    char *pathids[XSYNC_WATCH_PATHID_MAX];
+    char *abspaths[XSYNC_WATCH_PATHID_MAX];
+
+    /* 添加监视时忽略的目录 (已经删除或者没有权限) */
+    int skipped;
+} crawl_watch_t;
+
+
+__no_warning_unused(static)
+int lscb_crawl_watch_path (const char *path, int pathlen, struct mydirent *myent, void *arg1, void *arg2)
+{
+    crawl_watch_t *cw = (crawl_watch_t *) arg2;
+
+    if (myent->isdir) {
+        if (myent->islnk) {
+            char abspath[PATH_MAX];
+
+            if (! realpath(path, abspath)) {
+                LOGGER_WARN("realpath error(%d): %s - (%s)", errno, strerror(errno), path);
+                return 1;
+            }
+
+            // 目录名必须以 '/' 结尾
+            slashpath(abspath, sizeof(abspath));
+
+            if (cw->num == XSYNC_WATCH_PATHID_MAX) {
+                LOGGER_ERROR("too many watch pathid. see XSYNC_WATCH_PATHID_MAX (=%d) in client.mk", XSYNC_WATCH_PATHID_MAX);
+                return (-4);
+            }
+
+            cw->pathids[cw->num] = strdup(myent->ent.d_name);
+            cw->abspaths[cw->num] = strdup(abspath);
+            cw->num++;
+        } else {
+            LOGGER_WARN("watch path not a link: %s", path);
+        }
+    }
+
+    return 1;
+}
+
+
+/**
+ * 添加一个目录的监视. 在 inotifytools 锁内调用
+ */
+static int client_crawl_watch_dir (const char *dirpath, void *arg)
+{
+    crawl_watch_t *cw = (crawl_watch_t *) arg;
+
+    if (! inotifytools_watch_file(dirpath, INOTI_EVENTS_MASK, 0, 0)) {
+        int err = inotifytools_error();
+
+        // 与 inotifytools_watch_recursively 相同: 这些错误继续
+        if (err == ENOENT || err == EACCES || err == ELOOP || err == ENOTDIR) {
+            cw->skipped++;
+            return 1;
+        }
+
+        LOGGER_ERROR("inotify add watch error(%d): %s (%s)", err, strerror(err), dirpath);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * 并行遍历全部 pathid 目录, 遍历结束之后在一次 inotifytools 锁内添加全部监视.
+ *   inotifytools 的 wd 表不能从外部写入, 所以 inotify_add_watch 仍然由
+ *   inotifytools_watch_file 调用, 只是不再在锁内读目录和 lstat 文件.
+ */
+static XS_RESULT client_init_watch_crawl (XS_client client, int threads)
+{
+    int i, wd;
+
+    char pathbuf[PATH_MAX];
+
+    XS_watch_crawl crawl;
+    crawl_watch_t *cw;
+
+    XS_RESULT result = XS_ERROR;
+
+    uint64_t t0, t1, t2;
+
+    cw = (crawl_watch_t *) mem_alloc_zero(1, sizeof(crawl_watch_t));
+
+    if (listdir(client->watch_config, pathbuf, sizeof(pathbuf), (listdir_callback_t) lscb_crawl_watch_path, (void*) client, (void*) cw) != 0) {
+        LOGGER_ERROR("listdir fail: %s", client->watch_config);
+        goto out_free;
+    }
+
+    if (! cw->num) {
+        result = XS_SUCCESS;
+        goto out_free;
+    }
+
+    if (XS_watch_crawl_create(threads, &crawl) != XS_SUCCESS) {
+        goto out_free;
+    }
+
+    for (i = 0; i < cw->num; i++) {
+        if (XS_watch_crawl_add_root(crawl, cw->abspaths[i]) != XS_SUCCESS) {
+            goto out_crawl;
+        }
+    }
+
+    t0 = metrics_now_us();
+
+    if (XS_watch_crawl_run(crawl) != XS_SUCCESS) {
+        goto out_crawl;
+    }
+
+    t1 = metrics_now_us();
+
+    __inotifytools_lock();
+    {
+        if (XS_watch_crawl_merge(crawl, client_crawl_watch_dir, (void*) cw) != 0) {
+            __inotifytools_unlock();
+            goto out_crawl;
+        }
+
+        for (i = 0; i < cw->num; i++) {
+            wd = inotifytools_wd_from_filename(cw->abspaths[i]);
+
+            if (wd == -1) {
+                // pathid 目录本身添加失败
+                LOGGER_ERROR("inotify add wpath fail: (%s => %s)", cw->pathids[i], cw->abspaths[i]);
+
+                __inotifytools_unlock();
+                goto out_crawl;
+            }
+
+            if (! client_set_wd_pathid(client, wd, cw->pathids[i])) {
+                __inotifytools_unlock();
+                goto out_crawl;
+            }
+
+            LOGGER_INFO("inotify add wpath success: (%s => %s)", cw->pathids[i], cw->abspaths[i]);
+        }
+    }
+    __inotifytools_unlock();
+
+    t2 = metrics_now_us();
+
+    LOGGER_NOTICE("watch %"PRId64" dirs (skipped=%d, errors=%d): crawl %"PRIu64" ms by %d threads, add %"PRIu64" ms",
+        XS_watch_crawl_dirs(crawl) - cw->skipped, cw->skipped, XS_watch_crawl_errors(crawl),
+        (t1 - t0) / 1000, XS_watch_crawl_threads(crawl), (t2 - t1) / 1000);
+
+    result = XS_SUCCESS;
+
+out_crawl:
+    XS_watch_crawl_free(crawl);
+
+out_free:
+    for (i = 0; i < cw->num; i++) {
+        free(cw->pathids[i]);
+        free(cw->abspaths[i]);
+    }
+
+    mem_free(cw);
+
+    return result;
+}
+
+
 /**
  * 根据 watch 目录初始化
  *
  */
 XS_RESULT XS_client_conf_from_watch (XS_client client, const char *watch_root)
 {
-    int err, len;
+    int err, len, threads;
 
     char pathbuf[PATH_MAX];
 
@@ -473,44 +1118,26 @@ XS_RESULT XS_client_conf_from_watch (XS_client client, const char *watch_root)
         snprintf(pathbuf, sizeof(pathbuf), "%sevents-filter.lua", client->watch_config);
 
         if (access(pathbuf, F_OK|R_OK|X_OK) == 0) {
-			char * result = 0;
-
             LOGGER_NOTICE("loading: events-filter.lua -> %s", pathbuf);
 
-            if (LuaCtxNew(pathbuf, LUACTX_THREAD_MODE_MULTI, NULL, &client->luactx) != LUACTX_SUCCESS) {
-                LOGGER_FATAL("LuaCtxNew fail");
+            client->luactx = XS_client_filter_luactx_create(pathbuf, &client->lua_filter_files, &client->lua_filter_ffi);
+            if (! client->luactx) {
+                LOGGER_FATAL("XS_client_filter_luactx_create fail: %s", pathbuf);
                 return XS_ERROR;
             }
-
-			if (LuaCtxCall(client->luactx, "module_version", NULL, NULL) != LUACTX_SUCCESS) {
-				LOGGER_FATAL("LuaCtxCall module_version() fail: %s", LuaCtxGetError(client->luactx));
-			} else {
-				if (LuaCtxGetValueByKey(client->luactx, "result", 6, &result) && ! strcmp(result, "SUCCESS")) {
-					char * version;
-					char * author;
-
-					if (LuaCtxGetValueByKey(client->luactx, "version", 7, &version) && LuaCtxGetValueByKey(client->luactx, "author", 6, &author)) {
-						LOGGER_NOTICE("version=%s, author=%s", version, author);
-					} else {
-						result = 0;
-						LOGGER_FATAL("LuaCtxCall module_version() fail: version or author not found");
-					}
-				} else {
-					result = 0;
-					LOGGER_FATAL("LuaCtxCall module_version() fail");
-				}
-			}
-
-			if (! result) {
-				LuaCtxFree(&client->luactx);
-                return XS_ERROR;
-			}
         } else {
             LOGGER_ERROR("file access error(%d): %s (%s)", errno, strerror(errno), pathbuf);
             return XS_ERROR;
         }
     }
 
+    threads = client_watch_crawl_threads(client);
+
+    if (threads > 1) {
+        // 并行遍历, 一次添加全部监视
+        return client_init_watch_crawl(client, threads);
+    }
+
     err = listdir(client->watch_config, pathbuf, sizeof(pathbuf), (listdir_callback_t) client_init_watch_path, (void*) client, 0);
 
     return (err == 0? XS_SUCCESS : XS_ERROR);
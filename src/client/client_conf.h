@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-25
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 20:05:37
  */
 
 #ifndef CLIENT_CONF_H_INCLUDED
@@ -41,12 +41,16 @@ extern "C" {
 #endif
 
 #include "server_conn.h"
+#include "conn_reactor.h"
 #include "watch_entry.h"
 #include "watch_event.h"
 
 #include "perthread_data.h"
+#include "event_checkpoint.h"
+#include "sync_progress.h"
+#include "watch_repair.h"
 
-#include "../common/red_black_tree.h"
+#include "../common/rbtree.h"
 
 
 #define XS_client_threadpool_unused_queues(client)    \
@@ -84,9 +88,33 @@ typedef struct xs_client_t
      */
     xs_server_opts  servers_opts[XSYNC_SERVER_MAXID + 1];
 
+    /**
+     * 到每个服务器的连接 (XMUX 多路复用), 所有线程共享:
+     *   perthread_data.server_conns[sid] 引用这里的连接
+     */
+    xs_server_conn_t *server_conns[XSYNC_SERVER_MAXID + 1];
+
+    /* 负责全部服务器连接的 I/O */
+    xs_conn_reactor_t *reactor;
+
     /* 是(1)否(0)使用 kafka */
     int kafka;
 
+    /* 按行发送文件到 kafka 的跟踪器, 全部线程的 producer 共用 */
+    kt_tailer kafka_tailer;
+
+    /* kafka 事件消息的日志和每个文件的检查点 (watch/<clientid>.kafka-journal) */
+    XS_event_checkpoint kafka_checkpoint;
+
+    /* 1: 重试投递失败的事件消息的任务已经在队列中 */
+    volatile int kafka_retry_queued;
+
+    /* 每个 (条目, 服务器) 已确认的同步偏移 (watch/<clientid>.sync-progress) */
+    XS_sync_progress sync_progress;
+
+    /* 基准测试 (--bench): 事件不发送到服务器和 kafka */
+    int bench;
+
     /**
      * interval in seconds
      */
@@ -102,9 +130,24 @@ typedef struct xs_client_t
     threadpool_t *pool;
     void        **thread_args;
 
-    /* 是(1)否(0)重启监视(当配置更改时有必要重启监视) */
+    /* 是(1)否(0)重新同步监视: 只添加和删除变化的 pathid 目录 (XS_client_conf_sync_watch) */
     volatile int inotify_reload;
 
+    /* 添加或者删除监视失败的目录: inotify 线程按退避时间重试 */
+    XS_watch_repair watch_repair;
+
+    /* 下一次执行修复队列和检查 watch_config 修改的时间 (微秒) */
+    uint64_t watch_poll_us;
+    uint64_t watch_check_us;
+
+    /* 同步失败之后的重试次数和下一次重试的时间 (微秒) */
+    int watch_resync_retries;
+    uint64_t watch_resync_us;
+
+    /* watch_config 目录的修改时间: pathid 链接添加或者删除时改变 */
+    time_t watch_config_mtime;
+    long watch_config_mtime_ns;
+
     /* 刷新时间: 默认 0 */
     volatile time_t ready_time;
 
@@ -117,20 +160,48 @@ typedef struct xs_client_t
     /* 每次刷新的文件数 */
     int64_t sweep_files;
 
-    /* lua context */
+    /* lua context: 过滤脚本环境. 读者持有 luactx_lock 的读锁 (client_luactx_lock),
+     *   重新加载脚本时在写锁内替换
+     */
     lua_context luactx;
+    pthread_rwlock_t luactx_lock;
+
+    /* filter_file 返回 RELOAD: 要求 inotify 线程重新加载脚本 */
+    volatile int lua_reload;
+
+    /* 下一次检查脚本文件修改的时间 (微秒) */
+    uint64_t lua_check_us;
+
+    /* 脚本定义了 filter_files: 成批过滤文件, 否则逐个调用 filter_file */
+    int lua_filter_files;
+
+    /* LuaJIT 后端并且脚本定义了 filter_files_ffi: 脚本直接读批次中的事件 */
+    int lua_filter_ffi;
 
     /* 存放监视 wd 对应的 pathid. 最多监视 XSYNC_WATCH_PATHID_MAX=256 个 pathid 目录 */
 #ifdef XSYNC_USE_STATIC_PATHID_TABLE
     char *wd_pathid_table[XSYNC_WATCH_PATHID_MAX];
 #else
-    red_black_tree_t  wd_pathid_rbtree;
+    struct rb_root wd_pathid_rbtree;
+    int wd_pathid_count;
 #endif
 
-    /* 当前的监视事件树: 用于缓存正在处理的事件, 防止事件被重复处理 */
-    red_black_tree_t  event_rbtree;
+    /* 当前的监视事件树: 用于缓存正在处理的事件, 防止事件被重复处理.
+     *   节点嵌入在 watch_event_t 中, 插入和删除不分配内存
+     */
+    struct rb_root event_rbtree;
     pthread_mutex_t rbtree_lock;
 
+    /* 事件所在目录的路径表: 事件只保存目录的 id */
+    pathtab_t *pathtab;
+
+    /* sweep 线程读到的文件事件使用的字符串区 */
+    watch_event_arena_t sweep_arena;
+
+    /* sweep 线程和 inotify 读线程攒成一批过滤的文件事件 */
+    watch_event_batch_t sweep_batch;
+    watch_event_batch_t inotify_batch;
+
     /* application home dir, for instance: '/opt/xclient/sbin/' */
     int apphome_len;
     char apphome[FILENAME_MAXLEN + FILENAME_MAXLEN + 2];
@@ -190,23 +261,56 @@ inline void client_set_inotify_reload (struct xs_client_t *client, int reload)
 }
 
 
+/**
+ * 锁定过滤脚本环境: 返回 0 表示没有脚本 (不需要解锁)
+ */
 __no_warning_unused(static)
-int event_rbtree_cmp(void *newObject, void *nodeObject)
+inline lua_context client_luactx_lock (struct xs_client_t *client)
 {
-    return watch_event_compare((XS_watch_event) newObject, (XS_watch_event) nodeObject);
+    lua_context luactx;
+
+    if (pthread_rwlock_rdlock(&client->luactx_lock) != 0) {
+        return 0;
+    }
+
+    luactx = client->luactx;
+
+    if (luactx && LuaCtxLockState(luactx)) {
+        return luactx;
+    }
+
+    pthread_rwlock_unlock(&client->luactx_lock);
+    return 0;
+}
+
+
+__no_warning_unused(static)
+inline void client_luactx_unlock (struct xs_client_t *client, lua_context luactx)
+{
+    LuaCtxUnlockState(luactx);
+    pthread_rwlock_unlock(&client->luactx_lock);
 }
 
 
 __no_warning_unused(static)
-void event_rbtree_op(void *object, void *param)
+inline int event_rbtree_cmp (const struct watch_event_buf_t *key, const watch_event_t *node)
 {
+    return watch_event_compare(key, node);
 }
 
+/**
+ * event_rbtree_find, event_rbtree_lookup, event_rbtree_link,
+ * event_rbtree_insert, event_rbtree_erase, event_rbtree_first ...
+ */
+RB_TREE_DEFINE(event_rbtree, watch_event_t, rbnode, struct watch_event_buf_t, event_rbtree_cmp)
+
 
 #ifndef XSYNC_USE_STATIC_PATHID_TABLE
 
 struct wd_pathid_t
 {
+    struct rb_node rbnode;
+
     int wd;
     char len;
     char pathid[0];
@@ -214,19 +318,12 @@ struct wd_pathid_t
 
 
 __no_warning_unused(static)
-int wd_pathid_rbtree_cmp (void *newObject, void *nodeObject)
+inline int wd_pathid_rbtree_cmp (const int *wd, const struct wd_pathid_t *node)
 {
-    int wdNew = ((struct wd_pathid_t *) newObject)->wd;
-    int wdOld = ((struct wd_pathid_t *) nodeObject)->wd;
-
-    return (wdNew == wdOld ? 0 : (wdNew > wdOld ? 1 : -1));
+    return (*wd == node->wd ? 0 : (*wd > node->wd ? 1 : -1));
 }
 
-
-__no_warning_unused(static)
-void wd_pathid_rbtree_op (void *object, void *param)
-{
-}
+RB_TREE_DEFINE(wd_pathid_rbtree, struct wd_pathid_t, rbnode, int, wd_pathid_rbtree_cmp)
 
 #endif
 
@@ -236,6 +333,12 @@ void wd_pathid_rbtree_op (void *object, void *param)
  */
 extern void xs_client_delete (void *pv);
 
+extern lua_context XS_client_filter_luactx_create (const char *events_lua, int *filter_files, int *filter_ffi);
+
+extern int XS_client_conf_sync_watch (XS_client client);
+
+extern int XS_client_remove_watch_tree (XS_client client, const char *path);
+
 extern int xs_client_find_wpath_inlock (XS_client client, const char *wpath, char *pathroute, ssize_t pathsize,
     char *clientid_buf, int clientid_cb, char *pathid_buf, int pathid_cb, char *route_buf, int route_cb);
 
@@ -0,0 +1,189 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: client_metrics.c
+ *   xsync-client 的运行统计指标
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-22
+ *
+ * @update: 2018-11-29 15:26:40
+ */
+
+#include "client_api.h"
+#include "client_conf.h"
+
+#include "client_metrics.h"
+
+
+xs_client_metrics_t xs_client_metrics = {
+    .events_received = -1,
+    .events_coalesced = -1,
+    .events_filtered = -1,
+    .events_dispatched = -1,
+    .event_task_seconds = -1,
+    .lua_filter_seconds = -1,
+    .lua_task_seconds = -1,
+    .lua_filter_files = -1,
+    .lua_reloads = -1,
+    .lua_reload_errors = -1,
+    .watch_pathid_changes = -1,
+    .watch_repair_failures = -1,
+    .watch_repairs = -1,
+    .kafka_delivery_seconds = -1,
+    .kafka_errors = -1,
+    .kafka_lines = -1,
+    .kafka_replayed = -1,
+    .kafka_pending = -1,
+    .bytes_sent = -1,
+    .queue_depth = -1,
+    .inotify_watches = -1,
+    .path_nodes = -1,
+    .path_bytes = -1
+};
+
+
+static int64_t client_queue_depth (void *arg)
+{
+    XS_client client = (XS_client) arg;
+
+    int unused = threadpool_unused_queues(client->pool);
+
+    return (unused < 0? 0 : client->queues - unused);
+}
+
+
+static int64_t client_inotify_watches (void *arg)
+{
+    return inotifytools_get_num_watches_s();
+}
+
+
+static int64_t client_watch_repairs (void *arg)
+{
+    XS_client client = (XS_client) arg;
+
+    return (client->watch_repair? XS_watch_repair_pendings(client->watch_repair) : 0);
+}
+
+
+static int64_t client_path_nodes (void *arg)
+{
+    XS_client client = (XS_client) arg;
+
+    return pathtab_count(client->pathtab);
+}
+
+
+static int64_t client_kafka_pending (void *arg)
+{
+    XS_client client = (XS_client) arg;
+
+    return (client->kafka_checkpoint? XS_event_checkpoint_pendings(client->kafka_checkpoint) : 0);
+}
+
+
+static int64_t client_path_bytes (void *arg)
+{
+    XS_client client = (XS_client) arg;
+
+    return (int64_t) pathtab_memory(client->pathtab);
+}
+
+
+void XS_client_metrics_register (struct xs_client_t *client)
+{
+    xs_client_metrics_t *m = &xs_client_metrics;
+
+    m->events_received = metrics_counter_register("xsync_client_events_received_total",
+        "inotify events read from kernel");
+
+    m->events_coalesced = metrics_counter_register("xsync_client_events_coalesced_total",
+        "events ignored because the same file is already in process");
+
+    m->events_filtered = metrics_counter_register("xsync_client_events_filtered_total",
+        "events rejected by illegal name chars or filter_file()");
+
+    m->lua_filter_files = metrics_counter_register("xsync_client_lua_filter_files_total",
+        "files passed to lua filter_file() or filter_files()");
+
+    m->lua_reloads = metrics_counter_register("xsync_client_lua_reloads_total",
+        "lua scripts reloaded without restarting watches");
+
+    m->lua_reload_errors = metrics_counter_register("xsync_client_lua_reload_errors_total",
+        "lua scripts failed to reload (old scripts kept)");
+
+    m->events_dispatched = metrics_counter_register("xsync_client_events_dispatched_total",
+        "events added to task queue");
+
+    m->kafka_errors = metrics_counter_register("xsync_client_kafka_errors_total",
+        "kafka messages failed to deliver");
+
+    m->kafka_lines = metrics_counter_register("xsync_client_kafka_lines_total",
+        "file lines queued to kafka by tailing watched files");
+
+    m->kafka_replayed = metrics_counter_register("xsync_client_kafka_replayed_total",
+        "undelivered kafka event messages replayed from journal at startup");
+
+    m->bytes_sent = metrics_counter_register("xsync_client_bytes_sent_total",
+        "bytes written to server connections");
+
+    m->queue_depth = metrics_gauge_register("xsync_client_queue_depth",
+        "tasks waiting in threadpool queue", client_queue_depth, client);
+
+    m->inotify_watches = metrics_gauge_register("xsync_client_inotify_watches",
+        "number of inotify watches", client_inotify_watches, client);
+
+    m->watch_pathid_changes = metrics_counter_register("xsync_client_watch_pathid_changes_total",
+        "watch pathid dirs added or removed by incremental sync");
+
+    m->watch_repair_failures = metrics_counter_register("xsync_client_watch_repair_failures_total",
+        "watch add or remove given up after retries");
+
+    m->watch_repairs = metrics_gauge_register("xsync_client_watch_repairs",
+        "dirs waiting for watch add or remove retry", client_watch_repairs, client);
+
+    m->path_nodes = metrics_gauge_register("xsync_client_path_nodes",
+        "nodes in path interning table", client_path_nodes, client);
+
+    m->path_bytes = metrics_gauge_register("xsync_client_path_bytes",
+        "memory used by path interning table", client_path_bytes, client);
+
+    m->kafka_pending = metrics_gauge_register("xsync_client_kafka_pending",
+        "kafka event messages journaled but not yet delivered", client_kafka_pending, client);
+
+    m->event_task_seconds = metrics_histogram_register("xsync_client_event_task_seconds",
+        "time to process one event task");
+
+    m->lua_filter_seconds = metrics_histogram_register("xsync_client_lua_filter_seconds",
+        "time spent in lua filter_file() or one filter_files() batch");
+
+    m->lua_task_seconds = metrics_histogram_register("xsync_client_lua_task_seconds",
+        "time spent in lua on_event_task()");
+
+    m->kafka_delivery_seconds = metrics_histogram_register("xsync_client_kafka_delivery_seconds",
+        "time to produce one kafka message synchronously");
+}
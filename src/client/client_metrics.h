@@ -0,0 +1,121 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: client_metrics.h
+ *   xsync-client 的运行统计指标 (see "../common/metrics.h")
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-22
+ *
+ * @update: 2018-11-29 15:26:40
+ */
+
+#ifndef CLIENT_METRICS_H_INCLUDED
+#define CLIENT_METRICS_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../common/metrics.h"
+
+
+/**
+ * 指标 id. 注册之前全部为 -1 (更新为空操作)
+ */
+typedef struct xs_client_metrics_t
+{
+    /* 读到的 inotify 事件 */
+    int events_received;
+
+    /* 正在处理中而被合并 (忽略) 的事件 */
+    int events_coalesced;
+
+    /* 被非法字符或者 filter_file() 过滤掉的事件 */
+    int events_filtered;
+
+    /* 加入任务队列的事件 */
+    int events_dispatched;
+
+    /* do_event_task 的处理时间 */
+    int event_task_seconds;
+
+    /* filter_file() (或者一批 filter_files()) 和 on_event_task() 的执行时间 */
+    int lua_filter_seconds;
+    int lua_task_seconds;
+
+    /* 交给脚本过滤的文件数: 和 lua_filter_seconds 的次数之比是平均批次大小 */
+    int lua_filter_files;
+
+    /* 脚本重新加载成功和失败的次数 */
+    int lua_reloads;
+    int lua_reload_errors;
+
+    /* 同步监视时变化的 pathid 数, 重试之后仍然失败 (放弃) 的目录修复 */
+    int watch_pathid_changes;
+    int watch_repair_failures;
+
+    /* 等待修复的目录: 导出时取值 */
+    int watch_repairs;
+
+    /* kafka 消息发送 (同步, 等待投递结果) 的时间和失败次数 */
+    int kafka_delivery_seconds;
+    int kafka_errors;
+
+    /* 按行发送到 kafka 的行数 (进入发送队列) */
+    int kafka_lines;
+
+    /* 启动时从日志重放的事件消息数, 日志中没有确认的消息数 */
+    int kafka_replayed;
+    int kafka_pending;
+
+    /* 写入服务器连接的字节数 */
+    int bytes_sent;
+
+    /* 任务队列深度和监视数: 导出时取值 */
+    int queue_depth;
+    int inotify_watches;
+
+    /* 路径表 (client->pathtab) 的节点数和内存 */
+    int path_nodes;
+    int path_bytes;
+} xs_client_metrics_t;
+
+
+extern xs_client_metrics_t xs_client_metrics;
+
+
+/**
+ * 注册全部客户端指标. 必须在工作线程启动之前调用
+ */
+extern void XS_client_metrics_register (struct xs_client_t *client);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* CLIENT_METRICS_H_INCLUDED */
@@ -0,0 +1,654 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: conn_reactor.c
+ *   client side reactor owns all server connections
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-15
+ *
+ * @update: 2018-11-30 16:02:37
+ */
+
+#include "client_api.h"
+
+#include "conn_reactor.h"
+#include "client_metrics.h"
+
+
+static ub8 reactor_now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ub8) ts.tv_sec * 1000 + (ub8) (ts.tv_nsec / 1000000);
+}
+
+
+static int reactor_conn_timeout_ms (XS_server_conn sconn)
+{
+    int timeosec = sconn->srvopts->sockopts.timeosec;
+
+    return (timeosec > 0? timeosec * 1000 : XSYNC_HEARTBEAT_TIMEOUT_MS);
+}
+
+
+static void reactor_conn_set_pollout (xs_conn_reactor_t *reactor, XS_server_conn sconn, int pollout)
+{
+    struct epoll_event ev;
+
+    if (sconn->pollout != pollout) {
+        ev.events = EPOLLIN | (pollout? EPOLLOUT : 0);
+        ev.data.ptr = sconn;
+
+        if (epoll_ctl(reactor->epollfd, EPOLL_CTL_MOD, sconn->sockfd, &ev) == 0) {
+            sconn->pollout = pollout;
+        }
+    }
+}
+
+
+/**
+ * 关闭连接, 丢弃流上的数据, 按指数退避 (带随机抖动) 安排重连
+ */
+static void reactor_conn_fail (xs_conn_reactor_t *reactor, XS_server_conn sconn, ub8 now, const char *reason)
+{
+    int half;
+
+    if (sconn->sockfd != -1) {
+        epoll_ctl(reactor->epollfd, EPOLL_CTL_DEL, sconn->sockfd, 0);
+
+        close(sconn->sockfd);
+        sconn->sockfd = -1;
+    }
+
+    __interlock_set(&sconn->state, XS_CONN_CLOSED);
+
+    sconn->pollout = 0;
+
+    sconn->ctllen = sconn->ctloff = 0;
+    sconn->txlen = sconn->txoff = 0;
+    sconn->rxlen = 0;
+    sconn->rxdata = 0;
+
+    XS_stream_mux_reset_all(&sconn->mux);
+
+    if (sconn->backoff_ms == 0) {
+        sconn->backoff_ms = XSYNC_RECONNECT_MIN_MS;
+    } else if (sconn->backoff_ms < XSYNC_RECONNECT_MAX_MS / 2) {
+        sconn->backoff_ms *= 2;
+    } else {
+        sconn->backoff_ms = XSYNC_RECONNECT_MAX_MS;
+    }
+
+    // 下次重连: [backoff/2, backoff]
+    half = sconn->backoff_ms / 2;
+
+    sconn->retry_at_ms = now + half + rand_gen(&sconn->rctx) % (half + 1);
+
+    LOGGER_WARN("server(%s:%s) %s: reconnect in %d ms", sconn->srvopts->host, sconn->srvopts->sport,
+        reason, (int) (sconn->retry_at_ms - now));
+}
+
+
+static void reactor_conn_connect (xs_conn_reactor_t *reactor, XS_server_conn sconn, ub8 now)
+{
+    int err;
+    int sockfd = -1;
+
+    struct addrinfo hints, *res, *rp;
+    struct epoll_event ev;
+
+    xs_server_opts *srv = sconn->srvopts;
+
+    bzero(&hints, sizeof(hints));
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    // 服务器地址通常是 IP, getaddrinfo 不会阻塞 reactor
+    err = getaddrinfo(srv->host, srv->sport, &hints, &res);
+    if (err != 0) {
+        reactor_conn_fail(reactor, sconn, now, gai_strerror(err));
+        return;
+    }
+
+    for (rp = res; rp != NULL; rp = rp->ai_next) {
+        sockfd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+
+        if (sockfd == -1) {
+            continue;
+        }
+
+        if (connect(sockfd, rp->ai_addr, rp->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            break;
+        }
+
+        close(sockfd);
+        sockfd = -1;
+    }
+
+    freeaddrinfo(res);
+
+    if (sockfd == -1) {
+        reactor_conn_fail(reactor, sconn, now, "connect failed");
+        return;
+    }
+
+    if (srv->sockopts.nodelay) {
+        int on = 1;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    // 可写时连接完成
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = sconn;
+
+    if (epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, sockfd, &ev) == -1) {
+        close(sockfd);
+        reactor_conn_fail(reactor, sconn, now, "epoll_ctl failed");
+        return;
+    }
+
+    sconn->sockfd = sockfd;
+    sconn->pollout = 1;
+
+    sconn->deadline_ms = now + reactor_conn_timeout_ms(sconn);
+
+    __interlock_set(&sconn->state, XS_CONN_CONNECTING);
+
+    LOGGER_DEBUG("server(%s:%s) connecting", srv->host, srv->sport);
+}
+
+
+/**
+ * 连接完成: 发送 XCON 请求
+ */
+static void reactor_conn_handshake (xs_conn_reactor_t *reactor, XS_server_conn sconn, ub8 now)
+{
+    int err = 0;
+    socklen_t len = (socklen_t) sizeof(err);
+
+    ub4 randnum;
+
+    XSConnectReq_t xconReq;
+
+    xs_server_opts *srv = sconn->srvopts;
+
+    if (getsockopt(sconn->sockfd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        err = errno;
+    }
+
+    if (err) {
+        reactor_conn_fail(reactor, sconn, now, strerror(err));
+        return;
+    }
+
+    sconn->client_utctime = time(NULL);
+
+    randnum = rand_gen(&sconn->rctx);
+
+    sconn->replymagic = srv->magic ^ randnum;
+
+    XSConnectRequestBuild(&xconReq, sconn->clientid, sconn->password, srv->magic, sconn->client_utctime, randnum,
+        XS_compress_capflags() | XS_CAPFLAG_MUX, sconn->ctlbuf);
+
+    sconn->ctllen = XS_CONNECT_REQ_SIZE;
+    sconn->ctloff = 0;
+
+    sconn->last_recv_ms = now;
+    sconn->deadline_ms = now + reactor_conn_timeout_ms(sconn);
+
+    __interlock_set(&sconn->state, XS_CONN_HANDSHAKE);
+}
+
+
+static void reactor_conn_queue_ping (XS_server_conn sconn, ub1 flags)
+{
+    XSMuxFrame_t frame;
+
+    if (sconn->ctllen + XS_MUX_FRAME_HEAD_SIZE <= (int) sizeof(sconn->ctlbuf)) {
+        XSMuxFrameBuild(&frame, 0, XS_MUX_FRAME_PING, flags, 0, 0, sconn->ctlbuf + sconn->ctllen);
+
+        sconn->ctllen += XS_MUX_FRAME_HEAD_SIZE;
+    }
+}
+
+
+/**
+ * 发送: 先发完未发完的帧, 再发控制消息, 最后调度流上的数据.
+ *   socket 写满时注册 EPOLLOUT
+ */
+static int reactor_conn_flush (xs_conn_reactor_t *reactor, XS_server_conn sconn, ub8 now)
+{
+    ssize_t rc;
+
+    for (;;) {
+        ub1 *buf;
+        int *off, len;
+
+        if (sconn->txoff < sconn->txlen) {
+            buf = sconn->txbuf;
+            off = &sconn->txoff;
+            len = sconn->txlen;
+        } else if (sconn->ctloff < sconn->ctllen) {
+            buf = sconn->ctlbuf;
+            off = &sconn->ctloff;
+            len = sconn->ctllen;
+        } else if (sconn->state == XS_CONN_READY &&
+            (sconn->txlen = XS_stream_mux_schedule(&sconn->mux, sconn->txbuf, sizeof(sconn->txbuf))) > 0) {
+            sconn->txoff = 0;
+            continue;
+        } else {
+            // 全部发完
+            sconn->txlen = sconn->txoff = 0;
+            sconn->ctllen = sconn->ctloff = 0;
+
+            reactor_conn_set_pollout(reactor, sconn, 0);
+            return 0;
+        }
+
+        rc = send(sconn->sockfd, buf + *off, len - *off, MSG_NOSIGNAL);
+
+        if (rc > 0) {
+            *off += (int) rc;
+            sconn->last_send_ms = now;
+
+            metrics_counter_add(xs_client_metrics.bytes_sent, (uint64_t) rc);
+        } else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            reactor_conn_set_pollout(reactor, sconn, 1);
+            return 0;
+        } else if (rc < 0 && errno == EINTR) {
+            continue;
+        } else {
+            reactor_conn_fail(reactor, sconn, now, "send error");
+            return (-1);
+        }
+    }
+}
+
+
+/**
+ * 处理 XCON 应答. 返回 0 成功
+ */
+static int reactor_conn_on_reply (xs_conn_reactor_t *reactor, XS_server_conn sconn, ub8 now)
+{
+    XSConnectReply_t xconReply;
+
+    xs_server_opts *srv = sconn->srvopts;
+
+    if (! XSConnectReplyAcceptParse(sconn->rxhead, &xconReply) || xconReply.magic != sconn->replymagic) {
+        reactor_conn_fail(reactor, sconn, now, "bad XCON reply");
+        return (-1);
+    }
+
+    sconn->bitflags = xconReply.bitflags;
+    sconn->session = xconReply.session;
+
+    sconn->backoff_ms = 0;
+
+    __interlock_set(&sconn->state, XS_CONN_READY);
+
+    LOGGER_INFO("server(%s:%s) connected: session=%ju codec=%s%s", srv->host, srv->sport, sconn->session,
+        XS_codec_name(sconn->bitflags & XS_CAPFLAG_COMPRESS_MASK),
+        (sconn->bitflags & XS_CAPFLAG_MUX)? "" : " (XMUX not supported)");
+
+    return 0;
+}
+
+
+/**
+ * 接收: 握手时读 XCON 应答, 之后读 XMUX 帧. DATA 负载 (XCHK/XLGB 应答)
+ *   交给流的接收缓冲
+ */
+static int reactor_conn_recv (xs_conn_reactor_t *reactor, XS_server_conn sconn, ub8 now)
+{
+    ssize_t rc;
+
+    ub1 databuf[4096];
+
+    XSMuxFrame_t frame;
+
+    for (;;) {
+        if (sconn->rxdata) {
+            rc = recv(sconn->sockfd, databuf, sconn->rxdata < sizeof(databuf)? sconn->rxdata : sizeof(databuf), 0);
+
+            if (rc > 0) {
+                sconn->rxdata -= (ub4) rc;
+                sconn->last_recv_ms = now;
+
+                XS_stream_mux_on_data(&sconn->mux, sconn->rxstream, databuf, (ub4) rc);
+                continue;
+            }
+        } else {
+            int need = XS_MUX_FRAME_HEAD_SIZE;
+
+            if (sconn->state == XS_CONN_HANDSHAKE) {
+                // 先读拒绝应答的长度, 是 XCON 再读全接受应答
+                need = XS_CONNECT_REJECT_REPLY_SIZE;
+
+                if (sconn->rxlen >= XS_CONNECT_REJECT_REPLY_SIZE && ! memcmp(sconn->rxhead, XS_MSGID_XCON.c, 4)) {
+                    need = XS_CONNECT_ACCEPT_REPLY_SIZE;
+                }
+            }
+
+            rc = recv(sconn->sockfd, sconn->rxhead + sconn->rxlen, need - sconn->rxlen, 0);
+
+            if (rc > 0) {
+                sconn->rxlen += (int) rc;
+                sconn->last_recv_ms = now;
+
+                if (sconn->rxlen < need) {
+                    continue;
+                }
+
+                if (sconn->state == XS_CONN_HANDSHAKE) {
+                    if (need == XS_CONNECT_REJECT_REPLY_SIZE) {
+                        if (! memcmp(sconn->rxhead, XS_MSGID_XCON.c, 4)) {
+                            continue;
+                        }
+
+                        LOGGER_ERROR("server(%s:%s) reject: code=%d", sconn->srvopts->host, sconn->srvopts->sport,
+                            (int) BO_bytes_betoh_i32(sconn->rxhead + 4));
+
+                        reactor_conn_fail(reactor, sconn, now, "rejected");
+                        return (-1);
+                    }
+
+                    sconn->rxlen = 0;
+
+                    if (reactor_conn_on_reply(reactor, sconn, now) != 0) {
+                        return (-1);
+                    }
+
+                    continue;
+                }
+
+                sconn->rxlen = 0;
+
+                if (! XSMuxFrameParse(sconn->rxhead, &frame)) {
+                    reactor_conn_fail(reactor, sconn, now, "invalid frame");
+                    return (-1);
+                }
+
+                sconn->rxdata = frame.datalen;
+                sconn->rxstream = frame.streamid;
+
+                if (frame.type == XS_MUX_FRAME_PING) {
+                    if (! (frame.flags & XS_MUX_FLAG_ACK)) {
+                        reactor_conn_queue_ping(sconn, XS_MUX_FLAG_ACK);
+                    }
+                } else {
+                    XS_stream_mux_on_frame(&sconn->mux, &frame);
+                }
+
+                continue;
+            }
+        }
+
+        if (rc == 0) {
+            reactor_conn_fail(reactor, sconn, now, "server closed");
+            return (-1);
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+
+        if (errno != EINTR) {
+            reactor_conn_fail(reactor, sconn, now, strerror(errno));
+            return (-1);
+        }
+    }
+}
+
+
+static void reactor_conn_event (xs_conn_reactor_t *reactor, XS_server_conn sconn, ub4 events, ub8 now)
+{
+    if (sconn->sockfd == -1) {
+        return;
+    }
+
+    if (sconn->state == XS_CONN_CONNECTING) {
+        if (! (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            return;
+        }
+
+        reactor_conn_handshake(reactor, sconn, now);
+
+        if (sconn->state != XS_CONN_HANDSHAKE) {
+            return;
+        }
+    } else if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        if (reactor_conn_recv(reactor, sconn, now) != 0) {
+            return;
+        }
+    }
+
+    reactor_conn_flush(reactor, sconn, now);
+}
+
+
+/**
+ * 定时任务: 重连, 连接超时, 心跳. 同时发送工作线程新写入的数据
+ */
+static void reactor_conn_tick (xs_conn_reactor_t *reactor, XS_server_conn sconn, ub8 now)
+{
+    switch (sconn->state) {
+    case XS_CONN_CLOSED:
+        if (now >= sconn->retry_at_ms) {
+            reactor_conn_connect(reactor, sconn, now);
+        }
+        break;
+
+    case XS_CONN_CONNECTING:
+    case XS_CONN_HANDSHAKE:
+        if (now >= sconn->deadline_ms) {
+            reactor_conn_fail(reactor, sconn, now, "connect timeout");
+        }
+        break;
+
+    case XS_CONN_READY:
+        if (now - sconn->last_recv_ms >= XSYNC_HEARTBEAT_TIMEOUT_MS) {
+            reactor_conn_fail(reactor, sconn, now, "heartbeat timeout");
+            break;
+        }
+
+        if (now - sconn->last_send_ms >= XSYNC_HEARTBEAT_INTERVAL_MS && sconn->ctllen == 0) {
+            reactor_conn_queue_ping(sconn, 0);
+        }
+
+        reactor_conn_flush(reactor, sconn, now);
+        break;
+    }
+}
+
+
+static void * conn_reactor_thread (void *arg)
+{
+    int i, n;
+    ub8 now, wakeval;
+
+    struct epoll_event events[XSYNC_SERVER_MAXID + 2];
+
+    xs_conn_reactor_t *reactor = (xs_conn_reactor_t *) arg;
+
+    LOGGER_INFO("conn reactor start: connections=%d", reactor->nconns);
+
+    while (! __interlock_get(&reactor->stopping)) {
+        n = epoll_wait(reactor->epollfd, events, (int) (sizeof(events) / sizeof(events[0])), XSYNC_REACTOR_TICK_MS);
+
+        if (n == -1 && errno != EINTR) {
+            LOGGER_FATAL("epoll_wait error(%d): %s", errno, strerror(errno));
+            break;
+        }
+
+        now = reactor_now_ms();
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr) {
+                reactor_conn_event(reactor, (XS_server_conn) events[i].data.ptr, events[i].events, now);
+            } else {
+                // 工作线程唤醒
+                if (read(reactor->wakefd, &wakeval, sizeof(wakeval)) == -1 && errno != EAGAIN) {
+                    LOGGER_WARN("read eventfd error(%d): %s", errno, strerror(errno));
+                }
+            }
+        }
+
+        for (i = 0; i < reactor->nconns; i++) {
+            reactor_conn_tick(reactor, reactor->conns[i], now);
+        }
+    }
+
+    LOGGER_INFO("conn reactor exit");
+
+    return (void *) 0;
+}
+
+
+XS_RESULT XS_conn_reactor_create (xs_conn_reactor_t **outReactor)
+{
+    struct epoll_event ev;
+
+    xs_conn_reactor_t *reactor = (xs_conn_reactor_t *) mem_alloc_zero(1, sizeof(*reactor));
+
+    reactor->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epollfd == -1) {
+        LOGGER_ERROR("epoll_create1 error(%d): %s", errno, strerror(errno));
+        mem_free(reactor);
+        return XS_ERROR;
+    }
+
+    reactor->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->wakefd == -1) {
+        LOGGER_ERROR("eventfd error(%d): %s", errno, strerror(errno));
+        close(reactor->epollfd);
+        mem_free(reactor);
+        return XS_ERROR;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = 0;
+
+    if (epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, reactor->wakefd, &ev) == -1) {
+        LOGGER_ERROR("epoll_ctl error(%d): %s", errno, strerror(errno));
+        close(reactor->wakefd);
+        close(reactor->epollfd);
+        mem_free(reactor);
+        return XS_ERROR;
+    }
+
+    *outReactor = reactor;
+
+    return XS_SUCCESS;
+}
+
+
+XS_RESULT XS_conn_reactor_add (xs_conn_reactor_t *reactor, XS_server_conn sconn)
+{
+    if (reactor->started || reactor->nconns > XSYNC_SERVER_MAXID) {
+        return XS_E_PARAM;
+    }
+
+    reactor->conns[reactor->nconns++] = (XS_server_conn) RefObjectRetain((void**) &sconn);
+
+    sconn->wakefd = reactor->wakefd;
+
+    return XS_SUCCESS;
+}
+
+
+XS_RESULT XS_conn_reactor_start (xs_conn_reactor_t *reactor)
+{
+    int err;
+
+    pthread_attr_t pattr;
+
+    pthread_attr_init(&pattr);
+    pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_JOINABLE);
+
+    err = pthread_create(&reactor->thread_id, &pattr, conn_reactor_thread, (void*) reactor);
+
+    pthread_attr_destroy(&pattr);
+
+    if (err) {
+        LOGGER_ERROR("pthread_create error(%d): %s", err, strerror(err));
+        return XS_ERROR;
+    }
+
+    reactor->started = 1;
+
+    return XS_SUCCESS;
+}
+
+
+XS_VOID XS_conn_reactor_free (xs_conn_reactor_t **pReactor)
+{
+    int i;
+    ub8 one = 1;
+
+    xs_conn_reactor_t *reactor = *pReactor;
+
+    if (! reactor) {
+        return;
+    }
+
+    *pReactor = 0;
+
+    if (reactor->started) {
+        __interlock_set(&reactor->stopping, 1);
+
+        if (write(reactor->wakefd, &one, sizeof(one)) != sizeof(one)) {
+            LOGGER_WARN("write eventfd error(%d): %s", errno, strerror(errno));
+        }
+
+        pthread_join(reactor->thread_id, 0);
+    }
+
+    for (i = 0; i < reactor->nconns; i++) {
+        XS_server_conn sconn = reactor->conns[i];
+
+        reactor->conns[i] = 0;
+
+        sconn->wakefd = -1;
+
+        if (sconn->sockfd != -1) {
+            close(sconn->sockfd);
+            sconn->sockfd = -1;
+        }
+
+        __interlock_set(&sconn->state, XS_CONN_CLOSED);
+
+        XS_server_conn_release(&sconn);
+    }
+
+    close(reactor->wakefd);
+    close(reactor->epollfd);
+
+    mem_free(reactor);
+}
@@ -0,0 +1,94 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: conn_reactor.h
+ *   client side reactor owns all server connections
+ *
+ *   一个 epoll 线程负责全部服务器连接的 socket I/O: 非阻塞连接, 异步 XCON
+ *   握手, 心跳, 指数退避重连, 以及发送各连接上排队的流数据. 工作线程只把
+ *   数据写入连接的流队列 (XS_server_conn_stream_write), 不做 socket I/O.
+ *   服务器不可用时不阻塞工作线程, 启动时各连接并行建立.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-15
+ *
+ * @update: 2018-11-15 09:47:26
+ */
+
+#ifndef CONN_REACTOR_H_INCLUDED
+#define CONN_REACTOR_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "server_conn.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+
+typedef struct xs_conn_reactor_t
+{
+    int epollfd;
+
+    /* eventfd: 工作线程唤醒 reactor */
+    int wakefd;
+
+    volatile int stopping;
+
+    int started;
+    pthread_t thread_id;
+
+    /* 引用的连接 */
+    int nconns;
+    xs_server_conn_t *conns[XSYNC_SERVER_MAXID + 1];
+} xs_conn_reactor_t;
+
+
+extern XS_RESULT XS_conn_reactor_create (xs_conn_reactor_t **outReactor);
+
+/**
+ * 加入连接 (增加引用计数). 必须在 XS_conn_reactor_start 之前调用
+ */
+extern XS_RESULT XS_conn_reactor_add (xs_conn_reactor_t *reactor, XS_server_conn sconn);
+
+/**
+ * 启动 reactor 线程, 立即返回. 连接在 reactor 线程中异步建立
+ */
+extern XS_RESULT XS_conn_reactor_start (xs_conn_reactor_t *reactor);
+
+/**
+ * 停止 reactor 线程, 关闭并释放全部连接
+ */
+extern XS_VOID XS_conn_reactor_free (xs_conn_reactor_t **pReactor);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* CONN_REACTOR_H_INCLUDED */
@@ -0,0 +1,862 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: event_checkpoint.c
+ *   durable per-file checkpoints of kafka event messages (see "event_checkpoint.h")
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-27
+ *
+ * @update: 2018-11-30 20:05:37
+ */
+
+#include "client_api.h"
+
+#include "event_checkpoint.h"
+
+#include "../common/rbtree.h"
+
+#include <sys/time.h>
+
+
+#define EVCP_MAGIC           "XSEVCP01"
+#define EVCP_MAGIC_LEN       8
+
+#define EVCP_PENDING         'P'
+#define EVCP_DELIVERED       'D'
+#define EVCP_CHECKPOINT      'C'
+
+
+typedef struct evcp_rechdr_t
+{
+    /* 记录的总长度, 包括记录头 */
+    uint32_t len;
+
+    uint8_t type;
+    uint8_t pad[3];
+
+    uint64_t seq;
+    uint64_t time_us;
+} evcp_rechdr_t;
+
+
+typedef struct evcp_pendhdr_t
+{
+    int32_t partition;
+
+    uint16_t topiclen;
+    uint16_t keylen;
+    uint16_t filekeylen;
+    uint16_t pad;
+
+    uint32_t msglen;
+} evcp_pendhdr_t;
+
+
+/* 文件的检查点: 节点按 filekey 排序 */
+typedef struct evcp_file_t
+{
+    struct rb_node rbnode;
+
+    /* 最后确认的事件 */
+    uint64_t seq;
+    uint64_t time_us;
+
+    int keylen;
+    char key[0];
+} evcp_file_t;
+
+
+/* 没有确认的消息: 节点按 seq 排序 */
+typedef struct evcp_pend_t
+{
+    struct rb_node rbnode;
+
+    uint64_t seq;
+
+    /* 写入日志 (或者启动时读入) 的时间 */
+    uint64_t added_us;
+
+    /* 日志中的记录 (记录头 + 内容) */
+    uint32_t reclen;
+    char record[0];
+} evcp_pend_t;
+
+
+typedef struct evcp_fkey_t
+{
+    const char *key;
+    int keylen;
+} evcp_fkey_t;
+
+
+typedef struct xs_event_checkpoint_t
+{
+    /* 保护全部成员和日志文件的写入 */
+    thread_lock_t lock;
+
+    int fd;
+
+    /* 日志文件的长度, 上次压缩之后的长度 */
+    int64_t size;
+    int64_t compacted;
+
+    /* 最后分配的序号, 最后一个事件的时间 */
+    uint64_t seq;
+    uint64_t time_us;
+
+    /* 上次落盘的时间 */
+    uint64_t synced_us;
+
+    struct rb_root files;
+    int64_t nfiles;
+
+    struct rb_root pendings;
+    int64_t npendings;
+
+    char journal[PATH_MAX];
+} xs_event_checkpoint_t;
+
+
+static inline int evcp_file_cmp (const evcp_fkey_t *fkey, const evcp_file_t *file)
+{
+    int c = memcmp(fkey->key, file->key, (fkey->keylen < file->keylen? fkey->keylen : file->keylen));
+
+    return (c? c : (fkey->keylen - file->keylen));
+}
+
+RB_TREE_DEFINE(evcp_file_tree, evcp_file_t, rbnode, evcp_fkey_t, evcp_file_cmp)
+
+
+static inline int evcp_pend_cmp (const uint64_t *seq, const evcp_pend_t *pend)
+{
+    return (*seq < pend->seq? -1 : (*seq > pend->seq? 1 : 0));
+}
+
+RB_TREE_DEFINE(evcp_pend_tree, evcp_pend_t, rbnode, uint64_t, evcp_pend_cmp)
+
+
+static inline uint64_t evcp_now_us (void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+
+    return (uint64_t) tv.tv_sec * 1000000 + (uint64_t) tv.tv_usec;
+}
+
+
+/* 记录的内容解析为待投递的消息. 格式不对返回 -1 */
+static int evcp_parse_pending (const char *record, uint32_t reclen, xs_event_pending_t *pending)
+{
+    evcp_rechdr_t hdr;
+    evcp_pendhdr_t ph;
+
+    const char *p = record + sizeof(hdr) + sizeof(ph);
+
+    if (reclen < sizeof(hdr) + sizeof(ph)) {
+        return (-1);
+    }
+
+    memcpy(&hdr, record, sizeof(hdr));
+    memcpy(&ph, record + sizeof(hdr), sizeof(ph));
+
+    if ((uint64_t) sizeof(hdr) + sizeof(ph) + ph.topiclen + ph.keylen + ph.filekeylen + ph.msglen != reclen) {
+        return (-1);
+    }
+
+    pending->seq = hdr.seq;
+    pending->time_us = hdr.time_us;
+    pending->partition = ph.partition;
+
+    pending->topiclen = ph.topiclen;
+    pending->topic = p;
+    p += ph.topiclen;
+
+    pending->keylen = ph.keylen;
+    pending->key = p;
+    p += ph.keylen;
+
+    pending->filekeylen = ph.filekeylen;
+    pending->filekey = p;
+    p += ph.filekeylen;
+
+    pending->msglen = (int) ph.msglen;
+    pending->msg = p;
+
+    return 0;
+}
+
+
+/* 在 cp->lock 内调用: 文件的检查点前进到 seq */
+static void evcp_file_update (xs_event_checkpoint_t *cp, const char *key, int keylen, uint64_t seq, uint64_t time_us)
+{
+    evcp_fkey_t fkey;
+    evcp_file_t *file;
+
+    struct rb_node *parent;
+    struct rb_node **link;
+
+    fkey.key = key;
+    fkey.keylen = keylen;
+
+    file = evcp_file_tree_lookup(&cp->files, &fkey, &parent, &link);
+
+    if (! file) {
+        file = (evcp_file_t *) mem_alloc_zero(1, sizeof(evcp_file_t) + keylen + 1);
+
+        file->keylen = keylen;
+        memcpy(file->key, key, keylen);
+
+        evcp_file_tree_link(&cp->files, file, parent, link);
+
+        cp->nfiles++;
+    }
+
+    if (seq > file->seq) {
+        file->seq = seq;
+        file->time_us = time_us;
+    }
+}
+
+
+/* 在 cp->lock 内调用: 文件的检查点序号, 没有返回 0 */
+static uint64_t evcp_file_seq (xs_event_checkpoint_t *cp, const char *key, int keylen)
+{
+    evcp_fkey_t fkey;
+    evcp_file_t *file;
+
+    fkey.key = key;
+    fkey.keylen = keylen;
+
+    file = evcp_file_tree_find(&cp->files, &fkey);
+
+    return (file? file->seq : 0);
+}
+
+
+static int evcp_write_all (int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (-1);
+        }
+
+        buf += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+
+/* 在 cp->lock 内调用: 追加记录到日志 */
+static int evcp_append (xs_event_checkpoint_t *cp, const char *record, uint32_t reclen)
+{
+    uint64_t now;
+
+    if (evcp_write_all(cp->fd, record, reclen) != 0) {
+        LOGGER_ERROR("write fail(%d): %s (%s)", errno, strerror(errno), cp->journal);
+        return (-1);
+    }
+
+    cp->size += reclen;
+
+    now = evcp_now_us();
+
+    if (now - cp->synced_us >= (uint64_t) XSYNC_KAFKA_JOURNAL_SYNC_MS * 1000) {
+        fdatasync(cp->fd);
+        cp->synced_us = now;
+    }
+
+    return 0;
+}
+
+
+/* 检查点记录 (D, C): [记录头][filekeylen:2][filekey] */
+static uint32_t evcp_mark_record (char *record, int type, uint64_t seq, uint64_t time_us, const char *key, int keylen)
+{
+    evcp_rechdr_t hdr;
+    uint16_t len16 = (uint16_t) keylen;
+
+    bzero(&hdr, sizeof(hdr));
+
+    hdr.len = (uint32_t) (sizeof(hdr) + sizeof(len16) + keylen);
+    hdr.type = (uint8_t) type;
+    hdr.seq = seq;
+    hdr.time_us = time_us;
+
+    memcpy(record, &hdr, sizeof(hdr));
+    memcpy(record + sizeof(hdr), &len16, sizeof(len16));
+    memcpy(record + sizeof(hdr) + sizeof(len16), key, keylen);
+
+    return hdr.len;
+}
+
+
+/**
+ * 在 cp->lock 内调用: 把检查点和没有确认的消息写入新的日志文件, 替换
+ *   原来的日志
+ */
+static int evcp_compact (xs_event_checkpoint_t *cp)
+{
+    int fd;
+    uint32_t reclen;
+
+    char tmpfile[PATH_MAX + 8];
+    char record[sizeof(evcp_rechdr_t) + 2 + XSYNC_PATHFILE_MAXLEN];
+
+    evcp_file_t *file;
+    evcp_pend_t *pend;
+
+    int64_t size = EVCP_MAGIC_LEN;
+
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", cp->journal);
+
+    fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        LOGGER_ERROR("open fail(%d): %s (%s)", errno, strerror(errno), tmpfile);
+        return (-1);
+    }
+
+    if (evcp_write_all(fd, EVCP_MAGIC, EVCP_MAGIC_LEN) != 0) {
+        goto error_exit;
+    }
+
+    for (file = evcp_file_tree_first(&cp->files); file; file = evcp_file_tree_next(file)) {
+        reclen = evcp_mark_record(record, EVCP_CHECKPOINT, file->seq, file->time_us, file->key, file->keylen);
+
+        if (evcp_write_all(fd, record, reclen) != 0) {
+            goto error_exit;
+        }
+
+        size += reclen;
+    }
+
+    for (pend = evcp_pend_tree_first(&cp->pendings); pend; pend = evcp_pend_tree_next(pend)) {
+        if (evcp_write_all(fd, pend->record, pend->reclen) != 0) {
+            goto error_exit;
+        }
+
+        size += pend->reclen;
+    }
+
+    if (fdatasync(fd) != 0 || rename(tmpfile, cp->journal) != 0) {
+        goto error_exit;
+    }
+
+    close(cp->fd);
+
+    cp->fd = fd;
+    cp->size = cp->compacted = size;
+    cp->synced_us = evcp_now_us();
+
+    LOGGER_INFO("journal compacted: files=%"PRId64" pendings=%"PRId64" size=%"PRId64" (%s)",
+        cp->nfiles, cp->npendings, size, cp->journal);
+
+    return 0;
+
+error_exit:
+    LOGGER_ERROR("compact fail(%d): %s (%s)", errno, strerror(errno), tmpfile);
+
+    close(fd);
+    unlink(tmpfile);
+
+    return (-1);
+}
+
+
+/* 读入日志: 重建检查点和没有确认的消息. 写了一半的尾部记录被截掉 */
+static int evcp_load (xs_event_checkpoint_t *cp)
+{
+    char *buf;
+    int64_t off;
+
+    struct stat sb;
+
+    if (fstat(cp->fd, &sb) != 0) {
+        LOGGER_ERROR("fstat fail(%d): %s (%s)", errno, strerror(errno), cp->journal);
+        return (-1);
+    }
+
+    if (sb.st_size == 0) {
+        if (evcp_write_all(cp->fd, EVCP_MAGIC, EVCP_MAGIC_LEN) != 0) {
+            LOGGER_ERROR("write fail(%d): %s (%s)", errno, strerror(errno), cp->journal);
+            return (-1);
+        }
+
+        cp->size = cp->compacted = EVCP_MAGIC_LEN;
+        return 0;
+    }
+
+    buf = (char *) mem_alloc_zero(1, (size_t) sb.st_size);
+
+    if (pread(cp->fd, buf, (size_t) sb.st_size, 0) != (ssize_t) sb.st_size) {
+        LOGGER_ERROR("read fail(%d): %s (%s)", errno, strerror(errno), cp->journal);
+        mem_free(buf);
+        return (-1);
+    }
+
+    if (sb.st_size < EVCP_MAGIC_LEN || memcmp(buf, EVCP_MAGIC, EVCP_MAGIC_LEN)) {
+        LOGGER_ERROR("not a journal file: %s", cp->journal);
+        mem_free(buf);
+        return (-1);
+    }
+
+    off = EVCP_MAGIC_LEN;
+
+    while (off + (int64_t) sizeof(evcp_rechdr_t) <= sb.st_size) {
+        evcp_rechdr_t hdr;
+        const char *record = buf + off;
+
+        memcpy(&hdr, record, sizeof(hdr));
+
+        if (hdr.len < sizeof(hdr) || off + hdr.len > sb.st_size) {
+            break;
+        }
+
+        if (hdr.type == EVCP_PENDING) {
+            xs_event_pending_t pending;
+            evcp_pend_t *pend;
+
+            if (evcp_parse_pending(record, hdr.len, &pending) != 0 || pending.filekeylen > XSYNC_PATHFILE_MAXLEN) {
+                break;
+            }
+
+            pend = (evcp_pend_t *) mem_alloc_zero(1, sizeof(evcp_pend_t) + hdr.len);
+
+            pend->seq = hdr.seq;
+            pend->added_us = evcp_now_us();
+            pend->reclen = hdr.len;
+            memcpy(pend->record, record, hdr.len);
+
+            if (evcp_pend_tree_insert(&cp->pendings, &pend->seq, pend)) {
+                mem_free(pend);
+            } else {
+                cp->npendings++;
+            }
+        } else if (hdr.type == EVCP_DELIVERED || hdr.type == EVCP_CHECKPOINT) {
+            uint16_t keylen;
+
+            if (hdr.len < sizeof(hdr) + sizeof(keylen)) {
+                break;
+            }
+
+            memcpy(&keylen, record + sizeof(hdr), sizeof(keylen));
+
+            if (keylen > XSYNC_PATHFILE_MAXLEN || sizeof(hdr) + sizeof(keylen) + keylen != hdr.len) {
+                break;
+            }
+
+            evcp_file_update(cp, record + sizeof(hdr) + sizeof(keylen), keylen, hdr.seq, hdr.time_us);
+
+            if (hdr.type == EVCP_DELIVERED) {
+                evcp_pend_t *pend = evcp_pend_tree_find(&cp->pendings, &hdr.seq);
+
+                if (pend) {
+                    evcp_pend_tree_erase(&cp->pendings, pend);
+                    mem_free(pend);
+                    cp->npendings--;
+                }
+            }
+        } else {
+            break;
+        }
+
+        if (hdr.seq > cp->seq) {
+            cp->seq = hdr.seq;
+        }
+
+        if (hdr.time_us > cp->time_us) {
+            cp->time_us = hdr.time_us;
+        }
+
+        off += hdr.len;
+    }
+
+    mem_free(buf);
+
+    if (off < sb.st_size) {
+        LOGGER_WARN("journal truncated at %"PRId64" (size=%"PRId64"): %s", off, (int64_t) sb.st_size, cp->journal);
+
+        if (ftruncate(cp->fd, off) != 0) {
+            LOGGER_ERROR("ftruncate fail(%d): %s (%s)", errno, strerror(errno), cp->journal);
+            return (-1);
+        }
+    }
+
+    cp->size = cp->compacted = off;
+
+    return 0;
+}
+
+
+extern XS_RESULT XS_event_checkpoint_open (const char *journal, XS_event_checkpoint *outcp)
+{
+    xs_event_checkpoint_t *cp;
+
+    *outcp = 0;
+
+    if (strlen(journal) >= PATH_MAX) {
+        LOGGER_ERROR("journal path too long: %s", journal);
+        return XS_ERROR;
+    }
+
+    cp = (xs_event_checkpoint_t *) mem_alloc_zero(1, sizeof(xs_event_checkpoint_t));
+
+    strcpy(cp->journal, journal);
+
+    rb_root_init(&cp->files);
+    rb_root_init(&cp->pendings);
+
+    cp->fd = open(journal, O_RDWR | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if (cp->fd == -1) {
+        LOGGER_ERROR("open fail(%d): %s (%s)", errno, strerror(errno), journal);
+        mem_free(cp);
+        return XS_ERROR;
+    }
+
+    if (threadlock_init(&cp->lock) != 0) {
+        LOGGER_ERROR("threadlock_init fail");
+        close(cp->fd);
+        mem_free(cp);
+        return XS_ERROR;
+    }
+
+    if (evcp_load(cp) != 0) {
+        XS_event_checkpoint_close(cp);
+        return XS_ERROR;
+    }
+
+    cp->synced_us = evcp_now_us();
+
+    LOGGER_INFO("journal opened: files=%"PRId64" pendings=%"PRId64" seq=%"PRIu64" (%s)",
+        cp->nfiles, cp->npendings, cp->seq, journal);
+
+    *outcp = cp;
+
+    return XS_SUCCESS;
+}
+
+
+extern void XS_event_checkpoint_close (XS_event_checkpoint cp)
+{
+    evcp_file_t *file;
+    evcp_pend_t *pend;
+
+    if (cp->fd != -1) {
+        fdatasync(cp->fd);
+        close(cp->fd);
+        cp->fd = -1;
+    }
+
+    while ((file = evcp_file_tree_first(&cp->files)) != 0) {
+        evcp_file_tree_erase(&cp->files, file);
+        mem_free(file);
+    }
+
+    while ((pend = evcp_pend_tree_first(&cp->pendings)) != 0) {
+        evcp_pend_tree_erase(&cp->pendings, pend);
+        mem_free(pend);
+    }
+
+    threadlock_destroy(&cp->lock);
+
+    mem_free(cp);
+}
+
+
+extern uint64_t XS_event_checkpoint_next_seq (XS_event_checkpoint cp)
+{
+    uint64_t seq, now = evcp_now_us();
+
+    threadlock_lock(&cp->lock);
+
+    seq = cp->seq + 1;
+    if (seq < now) {
+        seq = now;
+    }
+
+    cp->seq = seq;
+
+    threadlock_unlock(&cp->lock);
+
+    return seq;
+}
+
+
+extern XS_RESULT XS_event_checkpoint_pending (XS_event_checkpoint cp, const xs_event_pending_t *pending)
+{
+    int ret;
+
+    evcp_rechdr_t hdr;
+    evcp_pendhdr_t ph;
+    evcp_pend_t *pend;
+
+    char *p;
+
+    if (pending->topiclen > 0xFFFF || pending->keylen > 0xFFFF || pending->filekeylen > XSYNC_PATHFILE_MAXLEN) {
+        LOGGER_ERROR("application error: pending message key too long");
+        return XS_ERROR;
+    }
+
+    bzero(&hdr, sizeof(hdr));
+    bzero(&ph, sizeof(ph));
+
+    hdr.len = (uint32_t) (sizeof(hdr) + sizeof(ph) + pending->topiclen + pending->keylen + pending->filekeylen + pending->msglen);
+    hdr.type = EVCP_PENDING;
+    hdr.seq = pending->seq;
+    hdr.time_us = pending->time_us;
+
+    ph.partition = pending->partition;
+    ph.topiclen = (uint16_t) pending->topiclen;
+    ph.keylen = (uint16_t) pending->keylen;
+    ph.filekeylen = (uint16_t) pending->filekeylen;
+    ph.msglen = (uint32_t) pending->msglen;
+
+    pend = (evcp_pend_t *) mem_alloc_zero(1, sizeof(evcp_pend_t) + hdr.len);
+
+    pend->seq = pending->seq;
+    pend->added_us = evcp_now_us();
+    pend->reclen = hdr.len;
+
+    p = pend->record;
+
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+
+    memcpy(p, &ph, sizeof(ph));
+    p += sizeof(ph);
+
+    memcpy(p, pending->topic, pending->topiclen);
+    p += pending->topiclen;
+
+    memcpy(p, pending->key, pending->keylen);
+    p += pending->keylen;
+
+    memcpy(p, pending->filekey, pending->filekeylen);
+    p += pending->filekeylen;
+
+    memcpy(p, pending->msg, pending->msglen);
+
+    threadlock_lock(&cp->lock);
+
+    if (evcp_pend_tree_insert(&cp->pendings, &pend->seq, pend)) {
+        threadlock_unlock(&cp->lock);
+
+        LOGGER_ERROR("application error: duplicate seq(=%"PRIu64")", pending->seq);
+        mem_free(pend);
+        return XS_ERROR;
+    }
+
+    cp->npendings++;
+
+    if (pending->time_us > cp->time_us) {
+        cp->time_us = pending->time_us;
+    }
+
+    ret = evcp_append(cp, pend->record, pend->reclen);
+
+    threadlock_unlock(&cp->lock);
+
+    return (ret == 0? XS_SUCCESS : XS_ERROR);
+}
+
+
+/* 在 cp->lock 内调用 */
+static void evcp_delivered_inlock (xs_event_checkpoint_t *cp, evcp_pend_t *pend)
+{
+    xs_event_pending_t pending;
+
+    char record[sizeof(evcp_rechdr_t) + 2 + XSYNC_PATHFILE_MAXLEN];
+
+    evcp_parse_pending(pend->record, pend->reclen, &pending);
+
+    evcp_file_update(cp, pending.filekey, pending.filekeylen, pending.seq, pending.time_us);
+
+    evcp_append(cp, record, evcp_mark_record(record, EVCP_DELIVERED, pending.seq, pending.time_us, pending.filekey, pending.filekeylen));
+
+    evcp_pend_tree_erase(&cp->pendings, pend);
+    mem_free(pend);
+
+    cp->npendings--;
+}
+
+
+extern void XS_event_checkpoint_delivered (XS_event_checkpoint cp, uint64_t seq)
+{
+    evcp_pend_t *pend;
+
+    threadlock_lock(&cp->lock);
+
+    pend = evcp_pend_tree_find(&cp->pendings, &seq);
+
+    if (pend) {
+        evcp_delivered_inlock(cp, pend);
+
+        if (cp->size > XSYNC_KAFKA_JOURNAL_MAXSIZE && cp->size > cp->compacted * 2) {
+            evcp_compact(cp);
+        }
+    }
+
+    threadlock_unlock(&cp->lock);
+}
+
+
+extern int XS_event_checkpoint_replay (XS_event_checkpoint cp, event_replay_cb replay_cb, void *arg)
+{
+    int replayed = 0, superseded = 0, failed = 0;
+
+    evcp_pend_t *pend, *next;
+    xs_event_pending_t pending;
+
+    threadlock_lock(&cp->lock);
+
+    for (pend = evcp_pend_tree_first(&cp->pendings); pend; pend = next) {
+        next = evcp_pend_tree_next(pend);
+
+        evcp_parse_pending(pend->record, pend->reclen, &pending);
+
+        if (evcp_file_seq(cp, pending.filekey, pending.filekeylen) >= pending.seq) {
+            /* 同一个文件后来的事件已经投递 */
+            evcp_pend_tree_erase(&cp->pendings, pend);
+            mem_free(pend);
+            cp->npendings--;
+
+            superseded++;
+        } else if (replay_cb(&pending, arg) == 0) {
+            evcp_delivered_inlock(cp, pend);
+
+            replayed++;
+        } else {
+            failed++;
+        }
+    }
+
+    LOGGER_NOTICE("journal replayed=%d superseded=%d failed=%d (%s)", replayed, superseded, failed, cp->journal);
+
+    evcp_compact(cp);
+
+    threadlock_unlock(&cp->lock);
+
+    return replayed;
+}
+
+
+extern int XS_event_checkpoint_retry (XS_event_checkpoint cp, int min_age_ms, int maxcount, event_replay_cb replay_cb, void *arg)
+{
+    int i, n = 0, retried = 0;
+
+    evcp_pend_t *pend, *next;
+    xs_event_pending_t pending;
+
+    evcp_pend_t **copies;
+
+    uint64_t now = evcp_now_us();
+
+    if (maxcount <= 0) {
+        return 0;
+    }
+
+    copies = (evcp_pend_t **) mem_alloc_zero(maxcount, sizeof(evcp_pend_t *));
+
+    threadlock_lock(&cp->lock);
+
+    for (pend = evcp_pend_tree_first(&cp->pendings); pend && n < maxcount; pend = next) {
+        next = evcp_pend_tree_next(pend);
+
+        if (now - pend->added_us < (uint64_t) min_age_ms * 1000) {
+            continue;
+        }
+
+        evcp_parse_pending(pend->record, pend->reclen, &pending);
+
+        if (evcp_file_seq(cp, pending.filekey, pending.filekeylen) >= pending.seq) {
+            /* 同一个文件后来的事件已经投递 */
+            evcp_pend_tree_erase(&cp->pendings, pend);
+            mem_free(pend);
+            cp->npendings--;
+            continue;
+        }
+
+        /* 复制记录: 发送期间不持有锁 */
+        copies[n] = (evcp_pend_t *) mem_alloc_unset(sizeof(evcp_pend_t) + pend->reclen);
+        memcpy(copies[n], pend, sizeof(evcp_pend_t) + pend->reclen);
+        n++;
+    }
+
+    threadlock_unlock(&cp->lock);
+
+    for (i = 0; i < n; i++) {
+        evcp_parse_pending(copies[i]->record, copies[i]->reclen, &pending);
+
+        if (replay_cb(&pending, arg) == 0) {
+            XS_event_checkpoint_delivered(cp, pending.seq);
+            retried++;
+        }
+
+        mem_free(copies[i]);
+    }
+
+    mem_free(copies);
+
+    if (n) {
+        LOGGER_NOTICE("journal retried=%d failed=%d (%s)", retried, n - retried, cp->journal);
+    }
+
+    return retried;
+}
+
+
+extern time_t XS_event_checkpoint_time (XS_event_checkpoint cp)
+{
+    time_t tp;
+
+    threadlock_lock(&cp->lock);
+    tp = (time_t) (cp->time_us / 1000000);
+    threadlock_unlock(&cp->lock);
+
+    return tp;
+}
+
+
+extern int64_t XS_event_checkpoint_files (XS_event_checkpoint cp)
+{
+    return cp->nfiles;
+}
+
+
+extern int64_t XS_event_checkpoint_pendings (XS_event_checkpoint cp)
+{
+    return cp->npendings;
+}
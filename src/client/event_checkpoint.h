@@ -0,0 +1,180 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: event_checkpoint.h
+ *   durable per-file checkpoints of kafka event messages
+ *
+ *   客户端发送到 kafka 的事件消息先写入日志文件 (P: 待投递), 收到投递
+ *   报告之后写入确认记录 (D). 内存中保存每个文件最后确认的事件序号
+ *   (检查点) 和没有确认的消息. 进程崩溃重启之后, 日志中没有确认而且
+ *   比文件检查点新的消息按序号重新发送 (重放), 不需要重新扫描全部目录.
+ *
+ *   日志文件格式:
+ *     [magic:8][记录...]
+ *     记录: [len:4][type:1][pad:3][seq:8][time_us:8][内容]
+ *
+ *   P: [partition:4][topiclen:2][keylen:2][filekeylen:2][pad:2][msglen:4]
+ *      [topic][key][filekey][msg]
+ *   D: [filekeylen:2][filekey]
+ *   C: 同 D, 压缩日志时写入的文件检查点
+ *
+ *   日志超过 XSYNC_KAFKA_JOURNAL_MAXSIZE 时压缩为检查点和待投递的消息.
+ *   崩溃时写了一半的尾部记录在打开时截掉.
+ *
+ *   事件序号 seq = max(上一个序号 + 1, 当前微秒时间), 日志丢失之后重新
+ *   开始的序号也大于之前的序号, 读者可以按文件用 seq 去掉重复的消息.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-27
+ *
+ * @update: 2018-11-30 20:05:37
+ */
+
+#ifndef EVENT_CHECKPOINT_H_INCLUDED
+#define EVENT_CHECKPOINT_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+
+#include <stdint.h>
+#include <time.h>
+
+
+typedef struct xs_event_checkpoint_t * XS_event_checkpoint;
+
+
+/**
+ * 待投递的消息. 字符串不以 '\0' 结尾
+ */
+typedef struct xs_event_pending_t
+{
+    uint64_t seq;
+    uint64_t time_us;
+
+    int32_t partition;
+
+    int topiclen;
+    int keylen;
+    int filekeylen;
+    int msglen;
+
+    const char *topic;
+    const char *key;
+    const char *filekey;
+    const char *msg;
+} xs_event_pending_t;
+
+
+/**
+ * 重放回调: 返回 0 表示投递成功
+ */
+typedef int (*event_replay_cb) (const xs_event_pending_t *pending, void *arg);
+
+
+/**
+ * XS_event_checkpoint_open
+ *   打开 (不存在时创建) 日志文件, 读入检查点和上次没有确认的消息
+ */
+extern XS_RESULT XS_event_checkpoint_open (const char *journal, XS_event_checkpoint *outcp);
+
+
+extern void XS_event_checkpoint_close (XS_event_checkpoint cp);
+
+
+/**
+ * XS_event_checkpoint_next_seq
+ *   分配事件序号 (线程安全)
+ */
+extern uint64_t XS_event_checkpoint_next_seq (XS_event_checkpoint cp);
+
+
+/**
+ * XS_event_checkpoint_pending
+ *   发送之前写入待投递记录
+ *
+ * returns:
+ *   XS_SUCCESS
+ *   XS_ERROR - 写日志失败 (消息仍然可以发送, 但崩溃之后不能重放)
+ */
+extern XS_RESULT XS_event_checkpoint_pending (XS_event_checkpoint cp, const xs_event_pending_t *pending);
+
+
+/**
+ * XS_event_checkpoint_delivered
+ *   收到投递报告之后确认消息: 更新文件的检查点
+ */
+extern void XS_event_checkpoint_delivered (XS_event_checkpoint cp, uint64_t seq);
+
+
+/**
+ * XS_event_checkpoint_replay
+ *   按序号重新发送上次没有确认的消息. 比文件检查点旧的消息已经被
+ *   后来的事件代替, 不再发送. 重放之后压缩日志. 回调在锁内调用,
+ *   只能在开始处理事件之前调用.
+ *
+ * returns:
+ *   重放成功的消息数. 失败的消息保留, 下次启动时再重放
+ */
+extern int XS_event_checkpoint_replay (XS_event_checkpoint cp, event_replay_cb replay_cb, void *arg);
+
+
+/**
+ * XS_event_checkpoint_retry
+ *   运行期间重新发送投递失败的消息: 只发送写入日志超过 min_age_ms 的
+ *   消息 (正在同步发送的消息不重复发送), 最多 maxcount 条. 回调在锁外
+ *   调用, 成功的消息确认投递.
+ *
+ * returns:
+ *   重新发送成功的消息数
+ */
+extern int XS_event_checkpoint_retry (XS_event_checkpoint cp, int min_age_ms, int maxcount, event_replay_cb replay_cb, void *arg);
+
+
+/**
+ * XS_event_checkpoint_time
+ *   日志中最后一个事件的时间 (秒). 没有记录返回 0
+ */
+extern time_t XS_event_checkpoint_time (XS_event_checkpoint cp);
+
+
+/**
+ * XS_event_checkpoint_files
+ * XS_event_checkpoint_pendings
+ *   有检查点的文件数和没有确认的消息数
+ */
+extern int64_t XS_event_checkpoint_files (XS_event_checkpoint cp);
+
+extern int64_t XS_event_checkpoint_pendings (XS_event_checkpoint cp);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* EVENT_CHECKPOINT_H_INCLUDED */
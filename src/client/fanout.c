@@ -0,0 +1,701 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: fanout.c
+ *   sync one file to many servers: read once, fan out to N streams
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-16
+ *
+ * @update: 2018-12-01 10:26:37
+ */
+
+#include "client_api.h"
+
+#include "fanout.h"
+
+
+xs_fanout_t * XS_fanout_create (int fd, ub8 endpos, const char *pathfile)
+{
+    int i, chunked, nblocks;
+
+    xs_fanout_t *fanout;
+
+    chunked = (endpos >= XSYNC_CHUNK_FILE_MINSIZE);
+    nblocks = (chunked? XSYNC_FANOUT_CHUNK_BLOCKS : XSYNC_FANOUT_CACHE_BLOCKS);
+
+    // 缓存的数据在前 (按块对齐), 块描述在后
+    fanout = (xs_fanout_t *) mem_alloc_zero(1,
+        sizeof(xs_fanout_t) + ((size_t) XSYNC_FANOUT_BLOCK_SIZE + sizeof(xs_fanout_block_t)) * nblocks);
+
+    fanout->fd = fd;
+    fanout->endpos = endpos;
+    fanout->pathfile = pathfile;
+
+    fanout->nblocks = nblocks;
+    fanout->blocks = (xs_fanout_block_t *) (fanout->blockbuf + (size_t) XSYNC_FANOUT_BLOCK_SIZE * nblocks);
+
+    for (i = 0; i < nblocks; i++) {
+        fanout->blocks[i].data = fanout->blockbuf + (size_t) XSYNC_FANOUT_BLOCK_SIZE * i;
+    }
+
+    if (chunked) {
+        fanout->chunked = 1;
+
+        XS_chunker_init(&fanout->chunker, XSYNC_CHUNK_MIN_SIZE, XSYNC_CHUNK_AVG_SIZE, XSYNC_CHUNK_MAX_SIZE);
+
+        fanout->chunkbuf = (ub1 *) mem_alloc_unset(XSYNC_CHUNK_MAX_SIZE * 2);
+    }
+
+    return fanout;
+}
+
+
+void XS_fanout_free (xs_fanout_t *fanout)
+{
+    int i;
+
+    for (i = 0; i < fanout->ntargets; i++) {
+        xs_fanout_target_t *target = &fanout->targets[i];
+
+        if (target->state == XS_FANOUT_OPEN) {
+            XS_server_conn_stream_close(target->sconn, target->entryid);
+        }
+
+        if (target->chunks) {
+            mem_free(target->chunks);
+        }
+
+        XS_compressor_uninit(&target->compressor);
+    }
+
+    if (fanout->chunkbuf) {
+        mem_free(fanout->chunkbuf);
+    }
+
+    if (fanout->compbuf) {
+        mem_free(fanout->compbuf);
+    }
+
+    mem_free(fanout);
+}
+
+
+void XS_fanout_set_progress (xs_fanout_t *fanout, XS_sync_progress progress, ub8 modtime)
+{
+    fanout->progress = progress;
+    fanout->modtime = modtime;
+}
+
+
+XS_RESULT XS_fanout_add_target (xs_fanout_t *fanout, int sid, xs_server_conn_t *sconn, ub8 entryid, ub8 offset)
+{
+    xs_fanout_target_t *target;
+
+    if (fanout->ntargets >= XSYNC_SERVER_MAXID || ! sconn) {
+        return XS_E_PARAM;
+    }
+
+    target = &fanout->targets[fanout->ntargets++];
+
+    target->sid = sid;
+    target->sconn = sconn;
+    target->entryid = entryid;
+
+    target->sent = target->acked = (offset < fanout->endpos? offset : fanout->endpos);
+
+    if (fanout->chunked) {
+        target->chunks = (XSChunkDesc_t *) mem_alloc_unset(sizeof(XSChunkDesc_t) * XSYNC_CHUNK_NEGOTIATE_MAX);
+    }
+
+    return XS_SUCCESS;
+}
+
+
+/**
+ * 取得 offset 开始的数据 (到所在块的结尾). 块按 XSYNC_FANOUT_BLOCK_SIZE 对齐,
+ *   直接映射到缓存. 返回 0 读文件出错
+ */
+static const ub1 * fanout_get_block (xs_fanout_t *fanout, ub8 offset, ub4 *length)
+{
+    ub8 base = offset - offset % XSYNC_FANOUT_BLOCK_SIZE;
+
+    xs_fanout_block_t *block = &fanout->blocks[(base / XSYNC_FANOUT_BLOCK_SIZE) % fanout->nblocks];
+
+    if (! block->valid || block->offset != base) {
+        ssize_t rc;
+        ub4 want, got = 0;
+
+        want = (ub4) (fanout->endpos - base < XSYNC_FANOUT_BLOCK_SIZE? fanout->endpos - base : XSYNC_FANOUT_BLOCK_SIZE);
+
+        block->valid = 0;
+
+        while (got < want) {
+            rc = pread(fanout->fd, block->data + got, want - got, (off_t) (base + got));
+
+            if (rc > 0) {
+                got += (ub4) rc;
+            } else if (rc < 0 && errno == EINTR) {
+                continue;
+            } else {
+                LOGGER_ERROR("pread error(%d): %s (offset=%ju)", errno, rc? strerror(errno) : "file truncated", base + got);
+                return 0;
+            }
+        }
+
+        block->offset = base;
+        block->length = want;
+        block->valid = 1;
+
+        fanout->reads++;
+    }
+
+    *length = block->length - (ub4) (offset - base);
+
+    return block->data + (offset - base);
+}
+
+
+static void fanout_target_reset (xs_fanout_target_t *target)
+{
+    XS_server_conn_stream_close(target->sconn, target->entryid);
+
+    target->state = XS_FANOUT_IDLE;
+    target->ended = 0;
+
+    // 从服务端确认的位置重新发送
+    target->sent = target->acked;
+    target->streampos = 0;
+
+    target->npending = 0;
+    target->pendhead = 0;
+
+    target->chunkstate = XS_FANOUT_CHUNK_SCAN;
+    target->nchunks = 0;
+    target->chunkidx = 0;
+}
+
+
+/**
+ * 流上的字节到达 streampos 时文件确认到 sent. streampos 没有变化 (跳过的块)
+ *   时合并到最后一个记录
+ */
+static void fanout_target_pending (xs_fanout_target_t *target)
+{
+    xs_fanout_pending_t *last;
+
+    if (target->npending) {
+        last = &target->pending[(target->pendhead + target->npending - 1) % XSYNC_FANOUT_PENDING_MAX];
+
+        if (last->streampos == target->streampos) {
+            last->fileoff = target->sent;
+            return;
+        }
+    }
+
+    last = &target->pending[(target->pendhead + target->npending) % XSYNC_FANOUT_PENDING_MAX];
+
+    last->streampos = target->streampos;
+    last->fileoff = target->sent;
+    last->sendns = XS_compress_now_ns();
+
+    target->npending++;
+}
+
+
+/**
+ * 由流的确认字节更新文件确认偏移
+ */
+static void fanout_target_update (xs_fanout_t *fanout, xs_fanout_target_t *target)
+{
+    int rc;
+    ub8 written, acked, fileoff;
+
+    if (target->state != XS_FANOUT_OPEN) {
+        return;
+    }
+
+    rc = XS_server_conn_stream_progress(target->sconn, target->entryid, &written, &acked);
+
+    if (rc != 0 || target->sconn->session != target->session) {
+        LOGGER_WARN("server-%d: stream(%ju) lost at offset=%ju", target->sid, target->entryid, target->acked);
+
+        fanout_target_reset(target);
+        return;
+    }
+
+    fileoff = target->acked;
+
+    while (target->npending && target->pending[target->pendhead].streampos <= acked) {
+        target->acked = target->pending[target->pendhead].fileoff;
+
+        if (target->compressor.codec != XS_CODEC_NONE) {
+            XS_compressor_adapt(&target->compressor, XS_compress_now_ns() - target->pending[target->pendhead].sendns);
+        }
+
+        target->pendhead = (target->pendhead + 1) % XSYNC_FANOUT_PENDING_MAX;
+        target->npending--;
+    }
+
+    if (fanout->progress && target->acked != fileoff) {
+        XS_sync_progress_set(fanout->progress, target->sid, target->entryid, target->acked, fanout->endpos, fanout->modtime);
+    }
+
+    if (target->ended && ! target->npending) {
+        XS_server_conn_stream_close(target->sconn, target->entryid);
+
+        target->state = XS_FANOUT_DONE;
+    }
+}
+
+
+/**
+ * 打开流时按连接协商的算法准备压缩
+ */
+static void fanout_target_codec (xs_fanout_t *fanout, xs_fanout_target_t *target)
+{
+    ub4 codec = target->sconn->bitflags & XS_CAPFLAG_COMPRESS_MASK;
+
+    if (codec != target->compressor.codec) {
+        size_t bound;
+
+        XS_compressor_uninit(&target->compressor);
+        XS_compressor_init(&target->compressor, codec);
+        XS_compressor_begin_file(&target->compressor, fanout->pathfile);
+
+        bound = XS_compress_bound(target->compressor.codec, fanout->chunked? XSYNC_CHUNK_MAX_SIZE : XSYNC_FANOUT_BLOCK_SIZE);
+
+        if (target->compressor.codec != XS_CODEC_NONE && bound > fanout->compsize) {
+            fanout->compbuf = (ub1 *) mem_realloc(fanout->compbuf, bound);
+            fanout->compsize = (ub4) bound;
+        }
+    }
+}
+
+
+/**
+ * 写入一个 XSYN: 数据在 [sent, sent + len). 压缩有效时发送压缩的数据.
+ *   返回同 XS_server_conn_stream_send, 成功时 streampos 加上写入的字节
+ */
+static int fanout_target_xsyn (xs_fanout_t *fanout, xs_fanout_target_t *target, const ub1 *data, ub4 len, int end)
+{
+    int rc;
+    ub4 codec, datalen = len;
+
+    XSSyncFileReq_t req;
+    ub1 head[XS_SYNC_REQ_SIZE];
+
+    size_t complen = XS_compressor_compress(&target->compressor, data, len, fanout->compbuf, fanout->compsize, &codec);
+
+    if (complen) {
+        data = fanout->compbuf;
+        datalen = (ub4) complen;
+    }
+
+    XSSyncFileReqBuild(&req, target->session, target->entryid, target->sent, datalen, codec, len, head);
+
+    rc = XS_server_conn_stream_send(target->sconn, target->entryid, head, XS_SYNC_REQ_SIZE, data, datalen, end);
+
+    if (rc > 0) {
+        target->streampos += XS_SYNC_REQ_SIZE + datalen;
+    }
+
+    return rc;
+}
+
+
+/**
+ * 从 sent 开始切分下一批块. 数据经过缓存读取, 一批块不超过缓存 (nblocks 个
+ *   对齐的块), 随后发送缺失的块时不再读文件. 其他目标在同一位置切分过时直接复制
+ */
+static int fanout_chunk_scan (xs_fanout_t *fanout, xs_fanout_target_t *target)
+{
+    int i;
+
+    ub4 cut, pos = 0, len = 0;
+    ub8 readpos, scanend;
+
+    for (i = 0; i < fanout->ntargets; i++) {
+        xs_fanout_target_t *other = &fanout->targets[i];
+
+        if (other != target && other->nchunks && other->chunkoff == target->sent) {
+            memcpy(target->chunks, other->chunks, sizeof(XSChunkDesc_t) * other->nchunks);
+
+            target->nchunks = other->nchunks;
+            target->chunkoff = other->chunkoff;
+            return XS_SUCCESS;
+        }
+    }
+
+    target->nchunks = 0;
+    target->chunkoff = target->sent;
+
+    readpos = target->sent;
+
+    scanend = readpos - readpos % XSYNC_FANOUT_BLOCK_SIZE + (ub8) XSYNC_FANOUT_BLOCK_SIZE * fanout->nblocks;
+    if (scanend > fanout->endpos) {
+        scanend = fanout->endpos;
+    }
+
+    for (;;) {
+        int eof;
+
+        // 缓冲的尾部移到头部, 从缓存补满 (2 个最大块)
+        if (pos) {
+            memmove(fanout->chunkbuf, fanout->chunkbuf + pos, len - pos);
+            len -= pos;
+            pos = 0;
+        }
+
+        while (len < XSYNC_CHUNK_MAX_SIZE * 2 && readpos < scanend) {
+            ub4 n;
+            const ub1 *data = fanout_get_block(fanout, readpos, &n);
+
+            if (! data) {
+                return XS_E_FILE;
+            }
+
+            if (n > XSYNC_CHUNK_MAX_SIZE * 2 - len) {
+                n = XSYNC_CHUNK_MAX_SIZE * 2 - len;
+            }
+
+            memcpy(fanout->chunkbuf + len, data, n);
+
+            len += n;
+            readpos += n;
+        }
+
+        eof = (readpos == fanout->endpos);
+
+        while (pos < len && target->nchunks < XSYNC_CHUNK_NEGOTIATE_MAX &&
+            (cut = XS_chunker_cut(&fanout->chunker, fanout->chunkbuf + pos, len - pos, eof)) > 0) {
+            XSChunkDesc_t *desc = &target->chunks[target->nchunks++];
+
+            bzero(desc, sizeof(*desc));
+
+            desc->length = cut;
+            XS_chunk_digest(fanout->chunkbuf + pos, cut, desc->digest);
+
+            pos += cut;
+        }
+
+        // 不足一个最大块的尾部留给下一批 (从缓存的下一段切分)
+        if (target->nchunks == XSYNC_CHUNK_NEGOTIATE_MAX || readpos == scanend) {
+            break;
+        }
+    }
+
+    return XS_SUCCESS;
+}
+
+
+/**
+ * 取得 [offset, offset + length) 的块数据. 在一个缓存块之内时直接返回缓存,
+ *   否则从缓存拼接到 chunkbuf. 返回 0 读文件出错
+ */
+static const ub1 * fanout_chunk_data (xs_fanout_t *fanout, ub8 offset, ub4 length)
+{
+    ub4 n, got = 0;
+
+    const ub1 *data = fanout_get_block(fanout, offset, &n);
+
+    if (! data || n >= length) {
+        return data;
+    }
+
+    for (;;) {
+        if (n > length - got) {
+            n = length - got;
+        }
+
+        memcpy(fanout->chunkbuf + got, data, n);
+
+        got += n;
+
+        if (got == length) {
+            break;
+        }
+
+        data = fanout_get_block(fanout, offset + got, &n);
+
+        if (! data) {
+            return 0;
+        }
+    }
+
+    return fanout->chunkbuf;
+}
+
+
+/**
+ * 分块发送: 每批块先发送 XCHK, 收到缺失块位图之后只用 XSYN 发送缺失的块,
+ *   服务端已有的块直接跳过. 不等待: 队列满或者应答没有到达时返回 0,
+ *   全部块处理完 (sent = endpos) 返回 1, 读文件出错返回 -1
+ */
+static int fanout_target_chunks (xs_fanout_t *fanout, xs_fanout_target_t *target)
+{
+    int rc;
+
+    while (target->sent < fanout->endpos) {
+        if (target->chunkstate == XS_FANOUT_CHUNK_SCAN) {
+            XSChunkNegotiateReq_t chkreq;
+            ub4 len;
+
+            if (target->npending >= XSYNC_FANOUT_PENDING_MAX) {
+                return 0;
+            }
+
+            // 队列满时保留切分的结果, 下一次直接发送
+            if (! target->nchunks && fanout_chunk_scan(fanout, target) != XS_SUCCESS) {
+                return (-1);
+            }
+
+            XSChunkNegotiateReqBuild(&chkreq, target->session, target->entryid, target->chunkoff, target->chunks, target->nchunks, fanout->chunkbuf);
+
+            len = XS_CHUNK_NEGOTIATE_REQ_SIZE + chkreq.datalen;
+
+            rc = XS_server_conn_stream_send(target->sconn, target->entryid, fanout->chunkbuf, len, 0, 0, 0);
+
+            if (rc == 0) {
+                return 0;
+            }
+
+            if (rc < 0) {
+                fanout_target_reset(target);
+                return 0;
+            }
+
+            target->streampos += len;
+            fanout_target_pending(target);
+
+            target->chunkstate = XS_FANOUT_CHUNK_WAIT;
+        }
+
+        if (target->chunkstate == XS_FANOUT_CHUNK_WAIT) {
+            XSChunkNegotiateReply_t reply;
+            ub1 replybuf[XS_CHUNK_NEGOTIATE_REPLY_SIZE + XS_CHUNK_BITMAP_SIZE(XSYNC_CHUNK_NEGOTIATE_MAX)];
+
+            rc = XS_server_conn_stream_recv(target->sconn, target->entryid, XS_CHUNK_NEGOTIATE_REPLY_SIZE, replybuf, sizeof(replybuf), 0);
+
+            if (rc == 0) {
+                return 0;
+            }
+
+            if (rc < 0 || ! XSChunkNegotiateReplyParse(replybuf, &reply) ||
+                reply.entryid != target->entryid || reply.chunks != target->nchunks) {
+                LOGGER_WARN("server-%d: invalid XCHK reply on stream(%ju)", target->sid, target->entryid);
+
+                fanout_target_reset(target);
+                return 0;
+            }
+
+            memcpy(target->bitmap, replybuf + XS_CHUNK_NEGOTIATE_REPLY_SIZE, reply.datalen);
+
+            target->chunkidx = 0;
+            target->chunkstate = XS_FANOUT_CHUNK_SEND;
+        }
+
+        while (target->chunkidx < target->nchunks) {
+            const XSChunkDesc_t *desc = &target->chunks[target->chunkidx];
+
+            if (XS_CHUNK_BITMAP_TEST(target->bitmap, target->chunkidx)) {
+                const ub1 *data;
+
+                if (target->npending >= XSYNC_FANOUT_PENDING_MAX) {
+                    return 0;
+                }
+
+                data = fanout_chunk_data(fanout, target->sent, desc->length);
+
+                if (! data) {
+                    return (-1);
+                }
+
+                rc = fanout_target_xsyn(fanout, target, data, desc->length, 0);
+
+                if (rc == 0) {
+                    return 0;
+                }
+
+                if (rc < 0) {
+                    fanout_target_reset(target);
+                    return 0;
+                }
+            } else {
+                // 服务端已经把这个块写入了文件
+                fanout->chunks_skipped++;
+                fanout->bytes_skipped += desc->length;
+            }
+
+            target->sent += desc->length;
+            target->chunkidx++;
+
+            fanout_target_pending(target);
+        }
+
+        target->nchunks = 0;
+        target->chunkstate = XS_FANOUT_CHUNK_SCAN;
+    }
+
+    return 1;
+}
+
+
+/**
+ * 向一个目标写入尽可能多的 XSYN 消息, 队列满时返回 (不等待)
+ */
+static int fanout_target_send (xs_fanout_t *fanout, xs_fanout_target_t *target)
+{
+    if (target->state == XS_FANOUT_IDLE) {
+        if (! XS_server_conn_is_ready(target->sconn) ||
+            XS_server_conn_stream_open(target->sconn, target->entryid) != XS_SUCCESS) {
+            return 0;
+        }
+
+        target->session = target->sconn->session;
+        target->state = XS_FANOUT_OPEN;
+
+        fanout_target_codec(fanout, target);
+    }
+
+    if (fanout->chunked && ! target->ended) {
+        int rc = fanout_target_chunks(fanout, target);
+
+        if (rc != 1) {
+            return rc;
+        }
+    }
+
+    while (! target->ended && target->npending < XSYNC_FANOUT_PENDING_MAX) {
+        int rc, end;
+
+        ub4 len = 0;
+        const ub1 *data = 0;
+
+        if (target->sent < fanout->endpos) {
+            data = fanout_get_block(fanout, target->sent, &len);
+
+            if (! data) {
+                return (-1);
+            }
+        }
+
+        end = (target->sent + len == fanout->endpos);
+
+        rc = fanout_target_xsyn(fanout, target, data, len, end);
+
+        if (rc == 0) {
+            // 这个服务器慢: 下一次再发, 不影响其他服务器
+            break;
+        }
+
+        if (rc < 0) {
+            fanout_target_reset(target);
+            break;
+        }
+
+        target->sent += len;
+        target->ended = end;
+
+        fanout_target_pending(target);
+    }
+
+    return 0;
+}
+
+
+int XS_fanout_step (xs_fanout_t *fanout)
+{
+    int i, remaining = 0;
+
+    for (i = 0; i < fanout->ntargets; i++) {
+        xs_fanout_target_t *target = &fanout->targets[i];
+
+        fanout_target_update(fanout, target);
+
+        if (target->state == XS_FANOUT_DONE) {
+            continue;
+        }
+
+        remaining++;
+
+        if (fanout_target_send(fanout, target) == -1) {
+            return (-1);
+        }
+    }
+
+    return remaining;
+}
+
+
+int XS_fanout_run (xs_fanout_t *fanout, int timeout_ms)
+{
+    int i, remaining;
+    ub8 acked, lastacked = 0;
+
+    struct timeval t0, t1;
+
+    gettimeofday(&t0, 0);
+
+    while ((remaining = XS_fanout_step(fanout)) > 0) {
+        xs_server_conn_t *waitconn = 0;
+
+        acked = 0;
+
+        for (i = 0; i < fanout->ntargets; i++) {
+            xs_fanout_target_t *target = &fanout->targets[i];
+
+            acked += target->acked;
+
+            if (! waitconn && target->state != XS_FANOUT_DONE && XS_server_conn_is_ready(target->sconn)) {
+                waitconn = target->sconn;
+            }
+        }
+
+        if (! waitconn) {
+            // 剩下的服务器都不可用: 不阻塞调用线程
+            break;
+        }
+
+        if (timeout_ms > 0) {
+            gettimeofday(&t1, 0);
+
+            if (acked != lastacked) {
+                // 有新的确认: 重新计时
+                lastacked = acked;
+                t0 = t1;
+            } else if ((t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000 >= timeout_ms) {
+                LOGGER_WARN("fanout stalled for %d ms: %d target(s) remaining", timeout_ms, remaining);
+                break;
+            }
+        }
+
+        // 等待发送或确认
+        XS_stream_mux_wait(&waitconn->mux, 10);
+    }
+
+    return remaining;
+}
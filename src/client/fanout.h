@@ -0,0 +1,213 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: fanout.h
+ *   sync one file to many servers: read once, fan out to N streams
+ *
+ *   文件的每个块只读一次, 同样的 XSYN 消息写入每个目标服务器的流.
+ *   每个 (条目, sid) 有各自的发送偏移和服务端确认的偏移: 慢的或者不可用的
+ *   服务器只落后于自己, 不影响其他服务器. 落后的服务器在最近的
+ *   XSYNC_FANOUT_CACHE_BLOCKS 个块之内时从缓存取数据, 不重新读文件.
+ *   分块传输时切分和发送缺失的块也从缓存取数据, 一批块不超过缓存.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-16
+ *
+ * @update: 2018-12-01 10:26:37
+ */
+
+#ifndef FANOUT_H_INCLUDED
+#define FANOUT_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "server_conn.h"
+#include "chunker.h"
+#include "sync_progress.h"
+
+
+#define XS_FANOUT_IDLE    0     /* 流没有打开 (或者连接断开之后等待重新打开) */
+#define XS_FANOUT_OPEN    1
+#define XS_FANOUT_DONE    2     /* 服务端确认了全部数据 */
+
+
+/**
+ * 分块传输: 每批不超过 XSYNC_CHUNK_NEGOTIATE_MAX 个块
+ */
+#define XS_FANOUT_CHUNK_SCAN    0     /* 切分下一批块 */
+#define XS_FANOUT_CHUNK_WAIT    1     /* XCHK 已发送, 等待缺失块位图 */
+#define XS_FANOUT_CHUNK_SEND    2     /* 发送缺失的块 */
+
+
+/**
+ * 流上的字节到达 streampos 被确认时, 文件确认到 fileoff.
+ *   sendns 为写入流的时间: 确认的耗时作为压缩级别调整的发送耗时
+ */
+typedef struct xs_fanout_pending_t
+{
+    ub8 streampos;
+    ub8 fileoff;
+    ub8 sendns;
+} xs_fanout_pending_t;
+
+
+typedef struct xs_fanout_target_t
+{
+    int sid;
+
+    /* 不持有引用: 由调用者 (perthread_data) 持有 */
+    xs_server_conn_t *sconn;
+
+    /* 服务端条目 ID = 流 ID */
+    ub8 entryid;
+
+    /* XS_FANOUT_* */
+    int state;
+
+    /* 1: 最后的消息 (END) 已经写入流 */
+    int ended;
+
+    /* 打开流时连接的会话: 会话改变说明重连过 */
+    ub8 session;
+
+    /* 已写入流的文件偏移和服务端确认的文件偏移 */
+    ub8 sent;
+    ub8 acked;
+
+    /* 流上已写入的字节 (包括 XSYN 包头) */
+    ub8 streampos;
+
+    int npending;
+    int pendhead;
+    xs_fanout_pending_t pending[XSYNC_FANOUT_PENDING_MAX];
+
+    /**
+     * 分块传输的当前一批块 (XS_FANOUT_CHUNK_*): 从 chunkoff 开始的 nchunks 个块,
+     *   chunkidx 是下一个要处理的块. bitmap 为服务端返回的缺失块位图
+     */
+    int chunkstate;
+    ub4 nchunks;
+    ub4 chunkidx;
+    ub8 chunkoff;
+    XSChunkDesc_t *chunks;
+    ub1 bitmap[XS_CHUNK_BITMAP_SIZE(XSYNC_CHUNK_NEGOTIATE_MAX)];
+
+    /* 按连接协商的算法压缩 XSYN 数据. 打开流时算法改变 (重连) 则重新初始化 */
+    xs_compressor_t compressor;
+} xs_fanout_target_t;
+
+
+typedef struct xs_fanout_block_t
+{
+    int valid;
+    ub4 length;
+    ub8 offset;
+    ub1 *data;
+} xs_fanout_block_t;
+
+
+typedef struct xs_fanout_t
+{
+    int fd;
+
+    /* 同步的终点: 文件长度 */
+    ub8 endpos;
+
+    /* 读文件的次数 (统计) */
+    ub8 reads;
+
+    /* 不小于 XSYNC_CHUNK_FILE_MINSIZE 的文件分块传输, 已存在的块不传输 */
+    int chunked;
+    xs_chunker_t chunker;
+
+    /* 切分和拼接跨缓存块的数据的缓冲 (2 * XSYNC_CHUNK_MAX_SIZE) */
+    ub1 *chunkbuf;
+
+    /* 文件路径 (调用者所有): 已经压缩过的文件类型不再压缩 */
+    const char *pathfile;
+
+    /* 确认偏移前进时写入 progress (断点续传), 0 不记录 */
+    XS_sync_progress progress;
+    ub8 modtime;
+
+    /* 压缩数据的缓冲: 所有目标共用, 按最大的 XS_compress_bound 分配 */
+    ub4 compsize;
+    ub1 *compbuf;
+
+    /* 跳过 (服务端已有) 的块和字节 (统计) */
+    ub8 chunks_skipped;
+    ub8 bytes_skipped;
+
+    int ntargets;
+    xs_fanout_target_t targets[XSYNC_SERVER_MAXID];
+
+    /* 缓存: XSYNC_FANOUT_CACHE_BLOCKS, 分块传输为 XSYNC_FANOUT_CHUNK_BLOCKS */
+    int nblocks;
+    xs_fanout_block_t *blocks;
+
+    ub1 blockbuf[0];
+} xs_fanout_t;
+
+
+/**
+ * fd 只读打开的文件, 同步 [0, endpos). fd 由调用者关闭.
+ *   endpos 不小于 XSYNC_CHUNK_FILE_MINSIZE 时分块传输 (XCHK 协商).
+ *   pathfile 在 fanout 释放之前必须有效
+ */
+extern xs_fanout_t * XS_fanout_create (int fd, ub8 endpos, const char *pathfile);
+
+extern void XS_fanout_free (xs_fanout_t *fanout);
+
+/**
+ * 各目标的确认偏移记录到 progress. modtime 为文件的修改时间
+ */
+extern void XS_fanout_set_progress (xs_fanout_t *fanout, XS_sync_progress progress, ub8 modtime);
+
+/**
+ * 增加目标服务器. offset 是服务端已经有的文件偏移 (断点续传)
+ */
+extern XS_RESULT XS_fanout_add_target (xs_fanout_t *fanout, int sid, xs_server_conn_t *sconn, ub8 entryid, ub8 offset);
+
+/**
+ * 推进一次: 更新各目标的确认偏移, 向可用的目标写入数据 (不等待).
+ *   返回没有完成的目标数目, -1 读文件出错
+ */
+extern int XS_fanout_step (xs_fanout_t *fanout);
+
+/**
+ * 推进直到全部完成, 或者剩下的目标都不可用, 或者全部目标超过 timeout_ms
+ *   都没有新的确认 (停滞, 0 不超时). 返回没有完成的目标数目, -1 读文件出错
+ */
+extern int XS_fanout_run (xs_fanout_t *fanout, int timeout_ms);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* FANOUT_H_INCLUDED */
@@ -30,7 +30,7 @@
  *
  * @create:
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 20:21:48
  */
 
 #ifndef PERTHREAD_DATA_H_INCLUDED
@@ -41,14 +41,13 @@ extern "C" {
 #endif
 
 #include "../common/common_util.h"
+#include "../common/evrecord.h"
 
 #include "../kafkatools/kafkatools.h"
 #include "../luacontext/luacontext.h"
 
 #include "server_conn.h"
 
-#include "../common/red_black_tree.h"
-
 
 typedef struct perthread_data
 {
@@ -58,9 +57,19 @@ typedef struct perthread_data
 
     lua_context luactx;
 
+    /* 重新加载的脚本环境: inotify 线程发布, 工作线程在两个事件之间换用 */
+    lua_context luactx_next;
+
     int kafka_producer_ready;
     struct  kafkatools_producer_api_t kt_producer_api;
 
+    /**
+     * 没有脚本消息时事件消息的格式: EVRECORD_FMT_TEXT (默认), _JSON,
+     *   _BINARY (kafka_config() 返回 event_format = "binary" 时使用)
+     */
+    int event_format;
+
+    /* 引用 xs_client_t.server_conns 中共享的连接. [0] 是服务器数量 */
     xs_server_conn_t *server_conns[XSYNC_SERVER_MAXID + 1];
 
     /* buffer with size >= 8192 and >= (PATH_MAX x 2) */
@@ -70,27 +79,27 @@ typedef struct perthread_data
 
 #define v_type_buf(ptdata)      (ptdata->buffer + 0)
 #define v_time_buf(ptdata)      (ptdata->buffer + 10)
-#define v_sid_buf(ptdata)       (ptdata->buffer + 38)
-#define v_thread_buf(ptdata)    (ptdata->buffer + 45)
+#define v_thread_buf(ptdata)    (ptdata->buffer + 38)
 #define v_event_buf(ptdata)     (ptdata->buffer + 50)
 #define v_clientid_buf(ptdata)  (ptdata->buffer + 100)
 #define v_pathid_buf(ptdata)    (ptdata->buffer + 200)
 #define v_file_buf(ptdata)      (ptdata->buffer + 300)
 #define v_route_buf(ptdata)     (ptdata->buffer + 560)
+#define v_sid_buf(ptdata)       (ptdata->buffer + 1800)
 #define v_path_buf(ptdata)      (ptdata->buffer + 2000)
 #define v_eventmsg_buf(ptdata)  (ptdata->buffer + 4000)
 #define v_buffer_end(ptdata)    (ptdata->buffer + XSYNC_BUFSIZE)
 
 
 #define v_type_cb(ptdata)      (v_time_buf(ptdata) - v_type_buf(ptdata))
-#define v_time_cb(ptdata)      (v_sid_buf(ptdata) - v_time_buf(ptdata))
-#define v_sid_cb(ptdata)       (v_thread_buf(ptdata) - v_sid_buf(ptdata))
+#define v_time_cb(ptdata)      (v_thread_buf(ptdata) - v_time_buf(ptdata))
 #define v_thread_cb(ptdata)    (v_event_buf(ptdata) - v_thread_buf(ptdata))
 #define v_event_cb(ptdata)     (v_clientid_buf(ptdata) - v_event_buf(ptdata))
 #define v_clientid_cb(ptdata)  (v_pathid_buf(ptdata) - v_clientid_buf(ptdata))
 #define v_pathid_cb(ptdata)    (v_file_buf(ptdata) - v_pathid_buf(ptdata))
 #define v_file_cb(ptdata)      (v_route_buf(ptdata) - v_file_buf(ptdata))
-#define v_route_cb(ptdata)     (v_path_buf(ptdata) - v_route_buf(ptdata))
+#define v_route_cb(ptdata)     (v_sid_buf(ptdata) - v_route_buf(ptdata))
+#define v_sid_cb(ptdata)       (v_path_buf(ptdata) - v_sid_buf(ptdata))
 #define v_path_cb(ptdata)      (v_eventmsg_buf(ptdata) - v_path_buf(ptdata))
 #define v_eventmsg_cb(ptdata)  (v_buffer_end(ptdata) - v_eventmsg_buf(ptdata))
 
@@ -129,6 +138,12 @@ int kafka_producer_api_create(kafkatools_producer_api_t *api, const char *libkts
     api->kt_get_topic = dlsym(handle, "kafkatools_get_topic");
     api->kt_topic_name = dlsym(handle, "kafkatools_topic_name");
     api->kt_produce_message_sync = dlsym(handle, "kafkatools_produce_message_sync");
+    api->kt_produce_keyed_sync = dlsym(handle, "kafkatools_produce_keyed_sync");
+    api->kt_producer_poll = dlsym(handle, "kafkatools_producer_poll");
+    api->kt_producer_flush = dlsym(handle, "kafkatools_producer_flush");
+    api->kt_tailer_create = dlsym(handle, "kafkatools_tailer_create");
+    api->kt_tailer_destroy = dlsym(handle, "kafkatools_tailer_destroy");
+    api->kt_tail_file = dlsym(handle, "kafkatools_tail_file");
 
     if (api->kt_producer_create(prop_names, prop_values, KAFKATOOLS_MSG_CB_DEFAULT, 0, &api->producer) != KAFKATOOLS_SUCCESS) {
         LOGGER_ERROR("kafkatools_producer_create fail");
@@ -160,6 +175,8 @@ void kafka_producer_api_free(kafkatools_producer_api_t *api)
 /**
  * client_conf.c
  */
+extern lua_context perthread_luactx_create (int threadid, const char *taskscriptfile);
+
 extern void * perthread_data_create (XS_client client, int servers, int threadid, const char *taskscriptfile);
 
 extern void perthread_data_free (perthread_data *perdata);
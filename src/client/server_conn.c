@@ -30,7 +30,7 @@
  *
  * @create: 2018-02-12
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 21:10:24
  */
 
 #include "client_api.h"
@@ -47,6 +47,9 @@ extern XS_RESULT XS_server_conn_create (const xs_server_opts *servOpts, char *cl
     xcon = (XS_server_conn) mem_alloc_zero(1, sizeof(struct xs_server_conn_t) + sizeof(xs_server_opts));
 
     xcon->sockfd = -1;
+    xcon->wakefd = -1;
+
+    xcon->state = XS_CONN_CLOSED;
 
     /**
      * http://man7.org/linux/man-pages/man2/time.2.html
@@ -66,90 +69,342 @@ extern XS_RESULT XS_server_conn_create (const xs_server_opts *servOpts, char *cl
 
     randctx_init(&xcon->rctx, t32 ^ servOpts->magic);
 
-    do {
-        int sockfd;
+    strncpy(xcon->clientid, clientid, XSYNC_CLIENTID_MAXLEN);
+    strncpy(xcon->password, password, XSYNC_PASSWORD_MAXLEN);
+
+    XS_stream_mux_init(&xcon->mux);
+
+    pthread_mutex_init(&xcon->reglock, 0);
+    pthread_cond_init(&xcon->regcond, 0);
+
+    memcpy(xcon->srvopts, servOpts, sizeof(xs_server_opts));
+
+    *outSConn = (XS_server_conn) RefObjectInit(xcon);
+
+    return XS_SUCCESS;
+}
+
 
-        char msg[256];
+extern XS_VOID XS_server_conn_release (XS_server_conn *inSConn)
+{
+    LOGGER_TRACE0();
 
-        sockfd = opensocket_v2(servOpts->host, servOpts->sport, servOpts->sockopts.timeosec, &servOpts->sockopts, msg);
+    RefObjectRelease((void**) inSConn, server_conn_delete);
+}
 
-        if (sockfd == -1) {
-            LOGGER_ERROR("opensocket_v2 failed: %s", msg);
-            mem_free_s((void**) &xcon);
+
+static void server_conn_wakeup (XS_server_conn sconn)
+{
+    ub8 one = 1;
+
+    if (sconn->wakefd != -1) {
+        if (write(sconn->wakefd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+            LOGGER_WARN("wakeup reactor error(%d): %s", errno, strerror(errno));
+        }
+    }
+}
+
+
+extern XS_RESULT XS_server_conn_stream_open (XS_server_conn sconn, ub8 entryid)
+{
+    if (! XS_server_conn_is_ready(sconn)) {
+        return XS_ERROR;
+    }
+
+    if (! (sconn->bitflags & XS_CAPFLAG_MUX)) {
+        LOGGER_ERROR("server not support XMUX");
+        return XS_E_NOTIMP;
+    }
+
+    if (XS_stream_mux_open(&sconn->mux, entryid) != 0) {
+        LOGGER_ERROR("stream(%ju) already opened", entryid);
+        return XS_E_PARAM;
+    }
+
+    return XS_SUCCESS;
+}
+
+
+extern XS_RESULT XS_server_conn_stream_write (XS_server_conn sconn, ub8 entryid, const void *data, ub4 len, int end)
+{
+    int ret;
+
+    while ((ret = XS_stream_mux_write(&sconn->mux, entryid, data, len, end)) == 0 && len) {
+        // 流的队列已满: 服务器不可用时不等待
+        if (! XS_server_conn_is_ready(sconn)) {
             return XS_ERROR;
-        } else {
-            int flags, err;
+        }
 
-            LOGGER_INFO("opensocket_v2 success: %s:%s", servOpts->host, servOpts->sport);
+        server_conn_wakeup(sconn);
 
-            flags = socket_set_nonblock(sockfd, msg, sizeof(msg));
-            if (flags == -1) {
-                LOGGER_ERROR("socket_set_nonblock failed: %s", msg);
-                close(sockfd);
-                mem_free_s((void**) &xcon);
-                return XS_ERROR;
-            }
+        XS_stream_mux_wait(&sconn->mux, XSYNC_REACTOR_TICK_MS);
+    }
+
+    if (ret < 0) {
+        return XS_ERROR;
+    }
+
+    server_conn_wakeup(sconn);
+
+    return XS_SUCCESS;
+}
+
+
+extern int XS_server_conn_stream_send (XS_server_conn sconn, ub8 entryid, const void *head, ub4 headlen, const void *data, ub4 len, int end)
+{
+    int ret = XS_stream_mux_write_msg(&sconn->mux, entryid, head, headlen, data, len, end);
+
+    if (ret < 0) {
+        return (-1);
+    }
+
+    server_conn_wakeup(sconn);
+
+    return (ret > 0 || (headlen + len) == 0)? 1 : 0;
+}
+
+
+extern int XS_server_conn_stream_recv (XS_server_conn sconn, ub8 entryid, ub4 headsize, ub1 *buf, ub4 bufsize, int timeout_ms)
+{
+    int ret;
+
+    struct timeval t0, t1;
+
+    gettimeofday(&t0, 0);
+
+    while ((ret = XS_stream_mux_recv(&sconn->mux, entryid, headsize, buf, bufsize)) == 0) {
+        if (! XS_server_conn_is_ready(sconn)) {
+            return (-1);
+        }
+
+        gettimeofday(&t1, 0);
+
+        if ((t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000 >= timeout_ms) {
+            break;
+        }
+
+        XS_stream_mux_wait(&sconn->mux, XSYNC_REACTOR_TICK_MS);
+    }
+
+    return ret;
+}
+
+
+extern int XS_server_conn_log_batch (XS_server_conn sconn, XSLogBatchEntry_t *entries, const char **pathfiles, ub4 count, ub8 *entryids, int timeout_ms)
+{
+    XSLogBatchReq_t req;
+    XSLogBatchReply_t reply;
+
+    ub8 streamid;
+    ub4 n, len, done = 0;
+    int rc, registered = 0;
+
+    // 请求在一个流窗口之内: 服务端收到完整的消息之后才处理
+    ub1 *buf = (ub1 *) mem_alloc_unset(XSYNC_MUX_STREAM_WINDOW);
+
+    while (done < count) {
+        n = (count - done < XSYNC_LOGBATCH_MAX? count - done : XSYNC_LOGBATCH_MAX);
+
+        len = 0;
+        while (n > 0 && (len = XSLogBatchReqBuild(&req, sconn->session, sconn->clientid,
+                entries + done, pathfiles + done, n, buf, XSYNC_MUX_STREAM_WINDOW)) == 0) {
+            n /= 2;
+        }
+
+        if (! len) {
+            LOGGER_WARN("XLGB: invalid path: %s", pathfiles[done]);
+
+            entryids[done++] = 0;
+            continue;
+        }
+
+        streamid = XS_MUX_REQUEST_STREAM | (ub8) __interlock_add(&sconn->request_counter);
+
+        if (XS_server_conn_stream_open(sconn, streamid) != XS_SUCCESS) {
+            registered = -1;
+            break;
+        }
+
+        rc = XS_server_conn_stream_send(sconn, streamid, buf, len, 0, 0, 1);
+
+        if (rc > 0) {
+            rc = XS_server_conn_stream_recv(sconn, streamid, XS_LOGBATCH_REPLY_SIZE, buf, XSYNC_MUX_STREAM_WINDOW, timeout_ms);
+        }
+
+        XS_server_conn_stream_close(sconn, streamid);
+
+        if (rc <= 0 || ! XSLogBatchReplyParse(buf, &reply, entryids + done) || reply.entries != n) {
+            LOGGER_WARN("XLGB: no valid reply on stream(%ju)", streamid & ~XS_MUX_REQUEST_STREAM);
+
+            registered = -1;
+            break;
+        }
+
+        registered += (int) (n - reply.failed);
+        done += n;
+    }
+
+    mem_free(buf);
+
+    return registered;
+}
+
+
+extern XS_entry_reg XS_server_conn_register (XS_server_conn sconn, const XSLogBatchEntry_t *entry, const char *pathfile)
+{
+    int len = (int) strlen(pathfile);
+
+    xs_entry_reg_t *reg = (xs_entry_reg_t *) mem_alloc_zero(1, sizeof(xs_entry_reg_t) + len + 1);
+
+    // 提交者和队列各一个引用
+    reg->refc = 2;
+
+    memcpy(&reg->entry, entry, sizeof(reg->entry));
+    memcpy(reg->pathfile, pathfile, len + 1);
+
+    pthread_mutex_lock(&sconn->reglock);
+
+    if (sconn->regtail) {
+        sconn->regtail->next = reg;
+    } else {
+        sconn->reghead = reg;
+    }
+    sconn->regtail = reg;
+
+    pthread_mutex_unlock(&sconn->reglock);
+
+    return reg;
+}
+
+
+static int server_conn_reg_compare (const void *a, const void *b)
+{
+    return strcmp((*(const xs_entry_reg_t **) a)->pathfile, (*(const xs_entry_reg_t **) b)->pathfile);
+}
+
+
+/**
+ * 发送取走的注册 (不在锁内): 按路径排序 (前缀压缩), 一个 XLGB
+ */
+static void server_conn_register_flush (XS_server_conn sconn, xs_entry_reg_t **regs, int count, int timeout_ms)
+{
+    int i, registered;
 
-            ub8 rc_read = 0;
+    const char **paths = (const char **) mem_alloc_unset(sizeof(char *) * count);
+    XSLogBatchEntry_t *entries = (XSLogBatchEntry_t *) mem_alloc_unset(sizeof(XSLogBatchEntry_t) * count);
+    ub8 *entryids = (ub8 *) mem_alloc_zero(count, sizeof(ub8));
 
-            XSConnectReq_t xconReq;
-            while(1) {
-                rc_read++;
+    qsort(regs, count, sizeof(regs[0]), server_conn_reg_compare);
 
-                XSConnectRequestBuild(&xconReq, clientid, password, servOpts->magic, xcon->client_utctime, rand_gen(&xcon->rctx), (ub1*) msg);
+    for (i = 0; i < count; i++) {
+        paths[i] = regs[i]->pathfile;
+        memcpy(&entries[i], &regs[i]->entry, sizeof(entries[i]));
+    }
 
-                // 发送连接请求: XS_CONNECT_REQ_SIZE 字节
-                err = sendlen(sockfd, msg, XS_CONNECT_REQ_SIZE);
-                if (err != XS_CONNECT_REQ_SIZE) {
-                    LOGGER_ERROR("sendlen error(%d): %s", errno, strerror(errno));
-                    close(sockfd);
-                    return XS_ERROR;
-                }
+    registered = XS_server_conn_log_batch(sconn, entries, paths, (ub4) count, entryids, timeout_ms);
 
-                LOGGER_DEBUG("%s", XSConnectRequestOutput(&xconReq, password, msg, sizeof(msg)));
+    if (registered < 0) {
+        LOGGER_WARN("XLGB: register %d entries failed", count);
+    } else {
+        LOGGER_DEBUG("XLGB: registered %d/%d entries", registered, count);
 
-                int next = 1;
-                int cbread = 0;
+        for (i = 0; i < count; i++) {
+            regs[i]->entryid = entryids[i];
+        }
+    }
+
+    mem_free(entryids);
+    mem_free(entries);
+    mem_free(paths);
+}
+
+
+extern ub8 XS_server_conn_register_wait (XS_server_conn sconn, XS_entry_reg reg, int timeout_ms)
+{
+    int i, count;
+
+    ub8 entryid;
+
+    xs_entry_reg_t **regs = 0;
+
+    pthread_mutex_lock(&sconn->reglock);
 
-                // 接收
-                while(cbread == 0) {
-                    sleep_ms(10);
+    while (! reg->done) {
+        if (sconn->regflushing) {
+            // 其他线程正在发送: 等待这一批完成
+            pthread_cond_wait(&sconn->regcond, &sconn->reglock);
+            continue;
+        }
+
+        if (! regs) {
+            regs = (xs_entry_reg_t **) mem_alloc_unset(sizeof(xs_entry_reg_t *) * XSYNC_LOGBATCH_COALESCE_MAX);
+        }
 
-                    while (next && (cbread = readlen_next(sockfd, msg, sizeof(msg), &next)) >= 0) {
-                        if (cbread > 0) {
-                            msg[cbread] = 0;
+        // 取走队列: 提交者已经放弃的条目不发送
+        count = 0;
 
-                            LOGGER_DEBUG("[%ju] read: %s", rc_read, msg);
-                        }
-                    }
-                }
+        while (sconn->reghead && count < XSYNC_LOGBATCH_COALESCE_MAX) {
+            xs_entry_reg_t *head = sconn->reghead;
+
+            sconn->reghead = head->next;
+            if (! sconn->reghead) {
+                sconn->regtail = 0;
+            }
 
-                if (cbread < 0) {
-                    LOGGER_ERROR("read (%d)", cbread);
-                    close(sockfd);
-                    sockfd = -1;
-                    break;
-                }
+            head->next = 0;
 
-                sleep_ms(10);
+            if (__interlock_get(&head->refc) == 1) {
+                XS_entry_reg_release(head);
+            } else {
+                regs[count++] = head;
             }
         }
 
-        // 保存当前连接描述符
-        xcon->sockfd = sockfd;
-    } while(0);
+        sconn->regflushing = 1;
 
-    memcpy(xcon->srvopts, servOpts, sizeof(xs_server_opts));
+        pthread_mutex_unlock(&sconn->reglock);
 
-    *outSConn = (XS_server_conn) RefObjectInit(xcon);
+        if (count) {
+            server_conn_register_flush(sconn, regs, count, timeout_ms);
+        }
 
-    return XS_SUCCESS;
+        pthread_mutex_lock(&sconn->reglock);
+
+        for (i = 0; i < count; i++) {
+            regs[i]->done = 1;
+        }
+
+        sconn->regflushing = 0;
+
+        pthread_cond_broadcast(&sconn->regcond);
+
+        for (i = 0; i < count; i++) {
+            // 队列的引用 (提交者仍持有自己的引用或者已经放弃)
+            XS_entry_reg_release(regs[i]);
+        }
+    }
+
+    entryid = reg->entryid;
+
+    pthread_mutex_unlock(&sconn->reglock);
+
+    if (regs) {
+        mem_free(regs);
+    }
+
+    return entryid;
 }
 
 
-extern XS_VOID XS_server_conn_release (XS_server_conn *inSConn)
+extern int XS_server_conn_stream_progress (XS_server_conn sconn, ub8 entryid, ub8 *written, ub8 *acked)
 {
-    LOGGER_TRACE0();
+    return XS_stream_mux_progress(&sconn->mux, entryid, written, acked);
+}
 
-    RefObjectRelease((void**) inSConn, server_conn_delete);
+
+extern XS_VOID XS_server_conn_stream_close (XS_server_conn sconn, ub8 entryid)
+{
+    XS_stream_mux_close(&sconn->mux, entryid);
+
+    server_conn_wakeup(sconn);
 }
@@ -30,7 +30,7 @@
  *
  * @create: 2018-02-12
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 18:10:52
  */
 
 #ifndef SERVER_CONN_H_INCLUDED
@@ -43,6 +43,48 @@ extern "C" {
 #include "server_opts.h"
 
 #include "../xsync-protocol.h"
+#include "../xsync-compress.h"
+
+#include "stream_mux.h"
+
+
+/**
+ * 合并注册 (XLGB) 的一个文件条目. 提交者和注册队列各持有一个引用,
+ *   只剩队列的引用时 (提交者已经放弃) 不再发送
+ */
+typedef struct xs_entry_reg_t
+{
+    struct xs_entry_reg_t *next;
+
+    ref_counter_t refc;
+
+    /* 1: 已经发送并得到应答 (entryid 为 0 表示注册失败). 在 reglock 内设置 */
+    int done;
+
+    ub8 entryid;
+
+    XSLogBatchEntry_t entry;
+
+    char pathfile[0];
+} xs_entry_reg_t, * XS_entry_reg;
+
+
+__no_warning_unused(static)
+inline void XS_entry_reg_release (xs_entry_reg_t *reg)
+{
+    if (reg && __interlock_sub(&reg->refc) == 0) {
+        mem_free(reg);
+    }
+}
+
+
+/**
+ * 连接状态: 只由 conn_reactor 线程修改
+ */
+#define XS_CONN_CLOSED        0
+#define XS_CONN_CONNECTING    1
+#define XS_CONN_HANDSHAKE     2
+#define XS_CONN_READY         3
 
 
 typedef struct xs_server_conn_t
@@ -52,9 +94,76 @@ typedef struct xs_server_conn_t
     /* socket fd connected to xsync-server */
     int sockfd;
 
+    /* XS_CONN_* */
+    volatile int state;
+
     randctx  rctx;
     time_t client_utctime;
 
+    /* XCON 应答中应该返回的魔数: magic ^ randnum */
+    ub4 replymagic;
+
+    /* XCON 应答: 服务端选用的能力 (XS_CAPFLAG_*) 和会话 */
+    ub4 bitflags;
+    ub8 session;
+
+    /* reactor 的 eventfd: 有数据要发送时唤醒 reactor. -1 未加入 reactor */
+    int wakefd;
+
+    /* 1: 已注册 EPOLLOUT */
+    int pollout;
+
+    /* 重连: 当前退避时间和下次连接的时间 */
+    int backoff_ms;
+    ub8 retry_at_ms;
+
+    /* 连接或握手的截止时间 */
+    ub8 deadline_ms;
+
+    /* 最后收发数据的时间: 用于心跳 */
+    ub8 last_recv_ms;
+    ub8 last_send_ms;
+
+    /**
+     * XMUX: 一个客户端到一个服务器只有一个连接, 所有线程共享.
+     *   各线程写入流 (entryid), 由 reactor 线程调度发送
+     */
+    xs_stream_mux_t mux;
+
+    /* 请求流的序号: streamid = XS_MUX_REQUEST_STREAM | 序号 */
+    ref_counter_t request_counter;
+
+    /**
+     * 合并注册: 提交的条目在 reghead 排队. 第一个等待结果的线程取走队列
+     *   (最多 XSYNC_LOGBATCH_COALESCE_MAX 个) 用一个 XLGB 发送, 发送期间
+     *   (regflushing) 其他线程等待 regcond, 新提交的条目进入下一批
+     */
+    pthread_mutex_t reglock;
+    pthread_cond_t regcond;
+    int regflushing;
+    xs_entry_reg_t *reghead;
+    xs_entry_reg_t *regtail;
+
+    /* 控制消息 (XCON, PING) 发送缓冲: 优先于流数据, 但不打断半个帧 */
+    int ctllen;
+    int ctloff;
+    ub1 ctlbuf[XS_CONNECT_REQ_SIZE + XS_MUX_FRAME_HEAD_SIZE * 4];
+
+    /* 接收: XCON 应答或 XMUX 帧头, 然后是 DATA 帧的负载 (rxdata 字节) */
+    int rxlen;
+    ub4 rxdata;
+    ub8 rxstream;
+    ub1 rxhead[XS_CONNECT_ACCEPT_REPLY_SIZE];
+
+    /* 已调度未发完的帧 */
+    int txlen;
+    int txoff;
+    ub1 txbuf[XS_MUX_FRAME_HEAD_SIZE + XSYNC_MUX_FRAME_MAXSIZE];
+
+    /* 重连时需要重新握手 */
+    char clientid[XSYNC_CLIENTID_MAXLEN + 1];
+    char password[XSYNC_PASSWORD_MAXLEN + 1];
+
     xs_server_opts srvopts[0];
 } xs_server_conn_t;
 
@@ -66,7 +175,6 @@ inline void server_conn_delete (void *pv)
 
     LOGGER_TRACE0();
 
-    //TODO:
     int sfd = sconn->sockfd;
 
     if (sfd != -1) {
@@ -74,16 +182,94 @@ inline void server_conn_delete (void *pv)
         close(sfd);
     }
 
+    XS_stream_mux_uninit(&sconn->mux);
+
+    while (sconn->reghead) {
+        xs_entry_reg_t *reg = sconn->reghead;
+
+        sconn->reghead = reg->next;
+        XS_entry_reg_release(reg);
+    }
+
+    pthread_cond_destroy(&sconn->regcond);
+    pthread_mutex_destroy(&sconn->reglock);
+
     mem_free(pv);
 }
 
 
+__no_warning_unused(static)
+inline int XS_server_conn_is_ready (xs_server_conn_t *sconn)
+{
+    return (__interlock_get(&sconn->state) == XS_CONN_READY);
+}
+
+
+/**
+ * 创建连接对象, 不连接服务器. 加入 conn_reactor 之后由 reactor 异步连接
+ */
 extern XS_RESULT XS_server_conn_create ( const xs_server_opts *servOpts, char* clientid, char* password, XS_server_conn *outSConn);
 
 
 extern XS_VOID XS_server_conn_release (XS_server_conn *inSConn);
 
 
+/**
+ * 在共享连接上传输一个文件条目 (entryid) 的数据.
+ *   数据进入流的发送队列后立即返回, 由 reactor 发送. 队列已满时等待;
+ *   连接不可用并且队列已满时立即返回错误, 不阻塞调用线程.
+ */
+extern XS_RESULT XS_server_conn_stream_open (XS_server_conn sconn, ub8 entryid);
+
+extern XS_RESULT XS_server_conn_stream_write (XS_server_conn sconn, ub8 entryid, const void *data, ub4 len, int end);
+
+extern XS_VOID XS_server_conn_stream_close (XS_server_conn sconn, ub8 entryid);
+
+/**
+ * 不等待: 把消息 (head + data) 写入流的发送队列.
+ *   返回 1 成功, 0 队列已满, -1 流不可用 (连接断开或被 RESET)
+ */
+extern int XS_server_conn_stream_send (XS_server_conn sconn, ub8 entryid, const void *head, ub4 headlen, const void *data, ub4 len, int end);
+
+/**
+ * 等待服务端在流上的应答 (headsize + datalen 字节), 最多 timeout_ms 毫秒.
+ *   返回消息字节数, 0 超时, -1 流不可用或者应答无效
+ */
+extern int XS_server_conn_stream_recv (XS_server_conn sconn, ub8 entryid, ub4 headsize, ub1 *buf, ub4 bufsize, int timeout_ms);
+
+/**
+ * 用 XLGB 注册 count 个文件条目, 每批在一个请求流上发送并等待应答
+ *   (最多 timeout_ms 毫秒). 超过一个流窗口的批次被拆分.
+ *   entryids[i] 返回第 i 个条目的 entryid, 注册失败为 0.
+ *
+ * returns:
+ *   注册成功的条目数, -1 连接不可用或者应答无效
+ */
+extern int XS_server_conn_log_batch (XS_server_conn sconn, XSLogBatchEntry_t *entries, const char **pathfiles, ub4 count, ub8 *entryids, int timeout_ms);
+
+/**
+ * XS_server_conn_register
+ *   提交一个条目的注册, 不等待. 返回的注册用 XS_server_conn_register_wait
+ *   取得 entryid, 用完 (或者放弃) 时调用 XS_entry_reg_release
+ */
+extern XS_entry_reg XS_server_conn_register (XS_server_conn sconn, const XSLogBatchEntry_t *entry, const char *pathfile);
+
+/**
+ * XS_server_conn_register_wait
+ *   等待注册的结果. 没有其他线程在发送时, 由调用者把队列中的条目合并为
+ *   一个 XLGB 发送 (最多等待应答 timeout_ms 毫秒).
+ *
+ * returns:
+ *   entryid, 注册失败返回 0
+ */
+extern ub8 XS_server_conn_register_wait (XS_server_conn sconn, XS_entry_reg reg, int timeout_ms);
+
+/**
+ * 取得流上写入和服务端确认的字节. 返回同 XS_stream_mux_progress
+ */
+extern int XS_server_conn_stream_progress (XS_server_conn sconn, ub8 entryid, ub8 *written, ub8 *acked);
+
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,542 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: stream_mux.c
+ *   multiplexed streams over one server connection (XMUX frames)
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-14
+ *
+ * @update: 2018-11-30 16:02:37
+ */
+
+#include "client_api.h"
+
+#include "stream_mux.h"
+
+
+#define mux_stream_hash(streamid)  ((int) ((streamid) & XSYNC_MUX_STREAM_HASHMAX))
+
+
+static xs_mux_stream_t * mux_stream_find (xs_stream_mux_t *mux, ub8 streamid)
+{
+    struct hlist_node *hp;
+
+    hlist_for_each(hp, &mux->stream_hlist[mux_stream_hash(streamid)]) {
+        xs_mux_stream_t *stream = hlist_entry(hp, xs_mux_stream_t, i_hash);
+
+        if (stream->streamid == streamid) {
+            return stream;
+        }
+    }
+
+    return 0;
+}
+
+
+static void mux_stream_clear (xs_mux_stream_t *stream)
+{
+    struct list_head *list, *next;
+
+    list_for_each_safe(list, next, &stream->bufs) {
+        xs_mux_buf_t *buf = list_entry(list, xs_mux_buf_t, i_list);
+
+        list_del(list);
+
+        mem_free(buf);
+    }
+
+    stream->queued = 0;
+}
+
+
+static void mux_stream_free (xs_stream_mux_t *mux, xs_mux_stream_t *stream)
+{
+    if (stream->active) {
+        list_del(&stream->i_active);
+        stream->active = 0;
+    }
+
+    hlist_del(&stream->i_hash);
+    mux->streams--;
+
+    mux_stream_clear(stream);
+
+    if (stream->rxbuf) {
+        mem_free(stream->rxbuf);
+    }
+
+    mem_free(stream);
+}
+
+
+/**
+ * 有数据 (或者待发送的 END) 并且有窗口的流进入活动队列的尾部
+ */
+static void mux_stream_activate (xs_stream_mux_t *mux, xs_mux_stream_t *stream)
+{
+    if (! stream->active && ! stream->reset && ! stream->ended &&
+        ((stream->queued && stream->window > 0) || (stream->closing && ! stream->queued))) {
+        list_add_tail(&stream->i_active, &mux->active);
+        stream->active = 1;
+    }
+}
+
+
+void XS_stream_mux_init (xs_stream_mux_t *mux)
+{
+    int i;
+
+    bzero(mux, sizeof(*mux));
+
+    pthread_mutex_init(&mux->lock, 0);
+    pthread_cond_init(&mux->cond, 0);
+
+    mux->conn_window = XSYNC_MUX_CONN_WINDOW;
+
+    INIT_LIST_HEAD(&mux->active);
+
+    for (i = 0; i <= XSYNC_MUX_STREAM_HASHMAX; i++) {
+        INIT_HLIST_HEAD(&mux->stream_hlist[i]);
+    }
+}
+
+
+void XS_stream_mux_uninit (xs_stream_mux_t *mux)
+{
+    int i;
+
+    struct hlist_node *hp, *hn;
+
+    for (i = 0; i <= XSYNC_MUX_STREAM_HASHMAX; i++) {
+        hlist_for_each_safe(hp, hn, &mux->stream_hlist[i]) {
+            xs_mux_stream_t *stream = hlist_entry(hp, xs_mux_stream_t, i_hash);
+
+            mux_stream_free(mux, stream);
+        }
+    }
+
+    pthread_cond_destroy(&mux->cond);
+    pthread_mutex_destroy(&mux->lock);
+}
+
+
+int XS_stream_mux_open (xs_stream_mux_t *mux, ub8 streamid)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&mux->lock);
+
+    if (! mux_stream_find(mux, streamid)) {
+        xs_mux_stream_t *stream = (xs_mux_stream_t *) mem_alloc_zero(1, sizeof(*stream));
+
+        stream->streamid = streamid;
+        stream->window = XSYNC_MUX_STREAM_WINDOW;
+
+        INIT_LIST_HEAD(&stream->bufs);
+
+        hlist_add_head(&stream->i_hash, &mux->stream_hlist[mux_stream_hash(streamid)]);
+        mux->streams++;
+
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&mux->lock);
+
+    return ret;
+}
+
+
+int XS_stream_mux_write_msg (xs_stream_mux_t *mux, ub8 streamid, const void *head, ub4 headlen, const void *data, ub4 len, int end)
+{
+    int ret;
+
+    ub4 total = headlen + len;
+
+    xs_mux_stream_t *stream;
+
+    pthread_mutex_lock(&mux->lock);
+
+    stream = mux_stream_find(mux, streamid);
+
+    if (! stream || stream->closing || stream->reset) {
+        ret = -1;
+    } else if (total && stream->queued && stream->queued + total > XSYNC_MUX_STREAM_QUEUE_MAX) {
+        // 背压: 允许一次写入超过上限, 但队列非空时必须等待
+        ret = 0;
+    } else {
+        if (total) {
+            xs_mux_buf_t *buf = (xs_mux_buf_t *) mem_alloc_unset(sizeof(*buf) + total);
+
+            buf->offset = 0;
+            buf->length = total;
+
+            if (headlen) {
+                memcpy(buf->data, head, headlen);
+            }
+            if (len) {
+                memcpy(buf->data + headlen, data, len);
+            }
+
+            list_add_tail(&buf->i_list, &stream->bufs);
+            stream->queued += total;
+            stream->written += total;
+        }
+
+        stream->closing = end;
+
+        mux_stream_activate(mux, stream);
+
+        ret = (int) total;
+    }
+
+    pthread_mutex_unlock(&mux->lock);
+
+    return ret;
+}
+
+
+void XS_stream_mux_close (xs_stream_mux_t *mux, ub8 streamid)
+{
+    xs_mux_stream_t *stream;
+
+    pthread_mutex_lock(&mux->lock);
+
+    stream = mux_stream_find(mux, streamid);
+
+    if (stream) {
+        if (stream->reset || stream->ended) {
+            mux_stream_free(mux, stream);
+        } else {
+            stream->closing = 1;
+            stream->detached = 1;
+            mux_stream_activate(mux, stream);
+        }
+    }
+
+    pthread_mutex_unlock(&mux->lock);
+}
+
+
+int XS_stream_mux_progress (xs_stream_mux_t *mux, ub8 streamid, ub8 *written, ub8 *acked)
+{
+    int ret = -1;
+
+    xs_mux_stream_t *stream;
+
+    pthread_mutex_lock(&mux->lock);
+
+    stream = mux_stream_find(mux, streamid);
+
+    if (stream) {
+        *written = stream->written;
+        *acked = stream->acked;
+
+        ret = stream->reset;
+    }
+
+    pthread_mutex_unlock(&mux->lock);
+
+    return ret;
+}
+
+
+/**
+ * 从流的队列中取出 len 字节到 outbuf
+ */
+static void mux_stream_dequeue (xs_mux_stream_t *stream, ub1 *outbuf, ub4 len)
+{
+    while (len > 0) {
+        xs_mux_buf_t *buf = list_entry(stream->bufs.next, xs_mux_buf_t, i_list);
+
+        ub4 cb = buf->length - buf->offset;
+
+        if (cb > len) {
+            cb = len;
+        }
+
+        memcpy(outbuf, buf->data + buf->offset, cb);
+
+        outbuf += cb;
+        len -= cb;
+
+        buf->offset += cb;
+        stream->queued -= cb;
+
+        if (buf->offset == buf->length) {
+            list_del(&buf->i_list);
+            mem_free(buf);
+        }
+    }
+}
+
+
+int XS_stream_mux_schedule (xs_stream_mux_t *mux, ub1 *outbuf, int outsize)
+{
+    XSMuxFrame_t frame;
+
+    int total = 0;
+
+    pthread_mutex_lock(&mux->lock);
+
+    while (! list_empty(&mux->active) && outsize - total > XS_MUX_FRAME_HEAD_SIZE) {
+        xs_mux_stream_t *stream = list_entry(mux->active.next, xs_mux_stream_t, i_active);
+
+        sb8 cb = (sb8) stream->queued;
+
+        ub1 flags = 0;
+
+        if (cb > stream->window) {
+            cb = stream->window;
+        }
+        if (cb > mux->conn_window) {
+            cb = mux->conn_window;
+        }
+        if (cb > XSYNC_MUX_QUANTUM) {
+            cb = XSYNC_MUX_QUANTUM;
+        }
+        if (cb > outsize - total - XS_MUX_FRAME_HEAD_SIZE) {
+            cb = outsize - total - XS_MUX_FRAME_HEAD_SIZE;
+        }
+
+        if (cb == 0 && stream->queued) {
+            if (mux->conn_window <= 0) {
+                // 连接窗口用完: 所有流都要等待 WINDOW 帧
+                break;
+            }
+
+            // 流窗口用完: 移出活动队列, 等待 WINDOW 帧
+            list_del(&stream->i_active);
+            stream->active = 0;
+            continue;
+        }
+
+        if (stream->closing && (ub8) cb == stream->queued) {
+            flags |= XS_MUX_FLAG_END;
+        }
+
+        XSMuxFrameBuild(&frame, stream->streamid, XS_MUX_FRAME_DATA, flags, 0, (ub4) cb, outbuf + total);
+
+        mux_stream_dequeue(stream, outbuf + total + XS_MUX_FRAME_HEAD_SIZE, (ub4) cb);
+
+        total += XS_MUX_FRAME_HEAD_SIZE + (int) cb;
+
+        stream->window -= cb;
+        mux->conn_window -= cb;
+
+        if (flags & XS_MUX_FLAG_END) {
+            if (stream->detached) {
+                mux_stream_free(mux, stream);
+            } else {
+                // 所有者关闭之前保留流, 以便取得确认的进度
+                list_del(&stream->i_active);
+                stream->active = 0;
+                stream->ended = 1;
+            }
+        } else {
+            // 轮转到队列尾部
+            list_del(&stream->i_active);
+            stream->active = 0;
+
+            mux_stream_activate(mux, stream);
+        }
+    }
+
+    if (total) {
+        pthread_cond_broadcast(&mux->cond);
+    }
+
+    pthread_mutex_unlock(&mux->lock);
+
+    return total;
+}
+
+
+void XS_stream_mux_on_frame (xs_stream_mux_t *mux, const XSMuxFrame_t *frame)
+{
+    xs_mux_stream_t *stream;
+
+    pthread_mutex_lock(&mux->lock);
+
+    if (frame->type == XS_MUX_FRAME_WINDOW) {
+        if (frame->streamid == 0) {
+            mux->conn_window += frame->window;
+        } else {
+            stream = mux_stream_find(mux, frame->streamid);
+
+            if (stream) {
+                stream->window += frame->window;
+                stream->acked += frame->window;
+                mux_stream_activate(mux, stream);
+            }
+        }
+    } else if (frame->type == XS_MUX_FRAME_RESET) {
+        stream = mux_stream_find(mux, frame->streamid);
+
+        if (stream) {
+            LOGGER_WARN("stream(%ju) reset by server: drop %ju bytes", stream->streamid, stream->queued);
+
+            if (stream->active) {
+                list_del(&stream->i_active);
+                stream->active = 0;
+            }
+
+            stream->reset = 1;
+            mux_stream_clear(stream);
+
+            if (stream->detached) {
+                mux_stream_free(mux, stream);
+            }
+        }
+    }
+
+    pthread_cond_broadcast(&mux->cond);
+
+    pthread_mutex_unlock(&mux->lock);
+}
+
+
+void XS_stream_mux_on_data (xs_stream_mux_t *mux, ub8 streamid, const void *data, ub4 len)
+{
+    xs_mux_stream_t *stream;
+
+    pthread_mutex_lock(&mux->lock);
+
+    stream = mux_stream_find(mux, streamid);
+
+    if (! stream || stream->reset || stream->rxlen + len > XSYNC_MUX_STREAM_QUEUE_MAX) {
+        LOGGER_WARN("stream(%ju): drop %u bytes from server", streamid, len);
+    } else {
+        if (stream->rxlen + len > stream->rxsize) {
+            stream->rxsize = (stream->rxlen + len) * 2;
+
+            stream->rxbuf = (ub1 *) mem_realloc(stream->rxbuf, stream->rxsize);
+        }
+
+        memcpy(stream->rxbuf + stream->rxlen, data, len);
+        stream->rxlen += len;
+
+        pthread_cond_broadcast(&mux->cond);
+    }
+
+    pthread_mutex_unlock(&mux->lock);
+}
+
+
+int XS_stream_mux_recv (xs_stream_mux_t *mux, ub8 streamid, ub4 headsize, ub1 *buf, ub4 bufsize)
+{
+    int ret = 0;
+
+    ub4 msglen;
+
+    xs_mux_stream_t *stream;
+
+    pthread_mutex_lock(&mux->lock);
+
+    stream = mux_stream_find(mux, streamid);
+
+    if (! stream || stream->reset) {
+        ret = -1;
+    } else if (stream->rxlen >= headsize && headsize >= 8) {
+        msglen = headsize + (ub4) BO_bytes_betoh_i32(stream->rxbuf + 4);
+
+        if (msglen > bufsize) {
+            LOGGER_ERROR("stream(%ju): reply too large (%u bytes)", streamid, msglen);
+            ret = -1;
+        } else if (stream->rxlen >= msglen) {
+            memcpy(buf, stream->rxbuf, msglen);
+
+            stream->rxlen -= msglen;
+            if (stream->rxlen) {
+                memmove(stream->rxbuf, stream->rxbuf + msglen, stream->rxlen);
+            }
+
+            ret = (int) msglen;
+        }
+    }
+
+    pthread_mutex_unlock(&mux->lock);
+
+    return ret;
+}
+
+
+void XS_stream_mux_reset_all (xs_stream_mux_t *mux)
+{
+    int i;
+
+    struct hlist_node *hp, *hn;
+
+    pthread_mutex_lock(&mux->lock);
+
+    for (i = 0; i <= XSYNC_MUX_STREAM_HASHMAX; i++) {
+        hlist_for_each_safe(hp, hn, &mux->stream_hlist[i]) {
+            xs_mux_stream_t *stream = hlist_entry(hp, xs_mux_stream_t, i_hash);
+
+            if (stream->detached) {
+                mux_stream_free(mux, stream);
+            } else {
+                if (stream->active) {
+                    list_del(&stream->i_active);
+                    stream->active = 0;
+                }
+
+                stream->reset = 1;
+                stream->window = XSYNC_MUX_STREAM_WINDOW;
+
+                mux_stream_clear(stream);
+            }
+        }
+    }
+
+    mux->conn_window = XSYNC_MUX_CONN_WINDOW;
+
+    pthread_cond_broadcast(&mux->cond);
+
+    pthread_mutex_unlock(&mux->lock);
+}
+
+
+void XS_stream_mux_wait (xs_stream_mux_t *mux, int timeout_ms)
+{
+    struct timespec abstime;
+
+    clock_gettime(CLOCK_REALTIME, &abstime);
+
+    abstime.tv_sec += timeout_ms / 1000;
+    abstime.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+
+    if (abstime.tv_nsec >= 1000000000L) {
+        abstime.tv_sec++;
+        abstime.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&mux->lock);
+
+    pthread_cond_timedwait(&mux->cond, &mux->lock, &abstime);
+
+    pthread_mutex_unlock(&mux->lock);
+}
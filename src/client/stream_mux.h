@@ -0,0 +1,209 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: stream_mux.h
+ *   multiplexed streams over one server connection (XMUX frames)
+ *
+ *   所有线程共享一个到服务器的连接. 每个文件条目 (entryid) 是一个流,
+ *   流各自有发送窗口; 有数据可发的流排在活动队列中, 轮询调度, 每轮每流
+ *   最多发送 XSYNC_MUX_QUANTUM 字节. 小文件不会排在大文件后面.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-14
+ *
+ * @update: 2018-11-30 16:02:37
+ */
+
+#ifndef STREAM_MUX_H_INCLUDED
+#define STREAM_MUX_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+#include "../xsync-protocol.h"
+
+#include "../common/common_util.h"
+#include "../common/dhlist.h"
+
+
+/**
+ * 流上排队待发送的数据
+ */
+typedef struct xs_mux_buf_t
+{
+    struct list_head i_list;
+
+    ub4 offset;
+    ub4 length;
+
+    ub1 data[0];
+} xs_mux_buf_t;
+
+
+typedef struct xs_mux_stream_t
+{
+    /* 在 stream_hlist 中 */
+    struct hlist_node i_hash;
+
+    /* 在 active 队列中 (有数据并且有窗口) */
+    struct list_head i_active;
+
+    /* xs_mux_buf_t 队列 */
+    struct list_head bufs;
+
+    ub8 streamid;
+
+    /* 剩余的发送窗口字节 */
+    sb8 window;
+
+    /* 排队未发送的字节 */
+    ub8 queued;
+
+    /* 写入流的全部字节和服务端确认 (WINDOW) 的字节 */
+    ub8 written;
+    ub8 acked;
+
+    int active;
+
+    /* 1: 已写入最后的数据, 数据发完后发送 END 帧 */
+    int closing;
+
+    /* 1: END 帧已经发送 */
+    int ended;
+
+    /* 1: 所有者已经关闭流, END 帧发送之后释放 */
+    int detached;
+
+    /* 1: 被服务端 RESET 或者连接断开 */
+    int reset;
+
+    /* 服务端在流上的应答 (XCHK/XLGB): DATA 帧的负载, 由所有者取出 */
+    ub4 rxlen;
+    ub4 rxsize;
+    ub1 *rxbuf;
+} xs_mux_stream_t;
+
+
+typedef struct xs_stream_mux_t
+{
+    pthread_mutex_t lock;
+
+    /* 发送了数据或者窗口增加时广播 */
+    pthread_cond_t cond;
+
+    /* 剩余的连接发送窗口字节 */
+    sb8 conn_window;
+
+    ub4 streams;
+
+    struct list_head active;
+
+    struct hlist_head stream_hlist[XSYNC_MUX_STREAM_HASHMAX + 1];
+} xs_stream_mux_t;
+
+
+extern void XS_stream_mux_init (xs_stream_mux_t *mux);
+
+extern void XS_stream_mux_uninit (xs_stream_mux_t *mux);
+
+/**
+ * 打开流. 返回 0 成功, -1 流已经存在
+ */
+extern int XS_stream_mux_open (xs_stream_mux_t *mux, ub8 streamid);
+
+/**
+ * 复制一个消息 (head + data) 到流的发送队列. 消息要么全部进入队列, 要么不进入.
+ *   end = 1 表示这是流上最后的数据, 发完之后发送 END 帧.
+ *
+ * 返回:
+ *   headlen + len  - 成功
+ *   0              - 队列已满 (XSYNC_MUX_STREAM_QUEUE_MAX), 等待发送之后重试
+ *   -1             - 流不存在, 已结束或被 RESET
+ */
+extern int XS_stream_mux_write_msg (xs_stream_mux_t *mux, ub8 streamid, const void *head, ub4 headlen, const void *data, ub4 len, int end);
+
+#define XS_stream_mux_write(mux, streamid, data, len, end)  \
+    XS_stream_mux_write_msg((mux), (streamid), 0, 0, (data), (len), (end))
+
+/**
+ * 关闭流: 释放所有者的流. 没有发送 END 的流在数据发完之后发送 END 再释放.
+ *   已经结束或被 RESET 的流立即释放.
+ */
+extern void XS_stream_mux_close (xs_stream_mux_t *mux, ub8 streamid);
+
+/**
+ * 取得流的进度: 写入的字节和服务端确认的字节.
+ *   返回 0 成功, 1 流被 RESET, -1 流不存在
+ */
+extern int XS_stream_mux_progress (xs_stream_mux_t *mux, ub8 streamid, ub8 *written, ub8 *acked);
+
+/**
+ * 轮询调度活动的流, 把 DATA 帧写入 outbuf (可能包含多个流的帧).
+ *   返回写入的字节数, 0 表示没有可发送的数据 (或者没有窗口).
+ *   outsize 至少为 XS_MUX_FRAME_HEAD_SIZE + 1
+ */
+extern int XS_stream_mux_schedule (xs_stream_mux_t *mux, ub1 *outbuf, int outsize);
+
+/**
+ * 处理服务端发来的 WINDOW/RESET 帧
+ */
+extern void XS_stream_mux_on_frame (xs_stream_mux_t *mux, const XSMuxFrame_t *frame);
+
+/**
+ * 服务端在流上发来的 DATA 负载追加到流的接收缓冲.
+ *   流不存在或者接收缓冲超过 XSYNC_MUX_STREAM_QUEUE_MAX 时丢弃
+ */
+extern void XS_stream_mux_on_data (xs_stream_mux_t *mux, ub8 streamid, const void *data, ub4 len);
+
+/**
+ * 从流的接收缓冲取出一个完整的应答消息 (headsize + datalen 字节) 到 buf, 不等待.
+ *   返回:
+ *     消息字节数  - 成功
+ *     0           - 消息还不完整
+ *     -1          - 流不存在或被 RESET, 或者消息超过 bufsize
+ */
+extern int XS_stream_mux_recv (xs_stream_mux_t *mux, ub8 streamid, ub4 headsize, ub1 *buf, ub4 bufsize);
+
+/**
+ * 连接断开: 所有流被 RESET (未发送的数据丢弃), 窗口恢复初始值.
+ *   已经关闭 (detached) 的流被释放
+ */
+extern void XS_stream_mux_reset_all (xs_stream_mux_t *mux);
+
+/**
+ * 等待发送或窗口变化, 最多 timeout_ms 毫秒
+ */
+extern void XS_stream_mux_wait (xs_stream_mux_t *mux, int timeout_ms);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* STREAM_MUX_H_INCLUDED */
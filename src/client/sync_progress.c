@@ -0,0 +1,429 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: sync_progress.c
+ *   durable per-(entry, server) sync progress (see "sync_progress.h")
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-30
+ *
+ * @update: 2018-11-30 18:10:52
+ */
+
+#include "client_api.h"
+
+#include "sync_progress.h"
+
+#include "../common/rbtree.h"
+
+#include <sys/time.h>
+
+
+#define SYNP_MAGIC           "XSSYNP01"
+#define SYNP_MAGIC_LEN       8
+
+
+typedef struct synp_record_t
+{
+    int32_t sid;
+    int32_t pad;
+
+    uint64_t entryid;
+    uint64_t offset;
+    uint64_t filesize;
+    uint64_t modtime;
+} synp_record_t;
+
+
+typedef struct synp_key_t
+{
+    int32_t sid;
+    uint64_t entryid;
+} synp_key_t;
+
+
+/* 条目的确认偏移: 节点按 (sid, entryid) 排序 */
+typedef struct synp_entry_t
+{
+    struct rb_node rbnode;
+
+    synp_record_t rec;
+} synp_entry_t;
+
+
+typedef struct xs_sync_progress_t
+{
+    /* 保护全部成员和日志文件的写入 */
+    thread_lock_t lock;
+
+    int fd;
+
+    /* 日志文件的长度 */
+    int64_t size;
+
+    /* 上次落盘的时间 */
+    uint64_t synced_us;
+
+    struct rb_root entries;
+    int64_t nentries;
+
+    char journal[PATH_MAX];
+} xs_sync_progress_t;
+
+
+static inline int synp_entry_cmp (const synp_key_t *key, const synp_entry_t *entry)
+{
+    if (key->sid != entry->rec.sid) {
+        return (key->sid < entry->rec.sid? -1 : 1);
+    }
+
+    return (key->entryid < entry->rec.entryid? -1 : (key->entryid > entry->rec.entryid? 1 : 0));
+}
+
+RB_TREE_DEFINE(synp_entry_tree, synp_entry_t, rbnode, synp_key_t, synp_entry_cmp)
+
+
+static inline uint64_t synp_now_us (void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+
+    return (uint64_t) tv.tv_sec * 1000000 + (uint64_t) tv.tv_usec;
+}
+
+
+static int synp_write_all (int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (-1);
+        }
+
+        buf += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+
+/* 在 sp->lock 内调用: 记录代替条目原来的确认偏移 */
+static void synp_entry_update (xs_sync_progress_t *sp, const synp_record_t *rec)
+{
+    synp_key_t key;
+    synp_entry_t *entry;
+
+    struct rb_node *parent;
+    struct rb_node **link;
+
+    key.sid = rec->sid;
+    key.entryid = rec->entryid;
+
+    entry = synp_entry_tree_lookup(&sp->entries, &key, &parent, &link);
+
+    if (! entry) {
+        entry = (synp_entry_t *) mem_alloc_zero(1, sizeof(synp_entry_t));
+
+        synp_entry_tree_link(&sp->entries, entry, parent, link);
+
+        sp->nentries++;
+    }
+
+    memcpy(&entry->rec, rec, sizeof(*rec));
+}
+
+
+/**
+ * 在 sp->lock 内调用: 每个条目写入一个记录到新的日志文件, 替换原来的日志
+ */
+static int synp_compact (xs_sync_progress_t *sp)
+{
+    int fd;
+
+    char tmpfile[PATH_MAX + 8];
+
+    synp_entry_t *entry;
+
+    int64_t size = SYNP_MAGIC_LEN;
+
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", sp->journal);
+
+    fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        LOGGER_ERROR("open fail(%d): %s (%s)", errno, strerror(errno), tmpfile);
+        return (-1);
+    }
+
+    if (synp_write_all(fd, SYNP_MAGIC, SYNP_MAGIC_LEN) != 0) {
+        goto error_exit;
+    }
+
+    for (entry = synp_entry_tree_first(&sp->entries); entry; entry = synp_entry_tree_next(entry)) {
+        if (synp_write_all(fd, (const char *) &entry->rec, sizeof(entry->rec)) != 0) {
+            goto error_exit;
+        }
+
+        size += sizeof(entry->rec);
+    }
+
+    if (fdatasync(fd) != 0 || rename(tmpfile, sp->journal) != 0) {
+        goto error_exit;
+    }
+
+    close(sp->fd);
+
+    sp->fd = fd;
+    sp->size = size;
+    sp->synced_us = synp_now_us();
+
+    LOGGER_INFO("sync progress compacted: entries=%"PRId64" size=%"PRId64" (%s)", sp->nentries, size, sp->journal);
+
+    return 0;
+
+error_exit:
+    LOGGER_ERROR("compact fail(%d): %s (%s)", errno, strerror(errno), tmpfile);
+
+    close(fd);
+    unlink(tmpfile);
+
+    return (-1);
+}
+
+
+/* 读入日志: 重建全部条目的确认偏移. 写了一半的尾部记录被截掉 */
+static int synp_load (xs_sync_progress_t *sp)
+{
+    char *buf;
+    int64_t off;
+
+    struct stat sb;
+
+    if (fstat(sp->fd, &sb) != 0) {
+        LOGGER_ERROR("fstat fail(%d): %s (%s)", errno, strerror(errno), sp->journal);
+        return (-1);
+    }
+
+    if (sb.st_size == 0) {
+        if (synp_write_all(sp->fd, SYNP_MAGIC, SYNP_MAGIC_LEN) != 0) {
+            LOGGER_ERROR("write fail(%d): %s (%s)", errno, strerror(errno), sp->journal);
+            return (-1);
+        }
+
+        sp->size = SYNP_MAGIC_LEN;
+        return 0;
+    }
+
+    buf = (char *) mem_alloc_zero(1, (size_t) sb.st_size);
+
+    if (pread(sp->fd, buf, (size_t) sb.st_size, 0) != (ssize_t) sb.st_size) {
+        LOGGER_ERROR("read fail(%d): %s (%s)", errno, strerror(errno), sp->journal);
+        mem_free(buf);
+        return (-1);
+    }
+
+    if (sb.st_size < SYNP_MAGIC_LEN || memcmp(buf, SYNP_MAGIC, SYNP_MAGIC_LEN)) {
+        LOGGER_ERROR("not a sync progress file: %s", sp->journal);
+        mem_free(buf);
+        return (-1);
+    }
+
+    for (off = SYNP_MAGIC_LEN; off + (int64_t) sizeof(synp_record_t) <= sb.st_size; off += sizeof(synp_record_t)) {
+        synp_record_t rec;
+
+        memcpy(&rec, buf + off, sizeof(rec));
+
+        synp_entry_update(sp, &rec);
+    }
+
+    mem_free(buf);
+
+    if (off < sb.st_size) {
+        LOGGER_WARN("sync progress truncated at %"PRId64" (size=%"PRId64"): %s", off, (int64_t) sb.st_size, sp->journal);
+
+        if (ftruncate(sp->fd, off) != 0) {
+            LOGGER_ERROR("ftruncate fail(%d): %s (%s)", errno, strerror(errno), sp->journal);
+            return (-1);
+        }
+    }
+
+    sp->size = off;
+
+    return 0;
+}
+
+
+extern XS_RESULT XS_sync_progress_open (const char *journal, XS_sync_progress *outsp)
+{
+    xs_sync_progress_t *sp;
+
+    *outsp = 0;
+
+    if (strlen(journal) >= PATH_MAX) {
+        LOGGER_ERROR("journal path too long: %s", journal);
+        return XS_ERROR;
+    }
+
+    sp = (xs_sync_progress_t *) mem_alloc_zero(1, sizeof(xs_sync_progress_t));
+
+    strcpy(sp->journal, journal);
+
+    rb_root_init(&sp->entries);
+
+    sp->fd = open(journal, O_RDWR | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if (sp->fd == -1) {
+        LOGGER_ERROR("open fail(%d): %s (%s)", errno, strerror(errno), journal);
+        mem_free(sp);
+        return XS_ERROR;
+    }
+
+    if (threadlock_init(&sp->lock) != 0) {
+        LOGGER_ERROR("threadlock_init fail");
+        close(sp->fd);
+        mem_free(sp);
+        return XS_ERROR;
+    }
+
+    if (synp_load(sp) != 0) {
+        XS_sync_progress_close(sp);
+        return XS_ERROR;
+    }
+
+    sp->synced_us = synp_now_us();
+
+    LOGGER_INFO("sync progress opened: entries=%"PRId64" (%s)", sp->nentries, journal);
+
+    *outsp = sp;
+
+    return XS_SUCCESS;
+}
+
+
+extern void XS_sync_progress_close (XS_sync_progress sp)
+{
+    synp_entry_t *entry;
+
+    if (sp->fd != -1) {
+        fdatasync(sp->fd);
+        close(sp->fd);
+        sp->fd = -1;
+    }
+
+    while ((entry = synp_entry_tree_first(&sp->entries)) != 0) {
+        synp_entry_tree_erase(&sp->entries, entry);
+        mem_free(entry);
+    }
+
+    threadlock_destroy(&sp->lock);
+
+    mem_free(sp);
+}
+
+
+extern int XS_sync_progress_get (XS_sync_progress sp, int sid, uint64_t entryid, uint64_t filesize, uint64_t modtime, uint64_t *offset)
+{
+    int ret = 0;
+
+    synp_key_t key;
+    synp_entry_t *entry;
+
+    key.sid = sid;
+    key.entryid = entryid;
+
+    *offset = 0;
+
+    threadlock_lock(&sp->lock);
+
+    entry = synp_entry_tree_find(&sp->entries, &key);
+
+    if (entry && entry->rec.modtime == modtime && entry->rec.filesize <= filesize && entry->rec.offset <= entry->rec.filesize) {
+        *offset = entry->rec.offset;
+        ret = 1;
+    }
+
+    threadlock_unlock(&sp->lock);
+
+    return ret;
+}
+
+
+extern void XS_sync_progress_set (XS_sync_progress sp, int sid, uint64_t entryid, uint64_t offset, uint64_t filesize, uint64_t modtime)
+{
+    uint64_t now;
+
+    synp_record_t rec;
+
+    bzero(&rec, sizeof(rec));
+
+    rec.sid = sid;
+    rec.entryid = entryid;
+    rec.offset = offset;
+    rec.filesize = filesize;
+    rec.modtime = modtime;
+
+    threadlock_lock(&sp->lock);
+
+    synp_entry_update(sp, &rec);
+
+    if (synp_write_all(sp->fd, (const char *) &rec, sizeof(rec)) != 0) {
+        LOGGER_ERROR("write fail(%d): %s (%s)", errno, strerror(errno), sp->journal);
+    } else {
+        sp->size += sizeof(rec);
+
+        now = synp_now_us();
+
+        if (now - sp->synced_us >= (uint64_t) XSYNC_SYNC_PROGRESS_SYNC_MS * 1000) {
+            fdatasync(sp->fd);
+            sp->synced_us = now;
+        }
+
+        if (sp->size > XSYNC_SYNC_PROGRESS_MAXSIZE &&
+            sp->size > SYNP_MAGIC_LEN + sp->nentries * (int64_t) sizeof(rec) * 2) {
+            synp_compact(sp);
+        }
+    }
+
+    threadlock_unlock(&sp->lock);
+}
+
+
+extern int64_t XS_sync_progress_entries (XS_sync_progress sp)
+{
+    int64_t n;
+
+    threadlock_lock(&sp->lock);
+    n = sp->nentries;
+    threadlock_unlock(&sp->lock);
+
+    return n;
+}
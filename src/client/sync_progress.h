@@ -0,0 +1,103 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: sync_progress.h
+ *   durable per-(entry, server) sync progress
+ *
+ *   文件同步到每个服务器时, 服务端确认 (fdatasync 之后) 的文件偏移写入
+ *   日志文件. 文件下一次同步 (事件, 扫描或者进程重启之后) 从这个偏移
+ *   继续, 不必重新发送已经确认的数据. 文件在记录之后修改过 (modtime
+ *   不同或者变短) 时从头开始.
+ *
+ *   日志文件格式:
+ *     [magic:8][记录...]
+ *     记录: [sid:4][pad:4][entryid:8][offset:8][filesize:8][modtime:8]
+ *
+ *   同一个 (sid, entryid) 后面的记录代替前面的记录. 日志超过
+ *   XSYNC_SYNC_PROGRESS_MAXSIZE 时压缩为每个条目一个记录. 崩溃时写了
+ *   一半的尾部记录在打开时截掉.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-30
+ *
+ * @update: 2018-11-30 18:10:52
+ */
+
+#ifndef SYNC_PROGRESS_H_INCLUDED
+#define SYNC_PROGRESS_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+
+#include <stdint.h>
+
+
+typedef struct xs_sync_progress_t * XS_sync_progress;
+
+
+/**
+ * XS_sync_progress_open
+ *   打开 (不存在时创建) 日志文件, 读入全部条目的确认偏移
+ */
+extern XS_RESULT XS_sync_progress_open (const char *journal, XS_sync_progress *outsp);
+
+
+extern void XS_sync_progress_close (XS_sync_progress sp);
+
+
+/**
+ * XS_sync_progress_get
+ *   取得条目在服务器 sid 上确认的偏移 (线程安全).
+ *
+ * returns:
+ *   1 - 有记录并且文件没有修改过, *offset 为确认的偏移
+ *   0 - 没有记录或者文件修改过, *offset = 0
+ */
+extern int XS_sync_progress_get (XS_sync_progress sp, int sid, uint64_t entryid, uint64_t filesize, uint64_t modtime, uint64_t *offset);
+
+
+/**
+ * XS_sync_progress_set
+ *   记录条目在服务器 sid 上确认的偏移 (线程安全)
+ */
+extern void XS_sync_progress_set (XS_sync_progress sp, int sid, uint64_t entryid, uint64_t offset, uint64_t filesize, uint64_t modtime);
+
+
+/**
+ * XS_sync_progress_entries
+ *   有记录的 (entry, sid) 数目
+ */
+extern int64_t XS_sync_progress_entries (XS_sync_progress sp);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* SYNC_PROGRESS_H_INCLUDED */
@@ -0,0 +1,563 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: watch_crawl.c
+ *   启动时并行遍历监视目录 (see "watch_crawl.h")
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-30
+ *
+ * @update: 2018-11-30 10:12:26
+ */
+
+#include "client_api.h"
+
+#include "watch_crawl.h"
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+
+/* 每块路径内存的字节数, 必须大于 PATH_MAX */
+#define WATCH_CRAWL_ARENA_SIZE     65536
+
+/* 一次 getdents64 读取的字节数 */
+#define WATCH_CRAWL_DENTS_SIZE     65536
+
+/* 从共享队列一次取出的目录数 */
+#define WATCH_CRAWL_TAKE_MAXNUM    64
+
+#define WATCH_CRAWL_THREADS_MAX    64
+
+
+/* 内核的 linux_dirent64 */
+typedef struct crawl_dirent64_t
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[0];
+} crawl_dirent64_t;
+
+
+typedef struct crawl_arena_t
+{
+    struct crawl_arena_t *next;
+
+    int used;
+
+    char data[WATCH_CRAWL_ARENA_SIZE];
+} crawl_arena_t;
+
+
+/* 路径数组: 路径本身在分片的 arena 中 */
+typedef struct crawl_paths_t
+{
+    char **paths;
+
+    int count;
+    int capacity;
+} crawl_paths_t;
+
+
+/* 线程分片: 只有所属线程访问, 合并时不需要加锁 */
+typedef struct crawl_shard_t
+{
+    struct xs_watch_crawl_t *crawl;
+
+    pthread_t thread;
+
+    /* 发现的目录 */
+    crawl_paths_t dirs;
+
+    /* 等待遍历的目录 (栈) */
+    crawl_paths_t stack;
+
+    crawl_arena_t *arena;
+
+    int errors;
+
+    char dents[WATCH_CRAWL_DENTS_SIZE] __attribute__((aligned(8)));
+} crawl_shard_t;
+
+
+typedef struct xs_watch_crawl_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t notify;
+
+    /* 遍历线程数 (含调用线程) */
+    int threads;
+
+    /* 等待中的线程数. 全部线程等待并且队列为空时遍历结束.
+     *   在锁内修改, 遍历线程不加锁读取
+     */
+    ref_counter_t idle;
+    int done;
+
+    int started;
+
+    /* 共享队列: 空闲线程从这里取目录 */
+    crawl_paths_t queue;
+
+    /* 根目录 */
+    crawl_paths_t roots;
+    crawl_arena_t *arena;
+
+    crawl_shard_t *shards[WATCH_CRAWL_THREADS_MAX];
+} xs_watch_crawl_t;
+
+
+static char * crawl_arena_alloc (crawl_arena_t **arena, int size)
+{
+    char *p;
+
+    crawl_arena_t *a = *arena;
+
+    if (! a || a->used + size > WATCH_CRAWL_ARENA_SIZE) {
+        a = (crawl_arena_t *) mem_alloc_unset(sizeof(crawl_arena_t));
+
+        a->next = *arena;
+        a->used = 0;
+
+        *arena = a;
+    }
+
+    p = a->data + a->used;
+    a->used += size;
+
+    return p;
+}
+
+
+static void crawl_arena_free (crawl_arena_t *arena)
+{
+    crawl_arena_t *next;
+
+    for (; arena; arena = next) {
+        next = arena->next;
+        mem_free(arena);
+    }
+}
+
+
+static inline void crawl_paths_push (crawl_paths_t *a, char *path)
+{
+    if (a->count == a->capacity) {
+        a->capacity = (a->capacity? a->capacity * 2 : 1024);
+        a->paths = (char **) mem_realloc(a->paths, sizeof(char *) * a->capacity);
+    }
+
+    a->paths[a->count++] = path;
+}
+
+
+static inline void crawl_paths_free (crawl_paths_t *a)
+{
+    if (a->paths) {
+        mem_free(a->paths);
+    }
+
+    a->paths = 0;
+    a->count = a->capacity = 0;
+}
+
+
+/**
+ * 读一个目录, 子目录记录到分片并且压入本线程的栈.
+ *   dirpath 以 '/' 结尾
+ */
+static void crawl_read_dir (crawl_shard_t *shard, const char *dirpath)
+{
+    int fd, len, namelen, off;
+    long n;
+
+    char *subdir;
+    crawl_dirent64_t *ent;
+    unsigned char type;
+
+    struct stat sbuf;
+
+    fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        // 遍历过程中删除的目录和没有权限的目录被忽略
+        if (errno != ENOENT && errno != EACCES && errno != ELOOP && errno != ENOTDIR) {
+            LOGGER_WARN("open dir error(%d): %s (%s)", errno, strerror(errno), dirpath);
+            shard->errors++;
+        }
+        return;
+    }
+
+    len = (int) strlen(dirpath);
+
+    while ((n = syscall(SYS_getdents64, fd, shard->dents, sizeof(shard->dents))) > 0) {
+        for (off = 0; off < n; off += ent->d_reclen) {
+            ent = (crawl_dirent64_t *) (shard->dents + off);
+
+            if (ent->d_name[0] == '.' && (! ent->d_name[1] || (ent->d_name[1] == '.' && ! ent->d_name[2]))) {
+                continue;
+            }
+
+            type = ent->d_type;
+
+            if (type == DT_UNKNOWN) {
+                // 文件系统不支持 d_type 时才 lstat
+                if (fstatat(fd, ent->d_name, &sbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+                    continue;
+                }
+
+                type = (S_ISDIR(sbuf.st_mode)? DT_DIR : DT_REG);
+            }
+
+            if (type != DT_DIR) {
+                continue;
+            }
+
+            namelen = (int) strlen(ent->d_name);
+
+            if (len + namelen + 1 >= PATH_MAX) {
+                LOGGER_WARN("path too long: %s%s", dirpath, ent->d_name);
+                continue;
+            }
+
+            // 目录名必须以 '/' 结尾
+            subdir = crawl_arena_alloc(&shard->arena, len + namelen + 2);
+
+            memcpy(subdir, dirpath, len);
+            memcpy(subdir + len, ent->d_name, namelen);
+            subdir[len + namelen] = '/';
+            subdir[len + namelen + 1] = '\0';
+
+            crawl_paths_push(&shard->dirs, subdir);
+            crawl_paths_push(&shard->stack, subdir);
+        }
+    }
+
+    if (n < 0) {
+        LOGGER_WARN("getdents64 error(%d): %s (%s)", errno, strerror(errno), dirpath);
+        shard->errors++;
+    }
+
+    close(fd);
+}
+
+
+/**
+ * 从共享队列取目录到本线程的栈. 全部线程空闲并且队列为空时返回 0
+ */
+static int crawl_take_work (crawl_shard_t *shard)
+{
+    int num = 0;
+
+    xs_watch_crawl_t *crawl = shard->crawl;
+
+    pthread_mutex_lock(&crawl->lock);
+
+    while (! crawl->queue.count && ! crawl->done) {
+        if (__interlock_add(&crawl->idle) == crawl->threads) {
+            // 没有线程在遍历, 也不会再有目录加入队列
+            crawl->done = 1;
+            __interlock_sub(&crawl->idle);
+
+            pthread_cond_broadcast(&crawl->notify);
+            break;
+        }
+
+        pthread_cond_wait(&crawl->notify, &crawl->lock);
+
+        __interlock_sub(&crawl->idle);
+    }
+
+    while (crawl->queue.count && num < WATCH_CRAWL_TAKE_MAXNUM) {
+        crawl_paths_push(&shard->stack, crawl->queue.paths[--crawl->queue.count]);
+        num++;
+    }
+
+    pthread_mutex_unlock(&crawl->lock);
+
+    return num;
+}
+
+
+/**
+ * 有空闲线程时把本线程栈底的一半目录 (靠近根, 子树较大) 放入共享队列
+ */
+static void crawl_share_work (crawl_shard_t *shard)
+{
+    int i, half;
+
+    xs_watch_crawl_t *crawl = shard->crawl;
+
+    if (shard->stack.count < 2 || ! __interlock_get(&crawl->idle)) {
+        return;
+    }
+
+    half = shard->stack.count / 2;
+
+    pthread_mutex_lock(&crawl->lock);
+
+    for (i = 0; i < half; i++) {
+        crawl_paths_push(&crawl->queue, shard->stack.paths[i]);
+    }
+
+    pthread_cond_broadcast(&crawl->notify);
+
+    pthread_mutex_unlock(&crawl->lock);
+
+    memmove(shard->stack.paths, shard->stack.paths + half, sizeof(char *) * (shard->stack.count - half));
+    shard->stack.count -= half;
+}
+
+
+static void * crawl_thread (void *arg)
+{
+    crawl_shard_t *shard = (crawl_shard_t *) arg;
+
+    for (;;) {
+        if (! shard->stack.count && ! crawl_take_work(shard)) {
+            break;
+        }
+
+        crawl_read_dir(shard, shard->stack.paths[--shard->stack.count]);
+
+        crawl_share_work(shard);
+    }
+
+    return 0;
+}
+
+
+extern XS_RESULT XS_watch_crawl_create (int threads, XS_watch_crawl *outcrawl)
+{
+    xs_watch_crawl_t *crawl = (xs_watch_crawl_t *) mem_alloc_zero(1, sizeof(xs_watch_crawl_t));
+
+    if (pthread_mutex_init(&crawl->lock, 0) != 0) {
+        LOGGER_FATAL("pthread_mutex_init error");
+
+        mem_free(crawl);
+        return XS_ERROR;
+    }
+
+    if (pthread_cond_init(&crawl->notify, 0) != 0) {
+        LOGGER_FATAL("pthread_cond_init error");
+
+        pthread_mutex_destroy(&crawl->lock);
+        mem_free(crawl);
+        return XS_ERROR;
+    }
+
+    crawl->threads = (threads < 1? 1 : (threads > WATCH_CRAWL_THREADS_MAX? WATCH_CRAWL_THREADS_MAX : threads));
+
+    *outcrawl = crawl;
+
+    return XS_SUCCESS;
+}
+
+
+extern void XS_watch_crawl_free (XS_watch_crawl crawl)
+{
+    int i;
+
+    for (i = 0; i < WATCH_CRAWL_THREADS_MAX; i++) {
+        crawl_shard_t *shard = crawl->shards[i];
+
+        if (shard) {
+            crawl_paths_free(&shard->dirs);
+            crawl_paths_free(&shard->stack);
+            crawl_arena_free(shard->arena);
+
+            mem_free(shard);
+        }
+    }
+
+    crawl_paths_free(&crawl->queue);
+    crawl_paths_free(&crawl->roots);
+    crawl_arena_free(crawl->arena);
+
+    pthread_cond_destroy(&crawl->notify);
+    pthread_mutex_destroy(&crawl->lock);
+
+    mem_free(crawl);
+}
+
+
+extern XS_RESULT XS_watch_crawl_add_root (XS_watch_crawl crawl, const char *root)
+{
+    int i, len, rlen;
+
+    char *path;
+
+    len = (int) strlen(root);
+
+    if (! len || len + 1 >= PATH_MAX) {
+        LOGGER_ERROR("bad root path: %s", root);
+        return XS_ERROR;
+    }
+
+    // 根目录统一以 '/' 结尾
+    path = crawl_arena_alloc(&crawl->arena, len + 2);
+
+    memcpy(path, root, len);
+
+    if (path[len - 1] != '/') {
+        path[len++] = '/';
+    }
+    path[len] = '\0';
+
+    for (i = 0; i < crawl->roots.count; i++) {
+        rlen = (int) strlen(crawl->roots.paths[i]);
+
+        if (rlen <= len && ! strncmp(crawl->roots.paths[i], path, rlen)) {
+            // 相同或者在已有的根目录之下: 遍历已有的根目录时会发现
+            LOGGER_INFO("crawl root ignored: %s (under %s)", path, crawl->roots.paths[i]);
+            return XS_SUCCESS;
+        }
+
+        if (rlen > len && ! strncmp(crawl->roots.paths[i], path, len)) {
+            // 已有的根目录在新的根目录之下: 替换
+            LOGGER_INFO("crawl root ignored: %s (under %s)", crawl->roots.paths[i], path);
+
+            crawl->roots.paths[i] = crawl->roots.paths[--crawl->roots.count];
+            i--;
+        }
+    }
+
+    crawl_paths_push(&crawl->roots, path);
+
+    return XS_SUCCESS;
+}
+
+
+extern XS_RESULT XS_watch_crawl_run (XS_watch_crawl crawl)
+{
+    int i, err, created;
+
+    if (crawl->started || ! crawl->roots.count) {
+        return XS_ERROR;
+    }
+
+    crawl->started = 1;
+
+    for (i = 0; i < crawl->roots.count; i++) {
+        crawl_paths_push(&crawl->queue, crawl->roots.paths[i]);
+    }
+
+    for (i = 0; i < crawl->threads; i++) {
+        crawl->shards[i] = (crawl_shard_t *) mem_alloc_zero(1, sizeof(crawl_shard_t));
+        crawl->shards[i]->crawl = crawl;
+    }
+
+    // 持有锁创建线程: 新线程在确定实际线程数之后才能取目录
+    pthread_mutex_lock(&crawl->lock);
+
+    for (created = 1; created < crawl->threads; created++) {
+        err = pthread_create(&crawl->shards[created]->thread, 0, crawl_thread, (void *) crawl->shards[created]);
+
+        if (err) {
+            LOGGER_WARN("pthread_create error(%d): %s. crawl with %d threads", err, strerror(err), created);
+            break;
+        }
+    }
+
+    for (i = created; i < crawl->threads; i++) {
+        mem_free(crawl->shards[i]);
+        crawl->shards[i] = 0;
+    }
+
+    crawl->threads = created;
+
+    pthread_mutex_unlock(&crawl->lock);
+
+    crawl_thread((void *) crawl->shards[0]);
+
+    for (i = 1; i < crawl->threads; i++) {
+        pthread_join(crawl->shards[i]->thread, 0);
+    }
+
+    return XS_SUCCESS;
+}
+
+
+extern int XS_watch_crawl_merge (XS_watch_crawl crawl, watch_crawl_cb cb, void *arg)
+{
+    int i, k;
+
+    for (k = 0; k < crawl->roots.count; k++) {
+        if (! cb(crawl->roots.paths[k], arg)) {
+            return (-1);
+        }
+    }
+
+    for (i = 0; i < crawl->threads; i++) {
+        crawl_shard_t *shard = crawl->shards[i];
+
+        for (k = 0; shard && k < shard->dirs.count; k++) {
+            if (! cb(shard->dirs.paths[k], arg)) {
+                return (-1);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+extern int64_t XS_watch_crawl_dirs (XS_watch_crawl crawl)
+{
+    int i;
+
+    int64_t dirs = crawl->roots.count;
+
+    for (i = 0; i < crawl->threads; i++) {
+        if (crawl->shards[i]) {
+            dirs += crawl->shards[i]->dirs.count;
+        }
+    }
+
+    return dirs;
+}
+
+
+extern int XS_watch_crawl_errors (XS_watch_crawl crawl)
+{
+    int i, errors = 0;
+
+    for (i = 0; i < crawl->threads; i++) {
+        if (crawl->shards[i]) {
+            errors += crawl->shards[i]->errors;
+        }
+    }
+
+    return errors;
+}
+
+
+extern int XS_watch_crawl_threads (XS_watch_crawl crawl)
+{
+    return crawl->threads;
+}
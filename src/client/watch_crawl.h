@@ -0,0 +1,125 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: watch_crawl.h
+ *   启动时并行遍历监视目录: 多个线程用 getdents64 读目录 (d_type 判断目录,
+ *   不对文件 lstat), 每个线程把发现的子目录记录在自己的分片中,
+ *   遍历结束之后合并, 由调用者一次加锁添加监视.
+ *
+ *   不跟随符号链接, 与 inotifytools_watch_recursively 相同.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-30
+ *
+ * @update: 2018-11-30 10:12:26
+ */
+
+#ifndef WATCH_CRAWL_H_INCLUDED
+#define WATCH_CRAWL_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+
+#include <stdint.h>
+
+
+typedef struct xs_watch_crawl_t * XS_watch_crawl;
+
+
+/**
+ * 合并回调: dirpath 以 '/' 结尾. 返回 1 继续, 0 停止合并
+ */
+typedef int (*watch_crawl_cb) (const char *dirpath, void *arg);
+
+
+extern XS_RESULT XS_watch_crawl_create (int threads, XS_watch_crawl *outcrawl);
+
+extern void XS_watch_crawl_free (XS_watch_crawl crawl);
+
+
+/**
+ * XS_watch_crawl_add_root
+ *   添加遍历的根目录 (绝对路径, 不是符号链接). 必须在 XS_watch_crawl_run 之前调用.
+ *   与已经添加的根目录相同或者在其之下的根目录被忽略
+ *
+ * returns:
+ *   XS_SUCCESS
+ *   XS_ERROR - 路径太长
+ */
+extern XS_RESULT XS_watch_crawl_add_root (XS_watch_crawl crawl, const char *root);
+
+
+/**
+ * XS_watch_crawl_run
+ *   并行遍历全部根目录, 全部线程结束之后返回. 调用线程也参与遍历.
+ *   不能打开的目录 (已经删除或者没有权限) 被忽略
+ *
+ * returns:
+ *   XS_SUCCESS
+ *   XS_ERROR - 没有根目录或者已经遍历过
+ */
+extern XS_RESULT XS_watch_crawl_run (XS_watch_crawl crawl);
+
+
+/**
+ * XS_watch_crawl_merge
+ *   按 根目录, 线程 0, 线程 1, ... 的分片顺序对每个目录调用 cb.
+ *   必须在 XS_watch_crawl_run 之后调用
+ *
+ * returns:
+ *   0 - 全部目录已经回调
+ *  -1 - cb 返回 0 停止
+ */
+extern int XS_watch_crawl_merge (XS_watch_crawl crawl, watch_crawl_cb cb, void *arg);
+
+
+/**
+ * 发现的目录数 (含根目录)
+ */
+extern int64_t XS_watch_crawl_dirs (XS_watch_crawl crawl);
+
+
+/**
+ * 读目录失败 (忽略的除外) 的次数
+ */
+extern int XS_watch_crawl_errors (XS_watch_crawl crawl);
+
+
+/**
+ * 实际参与遍历的线程数
+ */
+extern int XS_watch_crawl_threads (XS_watch_crawl crawl);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* WATCH_CRAWL_H_INCLUDED */
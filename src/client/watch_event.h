@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-24
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 21:10:24
  */
 
 #ifndef WATCH_EVENT_H_INCLUDED
@@ -45,6 +45,11 @@ extern "C" {
 #include "../xsync-protocol.h"
 
 #include "inotifyapi.h"
+#include "server_conn.h"
+
+#include "../common/rbtree.h"
+#include "../common/evtrace.h"
+#include "../common/pathtab.h"
 
 /**
  * https://linux.die.net/man/7/inotify
@@ -58,54 +63,311 @@ extern "C" {
  *  the length of each inotify_event structure is thus sizeof(struct inotify_event) + len.
  */
 
+/**
+ * 一批事件共用的字符串区: 保存事件的目录和文件名. 每读一个 inotify
+ *   事件 (或者 sweep 一个文件) 之前清空, 不为每个事件复制 PATH_MAX 的缓冲.
+ */
+typedef struct watch_event_arena_t
+{
+    int used;
+    char buf[PATH_MAX + NAME_MAX + 2];
+} watch_event_arena_t;
+
+
+/**
+ * sweep 提交的合并注册 (XLGB): regs[sid] 是提交到服务器 sid 的注册,
+ *   没有提交时为 0. 工作线程同步文件时等待结果, 不再逐个注册
+ */
+typedef struct watch_event_regs_t
+{
+    int sidmax;
+    XS_entry_reg regs[0];
+} watch_event_regs_t;
+
+
+__no_warning_unused(static)
+inline void watch_event_regs_free(watch_event_regs_t *entryregs)
+{
+    int sid;
+
+    for (sid = 1; sid <= entryregs->sidmax; sid++) {
+        XS_entry_reg_release(entryregs->regs[sid]);
+    }
+
+    mem_free(entryregs);
+}
+
+
+/**
+ * 加入任务队列的事件 (堆上分配, 按文件名的实际长度).
+ *   目录由 pathid 引用, 不保存路径
+ */
 typedef struct watch_event_t
 {
-    union {
-        struct {
-            int      wd;           /* Watch descriptor */
-            uint32_t mask;         /* Mask of events */
-            uint32_t cookie;       /* Unique cookie associating related events (for rename(2)) */
-            uint32_t len;          /* Size of name field including end null bytes. */
-            char     name[NAME_MAX + 1];    /* Optional null-terminated name = 256*/
-        };
+    /* 嵌入的 event_rbtree 节点 */
+    struct rb_node rbnode;
+
+    /* 被采样跟踪时的阶段时间记录 (--trace), 否则为 0 */
+    evtrace_rec_t *trace;
+
+    /* sweep 提交的注册, 没有时为 0 (由工作线程提交) */
+    watch_event_regs_t *entryregs;
 
-        struct inotify_event inevent;
-    };
+    int      wd;           /* Watch descriptor */
+    uint32_t mask;         /* Mask of events */
+    uint32_t cookie;       /* Unique cookie associating related events (for rename(2)) */
 
-    char str_mtime[21];
-    char str_size[21];
+    /**
+     * 所在目录在 client->pathtab 中的 id (持有一个引用).
+     *   事件不复制目录路径, 需要时由 watch_event_pathname 得到
+     */
+    uint32_t pathid;
 
-    /* 文件的全路径名长度和全路径名 */
-    int pathlen;
-    char pathname[0];
+    /* 文件名长度 (不含结尾的 '\0') 和文件名 */
+    int len;
+    char name[0];
 } watch_event_t;
 
 
+/**
+ * struct watch_event_buf_t 的字段: C 结构和 FFI cdef (WATCH_EVENT_FFI_CDEF)
+ *   都由这个列表生成, 增加字段时两边同时改变.
+ *
+ *   F(C 类型, FFI 类型, 字段名)
+ */
+#define WATCH_EVENT_BUF_FIELDS(F) \
+    F(int, "int", wd) \
+    F(uint32_t, "uint32_t", mask) \
+    F(uint32_t, "uint32_t", cookie) \
+    /* 加入任务队列时设置 */ \
+    F(uint32_t, "uint32_t", pathid) \
+    /* 文件名长度和文件名 */ \
+    F(int, "int", len) \
+    F(const char *, "const char *", name) \
+    /* 所在目录的全路径名长度和全路径名 (以 '/' 结尾) */ \
+    F(int, "int", pathlen) \
+    F(const char *, "const char *", pathname) \
+    F(int64_t, "int64_t", mtime) \
+    F(int64_t, "int64_t", size) \
+    /* 被采样跟踪时的阶段时间记录 (--trace), 否则为 0 */ \
+    F(evtrace_rec_t *, "void *", trace) \
+    /* sweep 提交的注册 (同 watch_event_t.entryregs), 随事件交给工作线程 */ \
+    F(watch_event_regs_t *, "void *", entryregs)
+
+#define WATCH_EVENT_BUF_CFIELD(ctype, ffitype, name)    ctype name;
+#define WATCH_EVENT_BUF_FFIFIELD(ctype, ffitype, name)  " " ffitype " " #name ";"
+
+
+/**
+ * 读到的事件. 目录和文件名指向 arena (或者调用期间不变的字符串),
+ *   文件的修改时间和大小只在调用 lua 时格式化为字符串
+ */
 struct watch_event_buf_t
 {
-    union {
-        struct {
-            int      wd;           /* Watch descriptor */
-            uint32_t mask;         /* Mask of events */
-            uint32_t cookie;       /* Unique cookie associating related events (for rename(2)) */
-            uint32_t len;          /* Length of name field not including end null byte: '\0' */
-            char     name[NAME_MAX + 1];    /* Optional null-terminated name */
-        };
+    WATCH_EVENT_BUF_FIELDS(WATCH_EVENT_BUF_CFIELD)
+};
+
+
+__no_warning_unused(static)
+inline void watch_event_arena_reset(watch_event_arena_t *arena)
+{
+    arena->used = 0;
+}
+
+
+/**
+ * 复制字符串到 arena (以 '\0' 结尾). 空间不足返回 0
+ */
+__no_warning_unused(static)
+const char * watch_event_arena_put(watch_event_arena_t *arena, const char *str, int len)
+{
+    char *p;
+
+    if (len < 0 || arena->used + len + 1 > (int) sizeof(arena->buf)) {
+        return 0;
+    }
+
+    p = arena->buf + arena->used;
+
+    memcpy(p, str, len);
+    p[len] = 0;
+
+    arena->used += len + 1;
+
+    return p;
+}
+
+
+/**
+ * 脚本 filter_files_ffi 对每个文件的输出 (LuaJIT 后端). verdict 同 FILTER_WPATH_*
+ */
+#define WATCH_FILTER_MESSAGE_SIZE     128
+#define WATCH_FILTER_MESSAGE_MAXLEN   (WATCH_FILTER_MESSAGE_SIZE - 1)
+
+typedef struct watch_filter_out_t
+{
+    int verdict;
 
-        struct inotify_event inevent;
-    };
+    int msglen;
+    char message[WATCH_FILTER_MESSAGE_SIZE];
+} watch_filter_out_t;
 
-    char str_mtime[21];
-    char str_size[21];
 
-    /* 文件的全路径名长度和全路径名 */
-    int pathlen;
-    char pathname[PATH_MAX];
-} watch_event_buf_t;
+#define WATCH_EVENT_FFI_STR(x)    WATCH_EVENT_FFI_STR2(x)
+#define WATCH_EVENT_FFI_STR2(x)   #x
 
+/**
+ * filter_files_ffi 使用的 FFI 类型 (ffi.cdef). 由上面的 C 定义生成;
+ *   加载脚本时仍用 ffi.sizeof 检查, 不一致时不使用 FFI
+ */
+#define WATCH_EVENT_FFI_CDEF  \
+    "struct watch_event_buf_t {" \
+    WATCH_EVENT_BUF_FIELDS(WATCH_EVENT_BUF_FFIFIELD) \
+    " };" \
+    "struct watch_filter_out_t { int verdict; int msglen;" \
+    " char message[" WATCH_EVENT_FFI_STR(WATCH_FILTER_MESSAGE_SIZE) "]; };" \
+    "enum { XS_FILTER_ACCEPT = 100, XS_FILTER_REJECT = -100, XS_FILTER_RELOAD = -1 };"
 
+
+/**
+ * 成批过滤的文件事件: 一次调用脚本 filter_files 过滤整批.
+ *   整批的目录和文件名按实际长度复制到一个字符串区 (strbuf), 每个事件
+ *   记录自己的偏移. 字符串区增长时重新指向, 批次清空之前不释放
+ */
+typedef struct watch_event_batch_t
+{
+    int count;
+
+    struct watch_event_buf_t events[XSYNC_FILTER_BATCH_MAXNUM];
+
+    /* 事件的目录和文件名在 strbuf 中的偏移 (长度见 pathlen, len) */
+    struct {
+        int pathoff;
+        int nameoff;
+    } offsets[XSYNC_FILTER_BATCH_MAXNUM];
+
+    char *strbuf;
+    int strused;
+    int strsize;
+} watch_event_batch_t;
+
+
+/* 字符串区的初始大小 */
+#define WATCH_EVENT_BATCH_STRSIZE    4096
+
+
+/**
+ * 清空批次, 保留字符串区
+ */
 __no_warning_unused(static)
-inline int watch_event_compare(const watch_event_t *inNew, const watch_event_t *inNode)
+inline void watch_event_batch_reset(watch_event_batch_t *batch)
+{
+    batch->count = 0;
+    batch->strused = 0;
+}
+
+
+__no_warning_unused(static)
+inline void watch_event_batch_free(watch_event_batch_t *batch)
+{
+    if (batch->strbuf) {
+        mem_free(batch->strbuf);
+        batch->strbuf = 0;
+    }
+
+    batch->strsize = 0;
+
+    watch_event_batch_reset(batch);
+}
+
+
+/**
+ * 复制事件到批次 (跟踪记录交给批次). 批次已满或者名字太长返回 0
+ */
+__no_warning_unused(static)
+struct watch_event_buf_t * watch_event_batch_add(watch_event_batch_t *batch, const struct watch_event_buf_t *evbuf)
+{
+    int i, need;
+    char *p;
+
+    struct watch_event_buf_t *ev;
+
+    if (batch->count >= XSYNC_FILTER_BATCH_MAXNUM ||
+        evbuf->pathlen < 0 || evbuf->pathlen >= PATH_MAX || evbuf->len < 0 || evbuf->len > NAME_MAX) {
+        return 0;
+    }
+
+    need = evbuf->pathlen + evbuf->len + 2;
+
+    if (batch->strused + need > batch->strsize) {
+        int size = (batch->strsize? batch->strsize * 2 : WATCH_EVENT_BATCH_STRSIZE);
+
+        while (size < batch->strused + need) {
+            size *= 2;
+        }
+
+        batch->strbuf = (char *) mem_realloc(batch->strbuf, size);
+        batch->strsize = size;
+
+        // 字符串区可能移动: 重新指向已经加入的事件
+        for (i = 0; i < batch->count; i++) {
+            batch->events[i].pathname = batch->strbuf + batch->offsets[i].pathoff;
+            batch->events[i].name = batch->strbuf + batch->offsets[i].nameoff;
+        }
+    }
+
+    ev = &batch->events[batch->count];
+
+    *ev = *evbuf;
+
+    p = batch->strbuf + batch->strused;
+
+    memcpy(p, evbuf->pathname, evbuf->pathlen);
+    p[evbuf->pathlen] = 0;
+
+    ev->pathname = p;
+    batch->offsets[batch->count].pathoff = batch->strused;
+
+    p += evbuf->pathlen + 1;
+
+    memcpy(p, evbuf->name, evbuf->len);
+    p[evbuf->len] = 0;
+
+    ev->name = p;
+    batch->offsets[batch->count].nameoff = batch->strused + evbuf->pathlen + 1;
+
+    batch->strused += need;
+    batch->count++;
+
+    return ev;
+}
+
+
+/**
+ * 查找批次中同一个文件 (wd, name) 的事件: 返回索引, 没有返回 -1
+ */
+__no_warning_unused(static)
+int watch_event_batch_find(const watch_event_batch_t *batch, const struct watch_event_buf_t *evbuf)
+{
+    int i;
+
+    for (i = 0; i < batch->count; i++) {
+        const struct watch_event_buf_t *ev = &batch->events[i];
+
+        if (ev->wd == evbuf->wd && ev->len == evbuf->len && ! strcmp(ev->name, evbuf->name)) {
+            return i;
+        }
+    }
+
+    return (-1);
+}
+
+
+/**
+ * event_rbtree 的比较函数: 新事件 (inNew) 和树中的事件按 (wd, name) 比较
+ */
+__no_warning_unused(static)
+inline int watch_event_compare(const struct watch_event_buf_t *inNew, const watch_event_t *inNode)
 {
     if (inNew->wd > inNode->wd) {
         return 1;
@@ -117,10 +379,13 @@ inline int watch_event_compare(const watch_event_t *inNew, const watch_event_t *
 }
 
 
+/**
+ * 在 inotifytools 锁内调用: 目录路径属于 inotifytools, 必须复制到 arena
+ */
 __no_warning_unused(static)
-int inotify_event_dump(watch_event_t *outevent, int pathlenmax, struct inotify_event *inevent)
+int inotify_event_dump(struct watch_event_buf_t *outevent, watch_event_arena_t *arena, struct inotify_event *inevent)
 {
-    int namelen;
+    int namelen, pathlen;
     char *wpath;
 
     namelen = (int) strnlen(inevent->name, NAME_MAX);
@@ -140,22 +405,28 @@ int inotify_event_dump(watch_event_t *outevent, int pathlenmax, struct inotify_e
         return 0;
     }
 
-    outevent->pathlen = strlen(wpath);
-    if (! outevent->pathlen || outevent->pathlen >= pathlenmax) {
+    pathlen = strlen(wpath);
+    if (! pathlen || pathlen >= PATH_MAX) {
         LOGGER_WARN("bad inevent path: %s", wpath);
         return 0;
     }
 
+    watch_event_arena_reset(arena);
+
     outevent->wd = inevent->wd;
     outevent->mask = inevent->mask;
     outevent->cookie = inevent->cookie;
+
+    outevent->pathlen = pathlen;
+    outevent->pathname = watch_event_arena_put(arena, wpath, pathlen);
+
     outevent->len = namelen;
+    outevent->name = watch_event_arena_put(arena, inevent->name, namelen);
 
-    memcpy(outevent->name, inevent->name, namelen);
-    outevent->name[namelen] = 0;
+    outevent->mtime = 0;
+    outevent->size = 0;
 
-    memcpy(outevent->pathname, wpath, outevent->pathlen);
-    outevent->pathname[outevent->pathlen] = 0;
+    outevent->entryregs = 0;
 
     // all is ok
     return 1;
@@ -163,18 +434,72 @@ int inotify_event_dump(watch_event_t *outevent, int pathlenmax, struct inotify_e
 
 
 __no_warning_unused(static)
-watch_event_t * watch_event_clone(const watch_event_t *inevent)
+watch_event_t * watch_event_clone(const struct watch_event_buf_t *evbuf)
 {
-    ssize_t cb = sizeof(watch_event_t) + sizeof(char)*(inevent->pathlen + 1);
-    watch_event_t *outevent = (watch_event_t *) mem_alloc_unset(cb);
-    memcpy(outevent, inevent, cb);
+    watch_event_t *outevent = (watch_event_t *) mem_alloc_unset(sizeof(watch_event_t) + evbuf->len + 1);
+
+    RB_CLEAR_NODE(&outevent->rbnode);
+
+    outevent->trace = evbuf->trace;
+    outevent->entryregs = evbuf->entryregs;
+
+    outevent->wd = evbuf->wd;
+    outevent->mask = evbuf->mask;
+    outevent->cookie = evbuf->cookie;
+    outevent->pathid = evbuf->pathid;
+
+    outevent->len = evbuf->len;
+    memcpy(outevent->name, evbuf->name, evbuf->len);
+    outevent->name[evbuf->len] = 0;
+
     return outevent;
 }
 
 
+/**
+ * 得到事件所在目录的全路径名 (以 '/' 结尾)
+ *
+ * returns:
+ *   路径长度 - success
+ *   -1       - 缓冲区太小或者 pathid 无效
+ */
+__no_warning_unused(static)
+int watch_event_pathname(pathtab_t *paths, const watch_event_t *event, char *buf, int bufsize)
+{
+    int len = pathtab_path(paths, event->pathid, buf, bufsize - 1);
+
+    if (len > 0 && buf[len - 1] != '/') {
+        buf[len++] = '/';
+        buf[len] = 0;
+    }
+
+    return len;
+}
+
+
+/**
+ * 放弃没有交给工作线程的注册
+ */
 __no_warning_unused(static)
-void watch_event_free(watch_event_t *event)
+inline void watch_event_buf_drop_entryregs(struct watch_event_buf_t *evbuf)
 {
+    if (evbuf->entryregs) {
+        watch_event_regs_free(evbuf->entryregs);
+        evbuf->entryregs = 0;
+    }
+}
+
+
+__no_warning_unused(static)
+void watch_event_free(pathtab_t *paths, watch_event_t *event)
+{
+    pathtab_release(paths, event->pathid);
+    evtrace_free(event->trace);
+
+    if (event->entryregs) {
+        watch_event_regs_free(event->entryregs);
+    }
+
     mem_free(event);
 }
 
@@ -0,0 +1,276 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: watch_repair.c
+ *   监视修复队列 (see "watch_repair.h")
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-29
+ *
+ * @update: 2018-11-30 20:48:03
+ */
+
+#include "client_api.h"
+
+#include "watch_repair.h"
+
+#include "../common/hashmap.h"
+
+#include <sys/time.h>
+
+
+typedef struct watch_repair_entry_t
+{
+    struct watch_repair_entry_t *next;
+
+    int op;
+    int retries;
+
+    /* 下次重试的时间 (微秒) */
+    uint64_t due_us;
+
+    char path[0];
+} watch_repair_entry_t;
+
+
+typedef struct xs_watch_repair_t
+{
+    thread_lock_t lock;
+
+    int count;
+
+    watch_repair_entry_t *head;
+
+    /* 队列中的请求: path => entry (键是 entry->path) */
+    hmap_t bypath;
+} xs_watch_repair_t;
+
+
+static inline uint64_t repair_now_us (void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+
+    return (uint64_t) tv.tv_sec * 1000000 + (uint64_t) tv.tv_usec;
+}
+
+
+/* 在锁内调用 */
+static watch_repair_entry_t * repair_find_inlock (xs_watch_repair_t *repair, const char *path)
+{
+    void_ptr entry;
+
+    if (hashmap_get(repair->bypath, path, &entry) == HMAP_S_OK) {
+        return (watch_repair_entry_t *) entry;
+    }
+
+    return 0;
+}
+
+
+/* 在锁内调用: 加入队列 */
+static int repair_link_inlock (xs_watch_repair_t *repair, watch_repair_entry_t *entry)
+{
+    if (hashmap_put(repair->bypath, entry->path, (void_ptr) entry) != HMAP_S_OK) {
+        return (-1);
+    }
+
+    entry->next = repair->head;
+    repair->head = entry;
+    repair->count++;
+
+    return 0;
+}
+
+
+extern XS_RESULT XS_watch_repair_create (XS_watch_repair *outrepair)
+{
+    xs_watch_repair_t *repair = (xs_watch_repair_t *) mem_alloc_zero(1, sizeof(xs_watch_repair_t));
+
+    if (threadlock_init(&repair->lock) != 0) {
+        LOGGER_FATAL("threadlock_init error");
+
+        mem_free(repair);
+        return XS_ERROR;
+    }
+
+    repair->bypath = hashmap_create();
+
+    *outrepair = repair;
+
+    return XS_SUCCESS;
+}
+
+
+extern void XS_watch_repair_free (XS_watch_repair repair)
+{
+    watch_repair_entry_t *entry;
+
+    // 长的键引用 entry->path: 先销毁 hashmap
+    hashmap_destroy(repair->bypath, 0, 0);
+
+    while ((entry = repair->head) != 0) {
+        repair->head = entry->next;
+        mem_free(entry);
+    }
+
+    threadlock_destroy(&repair->lock);
+
+    mem_free(repair);
+}
+
+
+extern XS_RESULT XS_watch_repair_add (XS_watch_repair repair, int op, const char *path)
+{
+    watch_repair_entry_t *entry;
+
+    int len = (int) strlen(path);
+
+    if (len >= PATH_MAX) {
+        LOGGER_ERROR("path too long: %s", path);
+        return XS_ERROR;
+    }
+
+    threadlock_lock(&repair->lock);
+
+    entry = repair_find_inlock(repair, path);
+
+    if (! entry) {
+        if (repair->count >= XSYNC_WATCH_REPAIR_MAXNUM) {
+            threadlock_unlock(&repair->lock);
+
+            LOGGER_WARN("watch repair queue full (%d): %s", XSYNC_WATCH_REPAIR_MAXNUM, path);
+            return XS_ERROR;
+        }
+
+        entry = (watch_repair_entry_t *) mem_alloc_zero(1, sizeof(watch_repair_entry_t) + len + 1);
+        memcpy(entry->path, path, len + 1);
+
+        if (repair_link_inlock(repair, entry) != 0) {
+            threadlock_unlock(&repair->lock);
+
+            LOGGER_ERROR("hashmap_put fail: %s", path);
+
+            mem_free(entry);
+            return XS_ERROR;
+        }
+    }
+
+    entry->op = op;
+    entry->retries = 0;
+    entry->due_us = 0;
+
+    threadlock_unlock(&repair->lock);
+
+    LOGGER_INFO("watch repair(%s): %s", (op == WATCH_REPAIR_ADD? "add" : "remove"), path);
+
+    return XS_SUCCESS;
+}
+
+
+extern int XS_watch_repair_run (XS_watch_repair repair, watch_repair_cb cb, void *arg)
+{
+    int gaveup = 0;
+
+    uint64_t now_us = repair_now_us();
+
+    watch_repair_entry_t *entry, *next, **link;
+
+    // 到期的请求移出队列, 回调不在锁内调用
+    watch_repair_entry_t *due = 0;
+
+    threadlock_lock(&repair->lock);
+
+    link = &repair->head;
+
+    while ((entry = *link) != 0) {
+        if (entry->due_us <= now_us) {
+            void_ptr removed;
+
+            *link = entry->next;
+            repair->count--;
+
+            hashmap_remove(repair->bypath, entry->path, &removed);
+
+            entry->next = due;
+            due = entry;
+        } else {
+            link = &entry->next;
+        }
+    }
+
+    threadlock_unlock(&repair->lock);
+
+    for (entry = due; entry; entry = next) {
+        next = entry->next;
+
+        if (cb(entry->op, entry->path, arg)) {
+            LOGGER_INFO("watch repair(%s) ok: %s", (entry->op == WATCH_REPAIR_ADD? "add" : "remove"), entry->path);
+
+            mem_free(entry);
+            continue;
+        }
+
+        if (++entry->retries >= XSYNC_WATCH_REPAIR_MAXRETRY) {
+            LOGGER_ERROR("watch repair(%s) gave up after %d retries: %s",
+                (entry->op == WATCH_REPAIR_ADD? "add" : "remove"), entry->retries, entry->path);
+
+            gaveup++;
+
+            mem_free(entry);
+            continue;
+        }
+
+        entry->due_us = repair_now_us() + watch_repair_backoff_us(entry->retries);
+
+        LOGGER_WARN("watch repair(%s) retry(%d) in %"PRIu64" ms: %s",
+            (entry->op == WATCH_REPAIR_ADD? "add" : "remove"), entry->retries, watch_repair_backoff_us(entry->retries) / 1000, entry->path);
+
+        threadlock_lock(&repair->lock);
+
+        if (repair_find_inlock(repair, entry->path) || repair_link_inlock(repair, entry) != 0) {
+            // 重试期间有新的请求 (以新的为准), 或者不能加入队列
+            mem_free(entry);
+        }
+
+        threadlock_unlock(&repair->lock);
+    }
+
+    return gaveup;
+}
+
+
+extern int XS_watch_repair_pendings (XS_watch_repair repair)
+{
+    int count;
+
+    threadlock_lock(&repair->lock);
+    count = repair->count;
+    threadlock_unlock(&repair->lock);
+
+    return count;
+}
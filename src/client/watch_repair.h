@@ -0,0 +1,122 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: watch_repair.h
+ *   监视修复队列: 添加或者删除监视失败的目录 (子树) 按退避时间重试,
+ *   不再因为单个目录失败而重启全部监视
+ *
+ *   同一个目录只保留最后一次请求的操作. 只有 inotify 线程执行修复,
+ *   其他线程 (sweep) 可以添加请求.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-29
+ *
+ * @update: 2018-11-29 15:26:40
+ */
+
+#ifndef WATCH_REPAIR_H_INCLUDED
+#define WATCH_REPAIR_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+
+#include <stdint.h>
+
+
+/* 添加目录及其子目录的监视 */
+#define WATCH_REPAIR_ADD       1
+
+/* 删除目录及其子目录的监视 */
+#define WATCH_REPAIR_REMOVE    2
+
+
+typedef struct xs_watch_repair_t * XS_watch_repair;
+
+
+/**
+ * 第 retries 次重试的退避时间 (微秒): XSYNC_WATCH_REPAIR_BACKOFF_MS 每次加倍,
+ *   最大 XSYNC_WATCH_REPAIR_BACKOFF_MAXMS
+ */
+static inline uint64_t watch_repair_backoff_us (int retries)
+{
+    uint64_t ms = XSYNC_WATCH_REPAIR_BACKOFF_MS;
+
+    while (retries-- > 1 && ms < XSYNC_WATCH_REPAIR_BACKOFF_MAXMS) {
+        ms *= 2;
+    }
+
+    return (ms < XSYNC_WATCH_REPAIR_BACKOFF_MAXMS? ms : XSYNC_WATCH_REPAIR_BACKOFF_MAXMS) * 1000;
+}
+
+
+/**
+ * 修复回调: 返回 1 表示成功 (或者不再需要修复), 0 表示失败, 稍后重试
+ */
+typedef int (*watch_repair_cb) (int op, const char *path, void *arg);
+
+
+extern XS_RESULT XS_watch_repair_create (XS_watch_repair *outrepair);
+
+extern void XS_watch_repair_free (XS_watch_repair repair);
+
+
+/**
+ * XS_watch_repair_add
+ *   添加修复请求 (线程安全). 目录已经在队列中时替换操作并且立即重试
+ *
+ * returns:
+ *   XS_SUCCESS
+ *   XS_ERROR - 队列已满 (XSYNC_WATCH_REPAIR_MAXNUM) 或者路径太长
+ */
+extern XS_RESULT XS_watch_repair_add (XS_watch_repair repair, int op, const char *path);
+
+
+/**
+ * XS_watch_repair_run
+ *   执行到期的修复请求. 失败的请求按 XSYNC_WATCH_REPAIR_BACKOFF_MS 加倍退避,
+ *   失败 XSYNC_WATCH_REPAIR_MAXRETRY 次之后放弃. 回调不在锁内调用.
+ *
+ * returns:
+ *   放弃的请求数
+ */
+extern int XS_watch_repair_run (XS_watch_repair repair, watch_repair_cb cb, void *arg);
+
+
+/**
+ * 队列中等待修复的目录数
+ */
+extern int XS_watch_repair_pendings (XS_watch_repair repair);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* WATCH_REPAIR_H_INCLUDED */
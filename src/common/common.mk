@@ -3,12 +3,13 @@
 #
 # @version: 0.4.4
 # @create: 2012-05-18 14:00:00
-# @update: 2018-11-07 10:20:15
+# @update: 2018-11-30 20:48:03
 #######################################################################
 TARGET := libcommon.a
 
 SOURCES := \
 	log4c_logger.c \
+	log4c_async.c \
 	threadpool.c \
 	getopt_longw.c \
 	getoptw.c \
@@ -17,7 +18,10 @@ SOURCES := \
 	mul_timer.c \
 	randctx.c \
 	rc4.c \
-	red_black_tree.c
+	hashmap.c \
+	metrics.c \
+	evtrace.c \
+	pathtab.c
 
 
 #   If the macro NDEBUG is defined at the moment <assert.h> was last
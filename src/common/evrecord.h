@@ -0,0 +1,670 @@
+/***********************************************************************
+* Copyright (c) 2018 pepstack, pepstack.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*   claim that you wrote the original software. If you use this software
+*   in a product, an acknowledgment in the product documentation would be
+*   appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not be
+*   misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source distribution.
+***********************************************************************/
+
+/**
+ * @file: evrecord.h
+ *   compact versioned binary event record
+ *
+ *   客户端事件的二进制编码 (kafka 消息), 代替 "{type|time|...}" 字符串:
+ *
+ *     [magic:1][version:1][fields:varint][字段...]
+ *
+ *   fields 是字段的位图, 字段按位的顺序排列, 只有位图中的字段出现.
+ *   整数为 varint (LEB128), 字符串为 varint 长度 + 字节 (没有 '\0').
+ *   新的字段只能使用更高的位并追加在末尾, 旧的读者忽略不认识的尾部.
+ *   不兼容的修改必须增加 version.
+ *
+ *   编码和解码都不分配内存: 解码得到的字符串指向输入缓冲区.
+ *   evrecord_format 把记录输出为文本 (旧格式) 或者 JSON.
+ *
+ *   seq 是客户端事件的序号 (单调递增, 重启之后继续), 读者按文件去掉
+ *   重放或者重试产生的重复记录.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-26
+ *
+ * @update: 2018-11-27 16:40:12
+ */
+
+#ifndef EVRECORD_H_INCLUDED
+#define EVRECORD_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/inotify.h>
+
+
+#define EVRECORD_MAGIC          0xE7
+#define EVRECORD_VERSION        1
+
+/* 字段位 */
+#define EVRECORD_F_TYPE         0x0001    /* varint: 任务类型 */
+#define EVRECORD_F_TIME         0x0002    /* varint: 事件处理时间, 微秒 (UTC) */
+#define EVRECORD_F_CLIENTID     0x0004    /* string */
+#define EVRECORD_F_THREAD       0x0008    /* varint: 工作线程 id */
+#define EVRECORD_F_SIDS         0x0010    /* varint 个数 + varint sid */
+#define EVRECORD_F_MASK         0x0020    /* varint: inotify 事件掩码 */
+#define EVRECORD_F_PATHID       0x0040    /* string */
+#define EVRECORD_F_PATH         0x0080    /* string: 目录, 以 '/' 结尾 */
+#define EVRECORD_F_FILE         0x0100    /* string: 文件名 */
+#define EVRECORD_F_ROUTE        0x0200    /* string */
+#define EVRECORD_F_SEQ          0x0400    /* varint: 客户端事件序号 */
+
+#define EVRECORD_F_ALL          0x07FF
+
+/* 最多的服务器 sid 数目 (sid: 1 ~ 255) */
+#define EVRECORD_SIDS_MAX       255
+
+/* evrecord_format 的输出格式 */
+#define EVRECORD_FMT_TEXT       0    /* {type|time|clientid|thread|sid|event|pathid|path|file|route} */
+#define EVRECORD_FMT_JSON       1
+#define EVRECORD_FMT_BINARY     2    /* 只用于选择消息格式, evrecord_format 不支持 */
+
+
+typedef struct evrecord_str_t
+{
+    const char *str;
+    uint32_t len;
+} evrecord_str_t;
+
+
+typedef struct evrecord_t
+{
+    uint32_t fields;
+
+    uint32_t type;
+    uint64_t time_us;
+
+    evrecord_str_t clientid;
+
+    uint32_t thread;
+
+    int nsids;
+    uint8_t sids[EVRECORD_SIDS_MAX];
+
+    uint32_t mask;
+
+    evrecord_str_t pathid;
+    evrecord_str_t path;
+    evrecord_str_t file;
+    evrecord_str_t route;
+
+    uint64_t seq;
+} evrecord_t;
+
+
+typedef struct evrecord_writer_t
+{
+    unsigned char *buf;
+    size_t size;
+    size_t len;
+
+    /* 1: 缓冲区不够 */
+    int overflow;
+} evrecord_writer_t;
+
+
+__attribute__((unused))
+static inline void evrecord_writer_init (evrecord_writer_t *w, void *buf, size_t size)
+{
+    w->buf = (unsigned char *) buf;
+    w->size = size;
+    w->len = 0;
+    w->overflow = 0;
+}
+
+
+__attribute__((unused))
+static inline void evrecord_put_byte (evrecord_writer_t *w, unsigned char b)
+{
+    if (w->len < w->size) {
+        w->buf[w->len++] = b;
+    } else {
+        w->overflow = 1;
+    }
+}
+
+
+__attribute__((unused))
+static inline void evrecord_put_varint (evrecord_writer_t *w, uint64_t v)
+{
+    while (v >= 0x80) {
+        evrecord_put_byte(w, (unsigned char) (v | 0x80));
+        v >>= 7;
+    }
+
+    evrecord_put_byte(w, (unsigned char) v);
+}
+
+
+__attribute__((unused))
+static inline void evrecord_put_str (evrecord_writer_t *w, const evrecord_str_t *s)
+{
+    evrecord_put_varint(w, s->len);
+
+    if (w->len + s->len <= w->size) {
+        memcpy(w->buf + w->len, s->str, s->len);
+        w->len += s->len;
+    } else {
+        w->overflow = 1;
+    }
+}
+
+
+__attribute__((unused))
+static inline int evrecord_get_varint (const unsigned char **pp, const unsigned char *end, uint64_t *v)
+{
+    int shift = 0;
+    uint64_t val = 0;
+
+    const unsigned char *p = *pp;
+
+    while (p < end && shift < 64) {
+        unsigned char b = *p++;
+
+        val |= (uint64_t) (b & 0x7F) << shift;
+
+        if (! (b & 0x80)) {
+            *pp = p;
+            *v = val;
+            return 0;
+        }
+
+        shift += 7;
+    }
+
+    return (-1);
+}
+
+
+__attribute__((unused))
+static inline int evrecord_get_str (const unsigned char **pp, const unsigned char *end, evrecord_str_t *s)
+{
+    uint64_t len;
+
+    if (evrecord_get_varint(pp, end, &len) || len > (uint64_t) (end - *pp)) {
+        return (-1);
+    }
+
+    s->str = (const char *) *pp;
+    s->len = (uint32_t) len;
+
+    *pp += len;
+    return 0;
+}
+
+
+__attribute__((unused))
+static inline void evrecord_set_str (evrecord_str_t *s, const char *str, size_t len)
+{
+    s->str = str;
+    s->len = (uint32_t) len;
+}
+
+
+/**
+ * evrecord_encode
+ *   编码 rec 中 fields 指定的字段到 buf
+ *
+ * returns:
+ *   编码的长度
+ *   -1 - buf 空间不足
+ */
+__attribute__((unused))
+static int evrecord_encode (const evrecord_t *rec, void *buf, size_t size)
+{
+    int i;
+
+    evrecord_writer_t w;
+
+    uint32_t fields = rec->fields & EVRECORD_F_ALL;
+
+    evrecord_writer_init(&w, buf, size);
+
+    evrecord_put_byte(&w, EVRECORD_MAGIC);
+    evrecord_put_byte(&w, EVRECORD_VERSION);
+    evrecord_put_varint(&w, fields);
+
+    if (fields & EVRECORD_F_TYPE) {
+        evrecord_put_varint(&w, rec->type);
+    }
+
+    if (fields & EVRECORD_F_TIME) {
+        evrecord_put_varint(&w, rec->time_us);
+    }
+
+    if (fields & EVRECORD_F_CLIENTID) {
+        evrecord_put_str(&w, &rec->clientid);
+    }
+
+    if (fields & EVRECORD_F_THREAD) {
+        evrecord_put_varint(&w, rec->thread);
+    }
+
+    if (fields & EVRECORD_F_SIDS) {
+        evrecord_put_varint(&w, (uint64_t) rec->nsids);
+
+        for (i = 0; i < rec->nsids; i++) {
+            evrecord_put_varint(&w, rec->sids[i]);
+        }
+    }
+
+    if (fields & EVRECORD_F_MASK) {
+        evrecord_put_varint(&w, rec->mask);
+    }
+
+    if (fields & EVRECORD_F_PATHID) {
+        evrecord_put_str(&w, &rec->pathid);
+    }
+
+    if (fields & EVRECORD_F_PATH) {
+        evrecord_put_str(&w, &rec->path);
+    }
+
+    if (fields & EVRECORD_F_FILE) {
+        evrecord_put_str(&w, &rec->file);
+    }
+
+    if (fields & EVRECORD_F_ROUTE) {
+        evrecord_put_str(&w, &rec->route);
+    }
+
+    if (fields & EVRECORD_F_SEQ) {
+        evrecord_put_varint(&w, rec->seq);
+    }
+
+    return (w.overflow? (-1) : (int) w.len);
+}
+
+
+/**
+ * evrecord_decode
+ *   解码记录. 字符串指向 buf, 不以 '\0' 结尾. 不认识的字段 (更高的位)
+ *   被忽略
+ *
+ * returns:
+ *   0 - success
+ *  -1 - 不是记录, 版本不支持或者数据不完整
+ */
+__attribute__((unused))
+static int evrecord_decode (const void *buf, size_t len, evrecord_t *rec)
+{
+    int i;
+    uint64_t v;
+
+    const unsigned char *p = (const unsigned char *) buf;
+    const unsigned char *end = p + len;
+
+    /* sids 只有前 nsids 个有效, 不清零 */
+    memset(rec, 0, offsetof(evrecord_t, sids));
+    memset(&rec->mask, 0, sizeof(*rec) - offsetof(evrecord_t, mask));
+
+    if (len < 3 || p[0] != EVRECORD_MAGIC || p[1] != EVRECORD_VERSION) {
+        return (-1);
+    }
+
+    p += 2;
+
+    if (evrecord_get_varint(&p, end, &v)) {
+        return (-1);
+    }
+
+    rec->fields = (uint32_t) v;
+
+    if (rec->fields & EVRECORD_F_TYPE) {
+        if (evrecord_get_varint(&p, end, &v)) {
+            return (-1);
+        }
+        rec->type = (uint32_t) v;
+    }
+
+    if (rec->fields & EVRECORD_F_TIME) {
+        if (evrecord_get_varint(&p, end, &rec->time_us)) {
+            return (-1);
+        }
+    }
+
+    if ((rec->fields & EVRECORD_F_CLIENTID) && evrecord_get_str(&p, end, &rec->clientid)) {
+        return (-1);
+    }
+
+    if (rec->fields & EVRECORD_F_THREAD) {
+        if (evrecord_get_varint(&p, end, &v)) {
+            return (-1);
+        }
+        rec->thread = (uint32_t) v;
+    }
+
+    if (rec->fields & EVRECORD_F_SIDS) {
+        if (evrecord_get_varint(&p, end, &v) || v > EVRECORD_SIDS_MAX) {
+            return (-1);
+        }
+
+        rec->nsids = (int) v;
+
+        for (i = 0; i < rec->nsids; i++) {
+            if (evrecord_get_varint(&p, end, &v) || v > 255) {
+                return (-1);
+            }
+            rec->sids[i] = (uint8_t) v;
+        }
+    }
+
+    if (rec->fields & EVRECORD_F_MASK) {
+        if (evrecord_get_varint(&p, end, &v)) {
+            return (-1);
+        }
+        rec->mask = (uint32_t) v;
+    }
+
+    if ((rec->fields & EVRECORD_F_PATHID) && evrecord_get_str(&p, end, &rec->pathid)) {
+        return (-1);
+    }
+
+    if ((rec->fields & EVRECORD_F_PATH) && evrecord_get_str(&p, end, &rec->path)) {
+        return (-1);
+    }
+
+    if ((rec->fields & EVRECORD_F_FILE) && evrecord_get_str(&p, end, &rec->file)) {
+        return (-1);
+    }
+
+    if ((rec->fields & EVRECORD_F_ROUTE) && evrecord_get_str(&p, end, &rec->route)) {
+        return (-1);
+    }
+
+    if ((rec->fields & EVRECORD_F_SEQ) && evrecord_get_varint(&p, end, &rec->seq)) {
+        return (-1);
+    }
+
+    rec->fields &= EVRECORD_F_ALL;
+
+    return 0;
+}
+
+
+/**
+ * evrecord_time_str
+ *   微秒时间按本地时间输出: "2018-11-26 10:15:38.123"
+ */
+__attribute__((unused))
+static int evrecord_time_str (uint64_t time_us, char *buf, size_t size)
+{
+    struct tm t;
+    time_t sec = (time_t) (time_us / 1000000);
+
+    localtime_r(&sec, &t);
+
+    return snprintf(buf, size, "%04d-%02d-%02d %02d:%02d:%02d.%03d",
+        1900 + t.tm_year, 1 + t.tm_mon, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, (int) ((time_us % 1000000) / 1000));
+}
+
+
+/**
+ * evrecord_sids_str
+ *   sid 列表输出为 "1,3,5"
+ */
+__attribute__((unused))
+static int evrecord_sids_str (const evrecord_t *rec, char *buf, size_t size)
+{
+    int i, n;
+    size_t len = 0;
+
+    if (size) {
+        *buf = 0;
+    }
+
+    for (i = 0; i < rec->nsids; i++) {
+        n = snprintf(buf + len, size - len, "%s%d", (i? "," : ""), rec->sids[i]);
+
+        if (n < 0 || (size_t) n >= size - len) {
+            return (-1);
+        }
+
+        len += n;
+    }
+
+    return (int) len;
+}
+
+
+/**
+ * evrecord_mask_str
+ *   inotify 事件掩码输出为名字列表: "CLOSE_WRITE,ISDIR"
+ */
+__attribute__((unused))
+static int evrecord_mask_str (uint32_t mask, char *buf, size_t size)
+{
+    static const struct {
+        uint32_t bit;
+        const char *name;
+    } names[] = {
+        {IN_ACCESS, "ACCESS"}, {IN_MODIFY, "MODIFY"}, {IN_ATTRIB, "ATTRIB"},
+        {IN_CLOSE_WRITE, "CLOSE_WRITE"}, {IN_CLOSE_NOWRITE, "CLOSE_NOWRITE"}, {IN_OPEN, "OPEN"},
+        {IN_MOVED_FROM, "MOVED_FROM"}, {IN_MOVED_TO, "MOVED_TO"}, {IN_CREATE, "CREATE"},
+        {IN_DELETE, "DELETE"}, {IN_DELETE_SELF, "DELETE_SELF"}, {IN_MOVE_SELF, "MOVE_SELF"},
+        {IN_UNMOUNT, "UNMOUNT"}, {IN_Q_OVERFLOW, "Q_OVERFLOW"}, {IN_IGNORED, "IGNORED"},
+        {IN_ISDIR, "ISDIR"}, {IN_ONESHOT, "ONESHOT"}
+    };
+
+    int i, n;
+    size_t len = 0;
+
+    if (size) {
+        *buf = 0;
+    }
+
+    for (i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++) {
+        if (mask & names[i].bit) {
+            n = snprintf(buf + len, size - len, "%s%s", (len? "," : ""), names[i].name);
+
+            if (n < 0 || (size_t) n >= size - len) {
+                return (-1);
+            }
+
+            len += n;
+        }
+    }
+
+    return (int) len;
+}
+
+
+/* JSON 字符串 (带引号和转义) 追加到 buf */
+__attribute__((unused))
+static int evrecord_json_str (const evrecord_str_t *s, char *buf, size_t size)
+{
+    uint32_t i;
+    size_t len = 0;
+
+    if (size < 2) {
+        return (-1);
+    }
+
+    buf[len++] = '"';
+
+    for (i = 0; i < s->len; i++) {
+        unsigned char ch = (unsigned char) s->str[i];
+
+        if (len + 7 >= size) {
+            return (-1);
+        }
+
+        if (ch == '"' || ch == '\\') {
+            buf[len++] = '\\';
+            buf[len++] = (char) ch;
+        } else if (ch < 0x20) {
+            len += snprintf(buf + len, size - len, "\\u%04x", ch);
+        } else {
+            buf[len++] = (char) ch;
+        }
+    }
+
+    if (len + 2 > size) {
+        return (-1);
+    }
+
+    buf[len++] = '"';
+    buf[len] = 0;
+
+    return (int) len;
+}
+
+
+/**
+ * evrecord_format
+ *   记录输出为字符串 (以 '\0' 结尾). 没有的字段输出为空.
+ *
+ *   EVRECORD_FMT_TEXT: {type|time|clientid|thread|sid|event|pathid|path|file|route}
+ *   EVRECORD_FMT_JSON: {"type":100,"time":"...","time_us":...,...}
+ *
+ * returns:
+ *   输出的长度
+ *   -1 - buf 空间不足或者格式不支持
+ */
+__attribute__((unused))
+static int evrecord_format (const evrecord_t *rec, int fmt, char *buf, size_t size)
+{
+    int n;
+    size_t len = 0;
+
+    char timestr[80];
+    char sidstr[EVRECORD_SIDS_MAX * 4 + 1];
+    char maskstr[256];
+
+    timestr[0] = sidstr[0] = maskstr[0] = 0;
+
+    if (rec->fields & EVRECORD_F_TIME) {
+        evrecord_time_str(rec->time_us, timestr, sizeof(timestr));
+    }
+
+    if (rec->fields & EVRECORD_F_SIDS) {
+        evrecord_sids_str(rec, sidstr, sizeof(sidstr));
+    }
+
+    if (rec->fields & EVRECORD_F_MASK) {
+        evrecord_mask_str(rec->mask, maskstr, sizeof(maskstr));
+    }
+
+    if (fmt == EVRECORD_FMT_TEXT) {
+        n = snprintf(buf, size, "{%u|%s|%.*s|%u|%s|%s|%.*s|%.*s|%.*s|%.*s}",
+            rec->type, timestr,
+            (int) rec->clientid.len, rec->clientid.str,
+            rec->thread, sidstr, maskstr,
+            (int) rec->pathid.len, rec->pathid.str,
+            (int) rec->path.len, rec->path.str,
+            (int) rec->file.len, rec->file.str,
+            (int) rec->route.len, rec->route.str);
+
+        return ((n < 0 || (size_t) n >= size)? (-1) : n);
+    }
+
+    if (fmt != EVRECORD_FMT_JSON) {
+        return (-1);
+    }
+
+#define EVRECORD_JSON_PUT(fmtstr, ...) do { \
+        n = snprintf(buf + len, size - len, fmtstr, __VA_ARGS__); \
+        if (n < 0 || (size_t) n >= size - len) { \
+            return (-1); \
+        } \
+        len += n; \
+    } while (0)
+
+#define EVRECORD_JSON_STR(key, s) do { \
+        EVRECORD_JSON_PUT("%s\"%s\":", (len > 1? "," : ""), key); \
+        n = evrecord_json_str(s, buf + len, size - len); \
+        if (n < 0) { \
+            return (-1); \
+        } \
+        len += n; \
+    } while (0)
+
+    EVRECORD_JSON_PUT("%s", "{");
+
+    if (rec->fields & EVRECORD_F_TYPE) {
+        EVRECORD_JSON_PUT("%s\"type\":%u", (len > 1? "," : ""), rec->type);
+    }
+
+    if (rec->fields & EVRECORD_F_TIME) {
+        EVRECORD_JSON_PUT("%s\"time\":\"%s\",\"time_us\":%llu", (len > 1? "," : ""), timestr, (unsigned long long) rec->time_us);
+    }
+
+    if (rec->fields & EVRECORD_F_CLIENTID) {
+        EVRECORD_JSON_STR("clientid", &rec->clientid);
+    }
+
+    if (rec->fields & EVRECORD_F_THREAD) {
+        EVRECORD_JSON_PUT("%s\"thread\":%u", (len > 1? "," : ""), rec->thread);
+    }
+
+    if (rec->fields & EVRECORD_F_SIDS) {
+        EVRECORD_JSON_PUT("%s\"sids\":[%s]", (len > 1? "," : ""), sidstr);
+    }
+
+    if (rec->fields & EVRECORD_F_MASK) {
+        EVRECORD_JSON_PUT("%s\"mask\":%u,\"event\":\"%s\"", (len > 1? "," : ""), rec->mask, maskstr);
+    }
+
+    if (rec->fields & EVRECORD_F_PATHID) {
+        EVRECORD_JSON_STR("pathid", &rec->pathid);
+    }
+
+    if (rec->fields & EVRECORD_F_PATH) {
+        EVRECORD_JSON_STR("path", &rec->path);
+    }
+
+    if (rec->fields & EVRECORD_F_FILE) {
+        EVRECORD_JSON_STR("file", &rec->file);
+    }
+
+    if (rec->fields & EVRECORD_F_ROUTE) {
+        EVRECORD_JSON_STR("route", &rec->route);
+    }
+
+    if (rec->fields & EVRECORD_F_SEQ) {
+        EVRECORD_JSON_PUT("%s\"seq\":%llu", (len > 1? "," : ""), (unsigned long long) rec->seq);
+    }
+
+    EVRECORD_JSON_PUT("%s", "}");
+
+#undef EVRECORD_JSON_STR
+#undef EVRECORD_JSON_PUT
+
+    return (int) len;
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* EVRECORD_H_INCLUDED */
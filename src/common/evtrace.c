@@ -0,0 +1,299 @@
+/***********************************************************************
+* Copyright (c) 2018 pepstack, pepstack.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*   claim that you wrote the original software. If you use this software
+*   in a product, an acknowledgment in the product documentation would be
+*   appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not be
+*   misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source distribution.
+***********************************************************************/
+
+/**
+ * @file: evtrace.c
+ *
+ * @create: 2018-11-23
+ * @update: 2018-11-23 16:20:08
+ */
+
+#include "evtrace.h"
+#include "log4c_logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+
+volatile int __evtrace_on = 0;
+
+const char * evtrace_stage_names[EVTRACE_STAGES] = {
+    "inotify",
+    "filter",
+    "enqueue",
+    "worker",
+    "lua",
+    "send",
+    "ack",
+    "srv_recv",
+    "srv_write",
+    "srv_ack"
+};
+
+
+static struct evtrace_ring_t
+{
+    evtrace_hdr_t *hdr;
+    evtrace_rec_t *recs;
+
+    size_t mapsize;
+
+    int sample;
+
+    volatile uint64_t counter;
+} evtrace_ring = {0};
+
+
+static size_t evtrace_mapsize (uint64_t capacity)
+{
+    return sizeof(evtrace_hdr_t) + (size_t) capacity * sizeof(evtrace_rec_t);
+}
+
+
+int evtrace_open (const char *ringfile, uint64_t capacity, int sample)
+{
+    int fd, fresh = 0;
+    struct stat st;
+    size_t mapsize;
+    void *addr;
+
+    if (evtrace_ring.hdr) {
+        LOGGER_WARN("evtrace already opened");
+        return 0;
+    }
+
+    if (capacity == 0 || sample <= 0) {
+        LOGGER_ERROR("invalid evtrace capacity(%ju) or sample(%d)", (uintmax_t) capacity, sample);
+        return -1;
+    }
+
+    mapsize = evtrace_mapsize(capacity);
+
+    fd = open(ringfile, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        LOGGER_ERROR("open error(%d): %s - %s", errno, strerror(errno), ringfile);
+        return -1;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        LOGGER_ERROR("fstat error(%d): %s - %s", errno, strerror(errno), ringfile);
+        close(fd);
+        return -1;
+    }
+
+    if ((size_t) st.st_size != mapsize) {
+        /* 新文件或者容量不同: 重建 */
+        if (ftruncate(fd, 0) == -1 || ftruncate(fd, (off_t) mapsize) == -1) {
+            LOGGER_ERROR("ftruncate error(%d): %s - %s", errno, strerror(errno), ringfile);
+            close(fd);
+            return -1;
+        }
+        fresh = 1;
+    }
+
+    addr = mmap(0, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        LOGGER_ERROR("mmap error(%d): %s - %s", errno, strerror(errno), ringfile);
+        return -1;
+    }
+
+    evtrace_ring.hdr = (evtrace_hdr_t *) addr;
+    evtrace_ring.recs = (evtrace_rec_t *) ((char *) addr + sizeof(evtrace_hdr_t));
+    evtrace_ring.mapsize = mapsize;
+    evtrace_ring.sample = sample;
+    evtrace_ring.counter = 0;
+
+    if (fresh || memcmp(evtrace_ring.hdr->magic, EVTRACE_MAGIC, 8) ||
+        evtrace_ring.hdr->version != EVTRACE_VERSION ||
+        evtrace_ring.hdr->recsize != sizeof(evtrace_rec_t) ||
+        evtrace_ring.hdr->capacity != capacity) {
+
+        memset(addr, 0, mapsize);
+
+        memcpy(evtrace_ring.hdr->magic, EVTRACE_MAGIC, 8);
+        evtrace_ring.hdr->version = EVTRACE_VERSION;
+        evtrace_ring.hdr->recsize = sizeof(evtrace_rec_t);
+        evtrace_ring.hdr->capacity = capacity;
+        evtrace_ring.hdr->head = 0;
+    }
+
+    __sync_synchronize();
+
+    __evtrace_on = 1;
+
+    LOGGER_INFO("evtrace ring: %s (capacity=%ju, sample=1/%d)", ringfile, (uintmax_t) capacity, sample);
+
+    return 0;
+}
+
+
+void evtrace_close (void)
+{
+    if (evtrace_ring.hdr) {
+        __evtrace_on = 0;
+
+        __sync_synchronize();
+
+        msync(evtrace_ring.hdr, evtrace_ring.mapsize, MS_ASYNC);
+        munmap(evtrace_ring.hdr, evtrace_ring.mapsize);
+
+        evtrace_ring.hdr = 0;
+        evtrace_ring.recs = 0;
+        evtrace_ring.mapsize = 0;
+    }
+}
+
+
+evtrace_rec_t * evtrace_begin (uint64_t id)
+{
+    evtrace_rec_t *rec;
+
+    if (! __evtrace_on) {
+        return 0;
+    }
+
+    if (evtrace_ring.sample > 1 &&
+        __sync_fetch_and_add(&evtrace_ring.counter, 1) % evtrace_ring.sample) {
+        return 0;
+    }
+
+    rec = (evtrace_rec_t *) calloc(1, sizeof(*rec));
+    if (rec) {
+        rec->id = id;
+        rec->pid = (uint32_t) getpid();
+    }
+
+    return rec;
+}
+
+
+void evtrace_commit (const evtrace_rec_t *rec)
+{
+    uint64_t seq;
+    evtrace_rec_t *slot;
+
+    if (! __evtrace_on || ! rec) {
+        return;
+    }
+
+    seq = __sync_fetch_and_add(&evtrace_ring.hdr->head, 1);
+
+    slot = &evtrace_ring.recs[seq % evtrace_ring.hdr->capacity];
+
+    /* 先清 seq, 读者看到 0 就跳过这条正在写的记录 */
+    slot->seq = 0;
+    __sync_synchronize();
+
+    slot->id = rec->id;
+    slot->pid = rec->pid;
+    slot->stages = rec->stages;
+    memcpy(slot->ts, rec->ts, sizeof(slot->ts));
+
+    __sync_synchronize();
+    slot->seq = seq + 1;
+}
+
+
+void evtrace_free (evtrace_rec_t *rec)
+{
+    if (rec) {
+        free(rec);
+    }
+}
+
+
+const evtrace_hdr_t * evtrace_ring_hdr (void)
+{
+    return evtrace_ring.hdr;
+}
+
+
+uint64_t evtrace_ring_foreach (const evtrace_hdr_t *hdr, evtrace_rec_cb cb, void *arg)
+{
+    uint64_t i, n = 0;
+
+    const evtrace_rec_t *recs = (const evtrace_rec_t *) ((const char *) hdr + sizeof(evtrace_hdr_t));
+
+    for (i = 0; i < hdr->capacity; i++) {
+        evtrace_rec_t rec;
+
+        uint64_t seq = recs[i].seq;
+
+        if (! seq) {
+            continue;
+        }
+
+        __sync_synchronize();
+        memcpy(&rec, &recs[i], sizeof(rec));
+        __sync_synchronize();
+
+        // 复制期间被写者覆盖
+        if (recs[i].seq != seq) {
+            continue;
+        }
+
+        rec.seq = seq;
+
+        cb(&rec, arg);
+        n++;
+    }
+
+    return n;
+}
+
+
+int evtrace_parse_option (const char *optarg, int *sample, char *file, int filesize, const char *deffile)
+{
+    char *endp = 0;
+    long rate;
+
+    rate = strtol(optarg, &endp, 10);
+
+    if (endp == optarg || rate <= 0 || rate > 0x7fffffff) {
+        return -1;
+    }
+
+    if (*endp == ',' && endp[1]) {
+        if (strlen(endp + 1) >= (size_t) filesize) {
+            return -1;
+        }
+        strcpy(file, endp + 1);
+    } else if (*endp == '\0') {
+        if (strlen(deffile) >= (size_t) filesize) {
+            return -1;
+        }
+        strcpy(file, deffile);
+    } else {
+        return -1;
+    }
+
+    *sample = (int) rate;
+
+    return 0;
+}
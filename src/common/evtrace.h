@@ -0,0 +1,219 @@
+/***********************************************************************
+* Copyright (c) 2018 pepstack, pepstack.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*   claim that you wrote the original software. If you use this software
+*   in a product, an acknowledgment in the product documentation would be
+*   appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not be
+*   misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source distribution.
+***********************************************************************/
+
+/**
+ * @file: evtrace.h
+ *   sampled per-event stage tracing into a binary ring file
+ *
+ *   被采样的事件在每个处理阶段记录单调时钟 (CLOCK_MONOTONIC, 纳秒).
+ *   事件处理完成时, 记录整体写入 mmap 的 ring 文件的一个槽位, 写满后
+ *   覆盖最旧的记录. 客户端和服务端各写自己的 ring 文件; 同一条记录
+ *   中的时间戳来自同一台主机, 所以阶段间的差值有意义.
+ *
+ *   ring 文件格式:
+ *     [evtrace_hdr_t][evtrace_rec_t * capacity]
+ *
+ *   记录的 seq 在其他字段写完之后才设置, 读者跳过 seq 为 0 或者
+ *   正在被覆盖的记录. 工具 xsync-evtrace 按阶段打印百分位.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-23
+ *
+ * @update: 2018-11-23 16:20:08
+ */
+
+#ifndef EVTRACE_H_INCLUDED
+#define EVTRACE_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+
+#define EVTRACE_MAGIC            "XSTRACE1"
+#define EVTRACE_VERSION          1
+
+/* 客户端阶段 */
+#define EVTRACE_INOTIFY          0    /* XS_client_bootstrap 读到 inotify 事件 */
+#define EVTRACE_FILTER           1    /* filter_watch_file 完成 */
+#define EVTRACE_ENQUEUE          2    /* client_add_inotify_event 加入任务队列 */
+#define EVTRACE_WORKER           3    /* do_event_task 开始 */
+#define EVTRACE_LUA              4    /* on_event_task() 完成 */
+#define EVTRACE_SEND             5    /* 开始向服务器发送文件 */
+#define EVTRACE_ACK              6    /* 全部服务器确认 */
+
+/* 服务端阶段 */
+#define EVTRACE_SRV_RECV         7    /* epcb_event_pollin 读完消息 */
+#define EVTRACE_SRV_WRITE        8    /* 数据交给存储 (写盘) 完成 */
+#define EVTRACE_SRV_ACK          9    /* 确认 (WINDOW) 已发送 */
+
+#define EVTRACE_STAGES           10
+
+
+typedef struct evtrace_hdr_t
+{
+    char magic[8];
+
+    uint32_t version;
+    uint32_t recsize;
+
+    uint64_t capacity;
+
+    /* 下一个写入的序号, 槽位 = (head % capacity) */
+    volatile uint64_t head;
+
+    char __pad[32];
+} evtrace_hdr_t;
+
+
+typedef struct evtrace_rec_t
+{
+    /* 写入序号 + 1. 0: 空槽或者正在写 */
+    volatile uint64_t seq;
+
+    /* 客户端: 事件序号; 服务端: 流 id */
+    uint64_t id;
+
+    uint32_t pid;
+
+    /* 已经记录的阶段的位图 */
+    uint32_t stages;
+
+    /* 每个阶段的时间 (纳秒), 未记录为 0 */
+    uint64_t ts[EVTRACE_STAGES];
+} evtrace_rec_t;
+
+
+/* 跟踪开关, 0 表示关闭 */
+extern volatile int __evtrace_on;
+
+extern const char * evtrace_stage_names[EVTRACE_STAGES];
+
+
+/**
+ * evtrace_open
+ *   创建或者打开 ring 文件并开始跟踪. 容量不同的已有文件被重建.
+ *
+ *   ringfile - ring 文件路径
+ *   capacity - 记录数
+ *   sample   - 每 sample 个事件跟踪 1 个 (1: 全部)
+ *
+ * returns:
+ *   0 - success
+ *  -1 - failed
+ */
+extern int evtrace_open (const char *ringfile, uint64_t capacity, int sample);
+
+
+extern void evtrace_close (void);
+
+
+/**
+ * evtrace_begin
+ *   按采样率决定是否跟踪一个事件. 返回 0 表示不跟踪.
+ *   返回的记录由 evtrace_end 写入并释放, 或者由 evtrace_free 丢弃.
+ */
+extern evtrace_rec_t * evtrace_begin (uint64_t id);
+
+
+/**
+ * evtrace_commit
+ *   把记录写入 ring 文件 (不释放记录)
+ */
+extern void evtrace_commit (const evtrace_rec_t *rec);
+
+
+extern void evtrace_free (evtrace_rec_t *rec);
+
+
+typedef void (*evtrace_rec_cb) (const evtrace_rec_t *rec, void *arg);
+
+
+/**
+ * evtrace_ring_hdr
+ *   当前打开的 ring (evtrace_open), 没有打开返回 0
+ */
+extern const evtrace_hdr_t * evtrace_ring_hdr (void);
+
+
+/**
+ * evtrace_ring_foreach
+ *   遍历 ring 中已经写完的记录 (hdr 指向映射的 ring 文件). 每条记录先
+ *   复制再回调, 复制期间被覆盖的记录跳过.
+ *
+ * returns:
+ *   回调的记录数
+ */
+extern uint64_t evtrace_ring_foreach (const evtrace_hdr_t *hdr, evtrace_rec_cb cb, void *arg);
+
+
+/**
+ * evtrace_parse_option
+ *   解析命令行参数 "RATE[,FILE]". 没有 FILE 时使用 deffile
+ *
+ * returns:
+ *   0 - success
+ *  -1 - invalid argument
+ */
+extern int evtrace_parse_option (const char *optarg, int *sample, char *file, int filesize, const char *deffile);
+
+
+__attribute__((unused))
+static inline uint64_t evtrace_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+
+__attribute__((unused))
+static inline void evtrace_stamp (evtrace_rec_t *rec, int stage)
+{
+    if (rec) {
+        rec->ts[stage] = evtrace_now_ns();
+        rec->stages |= (1U << stage);
+    }
+}
+
+
+__attribute__((unused))
+static inline void evtrace_end (evtrace_rec_t *rec)
+{
+    if (rec) {
+        evtrace_commit(rec);
+        evtrace_free(rec);
+    }
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* EVTRACE_H_INCLUDED */
@@ -4,7 +4,7 @@
  *
  * Author: master@pepstack.com
  *
- * Last Updated: 2016-07-20
+ * Last Updated: 2018-11-21
  */
 #include "hashmap.h"
 
@@ -12,8 +12,21 @@
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
 #define HMAP_INITIAL_SIZE (256)
-#define HMAP_CHAIN_LENGTH (8)
+
+/* slots per control byte group */
+#define HMAP_GROUP_WIDTH  (16)
+
+/* groups migrated from old table by each put/remove */
+#define HMAP_MIGRATE_GROUPS (2)
+
+/* control bytes: full slot holds 7 bits h2 (0x00~0x7F) */
+#define HMAP_CTRL_EMPTY   ((int8_t) 0x80)
+#define HMAP_CTRL_DELETED ((int8_t) 0xFE)
 
 /**
 * The compiler tries to warn you that you lose bits when casting from void *
@@ -29,25 +42,51 @@
 #define int_cast_to_pv(ival)    ((void*) (uintptr_t) (int) (ival))
 
 
-typedef enum _use_state {
-    unused_0 = 0,
-    used_1   = 1
-} use_state;
+/**
+ * A slot to keep key and value (32 bytes on 64-bit).
+ *   keylen < HMAP_KEY_INLINE: key copied into key.inl
+ *   otherwise key.ptr refers to caller's key storage
+ */
+typedef struct _hashmap_slot_t {
+    union {
+        char *ptr;
+        char  inl[HMAP_KEY_INLINE];
+    } key;
 
+    void_ptr  data;    /* pointer to value memory allocated by callee */
+
+    uint32_t  keylen;
+    uint32_t  h1;      /* hash >> 7, for migration without rehash */
+} hashmap_slot_t;
+
+
+/**
+ * ctrl[capacity] followed by slots[capacity] in one aligned block.
+ *   capacity is power of 2 and multiple of HMAP_GROUP_WIDTH.
+ */
+typedef struct _hashmap_table_t {
+    int capacity;
+    int groups_mask;
+    int size;
+    int growth_left;   /* EMPTY slots still usable before 7/8 load */
 
-/* A element to keep keys and values */
-typedef struct _hashmap_elem_t {
-    char       *key;   /* pointer to actual key storage */
-    use_state   used;  /* unused_0, used_1 */
-    void_ptr    data;  /* pointer to value memory allocated by callee */
-} hashmap_elem_t;
+    int8_t *ctrl;
+    hashmap_slot_t *slots;
+} hashmap_table_t;
 
 
-/* A hashmap has maximum size and current size, as well as the elems to hold */
+/**
+ * A hashmap has current table and the old one being migrated
+ */
 typedef struct _hashmap_map_t {
-    int table_size;
+    int hashfunc;
     int size;
-    hashmap_elem_t *elems;
+
+    hashmap_table_t tab;
+
+    /* old.ctrl != 0 while resizing */
+    hashmap_table_t old;
+    int migrate_group;
 } hashmap_map_t;
 
 
@@ -173,106 +212,353 @@ int get_int_hash(void * l, int hashsize)
  */
 int get_string_hash(const char* s, int slen, int hashsize)
 {
-    return get_int_hash((void*) int_cast_to_pv(crc32(s, slen)), hashsize);
+    return get_int_hash((void*) int_cast_to_pv(crc32((const unsigned char *) s, slen)), hashsize);
 }
 
 
 /**
- * Return the integer of the location in data to store the point to the item,
- *   or HMAP_E_OVERFLOW.
+ * MurmurHash64A, by Austin Appleby (public domain)
  */
-static int _hashmap_hash(hmap_t in, char* key)
+static uint64_t murmur_hash64a(const void *key, int len, uint64_t seed)
 {
-    int curr;
-    int i;
-    hashmap_elem_t *elem;
-    hashmap_map_t *m = (hashmap_map_t *) in;
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
 
-    /* If full, return immediately */
-    if (m->size >= (m->table_size/2)) {
-        return HMAP_E_OVERFLOW;
+    uint64_t h = seed ^ (len * m);
+
+    const unsigned char *data = (const unsigned char *) key;
+    const unsigned char *end = data + (len & ~7);
+
+    while (data != end) {
+        uint64_t k;
+        memcpy(&k, data, sizeof(k));
+        data += 8;
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
     }
 
-    /* Find the best index */
-    curr = get_string_hash(key, strlen(key), m->table_size);
+    switch (len & 7) {
+    case 7: h ^= (uint64_t) data[6] << 48;
+    case 6: h ^= (uint64_t) data[5] << 40;
+    case 5: h ^= (uint64_t) data[4] << 32;
+    case 4: h ^= (uint64_t) data[3] << 24;
+    case 3: h ^= (uint64_t) data[2] << 16;
+    case 2: h ^= (uint64_t) data[1] << 8;
+    case 1: h ^= (uint64_t) data[0];
+            h *= m;
+    };
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
 
-    /* Linear probing */
-    for (i = 0; i< HMAP_CHAIN_LENGTH; i++) {
-        elem = m->elems + curr;
-        if(elem->used == unused_0) {
-            return curr;
-        }
 
-        if(elem->used == used_1 && (!strcmp(elem->key, key))) {
-            return curr;
-        }
+/**
+ * FNV-1a 64
+ */
+static uint64_t fnv1a_hash64(const void *key, int len)
+{
+    const unsigned char *p = (const unsigned char *) key;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (len-- > 0) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+
+static uint64_t _hashmap_keyhash(const hashmap_map_t *m, const char *key, int keylen)
+{
+    uint32_t crc;
+
+    switch (m->hashfunc) {
+    case HMAP_HASH_FNV1A:
+        return fnv1a_hash64(key, keylen);
 
-        curr = (curr + 1) % m->table_size;
+    case HMAP_HASH_CRC32:
+        crc = crc32((const unsigned char *) key, keylen);
+        Jenkins_Mix_Key(crc);
+        return (uint64_t) crc * 0x9E3779B97F4A7C15ULL;
     }
-    return HMAP_E_OVERFLOW;
+
+    return murmur_hash64a(key, keylen, 0x5bd1e995);
 }
 
+
 /**
- * Doubles the size of the hashmap, and rehashes all the elements
+ * group matching: bit i set if ctrl[i] matches
  */
-static int _hashmap_rehash(hmap_t in)
+static inline uint32_t _group_match(const int8_t *ctrl, int8_t h2)
 {
+#if defined(__SSE2__)
+    __m128i g = _mm_load_si128((const __m128i *) ctrl);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), g));
+#else
     int i;
-    int old_size;
-    hashmap_elem_t *curr;
-    hashmap_elem_t *elem;
+    uint32_t bits = 0;
+    for (i = 0; i < HMAP_GROUP_WIDTH; i++) {
+        if (ctrl[i] == h2) {
+            bits |= (1U << i);
+        }
+    }
+    return bits;
+#endif
+}
 
-    /* Setup the new elements */
-    hashmap_map_t *m = (hashmap_map_t *) in;
-    hashmap_elem_t *temp = (hashmap_elem_t *) calloc(2 * m->table_size, sizeof(hashmap_elem_t));
-    if (!temp) {
+
+/* EMPTY (0x80) or DELETED (0xFE): the only ctrl bytes with sign bit set */
+static inline uint32_t _group_match_free(const int8_t *ctrl)
+{
+#if defined(__SSE2__)
+    return (uint32_t) _mm_movemask_epi8(_mm_load_si128((const __m128i *) ctrl));
+#else
+    int i;
+    uint32_t bits = 0;
+    for (i = 0; i < HMAP_GROUP_WIDTH; i++) {
+        if (ctrl[i] < 0) {
+            bits |= (1U << i);
+        }
+    }
+    return bits;
+#endif
+}
+
+
+#define _slot_key(slot)  \
+    ((slot)->keylen < HMAP_KEY_INLINE ? (const char *) (slot)->key.inl : (const char *) (slot)->key.ptr)
+
+
+static int _table_init(hashmap_table_t *t, int capacity)
+{
+    void *block;
+
+    if (posix_memalign(&block, 64, (size_t) capacity * (1 + sizeof(hashmap_slot_t))) != 0) {
         return HMAP_E_OUTMEM;
     }
 
-    /* Update the array */
-    curr = m->elems;
-    m->elems = temp;
+    t->capacity = capacity;
+    t->groups_mask = capacity / HMAP_GROUP_WIDTH - 1;
+    t->size = 0;
+    t->growth_left = capacity - capacity / 8;
 
-    /* Update the size */
-    old_size = m->table_size;
-    m->table_size = 2 * m->table_size;
-    m->size = 0;
+    t->ctrl = (int8_t *) block;
+    t->slots = (hashmap_slot_t *) (t->ctrl + capacity);
 
-    /* Rehash the elements */
-    for (i = 0; i < old_size; i++){
-        int status;
-        elem = curr + i;
-        if (elem->used == unused_0) {
-            continue;
+    memset(t->ctrl, HMAP_CTRL_EMPTY, capacity);
+
+    return HMAP_S_OK;
+}
+
+
+static void _table_free(hashmap_table_t *t)
+{
+    free(t->ctrl);
+    memset(t, 0, sizeof(*t));
+}
+
+
+/**
+ * Return the slot index of key in table t, or -1 if not found.
+ *   probes whole groups in triangular sequence, which visits every
+ *   group once since group count is power of 2.
+ */
+static int _table_find(const hashmap_table_t *t, uint64_t hash, const char *key, uint32_t keylen)
+{
+    uint32_t g, step;
+    int8_t h2 = (int8_t) (hash & 0x7F);
+
+    if (! t->ctrl) {
+        return -1;
+    }
+
+    g = (uint32_t) (hash >> 7) & t->groups_mask;
+
+    for (step = 0; step <= (uint32_t) t->groups_mask; step++) {
+        const int8_t *ctrl = t->ctrl + g * HMAP_GROUP_WIDTH;
+
+        uint32_t bits = _group_match(ctrl, h2);
+
+        while (bits) {
+            int i = g * HMAP_GROUP_WIDTH + __builtin_ctz(bits);
+            const hashmap_slot_t *slot = t->slots + i;
+
+            if (slot->keylen == keylen && ! memcmp(_slot_key(slot), key, keylen)) {
+                return i;
+            }
+
+            bits &= bits - 1;
         }
-        status = hashmap_put(m, elem->key, elem->data);
-        if (status != HMAP_S_OK) {
-            return status;
+
+        if (_group_match(ctrl, HMAP_CTRL_EMPTY)) {
+            return -1;
         }
+
+        g = (g + step + 1) & t->groups_mask;
     }
 
-    free(curr);
+    return -1;
+}
+
+
+/**
+ * Insert a slot known to be absent. caller makes sure growth_left > 0
+ *   or a DELETED slot exists.
+ */
+static hashmap_slot_t * _table_insert(hashmap_table_t *t, uint32_t h1, int8_t h2)
+{
+    uint32_t g, step;
+
+    g = h1 & t->groups_mask;
+
+    for (step = 0; step <= (uint32_t) t->groups_mask; step++) {
+        int8_t *ctrl = t->ctrl + g * HMAP_GROUP_WIDTH;
+
+        uint32_t bits = _group_match_free(ctrl);
+
+        if (bits) {
+            int i = __builtin_ctz(bits);
+
+            if (ctrl[i] == HMAP_CTRL_EMPTY) {
+                t->growth_left--;
+            }
+
+            ctrl[i] = h2;
+            t->size++;
+
+            return t->slots + g * HMAP_GROUP_WIDTH + i;
+        }
+
+        g = (g + step + 1) & t->groups_mask;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Erase slot i. it may become EMPTY again if its group has an EMPTY:
+ *   probing would have stopped at this group anyway.
+ */
+static void _table_erase(hashmap_table_t *t, int i)
+{
+    const int8_t *group = t->ctrl + (i & ~(HMAP_GROUP_WIDTH - 1));
+
+    if (_group_match(group, HMAP_CTRL_EMPTY)) {
+        t->ctrl[i] = HMAP_CTRL_EMPTY;
+        t->growth_left++;
+    } else {
+        t->ctrl[i] = HMAP_CTRL_DELETED;
+    }
+
+    t->size--;
+}
+
+
+/**
+ * Move up to ngroups groups from old table into current table.
+ *   migrated slots are marked DELETED in old so lookups stay correct.
+ */
+static void _hashmap_migrate(hashmap_map_t *m, int ngroups)
+{
+    hashmap_table_t *old = &m->old;
+
+    if (! old->ctrl) {
+        return;
+    }
+
+    while (ngroups-- > 0 && m->migrate_group <= old->groups_mask) {
+        int i, base = m->migrate_group++ * HMAP_GROUP_WIDTH;
+
+        for (i = base; i < base + HMAP_GROUP_WIDTH; i++) {
+            int8_t h2 = old->ctrl[i];
+
+            if (h2 >= 0) {
+                hashmap_slot_t *slot = _table_insert(&m->tab, old->slots[i].h1, h2);
+                *slot = old->slots[i];
+
+                old->ctrl[i] = HMAP_CTRL_DELETED;
+                old->size--;
+            }
+        }
+    }
+
+    if (m->migrate_group > old->groups_mask) {
+        _table_free(old);
+        m->migrate_group = 0;
+    }
+}
+
+
+/**
+ * Start resizing: current table becomes old one and is migrated in
+ *   later calls. keeps capacity if most used slots are tombstones.
+ */
+static int _hashmap_grow(hashmap_map_t *m)
+{
+    hashmap_table_t tab;
+
+    int capacity = m->tab.capacity;
+
+    /* finish previous resizing first */
+    _hashmap_migrate(m, m->old.groups_mask + 1);
+
+    if (m->tab.size > capacity * 7 / 16) {
+        capacity *= 2;
+    }
+
+    if (_table_init(&tab, capacity) != HMAP_S_OK) {
+        return HMAP_E_OUTMEM;
+    }
+
+    m->old = m->tab;
+    m->tab = tab;
+    m->migrate_group = 0;
+
+    _hashmap_migrate(m, HMAP_MIGRATE_GROUPS);
+
     return HMAP_S_OK;
 }
 
+
 /**
  * Create an empty hashmap
  */
 hmap_t hashmap_create()
 {
-    hashmap_map_t* m = (hashmap_map_t*) malloc(sizeof(hashmap_map_t));
+    return hashmap_create_ex(HMAP_HASH_DEFAULT, HMAP_INITIAL_SIZE);
+}
+
+
+hmap_t hashmap_create_ex(int hashfunc, int initsize)
+{
+    int capacity = HMAP_GROUP_WIDTH;
+
+    hashmap_map_t* m = (hashmap_map_t*) calloc(1, sizeof(hashmap_map_t));
     if (!m) {
         exit(HMAP_E_OUTMEM);
     }
 
-    m->elems = (hashmap_elem_t*) calloc(HMAP_INITIAL_SIZE, sizeof(hashmap_elem_t));
-    if (! m->elems) {
+    while (capacity < initsize) {
+        capacity *= 2;
+    }
+
+    if (_table_init(&m->tab, capacity) != HMAP_S_OK) {
         free(m);
         exit(HMAP_E_OUTMEM);
     }
 
-    m->table_size = HMAP_INITIAL_SIZE;
-    m->size = 0;
+    m->hashfunc = hashfunc;
 
     return m;
 }
@@ -305,30 +591,41 @@ char* ptr_addr_to_key(void_ptr ptr, char* key)
  */
 int hashmap_put(hmap_t in, char* key, void_ptr value)
 {
-    int index;
-    hashmap_map_t *m;
-    hashmap_elem_t *elem;
+    uint64_t hash;
+    uint32_t keylen;
+    hashmap_slot_t *slot;
+
+    hashmap_map_t *m = (hashmap_map_t *) in;
 
-    m = (hashmap_map_t *) in;
+    keylen = (uint32_t) strlen(key);
+    hash = _hashmap_keyhash(m, key, keylen);
+
+    _hashmap_migrate(m, HMAP_MIGRATE_GROUPS);
+
+    if (_table_find(&m->tab, hash, key, keylen) != -1 ||
+        _table_find(&m->old, hash, key, keylen) != -1) {
+        /* Find a repeated key */
+        return HMAP_E_KEYUSED;
+    }
 
-    /* Find a place to put our value */
-    index = _hashmap_hash(in, key);
-    while (index == HMAP_E_OVERFLOW) {
-        if (_hashmap_rehash(in) == HMAP_E_OUTMEM) {
+    if (m->tab.growth_left == 0) {
+        if (_hashmap_grow(m) != HMAP_S_OK) {
             return HMAP_E_OUTMEM;
         }
-        index = _hashmap_hash(in, key);
     }
 
-    /* Set the elems */
-    elem = m->elems + index;
-    if (elem->used == used_1) {
-        /* Find a repeated key */
-        return HMAP_E_KEYUSED;
+    slot = _table_insert(&m->tab, (uint32_t) (hash >> 7), (int8_t) (hash & 0x7F));
+
+    if (keylen < HMAP_KEY_INLINE) {
+        memcpy(slot->key.inl, key, keylen + 1);
+    } else {
+        slot->key.ptr = key;  /* only set to a reference */
     }
-    elem->data = value;
-    elem->key = key;  /* only set to a reference */
-    elem->used = used_1;
+
+    slot->data = value;
+    slot->keylen = keylen;
+    slot->h1 = (uint32_t) (hash >> 7);
+
     m->size++;
 
     return HMAP_S_OK;
@@ -339,26 +636,26 @@ int hashmap_put(hmap_t in, char* key, void_ptr value)
  */
 int hashmap_get(hmap_t in, const char* key, void_ptr *value)
 {
-    int curr;
     int i;
-    hashmap_map_t *m;
-    hashmap_elem_t *elem;
+    uint64_t hash;
+    uint32_t keylen;
 
-    m = (hashmap_map_t *) in;
+    hashmap_map_t *m = (hashmap_map_t *) in;
 
-    /* Find element location */
-    curr = get_string_hash(key, strlen(key), m->table_size);
+    keylen = (uint32_t) strlen(key);
+    hash = _hashmap_keyhash(m, key, keylen);
 
-    /* Linear probing, if necessary */
-    for (i = 0; i<HMAP_CHAIN_LENGTH; i++){
-        elem = m->elems + curr;
-        if (elem->used == used_1) {
-            if (!strcmp(elem->key, key)) {
-                *value = (elem->data);
-                return HMAP_S_OK;
-            }
-        }
-        curr = (curr + 1) % m->table_size;
+    /* get does not migrate: concurrent readers stay read-only */
+    i = _table_find(&m->tab, hash, key, keylen);
+    if (i != -1) {
+        *value = m->tab.slots[i].data;
+        return HMAP_S_OK;
+    }
+
+    i = _table_find(&m->old, hash, key, keylen);
+    if (i != -1) {
+        *value = m->old.slots[i].data;
+        return HMAP_S_OK;
     }
 
     *value = 0;
@@ -372,20 +669,26 @@ int hashmap_get(hmap_t in, const char* key, void_ptr *value)
  */
 int hashmap_iterate(hmap_t in, hmap_callback_func fnIterValue, void_ptr arg)
 {
-    int i;
-    hashmap_elem_t *elem;
+    int i, t;
     hashmap_map_t *m = (hashmap_map_t*) in;
 
     if (hashmap_size(m) <= 0) {
         return HMAP_E_NOTFOUND;
     }
 
-    for (i = 0; i< m->table_size; i++) {
-        elem = m->elems+i;
-        if (elem->used == used_1) {
-            int status = fnIterValue(elem->data, arg);
-            if (status != HMAP_S_OK) {
-                return status;
+    for (t = 0; t < 2; t++) {
+        hashmap_table_t *tab = (t == 0 ? &m->tab : &m->old);
+
+        if (! tab->ctrl) {
+            continue;
+        }
+
+        for (i = 0; i < tab->capacity; i++) {
+            if (tab->ctrl[i] >= 0) {
+                int status = fnIterValue(tab->slots[i].data, arg);
+                if (status != HMAP_S_OK) {
+                    return status;
+                }
             }
         }
     }
@@ -397,40 +700,38 @@ int hashmap_iterate(hmap_t in, hmap_callback_func fnIterValue, void_ptr arg)
  */
 int hashmap_remove(hmap_t in, char* key, void_ptr *outValue)
 {
-    int i, curr;
-    hashmap_map_t* m;
-    hashmap_elem_t *elem;
+    int i, t;
+    uint64_t hash;
+    uint32_t keylen;
 
-    /* Cast the hashmap */
-    m = (hashmap_map_t *) in;
+    hashmap_map_t* m = (hashmap_map_t *) in;
 
     if (outValue) {
         *outValue = 0;
     }
 
-    /* Find key */
-    curr = get_string_hash(key, strlen(key), m->table_size);
+    keylen = (uint32_t) strlen(key);
+    hash = _hashmap_keyhash(m, key, keylen);
 
-    /* Linear probing, if necessary */
-    for (i = 0; i < HMAP_CHAIN_LENGTH; i++){
-        elem = m->elems + curr;
-        if (elem->used == used_1){
-            if (! strcmp(elem->key, key)){
-                /* Blank out the fields */
-                elem->used = unused_0;
-                elem->key = 0;
-                if (outValue) {
-                    *outValue = elem->data;
-                }
-                elem->data = 0;
+    _hashmap_migrate(m, HMAP_MIGRATE_GROUPS);
 
-                /* Reduce the size */
-                m->size--;
-                return HMAP_S_OK;
+    for (t = 0; t < 2; t++) {
+        hashmap_table_t *tab = (t == 0 ? &m->tab : &m->old);
+
+        i = _table_find(tab, hash, key, keylen);
+        if (i != -1) {
+            if (outValue) {
+                *outValue = tab->slots[i].data;
             }
+
+            _table_erase(tab, i);
+
+            /* Reduce the size */
+            m->size--;
+            return HMAP_S_OK;
         }
-        curr = (curr + 1) % m->table_size;
     }
+
     /* Data not found */
     return HMAP_E_NOTFOUND;
 }
@@ -440,23 +741,35 @@ int hashmap_remove(hmap_t in, char* key, void_ptr *outValue)
  */
 void hashmap_clear(hmap_t in, hmap_callback_func fnFreeValue, void_ptr arg)
 {
-    hashmap_elem_t *elem;
-    void_ptr data;
+    int i;
     hashmap_map_t* m = (hashmap_map_t*) in;
 
-    while (m->table_size-->0) {
-        elem = m->elems+(m->table_size);
-        if (elem->used == used_1) {
-            elem->used = unused_0;
-            elem->key = 0;
-            data = elem->data;
-            elem->data = 0;
+    if (m->old.ctrl) {
+        if (fnFreeValue) {
+            for (i = 0; i < m->old.capacity; i++) {
+                if (m->old.ctrl[i] >= 0) {
+                    fnFreeValue(m->old.slots[i].data, arg);
+                }
+            }
+        }
+
+        _table_free(&m->old);
+        m->migrate_group = 0;
+    }
 
-            if (fnFreeValue) {
-                fnFreeValue(data, arg);
+    if (fnFreeValue) {
+        for (i = 0; i < m->tab.capacity; i++) {
+            if (m->tab.ctrl[i] >= 0) {
+                fnFreeValue(m->tab.slots[i].data, arg);
             }
         }
     }
+
+    memset(m->tab.ctrl, HMAP_CTRL_EMPTY, m->tab.capacity);
+    m->tab.size = 0;
+    m->tab.growth_left = m->tab.capacity - m->tab.capacity / 8;
+
+    m->size = 0;
 }
 
 /**
@@ -464,8 +777,10 @@ void hashmap_clear(hmap_t in, hmap_callback_func fnFreeValue, void_ptr arg)
  */
 void hashmap_destroy(hmap_t in, hmap_callback_func fnFreeValue, void_ptr arg)
 {
+    hashmap_map_t* m = (hashmap_map_t*) in;
+
     hashmap_clear(in, fnFreeValue, arg);
-    free(((hashmap_map_t *) in)->elems);
+    _table_free(&m->tab);
     free(in);
 }
 
@@ -2,9 +2,16 @@
  * hashmap.h
  *    Generic hash map declaration
  *
+ *    open addressing with 16-slot control byte groups (SwissTable),
+ *    probed with SSE2 where available. keys shorter than
+ *    HMAP_KEY_INLINE are copied into the slot, longer keys are kept
+ *    by reference as before. the table grows incrementally: each
+ *    put/remove migrates a few groups from the old table, get never
+ *    modifies the map.
+ *
  * Author: master@pepstack.com
  *
- * Last Updated: 2016-06-09
+ * Last Updated: 2018-11-21
  */
 #ifndef _HASHMAP_H_INCLUDED
 #define _HASHMAP_H_INCLUDED
@@ -22,6 +29,20 @@ extern "C" {
 #define HMAP_E_FAIL     (-1)     /* Hashmap api fail */
 #define HMAP_S_OK       (0)      /* Success */
 
+/**
+ * hash functions for string keys
+ */
+#define HMAP_HASH_MURMUR64A  0   /* MurmurHash64A (default) */
+#define HMAP_HASH_FNV1A      1   /* FNV-1a 64 */
+#define HMAP_HASH_CRC32      2   /* crc32 + Jenkins mix, as get_string_hash() */
+
+#define HMAP_HASH_DEFAULT    HMAP_HASH_MURMUR64A
+
+/**
+ * keys shorter than this are stored inline in the slot
+ */
+#define HMAP_KEY_INLINE      16
+
 /**
  * void_ptr is a pointer. This allows you to put arbitrary structures in the hashmap.
  */
@@ -65,6 +86,11 @@ extern int get_string_hash(const char* keystring, int keystrlen, int hashsize);
  */
 extern hmap_t hashmap_create();
 
+/**
+ * Return an empty hashmap with given hash function and initial capacity.
+ */
+extern hmap_t hashmap_create_ex(int hashfunc, int initsize);
+
 /**
  * Iteratively call fn with argument (value, arg) for each element data
  * in the hashmap. The function returns anything other than HMAP_S_OK
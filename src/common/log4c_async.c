@@ -0,0 +1,1040 @@
+/***********************************************************************
+* Copyright (c) 2018 pepstack, pepstack.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*   claim that you wrote the original software. If you use this software
+*   in a product, an acknowledgment in the product documentation would be
+*   appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not be
+*   misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source distribution.
+***********************************************************************/
+
+/**
+ * @file: log4c_async.c
+ *
+ * @create: 2018-11-20
+ * @update: 2018-11-20 09:42:10
+ */
+
+#include "log4c_logger.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+
+volatile int __logger_async_on = 0;
+
+
+#define LOGREC_ALIGN      16
+#define LOGREC_WRAP       0x01
+#define LOGREC_TEXT       0x02
+
+#define LOGARG_INT        1
+#define LOGARG_LONG       2
+#define LOGARG_LLONG      3
+#define LOGARG_INTMAX     4
+#define LOGARG_SIZE       5
+#define LOGARG_PTRDIFF    6
+#define LOGARG_DOUBLE     7
+#define LOGARG_LDOUBLE    8
+#define LOGARG_PTR        9
+#define LOGARG_STR        10
+
+/* 一条记录中复制的字符串总长度上限, 超过则退化为文本记录 */
+#define LOGREC_STRS_MAX   (LOGGER_BUF_LEN * 2)
+
+
+typedef struct logrec_arg_t
+{
+    int type;
+
+    /* LOGARG_STR: 复制的字节数, -1 表示 NULL */
+    int len;
+
+    union {
+        long long i;
+        double d;
+        long double ld;
+        const void *p;
+        size_t off;
+    } v;
+} logrec_arg_t;
+
+
+/**
+ * logrec_t
+ *   ring 中的一条记录, 按 LOGREC_ALIGN 对齐:
+ *
+ *   [logrec_t][logrec_arg_t * nargs][%s 字符串 ...]
+ *   [logrec_t][文本\0]                              (LOGREC_TEXT)
+ *   [logrec_t.size]                                 (LOGREC_WRAP, 跳到 ring 开头)
+ */
+typedef struct logrec_t
+{
+    uint32_t size;
+    uint8_t flags;
+    uint8_t nargs;
+    uint16_t priority;
+
+    int line;
+
+    const char *color;
+    const char *file;
+    const char *func;
+    const char *fmt;
+
+    struct timeval ts;
+
+    logrec_arg_t args[0];
+} logrec_t;
+
+
+typedef struct logasync_ring_t
+{
+    struct logasync_ring_t *next;
+
+    /* 写线程 (消费者) 修改 tail, 所属线程 (生产者) 修改 head */
+    volatile uint64_t head;
+    char __pad1[64 - sizeof(uint64_t)];
+
+    volatile uint64_t tail;
+    char __pad2[64 - sizeof(uint64_t)];
+
+    /* 所属线程已经退出 */
+    volatile int closed;
+
+    volatile uint64_t dropped;
+    uint64_t dropped_reported;
+
+    size_t size;
+    size_t mask;
+
+    char *buf;
+} logasync_ring_t;
+
+
+static struct logasync_t
+{
+    volatile int started;
+    volatile int running;
+    volatile int stopping;
+    volatile int sleeping;
+
+    int policy;
+    size_t ringsize;
+
+    pthread_t thread;
+    pthread_key_t key;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    logasync_ring_t * volatile rings;
+
+    volatile uint64_t flush_req;
+    volatile uint64_t flush_done;
+
+    /* logfile: fd >= 0 */
+    int fd;
+    size_t outlen;
+    char *outbuf;
+    struct timeval flushed_at;
+
+    /* 缓存的日期时间串 (秒) */
+    time_t datetm_sec;
+    char datetm[32];
+} __logasync = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+
+static __thread logasync_ring_t *__logasync_ring = 0;
+
+
+__attribute__((unused))
+static inline size_t logrec_align (size_t size)
+{
+    return (size + LOGREC_ALIGN - 1) & ~((size_t) LOGREC_ALIGN - 1);
+}
+
+
+static void logasync_wakeup (void)
+{
+    if (__logasync.sleeping) {
+        pthread_mutex_lock(&__logasync.lock);
+        pthread_cond_signal(&__logasync.cond);
+        pthread_mutex_unlock(&__logasync.lock);
+    }
+}
+
+
+static void logasync_ring_closed (void *arg)
+{
+    logasync_ring_t *ring = (logasync_ring_t *) arg;
+
+    __sync_synchronize();
+    ring->closed = 1;
+}
+
+
+static logasync_ring_t * logasync_ring_get (void)
+{
+    logasync_ring_t *ring = __logasync_ring;
+
+    if (ring) {
+        return ring;
+    }
+
+    ring = (logasync_ring_t *) calloc(1, sizeof(*ring));
+    if (! ring) {
+        return 0;
+    }
+
+    if (posix_memalign((void **) &ring->buf, 64, __logasync.ringsize) != 0) {
+        free(ring);
+        return 0;
+    }
+
+    ring->size = __logasync.ringsize;
+    ring->mask = ring->size - 1;
+
+    pthread_setspecific(__logasync.key, ring);
+
+    do {
+        ring->next = __logasync.rings;
+    } while (! __sync_bool_compare_and_swap(&__logasync.rings, ring->next, ring));
+
+    __logasync_ring = ring;
+    return ring;
+}
+
+
+/**
+ * logfmt_spec
+ *   解析 p 处 ('%' 之后) 的一个转换说明
+ *
+ * returns:
+ *   转换字符之后的位置, 0 表示不支持延迟格式化
+ */
+static const char * logfmt_spec (const char *p, int *nstars, int *precision, char *lenmod, char *conv)
+{
+    *nstars = 0;
+    *precision = -1;
+    *lenmod = 0;
+
+    while (*p && strchr("-+ #0'I", *p)) {
+        p++;
+    }
+
+    if (*p == '*') {
+        (*nstars)++;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    if (*p == '.') {
+        p++;
+
+        if (*p == '*') {
+            /* precision 由参数给出 */
+            *precision = -2;
+            (*nstars)++;
+            p++;
+        } else {
+            *precision = 0;
+            while (*p >= '0' && *p <= '9') {
+                *precision = *precision * 10 + (*p++ - '0');
+            }
+        }
+    }
+
+    switch (*p) {
+    case 'h':
+        p++;
+        *lenmod = 'h';
+        if (*p == 'h') {
+            p++;
+        }
+        break;
+
+    case 'l':
+        p++;
+        *lenmod = 'l';
+        if (*p == 'l') {
+            p++;
+            *lenmod = 'q';
+        }
+        break;
+
+    case 'q':
+    case 'L':
+    case 'j':
+    case 'z':
+    case 't':
+        *lenmod = *p++;
+        break;
+    }
+
+    *conv = *p;
+
+    switch (*p) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+    case 'p':
+        return p + 1;
+
+    case 'c':
+    case 's':
+        /* 宽字符不支持 */
+        return (*lenmod == 'l')? 0 : p + 1;
+    }
+
+    /* %n, %m 以及未知的转换 */
+    return 0;
+}
+
+
+/**
+ * logfmt_capture
+ *   按格式串从 ap 中取出全部参数
+ *
+ * returns:
+ *   >= 0 - 需要复制的字符串总字节数 (含结尾 '\0')
+ *     -1 - 需要退化为文本记录
+ */
+static int logfmt_capture (const char *fmt, va_list ap, logrec_arg_t *args, const char **strs, int *nargs)
+{
+    int n = 0, strbytes = 0;
+
+    const char *p = fmt;
+
+    while ((p = strchr(p, '%')) != 0) {
+        int i, nstars, precision;
+        char lenmod, conv;
+
+        if (*++p == '%') {
+            p++;
+            continue;
+        }
+
+        p = logfmt_spec(p, &nstars, &precision, &lenmod, &conv);
+        if (! p || n + nstars + 1 > LOGGER_ASYNC_ARGS_MAX) {
+            return (-1);
+        }
+
+        for (i = 0; i < nstars; i++) {
+            args[n].type = LOGARG_INT;
+            args[n].v.i = va_arg(ap, int);
+            n++;
+        }
+
+        if (precision == -2) {
+            precision = (int) args[n - 1].v.i;
+
+            if (precision < 0) {
+                precision = -1;
+            }
+        }
+
+        switch (conv) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            switch (lenmod) {
+            case 'l':
+                args[n].type = LOGARG_LONG;
+                args[n].v.i = va_arg(ap, long);
+                break;
+            case 'q':
+            case 'L':
+                args[n].type = LOGARG_LLONG;
+                args[n].v.i = va_arg(ap, long long);
+                break;
+            case 'j':
+                args[n].type = LOGARG_INTMAX;
+                args[n].v.i = (long long) va_arg(ap, intmax_t);
+                break;
+            case 'z':
+                args[n].type = LOGARG_SIZE;
+                args[n].v.i = (long long) va_arg(ap, size_t);
+                break;
+            case 't':
+                args[n].type = LOGARG_PTRDIFF;
+                args[n].v.i = (long long) va_arg(ap, ptrdiff_t);
+                break;
+            default:
+                args[n].type = LOGARG_INT;
+                args[n].v.i = va_arg(ap, int);
+                break;
+            }
+            break;
+
+        case 'c':
+            args[n].type = LOGARG_INT;
+            args[n].v.i = va_arg(ap, int);
+            break;
+
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            if (lenmod == 'L') {
+                args[n].type = LOGARG_LDOUBLE;
+                args[n].v.ld = va_arg(ap, long double);
+            } else {
+                args[n].type = LOGARG_DOUBLE;
+                args[n].v.d = va_arg(ap, double);
+            }
+            break;
+
+        case 'p':
+            args[n].type = LOGARG_PTR;
+            args[n].v.p = va_arg(ap, const void *);
+            break;
+
+        case 's':
+            args[n].type = LOGARG_STR;
+            strs[n] = va_arg(ap, const char *);
+
+            if (! strs[n]) {
+                args[n].len = -1;
+            } else {
+                size_t len = (precision >= 0)? strnlen(strs[n], precision) : strlen(strs[n]);
+
+                if (len > LOGGER_BUF_LEN) {
+                    len = LOGGER_BUF_LEN;
+                }
+
+                args[n].len = (int) len;
+                strbytes += (int) len + 1;
+
+                if (strbytes > LOGREC_STRS_MAX) {
+                    return (-1);
+                }
+            }
+            break;
+        }
+
+        n++;
+    }
+
+    *nargs = n;
+    return strbytes;
+}
+
+
+/**
+ * logfmt_one
+ *   按一个转换说明格式化一个参数
+ */
+static int logfmt_one (char *out, size_t outsz, const char *spec, const logrec_t *rec,
+    const logrec_arg_t *stars, int nstars, const logrec_arg_t *arg)
+{
+    int s0 = (nstars > 0)? (int) stars[0].v.i : 0;
+    int s1 = (nstars > 1)? (int) stars[1].v.i : 0;
+
+#define LOGFMT_CALL(val)  \
+    ((nstars == 0)? snprintf(out, outsz, spec, val) : \
+     (nstars == 1)? snprintf(out, outsz, spec, s0, val) : \
+                    snprintf(out, outsz, spec, s0, s1, val))
+
+    switch (arg->type) {
+    case LOGARG_INT:
+        return LOGFMT_CALL((int) arg->v.i);
+    case LOGARG_LONG:
+        return LOGFMT_CALL((long) arg->v.i);
+    case LOGARG_LLONG:
+        return LOGFMT_CALL((long long) arg->v.i);
+    case LOGARG_INTMAX:
+        return LOGFMT_CALL((intmax_t) arg->v.i);
+    case LOGARG_SIZE:
+        return LOGFMT_CALL((size_t) arg->v.i);
+    case LOGARG_PTRDIFF:
+        return LOGFMT_CALL((ptrdiff_t) arg->v.i);
+    case LOGARG_DOUBLE:
+        return LOGFMT_CALL(arg->v.d);
+    case LOGARG_LDOUBLE:
+        return LOGFMT_CALL(arg->v.ld);
+    case LOGARG_PTR:
+        return LOGFMT_CALL(arg->v.p);
+    case LOGARG_STR:
+        return LOGFMT_CALL((arg->len < 0)? (const char *) 0 : ((const char *) rec + arg->v.off));
+    }
+
+#undef LOGFMT_CALL
+
+    return 0;
+}
+
+
+/**
+ * logrec_render
+ *   在写线程中把一条二进制记录格式化为消息文本
+ */
+static size_t logrec_render (const logrec_t *rec, char *msg, size_t msgsz)
+{
+    int ret;
+    size_t len = 0;
+
+    const char *p;
+    const logrec_arg_t *arg = rec->args;
+
+    /* 为结尾的颜色复位序列预留空间 */
+    msgsz -= 5;
+
+    if (rec->color) {
+        len += snprintf(msg, msgsz, "%s", rec->color);
+    }
+
+    if (rec->flags & LOGREC_TEXT) {
+        ret = snprintf(msg + len, msgsz - len, "%s", (const char *) rec->args);
+        len += (ret < 0)? 0 : (size_t) ret;
+        goto end_render;
+    }
+
+    p = rec->fmt;
+
+    while (*p && len < msgsz - 1) {
+        int nstars, precision;
+        char lenmod, conv;
+
+        const char *q;
+        char spec[48];
+
+        if (*p != '%') {
+            msg[len++] = *p++;
+            continue;
+        }
+
+        if (p[1] == '%') {
+            msg[len++] = '%';
+            p += 2;
+            continue;
+        }
+
+        q = logfmt_spec(p + 1, &nstars, &precision, &lenmod, &conv);
+        if (! q || q - p >= (ptrdiff_t) sizeof(spec) || arg + nstars >= rec->args + rec->nargs) {
+            /* 与 logfmt_capture 不一致, 不应发生 */
+            break;
+        }
+
+        memcpy(spec, p, q - p);
+        spec[q - p] = 0;
+
+        ret = logfmt_one(msg + len, msgsz - len, spec, rec, arg, nstars, arg + nstars);
+        if (ret > 0) {
+            len += ret;
+        }
+
+        arg += nstars + 1;
+        p = q;
+    }
+
+end_render:
+    if (len >= msgsz) {
+        len = msgsz - 1;
+    }
+
+    if (rec->color) {
+        memcpy(msg + len, "\033[0m", 5);
+        len += 4;
+    }
+
+    msg[len] = 0;
+    return len;
+}
+
+
+static void logasync_out_flush (void)
+{
+    size_t off = 0;
+
+    while (off < __logasync.outlen) {
+        ssize_t n = write(__logasync.fd, __logasync.outbuf + off, __logasync.outlen - off);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        off += (size_t) n;
+    }
+
+    __logasync.outlen = 0;
+    gettimeofday(&__logasync.flushed_at, 0);
+}
+
+
+static void logasync_out_line (const logrec_t *rec, const char *msg)
+{
+    int ret;
+    struct tm tm;
+
+    size_t avail = LOGGER_ASYNC_OUTBUF_SIZE - __logasync.outlen;
+
+    if (avail < LOGGER_BUF_LEN + 256) {
+        logasync_out_flush();
+        avail = LOGGER_ASYNC_OUTBUF_SIZE;
+    }
+
+    if (rec->ts.tv_sec != __logasync.datetm_sec) {
+        localtime_r(&rec->ts.tv_sec, &tm);
+        strftime(__logasync.datetm, sizeof(__logasync.datetm), "%Y%m%d %H:%M:%S", &tm);
+        __logasync.datetm_sec = rec->ts.tv_sec;
+    }
+
+    /* 与 log4c dated layout 一致 */
+    ret = snprintf(__logasync.outbuf + __logasync.outlen, avail, "%s.%03ld %-8s %s- (%s:%d) <%s> %s\n",
+            __logasync.datetm, (long) rec->ts.tv_usec / 1000,
+            log4c_priority_to_string(rec->priority),
+            log4c_category_get_name(__logger_cat_global),
+            rec->file, rec->line, rec->func, msg);
+
+    if (ret > 0) {
+        __logasync.outlen += ((size_t) ret < avail)? (size_t) ret : avail - 1;
+    }
+}
+
+
+static void logasync_emit (const logrec_t *rec)
+{
+    char msg[LOGGER_BUF_LEN + 1];
+
+    logrec_render(rec, msg, sizeof(msg));
+
+    if (__logasync.fd != -1) {
+        logasync_out_line(rec, msg);
+    } else {
+        logger_write(rec->priority, rec->file, rec->line, rec->func, msg);
+    }
+}
+
+
+static void logasync_report_dropped (logasync_ring_t *ring)
+{
+    uint64_t dropped = ring->dropped;
+
+    if (dropped != ring->dropped_reported) {
+        char msg[128];
+        logrec_t rec;
+
+        bzero(&rec, sizeof(rec));
+
+        rec.priority = LOG4C_PRIORITY_WARN;
+        rec.flags = LOGREC_TEXT;
+        rec.file = __FILE__;
+        rec.line = __LINE__;
+        rec.func = __FUNCTION__;
+        gettimeofday(&rec.ts, 0);
+
+        snprintf(msg, sizeof(msg), "%llu log records dropped (ring full)",
+            (unsigned long long) (dropped - ring->dropped_reported));
+
+        ring->dropped_reported = dropped;
+
+        if (__logasync.fd != -1) {
+            logasync_out_line(&rec, msg);
+        } else {
+            logger_write(rec.priority, rec.file, rec.line, rec.func, msg);
+        }
+    }
+}
+
+
+/**
+ * logasync_drain
+ *   写出 ring 中的全部记录
+ *
+ * returns:
+ *   写出的记录数
+ */
+static int logasync_drain (logasync_ring_t *ring)
+{
+    int count = 0;
+
+    uint64_t tail = ring->tail;
+    uint64_t head = ring->head;
+
+    __sync_synchronize();
+
+    while (tail != head) {
+        const logrec_t *rec = (const logrec_t *) (ring->buf + (tail & ring->mask));
+
+        if (! (rec->flags & LOGREC_WRAP)) {
+            logasync_emit(rec);
+            count++;
+        }
+
+        tail += rec->size;
+
+        __sync_synchronize();
+        ring->tail = tail;
+    }
+
+    logasync_report_dropped(ring);
+
+    return count;
+}
+
+
+static int logasync_drain_all (void)
+{
+    int count = 0;
+
+    logasync_ring_t *prev = 0;
+    logasync_ring_t *ring = __logasync.rings;
+
+    while (ring) {
+        logasync_ring_t *next = ring->next;
+
+        count += logasync_drain(ring);
+
+        /* 只有写线程摘除节点; 生产者只在表头插入, 所以不摘除表头 */
+        if (prev && ring->closed && ring->tail == ring->head) {
+            prev->next = next;
+
+            free(ring->buf);
+            free(ring);
+        } else {
+            prev = ring;
+        }
+
+        ring = next;
+    }
+
+    return count;
+}
+
+
+static void * logasync_writer (void *arg)
+{
+    for (;;) {
+        uint64_t req = __logasync.flush_req;
+
+        __sync_synchronize();
+
+        int count = logasync_drain_all();
+
+        if (__logasync.fd != -1 && __logasync.outlen) {
+            struct timeval now;
+            gettimeofday(&now, 0);
+
+            if (! count || req != __logasync.flush_done ||
+                (now.tv_sec - __logasync.flushed_at.tv_sec) * 1000 +
+                (now.tv_usec - __logasync.flushed_at.tv_usec) / 1000 >= LOGGER_ASYNC_FLUSH_MS) {
+                logasync_out_flush();
+            }
+        }
+
+        __logasync.flush_done = req;
+
+        if (count) {
+            continue;
+        }
+
+        if (__logasync.stopping) {
+            break;
+        }
+
+        pthread_mutex_lock(&__logasync.lock);
+        __logasync.sleeping = 1;
+
+        if (! __logasync.stopping && __logasync.flush_req == __logasync.flush_done) {
+            struct timespec abstime;
+
+            clock_gettime(CLOCK_REALTIME, &abstime);
+
+            abstime.tv_nsec += LOGGER_ASYNC_FLUSH_MS * 1000000L;
+            if (abstime.tv_nsec >= 1000000000L) {
+                abstime.tv_sec += abstime.tv_nsec / 1000000000L;
+                abstime.tv_nsec %= 1000000000L;
+            }
+
+            pthread_cond_timedwait(&__logasync.cond, &__logasync.lock, &abstime);
+        }
+
+        __logasync.sleeping = 0;
+        pthread_mutex_unlock(&__logasync.lock);
+    }
+
+    if (__logasync.fd != -1) {
+        logasync_out_flush();
+    }
+
+    return (void *) 0;
+}
+
+
+static void logasync_write_sync (int priority, const char *color, const char *file, int line, const char *func, const char *text)
+{
+    if (color) {
+        char msg[LOGGER_BUF_LEN + 1];
+
+        snprintf(msg, sizeof(msg), "%s%s\033[0m", color, text);
+        logger_write(priority, file, line, func, msg);
+    } else {
+        logger_write(priority, file, line, func, text);
+    }
+}
+
+
+int logger_async_policy_from_string (const char *policy)
+{
+    if (! policy || ! strcmp(policy, "drop")) {
+        return LOGGER_ASYNC_DROP;
+    }
+
+    if (! strcmp(policy, "block")) {
+        return LOGGER_ASYNC_BLOCK;
+    }
+
+    return (-1);
+}
+
+
+int logger_async_start (size_t ringsize, int policy, const char *logfile)
+{
+    if (! __sync_bool_compare_and_swap(&__logasync.started, 0, 1)) {
+        return 0;
+    }
+
+    if (! ringsize) {
+        ringsize = LOGGER_ASYNC_RINGSIZE;
+    }
+
+    if (ringsize < 65536 || (ringsize & (ringsize - 1))) {
+        printf("\n**** logger_async_start: ringsize must be power of 2 and not less than 65536.\n");
+        goto error_exit;
+    }
+
+    __logasync.ringsize = ringsize;
+    __logasync.policy = policy;
+
+    if (logfile && *logfile) {
+        __logasync.fd = open(logfile, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (__logasync.fd == -1) {
+            printf("\n**** logger_async_start: open(%s) error(%d): %s\n", logfile, errno, strerror(errno));
+            goto error_exit;
+        }
+
+        __logasync.outbuf = (char *) malloc(LOGGER_ASYNC_OUTBUF_SIZE);
+        if (! __logasync.outbuf) {
+            goto error_exit;
+        }
+
+        __logasync.outlen = 0;
+        gettimeofday(&__logasync.flushed_at, 0);
+    }
+
+    if (pthread_key_create(&__logasync.key, logasync_ring_closed) != 0) {
+        goto error_exit;
+    }
+
+    __logasync.stopping = 0;
+    __logasync.running = 1;
+
+    if (pthread_create(&__logasync.thread, 0, logasync_writer, 0) != 0) {
+        __logasync.running = 0;
+        pthread_key_delete(__logasync.key);
+        goto error_exit;
+    }
+
+    atexit(logger_async_stop);
+
+    __sync_synchronize();
+    __logger_async_on = 1;
+
+    printf("\n* logger_async_start(ringsize=%zu policy=%s logfile=%s) success.\n",
+        ringsize, (policy == LOGGER_ASYNC_BLOCK? "block" : "drop"), (logfile && *logfile)? logfile : "(log4c)");
+
+    return 0;
+
+error_exit:
+    if (__logasync.fd != -1) {
+        close(__logasync.fd);
+        __logasync.fd = -1;
+    }
+
+    free(__logasync.outbuf);
+    __logasync.outbuf = 0;
+
+    __logasync.started = 0;
+    return (-1);
+}
+
+
+void logger_async_stop (void)
+{
+    if (! __sync_bool_compare_and_swap(&__logasync.running, 1, 0)) {
+        return;
+    }
+
+    __logger_async_on = 0;
+
+    pthread_mutex_lock(&__logasync.lock);
+    __logasync.stopping = 1;
+    pthread_cond_signal(&__logasync.cond);
+    pthread_mutex_unlock(&__logasync.lock);
+
+    pthread_join(__logasync.thread, 0);
+
+    if (__logasync.fd != -1) {
+        close(__logasync.fd);
+        __logasync.fd = -1;
+    }
+
+    free(__logasync.outbuf);
+    __logasync.outbuf = 0;
+}
+
+
+void logger_async_flush (void)
+{
+    uint64_t req = __sync_add_and_fetch(&__logasync.flush_req, 1);
+
+    while (__logasync.running && __logasync.flush_done < req) {
+        pthread_mutex_lock(&__logasync.lock);
+        pthread_cond_signal(&__logasync.cond);
+        pthread_mutex_unlock(&__logasync.lock);
+
+        usleep(200);
+    }
+}
+
+
+void logger_async_log (int priority, const char *color,
+    const char *file, int line, const char *func, const char *fmt, ...)
+{
+    va_list ap, ap2;
+
+    int nargs = 0, strbytes, i;
+    size_t size;
+    uint64_t head;
+
+    logrec_arg_t args[LOGGER_ASYNC_ARGS_MAX];
+    const char *strs[LOGGER_ASYNC_ARGS_MAX];
+    char text[LOGGER_BUF_LEN + 1];
+
+    logrec_t *rec;
+    logasync_ring_t *ring = logasync_ring_get();
+
+    va_start(ap, fmt);
+    va_copy(ap2, ap);
+
+    strbytes = logfmt_capture(fmt, ap, args, strs, &nargs);
+
+    if (strbytes < 0 || ! ring) {
+        vsnprintf(text, sizeof(text), fmt, ap2);
+    }
+
+    va_end(ap2);
+    va_end(ap);
+
+    if (! ring) {
+        logasync_write_sync(priority, color, file, line, func, text);
+        return;
+    }
+
+    if (strbytes < 0) {
+        size = logrec_align(sizeof(logrec_t) + strlen(text) + 1);
+    } else {
+        size = logrec_align(sizeof(logrec_t) + sizeof(logrec_arg_t) * nargs + strbytes);
+    }
+
+    for (;;) {
+        /* 预留 size 字节. 尾部放不下时写入 LOGREC_WRAP 并从头开始 */
+        size_t pos, contig;
+        uint64_t tail, total;
+
+        head = ring->head;
+        tail = ring->tail;
+
+        __sync_synchronize();
+
+        pos = (size_t) (head & ring->mask);
+        contig = ring->size - pos;
+        total = (size > contig)? size + contig : size;
+
+        if (head + total - tail <= ring->size) {
+            if (size > contig) {
+                rec = (logrec_t *) (ring->buf + pos);
+                rec->size = (uint32_t) contig;
+                rec->flags = LOGREC_WRAP;
+                pos = 0;
+            }
+
+            rec = (logrec_t *) (ring->buf + pos);
+            head += total;
+            break;
+        }
+
+        if (__logasync.policy != LOGGER_ASYNC_BLOCK || ! __logasync.running) {
+            ring->dropped++;
+            logasync_wakeup();
+            return;
+        }
+
+        logasync_wakeup();
+        sched_yield();
+    }
+
+    rec->size = (uint32_t) size;
+    rec->flags = 0;
+    rec->priority = (uint16_t) priority;
+    rec->line = line;
+    rec->color = color;
+    rec->file = file;
+    rec->func = func;
+    rec->fmt = fmt;
+
+    gettimeofday(&rec->ts, 0);
+
+    if (strbytes < 0) {
+        rec->flags = LOGREC_TEXT;
+        rec->nargs = 0;
+        strcpy((char *) rec->args, text);
+    } else {
+        size_t off = sizeof(logrec_t) + sizeof(logrec_arg_t) * nargs;
+
+        rec->nargs = (uint8_t) nargs;
+
+        for (i = 0; i < nargs; i++) {
+            rec->args[i] = args[i];
+
+            if (args[i].type == LOGARG_STR && args[i].len >= 0) {
+                memcpy((char *) rec + off, strs[i], args[i].len);
+                ((char *) rec)[off + args[i].len] = 0;
+
+                rec->args[i].v.off = off;
+                off += args[i].len + 1;
+            }
+        }
+    }
+
+    __sync_synchronize();
+    ring->head = head;
+
+    if (priority <= LOG4C_PRIORITY_FATAL) {
+        logger_async_flush();
+    } else if ((head - ring->tail) > (ring->size >> 1)) {
+        logasync_wakeup();
+    }
+}
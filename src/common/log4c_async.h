@@ -0,0 +1,138 @@
+/***********************************************************************
+* Copyright (c) 2018 pepstack, pepstack.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*   claim that you wrote the original software. If you use this software
+*   in a product, an acknowledgment in the product documentation would be
+*   appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not be
+*   misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source distribution.
+***********************************************************************/
+
+/**
+ * @file: log4c_async.h
+ *   asynchronous backend for LOGGER_* macros
+ *
+ *   每个写日志的线程拥有一个无锁单生产者/单消费者环形缓冲 (ring).
+ *   LOGGER_* 在调用线程只保存二进制记录: 格式串指针 + 参数值
+ *   (%s 参数复制字符串内容), 不做 snprintf, 不调用 log4c.
+ *   唯一的后台写线程取出记录, 格式化后写入 log4c 或者以大块 write
+ *   追加到指定的日志文件.
+ *
+ *   格式串必须是字面常量 (LOGGER_* 宏总是满足). 遇到 %n, %m, %ls
+ *   等无法延迟格式化的转换, 退化为在调用线程格式化为文本记录.
+ *
+ *   ring 满时的策略:
+ *     LOGGER_ASYNC_DROP  - 丢弃记录, 计数后由写线程报告
+ *     LOGGER_ASYNC_BLOCK - 唤醒写线程, 等待空间
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-20
+ *
+ * @update: 2018-11-20 09:42:10
+ */
+
+#ifndef LOG4C_ASYNC_H_INCLUDED
+#define LOG4C_ASYNC_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+#define LOGGER_ASYNC_DROP      0
+#define LOGGER_ASYNC_BLOCK     1
+
+/* 每线程 ring 缺省大小 (必须是 2 的幂) */
+#ifndef LOGGER_ASYNC_RINGSIZE
+#  define LOGGER_ASYNC_RINGSIZE         262144
+#endif
+
+/* 写线程空闲时的刷新间隔 */
+#ifndef LOGGER_ASYNC_FLUSH_MS
+#  define LOGGER_ASYNC_FLUSH_MS         50
+#endif
+
+/* 日志文件输出缓冲大小 */
+#ifndef LOGGER_ASYNC_OUTBUF_SIZE
+#  define LOGGER_ASYNC_OUTBUF_SIZE      262144
+#endif
+
+/* 一条记录最多的参数个数, 超过则退化为文本记录 */
+#ifndef LOGGER_ASYNC_ARGS_MAX
+#  define LOGGER_ASYNC_ARGS_MAX         24
+#endif
+
+
+/* 异步模式开关, 由 LOGGER_* 宏检查 */
+extern volatile int __logger_async_on;
+
+
+/**
+ * logger_async_start
+ *   启动后台写线程. 必须在 LOGGER_INIT 之后, 在 daemon() 之后调用
+ *   (fork 不复制线程).
+ *
+ *   ringsize - 每线程 ring 大小, 0 表示 LOGGER_ASYNC_RINGSIZE
+ *   policy   - LOGGER_ASYNC_DROP 或 LOGGER_ASYNC_BLOCK
+ *   logfile  - 0: 格式化后交给 log4c 的 appender;
+ *              否则以大块 write 直接追加到该文件
+ *
+ * returns:
+ *   0 - success
+ *  -1 - failed (仍然是同步模式)
+ */
+extern int logger_async_start (size_t ringsize, int policy, const char *logfile);
+
+
+/**
+ * logger_async_stop
+ *   写出全部记录后停止写线程, 恢复同步模式. 可重复调用.
+ */
+extern void logger_async_stop (void);
+
+
+/**
+ * logger_async_flush
+ *   等待调用时刻之前的全部记录被写出
+ */
+extern void logger_async_flush (void);
+
+
+/**
+ * logger_async_log
+ *   在调用线程的 ring 中保存一条记录. color 为 0 表示不带颜色.
+ */
+extern void logger_async_log (int priority, const char *color,
+    const char *file, int line, const char *func, const char *fmt, ...)
+    __attribute__((format(printf, 6, 7)));
+
+
+/**
+ * logger_async_policy_from_string
+ *   "drop" | "block" => LOGGER_ASYNC_DROP | LOGGER_ASYNC_BLOCK, 否则 -1
+ */
+extern int logger_async_policy_from_string (const char *policy);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* LOG4C_ASYNC_H_INCLUDED */
@@ -24,9 +24,10 @@
  *   - A wrapper for LOG4C
  *
  * create: 2014-08-01
- * update: 2018-09-28
+ * update: 2018-11-20
  * fixbug: 2018-01-31   'buf' as temp variable will cause conflicts with other files
  * fixbug: 2018-09-28   add log4c_logger.c for export global variable: __logger_cat_global
+ * update: 2018-11-20   asynchronous mode: see log4c_async.h
  *
  * 2015-11-17: add color output
  * ------ color output ------
@@ -57,6 +58,8 @@
 
 #include <log4c.h>
 
+#include "log4c_async.h"
+
 #ifndef LOGGER_BUF_LEN
     #define LOGGER_BUF_LEN  4410
 #endif
@@ -183,11 +186,21 @@ static void LOGGER_INIT ()
 __attribute__((unused))
 static void LOGGER_FINI ()
 {
+    logger_async_stop();
+
     printf("\n* log4c_fini.\n");
     log4c_fini();
 }
 
 
+/**
+ * LOGGER_ASYNC_LOG()
+ *   logger_async_start() 之后, 调用线程只保存记录, 由后台线程格式化输出
+ */
+#define LOGGER_ASYNC_LOG(priority, color, message, args...)  \
+    logger_async_log(priority, color, __FILE__, __LINE__, __FUNCTION__, message, ##args)
+
+
 /**
  * LOGGER_TRACE()
  */
@@ -196,10 +209,14 @@ static void LOGGER_FINI ()
 #else
     #define LOGGER_UNKNOWN(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_UNKNOWN)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
-            snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_UNKNOWN, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_UNKNOWN, 0, message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
+                snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_UNKNOWN, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #endif
 
@@ -209,10 +226,14 @@ static void LOGGER_FINI ()
 #else
 #   define LOGGER_TRACE(message, args...)  \
     if (logger_get_cat(LOG4C_PRIORITY_TRACE)) { \
-        char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
-        snprintf(__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
-        __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-        logger_write (LOG4C_PRIORITY_TRACE, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+        if (__logger_async_on) { \
+            LOGGER_ASYNC_LOG(LOG4C_PRIORITY_TRACE, 0, message, ##args); \
+        } else { \
+            char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
+            snprintf(__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
+            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+            logger_write (LOG4C_PRIORITY_TRACE, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+        } \
     }
 #endif
 
@@ -226,21 +247,29 @@ static void LOGGER_FINI ()
 #if defined(LOGGER_COLOR_OUTPUT)
     #define LOGGER_DEBUG(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_DEBUG)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
-            char *__psz_logger_buf = __logger_buf_tmp; \
-            __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[36m"); \
-            __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
-            snprintf(__psz_logger_buf, 20, "\033[0m"); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_DEBUG, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_DEBUG, "\033[36m", message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
+                char *__psz_logger_buf = __logger_buf_tmp; \
+                __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[36m"); \
+                __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
+                snprintf(__psz_logger_buf, 20, "\033[0m"); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_DEBUG, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #else
     #define LOGGER_DEBUG(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_DEBUG)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
-            snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_DEBUG, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_DEBUG, 0, message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
+                snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_DEBUG, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #endif
 #endif
@@ -255,21 +284,29 @@ static void LOGGER_FINI ()
 #if defined(LOGGER_COLOR_OUTPUT)
     #define LOGGER_INFO(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_INFO)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
-            char *__psz_logger_buf = __logger_buf_tmp; \
-            __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[32m"); \
-            __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
-            snprintf(__psz_logger_buf, 20, "\033[0m"); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_INFO, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_INFO, "\033[32m", message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
+                char *__psz_logger_buf = __logger_buf_tmp; \
+                __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[32m"); \
+                __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
+                snprintf(__psz_logger_buf, 20, "\033[0m"); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_INFO, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #else
     #define LOGGER_INFO(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_INFO)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
-            snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_INFO, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_INFO, 0, message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
+                snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_INFO, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #endif
 #endif
@@ -284,21 +321,29 @@ static void LOGGER_FINI ()
 #if defined(LOGGER_COLOR_OUTPUT)
     #define LOGGER_NOTICE(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_NOTICE)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
-            char *__psz_logger_buf = __logger_buf_tmp; \
-            __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[1;36m"); \
-            __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
-            snprintf(__psz_logger_buf, 20, "\033[0m"); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_NOTICE, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_NOTICE, "\033[1;36m", message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
+                char *__psz_logger_buf = __logger_buf_tmp; \
+                __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[1;36m"); \
+                __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
+                snprintf(__psz_logger_buf, 20, "\033[0m"); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_NOTICE, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #else
     #define LOGGER_NOTICE(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_NOTICE)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
-            snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_NOTICE, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_NOTICE, 0, message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
+                snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_NOTICE, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #endif
 #endif
@@ -313,21 +358,29 @@ static void LOGGER_FINI ()
 #if defined(LOGGER_COLOR_OUTPUT)
     #define LOGGER_WARN(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_WARN)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
-            char *__psz_logger_buf = __logger_buf_tmp; \
-            __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[33m"); \
-            __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
-            snprintf(__psz_logger_buf, 20, "\033[0m"); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_WARN, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_WARN, "\033[33m", message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
+                char *__psz_logger_buf = __logger_buf_tmp; \
+                __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[33m"); \
+                __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
+                snprintf(__psz_logger_buf, 20, "\033[0m"); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_WARN, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #else
     #define LOGGER_WARN(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_WARN)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
-            snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_WARN, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_WARN, 0, message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
+                snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_WARN, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #endif
 #endif
@@ -342,21 +395,29 @@ static void LOGGER_FINI ()
 #if defined(LOGGER_COLOR_OUTPUT)
     #define LOGGER_ERROR(message, args...)    \
         if (logger_get_cat(LOG4C_PRIORITY_ERROR)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
-            char *__psz_logger_buf = __logger_buf_tmp; \
-            __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[31m"); \
-            __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
-            snprintf(__psz_logger_buf, 20, "\033[0m"); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_ERROR, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_ERROR, "\033[31m", message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
+                char *__psz_logger_buf = __logger_buf_tmp; \
+                __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[31m"); \
+                __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
+                snprintf(__psz_logger_buf, 20, "\033[0m"); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_ERROR, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #else
     #define LOGGER_ERROR(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_ERROR)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
-            snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_ERROR, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_ERROR, 0, message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
+                snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_ERROR, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #endif
 #endif
@@ -371,21 +432,29 @@ static void LOGGER_FINI ()
 #if defined(LOGGER_COLOR_OUTPUT)
     #define LOGGER_FATAL(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_FATAL)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
-            char *__psz_logger_buf = __logger_buf_tmp; \
-            __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[31m"); \
-            __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
-            snprintf(__psz_logger_buf, 20, "\033[0m"); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_FATAL, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_FATAL, "\033[31m", message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN + 1]; \
+                char *__psz_logger_buf = __logger_buf_tmp; \
+                __psz_logger_buf = __logger_buf_tmp + snprintf(__psz_logger_buf, 20, "\033[31m"); \
+                __psz_logger_buf = __psz_logger_buf + snprintf(__psz_logger_buf, LOGGER_BUF_LEN - 20, message, ##args); \
+                snprintf(__psz_logger_buf, 20, "\033[0m"); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_FATAL, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #else
     #define LOGGER_FATAL(message, args...)  \
         if (logger_get_cat(LOG4C_PRIORITY_FATAL)) { \
-            char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
-            snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
-            __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
-            logger_write (LOG4C_PRIORITY_FATAL, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            if (__logger_async_on) { \
+                LOGGER_ASYNC_LOG(LOG4C_PRIORITY_FATAL, 0, message, ##args); \
+            } else { \
+                char __logger_buf_tmp[LOGGER_BUF_LEN+1]; \
+                snprintf (__logger_buf_tmp, LOGGER_BUF_LEN, message, ##args); \
+                __logger_buf_tmp[LOGGER_BUF_LEN] = 0; \
+                logger_write (LOG4C_PRIORITY_FATAL, __FILE__, __LINE__, __FUNCTION__, __logger_buf_tmp); \
+            } \
         }
 #endif
 #endif
@@ -0,0 +1,659 @@
+/***********************************************************************
+* Copyright (c) 2018 pepstack, pepstack.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*   claim that you wrote the original software. If you use this software
+*   in a product, an acknowledgment in the product documentation would be
+*   appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not be
+*   misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source distribution.
+***********************************************************************/
+
+/**
+ * @file: metrics.c
+ *
+ * @create: 2018-11-22
+ * @update: 2018-11-24 10:12:36
+ */
+
+#include "metrics.h"
+#include "log4c_logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+
+#define METRICS_NAME_MAXLEN    63
+#define METRICS_HELP_MAXLEN    127
+
+/* 统计服务: 请求读超时和 accept 轮询间隔 */
+#define METRICS_SERVE_TIMEO_MS   1000
+#define METRICS_SERVE_POLL_MS    500
+
+
+typedef struct metrics_entry_t
+{
+    int type;
+
+    /* 在同类指标中的序号 (即 id) */
+    int slot;
+
+    metrics_gauge_cb cb;
+    void *arg;
+
+    char name[METRICS_NAME_MAXLEN + 1];
+    char help[METRICS_HELP_MAXLEN + 1];
+} metrics_entry_t;
+
+
+static struct metrics_registry_t
+{
+    pthread_mutex_t lock;
+    pthread_key_t key;
+    int key_ok;
+
+    int nentries;
+    int ncounters;
+    int ngauges;
+    int nhists;
+
+    metrics_entry_t entries[METRICS_MAX];
+
+    volatile int64_t gauges[METRICS_GAUGES_MAX];
+
+    metrics_shard_t * volatile shards;
+
+    /* 统计服务 */
+    volatile int serving;
+    int listenfd;
+    pthread_t thread;
+    char unixpath[108];
+} __metrics = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .listenfd = -1
+};
+
+
+__thread metrics_shard_t * __metrics_shard = 0;
+
+
+static void metrics_shard_detach (void *arg)
+{
+    metrics_shard_t *shard = (metrics_shard_t *) arg;
+
+    __sync_synchronize();
+    shard->inuse = 0;
+}
+
+
+metrics_shard_t * metrics_shard_attach (void)
+{
+    metrics_shard_t *shard;
+
+    if (__metrics_shard) {
+        return __metrics_shard;
+    }
+
+    if (! __metrics.key_ok) {
+        pthread_mutex_lock(&__metrics.lock);
+        if (! __metrics.key_ok && pthread_key_create(&__metrics.key, metrics_shard_detach) == 0) {
+            __sync_synchronize();
+            __metrics.key_ok = 1;
+        }
+        pthread_mutex_unlock(&__metrics.lock);
+    }
+
+    // 优先复用已经退出的线程的分片
+    for (shard = __metrics.shards; shard; shard = shard->next) {
+        if (! shard->inuse && __sync_bool_compare_and_swap(&shard->inuse, 0, 1)) {
+            break;
+        }
+    }
+
+    if (! shard) {
+        if (posix_memalign((void **) &shard, 64, sizeof(*shard)) != 0) {
+            return 0;
+        }
+        bzero(shard, sizeof(*shard));
+
+        shard->inuse = 1;
+
+        do {
+            shard->next = __metrics.shards;
+        } while (! __sync_bool_compare_and_swap(&__metrics.shards, shard->next, shard));
+    }
+
+    if (__metrics.key_ok) {
+        pthread_setspecific(__metrics.key, shard);
+    }
+
+    __metrics_shard = shard;
+    return shard;
+}
+
+
+static int metrics_register (int type, const char *name, const char *help, metrics_gauge_cb cb, void *arg)
+{
+    int i, slot = -1;
+
+    metrics_entry_t *entry;
+
+    if (! name || strlen(name) > METRICS_NAME_MAXLEN) {
+        return (-1);
+    }
+
+    pthread_mutex_lock(&__metrics.lock);
+
+    for (i = 0; i < __metrics.nentries; i++) {
+        entry = &__metrics.entries[i];
+
+        if (! strcmp(entry->name, name)) {
+            slot = (entry->type == type? entry->slot : -1);
+            goto unlock_return;
+        }
+    }
+
+    if (__metrics.nentries == METRICS_MAX) {
+        goto unlock_return;
+    }
+
+    if (type == METRICS_COUNTER) {
+        if (__metrics.ncounters < METRICS_COUNTERS_MAX) {
+            slot = __metrics.ncounters++;
+        }
+    } else if (type == METRICS_GAUGE) {
+        if (__metrics.ngauges < METRICS_GAUGES_MAX) {
+            slot = __metrics.ngauges++;
+        }
+    } else if (type == METRICS_HISTOGRAM) {
+        if (__metrics.nhists < METRICS_HISTOGRAMS_MAX) {
+            slot = __metrics.nhists++;
+        }
+    }
+
+    if (slot != -1) {
+        entry = &__metrics.entries[__metrics.nentries];
+
+        entry->type = type;
+        entry->slot = slot;
+        entry->cb = cb;
+        entry->arg = arg;
+
+        snprintf(entry->name, sizeof(entry->name), "%s", name);
+        snprintf(entry->help, sizeof(entry->help), "%s", help? help : name);
+
+        __sync_synchronize();
+        __metrics.nentries++;
+    }
+
+unlock_return:
+    pthread_mutex_unlock(&__metrics.lock);
+
+    if (slot == -1) {
+        LOGGER_WARN("metrics register fail: %s", name);
+    }
+
+    return slot;
+}
+
+
+int metrics_counter_register (const char *name, const char *help)
+{
+    return metrics_register(METRICS_COUNTER, name, help, 0, 0);
+}
+
+
+int metrics_gauge_register (const char *name, const char *help, metrics_gauge_cb cb, void *arg)
+{
+    return metrics_register(METRICS_GAUGE, name, help, cb, arg);
+}
+
+
+int metrics_histogram_register (const char *name, const char *help)
+{
+    return metrics_register(METRICS_HISTOGRAM, name, help, 0, 0);
+}
+
+
+void metrics_gauge_set (int id, int64_t value)
+{
+    if (id >= 0) {
+        __metrics.gauges[id] = value;
+    }
+}
+
+
+void metrics_gauge_add (int id, int64_t delta)
+{
+    if (id >= 0) {
+        __sync_add_and_fetch(&__metrics.gauges[id], delta);
+    }
+}
+
+
+uint64_t metrics_counter_get (int id)
+{
+    uint64_t value = 0;
+    metrics_shard_t *shard;
+
+    if (id >= 0) {
+        for (shard = __metrics.shards; shard; shard = shard->next) {
+            value += shard->counters[id];
+        }
+    }
+
+    return value;
+}
+
+
+uint64_t metrics_histogram_count (int id)
+{
+    int i;
+    uint64_t count = 0;
+    metrics_shard_t *shard;
+
+    if (id >= 0) {
+        for (shard = __metrics.shards; shard; shard = shard->next) {
+            for (i = 0; i < METRICS_HIST_BUCKETS; i++) {
+                count += shard->hists[id].buckets[i];
+            }
+        }
+    }
+
+    return count;
+}
+
+
+/**
+ * 桶 i 的上界 (微秒, 不含)
+ */
+static uint64_t metrics_hist_upper (int i)
+{
+    int e;
+
+    if (i < METRICS_HIST_SUBCOUNT) {
+        return (uint64_t) i + 1;
+    }
+
+    e = (i >> METRICS_HIST_SUBBITS) + METRICS_HIST_SUBBITS - 1;
+
+    return ((uint64_t) (METRICS_HIST_SUBCOUNT + (i & (METRICS_HIST_SUBCOUNT - 1))) + 1) << (e - METRICS_HIST_SUBBITS);
+}
+
+
+uint64_t metrics_histogram_quantile (int id, double q)
+{
+    int i;
+    uint64_t count = 0, cum = 0, rank;
+    metrics_shard_t *shard;
+
+    uint64_t buckets[METRICS_HIST_BUCKETS];
+
+    if (id < 0) {
+        return 0;
+    }
+
+    bzero(buckets, sizeof(buckets));
+
+    for (shard = __metrics.shards; shard; shard = shard->next) {
+        for (i = 0; i < METRICS_HIST_BUCKETS; i++) {
+            buckets[i] += shard->hists[id].buckets[i];
+        }
+    }
+
+    for (i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        count += buckets[i];
+    }
+
+    if (! count) {
+        return 0;
+    }
+
+    // 第 rank 个值 (从 1 开始) 所在的桶
+    rank = (uint64_t) (q * count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    } else if (rank > count) {
+        rank = count;
+    }
+
+    for (i = 0; i < METRICS_HIST_BUCKETS - 1; i++) {
+        cum += buckets[i];
+
+        if (cum >= rank) {
+            break;
+        }
+    }
+
+    return metrics_hist_upper(i);
+}
+
+
+static void metrics_render_hist (FILE *fp, const metrics_entry_t *entry)
+{
+    int i;
+    uint64_t sum = 0, cum = 0;
+    metrics_shard_t *shard;
+
+    uint64_t buckets[METRICS_HIST_BUCKETS];
+
+    bzero(buckets, sizeof(buckets));
+
+    for (shard = __metrics.shards; shard; shard = shard->next) {
+        const metrics_hist_t *hist = &shard->hists[entry->slot];
+
+        for (i = 0; i < METRICS_HIST_BUCKETS; i++) {
+            buckets[i] += hist->buckets[i];
+        }
+        sum += hist->sum;
+    }
+
+    // 只在每个 2 的幂区间的末尾输出 le, 保证每次抓取的 le 集合相同
+    for (i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        cum += buckets[i];
+
+        if ((i & (METRICS_HIST_SUBCOUNT - 1)) == METRICS_HIST_SUBCOUNT - 1 && i != METRICS_HIST_BUCKETS - 1) {
+            fprintf(fp, "%s_bucket{le=\"%.6f\"} %"PRIu64"\n", entry->name, metrics_hist_upper(i) / 1000000.0, cum);
+        }
+    }
+
+    fprintf(fp, "%s_bucket{le=\"+Inf\"} %"PRIu64"\n", entry->name, cum);
+    fprintf(fp, "%s_sum %.6f\n", entry->name, sum / 1000000.0);
+    fprintf(fp, "%s_count %"PRIu64"\n", entry->name, cum);
+}
+
+
+void metrics_render (FILE *fp)
+{
+    int i, n;
+
+    __sync_synchronize();
+    n = __metrics.nentries;
+
+    for (i = 0; i < n; i++) {
+        const metrics_entry_t *entry = &__metrics.entries[i];
+
+        fprintf(fp, "# HELP %s %s\n", entry->name, entry->help);
+
+        if (entry->type == METRICS_COUNTER) {
+            uint64_t value = 0;
+            metrics_shard_t *shard;
+
+            for (shard = __metrics.shards; shard; shard = shard->next) {
+                value += shard->counters[entry->slot];
+            }
+
+            fprintf(fp, "# TYPE %s counter\n%s %"PRIu64"\n", entry->name, entry->name, value);
+        } else if (entry->type == METRICS_GAUGE) {
+            int64_t value = (entry->cb? entry->cb(entry->arg) : __metrics.gauges[entry->slot]);
+
+            fprintf(fp, "# TYPE %s gauge\n%s %"PRId64"\n", entry->name, entry->name, value);
+        } else {
+            fprintf(fp, "# TYPE %s histogram\n", entry->name);
+
+            metrics_render_hist(fp, entry);
+        }
+    }
+}
+
+
+static int metrics_listen (const char *addr)
+{
+    int fd, err;
+
+    if (! strncmp(addr, "unix:", 5)) {
+        struct sockaddr_un sun;
+
+        const char *path = addr + 5;
+
+        if (! *path || strlen(path) >= sizeof(sun.sun_path)) {
+            LOGGER_ERROR("invalid metrics address: %s", addr);
+            return (-1);
+        }
+
+        bzero(&sun, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        memcpy(sun.sun_path, path, strlen(path));
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            LOGGER_ERROR("socket error(%d): %s", errno, strerror(errno));
+            return (-1);
+        }
+
+        // 删除上次运行遗留的套接字文件
+        unlink(path);
+
+        if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) == -1 || listen(fd, 16) == -1) {
+            LOGGER_ERROR("bind/listen error(%d): %s. (%s)", errno, strerror(errno), addr);
+            close(fd);
+            return (-1);
+        }
+
+        snprintf(__metrics.unixpath, sizeof(__metrics.unixpath), "%s", path);
+    } else {
+        int on = 1;
+
+        char host[256];
+        const char *port;
+
+        struct addrinfo hints, *res = 0;
+
+        port = strrchr(addr, ':');
+        if (port) {
+            snprintf(host, sizeof(host), "%.*s", (int) (port - addr), addr);
+            port++;
+        } else {
+            snprintf(host, sizeof(host), "127.0.0.1");
+            port = addr;
+        }
+
+        bzero(&hints, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+
+        err = getaddrinfo(*host? host : 0, port, &hints, &res);
+        if (err || ! res) {
+            LOGGER_ERROR("getaddrinfo error: %s. (%s)", gai_strerror(err), addr);
+            return (-1);
+        }
+
+        fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+        if (fd == -1) {
+            LOGGER_ERROR("socket error(%d): %s", errno, strerror(errno));
+            freeaddrinfo(res);
+            return (-1);
+        }
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if (bind(fd, res->ai_addr, res->ai_addrlen) == -1 || listen(fd, 16) == -1) {
+            LOGGER_ERROR("bind/listen error(%d): %s. (%s)", errno, strerror(errno), addr);
+            freeaddrinfo(res);
+            close(fd);
+            return (-1);
+        }
+
+        freeaddrinfo(res);
+    }
+
+    return fd;
+}
+
+
+static void metrics_serve_client (int fd)
+{
+    int len = 0;
+    char req[1024];
+
+    char *body = 0;
+    size_t bodylen = 0;
+    FILE *fp;
+
+    struct timeval tv = {
+        METRICS_SERVE_TIMEO_MS / 1000,
+        (METRICS_SERVE_TIMEO_MS % 1000) * 1000
+    };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // 读到请求头结束. 不关心请求的路径
+    while (len < (int) sizeof(req) - 1) {
+        ssize_t rc = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+
+        if (rc <= 0) {
+            if (rc < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        len += (int) rc;
+        req[len] = 0;
+
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) {
+            break;
+        }
+    }
+
+    fp = open_memstream(&body, &bodylen);
+    if (fp) {
+        char head[160];
+        int headlen;
+
+        metrics_render(fp);
+        fclose(fp);
+
+        headlen = snprintf(head, sizeof(head),
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %lu\r\n"
+            "Connection: close\r\n\r\n", (unsigned long) bodylen);
+
+        if (send(fd, head, headlen, MSG_NOSIGNAL) == headlen) {
+            size_t off = 0;
+
+            while (off < bodylen) {
+                ssize_t rc = send(fd, body + off, bodylen - off, MSG_NOSIGNAL);
+
+                if (rc <= 0) {
+                    if (rc < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+
+                off += (size_t) rc;
+            }
+        }
+
+        free(body);
+    }
+
+    close(fd);
+}
+
+
+static void * metrics_serve_thread (void *arg)
+{
+    struct pollfd pfd;
+
+    pfd.fd = __metrics.listenfd;
+    pfd.events = POLLIN;
+
+    while (__metrics.serving) {
+        int fd;
+
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, METRICS_SERVE_POLL_MS) <= 0) {
+            continue;
+        }
+
+        fd = accept(__metrics.listenfd, 0, 0);
+        if (fd == -1) {
+            continue;
+        }
+
+        metrics_serve_client(fd);
+    }
+
+    return 0;
+}
+
+
+int metrics_serve_start (const char *addr)
+{
+    int fd;
+
+    if (__metrics.serving) {
+        return 0;
+    }
+
+    fd = metrics_listen(addr);
+    if (fd == -1) {
+        return (-1);
+    }
+
+    __metrics.listenfd = fd;
+    __metrics.serving = 1;
+
+    if (pthread_create(&__metrics.thread, 0, metrics_serve_thread, 0) != 0) {
+        LOGGER_ERROR("pthread_create error(%d): %s", errno, strerror(errno));
+
+        __metrics.serving = 0;
+        __metrics.listenfd = -1;
+        close(fd);
+
+        if (__metrics.unixpath[0]) {
+            unlink(__metrics.unixpath);
+            __metrics.unixpath[0] = 0;
+        }
+
+        return (-1);
+    }
+
+    LOGGER_INFO("metrics serve on: %s", addr);
+    return 0;
+}
+
+
+void metrics_serve_stop (void)
+{
+    if (! __sync_bool_compare_and_swap(&__metrics.serving, 1, 0)) {
+        return;
+    }
+
+    pthread_join(__metrics.thread, 0);
+
+    close(__metrics.listenfd);
+    __metrics.listenfd = -1;
+
+    if (__metrics.unixpath[0]) {
+        unlink(__metrics.unixpath);
+        __metrics.unixpath[0] = 0;
+    }
+}
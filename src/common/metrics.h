@@ -0,0 +1,286 @@
+/***********************************************************************
+* Copyright (c) 2018 pepstack, pepstack.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*   claim that you wrote the original software. If you use this software
+*   in a product, an acknowledgment in the product documentation would be
+*   appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not be
+*   misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source distribution.
+***********************************************************************/
+
+/**
+ * @file: metrics.h
+ *   lock-free metrics registry with prometheus text exposition
+ *
+ *   counter 和 histogram 按线程分片 (shard): 每个线程只写自己的分片,
+ *   不加锁, 不使用原子指令. 导出时把全部分片相加. 线程退出后分片
+ *   留给新线程复用, 计数不丢失.
+ *
+ *   histogram 是 HDR 风格的对数-线性桶: 每个 2 的幂区间分为
+ *   METRICS_HIST_SUBCOUNT 个等宽子桶, 相对误差 < 1/METRICS_HIST_SUBCOUNT.
+ *   记录的值单位是微秒, 导出时换算为秒.
+ *
+ *   gauge 是全局值, 由 metrics_gauge_set/add 更新, 或者在导出时调用
+ *   注册的回调函数取值 (例如队列深度).
+ *
+ *   注册必须在工作线程启动之前完成. 未注册 (id = -1) 的指标的更新
+ *   操作为空操作.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-22
+ *
+ * @update: 2018-11-24 10:12:36
+ */
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+
+#define METRICS_COUNTER        1
+#define METRICS_GAUGE          2
+#define METRICS_HISTOGRAM      3
+
+/* 注册的指标总数上限 */
+#ifndef METRICS_MAX
+#  define METRICS_MAX                   64
+#endif
+
+#ifndef METRICS_COUNTERS_MAX
+#  define METRICS_COUNTERS_MAX          32
+#endif
+
+#ifndef METRICS_GAUGES_MAX
+#  define METRICS_GAUGES_MAX            16
+#endif
+
+#ifndef METRICS_HISTOGRAMS_MAX
+#  define METRICS_HISTOGRAMS_MAX        12
+#endif
+
+/* 每个 2 的幂区间的子桶数 = 2^METRICS_HIST_SUBBITS */
+#define METRICS_HIST_SUBBITS   3
+#define METRICS_HIST_SUBCOUNT  (1 << METRICS_HIST_SUBBITS)
+
+/* 最大可区分的值: 2^METRICS_HIST_MAXEXP 微秒 (约 12.7 天), 超过计入最后一个桶 */
+#define METRICS_HIST_MAXEXP    40
+
+#define METRICS_HIST_BUCKETS   ((METRICS_HIST_MAXEXP - METRICS_HIST_SUBBITS + 1) * METRICS_HIST_SUBCOUNT)
+
+
+typedef int64_t (*metrics_gauge_cb) (void *arg);
+
+
+typedef struct metrics_hist_t
+{
+    volatile uint64_t sum;
+    volatile uint64_t buckets[METRICS_HIST_BUCKETS];
+} metrics_hist_t;
+
+
+typedef struct metrics_shard_t
+{
+    struct metrics_shard_t *next;
+
+    /* 0: 所属线程已经退出, 可以被新线程复用 */
+    volatile int inuse;
+
+    volatile uint64_t counters[METRICS_COUNTERS_MAX];
+
+    metrics_hist_t hists[METRICS_HISTOGRAMS_MAX];
+} metrics_shard_t;
+
+
+extern __thread metrics_shard_t * __metrics_shard;
+
+extern metrics_shard_t * metrics_shard_attach (void);
+
+
+/**
+ * metrics_counter_register
+ * metrics_gauge_register
+ * metrics_histogram_register
+ *   注册指标. 同名的指标返回已经注册的 id.
+ *
+ *   name - prometheus 指标名, 例如 "xsync_client_events_received_total"
+ *   help - 说明文字
+ *   cb   - gauge 取值回调, 0 表示使用 metrics_gauge_set/add 的值
+ *
+ * returns:
+ *   id >= 0 - success
+ *   -1      - 超出容量或者类型冲突
+ */
+extern int metrics_counter_register (const char *name, const char *help);
+
+extern int metrics_gauge_register (const char *name, const char *help, metrics_gauge_cb cb, void *arg);
+
+extern int metrics_histogram_register (const char *name, const char *help);
+
+
+extern void metrics_gauge_set (int id, int64_t value);
+
+extern void metrics_gauge_add (int id, int64_t delta);
+
+
+/**
+ * metrics_counter_get
+ * metrics_histogram_count
+ *   读取 counter 的当前值和 histogram 的记录次数 (全部分片之和)
+ */
+extern uint64_t metrics_counter_get (int id);
+
+extern uint64_t metrics_histogram_count (int id);
+
+
+/**
+ * metrics_histogram_quantile
+ *   估算分位数 q (0 ~ 1), 返回所在桶的上界 (微秒). 没有记录返回 0
+ */
+extern uint64_t metrics_histogram_quantile (int id, double q);
+
+
+/**
+ * metrics_render
+ *   以 prometheus text format (version 0.0.4) 输出全部指标
+ */
+extern void metrics_render (FILE *fp);
+
+
+/**
+ * metrics_serve_start
+ *   启动本地统计服务线程. 对任意 GET 请求以 HTTP/1.0 返回 metrics_render
+ *   的内容 (prometheus 直接抓取, curl --unix-socket 也可以访问).
+ *
+ *   addr:
+ *     "unix:/path/to/xsync.sock"  - unix 域套接字
+ *     "host:port"                 - tcp
+ *     "port"                      - tcp 127.0.0.1:port
+ *
+ * returns:
+ *   0 - success
+ *  -1 - failed
+ */
+extern int metrics_serve_start (const char *addr);
+
+
+extern void metrics_serve_stop (void);
+
+
+__attribute__((unused))
+static inline metrics_shard_t * metrics_shard (void)
+{
+    metrics_shard_t *shard = __metrics_shard;
+
+    if (! shard) {
+        shard = metrics_shard_attach();
+    }
+
+    return shard;
+}
+
+
+__attribute__((unused))
+static inline uint64_t metrics_now_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+
+__attribute__((unused))
+static inline int metrics_hist_bucket (uint64_t value)
+{
+    int e;
+
+    if (value < METRICS_HIST_SUBCOUNT) {
+        return (int) value;
+    }
+
+    e = 63 - __builtin_clzll(value);
+
+    if (e >= METRICS_HIST_MAXEXP) {
+        return METRICS_HIST_BUCKETS - 1;
+    }
+
+    return ((e - METRICS_HIST_SUBBITS + 1) << METRICS_HIST_SUBBITS) +
+        (int) ((value >> (e - METRICS_HIST_SUBBITS)) & (METRICS_HIST_SUBCOUNT - 1));
+}
+
+
+__attribute__((unused))
+static inline void metrics_counter_add (int id, uint64_t n)
+{
+    metrics_shard_t *shard;
+
+    if (id >= 0 && (shard = metrics_shard()) != 0) {
+        shard->counters[id] += n;
+    }
+}
+
+
+__attribute__((unused))
+static inline void metrics_counter_inc (int id)
+{
+    metrics_counter_add(id, 1);
+}
+
+
+/**
+ * metrics_histogram_observe
+ *   记录一个值 (微秒)
+ */
+__attribute__((unused))
+static inline void metrics_histogram_observe (int id, uint64_t usec)
+{
+    metrics_shard_t *shard;
+
+    if (id >= 0 && (shard = metrics_shard()) != 0) {
+        metrics_hist_t *hist = &shard->hists[id];
+
+        hist->buckets[metrics_hist_bucket(usec)]++;
+        hist->sum += usec;
+    }
+}
+
+
+/**
+ * metrics_histogram_since
+ *   记录从 start_us (metrics_now_us) 到现在的时间
+ */
+__attribute__((unused))
+static inline void metrics_histogram_since (int id, uint64_t start_us)
+{
+    if (id >= 0) {
+        metrics_histogram_observe(id, metrics_now_us() - start_us);
+    }
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* METRICS_H_INCLUDED */
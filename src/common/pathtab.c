@@ -0,0 +1,646 @@
+/***********************************************************************
+* Copyright (c) 2018 pepstack, pepstack.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*   claim that you wrote the original software. If you use this software
+*   in a product, an acknowledgment in the product documentation would be
+*   appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not be
+*   misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source distribution.
+***********************************************************************/
+
+/**
+ * @file: pathtab.c
+ *   refcounted path interning table
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-25
+ *
+ * @update: 2018-11-25 11:08:46
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pathtab.h"
+
+
+/* 节点按块分配, 块内的节点地址不变. id = 块号 << PATHTAB_CHUNK_BITS | 块内序号 */
+#define PATHTAB_CHUNK_BITS      12
+#define PATHTAB_CHUNK_SIZE      (1 << PATHTAB_CHUNK_BITS)
+#define PATHTAB_CHUNK_MASK      (PATHTAB_CHUNK_SIZE - 1)
+
+#define PATHTAB_BUCKETS_MIN     1024
+
+#define PATHTAB_NAMELEN_MAX     65535
+
+
+typedef struct pathtab_node_t
+{
+    uint32_t parent;
+
+    /* 子节点数 + 调用者持有的引用数 */
+    volatile uint32_t refs;
+
+    /* 哈希链中的下一个节点; 空闲时为空闲链中的下一个 id */
+    uint32_t next;
+
+    uint32_t hash;
+
+    uint16_t namelen;
+
+    /* 1: 使用中, 0: 空闲 */
+    uint8_t live;
+    uint8_t reserved;
+
+    union {
+        char *ptr;
+        char buf[PATHTAB_INLINE_NAME + 1];
+    } name;
+} pathtab_node_t;
+
+
+struct pathtab_t
+{
+    pthread_rwlock_t lock;
+
+    pathtab_node_t **chunks;
+    uint32_t nchunks;
+    uint32_t maxchunks;
+
+    /* 从未使用过的下一个 id */
+    uint32_t nextid;
+
+    /* 释放的 id 链 */
+    uint32_t freelist;
+
+    uint32_t count;
+
+    /* 哈希索引: (parent, name) => id, nbuckets = 2^n */
+    uint32_t *buckets;
+    uint32_t nbuckets;
+
+    /* 超过 PATHTAB_INLINE_NAME 的名字占用的字节 */
+    size_t namebytes;
+};
+
+
+#define pathtab_node(tab, id)  \
+    (&(tab)->chunks[(id) >> PATHTAB_CHUNK_BITS][(id) & PATHTAB_CHUNK_MASK])
+
+#define pathtab_node_name(node)  \
+    ((node)->namelen > PATHTAB_INLINE_NAME? (node)->name.ptr : (node)->name.buf)
+
+
+static uint32_t pathtab_hash (uint32_t parent, const char *name, int namelen)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261U ^ parent;
+
+    while (namelen-- > 0) {
+        h ^= (uint8_t) *name++;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+
+static int pathtab_valid_id (const pathtab_t *tab, uint32_t id)
+{
+    return (id != PATHTAB_NONE && id < tab->nextid && pathtab_node(tab, id)->live);
+}
+
+
+static uint32_t pathtab_find_locked (const pathtab_t *tab, uint32_t parent, const char *name, int namelen, uint32_t hash)
+{
+    uint32_t id = tab->buckets[hash & (tab->nbuckets - 1)];
+
+    while (id) {
+        const pathtab_node_t *node = pathtab_node(tab, id);
+
+        if (node->hash == hash && node->parent == parent && node->namelen == namelen &&
+            ! memcmp(pathtab_node_name(node), name, namelen)) {
+            return id;
+        }
+
+        id = node->next;
+    }
+
+    return PATHTAB_NONE;
+}
+
+
+static void pathtab_rehash_locked (pathtab_t *tab)
+{
+    uint32_t id, nbuckets = tab->nbuckets * 2;
+
+    uint32_t *buckets = (uint32_t *) calloc(nbuckets, sizeof(uint32_t));
+
+    if (! buckets) {
+        /* 索引不扩大, 查找变慢但是仍然正确 */
+        return;
+    }
+
+    for (id = PATHTAB_ROOT; id < tab->nextid; id++) {
+        pathtab_node_t *node = pathtab_node(tab, id);
+
+        if (node->live) {
+            uint32_t *head = &buckets[node->hash & (nbuckets - 1)];
+
+            node->next = *head;
+            *head = id;
+        }
+    }
+
+    free(tab->buckets);
+
+    tab->buckets = buckets;
+    tab->nbuckets = nbuckets;
+}
+
+
+static uint32_t pathtab_alloc_id_locked (pathtab_t *tab)
+{
+    uint32_t id = tab->freelist;
+
+    if (id) {
+        tab->freelist = pathtab_node(tab, id)->next;
+        return id;
+    }
+
+    id = tab->nextid;
+
+    if ((id >> PATHTAB_CHUNK_BITS) == tab->nchunks) {
+        pathtab_node_t *chunk;
+
+        if (tab->nchunks == (UINT32_MAX >> PATHTAB_CHUNK_BITS)) {
+            return PATHTAB_NONE;
+        }
+
+        if (tab->nchunks == tab->maxchunks) {
+            uint32_t maxchunks = tab->maxchunks * 2;
+
+            pathtab_node_t **chunks = (pathtab_node_t **) realloc(tab->chunks, sizeof(pathtab_node_t *) * maxchunks);
+            if (! chunks) {
+                return PATHTAB_NONE;
+            }
+
+            tab->chunks = chunks;
+            tab->maxchunks = maxchunks;
+        }
+
+        chunk = (pathtab_node_t *) calloc(PATHTAB_CHUNK_SIZE, sizeof(pathtab_node_t));
+        if (! chunk) {
+            return PATHTAB_NONE;
+        }
+
+        tab->chunks[tab->nchunks++] = chunk;
+    }
+
+    tab->nextid++;
+
+    return id;
+}
+
+
+/**
+ * 创建节点, 引用计数为 0: 调用者在释放写锁之前必须增加引用
+ */
+static uint32_t pathtab_create_locked (pathtab_t *tab, uint32_t parent, const char *name, int namelen, uint32_t hash)
+{
+    uint32_t *head;
+    pathtab_node_t *node;
+
+    uint32_t id = pathtab_alloc_id_locked(tab);
+
+    if (! id) {
+        return PATHTAB_NONE;
+    }
+
+    node = pathtab_node(tab, id);
+
+    if (namelen > PATHTAB_INLINE_NAME) {
+        node->name.ptr = (char *) malloc(namelen + 1);
+
+        if (! node->name.ptr) {
+            node->next = tab->freelist;
+            tab->freelist = id;
+            return PATHTAB_NONE;
+        }
+
+        tab->namebytes += namelen + 1;
+    }
+
+    node->namelen = (uint16_t) namelen;
+
+    memcpy((char *) pathtab_node_name(node), name, namelen);
+    ((char *) pathtab_node_name(node))[namelen] = 0;
+
+    node->parent = parent;
+    node->refs = 0;
+    node->hash = hash;
+    node->live = 1;
+
+    head = &tab->buckets[hash & (tab->nbuckets - 1)];
+    node->next = *head;
+    *head = id;
+
+    if (parent) {
+        pathtab_node(tab, parent)->refs++;
+    }
+
+    if (++tab->count > tab->nbuckets) {
+        pathtab_rehash_locked(tab);
+    }
+
+    return id;
+}
+
+
+/**
+ * 删除引用计数为 0 的节点, 并释放它对父节点的引用
+ */
+static void pathtab_remove_locked (pathtab_t *tab, uint32_t id)
+{
+    while (id) {
+        uint32_t *link;
+        pathtab_node_t *node = pathtab_node(tab, id);
+
+        if (! node->live || node->refs) {
+            break;
+        }
+
+        link = &tab->buckets[node->hash & (tab->nbuckets - 1)];
+        while (*link != id) {
+            link = &pathtab_node(tab, *link)->next;
+        }
+        *link = node->next;
+
+        if (node->namelen > PATHTAB_INLINE_NAME) {
+            free(node->name.ptr);
+            tab->namebytes -= node->namelen + 1;
+        }
+
+        node->live = 0;
+        node->namelen = 0;
+
+        node->next = tab->freelist;
+        tab->freelist = id;
+
+        tab->count--;
+
+        id = node->parent;
+
+        if (id) {
+            pathtab_node(tab, id)->refs--;
+        }
+    }
+}
+
+
+pathtab_t * pathtab_create (void)
+{
+    pathtab_t *tab = (pathtab_t *) calloc(1, sizeof(pathtab_t));
+
+    if (! tab) {
+        return 0;
+    }
+
+    tab->maxchunks = 16;
+    tab->chunks = (pathtab_node_t **) calloc(tab->maxchunks, sizeof(pathtab_node_t *));
+
+    tab->nbuckets = PATHTAB_BUCKETS_MIN;
+    tab->buckets = (uint32_t *) calloc(tab->nbuckets, sizeof(uint32_t));
+
+    if (! tab->chunks || ! tab->buckets) {
+        free(tab->buckets);
+        free(tab->chunks);
+        free(tab);
+        return 0;
+    }
+
+    pthread_rwlock_init(&tab->lock, 0);
+
+    /* id 0 不使用 */
+    tab->nextid = PATHTAB_ROOT;
+
+    /* 根节点: 名字为空, 表自己持有一个引用, 永远不删除 */
+    if (pathtab_create_locked(tab, PATHTAB_NONE, "", 0, pathtab_hash(PATHTAB_NONE, "", 0)) != PATHTAB_ROOT) {
+        pathtab_free(tab);
+        return 0;
+    }
+
+    pathtab_node(tab, PATHTAB_ROOT)->refs = 1;
+
+    return tab;
+}
+
+
+void pathtab_free (pathtab_t *tab)
+{
+    uint32_t id;
+
+    if (! tab) {
+        return;
+    }
+
+    for (id = PATHTAB_ROOT; id < tab->nextid; id++) {
+        pathtab_node_t *node = pathtab_node(tab, id);
+
+        if (node->live && node->namelen > PATHTAB_INLINE_NAME) {
+            free(node->name.ptr);
+        }
+    }
+
+    while (tab->nchunks > 0) {
+        free(tab->chunks[--tab->nchunks]);
+    }
+
+    pthread_rwlock_destroy(&tab->lock);
+
+    free(tab->buckets);
+    free(tab->chunks);
+    free(tab);
+}
+
+
+uint32_t pathtab_intern (pathtab_t *tab, uint32_t parent, const char *name, int namelen)
+{
+    uint32_t id, hash;
+
+    if (namelen <= 0 || namelen > PATHTAB_NAMELEN_MAX || memchr(name, 0, namelen)) {
+        return PATHTAB_NONE;
+    }
+
+    hash = pathtab_hash(parent, name, namelen);
+
+    pthread_rwlock_rdlock(&tab->lock);
+
+    if (! pathtab_valid_id(tab, parent)) {
+        pthread_rwlock_unlock(&tab->lock);
+        return PATHTAB_NONE;
+    }
+
+    id = pathtab_find_locked(tab, parent, name, namelen, hash);
+
+    if (id) {
+        /* 读锁下其他读者可能同时增加引用 */
+        __sync_add_and_fetch(&pathtab_node(tab, id)->refs, 1);
+
+        pthread_rwlock_unlock(&tab->lock);
+        return id;
+    }
+
+    pthread_rwlock_unlock(&tab->lock);
+
+    pthread_rwlock_wrlock(&tab->lock);
+
+    id = pathtab_find_locked(tab, parent, name, namelen, hash);
+
+    if (! id && pathtab_valid_id(tab, parent)) {
+        id = pathtab_create_locked(tab, parent, name, namelen, hash);
+    }
+
+    if (id) {
+        pathtab_node(tab, id)->refs++;
+    }
+
+    pthread_rwlock_unlock(&tab->lock);
+
+    return id;
+}
+
+
+/**
+ * 逐级查找 (create = 0) 或者创建 (create = 1, 必须持有写锁) 路径的节点
+ */
+static uint32_t pathtab_walk_locked (pathtab_t *tab, const char *path, int pathlen, int create)
+{
+    int i = 0;
+
+    uint32_t id = PATHTAB_ROOT;
+
+    while (i < pathlen) {
+        int namelen;
+        uint32_t hash, child;
+        const char *name;
+
+        while (i < pathlen && path[i] == '/') {
+            i++;
+        }
+
+        name = path + i;
+
+        while (i < pathlen && path[i] != '/') {
+            i++;
+        }
+
+        namelen = (int) (path + i - name);
+
+        if (! namelen) {
+            break;
+        }
+
+        if (namelen > PATHTAB_NAMELEN_MAX) {
+            child = PATHTAB_NONE;
+        } else {
+            hash = pathtab_hash(id, name, namelen);
+
+            child = pathtab_find_locked(tab, id, name, namelen, hash);
+
+            if (! child && create) {
+                child = pathtab_create_locked(tab, id, name, namelen, hash);
+            }
+        }
+
+        if (! child) {
+            /* 删除本次创建的没有子节点的中间节点 */
+            if (create) {
+                pathtab_remove_locked(tab, id);
+            }
+
+            return PATHTAB_NONE;
+        }
+
+        id = child;
+    }
+
+    return id;
+}
+
+
+uint32_t pathtab_intern_path (pathtab_t *tab, const char *path, int pathlen)
+{
+    uint32_t id;
+
+    if (! path) {
+        return PATHTAB_NONE;
+    }
+
+    if (pathlen < 0) {
+        pathlen = (int) strlen(path);
+    }
+
+    if (pathlen == 0 || path[0] != '/' || memchr(path, 0, pathlen)) {
+        return PATHTAB_NONE;
+    }
+
+    pthread_rwlock_rdlock(&tab->lock);
+
+    id = pathtab_walk_locked(tab, path, pathlen, 0);
+
+    if (id) {
+        __sync_add_and_fetch(&pathtab_node(tab, id)->refs, 1);
+
+        pthread_rwlock_unlock(&tab->lock);
+        return id;
+    }
+
+    pthread_rwlock_unlock(&tab->lock);
+
+    pthread_rwlock_wrlock(&tab->lock);
+
+    id = pathtab_walk_locked(tab, path, pathlen, 1);
+
+    if (id) {
+        pathtab_node(tab, id)->refs++;
+    }
+
+    pthread_rwlock_unlock(&tab->lock);
+
+    return id;
+}
+
+
+void pathtab_ref (pathtab_t *tab, uint32_t id)
+{
+    pthread_rwlock_rdlock(&tab->lock);
+
+    if (pathtab_valid_id(tab, id)) {
+        __sync_add_and_fetch(&pathtab_node(tab, id)->refs, 1);
+    }
+
+    pthread_rwlock_unlock(&tab->lock);
+}
+
+
+void pathtab_release (pathtab_t *tab, uint32_t id)
+{
+    uint32_t refs = 1;
+
+    if (id == PATHTAB_NONE || id == PATHTAB_ROOT) {
+        /* 根节点由表持有, 对它的引用计数不需要精确 */
+        return;
+    }
+
+    pthread_rwlock_rdlock(&tab->lock);
+
+    if (pathtab_valid_id(tab, id)) {
+        refs = __sync_sub_and_fetch(&pathtab_node(tab, id)->refs, 1);
+    }
+
+    pthread_rwlock_unlock(&tab->lock);
+
+    if (! refs) {
+        /**
+         * 释放读锁之后节点可能又被引用 (或者已经被别的线程删除, id 被复用).
+         *   写锁下使用中并且引用为 0 的节点一定是应该删除的节点
+         */
+        pthread_rwlock_wrlock(&tab->lock);
+
+        pathtab_remove_locked(tab, id);
+
+        pthread_rwlock_unlock(&tab->lock);
+    }
+}
+
+
+uint32_t pathtab_parent (pathtab_t *tab, uint32_t id)
+{
+    uint32_t parent = PATHTAB_NONE;
+
+    pthread_rwlock_rdlock(&tab->lock);
+
+    if (pathtab_valid_id(tab, id)) {
+        parent = pathtab_node(tab, id)->parent;
+    }
+
+    pthread_rwlock_unlock(&tab->lock);
+
+    return parent;
+}
+
+
+int pathtab_path (pathtab_t *tab, uint32_t id, char *buf, int bufsize)
+{
+    int len = 0;
+    uint32_t up;
+
+    pthread_rwlock_rdlock(&tab->lock);
+
+    if (! pathtab_valid_id(tab, id)) {
+        pthread_rwlock_unlock(&tab->lock);
+        return (-1);
+    }
+
+    for (up = id; up != PATHTAB_ROOT; up = pathtab_node(tab, up)->parent) {
+        len += 1 + pathtab_node(tab, up)->namelen;
+    }
+
+    if (id == PATHTAB_ROOT) {
+        len = 1;
+    }
+
+    if (len >= bufsize) {
+        pthread_rwlock_unlock(&tab->lock);
+        return (-1);
+    }
+
+    buf[len] = 0;
+    buf[0] = '/';
+
+    /* 从叶节点向上, 由后向前填写 */
+    for (up = id, bufsize = len; up != PATHTAB_ROOT; up = pathtab_node(tab, up)->parent) {
+        const pathtab_node_t *node = pathtab_node(tab, up);
+
+        bufsize -= node->namelen;
+        memcpy(buf + bufsize, pathtab_node_name(node), node->namelen);
+
+        buf[--bufsize] = '/';
+    }
+
+    pthread_rwlock_unlock(&tab->lock);
+
+    return len;
+}
+
+
+uint32_t pathtab_count (pathtab_t *tab)
+{
+    return tab->count;
+}
+
+
+size_t pathtab_memory (pathtab_t *tab)
+{
+    return sizeof(pathtab_t) +
+        sizeof(pathtab_node_t *) * tab->maxchunks +
+        sizeof(pathtab_node_t) * PATHTAB_CHUNK_SIZE * tab->nchunks +
+        sizeof(uint32_t) * tab->nbuckets +
+        tab->namebytes;
+}
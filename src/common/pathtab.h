@@ -0,0 +1,134 @@
+/***********************************************************************
+* Copyright (c) 2018 pepstack, pepstack.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*   claim that you wrote the original software. If you use this software
+*   in a product, an acknowledgment in the product documentation would be
+*   appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not be
+*   misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source distribution.
+***********************************************************************/
+
+/**
+ * @file: pathtab.h
+ *   refcounted path interning table
+ *
+ *   路径按 '/' 分解为节点: 每个节点只保存父节点 id 和本级的名字. 同一
+ *   目录下的文件共用目录节点, 一个文件只占用一个节点 (几十字节), 而
+ *   不是一个完整路径的副本. 相同的路径总是得到相同的 id, 路径比较
+ *   变为整数比较.
+ *
+ *   节点有引用计数: 每个子节点引用父节点, 调用者持有的 id 也是引用.
+ *   最后一个引用释放时节点被删除, id 被复用.
+ *
+ *   查找在读锁下进行 (路径已经存在时不阻塞其他读者), 创建和删除节点
+ *   使用写锁.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-25
+ *
+ * @update: 2018-11-25 11:08:46
+ */
+
+#ifndef PATHTAB_H_INCLUDED
+#define PATHTAB_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/* 无效的 id */
+#define PATHTAB_NONE            0
+
+/* 根目录 "/" 的 id */
+#define PATHTAB_ROOT            1
+
+/* 名字不超过这个长度时保存在节点中, 不另外分配内存 */
+#define PATHTAB_INLINE_NAME     23
+
+
+typedef struct pathtab_t pathtab_t;
+
+
+extern pathtab_t * pathtab_create (void);
+
+extern void pathtab_free (pathtab_t *tab);
+
+
+/**
+ * pathtab_intern
+ *   取得 parent 下名为 name 的节点 (不存在则创建), 返回的 id 带有一个引用.
+ *
+ * returns:
+ *   id - success
+ *   PATHTAB_NONE - 参数无效或者内存不足
+ */
+extern uint32_t pathtab_intern (pathtab_t *tab, uint32_t parent, const char *name, int namelen);
+
+
+/**
+ * pathtab_intern_path
+ *   取得绝对路径的节点, 返回的 id 带有一个引用. 连续的 '/' 和结尾的 '/'
+ *   被忽略: "/var/log/" 和 "/var//log" 是同一个节点.
+ */
+extern uint32_t pathtab_intern_path (pathtab_t *tab, const char *path, int pathlen);
+
+
+extern void pathtab_ref (pathtab_t *tab, uint32_t id);
+
+extern void pathtab_release (pathtab_t *tab, uint32_t id);
+
+
+/**
+ * pathtab_parent
+ *   父节点的 id (不增加引用). 根节点返回 PATHTAB_NONE
+ */
+extern uint32_t pathtab_parent (pathtab_t *tab, uint32_t id);
+
+
+/**
+ * pathtab_path
+ *   还原 id 的绝对路径到 buf (以 '\0' 结尾). 根节点为 "/".
+ *
+ * returns:
+ *   路径的长度
+ *   -1 - id 无效或者 buf 空间不足
+ */
+extern int pathtab_path (pathtab_t *tab, uint32_t id, char *buf, int bufsize);
+
+
+/**
+ * pathtab_count
+ *   当前节点数目
+ */
+extern uint32_t pathtab_count (pathtab_t *tab);
+
+
+/**
+ * pathtab_memory
+ *   节点, 名字和索引占用的内存字节
+ */
+extern size_t pathtab_memory (pathtab_t *tab);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* PATHTAB_H_INCLUDED */
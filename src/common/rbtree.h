@@ -0,0 +1,535 @@
+/**
+ * rbtree.h
+ *  - intrusive red-black tree from Linux Kernel
+ *
+ * from linux-2.6.32: include/linux/rbtree.h, lib/rbtree.c
+ *   (C) 1999  Andrea Arcangeli <andrea@suse.de>
+ *   (C) 2002  David Woodhouse <dwmw2@infradead.org>
+ *
+ * the node is embedded in user object, so insert and erase never
+ *   allocate. typed find/insert are generated by RB_TREE_DEFINE() with
+ *   a static inline comparator, so comparisons are inlined.
+ *
+ * modified by cheungmine
+ * 2018-11-21
+ */
+#ifndef _RB_TREE_H
+#define _RB_TREE_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+
+struct rb_node
+{
+    unsigned long  rb_parent_color;
+#define RB_RED      0
+#define RB_BLACK    1
+    struct rb_node *rb_right;
+    struct rb_node *rb_left;
+} __attribute__((aligned(sizeof(long))));
+
+
+struct rb_root
+{
+    struct rb_node *rb_node;
+};
+
+
+#define rb_parent(r)    ((struct rb_node *)((r)->rb_parent_color & ~3))
+#define rb_color(r)     ((r)->rb_parent_color & 1)
+#define rb_is_red(r)    (!rb_color(r))
+#define rb_is_black(r)  rb_color(r)
+#define rb_set_red(r)   do { (r)->rb_parent_color &= ~1; } while (0)
+#define rb_set_black(r) do { (r)->rb_parent_color |= 1; } while (0)
+
+#define RB_ROOT_INIT        { 0 }
+#define RB_EMPTY_ROOT(root) ((root)->rb_node == 0)
+#define RB_EMPTY_NODE(node) (rb_parent(node) == node)
+#define RB_CLEAR_NODE(node) ((node)->rb_parent_color = (unsigned long) (node))
+
+#define rb_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+
+static inline void rb_set_parent(struct rb_node *rb, struct rb_node *p)
+{
+    rb->rb_parent_color = (rb->rb_parent_color & 3) | (unsigned long) p;
+}
+
+static inline void rb_set_color(struct rb_node *rb, int color)
+{
+    rb->rb_parent_color = (rb->rb_parent_color & ~1) | color;
+}
+
+static inline void rb_root_init(struct rb_root *root)
+{
+    root->rb_node = 0;
+}
+
+
+static inline void __rb_rotate_left(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *right = node->rb_right;
+    struct rb_node *parent = rb_parent(node);
+
+    if ((node->rb_right = right->rb_left)) {
+        rb_set_parent(right->rb_left, node);
+    }
+    right->rb_left = node;
+
+    rb_set_parent(right, parent);
+
+    if (parent) {
+        if (node == parent->rb_left) {
+            parent->rb_left = right;
+        } else {
+            parent->rb_right = right;
+        }
+    } else {
+        root->rb_node = right;
+    }
+    rb_set_parent(node, right);
+}
+
+
+static inline void __rb_rotate_right(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *left = node->rb_left;
+    struct rb_node *parent = rb_parent(node);
+
+    if ((node->rb_left = left->rb_right)) {
+        rb_set_parent(left->rb_right, node);
+    }
+    left->rb_right = node;
+
+    rb_set_parent(left, parent);
+
+    if (parent) {
+        if (node == parent->rb_right) {
+            parent->rb_right = left;
+        } else {
+            parent->rb_left = left;
+        }
+    } else {
+        root->rb_node = left;
+    }
+    rb_set_parent(node, left);
+}
+
+
+/**
+ * rebalance after rb_link_node()
+ */
+static inline void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *parent, *gparent;
+
+    while ((parent = rb_parent(node)) && rb_is_red(parent)) {
+        gparent = rb_parent(parent);
+
+        if (parent == gparent->rb_left) {
+            struct rb_node *uncle = gparent->rb_right;
+
+            if (uncle && rb_is_red(uncle)) {
+                rb_set_black(uncle);
+                rb_set_black(parent);
+                rb_set_red(gparent);
+                node = gparent;
+                continue;
+            }
+
+            if (parent->rb_right == node) {
+                struct rb_node *tmp;
+                __rb_rotate_left(parent, root);
+                tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+
+            rb_set_black(parent);
+            rb_set_red(gparent);
+            __rb_rotate_right(gparent, root);
+        } else {
+            struct rb_node *uncle = gparent->rb_left;
+
+            if (uncle && rb_is_red(uncle)) {
+                rb_set_black(uncle);
+                rb_set_black(parent);
+                rb_set_red(gparent);
+                node = gparent;
+                continue;
+            }
+
+            if (parent->rb_left == node) {
+                struct rb_node *tmp;
+                __rb_rotate_right(parent, root);
+                tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+
+            rb_set_black(parent);
+            rb_set_red(gparent);
+            __rb_rotate_left(gparent, root);
+        }
+    }
+
+    rb_set_black(root->rb_node);
+}
+
+
+static inline void __rb_erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root)
+{
+    struct rb_node *other;
+
+    while ((!node || rb_is_black(node)) && node != root->rb_node) {
+        if (parent->rb_left == node) {
+            other = parent->rb_right;
+
+            if (rb_is_red(other)) {
+                rb_set_black(other);
+                rb_set_red(parent);
+                __rb_rotate_left(parent, root);
+                other = parent->rb_right;
+            }
+
+            if ((!other->rb_left || rb_is_black(other->rb_left)) &&
+                (!other->rb_right || rb_is_black(other->rb_right))) {
+                rb_set_red(other);
+                node = parent;
+                parent = rb_parent(node);
+            } else {
+                if (!other->rb_right || rb_is_black(other->rb_right)) {
+                    rb_set_black(other->rb_left);
+                    rb_set_red(other);
+                    __rb_rotate_right(other, root);
+                    other = parent->rb_right;
+                }
+                rb_set_color(other, rb_color(parent));
+                rb_set_black(parent);
+                rb_set_black(other->rb_right);
+                __rb_rotate_left(parent, root);
+                node = root->rb_node;
+                break;
+            }
+        } else {
+            other = parent->rb_left;
+
+            if (rb_is_red(other)) {
+                rb_set_black(other);
+                rb_set_red(parent);
+                __rb_rotate_right(parent, root);
+                other = parent->rb_left;
+            }
+
+            if ((!other->rb_left || rb_is_black(other->rb_left)) &&
+                (!other->rb_right || rb_is_black(other->rb_right))) {
+                rb_set_red(other);
+                node = parent;
+                parent = rb_parent(node);
+            } else {
+                if (!other->rb_left || rb_is_black(other->rb_left)) {
+                    rb_set_black(other->rb_right);
+                    rb_set_red(other);
+                    __rb_rotate_left(other, root);
+                    other = parent->rb_left;
+                }
+                rb_set_color(other, rb_color(parent));
+                rb_set_black(parent);
+                rb_set_black(other->rb_left);
+                __rb_rotate_right(parent, root);
+                node = root->rb_node;
+                break;
+            }
+        }
+    }
+
+    if (node) {
+        rb_set_black(node);
+    }
+}
+
+
+/**
+ * unlink node from tree. node memory is owned by caller.
+ */
+static inline void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *child, *parent;
+    int color;
+
+    if (!node->rb_left) {
+        child = node->rb_right;
+    } else if (!node->rb_right) {
+        child = node->rb_left;
+    } else {
+        struct rb_node *old = node, *left;
+
+        node = node->rb_right;
+        while ((left = node->rb_left) != 0) {
+            node = left;
+        }
+
+        if (rb_parent(old)) {
+            if (rb_parent(old)->rb_left == old) {
+                rb_parent(old)->rb_left = node;
+            } else {
+                rb_parent(old)->rb_right = node;
+            }
+        } else {
+            root->rb_node = node;
+        }
+
+        child = node->rb_right;
+        parent = rb_parent(node);
+        color = rb_color(node);
+
+        if (parent == old) {
+            parent = node;
+        } else {
+            if (child) {
+                rb_set_parent(child, parent);
+            }
+            parent->rb_left = child;
+
+            node->rb_right = old->rb_right;
+            rb_set_parent(old->rb_right, node);
+        }
+
+        node->rb_parent_color = old->rb_parent_color;
+        node->rb_left = old->rb_left;
+        rb_set_parent(old->rb_left, node);
+
+        goto color;
+    }
+
+    parent = rb_parent(node);
+    color = rb_color(node);
+
+    if (child) {
+        rb_set_parent(child, parent);
+    }
+
+    if (parent) {
+        if (parent->rb_left == node) {
+            parent->rb_left = child;
+        } else {
+            parent->rb_right = child;
+        }
+    } else {
+        root->rb_node = child;
+    }
+
+color:
+    if (color == RB_BLACK) {
+        __rb_erase_color(child, parent, root);
+    }
+}
+
+
+static inline struct rb_node * rb_first(const struct rb_root *root)
+{
+    struct rb_node *n = root->rb_node;
+
+    if (!n) {
+        return 0;
+    }
+    while (n->rb_left) {
+        n = n->rb_left;
+    }
+    return n;
+}
+
+
+static inline struct rb_node * rb_last(const struct rb_root *root)
+{
+    struct rb_node *n = root->rb_node;
+
+    if (!n) {
+        return 0;
+    }
+    while (n->rb_right) {
+        n = n->rb_right;
+    }
+    return n;
+}
+
+
+static inline struct rb_node * rb_next(const struct rb_node *node)
+{
+    struct rb_node *parent;
+
+    if (rb_parent(node) == node) {
+        return 0;
+    }
+
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left) {
+            node = node->rb_left;
+        }
+        return (struct rb_node *) node;
+    }
+
+    while ((parent = rb_parent(node)) && node == parent->rb_right) {
+        node = parent;
+    }
+    return parent;
+}
+
+
+static inline struct rb_node * rb_prev(const struct rb_node *node)
+{
+    struct rb_node *parent;
+
+    if (rb_parent(node) == node) {
+        return 0;
+    }
+
+    if (node->rb_left) {
+        node = node->rb_left;
+        while (node->rb_right) {
+            node = node->rb_right;
+        }
+        return (struct rb_node *) node;
+    }
+
+    while ((parent = rb_parent(node)) && node == parent->rb_left) {
+        node = parent;
+    }
+    return parent;
+}
+
+
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **rb_link)
+{
+    node->rb_parent_color = (unsigned long) parent;
+    node->rb_left = node->rb_right = 0;
+
+    *rb_link = node;
+}
+
+
+/**
+ * replace victim with newnode (same key) without rebalancing
+ */
+static inline void rb_replace_node(struct rb_node *victim, struct rb_node *newnode, struct rb_root *root)
+{
+    struct rb_node *parent = rb_parent(victim);
+
+    if (parent) {
+        if (victim == parent->rb_left) {
+            parent->rb_left = newnode;
+        } else {
+            parent->rb_right = newnode;
+        }
+    } else {
+        root->rb_node = newnode;
+    }
+
+    if (victim->rb_left) {
+        rb_set_parent(victim->rb_left, newnode);
+    }
+    if (victim->rb_right) {
+        rb_set_parent(victim->rb_right, newnode);
+    }
+
+    *newnode = *victim;
+}
+
+
+/**
+ * RB_TREE_DEFINE
+ *   generate typed operations on a tree of objects of type 'type'
+ *   embedding 'struct rb_node member'.
+ *
+ *   cmp: static inline int cmp(const keytype *key, const type *obj)
+ *
+ *   type * name_find(root, key)
+ *   type * name_lookup(root, key, &parent, &link)  - also returns where
+ *                                                     key would be linked
+ *   void   name_link(root, obj, parent, link)
+ *   type * name_insert(root, key, obj)             - returns existing
+ *                                                     object or 0 if linked
+ *   void   name_erase(root, obj)
+ *   type * name_first(root)
+ *   type * name_next(obj)
+ */
+#define RB_TREE_DEFINE(name, type, member, keytype, cmp) \
+    __attribute__((unused)) \
+    static inline type * name##_lookup (struct rb_root *root, const keytype *key, \
+        struct rb_node **parent, struct rb_node ***link) \
+    { \
+        struct rb_node **__rb_p = &root->rb_node; \
+        struct rb_node *__rb_pa = 0; \
+        while (*__rb_p) { \
+            type *__rb_obj = rb_entry(*__rb_p, type, member); \
+            int __rb_c = cmp(key, __rb_obj); \
+            __rb_pa = *__rb_p; \
+            if (__rb_c < 0) { \
+                __rb_p = &(*__rb_p)->rb_left; \
+            } else if (__rb_c > 0) { \
+                __rb_p = &(*__rb_p)->rb_right; \
+            } else { \
+                return __rb_obj; \
+            } \
+        } \
+        if (parent) { \
+            *parent = __rb_pa; \
+        } \
+        if (link) { \
+            *link = __rb_p; \
+        } \
+        return 0; \
+    } \
+    __attribute__((unused)) \
+    static inline type * name##_find (struct rb_root *root, const keytype *key) \
+    { \
+        return name##_lookup(root, key, 0, 0); \
+    } \
+    __attribute__((unused)) \
+    static inline void name##_link (struct rb_root *root, type *__rb_item, \
+        struct rb_node *parent, struct rb_node **link) \
+    { \
+        rb_link_node(&__rb_item->member, parent, link); \
+        rb_insert_color(&__rb_item->member, root); \
+    } \
+    __attribute__((unused)) \
+    static inline type * name##_insert (struct rb_root *root, const keytype *key, type *__rb_item) \
+    { \
+        struct rb_node *__rb_parent; \
+        struct rb_node **__rb_link; \
+        type *__rb_exist = name##_lookup(root, key, &__rb_parent, &__rb_link); \
+        if (! __rb_exist) { \
+            name##_link(root, __rb_item, __rb_parent, __rb_link); \
+        } \
+        return __rb_exist; \
+    } \
+    __attribute__((unused)) \
+    static inline void name##_erase (struct rb_root *root, type *__rb_item) \
+    { \
+        rb_erase(&__rb_item->member, root); \
+        RB_CLEAR_NODE(&__rb_item->member); \
+    } \
+    __attribute__((unused)) \
+    static inline type * name##_first (struct rb_root *root) \
+    { \
+        struct rb_node *__rb_n = rb_first(root); \
+        return __rb_n ? rb_entry(__rb_n, type, member) : 0; \
+    } \
+    __attribute__((unused)) \
+    static inline type * name##_next (type *__rb_item) \
+    { \
+        struct rb_node *__rb_n = rb_next(&__rb_item->member); \
+        return __rb_n ? rb_entry(__rb_n, type, member) : 0; \
+    }
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _RB_TREE_H */
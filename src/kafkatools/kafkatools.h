@@ -30,7 +30,7 @@
  * @version: 0.4.4
  *
  * @create: 2018-10-08 16:17:00
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 19:40:25
  *
  */
 
@@ -46,13 +46,55 @@ extern "C" {
 
 #define KAFKATOOLS_ERRSTR_SIZE  256
 
+/**
+ * kafkatools 自己的 producer 属性 (不传给 librdkafka):
+ *   后台刷新 topic 分区数的间隔 (毫秒), 0 表示不刷新
+ */
+#define KAFKATOOLS_PROP_METADATA_REFRESH_MS  "kafkatools.metadata.refresh.ms"
+
+#ifndef KAFKATOOLS_METADATA_REFRESH_MS
+#  define KAFKATOOLS_METADATA_REFRESH_MS     30000
+#endif
+
+/**
+ * kafkatools 自己的 consumer 属性 (不传给 librdkafka):
+ *   异步提交偏移的间隔 (毫秒)
+ */
+#define KAFKATOOLS_PROP_COMMIT_INTERVAL_MS   "kafkatools.commit.interval.ms"
+
+#ifndef KAFKATOOLS_COMMIT_INTERVAL_MS
+#  define KAFKATOOLS_COMMIT_INTERVAL_MS      1000
+#endif
+
+/**
+ * producer 属性 "enable.idempotence" = "true": librdkafka 支持时 (>= 1.0)
+ *   原样设置; 不支持时改为有序的投递 (acks=all, 每个连接只有一个请求,
+ *   一直重试), 重试可能产生的重复由读者按 evrecord 的 seq 去掉
+ */
+#define KAFKATOOLS_PROP_IDEMPOTENCE          "enable.idempotence"
+
+/**
+ * 同步发送时内部队列满 (queue.buffering.max.messages) 的最多重试次数,
+ *   每次重试之前等待投递报告 KAFKATOOLS_QUEUE_FULL_WAIT_MS
+ */
+#ifndef KAFKATOOLS_QUEUE_FULL_RETRIES
+#  define KAFKATOOLS_QUEUE_FULL_RETRIES      50
+#endif
+
+#ifndef KAFKATOOLS_QUEUE_FULL_WAIT_MS
+#  define KAFKATOOLS_QUEUE_FULL_WAIT_MS      100
+#endif
+
+/* 消费线程每次读取的最多消息数 */
+#ifndef KAFKATOOLS_CONSUME_BATCH
+#  define KAFKATOOLS_CONSUME_BATCH           1000
+#endif
+
 /**
  * The C API is also documented in rdkafka.h
  */
 #include <librdkafka/rdkafka.h>
 
-#include "red_black_tree.h"
-
 #define KAFKATOOLS_MSG_CB_DEFAULT  ((kafkatools_msg_cb)((void*) (uintptr_t) (int) (-1)))
 
 typedef void (*kafkatools_msg_cb) (rd_kafka_t *rk,  const rd_kafka_message_t *rkmessage, void *opaque);
@@ -61,6 +103,41 @@ typedef struct kafkatools_producer_t * kt_producer;
 
 typedef struct rd_kafka_topic_t * kt_topic;
 
+typedef struct kafkatools_tailer_t * kt_tailer;
+
+typedef struct kafkatools_consumer_t * kt_consumer;
+
+
+/**
+ * 跟踪文件已经确认投递的偏移前进时的回调. 在调用 rd_kafka_poll 的线程中执行
+ */
+typedef void (*kafkatools_offset_cb) (const char *msgfile, int64_t offset, void *arg);
+
+
+/**
+ * consumer 的批处理回调: 在消费线程 (thrdno) 中调用. 同一个分区的消息
+ *   总在同一个线程中按顺序到达. msgs 在回调返回之后被释放, 不能保留.
+ */
+typedef void (*kafkatools_batch_cb) (int thrdno, rd_kafka_message_t **msgs, int count, void *arg);
+
+
+typedef struct kafkatools_consumer_stats_t
+{
+    /* 回调处理的消息数和批次数 */
+    int64_t messages;
+    int64_t batches;
+
+    /* 消费错误 (不包括 PARTITION_EOF) */
+    int64_t errors;
+
+    /* 偏移提交成功和失败的次数 */
+    int64_t commits;
+    int64_t commit_errors;
+
+    /* 当前分配的分区数 */
+    int64_t partitions;
+} kafkatools_consumer_stats_t;
+
 
 typedef struct kafkatools_produce_msg_t
 {
@@ -96,9 +173,30 @@ typedef struct kafkatools_producer_api_t
     kt_topic (* kt_get_topic) (kt_producer, const char *);
     const char * (* kt_topic_name) (const kt_topic);
     int (*kt_produce_message_sync) (kt_producer, const char *, int, kt_topic, int, int);
+    int (*kt_produce_keyed_sync) (kt_producer, const char *, int, kt_topic, const char *, int, int, int);
+    int (*kt_producer_poll) (kt_producer, int);
+    int (*kt_producer_flush) (kt_producer, int);
+    int (*kt_tailer_create) (const char *, kafkatools_offset_cb, void *, kt_tailer *);
+    void (*kt_tailer_destroy) (kt_tailer);
+    int (*kt_tail_file) (kt_tailer, kt_producer, kt_topic, int, const char *);
 } kafkatools_producer_api_t;
 
 
+typedef struct kafkatools_consumer_api_t
+{
+    void *handle;
+
+    kt_consumer consumer;
+
+    const char * (* kt_get_rdkafka_version) (void);
+    int (* kt_consumer_create) (const char **, const char **, int, int, kafkatools_batch_cb, void *, kt_consumer *);
+    int (* kt_consumer_subscribe) (kt_consumer, const char *);
+    void (* kt_consumer_destroy) (kt_consumer);
+    const char * (* kt_consumer_get_errstr) (kt_consumer);
+    void (* kt_consumer_get_stats) (kt_consumer, kafkatools_consumer_stats_t *);
+} kafkatools_consumer_api_t;
+
+
 extern const char * kafkatools_get_rdkafka_version (void);
 
 extern const char * kafkatools_producer_get_errstr (kt_producer producer);
@@ -113,7 +211,126 @@ extern const char * kafkatools_topic_name (const kt_topic topic);
 
 extern int kafkatools_produce_message_sync (kt_producer producer, const char *message, int chlen, kt_topic topic, int partition, int timout_ms);
 
-extern int kafkatools_producer_process_msgfile (kt_producer producer, const char *msgfile, const char *linebreak, off_t position);
+/**
+ * kafkatools_topic_partitions
+ *   topic 缓存的分区数 (后台线程定期刷新). 0 表示还不知道
+ */
+extern int kafkatools_topic_partitions (const kt_topic topic);
+
+/**
+ * kafkatools_key_partition
+ *   key 的一致性哈希 (FNV-1a + jump consistent hash) 映射到 [0, partitions).
+ *   分区数增加时只有少量 key 改变分区
+ */
+extern int32_t kafkatools_key_partition (const char *key, int keylen, int32_t partitions);
+
+/**
+ * kafkatools_produce_keyed_sync
+ *   发送带 key 的消息并等待投递完成. partition 为 RD_KAFKA_PARTITION_UA 时
+ *   按 key 选择分区: 同一个 key 的消息总是在同一个分区, 保持顺序.
+ *   分区数未知时由 topic 的分区函数以同样的哈希选择.
+ *
+ *   只有收到这条消息成功的投递报告才返回 KAFKATOOLS_SUCCESS. 内部队列满时
+ *   有限次地等待重试; 投递失败, 超时 (timout_ms, -1 表示直到投递报告) 或者
+ *   队列一直满返回 KAFKATOOLS_ERROR.
+ */
+extern int kafkatools_produce_keyed_sync (kt_producer producer, const char *message, int chlen, kt_topic topic,
+    const char *key, int keylen, int partition, int timout_ms);
+
+/**
+ * kafkatools_producer_poll
+ *   处理投递报告, 最多等待 timeout_ms. 返回处理的事件数
+ */
+extern int kafkatools_producer_poll (kt_producer producer, int timeout_ms);
+
+/**
+ * kafkatools_producer_flush
+ *   等待全部消息投递完成, 最多等待 timeout_ms. 超时返回 KAFKATOOLS_ERROR
+ */
+extern int kafkatools_producer_flush (kt_producer producer, int timeout_ms);
+
+
+/**
+ * kafkatools_tailer_create
+ *   创建文件跟踪器: 把文件新增的内容按行 (linebreak 分隔) 发送到 kafka.
+ *   跟踪器可以被多个线程的多个 producer 共用. 销毁之前必须先 flush
+ *   全部使用它的 producer.
+ *
+ *   linebreak - 行分隔符 (1 ~ 7 字节), 0 表示 "\n"
+ *   offset_cb - 文件的确认偏移前进时回调, 可以为 0
+ */
+extern int kafkatools_tailer_create (const char *linebreak, kafkatools_offset_cb offset_cb, void *cbarg, kt_tailer *outtailer);
+
+extern void kafkatools_tailer_destroy (kt_tailer tailer);
+
+
+/**
+ * kafkatools_tailer_set_offset
+ *   设置文件的起始偏移 (例如从上次确认的位置继续). 文件有未完成的
+ *   消息时返回 KAFKATOOLS_ERROR
+ */
+extern int kafkatools_tailer_set_offset (kt_tailer tailer, const char *msgfile, int64_t offset);
+
+/**
+ * kafkatools_tailer_get_offset
+ *   文件已经确认投递的偏移, 之前的行全部写入了 kafka. 未知文件返回 -1
+ */
+extern int64_t kafkatools_tailer_get_offset (kt_tailer tailer, const char *msgfile);
+
+
+/**
+ * kafkatools_tail_file
+ *   把 msgfile 上次读到的位置之后的完整行异步发送到 topic (消息 key 为文件名,
+ *   partition 为 RD_KAFKA_PARTITION_UA 时按 key 选择分区). 行的内容由 pread
+ *   复制到每批的缓冲, 投递报告到达后确认偏移并释放缓冲. 投递失败时回退到
+ *   确认的位置重新发送; 同一位置连续回退 KT_TAIL_REWIND_MAX 次之后返回失败.
+ *   消息太大等永久性的错误不重试, 这一行被丢弃.
+ *
+ *   同一文件不能在两个线程中同时调用.
+ *
+ * returns:
+ *   发送的行数 (>= 0)
+ *   KAFKATOOLS_ERROR - 失败 (见 kafkatools_producer_get_errstr)
+ */
+extern int kafkatools_tail_file (kt_tailer tailer, kt_producer producer, kt_topic topic, int partition, const char *msgfile);
+
+
+/**
+ * kafkatools_producer_process_msgfile
+ *   从 position 开始把文件的全部完整行发送到 topic, 等待投递完成.
+ *   返回确认的文件偏移, 失败返回 KAFKATOOLS_ERROR
+ */
+extern int64_t kafkatools_producer_process_msgfile (kt_producer producer, kt_topic topic, int partition, const char *msgfile, const char *linebreak, off_t position);
+
+
+/**
+ * kafkatools_consumer_create
+ *   创建消费者 (prop_names 必须包括 "group.id" 和 "bootstrap.servers").
+ *
+ *   threads   - 消费线程数. 分配的分区按 topic 和分区号固定分给一个线程
+ *   batchsize - 每次 rd_kafka_consume_batch_queue 读取的最多消息数,
+ *               0 表示 KAFKATOOLS_CONSUME_BATCH
+ *   batch_cb  - 批处理回调. 回调返回后保存偏移, 后台按
+ *               kafkatools.commit.interval.ms 异步提交
+ */
+extern int kafkatools_consumer_create (const char **prop_names, const char **prop_values, int threads, int batchsize,
+    kafkatools_batch_cb batch_cb, void *cbarg, kt_consumer *outconsumer);
+
+/**
+ * kafkatools_consumer_subscribe
+ *   订阅 topics (逗号分隔, "^" 开头为正则表达式) 并启动消费线程
+ */
+extern int kafkatools_consumer_subscribe (kt_consumer consumer, const char *topics);
+
+/**
+ * kafkatools_consumer_destroy
+ *   停止消费线程, 同步提交最后的偏移, 离开消费者组
+ */
+extern void kafkatools_consumer_destroy (kt_consumer consumer);
+
+extern const char * kafkatools_consumer_get_errstr (kt_consumer consumer);
+
+extern void kafkatools_consumer_get_stats (kt_consumer consumer, kafkatools_consumer_stats_t *stats);
 
 
 #if defined(__cplusplus)
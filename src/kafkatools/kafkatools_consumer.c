@@ -18,6 +18,32 @@
 *
 * 3. This notice may not be removed or altered from any source distribution.
 ***********************************************************************/
+
+/**
+ * @file: kafkatools_consumer.c
+ *
+ *  refer:
+ *    https://github.com/edenhill/librdkafka/blob/master/src/rdkafka.h
+ *
+ *    https://github.com/edenhill/librdkafka/blob/master/examples/rdkafka_consumer_example.c
+ *
+ *  消费者组订阅 topic. 每个分配的分区的队列转发到固定的一个消费线程
+ *  (按 topic 和分区号), 消费线程用 rd_kafka_consume_batch_queue 成批
+ *  读取消息并回调, 所以同一个分区的消息总在同一个线程中按顺序处理.
+ *
+ *  回调返回之后保存每个分区最后的偏移 (enable.auto.offset.store=false),
+ *  后台线程按间隔异步提交已保存的偏移 (enable.auto.commit=false).
+ *  消息至少处理一次: 异常退出后从最后提交的偏移重新消费.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-10-08
+ *
+ * @update: 2018-11-27 10:21:45
+ */
+
 #include "kafkatools.h"
 
 #include <stdio.h>
@@ -28,4 +54,485 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+/* 消费线程等待消息的时间 (检查退出标志的间隔) */
+#define KT_CONSUME_TIMEOUT_MS   100
+
+/* 后台线程处理分配 (rebalance) 和提交的间隔 */
+#define KT_CONSUMER_POLL_MS     100
+
+#define KT_CONSUMER_THREADS_MAX 64
+
+#define KT_CONSUMER_TOPICS_MAX  64
+
+
+struct kafkatools_consumer_t;
+
+typedef struct kt_consume_thread_t
+{
+    struct kafkatools_consumer_t *consumer;
+
+    int thrdno;
+    pthread_t thread;
+
+    /* 分配给这个线程的分区的队列都转发到这里 */
+    rd_kafka_queue_t *queue;
+
+    rd_kafka_message_t **msgs;
+} kt_consume_thread_t;
+
+
+typedef struct kafkatools_consumer_t
+{
+    rd_kafka_t *rkConsumer;
+
+    kafkatools_batch_cb batch_cb;
+    void *cbarg;
+
+    int batchsize;
+    int commit_interval_ms;
+
+    /* 后台线程: rebalance 和偏移提交 */
+    pthread_t poll_thread;
+    int poll_running;
+
+    volatile int stop;
+
+    /* 保存之后还没有提交的消息数 */
+    volatile int64_t uncommitted;
+
+    kafkatools_consumer_stats_t stats;
+
+    char errstr[KAFKATOOLS_ERRSTR_SIZE];
+
+    int threads;
+    kt_consume_thread_t thrds[0];
+} kafkatools_consumer_t;
+
+
+static inline uint64_t kt_now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * 分区对应的消费线程: 同一个分区总是同一个线程
+ */
+static int kt_partition_thread (const kafkatools_consumer_t *consumer, const char *topic, int32_t partition)
+{
+    uint32_t h = 2166136261U;
+
+    while (*topic) {
+        h ^= (unsigned char) *topic++;
+        h *= 16777619U;
+    }
+
+    return (int) ((h + (uint32_t) partition) % (uint32_t) consumer->threads);
+}
+
+
+/**
+ * 在后台线程中调用 (rd_kafka_consumer_poll, rd_kafka_consumer_close)
+ */
+static void kt_rebalance_cb (rd_kafka_t *rk, rd_kafka_resp_err_t err, rd_kafka_topic_partition_list_t *partitions, void *opaque)
+{
+    int i;
+
+    kafkatools_consumer_t *consumer = (kafkatools_consumer_t *) opaque;
+
+    switch (err) {
+    case RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS:
+        /* 分配之前转发分区的队列, 第一批消息就进入消费线程 */
+        for (i = 0; i < partitions->cnt; i++) {
+            rd_kafka_topic_partition_t *tp = &partitions->elems[i];
+
+            rd_kafka_queue_t *partq = rd_kafka_queue_get_partition(rk, tp->topic, tp->partition);
+
+            if (partq) {
+                int thrdno = kt_partition_thread(consumer, tp->topic, tp->partition);
+
+                rd_kafka_queue_forward(partq, consumer->thrds[thrdno].queue);
+                rd_kafka_queue_destroy(partq);
+            }
+        }
+
+        rd_kafka_assign(rk, partitions);
+
+        __sync_lock_test_and_set(&consumer->stats.partitions, partitions->cnt);
+        break;
+
+    case RD_KAFKA_RESP_ERR__REVOKE_PARTITIONS:
+        /* 分区交给其他消费者之前同步提交已经处理的偏移 */
+        if (__sync_lock_test_and_set(&consumer->uncommitted, 0) > 0) {
+            rd_kafka_commit(rk, NULL, 0);
+        }
+
+        rd_kafka_assign(rk, NULL);
+
+        __sync_lock_test_and_set(&consumer->stats.partitions, 0);
+        break;
+
+    default:
+        snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "rebalance failed: %s", rd_kafka_err2str(err));
+
+        rd_kafka_assign(rk, NULL);
+        break;
+    }
+}
+
+
+static void kt_offset_commit_cb (rd_kafka_t *rk, rd_kafka_resp_err_t err, rd_kafka_topic_partition_list_t *offsets, void *opaque)
+{
+    kafkatools_consumer_t *consumer = (kafkatools_consumer_t *) opaque;
+
+    if (err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+        __sync_add_and_fetch(&consumer->stats.commits, 1);
+    } else if (err != RD_KAFKA_RESP_ERR__NO_OFFSET) {
+        __sync_add_and_fetch(&consumer->stats.commit_errors, 1);
+
+        snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "offset commit failed: %s", rd_kafka_err2str(err));
+    }
+}
+
+
+/**
+ * 后台线程: 处理 rebalance 和错误事件, 按间隔异步提交保存的偏移
+ */
+static void * kt_consumer_poll_thread (void *arg)
+{
+    rd_kafka_message_t *rkmessage;
+
+    kafkatools_consumer_t *consumer = (kafkatools_consumer_t *) arg;
+
+    uint64_t next_commit = kt_now_ms() + consumer->commit_interval_ms;
+
+    while (! consumer->stop) {
+        /* 分区的消息已经转发到消费线程, 这里只收到事件和错误 */
+        rkmessage = rd_kafka_consumer_poll(consumer->rkConsumer, KT_CONSUMER_POLL_MS);
+
+        if (rkmessage) {
+            if (rkmessage->err && rkmessage->err != RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+                snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "consumer error: %s", rd_kafka_message_errstr(rkmessage));
+            }
+
+            rd_kafka_message_destroy(rkmessage);
+        }
+
+        if (kt_now_ms() >= next_commit) {
+            next_commit = kt_now_ms() + consumer->commit_interval_ms;
+
+            if (__sync_lock_test_and_set(&consumer->uncommitted, 0) > 0) {
+                /* 提交全部已保存的偏移, 结果在 kt_offset_commit_cb 中 */
+                rd_kafka_commit(consumer->rkConsumer, NULL, 1);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * 消费线程: 成批读取转发到本线程的分区消息
+ */
+static void * kt_consume_thread (void *arg)
+{
+    ssize_t i, n, count;
+
+    kt_consume_thread_t *thrd = (kt_consume_thread_t *) arg;
+    kafkatools_consumer_t *consumer = thrd->consumer;
+
+    rd_kafka_message_t **msgs = thrd->msgs;
+
+    while (! consumer->stop) {
+        n = rd_kafka_consume_batch_queue(thrd->queue, KT_CONSUME_TIMEOUT_MS, msgs, consumer->batchsize);
+
+        if (n <= 0) {
+            continue;
+        }
+
+        /* 去掉错误 (例如 PARTITION_EOF), 其余消息交给回调 */
+        for (i = 0, count = 0; i < n; i++) {
+            if (msgs[i]->err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+                msgs[count++] = msgs[i];
+            } else {
+                if (msgs[i]->err != RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+                    __sync_add_and_fetch(&consumer->stats.errors, 1);
+                }
+
+                rd_kafka_message_destroy(msgs[i]);
+            }
+        }
+
+        if (! count) {
+            continue;
+        }
+
+        consumer->batch_cb(thrd->thrdno, msgs, (int) count, consumer->cbarg);
+
+        /* 保存每个分区最后的偏移: 同一个分区的消息在批次中连续 */
+        for (i = 0; i < count; i++) {
+            if (i + 1 == count || msgs[i + 1]->rkt != msgs[i]->rkt || msgs[i + 1]->partition != msgs[i]->partition) {
+                rd_kafka_offset_store(msgs[i]->rkt, msgs[i]->partition, msgs[i]->offset);
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            rd_kafka_message_destroy(msgs[i]);
+        }
+
+        __sync_add_and_fetch(&consumer->uncommitted, count);
+
+        __sync_add_and_fetch(&consumer->stats.messages, count);
+        __sync_add_and_fetch(&consumer->stats.batches, 1);
+    }
+
+    return NULL;
+}
+
+
+static void kt_consumer_free (kafkatools_consumer_t *consumer)
+{
+    int i;
+
+    for (i = 0; i < consumer->threads; i++) {
+        if (consumer->thrds[i].queue) {
+            rd_kafka_queue_destroy(consumer->thrds[i].queue);
+        }
+
+        free(consumer->thrds[i].msgs);
+    }
+
+    if (consumer->rkConsumer) {
+        rd_kafka_destroy(consumer->rkConsumer);
+    }
+
+    free(consumer);
+}
+
+
+/***************************** public api *****************************/
+
+int kafkatools_consumer_create (const char **prop_names, const char **prop_values, int threads, int batchsize,
+    kafkatools_batch_cb batch_cb, void *cbarg, kt_consumer *outconsumer)
+{
+    int i;
+
+    rd_kafka_conf_t *conf;
+
+    kafkatools_consumer_t *consumer;
+
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > KT_CONSUMER_THREADS_MAX) {
+        threads = KT_CONSUMER_THREADS_MAX;
+    }
+
+    consumer = (kafkatools_consumer_t *) calloc(1, sizeof(*consumer) + sizeof(kt_consume_thread_t) * threads);
+    if (! consumer) {
+        return KAFKATOOLS_ERROR;
+    }
+
+    consumer->threads = threads;
+    consumer->batchsize = (batchsize > 0? batchsize : KAFKATOOLS_CONSUME_BATCH);
+    consumer->commit_interval_ms = KAFKATOOLS_COMMIT_INTERVAL_MS;
+    consumer->batch_cb = batch_cb;
+    consumer->cbarg = cbarg;
+
+    conf = rd_kafka_conf_new();
+
+    i = 0;
+    while (i < 256 && prop_names[i]) {
+        if (! strcmp(prop_names[i], KAFKATOOLS_PROP_COMMIT_INTERVAL_MS)) {
+            /* kafkatools 自己的属性, 不传给 librdkafka */
+            consumer->commit_interval_ms = atoi(prop_values[i]);
+        } else if (rd_kafka_conf_set(conf, prop_names[i], prop_values[i], consumer->errstr, KAFKATOOLS_ERRSTR_SIZE) != RD_KAFKA_CONF_OK) {
+            rd_kafka_conf_destroy(conf);
+            free(consumer);
+            return KAFKATOOLS_ERROR;
+        }
+
+        ++i;
+    }
+
+    if (consumer->commit_interval_ms < 10) {
+        consumer->commit_interval_ms = 10;
+    }
+
+    /* 偏移在回调之后保存, 由后台线程提交 */
+    if (rd_kafka_conf_set(conf, "enable.auto.commit", "false", consumer->errstr, KAFKATOOLS_ERRSTR_SIZE) != RD_KAFKA_CONF_OK ||
+        rd_kafka_conf_set(conf, "enable.auto.offset.store", "false", consumer->errstr, KAFKATOOLS_ERRSTR_SIZE) != RD_KAFKA_CONF_OK) {
+        rd_kafka_conf_destroy(conf);
+        free(consumer);
+        return KAFKATOOLS_ERROR;
+    }
+
+    rd_kafka_conf_set_rebalance_cb(conf, kt_rebalance_cb);
+    rd_kafka_conf_set_offset_commit_cb(conf, kt_offset_commit_cb);
+    rd_kafka_conf_set_opaque(conf, consumer);
+
+    /* rd_kafka_new() takes ownership of the conf object on success */
+    consumer->rkConsumer = rd_kafka_new(RD_KAFKA_CONSUMER, conf, consumer->errstr, KAFKATOOLS_ERRSTR_SIZE);
+    if (! consumer->rkConsumer) {
+        rd_kafka_conf_destroy(conf);
+        free(consumer);
+        return KAFKATOOLS_ERROR;
+    }
+
+    /* 事件和错误由 rd_kafka_consumer_poll 取得 */
+    rd_kafka_poll_set_consumer(consumer->rkConsumer);
+
+    for (i = 0; i < threads; i++) {
+        kt_consume_thread_t *thrd = &consumer->thrds[i];
+
+        thrd->consumer = consumer;
+        thrd->thrdno = i;
+        thrd->queue = rd_kafka_queue_new(consumer->rkConsumer);
+        thrd->msgs = (rd_kafka_message_t **) malloc(sizeof(rd_kafka_message_t *) * consumer->batchsize);
+
+        if (! thrd->queue || ! thrd->msgs) {
+            snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "out of memory");
+            kt_consumer_free(consumer);
+            return KAFKATOOLS_ERROR;
+        }
+    }
+
+    *outconsumer = consumer;
+
+    return KAFKATOOLS_SUCCESS;
+}
+
+
+int kafkatools_consumer_subscribe (kt_consumer consumer, const char *topics)
+{
+    int i, ntopics = 0;
+
+    rd_kafka_resp_err_t err;
+    rd_kafka_topic_partition_list_t *subscription;
+
+    char *names[KT_CONSUMER_TOPICS_MAX];
+    char *buf, *name, *saveptr = NULL;
+
+    if (consumer->poll_running) {
+        snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "already subscribed");
+        return KAFKATOOLS_ERROR;
+    }
+
+    buf = strdup(topics);
+    if (! buf) {
+        snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "out of memory");
+        return KAFKATOOLS_ERROR;
+    }
+
+    for (name = strtok_r(buf, ",", &saveptr); name && ntopics < KT_CONSUMER_TOPICS_MAX; name = strtok_r(NULL, ",", &saveptr)) {
+        if (*name) {
+            names[ntopics++] = name;
+        }
+    }
+
+    if (! ntopics) {
+        snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "no topics: %s", topics);
+        free(buf);
+        return KAFKATOOLS_ERROR;
+    }
+
+    subscription = rd_kafka_topic_partition_list_new(ntopics);
+
+    for (i = 0; i < ntopics; i++) {
+        /* "^" 开头的名字是正则表达式 */
+        rd_kafka_topic_partition_list_add(subscription, names[i], RD_KAFKA_PARTITION_UA);
+    }
+
+    err = rd_kafka_subscribe(consumer->rkConsumer, subscription);
+
+    rd_kafka_topic_partition_list_destroy(subscription);
+    free(buf);
+
+    if (err) {
+        snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "rd_kafka_subscribe failed: %s", rd_kafka_err2str(err));
+        return KAFKATOOLS_ERROR;
+    }
+
+    for (i = 0; i < consumer->threads; i++) {
+        if (pthread_create(&consumer->thrds[i].thread, NULL, kt_consume_thread, &consumer->thrds[i]) != 0) {
+            snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "pthread_create failed");
+
+            consumer->stop = 1;
+            while (i-- > 0) {
+                pthread_join(consumer->thrds[i].thread, NULL);
+            }
+
+            rd_kafka_unsubscribe(consumer->rkConsumer);
+            return KAFKATOOLS_ERROR;
+        }
+    }
+
+    if (pthread_create(&consumer->poll_thread, NULL, kt_consumer_poll_thread, consumer) != 0) {
+        snprintf(consumer->errstr, KAFKATOOLS_ERRSTR_SIZE, "pthread_create failed");
+
+        consumer->stop = 1;
+        for (i = 0; i < consumer->threads; i++) {
+            pthread_join(consumer->thrds[i].thread, NULL);
+        }
+
+        rd_kafka_unsubscribe(consumer->rkConsumer);
+        return KAFKATOOLS_ERROR;
+    }
+
+    consumer->poll_running = 1;
+
+    return KAFKATOOLS_SUCCESS;
+}
+
+
+void kafkatools_consumer_destroy (kt_consumer consumer)
+{
+    int i;
+
+    if (consumer->poll_running) {
+        consumer->stop = 1;
+
+        for (i = 0; i < consumer->threads; i++) {
+            pthread_join(consumer->thrds[i].thread, NULL);
+        }
+
+        pthread_join(consumer->poll_thread, NULL);
+
+        consumer->poll_running = 0;
+
+        /* 同步提交最后保存的偏移 */
+        if (__sync_lock_test_and_set(&consumer->uncommitted, 0) > 0) {
+            rd_kafka_commit(consumer->rkConsumer, NULL, 0);
+        }
+    }
+
+    /* 离开消费者组 (调用 kt_rebalance_cb 撤销分配) */
+    rd_kafka_consumer_close(consumer->rkConsumer);
+
+    kt_consumer_free(consumer);
+}
+
+
+const char * kafkatools_consumer_get_errstr (kt_consumer consumer)
+{
+    consumer->errstr[KAFKATOOLS_ERRSTR_SIZE - 1] = '\0';
+    return consumer->errstr;
+}
+
 
+void kafkatools_consumer_get_stats (kt_consumer consumer, kafkatools_consumer_stats_t *stats)
+{
+    stats->messages = __sync_add_and_fetch(&consumer->stats.messages, 0);
+    stats->batches = __sync_add_and_fetch(&consumer->stats.batches, 0);
+    stats->errors = __sync_add_and_fetch(&consumer->stats.errors, 0);
+    stats->commits = __sync_add_and_fetch(&consumer->stats.commits, 0);
+    stats->commit_errors = __sync_add_and_fetch(&consumer->stats.commit_errors, 0);
+    stats->partitions = __sync_add_and_fetch(&consumer->stats.partitions, 0);
+}
@@ -33,11 +33,13 @@
  *
  * @create: 2018-10-08
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 19:40:25
  */
 
 #include "kafkatools.h"
 
+#include "../common/rbtree.h"
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -47,6 +49,41 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+
+
+/* 跟踪文件时每批读取的最大字节 (大于 KT_TAIL_LINE_MAX) */
+#define KT_TAIL_READSIZE       (1024 * 1024)
+
+/* 每批 (rd_kafka_produce_batch) 最多的行数 */
+#define KT_TAIL_BATCH_LINES    4096
+
+/* 超过这个长度的行被分为多条消息 (小于 broker 的 message.max.bytes) */
+#define KT_TAIL_LINE_MAX       (512 * 1024)
+
+/* 队列满时等待投递的时间 */
+#define KT_TAIL_POLL_MS        100
+
+/* 队列满时重试的次数, 超过之后按失败报告 (回退重新读取) */
+#define KT_TAIL_QUEUE_RETRIES  50
+
+/* 同一位置连续回退的次数, 超过之后 kafkatools_tail_file 返回失败 */
+#define KT_TAIL_REWIND_MAX     5
+
+/* 后台刷新 topic 元数据时请求的超时 */
+#define KT_METADATA_TIMEOUT_MS 5000
+
+/* 同步发送等待投递报告时每次 poll 的时间 */
+#define KT_SYNC_POLL_MS        10
+
+/* 消息的 msg_opaque 的类型 (第一个成员) */
+#define KT_MSGREF_TAIL         1
+#define KT_MSGREF_SYNC         2
+
+/* 同步消息的状态 */
+#define KT_SYNC_WAIT           0
+#define KT_SYNC_DONE           1
+#define KT_SYNC_ABANDON        2
 
 
 typedef struct kafkatools_producer_t
@@ -57,48 +94,154 @@ typedef struct kafkatools_producer_t
     /* Producer instance handle */
     rd_kafka_t *rkProducer;
 
-    red_black_tree_t  rktopic_tree;
+    struct rb_root  rktopic_tree;
+
+    /* 最近一次使用的 topic: 连续的事件通常发送到同一个 topic */
+    struct rktopic_entry_t *last_topic;
+
+    /**
+     * 后台刷新 topic 的分区数. rktopic_tree 只由 producer 所在的线程插入,
+     *   插入和刷新线程的遍历在 meta_lock 之内; 所在线程的查找不加锁
+     */
+    pthread_mutex_t meta_lock;
+    pthread_cond_t meta_cond;
+    pthread_t meta_thread;
+    int meta_refresh_ms;
+    int meta_running;
+    int meta_stop;
+
+    /* 调用者的投递报告回调. 跟踪文件的消息由 kt_tail_delivered 处理 */
+    kafkatools_msg_cb msg_cb;
+    void *msg_opaque;
 
     char errstr[KAFKATOOLS_ERRSTR_SIZE];
 } kafkatools_producer_t;
 
 
-static int rktopic_name_cmp(void *newObject, void *nodeObject)
+struct kt_tailfile_t;
+
+/**
+ * 跟踪文件的一批消息: 消息内容引用同一个读缓冲 (复制自文件, 文件被
+ *   截断时不会 SIGBUS), 全部投递之后确认偏移并释放缓冲
+ */
+typedef struct kt_tailbatch_t
 {
-    return strcmp(rd_kafka_topic_name((rd_kafka_topic_t *) newObject), rd_kafka_topic_name((rd_kafka_topic_t *) nodeObject));
-}
+    /* KT_MSGREF_TAIL */
+    int msgref;
+
+    struct kt_tailbatch_t *next;
+
+    struct kt_tailfile_t *file;
 
+    /* 这批消息之后的文件偏移 */
+    int64_t endpos;
 
-/*! Callback function prototype for traverse objects */
-static void rktopic_object_release(void *object, void *param)
+    char *buf;
+
+    /* 没有收到投递报告的消息数 */
+    int pending;
+
+    /* 投递失败的消息数 */
+    int failed;
+} kt_tailbatch_t;
+
+
+/**
+ * 同步发送的消息: 投递报告可能由任何调用 poll 的线程处理. 等待超时的
+ *   消息标记为 KT_SYNC_ABANDON, 由之后的投递报告释放
+ */
+typedef struct kt_syncmsg_t
 {
-    rd_kafka_topic_destroy((rd_kafka_topic_t *) object);
-}
+    /* KT_MSGREF_SYNC */
+    int msgref;
 
+    volatile int state;
 
-static ssize_t pread_len (int fd, unsigned char *buf, size_t len, off_t pos)
+    rd_kafka_resp_err_t err;
+} kt_syncmsg_t;
+
+
+/* 跟踪的文件: 节点按文件名排序 */
+typedef struct kt_tailfile_t
 {
-    ssize_t rc;
-    unsigned char *pb = buf;
+    struct rb_node rbnode;
 
-    while (len != 0 && (rc = pread (fd, (void*) pb, len, pos)) != 0) {
-        if (rc == -1) {
-            if (errno == EINTR || errno == EAGAIN) {
-                continue;
-            } else {
-                /* pread error */
-                return (-1);
-            }
-        }
+    struct kafkatools_tailer_t *tailer;
+
+    dev_t dev;
+    ino_t ino;
+
+    /* 下一次读取的位置 */
+    int64_t readpos;
+
+    /* 确认投递的位置: 之前的行全部写入 kafka */
+    int64_t committed;
+
+    /* 按文件偏移排序的未完成批次 */
+    kt_tailbatch_t *head;
+    kt_tailbatch_t *tail;
+
+    /* 有消息投递失败: 全部批次完成之后从 committed 重新读取 */
+    int rewind;
+
+    /* committed 没有前进时连续回退的次数 */
+    int rewinds;
+
+    int pathlen;
+    char path[0];
+} kt_tailfile_t;
+
+
+typedef struct kafkatools_tailer_t
+{
+    /* 保护 file_tree 和文件的偏移, 批次 */
+    pthread_mutex_t lock;
+
+    struct rb_root file_tree;
+
+    kafkatools_offset_cb offset_cb;
+    void *cbarg;
+
+    long pagesize;
+
+    int lblen;
+    char linebreak[8];
+} kafkatools_tailer_t;
+
+
+
+/* rktopic_tree 的节点: 按 topic 名字排序, 节点嵌入在对象中 */
+typedef struct rktopic_entry_t
+{
+    struct rb_node rbnode;
+
+    rd_kafka_topic_t *rktopic;
+
+    /* 缓存的分区数 (后台刷新). 0 表示未知 */
+    volatile int32_t partitions;
+
+    char name[0];
+} rktopic_entry_t;
+
+
+static inline int rktopic_name_cmp (const char *name, const rktopic_entry_t *entry)
+{
+    return strcmp(name, entry->name);
+}
+
+RB_TREE_DEFINE(rktopic_tree, rktopic_entry_t, rbnode, char, rktopic_name_cmp)
 
-        len -= rc;
-        pos += rc;
-        pb += rc;
-    }
 
-    return (ssize_t) (pb - buf);
+static inline int tailfile_path_cmp (const char *path, const kt_tailfile_t *file)
+{
+    return strcmp(path, file->path);
 }
 
+RB_TREE_DEFINE(tailfile_tree, kt_tailfile_t, rbnode, char, tailfile_path_cmp)
+
+
+static void kt_tail_delivered (kt_tailbatch_t *batch, rd_kafka_resp_err_t err);
+
 
 /**
  * Message delivery report callback.
@@ -122,12 +265,139 @@ static void kt_msg_cb_default (rd_kafka_t *rk, const rd_kafka_message_t *rkmessa
 
 
 /**
- * !! 要求调用者实现此函数 !!
- *
+ * 安装在 producer 上的投递报告回调: 跟踪文件的消息 (msg_opaque 为批次)
+ *   由 kt_tail_delivered 处理, 同步发送的消息通知等待的线程, 其他消息
+ *   交给调用者的回调
+ */
+static void kt_dr_msg_cb (rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void *opaque)
+{
+    kafkatools_producer_t *producer = (kafkatools_producer_t *) opaque;
+
+    if (! rkmessage->_private) {
+        producer->msg_cb(rk, rkmessage, producer->msg_opaque);
+    } else if (*(int *) rkmessage->_private == KT_MSGREF_TAIL) {
+        kt_tail_delivered((kt_tailbatch_t *) rkmessage->_private, rkmessage->err);
+    } else {
+        kt_syncmsg_t *syncmsg = (kt_syncmsg_t *) rkmessage->_private;
+
+        syncmsg->err = rkmessage->err;
+
+        if (! __sync_bool_compare_and_swap(&syncmsg->state, KT_SYNC_WAIT, KT_SYNC_DONE)) {
+            /* 等待的线程已经超时返回 */
+            free(syncmsg);
+        }
+    }
+}
+
+
+/**
+ * 不支持 enable.idempotence 的 librdkafka (< 1.0): 设置为有序的投递.
+ *   每个连接只有一个请求, 重试不会改变消息的顺序
+ */
+static rd_kafka_conf_res_t kt_conf_set_ordered (kafkatools_producer_t *producer)
+{
+    rd_kafka_conf_res_t res;
+
+    res = rd_kafka_conf_set(producer->conf, "max.in.flight.requests.per.connection", "1", producer->errstr, KAFKATOOLS_ERRSTR_SIZE);
+
+    if (res == RD_KAFKA_CONF_OK) {
+        res = rd_kafka_conf_set(producer->conf, "request.required.acks", "-1", producer->errstr, KAFKATOOLS_ERRSTR_SIZE);
+    }
+
+    if (res == RD_KAFKA_CONF_OK) {
+        /* 直到 message.timeout.ms 一直重试 */
+        res = rd_kafka_conf_set(producer->conf, "message.send.max.retries", "10000000", producer->errstr, KAFKATOOLS_ERRSTR_SIZE);
+    }
+
+    return res;
+}
+
+
+/**
+ * topic 的分区函数: 与 kafkatools_key_partition 相同, 分区数未知时
+ *   (RD_KAFKA_PARTITION_UA) 由 librdkafka 调用, 选择的分区一致
  */
-static int on_process_msgline (char *msgline, ssize_t msglen, kafkatools_produce_msg_t *outmsg)
+static int32_t kt_partitioner_cb (const rd_kafka_topic_t *rkt, const void *key, size_t keylen,
+    int32_t partition_cnt, void *rkt_opaque, void *msg_opaque)
+{
+    if (! key || ! keylen) {
+        return rd_kafka_msg_partitioner_random(rkt, key, keylen, partition_cnt, rkt_opaque, msg_opaque);
+    }
+
+    /* 分区不可用时也不换分区, 保证同一个 key 的消息有序 */
+    return kafkatools_key_partition((const char *) key, (int) keylen, partition_cnt);
+}
+
+
+/**
+ * 一次请求取得本地已知的全部 topic 的元数据, 更新缓存的分区数
+ */
+static void kt_metadata_refresh (kafkatools_producer_t *producer)
+{
+    int i;
+    rktopic_entry_t *entry;
+
+    const struct rd_kafka_metadata *md = NULL;
+
+    if (rd_kafka_metadata(producer->rkProducer, 0, NULL, &md, KT_METADATA_TIMEOUT_MS) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        return;
+    }
+
+    pthread_mutex_lock(&producer->meta_lock);
+
+    for (i = 0; i < md->topic_cnt; i++) {
+        const struct rd_kafka_metadata_topic *mt = &md->topics[i];
+
+        if (mt->err == RD_KAFKA_RESP_ERR_NO_ERROR && mt->partition_cnt > 0) {
+            entry = rktopic_tree_find(&producer->rktopic_tree, mt->topic);
+
+            if (entry) {
+                entry->partitions = mt->partition_cnt;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&producer->meta_lock);
+
+    rd_kafka_metadata_destroy(md);
+}
+
+
+static void * kt_metadata_thread (void *arg)
 {
-    return 0;
+    struct timespec ts;
+
+    kafkatools_producer_t *producer = (kafkatools_producer_t *) arg;
+
+    pthread_mutex_lock(&producer->meta_lock);
+
+    while (! producer->meta_stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        ts.tv_sec += producer->meta_refresh_ms / 1000;
+        ts.tv_nsec += (long) (producer->meta_refresh_ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        /* 新的 topic 加入时被唤醒, 立即刷新 */
+        pthread_cond_timedwait(&producer->meta_cond, &producer->meta_lock, &ts);
+
+        if (producer->meta_stop) {
+            break;
+        }
+
+        pthread_mutex_unlock(&producer->meta_lock);
+
+        kt_metadata_refresh(producer);
+
+        pthread_mutex_lock(&producer->meta_lock);
+    }
+
+    pthread_mutex_unlock(&producer->meta_lock);
+
+    return NULL;
 }
 
 
@@ -181,9 +451,28 @@ int kafkatools_producer_create (const char **prop_names, const char **prop_value
      *     "1000"
      *  };
      */
+    producer->meta_refresh_ms = KAFKATOOLS_METADATA_REFRESH_MS;
+
     i = 0;
     while (i < 256 && prop_names[i]) {
+        if (! strcmp(prop_names[i], KAFKATOOLS_PROP_METADATA_REFRESH_MS)) {
+            /* kafkatools 自己的属性, 不传给 librdkafka */
+            producer->meta_refresh_ms = atoi(prop_values[i]);
+
+            ++i;
+            continue;
+        }
+
         res = rd_kafka_conf_set(producer->conf, prop_names[i], prop_values[i], producer->errstr, KAFKATOOLS_ERRSTR_SIZE);
+
+        if (res == RD_KAFKA_CONF_UNKNOWN && ! strcmp(prop_names[i], KAFKATOOLS_PROP_IDEMPOTENCE)) {
+            if (! strcmp(prop_values[i], "true")) {
+                res = kt_conf_set_ordered(producer);
+            } else {
+                res = RD_KAFKA_CONF_OK;
+            }
+        }
+
         if (res != RD_KAFKA_CONF_OK) {
             rd_kafka_conf_destroy(producer->conf);
             free(producer);
@@ -197,17 +486,22 @@ int kafkatools_producer_create (const char **prop_names, const char **prop_value
      * This callback will be called once per message to inform the application
      *  if delivery succeeded or failed. See dr_msg_cb() above.
      */
-    if (msg_cb == KAFKATOOLS_MSG_CB_DEFAULT) {
-        rd_kafka_conf_set_dr_msg_cb(producer->conf, kt_msg_cb_default);
+    if (msg_cb == KAFKATOOLS_MSG_CB_DEFAULT || ! msg_cb) {
+        producer->msg_cb = kt_msg_cb_default;
     } else {
-        rd_kafka_conf_set_dr_msg_cb(producer->conf, msg_cb);
+        producer->msg_cb = msg_cb;
     }
+    producer->msg_opaque = msg_opaque;
+
+    rd_kafka_conf_set_dr_msg_cb(producer->conf, kt_dr_msg_cb);
 
     /*
      * Retrieves the opaque pointer previously set with:
      *   rd_kafka_conf_set_opaque()
+     *
+     * 回调 kt_dr_msg_cb 的 opaque 是 producer, 调用者的 msg_opaque 保存在 producer 中
      */
-    rd_kafka_conf_set_opaque(producer->conf, msg_opaque);
+    rd_kafka_conf_set_opaque(producer->conf, producer);
 
     /*
      * Create producer instance.
@@ -223,7 +517,19 @@ int kafkatools_producer_create (const char **prop_names, const char **prop_value
         return KAFKATOOLS_ERROR;
     }
 
-    rbtree_init(&producer->rktopic_tree, (fn_comp_func*) rktopic_name_cmp);
+    rb_root_init(&producer->rktopic_tree);
+
+    pthread_mutex_init(&producer->meta_lock, NULL);
+    pthread_cond_init(&producer->meta_cond, NULL);
+
+    if (producer->meta_refresh_ms > 0) {
+        if (pthread_create(&producer->meta_thread, NULL, kt_metadata_thread, producer) == 0) {
+            producer->meta_running = 1;
+        } else {
+            /* 没有后台刷新时按 key 的消息由 kt_partitioner_cb 选择分区 */
+            printf("warn: pthread_create fail: kafkatools metadata thread\n");
+        }
+    }
 
     *outproducer = producer;
 
@@ -233,26 +539,55 @@ int kafkatools_producer_create (const char **prop_names, const char **prop_value
 
 void kafkatools_producer_destroy (kt_producer producer)
 {
+    if (producer->meta_running) {
+        pthread_mutex_lock(&producer->meta_lock);
+        producer->meta_stop = 1;
+        pthread_cond_signal(&producer->meta_cond);
+        pthread_mutex_unlock(&producer->meta_lock);
+
+        pthread_join(producer->meta_thread, NULL);
+        producer->meta_running = 0;
+    }
+
     if (producer->rkProducer) {
+        rktopic_entry_t *entry;
+
         rd_kafka_t *rkProducer = producer->rkProducer;
 
         producer->rkProducer = 0;
 
-        rbtree_traverse(&producer->rktopic_tree, rktopic_object_release, 0);
+        /* 跟踪文件的消息引用批次的读缓冲, 必须在投递报告之后释放 */
+        rd_kafka_flush(rkProducer, 5000);
+
+        producer->last_topic = 0;
 
-        rbtree_clean(&producer->rktopic_tree);
+        while ((entry = rktopic_tree_first(&producer->rktopic_tree)) != 0) {
+            rktopic_tree_erase(&producer->rktopic_tree, entry);
+
+            rd_kafka_topic_destroy(entry->rktopic);
+            free(entry);
+        }
 
         /* Destroy the producer instance */
         rd_kafka_destroy(rkProducer);
     }
 
+    pthread_cond_destroy(&producer->meta_cond);
+    pthread_mutex_destroy(&producer->meta_lock);
+
     free(producer);
 }
 
 
 kt_topic kafkatools_get_topic (kt_producer producer, const char *topic_name)
 {
-    red_black_node_t *node;
+    size_t namelen;
+    rktopic_entry_t *entry;
+
+    struct rb_node *parent;
+    struct rb_node **link;
+
+    rd_kafka_topic_conf_t *tconf;
 
     /* Topic handles are refcounted internally and calling rd_kafka_topic_new()
      *  again with the same topic name will return the previous topic handle
@@ -265,29 +600,60 @@ kt_topic kafkatools_get_topic (kt_producer producer, const char *topic_name)
      */
     rd_kafka_topic_t *rktopic;
 
-    rktopic = rd_kafka_topic_new(producer->rkProducer, topic_name, NULL);
+    // 连续的事件通常发送到同一个 topic, 不必查找
+    entry = producer->last_topic;
+    if (entry && ! strcmp(entry->name, topic_name)) {
+        return (kt_topic) entry->rktopic;
+    }
+
+    // 先按名字查找, 已经存在的 topic 不再调用 rd_kafka_topic_new
+    entry = rktopic_tree_lookup(&producer->rktopic_tree, topic_name, &parent, &link);
+    if (entry) {
+        producer->last_topic = entry;
+        return (kt_topic) entry->rktopic;
+    }
+
+    // tree 中没有 topic, 插入新 topic
+    namelen = strlen(topic_name);
+
+    entry = (rktopic_entry_t *) malloc(sizeof(*entry) + namelen + 1);
+    if (! entry) {
+        // 必须成功
+        printf("application error: out of memory!\n");
+        exit(-1);
+    }
+
+    entry->partitions = 0;
+    memcpy(entry->name, topic_name, namelen + 1);
+
+    // 按 key 选择分区; rd_kafka_topic_opaque() 返回 entry
+    tconf = rd_kafka_topic_conf_new();
+    rd_kafka_topic_conf_set_partitioner_cb(tconf, kt_partitioner_cb);
+    rd_kafka_topic_conf_set_opaque(tconf, entry);
+
+    rktopic = rd_kafka_topic_new(producer->rkProducer, topic_name, tconf);
 
     if (! rktopic) {
         snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "rd_kafka_topic_new(topic=%s) fail: %s",
             topic_name, rd_kafka_err2str(rd_kafka_last_error()));
+
+        rd_kafka_topic_conf_destroy(tconf);
+        free(entry);
         return NULL;
     }
 
-    node = rbtree_find(&producer->rktopic_tree, (void*) rktopic);
-    if (! node) {
-        // 如果 tree 没有 topic, 插入新 topic
-        int is_new_node;
+    entry->rktopic = rktopic;
 
-        node = rbtree_insert_unique(&producer->rktopic_tree, (void *)rktopic, &is_new_node);
-        if (! node || ! is_new_node) {
-            // 必须成功
-            printf("application error: should never run to this!\n");
-            exit(-1);
-        }
-    } else {
-        // 如果 tree 中已经存在 topic, 释放 topic 引用计数
-        rd_kafka_topic_destroy(rktopic);
+    pthread_mutex_lock(&producer->meta_lock);
+    {
+        rktopic_tree_link(&producer->rktopic_tree, entry, parent, link);
+
+        // 唤醒刷新线程取得新 topic 的分区数
+        pthread_cond_signal(&producer->meta_cond);
     }
+    pthread_mutex_unlock(&producer->meta_lock);
+
+    producer->last_topic = entry;
 
     // do not call rd_kafka_topic_destroy() for below object!
     return (kt_topic) rktopic;
@@ -300,137 +666,708 @@ const char * kafkatools_topic_name (const kt_topic topic)
 }
 
 
-int kafkatools_produce_message_sync (kt_producer producer, const char *message, int chlen, kt_topic topic, int partition, int timout_ms)
+int kafkatools_topic_partitions (const kt_topic topic)
 {
-    int ret;
+    rktopic_entry_t *entry = (rktopic_entry_t *) rd_kafka_topic_opaque((const rd_kafka_topic_t *) topic);
 
-    ret = rd_kafka_produce( (rd_kafka_topic_t *) topic,   /* Topic object */
-            partition,                   /* Use builtin partitioner to select partition*/
-            RD_KAFKA_MSG_F_COPY,         /* Make a copy of the payload. */
-            (void* ) message, chlen,     /* Message payload (value) and length */
-            NULL, 0,                     /* Optional key and its length for partition */
-            NULL                         /* msg_opaque is an optional application-provided per-message opaque
-                                          *  pointer that will provided in the delivery report callback (`dr_cb`) for
-                                          *  referencing this message.
-                                          */
-        );
-
-    if (ret == -1) {
-        /* Poll to handle delivery reports */
-        if (rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
-            /* If the internal queue is full, wait for messages to be delivered and then retry.
-             * The internal queue represents both messages to be sent and messages that have
-             *  been sent or failed, awaiting their delivery report callback to be called.
-             *
-             * The internal queue is limited by the configuration property:
-             *      queue.buffering.max.messages
-             */
-            rd_kafka_poll(producer->rkProducer, timout_ms);
-
-            return KAFKATOOLS_SUCCESS;
-        } else {
-            snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "rd_kafka_produce (topic=%s, partition=%d) failed: %s",
-                    kafkatools_topic_name(topic),
+    return (entry? entry->partitions : 0);
+}
+
+
+int32_t kafkatools_key_partition (const char *key, int keylen, int32_t partitions)
+{
+    int i;
+
+    int64_t b = -1, j = 0;
+
+    /* FNV-1a 64 */
+    uint64_t h = 14695981039346656037ULL;
+
+    for (i = 0; i < keylen; i++) {
+        h ^= (unsigned char) key[i];
+        h *= 1099511628211ULL;
+    }
+
+    if (partitions <= 1) {
+        return 0;
+    }
+
+    /**
+     * jump consistent hash (Lamping, Veach): 分区数从 n 增加到 n+1 时,
+     *   只有 1/(n+1) 的 key 改变分区
+     */
+    while (j < partitions) {
+        b = j;
+        h = h * 2862933555777941757ULL + 1;
+        j = (int64_t) ((double) (b + 1) * ((double) (1LL << 31) / (double) ((h >> 33) + 1)));
+    }
+
+    return (int32_t) b;
+}
+
+
+/**
+ * 发送一条消息并等待这条消息的投递报告. 内部队列满时等待投递报告之后
+ *   重试 (反压), 最多 KAFKATOOLS_QUEUE_FULL_RETRIES 次
+ */
+static int kt_produce_sync (kafkatools_producer_t *producer, rd_kafka_topic_t *rkt, int partition,
+    const char *key, int keylen, const char *message, int chlen, int timout_ms)
+{
+    int ret, retries = 0, waited = 0;
+
+    rd_kafka_resp_err_t err;
+
+    kt_syncmsg_t *syncmsg = (kt_syncmsg_t *) malloc(sizeof(*syncmsg));
+
+    if (! syncmsg) {
+        snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "out of memory");
+        return KAFKATOOLS_ERROR;
+    }
+
+    syncmsg->msgref = KT_MSGREF_SYNC;
+    syncmsg->state = KT_SYNC_WAIT;
+    syncmsg->err = RD_KAFKA_RESP_ERR_NO_ERROR;
+
+    for (;;) {
+        ret = rd_kafka_produce(rkt,              /* Topic object */
+                partition,                   /* RD_KAFKA_PARTITION_UA: use kt_partitioner_cb to select partition */
+                RD_KAFKA_MSG_F_COPY,         /* Make a copy of the payload. */
+                (void* ) message, chlen,     /* Message payload (value) and length */
+                key, (key? keylen : 0),      /* Optional key and its length for partition */
+                syncmsg                      /* msg_opaque: the delivery report (kt_dr_msg_cb) wakes up the waiter */
+            );
+
+        if (ret == 0) {
+            break;
+        }
+
+        err = rd_kafka_last_error();
+
+        if (err != RD_KAFKA_RESP_ERR__QUEUE_FULL || retries == KAFKATOOLS_QUEUE_FULL_RETRIES) {
+            snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "rd_kafka_produce (topic=%s, partition=%d) failed: %s (retries=%d)",
+                    rd_kafka_topic_name(rkt),
                     partition,
-                    rd_kafka_err2str(rd_kafka_last_error())
+                    rd_kafka_err2str(err),
+                    retries
                 );
+
+            free(syncmsg);
             return KAFKATOOLS_ERROR;
         }
+
+        /* If the internal queue is full, wait for messages to be delivered and then retry.
+         * The internal queue represents both messages to be sent and messages that have
+         *  been sent or failed, awaiting their delivery report callback to be called.
+         *
+         * The internal queue is limited by the configuration property:
+         *      queue.buffering.max.messages
+         */
+        rd_kafka_poll(producer->rkProducer, KAFKATOOLS_QUEUE_FULL_WAIT_MS);
+
+        retries++;
     }
 
-    /* Wait for final messages to be delivered or fail.
-     *  rd_kafka_flush() is an abstraction over rd_kafka_poll() which
-     *  waits for all messages to be delivered.
-     */
-    rd_kafka_flush(producer->rkProducer, timout_ms);
+    /* 等待这条消息的投递报告. 其他线程的 poll 也可能处理这个报告 */
+    while (syncmsg->state == KT_SYNC_WAIT) {
+        if (timout_ms >= 0 && waited >= timout_ms) {
+            if (__sync_bool_compare_and_swap(&syncmsg->state, KT_SYNC_WAIT, KT_SYNC_ABANDON)) {
+                /* 之后的投递报告释放 syncmsg */
+                snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "delivery report timed out (topic=%s, partition=%d, timeout=%d ms)",
+                    rd_kafka_topic_name(rkt), partition, timout_ms);
+
+                return KAFKATOOLS_ERROR;
+            }
+
+            break;
+        }
+
+        rd_kafka_poll(producer->rkProducer, KT_SYNC_POLL_MS);
+        waited += KT_SYNC_POLL_MS;
+    }
+
+    err = syncmsg->err;
+    free(syncmsg);
+
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "delivery failed (topic=%s, partition=%d): %s",
+            rd_kafka_topic_name(rkt), partition, rd_kafka_err2str(err));
+
+        return KAFKATOOLS_ERROR;
+    }
 
     return KAFKATOOLS_SUCCESS;
 }
 
 
-int kafkatools_producer_process_msgfile (kt_producer producer, const char *msgfile, const char *linebreak, off_t position)
+int kafkatools_produce_message_sync (kt_producer producer, const char *message, int chlen, kt_topic topic, int partition, int timout_ms)
 {
-    int fd;
-    int ret;
-    char buf[4096];
-    ssize_t cb;
+    return kt_produce_sync(producer, (rd_kafka_topic_t *) topic, partition, NULL, 0, message, chlen, timout_ms);
+}
+
+
+int kafkatools_produce_keyed_sync (kt_producer producer, const char *message, int chlen, kt_topic topic,
+    const char *key, int keylen, int partition, int timout_ms)
+{
+    if (partition == RD_KAFKA_PARTITION_UA && key) {
+        int32_t partitions = (int32_t) kafkatools_topic_partitions(topic);
+
+        if (partitions > 0) {
+            /* 分区数已知 (后台刷新), 直接选择分区 */
+            partition = kafkatools_key_partition(key, keylen, partitions);
+        }
+    }
+
+    return kt_produce_sync(producer, (rd_kafka_topic_t *) topic, partition, key, keylen, message, chlen, timout_ms);
+}
 
-    kafkatools_produce_msg_t msg;
 
-    // TODO: 初始化 msg
+int kafkatools_producer_poll (kt_producer producer, int timeout_ms)
+{
+    return rd_kafka_poll(producer->rkProducer, timeout_ms);
+}
+
+
+int kafkatools_producer_flush (kt_producer producer, int timeout_ms)
+{
+    rd_kafka_resp_err_t err = rd_kafka_flush(producer->rkProducer, timeout_ms);
+
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "rd_kafka_flush failed: %s (outq=%d)",
+            rd_kafka_err2str(err), rd_kafka_outq_len(producer->rkProducer));
+        return KAFKATOOLS_ERROR;
+    }
+
+    return KAFKATOOLS_SUCCESS;
+}
+
+
+/***************************** file tailer ****************************/
+
+static void tailbatch_free (kt_tailbatch_t *batch)
+{
+    free(batch->buf);
+    free(batch);
+}
+
+
+/* 在 tailer->lock 内调用 */
+static kt_tailfile_t * tailfile_get (kafkatools_tailer_t *tailer, const char *path)
+{
+    int pathlen;
+    kt_tailfile_t *file;
+
+    struct rb_node *parent;
+    struct rb_node **link;
+
+    file = tailfile_tree_lookup(&tailer->file_tree, path, &parent, &link);
+    if (file) {
+        return file;
+    }
+
+    pathlen = (int) strlen(path);
+
+    file = (kt_tailfile_t *) calloc(1, sizeof(*file) + pathlen + 1);
+    if (! file) {
+        return NULL;
+    }
+
+    file->tailer = tailer;
+    file->pathlen = pathlen;
+    memcpy(file->path, path, pathlen + 1);
+
+    tailfile_tree_link(&tailer->file_tree, file, parent, link);
+
+    return file;
+}
+
+
+/**
+ * 重新发送也不会成功的错误: 这条消息被丢弃, 不回退
+ */
+static inline int kt_tail_err_permanent (rd_kafka_resp_err_t err)
+{
+    switch (err) {
+    case RD_KAFKA_RESP_ERR_MSG_SIZE_TOO_LARGE:
+    case RD_KAFKA_RESP_ERR_INVALID_MSG_SIZE:
+    case RD_KAFKA_RESP_ERR_INVALID_MSG:
+    case RD_KAFKA_RESP_ERR_RECORD_LIST_TOO_LARGE:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+
+/**
+ * 一条消息的投递报告. 批次全部完成时按文件偏移顺序确认, 有失败时等待
+ *   全部批次完成之后回退到确认的位置 (至少一次). 永久性的错误不回退
+ */
+static void kt_tail_delivered (kt_tailbatch_t *batch, rd_kafka_resp_err_t err)
+{
+    int64_t offset = -1;
+
+    kt_tailfile_t *file = batch->file;
+    kafkatools_tailer_t *tailer = file->tailer;
+
+    pthread_mutex_lock(&tailer->lock);
+
+    batch->pending--;
+
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR && ! kt_tail_err_permanent(err)) {
+        batch->failed++;
+        file->rewind = 1;
+    }
+
+    while ((batch = file->head) != NULL && batch->pending == 0 && ! batch->failed) {
+        file->head = batch->next;
+        if (! file->head) {
+            file->tail = NULL;
+        }
+
+        offset = file->committed = batch->endpos;
+        file->rewinds = 0;
+
+        tailbatch_free(batch);
+    }
+
+    if (file->rewind) {
+        /* 全部批次都已经完成才能回退 */
+        for (batch = file->head; batch && batch->pending == 0; batch = batch->next) {}
+
+        if (! batch) {
+            while ((batch = file->head) != NULL) {
+                file->head = batch->next;
+                tailbatch_free(batch);
+            }
+
+            file->tail = NULL;
+            file->readpos = file->committed;
+            file->rewind = 0;
+            file->rewinds++;
+        }
+    }
+
+    pthread_mutex_unlock(&tailer->lock);
+
+    if (offset != -1 && tailer->offset_cb) {
+        tailer->offset_cb(file->path, offset, tailer->cbarg);
+    }
+}
+
+
+int kafkatools_tailer_create (const char *linebreak, kafkatools_offset_cb offset_cb, void *cbarg, kt_tailer *outtailer)
+{
+    kafkatools_tailer_t *tailer;
+
+    int lblen = (linebreak? (int) strlen(linebreak) : 1);
+
+    if (lblen < 1 || lblen >= (int) sizeof(tailer->linebreak)) {
+        return KAFKATOOLS_ERROR;
+    }
+
+    tailer = (kafkatools_tailer_t *) calloc(1, sizeof(*tailer));
+    if (! tailer) {
+        return KAFKATOOLS_ERROR;
+    }
+
+    if (pthread_mutex_init(&tailer->lock, NULL) != 0) {
+        free(tailer);
+        return KAFKATOOLS_ERROR;
+    }
+
+    rb_root_init(&tailer->file_tree);
+
+    tailer->offset_cb = offset_cb;
+    tailer->cbarg = cbarg;
+
+    tailer->pagesize = sysconf(_SC_PAGESIZE);
+
+    tailer->lblen = lblen;
+    memcpy(tailer->linebreak, (linebreak? linebreak : "\n"), lblen);
+
+    *outtailer = tailer;
+
+    return KAFKATOOLS_SUCCESS;
+}
+
+
+void kafkatools_tailer_destroy (kt_tailer tailer)
+{
+    kt_tailfile_t *file;
+    kt_tailbatch_t *batch;
+
+    while ((file = tailfile_tree_first(&tailer->file_tree)) != NULL) {
+        tailfile_tree_erase(&tailer->file_tree, file);
+
+        while ((batch = file->head) != NULL) {
+            file->head = batch->next;
+            tailbatch_free(batch);
+        }
+
+        free(file);
+    }
+
+    pthread_mutex_destroy(&tailer->lock);
+
+    free(tailer);
+}
+
+
+int kafkatools_tailer_set_offset (kt_tailer tailer, const char *msgfile, int64_t offset)
+{
+    int ret = KAFKATOOLS_ERROR;
+
+    kt_tailfile_t *file;
+
+    pthread_mutex_lock(&tailer->lock);
+
+    file = tailfile_get(tailer, msgfile);
+
+    if (file && ! file->head && offset >= 0) {
+        file->readpos = file->committed = offset;
+        file->rewind = 0;
+        file->rewinds = 0;
+        ret = KAFKATOOLS_SUCCESS;
+    }
+
+    pthread_mutex_unlock(&tailer->lock);
+
+    return ret;
+}
+
+
+int64_t kafkatools_tailer_get_offset (kt_tailer tailer, const char *msgfile)
+{
+    int64_t offset = -1;
+
+    kt_tailfile_t *file;
+
+    pthread_mutex_lock(&tailer->lock);
+
+    file = tailfile_tree_find(&tailer->file_tree, msgfile);
+    if (file) {
+        offset = file->committed;
+    }
+
+    pthread_mutex_unlock(&tailer->lock);
+
+    return offset;
+}
+
+
+/**
+ * 查找行分隔符. 单字节分隔符使用 memchr (glibc 按 SSE2/AVX2 向量化)
+ */
+static inline const char * kt_find_linebreak (const char *p, const char *end, const char *lb, int lblen)
+{
+    if (lblen == 1) {
+        return (const char *) memchr(p, lb[0], end - p);
+    }
+
+    while (end - p >= lblen) {
+        p = (const char *) memchr(p, lb[0], end - p - lblen + 1);
+
+        if (! p) {
+            break;
+        }
+
+        if (! memcmp(p, lb, lblen)) {
+            return p;
+        }
+
+        p++;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * 发送一批消息, 队列满时等待投递之后重试 (最多 KT_TAIL_QUEUE_RETRIES 次).
+ *   没有进入队列的消息按失败报告给批次
+ */
+static void kt_tail_produce_batch (kafkatools_producer_t *producer, rd_kafka_topic_t *rkt, int partition,
+    rd_kafka_message_t *msgs, int count, kt_tailbatch_t *batch)
+{
+    int i, n, retry, retries = 0;
+
+    while (count > 0) {
+        rd_kafka_produce_batch(rkt, partition, 0, msgs, count);
+
+        retry = 0;
+
+        for (i = 0, n = 0; i < count; i++) {
+            if (msgs[i].err == RD_KAFKA_RESP_ERR__QUEUE_FULL && retries < KT_TAIL_QUEUE_RETRIES) {
+                msgs[n] = msgs[i];
+                msgs[n++].err = RD_KAFKA_RESP_ERR_NO_ERROR;
+                retry = 1;
+            } else if (msgs[i].err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+                snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "rd_kafka_produce_batch failed: %s (topic=%s)",
+                    rd_kafka_err2str(msgs[i].err), rd_kafka_topic_name(rkt));
+
+                kt_tail_delivered(batch, msgs[i].err);
+            }
+        }
+
+        count = n;
+
+        if (retry) {
+            /* 内部队列满 (queue.buffering.max.messages): 等待投递报告之后重试 */
+            rd_kafka_poll(producer->rkProducer, KT_TAIL_POLL_MS);
+            retries++;
+        }
+    }
+}
+
+
+int kafkatools_tail_file (kt_tailer tailer, kt_producer producer, kt_topic topic, int partition, const char *msgfile)
+{
+    int fd, count, rewinds, total = 0;
+    int64_t readpos;
+
+    struct stat sb;
+
+    kt_tailfile_t *file;
+    rd_kafka_message_t *msgs = NULL;
 
     fd = open(msgfile, O_RDONLY | O_NOATIME);
+    if (fd == -1 && errno == EPERM) {
+        /* O_NOATIME 只允许文件的属主使用 */
+        fd = open(msgfile, O_RDONLY);
+    }
+
     if (fd == -1) {
-        perror("open\n");
+        snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "open error(%d): %s (%s)", errno, strerror(errno), msgfile);
         return KAFKATOOLS_ERROR;
     }
 
-    if (lseek(fd, position, SEEK_SET) != position) {
-        perror("lseek\n");
+    if (fstat(fd, &sb) != 0) {
+        snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "fstat error(%d): %s (%s)", errno, strerror(errno), msgfile);
         close(fd);
         return KAFKATOOLS_ERROR;
     }
 
-    while ((cb = pread_len(fd, (unsigned char *) buf, sizeof buf, position)) > 0) {
-        ret = on_process_msgline(buf, cb, &msg);
+    pthread_mutex_lock(&tailer->lock);
 
-        // TODO: ret
+    file = tailfile_get(tailer, msgfile);
 
-        ret = rd_kafka_produce((rd_kafka_topic_t *) msg.topic,   /* Topic object */
-                msg.partition,              /* Use builtin partitioner to select partition*/
-                RD_KAFKA_MSG_F_COPY,        /* Make a copy of the payload. */
-                msg.msgbuf, msg.msglen,     /* Message payload (value) and length */
-                msg.key, msg.keylen,        /* Optional key and its length for partition */
-                msg.opaque                  /* msg_opaque is an optional application-provided per-message opaque
-                                             *  pointer that will provided in the delivery report callback (`dr_cb`) for
-                                             *  referencing this message.
-                                             */
-            );
+    if (file && ! file->head) {
+        if (file->dev != sb.st_dev || file->ino != sb.st_ino || sb.st_size < file->committed) {
+            /* 新文件, 或者文件被替换 (轮转) 或者截断: 从头开始 */
+            if (file->ino && (file->dev != sb.st_dev || file->ino != sb.st_ino || sb.st_size < file->committed)) {
+                file->readpos = file->committed = 0;
+                file->rewinds = 0;
+            }
+
+            file->dev = sb.st_dev;
+            file->ino = sb.st_ino;
+        }
+    }
+
+    pthread_mutex_unlock(&tailer->lock);
+
+    if (! file) {
+        snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "out of memory");
+        close(fd);
+        return KAFKATOOLS_ERROR;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (;;) {
+        int64_t endpos;
+        ssize_t rlen;
+        size_t buflen;
+        char *buf;
+
+        const char *p, *end, *line, *lb;
+
+        kt_tailbatch_t *batch;
+
+        /**
+         * 每批之前重新读取位置: 发送时处理的投递报告可能已经回退.
+         *   有失败的批次没有完成时, 等待回退
+         */
+        pthread_mutex_lock(&tailer->lock);
+        {
+            readpos = (file->rewind? -1 : file->readpos);
+            rewinds = file->rewinds;
+
+            if (rewinds > KT_TAIL_REWIND_MAX) {
+                /* 下一次调用重新计数 */
+                file->rewinds = 0;
+            }
+        }
+        pthread_mutex_unlock(&tailer->lock);
+
+        if (rewinds > KT_TAIL_REWIND_MAX) {
+            snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "delivery failed %d times at %lld (%s)", rewinds, (long long) readpos, msgfile);
+            total = KAFKATOOLS_ERROR;
+            break;
+        }
+
+        if (readpos < 0 || readpos >= (int64_t) sb.st_size) {
+            break;
+        }
+
+        buflen = (size_t) (sb.st_size - readpos);
+        if (buflen > KT_TAIL_READSIZE) {
+            buflen = KT_TAIL_READSIZE;
+        }
+
+        buf = (char *) malloc(buflen);
+        if (! buf) {
+            snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "out of memory");
+            total = KAFKATOOLS_ERROR;
+            break;
+        }
+
+        /* 复制文件内容: 消息引用这个缓冲, 文件被截断也不影响 */
+        rlen = pread(fd, buf, buflen, (off_t) readpos);
+        if (rlen <= 0) {
+            if (rlen == -1) {
+                snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "pread error(%d): %s (%s)", errno, strerror(errno), msgfile);
+                total = KAFKATOOLS_ERROR;
+            }
+            free(buf);
+            break;
+        }
 
-        if (ret == -1) {
-            /* Poll to handle delivery reports */
-            if (rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
-                /* If the internal queue is full, wait for messages to be delivered and then retry.
-                 * The internal queue represents both messages to be sent and messages that have
-                 *  been sent or failed, awaiting their delivery report callback to be called.
-                 *
-                 * The internal queue is limited by the configuration property:
-                 *      queue.buffering.max.messages
-                 */
-                rd_kafka_poll(producer->rkProducer, 1000 /* block wait for max 1000ms */);
-
-                // goto retry;
+        if (! msgs) {
+            msgs = (rd_kafka_message_t *) malloc(sizeof(rd_kafka_message_t) * KT_TAIL_BATCH_LINES);
+            if (! msgs) {
+                free(buf);
+                snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "out of memory");
+                total = KAFKATOOLS_ERROR;
                 break;
+            }
+        }
+
+        batch = (kt_tailbatch_t *) calloc(1, sizeof(*batch));
+        if (! batch) {
+            free(buf);
+            snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "out of memory");
+            total = KAFKATOOLS_ERROR;
+            break;
+        }
+
+        batch->msgref = KT_MSGREF_TAIL;
+        batch->buf = buf;
+
+        p = buf;
+        end = buf + rlen;
+
+        count = 0;
+
+        while (count < KT_TAIL_BATCH_LINES && p < end) {
+            line = p;
+
+            lb = kt_find_linebreak(p, (end - p > KT_TAIL_LINE_MAX + tailer->lblen)? p + KT_TAIL_LINE_MAX + tailer->lblen : end,
+                tailer->linebreak, tailer->lblen);
+
+            if (lb) {
+                p = lb + tailer->lblen;
+            } else if (end - line >= KT_TAIL_LINE_MAX) {
+                /* 超长的行分为多条消息 */
+                lb = p = line + KT_TAIL_LINE_MAX;
             } else {
-                snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "rd_kafka_produce failed: %s (topic=%s)",
-                    rd_kafka_err2str(rd_kafka_last_error()), kafkatools_topic_name(msg.topic));
+                /* 不完整的行, 等待写入完成 */
+                break;
+            }
+
+            bzero(&msgs[count], sizeof(rd_kafka_message_t));
+
+            msgs[count].payload = (void *) line;
+            msgs[count].len = (size_t) (lb - line);
+            msgs[count].key = (void *) file->path;
+            msgs[count].key_len = (size_t) file->pathlen;
+            msgs[count]._private = batch;
 
-                goto exit_onerror;
+            count++;
+        }
+
+        if (! count) {
+            tailbatch_free(batch);
+
+            if (buflen == KT_TAIL_READSIZE && rlen == (ssize_t) buflen) {
+                /* should never run to this: KT_TAIL_LINE_MAX < KT_TAIL_READSIZE */
+                snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "line too long at %lld (%s)", (long long) readpos, msgfile);
+                total = KAFKATOOLS_ERROR;
             }
+            break;
         }
 
-        /* A producer application should continually serve the delivery report queue
-         *  by calling rd_kafka_poll() at frequent intervals.
-         * Either put the poll call in your main loop, or in a dedicated thread, or
-         *  call it after every rd_kafka_produce() call.
-         * Just make sure that rd_kafka_poll() is still called during periods where
-         *  you are not producing any messages to make sure previously produced messages
-         *  have their delivery report callback served (and any other callbacks you register).
-         */
-        rd_kafka_poll(producer->rkProducer, 0 /* non-blocking */);
-    }
+        endpos = readpos + (int64_t) (p - buf);
 
-    /* Wait for final messages to be delivered or fail.
-     *  rd_kafka_flush() is an abstraction over rd_kafka_poll() which
-     *  waits for all messages to be delivered.
-     */
-    rd_kafka_flush(producer->rkProducer, -1);
+        batch->file = file;
+        batch->endpos = endpos;
+        batch->pending = count;
 
-    close(fd);
-    return KAFKATOOLS_SUCCESS;
+        pthread_mutex_lock(&tailer->lock);
+
+        if (file->rewind || file->readpos != readpos) {
+            /* 读取期间有投递失败或者回退: 丢弃这一批, 重新读取位置 */
+            pthread_mutex_unlock(&tailer->lock);
+
+            tailbatch_free(batch);
+            continue;
+        }
+
+        if (file->tail) {
+            file->tail->next = batch;
+        } else {
+            file->head = batch;
+        }
+        file->tail = batch;
+
+        file->readpos = endpos;
 
-exit_onerror:
+        pthread_mutex_unlock(&tailer->lock);
 
+        /* 消息内容引用批次的缓冲 (msgflags = 0), 投递报告之后释放 */
+        kt_tail_produce_batch(producer, (rd_kafka_topic_t *) topic, partition, msgs, count, batch);
+
+        total += count;
+    }
+
+    free(msgs);
     close(fd);
-    return KAFKATOOLS_ERROR;
+
+    /* 处理已经到达的投递报告 */
+    rd_kafka_poll(producer->rkProducer, 0);
+
+    return total;
+}
+
+
+int64_t kafkatools_producer_process_msgfile (kt_producer producer, kt_topic topic, int partition, const char *msgfile, const char *linebreak, off_t position)
+{
+    int ret;
+    int64_t offset;
+
+    kt_tailer tailer;
+
+    if (kafkatools_tailer_create(linebreak, NULL, NULL, &tailer) != KAFKATOOLS_SUCCESS) {
+        snprintf(producer->errstr, KAFKATOOLS_ERRSTR_SIZE, "kafkatools_tailer_create failed");
+        return KAFKATOOLS_ERROR;
+    }
+
+    kafkatools_tailer_set_offset(tailer, msgfile, (int64_t) position);
+
+    do {
+        ret = kafkatools_tail_file(tailer, producer, topic, partition, msgfile);
+
+        /* Wait for final messages to be delivered or fail.
+         *  rd_kafka_flush() is an abstraction over rd_kafka_poll() which
+         *  waits for all messages to be delivered.
+         */
+        rd_kafka_flush(producer->rkProducer, -1);
+    } while (ret > 0);
+
+    offset = kafkatools_tailer_get_offset(tailer, msgfile);
+
+    kafkatools_tailer_destroy(tailer);
+
+    return (ret == KAFKATOOLS_ERROR? KAFKATOOLS_ERROR : offset);
 }
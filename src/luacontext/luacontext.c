@@ -29,7 +29,7 @@
  *
  * @create: 2018-10-15
  *
- * @update: 2018-11-09 14:22:46
+ * @update: 2018-11-29 09:40:18
  *
  */
 
@@ -55,9 +55,53 @@
 #include <assert.h>
 #include <pthread.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #include "luacontext.h"
 
 
+#if LUA_VERSION_NUM < 502
+/**
+ * LuaJIT (Lua 5.1 API) 没有 luaL_requiref: 调用 openf 加载模块到 package.loaded[modname],
+ *   glb 为真时同时设置全局变量. 和 Lua 5.3 一样, 模块留在栈顶
+ */
+static void luactx_requiref (lua_State *L, const char *modname, lua_CFunction openf, int glb)
+{
+    lua_pushcfunction(L, openf);
+    lua_pushstring(L, modname);
+    lua_call(L, 1, 1);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    lua_pushvalue(L, -2);
+    lua_setfield(L, -2, modname);
+    lua_pop(L, 1);
+
+    if (glb) {
+        lua_pushvalue(L, -1);
+        lua_setglobal(L, modname);
+    }
+}
+
+#  define luaL_requiref(L, modname, openf, glb)  luactx_requiref(L, modname, openf, glb)
+#endif
+
+
+/**
+ * 加载时的脚本文件状态: 用于检查脚本是否修改
+ */
+typedef struct luactx_script_t
+{
+    char *path;
+
+    ino_t ino;
+    off_t size;
+
+    time_t mtime;
+    long mtime_ns;
+} luactx_script_t;
+
+
 /**
  * Creating a single lua_State per thread is a good solution
  *  to having multiple threads of Lua execution.
@@ -92,9 +136,174 @@ typedef struct lua_context_t
 
     /* 存储所有输出的 value 值 */
     char values_buffer[LUACTX_VALUES_BUFSIZE];
+
+    /**
+     * 批量调用: 注册表中复用的输入数组和记录表池 (LUA_NOREF 表示尚未创建)
+     */
+    int batch_inref;
+    int batch_poolref;
+
+    /* 上一次批量调用放入输入数组的记录数 */
+    int batch_inrows;
+
+    /* 批量调用输出的记录数和容量 */
+    int batch_rows;
+    int batch_maxrows;
+
+    /**
+     * 第 i 条记录: verdict 在 [offset[2i], offset[2i+1]),
+     *   message 在 [offset[2i+1], offset[2i+2])
+     */
+    int *batch_offset;
+
+    /* 存储所有记录输出的 verdict 和 message */
+    int batch_bufsize;
+    char *batch_buffer;
+
+    /* 主脚本和 require 的模块文件 */
+    int num_scripts;
+    luactx_script_t scripts[LUACTX_SCRIPTS_MAXNUM];
 } lua_context_t;
 
 
+static int script_stat (luactx_script_t *script, const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        /* 文件不存在: 状态全部为 0 */
+        script->ino = 0;
+        script->size = 0;
+        script->mtime = 0;
+        script->mtime_ns = 0;
+        return 0;
+    }
+
+    script->ino = st.st_ino;
+    script->size = st.st_size;
+    script->mtime = st.st_mtim.tv_sec;
+    script->mtime_ns = st.st_mtim.tv_nsec;
+
+    return 1;
+}
+
+
+static void script_add (lua_context ctx, const char *path)
+{
+    int i;
+
+    luactx_script_t *script;
+
+    if (ctx->num_scripts == LUACTX_SCRIPTS_MAXNUM) {
+        return;
+    }
+
+    for (i = 0; i < ctx->num_scripts; i++) {
+        if (! strcmp(ctx->scripts[i].path, path)) {
+            return;
+        }
+    }
+
+    script = &ctx->scripts[ctx->num_scripts];
+
+    if (script_stat(script, path)) {
+        script->path = strdup(path);
+
+        if (script->path) {
+            ctx->num_scripts++;
+        }
+    }
+}
+
+
+/**
+ * 记录主脚本和 package.loaded 中 package.searchpath 能找到文件的模块
+ */
+static void script_add_loaded (lua_context ctx, lua_State *L, const char *scriptfile)
+{
+    script_add(ctx, scriptfile);
+
+    lua_getglobal(L, "package");
+    if (! lua_istable(L, -1)) {
+        lua_settop(L, 0);
+        return;
+    }
+
+    lua_getfield(L, -1, "loaded");
+    if (! lua_istable(L, -1)) {
+        lua_settop(L, 0);
+        return;
+    }
+
+    lua_pushnil(L);
+
+    while (lua_next(L, 2)) {
+        lua_pop(L, 1);
+
+        if (lua_type(L, -1) == LUA_TSTRING) {
+            lua_getfield(L, 1, "searchpath");
+            lua_pushvalue(L, -2);
+            lua_getfield(L, 1, "path");
+
+            if (lua_isfunction(L, -3) && lua_pcall(L, 2, 1, 0) == 0 && lua_type(L, -1) == LUA_TSTRING) {
+                script_add(ctx, lua_tostring(L, -1));
+            }
+
+            /* 只保留 key */
+            lua_settop(L, 3);
+        }
+    }
+
+    lua_settop(L, 0);
+}
+
+
+static int batch_reserve_rows (lua_context ctx, int rows)
+{
+    if (rows > ctx->batch_maxrows) {
+        int *offset = (int *) realloc(ctx->batch_offset, sizeof(int) * (rows * 2 + 1));
+        if (! offset) {
+            return LUACTX_OUT_MEMORY;
+        }
+
+        ctx->batch_offset = offset;
+        ctx->batch_maxrows = rows;
+    }
+
+    return LUACTX_SUCCESS;
+}
+
+
+static int batch_put_string (lua_context ctx, int *used, const char *str)
+{
+    int cb = (int) (str? strlen(str) + 1 : 0);
+
+    if (*used + cb > ctx->batch_bufsize) {
+        char *buf;
+        int bufsize = (ctx->batch_bufsize? ctx->batch_bufsize : LUACTX_VALUES_BUFSIZE);
+
+        while (*used + cb > bufsize) {
+            bufsize *= 2;
+        }
+
+        buf = (char *) realloc(ctx->batch_buffer, bufsize);
+        if (! buf) {
+            return LUACTX_OUT_MEMORY;
+        }
+
+        ctx->batch_buffer = buf;
+        ctx->batch_bufsize = bufsize;
+    }
+
+    if (cb) {
+        memcpy(ctx->batch_buffer + *used, str, cb);
+        *used += cb;
+    }
+
+    return LUACTX_SUCCESS;
+}
+
+
 int LuaCtxNew (const char *scriptfile, int threadmode, luareglib_t *reglib, lua_context *outctx)
 {
     int err;
@@ -112,6 +321,9 @@ int LuaCtxNew (const char *scriptfile, int threadmode, luareglib_t *reglib, lua_
 
     ctx->thread_mode = threadmode;
 
+    ctx->batch_inref = LUA_NOREF;
+    ctx->batch_poolref = LUA_NOREF;
+
     /* initialize Lua */
     L = luaL_newstate();
     if (! L) {
@@ -156,6 +368,8 @@ int LuaCtxNew (const char *scriptfile, int threadmode, luareglib_t *reglib, lua_
     /* cleanup stack */
     lua_settop(L, 0);
 
+    script_add_loaded(ctx, L, scriptfile);
+
     /* success */
     ctx->L = L;
 
@@ -184,6 +398,13 @@ void LuaCtxFree (lua_context *pctx)
             }
         }
 
+        free(ctx->batch_offset);
+        free(ctx->batch_buffer);
+
+        while (ctx->num_scripts-- > 0) {
+            free(ctx->scripts[ctx->num_scripts].path);
+        }
+
         free(ctx);
     }
 }
@@ -412,6 +633,340 @@ int LuaCtxCallMany (lua_context ctx, const char *funcname, const char *keys[], c
 }
 
 
+int LuaCtxCallBatch (lua_context ctx, const char *funcname, const char *keys[], int nkeys, const char *values[], int rows)
+{
+    int i, k, used;
+    const char *result;
+
+    lua_State * L = ctx->L;
+
+    ctx->batch_rows = 0;
+
+    if (rows < 0 || rows > LUACTX_BATCH_MAXROWS) {
+        snprintf(ctx->error, sizeof(ctx->error), "too many batch rows: more than %d.", LUACTX_BATCH_MAXROWS);
+        return LUACTX_ERROR;
+    }
+
+    if (batch_reserve_rows(ctx, rows) != LUACTX_SUCCESS) {
+        snprintf(ctx->error, sizeof(ctx->error), "out of memory for %d batch rows.", rows);
+        return LUACTX_OUT_MEMORY;
+    }
+
+    lua_settop(L, 0);
+
+    if (ctx->batch_inref == LUA_NOREF) {
+        // 第一次批量调用: 创建输入数组和记录表池, 之后一直复用
+        lua_newtable(L);
+        ctx->batch_inref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+        lua_newtable(L);
+        ctx->batch_poolref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    // tell it ro run __trycall(), at 1
+    lua_getglobal(L, "__trycall");
+
+    // tell __trycall() the funcname, at 2
+    lua_pushstring(L, funcname);
+
+    // tell __trycall() the intable (array of records), at 3
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->batch_inref);
+
+    // pool of record tables, at 4
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->batch_poolref);
+
+    for (i = 0; i < rows; i++) {
+        const char **rowvalues = values + i * nkeys;
+
+        lua_rawgeti(L, 4, i + 1);
+
+        if (! lua_istable(L, -1)) {
+            // 池中没有第 i 条记录表: 创建并放入池
+            lua_pop(L, 1);
+
+            lua_createtable(L, 0, nkeys);
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, 4, i + 1);
+        }
+
+        // 覆盖记录表的全部字段 (值为 NULL 时删除字段), record table at -1
+        for (k = 0; k < nkeys; k++) {
+            lua_pushstring(L, rowvalues[k]);
+            lua_setfield(L, -2, keys[k]);
+        }
+
+        // intable[i+1] = record, pop record
+        lua_rawseti(L, 3, i + 1);
+    }
+
+    // 删除上一次多出的记录, 保证 #intable == rows
+    for (i = rows; i < ctx->batch_inrows; i++) {
+        lua_pushnil(L);
+        lua_rawseti(L, 3, i + 1);
+    }
+
+    ctx->batch_inrows = rows;
+
+    // remove pool, intable again at -1
+    lua_pop(L, 1);
+
+    // Run function, !!! NRETURN=1 !!!
+    if ( lua_pcall(L, 2, 1, 0) ) {
+        snprintf(ctx->error, sizeof(ctx->error), "lua_pcall fail: %s", lua_tostring(L, -1));
+        return LUACTX_ERROR;
+    }
+
+    if (! lua_istable(L, 1)) {
+        snprintf(ctx->error, sizeof(ctx->error), "%s() not return a table.", funcname);
+        return LUACTX_ERROR;
+    }
+
+    // 整批的结果: __trycall() 总是设置 result 和 exception
+    lua_getfield(L, 1, "result");
+    result = lua_tostring(L, -1);
+
+    if (! result || strcmp(result, "SUCCESS")) {
+        lua_getfield(L, 1, "exception");
+
+        snprintf(ctx->error, sizeof(ctx->error), "%s() result=%s: %s", funcname,
+            (result? result : "(null)"),
+            (lua_tostring(L, -1)? lua_tostring(L, -1) : "(none)"));
+
+        return LUACTX_ERROR;
+    }
+
+    lua_settop(L, 1);
+
+    used = 0;
+
+    for (i = 0; i < rows; i++) {
+        const char *verdict = 0;
+        const char *message = 0;
+
+        lua_rawgeti(L, 1, i + 1);
+
+        if (lua_istable(L, -1)) {
+            lua_getfield(L, -1, "result");
+            lua_getfield(L, -2, "message");
+
+            verdict = lua_tostring(L, -2);
+            message = lua_tostring(L, -1);
+        } else {
+            verdict = lua_tostring(L, -1);
+        }
+
+        ctx->batch_offset[i * 2] = used;
+
+        if (batch_put_string(ctx, &used, verdict) != LUACTX_SUCCESS) {
+            snprintf(ctx->error, sizeof(ctx->error), "out of memory for batch verdicts.");
+            return LUACTX_OUT_MEMORY;
+        }
+
+        ctx->batch_offset[i * 2 + 1] = used;
+
+        if (batch_put_string(ctx, &used, message) != LUACTX_SUCCESS) {
+            snprintf(ctx->error, sizeof(ctx->error), "out of memory for batch messages.");
+            return LUACTX_OUT_MEMORY;
+        }
+
+        ctx->batch_offset[i * 2 + 2] = used;
+
+        lua_settop(L, 1);
+    }
+
+    ctx->batch_rows = rows;
+
+    return LUACTX_SUCCESS;
+}
+
+
+int LuaCtxHasFunction (lua_context ctx, const char *funcname)
+{
+    int ret;
+
+    lua_State * L = ctx->L;
+
+    lua_settop(L, 0);
+
+    lua_getglobal(L, funcname);
+    ret = lua_isfunction(L, -1);
+
+    lua_settop(L, 0);
+
+    return ret;
+}
+
+
+int LuaCtxBatchRows (lua_context ctx)
+{
+    return ctx->batch_rows;
+}
+
+
+int LuaCtxGetVerdict (lua_context ctx, int row, char **outverdict)
+{
+    if (row >= 0 && row < ctx->batch_rows) {
+        int start = ctx->batch_offset[row * 2];
+        int end = ctx->batch_offset[row * 2 + 1];
+        *outverdict = ctx->batch_buffer + start;
+        return (end - start);
+    } else {
+        /* bad row */
+        return 0;
+    }
+}
+
+
+int LuaCtxGetMessage (lua_context ctx, int row, char **outmessage)
+{
+    if (row >= 0 && row < ctx->batch_rows) {
+        int start = ctx->batch_offset[row * 2 + 1];
+        int end = ctx->batch_offset[row * 2 + 2];
+        *outmessage = ctx->batch_buffer + start;
+        return (end - start);
+    } else {
+        /* bad row */
+        return 0;
+    }
+}
+
+
+int LuaCtxHasFFI (lua_context ctx)
+{
+#ifdef LUACTX_USE_LUAJIT
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+/**
+ * 调用 require("ffi").<method>(arg), 返回值在栈顶
+ */
+static int luactx_ffi_call (lua_context ctx, const char *method, const char *arg)
+{
+    lua_State * L = ctx->L;
+
+    if (! LuaCtxHasFFI(ctx)) {
+        snprintf(ctx->error, sizeof(ctx->error), "ffi not supported: not LuaJIT backend.");
+        return LUACTX_ERROR;
+    }
+
+    lua_settop(L, 0);
+
+    lua_getglobal(L, "require");
+    lua_pushstring(L, "ffi");
+
+    if ( lua_pcall(L, 1, 1, 0) ) {
+        snprintf(ctx->error, sizeof(ctx->error), "require ffi fail: %s", lua_tostring(L, -1));
+        return LUACTX_ERROR;
+    }
+
+    // ffi.<method>, ffi table at 1
+    lua_getfield(L, 1, method);
+    lua_pushstring(L, arg);
+
+    if ( lua_pcall(L, 1, 1, 0) ) {
+        snprintf(ctx->error, sizeof(ctx->error), "ffi.%s fail: %s", method, lua_tostring(L, -1));
+        return LUACTX_ERROR;
+    }
+
+    return LUACTX_SUCCESS;
+}
+
+
+int LuaCtxFFIDef (lua_context ctx, const char *cdefs)
+{
+    int ret = luactx_ffi_call(ctx, "cdef", cdefs);
+
+    lua_settop(ctx->L, 0);
+
+    return ret;
+}
+
+
+int LuaCtxFFISizeof (lua_context ctx, const char *ctype)
+{
+    int size = -1;
+
+    if (luactx_ffi_call(ctx, "sizeof", ctype) == LUACTX_SUCCESS && lua_isnumber(ctx->L, -1)) {
+        size = (int) lua_tointeger(ctx->L, -1);
+    }
+
+    lua_settop(ctx->L, 0);
+
+    return size;
+}
+
+
+int LuaCtxCallFFI (lua_context ctx, const char *funcname, const void *inrecs, void *outrecs, int count)
+{
+    lua_State * L = ctx->L;
+
+    lua_settop(L, 0);
+
+    lua_getglobal(L, funcname);
+
+    if (! lua_isfunction(L, -1)) {
+        snprintf(ctx->error, sizeof(ctx->error), "error funcname: %s", funcname);
+        lua_settop(L, 0);
+        return LUACTX_ERROR;
+    }
+
+    // C 内存以 lightuserdata 传入, 不创建表和字符串
+    lua_pushlightuserdata(L, (void *) inrecs);
+    lua_pushlightuserdata(L, outrecs);
+    lua_pushinteger(L, count);
+
+    // Run function, !!! NRETURN=0 !!!
+    if ( lua_pcall(L, 3, 0, 0) ) {
+        snprintf(ctx->error, sizeof(ctx->error), "lua_pcall fail: %s", lua_tostring(L, -1));
+        lua_settop(L, 0);
+        return LUACTX_ERROR;
+    }
+
+    return LUACTX_SUCCESS;
+}
+
+
+int LuaCtxScriptChanged (lua_context ctx, const char **outfile)
+{
+    int i;
+
+    luactx_script_t cur;
+
+    for (i = 0; i < ctx->num_scripts; i++) {
+        luactx_script_t *script = &ctx->scripts[i];
+
+        script_stat(&cur, script->path);
+
+        if (cur.ino != script->ino || cur.size != script->size ||
+            cur.mtime != script->mtime || cur.mtime_ns != script->mtime_ns) {
+            if (outfile) {
+                *outfile = script->path;
+            }
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+void LuaCtxScriptRefresh (lua_context ctx)
+{
+    int i;
+
+    for (i = 0; i < ctx->num_scripts; i++) {
+        luactx_script_t *script = &ctx->scripts[i];
+
+        script_stat(script, script->path);
+    }
+}
+
+
 int LuaCtxNumPairs (lua_context ctx)
 {
     return ctx->kv_pairs;
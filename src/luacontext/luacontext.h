@@ -30,7 +30,7 @@
  *
  * @create: 2018-10-15
  *
- * @update: 2018-11-09 14:24:00
+ * @update: 2018-11-29 09:40:18
  *
  */
 #ifndef LUACTX_H_INCLUDED
@@ -41,11 +41,19 @@ extern "C" {
 #endif
 
 /**
- * liblua.a
+ * liblua.a (PUC Lua 5.3), 或者 libluajit-5.1.a (LuaJIT 2.1, 定义 LUACTX_USE_LUAJIT).
+ *   LuaJIT 的头文件在 luajit-2.1/ 下, 不会和 Lua 5.3 的头文件混用
  */
-#include "lua.h"
-#include "lualib.h"
-#include "lauxlib.h"
+#ifdef LUACTX_USE_LUAJIT
+#  include "luajit-2.1/lua.h"
+#  include "luajit-2.1/lualib.h"
+#  include "luajit-2.1/lauxlib.h"
+#  include "luajit-2.1/luajit.h"
+#else
+#  include "lua.h"
+#  include "lualib.h"
+#  include "lauxlib.h"
+#endif
 
 
 /* 定义函数返回值 */
@@ -95,6 +103,18 @@ extern "C" {
 #endif
 
 
+/* 批量调用 (LuaCtxCallBatch) 一次支持的最大记录数 */
+#ifndef LUACTX_BATCH_MAXROWS
+#  define LUACTX_BATCH_MAXROWS    4096
+#endif
+
+
+/* 记录修改时间的脚本文件最大数目: 主脚本和 require 的模块 */
+#ifndef LUACTX_SCRIPTS_MAXNUM
+#  define LUACTX_SCRIPTS_MAXNUM     32
+#endif
+
+
 typedef int (* luaopen_libname_func) (lua_State *);
 
 typedef struct luareglib_t
@@ -130,6 +150,79 @@ extern int LuaCtxCall (lua_context ctx, const char *funcname, const char *key, c
 
 extern int LuaCtxCallMany (lua_context ctx, const char *funcname, const char *keys[], const char *values[], int kv_pairs);
 
+/**
+ * 批量调用: 一次把 rows 条记录传给脚本函数 funcname, 代替逐条 LuaCtxCallMany.
+ *
+ *   values 按行存放: 第 i 条记录的第 k 个字段为 values[i * nkeys + k].
+ *   脚本函数的输入是记录表的数组 (#intab == rows), 每条记录是 {keys[k] = value} 的表.
+ *   输入数组和记录表保存在注册表中, 每次调用复用, 脚本不能保留对它们的引用!
+ *
+ *   脚本函数返回数组, 第 i 个元素是第 i 条记录的结论 (verdict):
+ *     字符串: 结论本身, 例如 "SUCCESS", "REJECT"
+ *     表:     {result = 结论, message = 消息}
+ *
+ * 返回 LUACTX_SUCCESS 时由 LuaCtxGetVerdict/LuaCtxGetMessage 读取每条记录的输出.
+ *   函数不存在或者异常时返回 LUACTX_ERROR (LuaCtxGetError 得到错误信息)
+ */
+extern int LuaCtxCallBatch (lua_context ctx, const char *funcname, const char *keys[], int nkeys, const char *values[], int rows);
+
+/**
+ * 脚本是否定义了全局函数 funcname. 用于判断是否支持批量调用
+ */
+extern int LuaCtxHasFunction (lua_context ctx, const char *funcname);
+
+/**
+ * 上一次批量调用的记录数
+ */
+extern int LuaCtxBatchRows (lua_context ctx);
+
+/**
+ * 第 row 条记录的结论. 返回字节数 (含 '\0'), 没有结论返回 0
+ */
+extern int LuaCtxGetVerdict (lua_context ctx, int row, char **outverdict);
+
+/**
+ * 第 row 条记录的消息. 返回字节数 (含 '\0'), 没有消息返回 0
+ */
+extern int LuaCtxGetMessage (lua_context ctx, int row, char **outmessage);
+
+/**
+ * 是否是 LuaJIT 后端: 支持 LuaCtxFFIDef 和 LuaCtxFFISizeof
+ */
+extern int LuaCtxHasFFI (lua_context ctx);
+
+/**
+ * 定义 FFI 类型: ffi.cdef(cdefs). 每个 lua_context 只能定义一次同名的类型.
+ *   不是 LuaJIT 后端返回 LUACTX_ERROR
+ */
+extern int LuaCtxFFIDef (lua_context ctx, const char *cdefs);
+
+/**
+ * FFI 类型的字节数: ffi.sizeof(ctype). 用于检查 cdef 和 C 结构一致. 失败返回 -1
+ */
+extern int LuaCtxFFISizeof (lua_context ctx, const char *ctype);
+
+/**
+ * FFI 调用: 脚本函数 funcname(inrecs, outrecs, count) 直接读写 C 内存, 不复制字符串.
+ *
+ *   inrecs 和 outrecs 以 lightuserdata 传入, 脚本用 ffi.cast 转换为 cdef 定义的结构指针,
+ *   读 inrecs[0..count-1], 写 outrecs[0..count-1]. 调用结束之后脚本不能保留这些指针!
+ *   不经过 __trycall: 函数不存在或者异常时返回 LUACTX_ERROR (LuaCtxGetError 得到错误信息)
+ */
+extern int LuaCtxCallFFI (lua_context ctx, const char *funcname, const void *inrecs, void *outrecs, int count);
+
+/**
+ * 脚本文件是否已经修改: 比较 LuaCtxNew 加载时记录的主脚本和 require 的模块
+ *   (package.path 中找到的 .lua 文件) 的修改时间, 大小和 inode.
+ *   有文件修改或者删除返回 1, outfile 为第一个修改的文件 (可以为 NULL); 没有修改返回 0
+ */
+extern int LuaCtxScriptChanged (lua_context ctx, const char **outfile);
+
+/**
+ * 重新记录全部脚本文件的当前状态. 用于重新加载失败之后: 脚本没有再次修改不会重试
+ */
+extern void LuaCtxScriptRefresh (lua_context ctx);
+
 extern int LuaCtxNumPairs (lua_context ctx);
 
 /**
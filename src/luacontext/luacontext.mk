@@ -3,7 +3,7 @@
 #
 # @version: 0.4.4
 # @create: 2018-10-10 10:00:00
-# @update: 2018-11-09 11:58:53
+# @update: 2018-11-28 17:05:22
 #######################################################################
 
 TARGET := libluacontext.a
@@ -26,6 +26,17 @@ SOURCES := \
 #     nothing at all.
 SRC_DEFS := NDEBUG
 
+# LuaJIT 2.1 后端 (FFI): make LUAJIT=1
+#   需要 libs/include/luajit-2.1/ 和 libs/lib/libluajit-5.1.a,
+#   client.mk 必须使用同样的 LUAJIT 设置
+ifdef LUAJIT
+    SRC_DEFS += LUACTX_USE_LUAJIT
+
+    TGT_LDLIBS  := \
+	    ${LIB_PREFIX}/libluajit-5.1.a \
+	    -lpthread
+endif
+
 
 SRC_INCDIRS := . \
     ../../libs/include
@@ -4,7 +4,7 @@
 #
 # @version: 0.4.4
 # @create: 2018-05-18 14:00:00
-# @update: 2018-11-07 10:20:15
+# @update: 2018-11-30 20:48:03
 #######################################################################
 # GCC, the GNU C compiler, supports `-g' with or without `-O',
 #   making it possible to debug optimized code.
@@ -47,4 +47,8 @@ SUBMAKEFILES := common/common.mk \
 	luacontext/luacontext.mk \
 	redisapi/redisapi.mk \
 	server/server.mk \
-	client/client.mk
+	client/client.mk \
+	tools/tools.mk \
+	tools/loadgen.mk \
+	tools/evproduce.mk \
+	tools/hashmap_bench.mk
@@ -29,7 +29,7 @@
  *
  * @create: 2018-02-10
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-24 15:42:19
  *
  */
 
@@ -582,6 +582,183 @@ void RedisFreeReplyObject(redisReply **ppreply)
 }
 
 
+/**
+ * 'MOVED 7142 127.0.0.1:7002' => host="127.0.0.1", port=7002
+ */
+static int redis_reply_moved(const redisReply *reply, char *host, size_t hostsize, int *port)
+{
+    const char *start, *end;
+
+    if (reply->type != REDIS_REPLY_ERROR || strncmp(reply->str, "MOVED ", 6)) {
+        return 0;
+    }
+
+    start = strchr(&(reply->str[6]), 32);
+    if (! start) {
+        return 0;
+    }
+    ++start;
+
+    end = strrchr(start, ':');
+    if (! end || end == start || (size_t) (end - start) >= hostsize) {
+        return 0;
+    }
+
+    memcpy(host, start, end - start);
+    host[end - start] = 0;
+
+    *port = atoi(end + 1);
+
+    return (*port > 0? 1 : 0);
+}
+
+
+/**
+ * 在 ctx 上流水线执行 idx[0..num-1] 指定的命令
+ */
+static int redis_pipeline_exec(RedisConn_t * redconn, redisContext *ctx, int num, const int *idx,
+    const int *argcs, const char ***argvs, const size_t **argvlens, redisReply **replies)
+{
+    int i, k;
+
+    for (i = 0; i < num; i++) {
+        k = idx[i];
+
+        if (redisAppendCommandArgv(ctx, argcs[k], argvs[k], argvlens[k]) != REDIS_OK) {
+            // ctx->errstr 与 errmsg 一样长: 截断到前缀之后剩余的空间
+            snprintf(redconn->errmsg, sizeof(redconn->errmsg), "redisAppendCommandArgv failed: %.*s",
+                (int) (sizeof(redconn->errmsg) - sizeof("redisAppendCommandArgv failed: ")), ctx->errstr);
+            redconn->errmsg[ REDISAPI_ERRMSG_MAXLEN ] = 0;
+            RedisConnCloseNode(redconn, redconn->active_node->index);
+            return REDISAPI_ERROR;
+        }
+    }
+
+    for (i = 0; i < num; i++) {
+        k = idx[i];
+
+        if (redisGetReply(ctx, (void **) &replies[k]) != REDIS_OK || ! replies[k]) {
+            // 执行失败, 连接不能再被使用. 必须建立新连接!!
+            snprintf(redconn->errmsg, sizeof(redconn->errmsg), "redisGetReply failed: bad context.");
+            redconn->errmsg[ REDISAPI_ERRMSG_MAXLEN ] = 0;
+            RedisConnCloseNode(redconn, redconn->active_node->index);
+
+            while (i-- > 0) {
+                RedisFreeReplyObject(&replies[idx[i]]);
+            }
+            return REDISAPI_ERROR;
+        }
+    }
+
+    return REDISAPI_SUCCESS;
+}
+
+
+__attribute__((used))
+int RedisConnExecPipeline(RedisConn_t * redconn, int numCmds, const int *argcs, const char ***argvs, const size_t **argvlens, redisReply **replies)
+{
+    int i, k, num, ret, port, failed, redirects;
+
+    char host[REDISAPI_ERRMSG_MAXLEN + 1];
+
+    redisContext *ctx;
+
+    int *idx;
+
+    bzero(replies, sizeof(redisReply *) * numCmds);
+
+    if (numCmds <= 0) {
+        snprintf(redconn->errmsg, sizeof(redconn->errmsg), "REDISAPI_EARG: no commands.");
+        redconn->errmsg[ REDISAPI_ERRMSG_MAXLEN ] = 0;
+        return REDISAPI_EARG;
+    }
+
+    idx = (int *) malloc(sizeof(int) * numCmds);
+    if (! idx) {
+        snprintf(redconn->errmsg, sizeof(redconn->errmsg), "REDISAPI_EMEM: out of memory.");
+        redconn->errmsg[ REDISAPI_ERRMSG_MAXLEN ] = 0;
+        return REDISAPI_EMEM;
+    }
+
+    for (i = 0; i < numCmds; i++) {
+        idx[i] = i;
+    }
+
+    ctx = RedisConnGetActiveContext(redconn, 0, 0);
+    if (! ctx) {
+        free(idx);
+        return REDISAPI_ERROR;
+    }
+
+    ret = redis_pipeline_exec(redconn, ctx, numCmds, idx, argcs, argvs, argvlens, replies);
+    if (ret != REDISAPI_SUCCESS) {
+        free(idx);
+        return ret;
+    }
+
+    // 被 MOVED 的命令: 每一轮取第一个的目标节点, 把去往同一节点的命令一起重新执行
+    for (redirects = 0; redirects < 16; redirects++) {
+        num = 0;
+        port = 0;
+
+        for (i = 0; i < numCmds; i++) {
+            char h[REDISAPI_ERRMSG_MAXLEN + 1];
+            int p;
+
+            if (replies[i] && redis_reply_moved(replies[i], h, sizeof(h), &p)) {
+                if (! num) {
+                    strcpy(host, h);
+                    port = p;
+                }
+
+                if (p == port && ! strcmp(h, host)) {
+                    RedisFreeReplyObject(&replies[i]);
+                    idx[num++] = i;
+                }
+            }
+        }
+
+        if (! num) {
+            break;
+        }
+
+        ctx = RedisConnGetActiveContext(redconn, host, port);
+
+        if (! ctx || redis_pipeline_exec(redconn, ctx, num, idx, argcs, argvs, argvlens, replies) != REDISAPI_SUCCESS) {
+            for (i = 0; i < numCmds; i++) {
+                RedisFreeReplyObject(&replies[i]);
+            }
+            free(idx);
+            return REDISAPI_ERROR;
+        }
+    }
+
+    free(idx);
+
+    // 其余的错误 (例如 NOAUTH) 逐个按 RedisConnExecCommand 的规则处理
+    failed = 0;
+
+    for (k = 0; k < numCmds; k++) {
+        if (replies[k]->type == REDIS_REPLY_ERROR) {
+            if (! strncmp(replies[k]->str, "NOAUTH ", 7)) {
+                RedisFreeReplyObject(&replies[k]);
+                replies[k] = RedisConnExecCommand(redconn, argcs[k], argvs[k], argvlens[k]);
+            } else {
+                snprintf(redconn->errmsg, sizeof(redconn->errmsg), "REDIS_REPLY_ERROR: %s", replies[k]->str);
+                redconn->errmsg[ REDISAPI_ERRMSG_MAXLEN ] = 0;
+                RedisFreeReplyObject(&replies[k]);
+            }
+
+            if (! replies[k]) {
+                ++failed;
+            }
+        }
+    }
+
+    return failed;
+}
+
+
 __attribute__((used))
 int RedisExpireSet(RedisConn_t * redconn, const char *key, int64_t expire_ms)
 {
@@ -39,7 +39,7 @@
  *
  * @create: 2018-02-10
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-24 15:42:19
  *
  */
 #ifndef REDIS_CONN_SYN_H_INCLUDED
@@ -198,6 +198,18 @@ extern redisReply * RedisConnExecCommand(RedisConn_t * redconn, int argc, const
 
 extern void RedisFreeReplyObject(redisReply **reply);
 
+/**
+ * 流水线: 一次发送全部命令, 再依次读取应答 (一次往返).
+ *   集群中被 MOVED 到其他节点的命令, 按节点分组之后在新节点上再流水线
+ *   执行一次. replies[i] 是第 i 个命令的应答, 失败的命令为 0.
+ *
+ * returns:
+ *   REDISAPI_SUCCESS - 全部命令成功
+ *   > 0              - 失败的命令数目 (errmsg 是最后一个错误)
+ *   < 0              - 连接错误, 全部 replies 为 0
+ */
+extern int RedisConnExecPipeline(RedisConn_t * redconn, int numCmds, const int *argcs, const char ***argvs, const size_t **argvlens, redisReply **replies);
+
 /**
  * 同步 API
  * high level functions
@@ -0,0 +1,868 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: chunk_store.c
+ *   server-side content-addressed chunk index (dedup)
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-12
+ *
+ * @update: 2018-12-01 14:37:05
+ */
+
+#include "server_api.h"
+
+#include "chunk_store.h"
+#include "server_metrics.h"
+
+
+#define CHUNK_JOURNAL_NAME       "chunks.journal"
+
+#define CHUNK_JOURNAL_MAGIC      "XSCHKJ01"
+#define CHUNK_JOURNAL_MAGIC_LEN  8
+
+#define CHUNK_REC_FILE    1     /* 文件清单: 代替同一个文件原来的清单 */
+#define CHUNK_REC_DROP    2     /* 删除文件清单 (没有块) */
+
+
+typedef struct chunk_rec_head_t
+{
+    ub4 type;
+    ub4 nchunks;
+
+    ub8 fileid;
+    ub8 size;
+    ub8 mtime;
+
+    ub4 pathlen;
+    ub4 pad;
+} chunk_rec_head_t;
+
+
+typedef struct chunk_rec_loc_t
+{
+    ub8 offset;
+    ub4 length;
+    ub4 pad;
+
+    ub1 digest[XS_CHUNK_HASH_SIZE];
+} chunk_rec_loc_t;
+
+
+#define chunk_rec_pathsize(pathlen)  \
+    ((int64_t) (((pathlen) + 7) & ~7))
+
+#define chunk_rec_size(pathlen, nchunks)  \
+    ((int64_t) sizeof(chunk_rec_head_t) + chunk_rec_pathsize(pathlen) + (int64_t) sizeof(chunk_rec_loc_t) * (nchunks))
+
+
+static int chunk_store_mkdirs (char *pathname, int len)
+{
+    int i;
+
+    for (i = 1; i < len; i++) {
+        if (pathname[i] == '/') {
+            pathname[i] = 0;
+
+            if (mkdir(pathname, 0755) != 0 && errno != EEXIST) {
+                LOGGER_ERROR("mkdir error(%d): %s. (%s)", errno, strerror(errno), pathname);
+                pathname[i] = '/';
+                return (-1);
+            }
+
+            pathname[i] = '/';
+        }
+    }
+
+    return 0;
+}
+
+
+static int chunk_write_all (int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (-1);
+        }
+
+        buf += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+
+/* FNV-1a */
+static inline int chunk_path_hash (const char *pathfile, int pathlen)
+{
+    int i;
+    ub4 h = 2166136261U;
+
+    for (i = 0; i < pathlen; i++) {
+        h ^= (ub1) pathfile[i];
+        h *= 16777619U;
+    }
+
+    return (int) (h & XSYNC_CHUNK_STORE_HASHMAX);
+}
+
+
+static inline ub8 chunk_stat_mtime (const struct stat *sb)
+{
+    return (ub8) sb->st_mtim.tv_sec * 1000000000ULL + (ub8) sb->st_mtim.tv_nsec;
+}
+
+
+static xs_chunk_t * chunk_find_inlock (XS_chunk_store store, const ub1 digest[XS_CHUNK_HASH_SIZE])
+{
+    struct hlist_node *hp;
+
+    hlist_for_each(hp, &store->chunk_hlist[xs_chunk_digest_hash(digest)]) {
+        xs_chunk_t *chunk = hlist_entry(hp, xs_chunk_t, i_hash);
+
+        if (! memcmp(chunk->digest, digest, XS_CHUNK_HASH_SIZE)) {
+            return chunk;
+        }
+    }
+
+    return 0;
+}
+
+
+static xs_chunk_file_t * chunk_file_find_inlock (XS_chunk_store store, const char *pathfile, int pathlen)
+{
+    struct hlist_node *hp;
+
+    hlist_for_each(hp, &store->file_hlist[chunk_path_hash(pathfile, pathlen)]) {
+        xs_chunk_file_t *file = hlist_entry(hp, xs_chunk_file_t, i_hash);
+
+        if (file->pathlen == pathlen && ! memcmp(file->pathfile, pathfile, pathlen)) {
+            return file;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * 在 store->lock 内调用: 删除文件清单, 引用计数为 0 的块从索引中删除
+ */
+static void chunk_file_remove_inlock (XS_chunk_store store, xs_chunk_file_t *file)
+{
+    ub4 i;
+
+    for (i = 0; i < file->nchunks; i++) {
+        xs_chunk_t *chunk = file->locs[i].chunk;
+
+        hlist_del(&file->locs[i].i_loc);
+
+        if (--chunk->refc == 0) {
+            hlist_del(&chunk->i_hash);
+            store->chunks--;
+
+            mem_free(chunk);
+        }
+    }
+
+    hlist_del(&file->i_hash);
+
+    store->files--;
+    store->livesize -= chunk_rec_size(file->pathlen, file->nchunks);
+
+    if (file->locs) {
+        mem_free(file->locs);
+    }
+
+    mem_free(file);
+}
+
+
+/**
+ * 在 store->lock 内调用: 由 FILE 记录添加文件清单, 代替同一个文件原来的清单
+ */
+static void chunk_file_add_inlock (XS_chunk_store store, const char *rec)
+{
+    ub4 i;
+
+    chunk_rec_head_t head;
+    xs_chunk_file_t *file;
+
+    const char *pathfile = rec + sizeof(head);
+    const char *locbuf;
+
+    memcpy(&head, rec, sizeof(head));
+
+    locbuf = pathfile + chunk_rec_pathsize(head.pathlen);
+
+    file = chunk_file_find_inlock(store, pathfile, (int) head.pathlen);
+    if (file) {
+        chunk_file_remove_inlock(store, file);
+    }
+
+    file = (xs_chunk_file_t *) mem_alloc_zero(1, sizeof(xs_chunk_file_t) + head.pathlen + 1);
+
+    file->fileid = head.fileid;
+    file->size = head.size;
+    file->mtime = head.mtime;
+
+    file->pathlen = (int) head.pathlen;
+    memcpy(file->pathfile, pathfile, head.pathlen);
+
+    file->nchunks = head.nchunks;
+    file->locs = (xs_chunk_loc_t *) mem_alloc_zero(head.nchunks, sizeof(xs_chunk_loc_t));
+
+    for (i = 0; i < head.nchunks; i++) {
+        chunk_rec_loc_t lr;
+        xs_chunk_t *chunk;
+
+        memcpy(&lr, locbuf + sizeof(lr) * i, sizeof(lr));
+
+        chunk = chunk_find_inlock(store, lr.digest);
+
+        if (! chunk) {
+            chunk = (xs_chunk_t *) mem_alloc_zero(1, sizeof(xs_chunk_t));
+
+            chunk->length = lr.length;
+            memcpy(chunk->digest, lr.digest, XS_CHUNK_HASH_SIZE);
+
+            INIT_HLIST_HEAD(&chunk->locs);
+
+            hlist_add_head(&chunk->i_hash, &store->chunk_hlist[xs_chunk_digest_hash(lr.digest)]);
+            store->chunks++;
+        }
+
+        file->locs[i].chunk = chunk;
+        file->locs[i].file = file;
+        file->locs[i].offset = lr.offset;
+
+        hlist_add_head(&file->locs[i].i_loc, &chunk->locs);
+        chunk->refc++;
+    }
+
+    hlist_add_head(&file->i_hash, &store->file_hlist[chunk_path_hash(file->pathfile, file->pathlen)]);
+
+    store->files++;
+    store->livesize += chunk_rec_size(head.pathlen, head.nchunks);
+
+    if (head.fileid >= store->nextfileid) {
+        store->nextfileid = head.fileid + 1;
+    }
+}
+
+
+/**
+ * 组成一个日志记录. DROP 记录没有块 (nchunks = 0)
+ */
+static char * chunk_rec_build (ub4 type, ub8 fileid, ub8 size, ub8 mtime, const char *pathfile, int pathlen,
+    const xs_chunk_ref_t *chunks, int nchunks, int64_t *reclen)
+{
+    int i;
+
+    chunk_rec_head_t head;
+    char *locbuf, *rec;
+
+    *reclen = chunk_rec_size(pathlen, nchunks);
+
+    rec = (char *) mem_alloc_zero(1, (size_t) *reclen);
+
+    bzero(&head, sizeof(head));
+
+    head.type = type;
+    head.nchunks = (ub4) nchunks;
+    head.fileid = fileid;
+    head.size = size;
+    head.mtime = mtime;
+    head.pathlen = (ub4) pathlen;
+
+    memcpy(rec, &head, sizeof(head));
+    memcpy(rec + sizeof(head), pathfile, pathlen);
+
+    locbuf = rec + sizeof(head) + chunk_rec_pathsize(pathlen);
+
+    for (i = 0; i < nchunks; i++) {
+        chunk_rec_loc_t lr;
+
+        bzero(&lr, sizeof(lr));
+
+        lr.offset = chunks[i].offset;
+        lr.length = chunks[i].length;
+        memcpy(lr.digest, chunks[i].digest, XS_CHUNK_HASH_SIZE);
+
+        memcpy(locbuf + sizeof(lr) * i, &lr, sizeof(lr));
+    }
+
+    return rec;
+}
+
+
+/**
+ * 在 store->lock 内调用: 每个文件清单写入一个记录到新的日志文件, 替换原来的日志
+ */
+static int chunk_journal_compact (XS_chunk_store store)
+{
+    int fd, hash;
+
+    char tmpfile[PATH_MAX + 8];
+
+    struct hlist_node *hp;
+    xs_chunk_ref_t *chunks = 0;
+
+    int64_t size = CHUNK_JOURNAL_MAGIC_LEN;
+
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", store->journal);
+
+    fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        LOGGER_ERROR("open fail(%d): %s (%s)", errno, strerror(errno), tmpfile);
+        return (-1);
+    }
+
+    if (chunk_write_all(fd, CHUNK_JOURNAL_MAGIC, CHUNK_JOURNAL_MAGIC_LEN) != 0) {
+        goto error_exit;
+    }
+
+    for (hash = 0; hash <= XSYNC_CHUNK_STORE_HASHMAX; hash++) {
+        hlist_for_each(hp, &store->file_hlist[hash]) {
+            xs_chunk_file_t *file = hlist_entry(hp, xs_chunk_file_t, i_hash);
+
+            ub4 i;
+            char *rec;
+            int64_t reclen;
+
+            chunks = (xs_chunk_ref_t *) mem_realloc(chunks, sizeof(xs_chunk_ref_t) * file->nchunks);
+
+            for (i = 0; i < file->nchunks; i++) {
+                chunks[i].offset = file->locs[i].offset;
+                chunks[i].length = file->locs[i].chunk->length;
+                memcpy(chunks[i].digest, file->locs[i].chunk->digest, XS_CHUNK_HASH_SIZE);
+            }
+
+            rec = chunk_rec_build(CHUNK_REC_FILE, file->fileid, file->size, file->mtime,
+                file->pathfile, file->pathlen, chunks, (int) file->nchunks, &reclen);
+
+            if (chunk_write_all(fd, rec, (size_t) reclen) != 0) {
+                mem_free(rec);
+                goto error_exit;
+            }
+
+            mem_free(rec);
+
+            size += reclen;
+        }
+    }
+
+    if (fdatasync(fd) != 0 || rename(tmpfile, store->journal) != 0) {
+        goto error_exit;
+    }
+
+    if (chunks) {
+        mem_free(chunks);
+    }
+
+    close(store->fd);
+
+    store->fd = fd;
+    store->size = size;
+
+    LOGGER_INFO("chunk journal compacted: files=%ju chunks=%ju size=%"PRId64" (%s)", store->files, store->chunks, size, store->journal);
+
+    return 0;
+
+error_exit:
+    LOGGER_ERROR("compact fail(%d): %s (%s)", errno, strerror(errno), tmpfile);
+
+    if (chunks) {
+        mem_free(chunks);
+    }
+
+    close(fd);
+    unlink(tmpfile);
+
+    return (-1);
+}
+
+
+/**
+ * 在 store->lock 内调用: 追加一个记录. 写入失败时截掉写了一半的记录
+ */
+static int chunk_journal_append (XS_chunk_store store, const char *rec, int64_t reclen, int sync)
+{
+    if (chunk_write_all(store->fd, rec, (size_t) reclen) != 0) {
+        LOGGER_ERROR("write fail(%d): %s (%s)", errno, strerror(errno), store->journal);
+
+        if (ftruncate(store->fd, (off_t) store->size) != 0) {
+            LOGGER_ERROR("ftruncate fail(%d): %s (%s)", errno, strerror(errno), store->journal);
+        }
+
+        return (-1);
+    }
+
+    store->size += reclen;
+
+    if (sync && fdatasync(store->fd) != 0) {
+        LOGGER_ERROR("fdatasync fail(%d): %s (%s)", errno, strerror(errno), store->journal);
+        return (-1);
+    }
+
+    if (store->size > XSYNC_CHUNK_JOURNAL_MAXSIZE && store->size > CHUNK_JOURNAL_MAGIC_LEN + store->livesize * 2) {
+        chunk_journal_compact(store);
+    }
+
+    return 0;
+}
+
+
+/**
+ * 在 store->lock 内调用: 删除文件清单并记录 DROP. DROP 不落盘: 丢失时
+ *   重新打开之后的清单由文件的长度和修改时间判断是否作废
+ */
+static void chunk_file_drop_inlock (XS_chunk_store store, xs_chunk_file_t *file)
+{
+    char *rec;
+    int64_t reclen;
+
+    rec = chunk_rec_build(CHUNK_REC_DROP, file->fileid, 0, 0, file->pathfile, file->pathlen, 0, 0, &reclen);
+
+    chunk_journal_append(store, rec, reclen, 0);
+
+    mem_free(rec);
+
+    chunk_file_remove_inlock(store, file);
+}
+
+
+/**
+ * 读入日志: 重建全部文件清单和块索引. 写了一半的尾部记录被截掉
+ */
+static int chunk_journal_load (XS_chunk_store store)
+{
+    char *buf;
+    int64_t off;
+
+    struct stat sb;
+
+    if (fstat(store->fd, &sb) != 0) {
+        LOGGER_ERROR("fstat fail(%d): %s (%s)", errno, strerror(errno), store->journal);
+        return (-1);
+    }
+
+    if (sb.st_size == 0) {
+        if (chunk_write_all(store->fd, CHUNK_JOURNAL_MAGIC, CHUNK_JOURNAL_MAGIC_LEN) != 0) {
+            LOGGER_ERROR("write fail(%d): %s (%s)", errno, strerror(errno), store->journal);
+            return (-1);
+        }
+
+        store->size = CHUNK_JOURNAL_MAGIC_LEN;
+        return 0;
+    }
+
+    buf = (char *) mem_alloc_zero(1, (size_t) sb.st_size);
+
+    if (pread(store->fd, buf, (size_t) sb.st_size, 0) != (ssize_t) sb.st_size) {
+        LOGGER_ERROR("read fail(%d): %s (%s)", errno, strerror(errno), store->journal);
+        mem_free(buf);
+        return (-1);
+    }
+
+    if (sb.st_size < CHUNK_JOURNAL_MAGIC_LEN || memcmp(buf, CHUNK_JOURNAL_MAGIC, CHUNK_JOURNAL_MAGIC_LEN)) {
+        LOGGER_ERROR("not a chunk journal: %s", store->journal);
+        mem_free(buf);
+        return (-1);
+    }
+
+    off = CHUNK_JOURNAL_MAGIC_LEN;
+
+    while (off + (int64_t) sizeof(chunk_rec_head_t) <= sb.st_size) {
+        chunk_rec_head_t head;
+        int64_t reclen;
+
+        memcpy(&head, buf + off, sizeof(head));
+
+        if (head.pathlen == 0 || head.pathlen >= PATH_MAX ||
+            ! ((head.type == CHUNK_REC_FILE && head.nchunks) || (head.type == CHUNK_REC_DROP && ! head.nchunks))) {
+            break;
+        }
+
+        reclen = chunk_rec_size(head.pathlen, head.nchunks);
+
+        if (off + reclen > sb.st_size) {
+            break;
+        }
+
+        if (head.type == CHUNK_REC_FILE) {
+            chunk_file_add_inlock(store, buf + off);
+        } else {
+            xs_chunk_file_t *file = chunk_file_find_inlock(store, buf + off + sizeof(head), (int) head.pathlen);
+
+            if (file && file->fileid == head.fileid) {
+                chunk_file_remove_inlock(store, file);
+            }
+        }
+
+        off += reclen;
+    }
+
+    mem_free(buf);
+
+    if (off < sb.st_size) {
+        LOGGER_WARN("chunk journal truncated at %"PRId64" (size=%"PRId64"): %s", off, (int64_t) sb.st_size, store->journal);
+
+        if (ftruncate(store->fd, off) != 0) {
+            LOGGER_ERROR("ftruncate fail(%d): %s (%s)", errno, strerror(errno), store->journal);
+            return (-1);
+        }
+    }
+
+    store->size = off;
+
+    return 0;
+}
+
+
+extern XS_RESULT XS_chunk_store_create (const char *rootpath, XS_chunk_store *outStore)
+{
+    int i, len;
+    XS_chunk_store store;
+
+    *outStore = 0;
+
+    len = (int) strlen(rootpath);
+    if (len == 0 || len + 1 + (int) sizeof(CHUNK_JOURNAL_NAME) + 8 > PATH_MAX) {
+        LOGGER_ERROR("invalid chunk store path: '%s'", rootpath);
+        return XS_E_PARAM;
+    }
+
+    store = (XS_chunk_store) mem_alloc_zero(1, sizeof(xs_chunk_store_t));
+
+    memcpy(store->journal, rootpath, len);
+    if (store->journal[len - 1] != '/') {
+        store->journal[len++] = '/';
+    }
+
+    if (chunk_store_mkdirs(store->journal, len) != 0) {
+        mem_free(store);
+        return XS_E_FILE;
+    }
+
+    memcpy(store->journal + len, CHUNK_JOURNAL_NAME, sizeof(CHUNK_JOURNAL_NAME));
+
+    if (threadlock_init(&store->lock) != 0) {
+        LOGGER_FATAL("threadlock_init error(%d): %s", errno, strerror(errno));
+        mem_free(store);
+        return XS_ERROR;
+    }
+
+    for (i = 0; i <= XSYNC_CHUNK_STORE_HASHMAX; i++) {
+        INIT_HLIST_HEAD(&store->chunk_hlist[i]);
+        INIT_HLIST_HEAD(&store->file_hlist[i]);
+    }
+
+    store->nextfileid = 1;
+
+    store->fd = open(store->journal, O_RDWR | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if (store->fd == -1) {
+        LOGGER_ERROR("open fail(%d): %s (%s)", errno, strerror(errno), store->journal);
+        XS_chunk_store_free(store);
+        return XS_E_FILE;
+    }
+
+    if (chunk_journal_load(store) != 0) {
+        XS_chunk_store_free(store);
+        return XS_E_FILE;
+    }
+
+    LOGGER_INFO("chunk store: files=%ju chunks=%ju (%s)", store->files, store->chunks, store->journal);
+
+    *outStore = store;
+    return XS_SUCCESS;
+}
+
+
+extern XS_VOID XS_chunk_store_free (XS_chunk_store store)
+{
+    int hash;
+    struct hlist_node *hp, *hn;
+
+    LOGGER_INFO("chunk store: files=%ju chunks=%ju dedup=%ju(%ju bytes)",
+        store->files, store->chunks, store->dedup_chunks, store->dedup_bytes);
+
+    if (store->fd != -1) {
+        fdatasync(store->fd);
+        close(store->fd);
+        store->fd = -1;
+    }
+
+    for (hash = 0; hash <= XSYNC_CHUNK_STORE_HASHMAX; hash++) {
+        hlist_for_each_safe(hp, hn, &store->file_hlist[hash]) {
+            chunk_file_remove_inlock(store, hlist_entry(hp, xs_chunk_file_t, i_hash));
+        }
+    }
+
+    threadlock_destroy(&store->lock);
+
+    mem_free(store);
+}
+
+
+extern ub4 XS_chunk_store_negotiate (XS_chunk_store store, const XSChunkDesc_t *descs, ub4 chunks, ub1 *bitmap)
+{
+    ub4 i, missing = 0;
+
+    bzero(bitmap, XS_CHUNK_BITMAP_SIZE(chunks));
+
+    threadlock_lock(&store->lock);
+
+    for (i = 0; i < chunks; i++) {
+        xs_chunk_t *chunk = chunk_find_inlock(store, descs[i].digest);
+
+        if (! chunk || chunk->length != descs[i].length) {
+            XS_CHUNK_BITMAP_SET(bitmap, i);
+            missing++;
+        }
+    }
+
+    threadlock_unlock(&store->lock);
+
+    LOGGER_DEBUG("chunks=%u missing=%u", chunks, missing);
+
+    return missing;
+}
+
+
+extern XS_VOID XS_chunk_store_begin (XS_chunk_store store, const char *pathfile)
+{
+    int valid;
+    struct stat sb;
+
+    xs_chunk_file_t *file;
+
+    valid = (stat(pathfile, &sb) == 0 && S_ISREG(sb.st_mode));
+
+    threadlock_lock(&store->lock);
+
+    file = chunk_file_find_inlock(store, pathfile, (int) strlen(pathfile));
+
+    if (file) {
+        if (! file->writing && (! valid || (ub8) sb.st_size != file->size || chunk_stat_mtime(&sb) != file->mtime)) {
+            LOGGER_DEBUG("chunk manifest expired: %s", pathfile);
+
+            chunk_file_drop_inlock(store, file);
+        } else {
+            file->writing++;
+        }
+    }
+
+    threadlock_unlock(&store->lock);
+}
+
+
+extern XS_RESULT XS_chunk_store_copyto (XS_chunk_store store, const ub1 digest[XS_CHUNK_HASH_SIZE], ub4 length,
+    const char *pathfile, int wofd, ub8 offset, ub8 wrpos, char *buf, size_t bufsize)
+{
+    int rofd, self = 0, found = 0;
+    int pathlen = (int) strlen(pathfile);
+
+    ub4 total = 0;
+    ub8 srcoff = 0, fileid = 0, size = 0, mtime = 0;
+
+    char srcfile[PATH_MAX];
+
+    struct stat sb;
+    struct hlist_node *hp;
+
+    xs_chunk_t *chunk;
+
+    threadlock_lock(&store->lock);
+
+    chunk = chunk_find_inlock(store, digest);
+
+    if (chunk && chunk->length == length) {
+        hlist_for_each(hp, &chunk->locs) {
+            xs_chunk_loc_t *loc = hlist_entry(hp, xs_chunk_loc_t, i_loc);
+            xs_chunk_file_t *file = loc->file;
+
+            if (file->pathlen >= (int) sizeof(srcfile)) {
+                continue;
+            }
+
+            if (file->pathlen == pathlen && ! memcmp(file->pathfile, pathfile, pathlen)) {
+                // 同一个文件: 只用这次还没有写过的部分, 不能和目标位置重叠
+                if (loc->offset < wrpos ||
+                    (loc->offset != offset && loc->offset < offset + length && offset < loc->offset + length)) {
+                    continue;
+                }
+
+                self = 1;
+            } else if (file->writing) {
+                continue;
+            }
+
+            memcpy(srcfile, file->pathfile, file->pathlen + 1);
+
+            srcoff = loc->offset;
+            fileid = file->fileid;
+            size = file->size;
+            mtime = file->mtime;
+
+            found = 1;
+            break;
+        }
+    }
+
+    threadlock_unlock(&store->lock);
+
+    if (! found) {
+        return XS_ERROR;
+    }
+
+    if (self && srcoff == offset) {
+        // 块已经在文件的这个位置
+        return XS_SUCCESS;
+    }
+
+    rofd = open(srcfile, O_RDONLY);
+    if (rofd == -1) {
+        LOGGER_WARN("open error(%d): %s. (%s)", errno, strerror(errno), srcfile);
+        return XS_E_FILE;
+    }
+
+    if (! self && (fstat(rofd, &sb) != 0 || (ub8) sb.st_size != size || chunk_stat_mtime(&sb) != mtime)) {
+        xs_chunk_file_t *file;
+
+        LOGGER_DEBUG("chunk manifest expired: %s", srcfile);
+
+        close(rofd);
+
+        threadlock_lock(&store->lock);
+
+        file = chunk_file_find_inlock(store, srcfile, (int) strlen(srcfile));
+
+        if (file && file->fileid == fileid && ! file->writing) {
+            chunk_file_drop_inlock(store, file);
+        }
+
+        threadlock_unlock(&store->lock);
+
+        return XS_ERROR;
+    }
+
+    while (total < length) {
+        size_t want = length - total;
+
+        ssize_t cb = pread(rofd, buf, (want > bufsize? bufsize : want), (off_t) (srcoff + total));
+
+        if (cb <= 0) {
+            if (cb < 0 && errno == EINTR) {
+                continue;
+            }
+
+            LOGGER_ERROR("pread error(%d): %s. (%s)", errno, cb? strerror(errno) : "file truncated", srcfile);
+            close(rofd);
+            return XS_E_FILE;
+        }
+
+        if (pwrite(wofd, buf, (size_t) cb, (off_t) (offset + total)) != cb) {
+            LOGGER_ERROR("pwrite error(%d): %s", errno, strerror(errno));
+            close(rofd);
+            return XS_E_FILE;
+        }
+
+        total += (ub4) cb;
+
+        metrics_counter_add(xs_server_metrics.bytes_written, (uint64_t) cb);
+    }
+
+    close(rofd);
+    return XS_SUCCESS;
+}
+
+
+extern XS_RESULT XS_chunk_store_commit (XS_chunk_store store, const char *pathfile, int wofd, const xs_chunk_ref_t *chunks, int nchunks)
+{
+    int ret;
+    uint64_t t0;
+
+    char *rec;
+    int64_t reclen;
+
+    struct stat sb;
+
+    if (nchunks == 0) {
+        XS_chunk_store_forget(store, pathfile);
+        return XS_SUCCESS;
+    }
+
+    if (fstat(wofd, &sb) != 0) {
+        LOGGER_ERROR("fstat error(%d): %s. (%s)", errno, strerror(errno), pathfile);
+
+        XS_chunk_store_forget(store, pathfile);
+        return XS_E_FILE;
+    }
+
+    t0 = metrics_now_us();
+
+    threadlock_lock(&store->lock);
+
+    rec = chunk_rec_build(CHUNK_REC_FILE, store->nextfileid, (ub8) sb.st_size, chunk_stat_mtime(&sb),
+        pathfile, (int) strlen(pathfile), chunks, nchunks, &reclen);
+
+    chunk_file_add_inlock(store, rec);
+
+    ret = chunk_journal_append(store, rec, reclen, 1);
+
+    threadlock_unlock(&store->lock);
+
+    mem_free(rec);
+
+    metrics_histogram_since(xs_server_metrics.chunk_write_seconds, t0);
+
+    return (ret == 0? XS_SUCCESS : XS_E_FILE);
+}
+
+
+extern XS_VOID XS_chunk_store_forget (XS_chunk_store store, const char *pathfile)
+{
+    xs_chunk_file_t *file;
+
+    threadlock_lock(&store->lock);
+
+    file = chunk_file_find_inlock(store, pathfile, (int) strlen(pathfile));
+
+    if (file) {
+        chunk_file_drop_inlock(store, file);
+    }
+
+    threadlock_unlock(&store->lock);
+}
@@ -0,0 +1,233 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: chunk_store.h
+ *   server-side content-addressed chunk index (dedup)
+ *
+ *   块的数据只写一次: 写在同步的目标文件里. 块索引按 SHA-256 记录块在
+ *     哪些文件的哪个偏移 (文件清单). 同样内容的块不会被重复传输, 而是
+ *     从清单记录的文件复制到新的文件.
+ *
+ *   文件清单记录在日志文件 $chunkstore/chunks.journal:
+ *     [magic:8][记录...]
+ *     记录: [type:4][nchunks:4][fileid:8][size:8][mtime:8][pathlen:4][pad:4]
+ *           [pathfile (补齐到 8 字节)][nchunks * (offset:8 length:4 pad:4 digest:32)]
+ *
+ *   FILE 记录代替同一个文件原来的清单, DROP 记录删除文件的清单. 块的
+ *     引用计数是全部清单中引用它的次数, 打开时由日志重建; 计数为 0 的块
+ *     从索引中删除 (GC). 日志超过 XSYNC_CHUNK_JOURNAL_MAXSIZE 时压缩为
+ *     每个文件一个记录. 崩溃时写了一半的尾部记录在打开时截掉.
+ *
+ *   清单记录文件的长度和修改时间: 文件在清单之后被其他程序修改过时,
+ *     清单作废, 它的块不再用于复制.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-12
+ *
+ * @update: 2018-12-01 14:37:05
+ */
+
+#ifndef CHUNK_STORE_H_INCLUDED
+#define CHUNK_STORE_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../common/common_util.h"
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+#include "../xsync-protocol.h"
+
+#include <openssl/sha.h>
+
+
+typedef struct xs_chunk_store_t * XS_chunk_store;
+
+
+/**
+ * xs_chunk_ref_t
+ *
+ *   文件中的一个块. 文件条目按文件偏移记录收到的块, 流结束时作为
+ *   文件清单提交 (XS_chunk_store_commit)
+ */
+typedef struct xs_chunk_ref_t
+{
+    ub8 offset;
+    ub4 length;
+    ub1 digest[XS_CHUNK_HASH_SIZE];
+} xs_chunk_ref_t;
+
+
+struct xs_chunk_t;
+struct xs_chunk_file_t;
+
+
+/**
+ * xs_chunk_loc_t
+ *
+ *   块在一个文件清单中的位置. 同一个块的全部位置在块的 locs 链表中
+ */
+typedef struct xs_chunk_loc_t
+{
+    /**
+     * hlist node in locs of xs_chunk_t
+     */
+    struct hlist_node i_loc;
+
+    struct xs_chunk_t *chunk;
+    struct xs_chunk_file_t *file;
+
+    ub8 offset;
+} xs_chunk_loc_t;
+
+
+/**
+ * xs_chunk_t
+ *
+ *   内存中的块索引节点. refc 为引用这个块的位置数目 (locs 链表的长度),
+ *   为 0 时从索引中删除 (GC).
+ */
+typedef struct xs_chunk_t
+{
+    /**
+     * hlist node in chunk_hlist of XS_chunk_store
+     */
+    struct hlist_node i_hash;
+
+    ub4 refc;
+    ub4 length;
+
+    struct hlist_head locs;
+
+    ub1 digest[XS_CHUNK_HASH_SIZE];
+} xs_chunk_t;
+
+
+/**
+ * xs_chunk_file_t
+ *
+ *   一个文件的清单. writing 不为 0 时文件正在被流重写: 其他文件不从这里
+ *   复制块, 同一个文件只使用还没有被重写的部分
+ */
+typedef struct xs_chunk_file_t
+{
+    /**
+     * hlist node in file_hlist of XS_chunk_store, key is pathfile
+     */
+    struct hlist_node i_hash;
+
+    ub8 fileid;
+
+    /* 提交清单时文件的长度和修改时间 (ns) */
+    ub8 size;
+    ub8 mtime;
+
+    int writing;
+
+    ub4 nchunks;
+    xs_chunk_loc_t *locs;
+
+    int pathlen;
+    char pathfile[0];
+} xs_chunk_file_t;
+
+
+typedef struct xs_chunk_store_t
+{
+    thread_lock_t lock;
+
+    /* chunks.journal */
+    int fd;
+    int64_t size;
+
+    /* 全部清单的记录字节 (压缩之后的日志长度) */
+    int64_t livesize;
+
+    ub8 nextfileid;
+
+    /* statistics */
+    ub8 chunks;                 /* chunks in index */
+    ub8 files;                  /* file manifests */
+    ub8 dedup_chunks;           /* chunks copied from other files */
+    ub8 dedup_bytes;
+
+    struct hlist_head chunk_hlist[XSYNC_CHUNK_STORE_HASHMAX + 1];
+    struct hlist_head file_hlist[XSYNC_CHUNK_STORE_HASHMAX + 1];
+
+    char journal[PATH_MAX];
+} xs_chunk_store_t;
+
+
+#define xs_chunk_digest_hash(digest)  \
+    ((int) (BO_bytes_betoh_i32((void *) (digest)) & XSYNC_CHUNK_STORE_HASHMAX))
+
+
+/**
+ * 打开 (不存在时创建) rootpath 目录下的日志, 重建块索引
+ */
+extern XS_RESULT XS_chunk_store_create (const char *rootpath, XS_chunk_store *outStore);
+
+extern XS_VOID XS_chunk_store_free (XS_chunk_store store);
+
+/**
+ * 对 XCHK 请求的块描述检查是否存在. 不存在的块在 bitmap 中置位.
+ *   返回缺失的块数目
+ */
+extern ub4 XS_chunk_store_negotiate (XS_chunk_store store, const XSChunkDesc_t *descs, ub4 chunks, ub1 *bitmap);
+
+/**
+ * 流开始重写 pathfile: 文件在清单之后被修改过时删除清单, 否则标记为
+ *   正在重写, 直到 XS_chunk_store_commit 或者 XS_chunk_store_forget
+ */
+extern XS_VOID XS_chunk_store_begin (XS_chunk_store store, const char *pathfile);
+
+/**
+ * 把块内容写入 wofd (pathfile 打开的文件) 的 offset 位置. 块从清单记录
+ *   的文件复制. pathfile 自己的清单只使用 wrpos 之后 (这次没有写过) 的
+ *   部分, 块已经在 offset 时不复制. 找不到可用的块返回 XS_ERROR
+ */
+extern XS_RESULT XS_chunk_store_copyto (XS_chunk_store store, const ub1 digest[XS_CHUNK_HASH_SIZE], ub4 length,
+    const char *pathfile, int wofd, ub8 offset, ub8 wrpos, char *buf, size_t bufsize);
+
+/**
+ * 文件落盘之后提交清单 (代替原来的清单). 清单在日志中落盘.
+ *   nchunks 为 0 时删除原来的清单
+ */
+extern XS_RESULT XS_chunk_store_commit (XS_chunk_store store, const char *pathfile, int wofd, const xs_chunk_ref_t *chunks, int nchunks);
+
+/**
+ * 删除文件的清单: 文件没有完成同步, 内容不再和清单一致
+ */
+extern XS_VOID XS_chunk_store_forget (XS_chunk_store store, const char *pathfile);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* CHUNK_STORE_H_INCLUDED */
@@ -0,0 +1,360 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: client_conn.c
+ *
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-30
+ *
+ * @update: 2018-11-30 17:26:44
+ */
+
+#include "server_api.h"
+
+#include "client_conn.h"
+
+
+xs_client_conn_t * XS_client_conn_create (int sockfd)
+{
+    int i;
+
+    xs_client_conn_t *conn = (xs_client_conn_t *) mem_alloc_zero(1, sizeof(*conn));
+
+    conn->sockfd = sockfd;
+
+    for (i = 0; i <= XSYNC_MUX_STREAM_HASHMAX; i++) {
+        INIT_HLIST_HEAD(&conn->stream_hlist[i]);
+    }
+
+    INIT_LIST_HEAD(&conn->acklist);
+
+    return conn;
+}
+
+
+void XS_client_conn_free (xs_client_conn_t *conn)
+{
+    int i;
+
+    struct hlist_node *hp, *hn;
+
+    for (i = 0; i <= XSYNC_MUX_STREAM_HASHMAX; i++) {
+        hlist_for_each_safe(hp, hn, &conn->stream_hlist[i]) {
+            xs_conn_stream_t *stream = hlist_entry(hp, xs_conn_stream_t, i_hash);
+
+            XS_client_conn_stream_free(conn, stream);
+        }
+    }
+
+    if (conn->client) {
+        // 会话拥有的文件条目随会话关闭
+        hlist_del(&conn->client->i_hash);
+
+        XS_client_session_release(&conn->client);
+    }
+
+    if (conn->rxbuf) {
+        mem_free(conn->rxbuf);
+    }
+
+    if (conn->txbuf) {
+        mem_free(conn->txbuf);
+    }
+
+    if (conn->rawbuf) {
+        mem_free(conn->rawbuf);
+    }
+
+    XS_compressor_uninit(&conn->decompressor);
+
+    mem_free(conn);
+}
+
+
+int XS_client_conn_recv (xs_client_conn_t *conn, const void *data, ub4 len, ub4 maxsize)
+{
+    ub4 remain = conn->rxlen - conn->rxoff;
+
+    if (remain + len > maxsize) {
+        LOGGER_WARN("sock(%d): message too large (%u bytes)", conn->sockfd, remain + len);
+        return (-1);
+    }
+
+    if (conn->rxoff) {
+        // 处理过的字节移出缓冲
+        if (remain) {
+            memmove(conn->rxbuf, conn->rxbuf + conn->rxoff, remain);
+        }
+
+        conn->rxoff = 0;
+        conn->rxlen = remain;
+    }
+
+    if (conn->rxlen + len > conn->rxsize) {
+        conn->rxsize = (conn->rxlen + len) * 2;
+
+        if (conn->rxsize > maxsize) {
+            conn->rxsize = maxsize;
+        }
+
+        conn->rxbuf = (ub1 *) mem_realloc(conn->rxbuf, conn->rxsize);
+    }
+
+    memcpy(conn->rxbuf + conn->rxlen, data, len);
+    conn->rxlen += len;
+
+    return 0;
+}
+
+
+void XS_client_conn_consume (xs_client_conn_t *conn, ub4 len)
+{
+    conn->rxoff += len;
+
+    if (conn->rxoff == conn->rxlen) {
+        conn->rxoff = conn->rxlen = 0;
+    }
+}
+
+
+int XS_client_conn_flush (xs_client_conn_t *conn)
+{
+    while (conn->txoff < conn->txlen) {
+        ssize_t rc = send(conn->sockfd, conn->txbuf + conn->txoff, conn->txlen - conn->txoff, MSG_NOSIGNAL);
+
+        if (rc > 0) {
+            conn->txoff += (ub4) rc;
+        } else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else if (rc < 0 && errno == EINTR) {
+            continue;
+        } else {
+            LOGGER_ERROR("sock(%d): send error(%d): %s", conn->sockfd, errno, strerror(errno));
+            return (-1);
+        }
+    }
+
+    conn->txoff = conn->txlen = 0;
+
+    return 1;
+}
+
+
+int XS_client_conn_send (xs_client_conn_t *conn, const void *data, ub4 len)
+{
+    ub4 sent = 0;
+
+    if (conn->txoff == conn->txlen) {
+        // 没有排队的数据: 直接写 socket
+        while (sent < len) {
+            ssize_t rc = send(conn->sockfd, (const ub1 *) data + sent, len - sent, MSG_NOSIGNAL);
+
+            if (rc > 0) {
+                sent += (ub4) rc;
+            } else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else if (rc < 0 && errno == EINTR) {
+                continue;
+            } else {
+                LOGGER_ERROR("sock(%d): send error(%d): %s", conn->sockfd, errno, strerror(errno));
+                return (-1);
+            }
+        }
+
+        conn->txoff = conn->txlen = 0;
+
+        if (sent == len) {
+            return 0;
+        }
+    }
+
+    len -= sent;
+
+    if (conn->txlen - conn->txoff + len > XS_CLIENT_CONN_TXMAX) {
+        LOGGER_WARN("sock(%d): client not reading replies (%u bytes pending)", conn->sockfd, conn->txlen - conn->txoff);
+        return (-1);
+    }
+
+    if (conn->txoff && conn->txlen + len > conn->txsize) {
+        memmove(conn->txbuf, conn->txbuf + conn->txoff, conn->txlen - conn->txoff);
+
+        conn->txlen -= conn->txoff;
+        conn->txoff = 0;
+    }
+
+    if (conn->txlen + len > conn->txsize) {
+        conn->txsize = (conn->txlen + len) * 2;
+
+        conn->txbuf = (ub1 *) mem_realloc(conn->txbuf, conn->txsize);
+    }
+
+    memcpy(conn->txbuf + conn->txlen, (const ub1 *) data + sent, len);
+    conn->txlen += len;
+
+    return 0;
+}
+
+
+#define conn_stream_hash(streamid)  ((int) ((streamid) & XSYNC_MUX_STREAM_HASHMAX))
+
+
+xs_conn_stream_t * XS_client_conn_stream_find (xs_client_conn_t *conn, ub8 streamid)
+{
+    struct hlist_node *hp;
+
+    hlist_for_each(hp, &conn->stream_hlist[conn_stream_hash(streamid)]) {
+        xs_conn_stream_t *stream = hlist_entry(hp, xs_conn_stream_t, i_hash);
+
+        if (stream->streamid == streamid) {
+            return stream;
+        }
+    }
+
+    return 0;
+}
+
+
+xs_conn_stream_t * XS_client_conn_stream_open (xs_client_conn_t *conn, ub8 streamid)
+{
+    xs_conn_stream_t *stream = (xs_conn_stream_t *) mem_alloc_zero(1, sizeof(*stream));
+
+    stream->streamid = streamid;
+
+    hlist_add_head(&stream->i_hash, &conn->stream_hlist[conn_stream_hash(streamid)]);
+
+    return stream;
+}
+
+
+void XS_client_conn_stream_free (xs_client_conn_t *conn, xs_conn_stream_t *stream)
+{
+    hlist_del(&stream->i_hash);
+
+    if (stream->acking) {
+        list_del(&stream->i_ack);
+    }
+
+    if (stream->msgbuf) {
+        mem_free(stream->msgbuf);
+    }
+
+    if (stream->plan) {
+        XS_client_conn_stream_plan(stream, 0);
+    }
+
+    mem_free(stream);
+}
+
+
+int XS_client_conn_stream_recv (xs_conn_stream_t *stream, const void *data, ub4 len)
+{
+    if (stream->msglen + len > XS_CONN_STREAM_MSGMAX) {
+        return (-1);
+    }
+
+    if (stream->msglen + len > stream->msgsize) {
+        stream->msgsize = (stream->msglen + len) * 2;
+
+        if (stream->msgsize > XS_CONN_STREAM_MSGMAX) {
+            stream->msgsize = XS_CONN_STREAM_MSGMAX;
+        }
+
+        stream->msgbuf = (ub1 *) mem_realloc(stream->msgbuf, stream->msgsize);
+    }
+
+    memcpy(stream->msgbuf + stream->msglen, data, len);
+    stream->msglen += len;
+
+    return 0;
+}
+
+
+void XS_client_conn_stream_consume (xs_client_conn_t *conn, xs_conn_stream_t *stream, ub4 len)
+{
+    stream->msglen -= len;
+
+    if (stream->msglen) {
+        memmove(stream->msgbuf, stream->msgbuf + len, stream->msglen);
+    }
+
+    stream->ackbytes += len;
+
+    if (! stream->acking) {
+        list_add_tail(&stream->i_ack, &conn->acklist);
+        stream->acking = 1;
+    }
+}
+
+
+ub1 * XS_client_conn_rawbuf (xs_client_conn_t *conn, ub4 rawlen)
+{
+    if (rawlen > conn->rawsize) {
+        conn->rawbuf = (ub1 *) mem_realloc(conn->rawbuf, rawlen);
+        conn->rawsize = rawlen;
+    }
+
+    return conn->rawbuf;
+}
+
+
+xs_conn_chunk_t * XS_client_conn_stream_plan (xs_conn_stream_t *stream, ub4 chunks)
+{
+    if (stream->plan) {
+        mem_free(stream->plan);
+        stream->plan = 0;
+    }
+
+    stream->nplan = 0;
+    stream->planhead = 0;
+
+    if (chunks) {
+        stream->plan = (xs_conn_chunk_t *) mem_alloc_zero(chunks, sizeof(xs_conn_chunk_t));
+        stream->nplan = chunks;
+    }
+
+    return stream->plan;
+}
+
+
+xs_conn_chunk_t * XS_client_conn_stream_plan_find (xs_conn_stream_t *stream, ub8 offset, ub4 length)
+{
+    ub4 i;
+
+    for (i = stream->planhead; i < stream->nplan; i++) {
+        xs_conn_chunk_t *pc = &stream->plan[i];
+
+        if (pc->offset == offset) {
+            return (pc->length == length && ! pc->done)? pc : 0;
+        }
+
+        if (pc->offset > offset) {
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,245 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: client_conn.h
+ *   服务端的客户端连接: 接收缓冲和发送缓冲.
+ *
+ *   epoll 边沿触发时一次读到的数据不一定是完整的消息 (XCHK/XLGB 请求和
+ *   XMUX 帧都可能跨多次读取), 不完整的部分保留在接收缓冲, 下次读到之后
+ *   继续处理. 应答写入 socket 时如果 socket 已满, 没有发出的部分保存在
+ *   发送缓冲, 等待 EPOLLOUT 之后发送.
+ *
+ *   XMUX 的每个流 (xs_conn_stream_t) 另有自己的消息缓冲: 帧的负载按流
+ *   重组为完整的消息 (XSYN/XCHK/XLGB) 之后才处理. 流窗口只在消息的数据
+ *   写入文件并且 fdatasync 之后才归还, 因此客户端收到的 WINDOW 就是
+ *   服务端持久化的确认.
+ *
+ *   只在 epoll 线程中使用, 不加锁.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-30
+ *
+ * @update: 2018-11-30 17:26:44
+ */
+
+#ifndef CLIENT_CONN_H_INCLUDED
+#define CLIENT_CONN_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../common/common_util.h"
+#include "../common/dhlist.h"
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+#include "../xsync-protocol.h"
+#include "../xsync-compress.h"
+
+#include "client_session.h"
+#include "chunk_store.h"
+
+
+/**
+ * 发送缓冲的上限: 客户端不读应答时断开连接
+ */
+#define XS_CLIENT_CONN_TXMAX    (XSYNC_MUX_CONN_WINDOW * 4)
+
+
+/**
+ * 流上一个消息的最大字节: 客户端在一个流上未确认的字节不超过流窗口,
+ *   超过流窗口的消息永远不能完整到达
+ */
+#define XS_CONN_STREAM_MSGMAX   XSYNC_MUX_STREAM_WINDOW
+
+
+/**
+ * XCHK 协商的一个块: done 为 0 表示还没有写入文件 (缺失的块由 XSYN 补齐)
+ */
+typedef struct xs_conn_chunk_t
+{
+    ub8 offset;
+    ub4 length;
+    ub1 digest[XS_CHUNK_HASH_SIZE];
+
+    int done;
+} xs_conn_chunk_t;
+
+
+typedef struct xs_conn_stream_t
+{
+    /* 在 conn->stream_hlist 中, key 为 streamid */
+    struct hlist_node i_hash;
+
+    /* 在 conn->acklist 中: 有等待归还窗口的字节 */
+    struct list_head i_ack;
+    int acking;
+
+    ub8 streamid;
+
+    /* 没有处理完的消息 (来自多个 DATA 帧) */
+    ub4 msglen;
+    ub4 msgsize;
+    ub1 *msgbuf;
+
+    /* 处理完等待 WINDOW 的字节 */
+    ub4 ackbytes;
+
+    /* 1: 写入了文件, 归还窗口之前 fdatasync */
+    int dirty;
+
+    /* 1: 收到 END 帧 */
+    int ended;
+
+    /* 数据流的文件条目 (在 session 的 entry_hlist 中), 不持有引用 */
+    XS_file_entry entry;
+
+    /* 写入的最大文件偏移: 流结束时文件截断到这里 */
+    ub8 endpos;
+
+    /**
+     * 最近一次 XCHK 协商的块. [0, planhead) 已经按文件顺序加入 entry,
+     *   planhead 之后的块等到前面的块都写入之后加入
+     */
+    ub4 nplan;
+    ub4 planhead;
+    xs_conn_chunk_t *plan;
+} xs_conn_stream_t;
+
+
+typedef struct xs_client_conn_t
+{
+    /* 在 server->conn_hlist 中, key 为 sockfd */
+    struct hlist_node i_hash;
+
+    int sockfd;
+
+    /* XCON 接受之后服务端分配的会话和选用的能力 */
+    ub8 session;
+    ub4 bitflags;
+
+    /* XCON 接受之后的客户端会话, 拥有这个连接打开的文件条目 */
+    XS_client_session client;
+
+    /* XMUX 流 */
+    struct hlist_head stream_hlist[XSYNC_MUX_STREAM_HASHMAX + 1];
+
+    /* 等待归还窗口的流: 一次读取处理完之后统一 fdatasync 和发送 WINDOW */
+    struct list_head acklist;
+
+    /* 解压 XSYN 数据 (算法为 XCON 协商的 codec): rawbuf 按需增长 */
+    xs_compressor_t decompressor;
+    ub4 rawsize;
+    ub1 *rawbuf;
+
+    /* 接收缓冲: [rxoff, rxlen) 是没有处理完的字节 */
+    ub4 rxoff;
+    ub4 rxlen;
+    ub4 rxsize;
+    ub1 *rxbuf;
+
+    /* 发送缓冲: [txoff, txlen) 是没有发出的字节 */
+    ub4 txoff;
+    ub4 txlen;
+    ub4 txsize;
+    ub1 *txbuf;
+} xs_client_conn_t;
+
+
+#define XS_client_conn_rxdata(conn)     ((conn)->rxbuf + (conn)->rxoff)
+#define XS_client_conn_rxbytes(conn)    ((conn)->rxlen - (conn)->rxoff)
+
+#define XS_client_conn_txpending(conn)  ((conn)->txoff < (conn)->txlen)
+
+
+extern xs_client_conn_t * XS_client_conn_create (int sockfd);
+
+extern void XS_client_conn_free (xs_client_conn_t *conn);
+
+/**
+ * 读到的数据追加到接收缓冲. maxsize 为缓冲中允许的最大字节 (最大的
+ *   消息), 超过返回 -1
+ */
+extern int XS_client_conn_recv (xs_client_conn_t *conn, const void *data, ub4 len, ub4 maxsize);
+
+/**
+ * 从接收缓冲的头部去掉处理完的 len 字节
+ */
+extern void XS_client_conn_consume (xs_client_conn_t *conn, ub4 len);
+
+/**
+ * 发送应答: 前面没有待发送的数据时直接写 socket, 写不完的部分进入发送
+ *   缓冲. 返回 0 成功, -1 连接出错或者发送缓冲超过 XS_CLIENT_CONN_TXMAX
+ */
+extern int XS_client_conn_send (xs_client_conn_t *conn, const void *data, ub4 len);
+
+/**
+ * 发送缓冲中的数据. 返回 1 全部发出, 0 socket 已满 (等待 EPOLLOUT), -1 出错
+ */
+extern int XS_client_conn_flush (xs_client_conn_t *conn);
+
+
+extern xs_conn_stream_t * XS_client_conn_stream_find (xs_client_conn_t *conn, ub8 streamid);
+
+extern xs_conn_stream_t * XS_client_conn_stream_open (xs_client_conn_t *conn, ub8 streamid);
+
+/**
+ * 释放流: 没有结束的文件条目不关闭 (同一个条目可能由新的流继续)
+ */
+extern void XS_client_conn_stream_free (xs_client_conn_t *conn, xs_conn_stream_t *stream);
+
+/**
+ * DATA 帧的负载追加到流的消息缓冲. 超过 XS_CONN_STREAM_MSGMAX 返回 -1
+ */
+extern int XS_client_conn_stream_recv (xs_conn_stream_t *stream, const void *data, ub4 len);
+
+/**
+ * 从消息缓冲的头部去掉处理完的 len 字节, 记入等待归还的窗口
+ */
+extern void XS_client_conn_stream_consume (xs_client_conn_t *conn, xs_conn_stream_t *stream, ub4 len);
+
+/**
+ * 解压缓冲: 至少 rawlen 字节
+ */
+extern ub1 * XS_client_conn_rawbuf (xs_client_conn_t *conn, ub4 rawlen);
+
+/**
+ * 开始新的一批块 (上一批没有到达的块被释放), 返回 chunks 个块的数组
+ */
+extern xs_conn_chunk_t * XS_client_conn_stream_plan (xs_conn_stream_t *stream, ub4 chunks);
+
+/**
+ * 查找 offset 开始, 长度为 length 的还没有收到的块. 返回 0 不在这一批中
+ */
+extern xs_conn_chunk_t * XS_client_conn_stream_plan_find (xs_conn_stream_t *stream, ub8 offset, ub4 length);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* CLIENT_CONN_H_INCLUDED */
@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 16:02:37
  */
 
 
@@ -39,12 +39,74 @@
 #include "client_session.h"
 
 
-extern XS_RESULT XS_client_session_create (const char *clientid, XS_client_session *outSession)
+#define session_entry_hash(entryid)  ((int) ((entryid) & XSYNC_FILE_ENTRY_HASHMAX))
+
+
+extern XS_RESULT XS_client_session_create (const char *clientid, const char *dataroot, ub8 session, XS_client_session *outSession)
 {
+    int i, len;
+
+    XS_client_session client;
+
+    *outSession = 0;
+
+    client = (XS_client_session) mem_alloc_zero(1, sizeof(struct xs_client_session_t));
+
+    len = snprintf(client->path_prefix, sizeof(client->path_prefix), "%s%s/", dataroot, clientid);
+    if (len < 2 || len >= sizeof(client->path_prefix)) {
+        LOGGER_ERROR("path too long: %s%s/", dataroot, clientid);
+        mem_free(client);
+        return XS_ERROR;
+    }
+
+    strncpy(client->clientid, clientid, XSYNC_CLIENTID_MAXLEN);
+
+    client->session = session;
+
+    for (i = 0; i <= XSYNC_FILE_ENTRY_HASHMAX; i++) {
+        INIT_HLIST_HEAD(&client->entry_hlist[i]);
+    }
+
+    __interlock_set(&client->in_use, 1);
+
+    *outSession = (XS_client_session) RefObjectInit(client);
+
+    LOGGER_TRACE("client=%p", client);
+
     return XS_SUCCESS;
 }
 
 
+extern XS_file_entry XS_client_session_find_entry (XS_client_session client, ub8 entryid)
+{
+    struct hlist_node *hp;
+
+    hlist_for_each(hp, &client->entry_hlist[session_entry_hash(entryid)]) {
+        struct xs_file_entry_t *entry = hlist_entry(hp, struct xs_file_entry_t, i_hash);
+
+        if (entry->entryid == entryid) {
+            return entry;
+        }
+    }
+
+    return 0;
+}
+
+
+extern XS_VOID XS_client_session_add_entry (XS_client_session client, XS_file_entry entry)
+{
+    hlist_add_head(&entry->i_hash, &client->entry_hlist[session_entry_hash(entry->entryid)]);
+}
+
+
+extern XS_VOID XS_client_session_remove_entry (XS_client_session client, XS_file_entry entry)
+{
+    hlist_del(&entry->i_hash);
+
+    XS_file_entry_release(&entry);
+}
+
+
 extern XS_VOID XS_client_session_release (XS_client_session * inSession)
 {
     LOGGER_TRACE0();
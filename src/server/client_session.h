@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 16:02:37
  */
 
 /**
@@ -88,6 +88,11 @@ typedef struct xs_client_session_t
      */
     char token[4];
 
+    /**
+     * XCON 应答中返回给客户端的会话 ID (client_hlist 的 key)
+     */
+    ub8 session;
+
     /**
      * 客户端的ip地址端口等信息
      */
@@ -143,7 +148,22 @@ inline void xs_client_session_delete (void *pv)
 }
 
 
-extern XS_RESULT XS_client_session_create (const char *clientid, XS_client_session *outSession);
+/**
+ * 创建会话. 客户端的文件保存到 dataroot/clientid/ 下 (dataroot 以 '/' 结尾)
+ */
+extern XS_RESULT XS_client_session_create (const char *clientid, const char *dataroot, ub8 session, XS_client_session *outSession);
+
+/**
+ * 取得会话中正在写入的文件条目
+ */
+extern XS_file_entry XS_client_session_find_entry (XS_client_session client, ub8 entryid);
+
+extern XS_VOID XS_client_session_add_entry (XS_client_session client, XS_file_entry entry);
+
+/**
+ * 从会话中删除并释放文件条目 (关闭文件)
+ */
+extern XS_VOID XS_client_session_remove_entry (XS_client_session client, XS_file_entry entry);
 
 extern XS_VOID XS_client_session_release (XS_client_session * inSession);
 
@@ -0,0 +1,423 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: entrydb.c
+ *   批量注册文件条目 (see "entrydb.h")
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-24
+ *
+ * @update: 2018-11-30 16:02:37
+ */
+
+#include "server_api.h"
+
+#include "entrydb.h"
+#include "server_metrics.h"
+
+
+/* 每个条目的命令: HSETNX entryid, HSETNX credtime, HMSET, HGET entryid, HSET xsyn */
+#define ENTRYDB_CMDS_PER_ENTRY    5
+
+#define ENTRYDB_CMD_HMSET         2
+#define ENTRYDB_CMD_HGET          3
+
+/* HMSET key + 6 对字段 */
+#define ENTRYDB_ARGV_MAX          14
+
+#define ENTRYDB_KEY_MAXLEN        (XS_SERVERID_MAXLEN + XSYNC_CLIENTID_MAXLEN + 32 + 16)
+
+
+typedef struct entrydb_row_t
+{
+    char logkey[ENTRYDB_KEY_MAXLEN + 1];
+    char synkey[XS_SERVERID_MAXLEN + 32];
+
+    char newid[24];
+    char exptime[24];
+    char filesize[24];
+    char modtime[24];
+    char watchmd5[33];
+
+    const char *argv[ENTRYDB_CMDS_PER_ENTRY][ENTRYDB_ARGV_MAX];
+    size_t argvlen[ENTRYDB_CMDS_PER_ENTRY][ENTRYDB_ARGV_MAX];
+} entrydb_row_t;
+
+
+__no_warning_unused(static)
+void entrydb_cmd_set (entrydb_row_t *row, int cmd, int argi, const char *arg)
+{
+    row->argv[cmd][argi] = arg;
+    row->argvlen[cmd][argi] = strlen(arg);
+}
+
+
+/**
+ * INCRBY xs:$serverid:entryid count: 返回预留区间的最后一个 id
+ */
+static ub8 entrydb_reserve_ids (RedisConn_t *redconn, const char *serverid, ub4 count)
+{
+    redisReply *reply;
+
+    ub8 lastid = 0;
+
+    char key[XS_SERVERID_MAXLEN + 16];
+    char num[12];
+
+    const char *argv[3];
+    size_t argvlen[3];
+
+    uint64_t t0 = metrics_now_us();
+
+    argvlen[1] = snprintf(key, sizeof(key), "xs:%s:entryid", serverid);
+    argvlen[2] = snprintf(num, sizeof(num), "%u", count);
+
+    argv[0] = "INCRBY"; argvlen[0] = 6;
+    argv[1] = key;
+    argv[2] = num;
+
+    reply = RedisConnExecCommand(redconn, 3, argv, argvlen);
+
+    metrics_histogram_since(xs_server_metrics.redis_rtt_seconds, t0);
+
+    if (reply && reply->type == REDIS_REPLY_INTEGER && reply->integer >= (long long) count) {
+        lastid = (ub8) reply->integer;
+    } else {
+        metrics_counter_inc(xs_server_metrics.redis_errors);
+
+        LOGGER_ERROR("INCRBY %s %u failed: %s", key, count, reply? "bad reply" : redconn->errmsg);
+    }
+
+    RedisFreeReplyObject(&reply);
+
+    return lastid;
+}
+
+
+/**
+ * 删除为已经注册过的条目预留的 xsyn 行
+ */
+static void entrydb_drop_synkeys (RedisConn_t *redconn, entrydb_row_t *rows, const int *unused, int num)
+{
+    int i, ret;
+
+    int *argcs = (int *) mem_alloc_unset(sizeof(int) * num);
+    const char ***argvs = (const char ***) mem_alloc_unset(sizeof(char **) * num);
+    const size_t **argvlens = (const size_t **) mem_alloc_unset(sizeof(size_t *) * num);
+    redisReply **replies = (redisReply **) mem_alloc_unset(sizeof(redisReply *) * num);
+
+    for (i = 0; i < num; i++) {
+        entrydb_row_t *row = &rows[unused[i]];
+
+        // 重用 HGET 的参数数组: DEL synkey
+        entrydb_cmd_set(row, ENTRYDB_CMD_HGET, 0, "DEL");
+        entrydb_cmd_set(row, ENTRYDB_CMD_HGET, 1, row->synkey);
+
+        argcs[i] = 2;
+        argvs[i] = row->argv[ENTRYDB_CMD_HGET];
+        argvlens[i] = row->argvlen[ENTRYDB_CMD_HGET];
+    }
+
+    ret = RedisConnExecPipeline(redconn, num, argcs, argvs, argvlens, replies);
+
+    if (ret != REDISAPI_SUCCESS) {
+        metrics_counter_inc(xs_server_metrics.redis_errors);
+
+        LOGGER_WARN("drop %d xsyn keys failed(%d): %s", num, ret, redconn->errmsg);
+    }
+
+    for (i = 0; i < num; i++) {
+        RedisFreeReplyObject(&replies[i]);
+    }
+
+    mem_free(replies);
+    mem_free(argvlens);
+    mem_free(argvs);
+    mem_free(argcs);
+}
+
+
+int XS_entrydb_register_batch (RedisConn_t *redconn,
+    const char *serverid,
+    const char *clientid,
+    const XSLogBatchEntry_t *entries,
+    const char **pathfiles,
+    ub4 count,
+    ub8 *entryids)
+{
+    ub4 i, k;
+    int ret, ok, num, nunused;
+    ub8 firstid, lastid;
+
+    char now[24];
+
+    entrydb_row_t *rows;
+
+    int *argcs, *unused;
+    const char ***argvs;
+    const size_t **argvlens;
+    redisReply **replies;
+
+    uint64_t t0;
+
+    bzero(entryids, sizeof(ub8) * count);
+
+    if (! count) {
+        return 0;
+    }
+
+    lastid = entrydb_reserve_ids(redconn, serverid, count);
+    if (! lastid) {
+        return (-1);
+    }
+
+    firstid = lastid - count + 1;
+
+    snprintf(now, sizeof(now), "%ju", (uintmax_t) time(0));
+
+    num = (int) count * ENTRYDB_CMDS_PER_ENTRY;
+
+    rows = (entrydb_row_t *) mem_alloc_unset(sizeof(entrydb_row_t) * count);
+
+    argcs = (int *) mem_alloc_unset(sizeof(int) * num);
+    argvs = (const char ***) mem_alloc_unset(sizeof(char **) * num);
+    argvlens = (const size_t **) mem_alloc_unset(sizeof(size_t *) * num);
+    replies = (redisReply **) mem_alloc_unset(sizeof(redisReply *) * num);
+
+    for (i = 0; i < count; i++) {
+        const XSLogBatchEntry_t *entry = &entries[i];
+        entrydb_row_t *row = &rows[i];
+
+        MD5_CTX ctx;
+        unsigned char md5[16];
+        char pathmd5[33];
+
+        MD5_Init(&ctx);
+        MD5_Update(&ctx, pathfiles[i], strlen(pathfiles[i]));
+        MD5_Final(md5, &ctx);
+
+        for (k = 0; k < 16; k++) {
+            snprintf(pathmd5 + k * 2, 3, "%02x", md5[k]);
+        }
+
+        snprintf(row->logkey, sizeof(row->logkey), "xs:%s:xlog:%s:%s", serverid, clientid, pathmd5);
+        snprintf(row->synkey, sizeof(row->synkey), "xs:%s:xsyn:%ju", serverid, (uintmax_t) (firstid + i));
+
+        snprintf(row->newid, sizeof(row->newid), "%ju", (uintmax_t) (firstid + i));
+        snprintf(row->exptime, sizeof(row->exptime), "%ju", (uintmax_t) entry->exptime);
+        snprintf(row->filesize, sizeof(row->filesize), "%ju", (uintmax_t) entry->filesize);
+        snprintf(row->modtime, sizeof(row->modtime), "%ju", (uintmax_t) entry->modtime);
+
+        for (k = 0; k < 16; k++) {
+            snprintf(row->watchmd5 + k * 2, 3, "%02x", entry->filemd5[k]);
+        }
+
+        // HSETNX logkey entryid newid
+        entrydb_cmd_set(row, 0, 0, "HSETNX");
+        entrydb_cmd_set(row, 0, 1, row->logkey);
+        entrydb_cmd_set(row, 0, 2, "entryid");
+        entrydb_cmd_set(row, 0, 3, row->newid);
+
+        // HSETNX logkey credtime now
+        entrydb_cmd_set(row, 1, 0, "HSETNX");
+        entrydb_cmd_set(row, 1, 1, row->logkey);
+        entrydb_cmd_set(row, 1, 2, "credtime");
+        entrydb_cmd_set(row, 1, 3, now);
+
+        // HMSET logkey ...
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 0, "HMSET");
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 1, row->logkey);
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 2, "pathfile");
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 3, pathfiles[i]);
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 4, "exptime");
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 5, row->exptime);
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 6, "updtime");
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 7, now);
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 8, "filesize");
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 9, row->filesize);
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 10, "modtime");
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 11, row->modtime);
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 12, "watchmd5");
+        entrydb_cmd_set(row, ENTRYDB_CMD_HMSET, 13, row->watchmd5);
+
+        // HGET logkey entryid
+        entrydb_cmd_set(row, ENTRYDB_CMD_HGET, 0, "HGET");
+        entrydb_cmd_set(row, ENTRYDB_CMD_HGET, 1, row->logkey);
+        entrydb_cmd_set(row, ENTRYDB_CMD_HGET, 2, "entryid");
+
+        // HSET synkey logkey logkey
+        entrydb_cmd_set(row, 4, 0, "HSET");
+        entrydb_cmd_set(row, 4, 1, row->synkey);
+        entrydb_cmd_set(row, 4, 2, "logkey");
+        entrydb_cmd_set(row, 4, 3, row->logkey);
+
+        for (k = 0; k < ENTRYDB_CMDS_PER_ENTRY; k++) {
+            int c = i * ENTRYDB_CMDS_PER_ENTRY + k;
+
+            argcs[c] = (k == ENTRYDB_CMD_HMSET? ENTRYDB_ARGV_MAX : (k == ENTRYDB_CMD_HGET? 3 : 4));
+            argvs[c] = row->argv[k];
+            argvlens[c] = row->argvlen[k];
+        }
+    }
+
+    t0 = metrics_now_us();
+
+    ret = RedisConnExecPipeline(redconn, num, argcs, argvs, argvlens, replies);
+
+    metrics_histogram_since(xs_server_metrics.redis_rtt_seconds, t0);
+
+    ok = 0;
+
+    if (ret < 0) {
+        metrics_counter_inc(xs_server_metrics.redis_errors);
+
+        LOGGER_ERROR("register %u entries failed(%d): %s", count, ret, redconn->errmsg);
+    } else {
+        // 已经注册过的条目: 预留的 xsyn 行不再使用
+        unused = (int *) mem_alloc_unset(sizeof(int) * count);
+        nunused = 0;
+
+        for (i = 0; i < count; i++) {
+            redisReply *reply = replies[i * ENTRYDB_CMDS_PER_ENTRY + ENTRYDB_CMD_HGET];
+
+            for (k = 0; k < ENTRYDB_CMDS_PER_ENTRY; k++) {
+                if (! replies[i * ENTRYDB_CMDS_PER_ENTRY + k]) {
+                    break;
+                }
+            }
+
+            if (k == ENTRYDB_CMDS_PER_ENTRY && reply->type == REDIS_REPLY_STRING) {
+                entryids[i] = (ub8) strtoull(reply->str, 0, 10);
+
+                if (entryids[i] != firstid + i) {
+                    unused[nunused++] = (int) i;
+                }
+
+                ++ok;
+            }
+        }
+
+        if (ret > 0) {
+            metrics_counter_inc(xs_server_metrics.redis_errors);
+
+            LOGGER_WARN("register %u entries: %d commands failed: %s", count, ret, redconn->errmsg);
+        }
+
+        if (nunused) {
+            entrydb_drop_synkeys(redconn, rows, unused, nunused);
+        }
+
+        mem_free(unused);
+    }
+
+    for (i = 0; i < (ub4) num; i++) {
+        RedisFreeReplyObject(&replies[i]);
+    }
+
+    mem_free(replies);
+    mem_free(argvlens);
+    mem_free(argvs);
+    mem_free(argcs);
+    mem_free(rows);
+
+    metrics_counter_add(xs_server_metrics.entries_registered, (uint64_t) ok);
+
+    return ok;
+}
+
+
+/**
+ * HGET key field: 字符串值复制到 value. 返回长度, 0 不存在, -1 出错
+ */
+static int entrydb_hget (RedisConn_t *redconn, const char *key, const char *field, char *value, int size)
+{
+    int len;
+    redisReply *reply;
+
+    const char *argv[3];
+    size_t argvlen[3];
+
+    uint64_t t0 = metrics_now_us();
+
+    argv[0] = "HGET"; argvlen[0] = 4;
+    argv[1] = key; argvlen[1] = strlen(key);
+    argv[2] = field; argvlen[2] = strlen(field);
+
+    reply = RedisConnExecCommand(redconn, 3, argv, argvlen);
+
+    metrics_histogram_since(xs_server_metrics.redis_rtt_seconds, t0);
+
+    if (! reply) {
+        metrics_counter_inc(xs_server_metrics.redis_errors);
+
+        LOGGER_ERROR("HGET %s %s failed: %s", key, field, redconn->errmsg);
+        return (-1);
+    }
+
+    len = 0;
+
+    if (reply->type == REDIS_REPLY_STRING && reply->len > 0 && reply->len < size) {
+        len = (int) reply->len;
+
+        memcpy(value, reply->str, len);
+        value[len] = 0;
+    }
+
+    RedisFreeReplyObject(&reply);
+
+    return len;
+}
+
+
+int XS_entrydb_lookup (RedisConn_t *redconn,
+    const char *serverid,
+    const char *clientid,
+    ub8 entryid,
+    char *pathfile,
+    int pathsize)
+{
+    int len, prefixlen;
+
+    char synkey[XS_SERVERID_MAXLEN + 32];
+    char logkey[ENTRYDB_KEY_MAXLEN + 1];
+    char prefix[ENTRYDB_KEY_MAXLEN + 1];
+
+    snprintf(synkey, sizeof(synkey), "xs:%s:xsyn:%ju", serverid, (uintmax_t) entryid);
+
+    len = entrydb_hget(redconn, synkey, "logkey", logkey, sizeof(logkey));
+    if (len <= 0) {
+        return len;
+    }
+
+    prefixlen = snprintf(prefix, sizeof(prefix), "xs:%s:xlog:%s:", serverid, clientid);
+
+    if (len <= prefixlen || strncmp(logkey, prefix, prefixlen)) {
+        LOGGER_WARN("entry(%ju) not belong to client: %s", (uintmax_t) entryid, clientid);
+        return 0;
+    }
+
+    return entrydb_hget(redconn, logkey, "pathfile", pathfile, pathsize);
+}
@@ -22,7 +22,7 @@
 
 /**
  * @file: entrydb.h
- *
+ *   文件条目注册表 (XLOG/XSYN 表, see "../xsync-protocol.h") on redis-cluster
  *
  * @author: master@pepstack.com
  *
@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 16:02:37
  */
 
 #ifndef ENTRYDB_H_INCLUDED
@@ -42,8 +42,62 @@ extern "C" {
 
 #include "../xsync-error.h"
 #include "../xsync-config.h"
+#include "../xsync-protocol.h"
+
+#include "../redisapi/redis_api.h"
+
+
+/**
+ * XS_entrydb_register_batch
+ *   批量注册文件条目 (XLGB). 不论条目多少, 一批只访问 redis 两次:
+ *
+ *     1) INCRBY xs:$serverid:entryid $count    预留 entryid 区间
+ *
+ *     2) 流水线, 每个条目 (logkey = xs:$serverid:xlog:$clientid:$md5(pathfile)):
+ *          HSETNX logkey entryid $newid
+ *          HSETNX logkey credtime $now
+ *          HMSET  logkey pathfile .. exptime .. updtime .. filesize .. modtime .. watchmd5 ..
+ *          HGET   logkey entryid
+ *          HSET   xs:$serverid:xsyn:$newid logkey $logkey
+ *
+ *   已经注册过的文件保留原来的 entryid (断点续传), 为它预留的 xsyn 行
+ *   随后被删除 (只在有这种条目时多访问一次).
+ *
+ *   entryids[i] 返回第 i 个条目的 entryid, 注册失败为 0.
+ *
+ * returns:
+ *   注册成功的条目数
+ *   -1 - redis 不可用
+ */
+extern int XS_entrydb_register_batch (RedisConn_t *redconn,
+    const char *serverid,
+    const char *clientid,
+    const XSLogBatchEntry_t *entries,
+    const char **pathfiles,
+    ub4 count,
+    ub8 *entryids);
 
 
+/**
+ * XS_entrydb_lookup
+ *   由 entryid 查找客户端注册的文件路径 (流上第一个 XSYN 时调用):
+ *
+ *     HGET xs:$serverid:xsyn:$entryid logkey
+ *     HGET logkey pathfile
+ *
+ *   logkey 必须属于 clientid, 否则认为条目不存在.
+ *
+ * returns:
+ *   pathfile 的长度
+ *   0  - 条目不存在
+ *   -1 - redis 不可用
+ */
+extern int XS_entrydb_lookup (RedisConn_t *redconn,
+    const char *serverid,
+    const char *clientid,
+    ub8 entryid,
+    char *pathfile,
+    int pathsize);
 
 
 #if defined(__cplusplus)
@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 16:02:37
  */
 
 #include "server_api.h"
@@ -38,21 +38,76 @@
 #include "file_entry.h"
 
 
-extern XS_VOID XS_file_entry_create (XS_file_entry *outEntry)
+/**
+ * 创建目标文件的上级目录
+ */
+static int file_entry_mkdirs (char *pathname, int len)
+{
+    int i;
+
+    for (i = 1; i < len; i++) {
+        if (pathname[i] == '/') {
+            pathname[i] = 0;
+
+            if (mkdir(pathname, 0755) != 0 && errno != EEXIST) {
+                LOGGER_ERROR("mkdir error(%d): %s. (%s)", errno, strerror(errno), pathname);
+                pathname[i] = '/';
+                return (-1);
+            }
+
+            pathname[i] = '/';
+        }
+    }
+
+    return 0;
+}
+
+
+extern XS_RESULT XS_file_entry_create (pathtab_t *paths, const char *pathfile, XS_file_entry *outEntry)
 {
     XS_file_entry entry;
+    uint32_t pathid;
 
     *outEntry = 0;
 
+    pathid = pathtab_intern_path(paths, pathfile, -1);
+    if (pathid == PATHTAB_NONE) {
+        LOGGER_ERROR("pathtab_intern_path fail: %s", pathfile);
+        return XS_ERROR;
+    }
+
     entry = (XS_file_entry) mem_alloc_zero(1, sizeof(struct xs_file_entry_t));
 
     entry->wofd = -1;
 
+    entry->paths = paths;
+    entry->pathid = pathid;
+
     __interlock_set(&entry->in_use, 1);
 
     *outEntry = (XS_file_entry) RefObjectInit(entry);
 
     LOGGER_TRACE("entry=%p", entry);
+
+    return XS_SUCCESS;
+}
+
+
+extern int XS_file_entry_open (XS_file_entry entry, mode_t filemode)
+{
+    int len;
+    char entryfile[PATH_MAX];
+
+    if (entry->wofd != -1) {
+        return entry->wofd;
+    }
+
+    len = pathtab_path(entry->paths, entry->pathid, entryfile, sizeof(entryfile));
+    if (len <= 0 || file_entry_mkdirs(entryfile, len) != 0) {
+        return (-1);
+    }
+
+    return file_entry_open_file(entry, filemode);
 }
 
 
@@ -70,3 +125,46 @@ extern XS_BOOL XS_file_entry_not_in_use (XS_file_entry entry)
 
     return (in_use == 0? 1 : 0);
 }
+
+
+/**
+ * 添加块到文件条目的末尾. 流从前面的偏移重新发送时, 之后的块被代替
+ */
+extern XS_VOID XS_file_entry_add_chunk (XS_file_entry entry, ub8 offset, ub4 length, const ub1 digest[XS_CHUNK_HASH_SIZE])
+{
+    xs_chunk_ref_t *ref;
+
+    while (entry->nchunks > 0 && entry->chunks[entry->nchunks - 1].offset >= offset) {
+        entry->nchunks--;
+    }
+
+    if (entry->nchunks == entry->maxchunks) {
+        entry->maxchunks = (entry->maxchunks? entry->maxchunks * 2 : 64);
+
+        entry->chunks = (xs_chunk_ref_t *) mem_realloc(entry->chunks, sizeof(xs_chunk_ref_t) * entry->maxchunks);
+    }
+
+    ref = &entry->chunks[entry->nchunks++];
+
+    ref->offset = offset;
+    ref->length = length;
+    memcpy(ref->digest, digest, XS_CHUNK_HASH_SIZE);
+}
+
+
+extern XS_VOID XS_file_entry_commit_chunks (XS_file_entry entry)
+{
+    XS_chunk_store chunkstore = entry->chunkstore;
+
+    if (chunkstore) {
+        char entryfile[PATH_MAX];
+
+        entry->chunkstore = 0;
+
+        if (pathtab_path(entry->paths, entry->pathid, entryfile, sizeof(entryfile)) > 0) {
+            XS_chunk_store_commit(chunkstore, entryfile, entry->wofd, entry->chunks, entry->nchunks);
+        } else {
+            LOGGER_ERROR("invalid entry pathid(=%u). (entryid=%ju)", entry->pathid, entry->entryid);
+        }
+    }
+}
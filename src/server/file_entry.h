@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 16:02:37
  */
 
 #ifndef FILE_ENTRY_H_INCLUDED
@@ -42,12 +42,15 @@ extern "C" {
 
 #include "../common/common_util.h"
 #include "../common/mul_timer.h"
+#include "../common/pathtab.h"
 
 #include "../xsync-error.h"
 #include "../xsync-config.h"
 
 #include "../redisapi/redis_api.h"
 
+#include "chunk_store.h"
+
 
 typedef struct PollinData_t
 {
@@ -97,13 +100,31 @@ typedef struct xs_file_entry_t
     /* position in entry db */
     int64_t db_position;
 
+    /**
+     * 这次同步收到的块 (按文件偏移顺序), 流结束时作为文件清单提交到
+     *   chunkstore. 分块传输时才使用, 否则 nchunks = 0
+     */
+    int nchunks;
+    int maxchunks;
+    xs_chunk_ref_t *chunks;
+
+    /* 不为 0: 已经 XS_chunk_store_begin, 没有提交时释放条目删除清单 */
+    XS_chunk_store chunkstore;
+
+    /* 这次同步写入的最大文件偏移: 之后的部分还是原来的内容 */
+    uint64_t wrpos;
+
     /**
      * hlist node in entry_hlist of XS_client_session
      */
     struct hlist_node i_hash;
 
-    int pathlen;
-    char fullpath[0];
+    /**
+     * 目标文件在 server->pathtab 中的 id (持有一个引用).
+     *   条目不保存全路径, 打开文件时由 pathtab_path 还原
+     */
+    pathtab_t *paths;
+    uint32_t pathid;
 } * XS_file_entry, xs_file_entry_t;
 
 
@@ -117,14 +138,11 @@ void file_entry_close_file (XS_file_entry entry)
         entry->wofd = -1;
 
         if (close(wofd) == -1) {
-            const char * entryfile = entry->fullpath;
-
             /* exception error */
-            LOGGER_ERROR("close file error(%d): %s. (%s)", errno, strerror(errno), entryfile);
+            LOGGER_ERROR("close file error(%d): %s. (entryid=%llu)", errno, strerror(errno),
+                (unsigned long long) entry->entryid);
         } else {
-            const char * entryfile = entry->fullpath;
-
-            LOGGER_DEBUG("close file ok. (%s)", entryfile);
+            LOGGER_DEBUG("close file ok. (entryid=%llu)", (unsigned long long) entry->entryid);
         }
     }
 
@@ -136,8 +154,13 @@ void file_entry_close_file (XS_file_entry entry)
 __no_warning_unused(static)
 int file_entry_open_file (XS_file_entry entry, mode_t filemode)
 {
-    //TODO:
-    const char *entryfile = entry->fullpath;
+    char entryfile[PATH_MAX];
+
+    if (pathtab_path(entry->paths, entry->pathid, entryfile, sizeof(entryfile)) <= 0) {
+        LOGGER_ERROR("invalid entry pathid(=%u). (entryid=%llu)", entry->pathid,
+            (unsigned long long) entry->entryid);
+        return -1;
+    }
 
     /* make sure file is closed */
     file_entry_close_file(entry);
@@ -176,16 +199,49 @@ inline void xs_file_entry_delete (void *pv)
     // TODO:
     file_entry_close_file(entry);
 
+    if (entry->chunkstore) {
+        char entryfile[PATH_MAX];
+
+        // 没有完成同步: 文件的内容不再和清单一致
+        if (pathtab_path(entry->paths, entry->pathid, entryfile, sizeof(entryfile)) > 0) {
+            XS_chunk_store_forget(entry->chunkstore, entryfile);
+        }
+    }
+
+    if (entry->chunks) {
+        mem_free_s((void **) &entry->chunks);
+    }
+
+    if (entry->paths) {
+        pathtab_release(entry->paths, entry->pathid);
+    }
+
     mem_free(pv);
 }
 
 
-extern XS_VOID XS_file_entry_create (XS_file_entry * outEntry);
+/**
+ * 创建文件条目. pathfile 为目标文件的绝对路径, 登记到 paths 中
+ */
+extern XS_RESULT XS_file_entry_create (pathtab_t *paths, const char *pathfile, XS_file_entry * outEntry);
+
+/**
+ * 打开 (创建) 目标文件, 需要时创建上级目录. 已经打开时直接返回.
+ *   返回 wofd, -1 出错
+ */
+extern int XS_file_entry_open (XS_file_entry entry, mode_t filemode);
 
 extern XS_VOID XS_file_entry_release (XS_file_entry * inEntry);
 
 extern XS_BOOL XS_file_entry_not_in_use (XS_file_entry entry);
 
+extern XS_VOID XS_file_entry_add_chunk (XS_file_entry entry, ub8 offset, ub4 length, const ub1 digest[XS_CHUNK_HASH_SIZE]);
+
+/**
+ * 文件落盘之后, 把收到的块作为文件清单提交到 chunkstore
+ */
+extern XS_VOID XS_file_entry_commit_chunks (XS_file_entry entry);
+
 
 #if defined(__cplusplus)
 }
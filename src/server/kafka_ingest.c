@@ -0,0 +1,203 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: kafka_ingest.c
+ *   从 kafka 批量读取事件到镜像索引 (see "kafka_ingest.h")
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-27
+ *
+ * @update: 2018-11-27 16:40:12
+ */
+
+#include "kafka_ingest.h"
+#include "server_metrics.h"
+
+#include <dlfcn.h>
+
+
+typedef struct xs_kafka_ingest_t
+{
+    kafkatools_consumer_api_t api;
+
+    mirror_index mirror;
+} xs_kafka_ingest_t;
+
+
+/**
+ * 在 kafkatools 的消费线程中调用: 解码一批消息合并到镜像索引
+ */
+static void kafka_ingest_batch_cb (int thrdno, rd_kafka_message_t **msgs, int count, void *arg)
+{
+    int i, ret, applied = 0, skipped = 0, duplicates = 0;
+
+    evrecord_t rec;
+
+    XS_kafka_ingest ingest = (XS_kafka_ingest) arg;
+
+    for (i = 0; i < count; i++) {
+        ret = -1;
+
+        if (evrecord_decode(msgs[i]->payload, msgs[i]->len, &rec) == 0) {
+            ret = XS_mirror_index_apply(ingest->mirror, &rec);
+        }
+
+        if (ret == MIRROR_APPLY_OK) {
+            applied++;
+        } else if (ret == MIRROR_APPLY_DUPLICATE) {
+            // 客户端重放或者重试的消息
+            duplicates++;
+        } else {
+            // 不是二进制事件记录 (event_format 为 text/json 或者脚本的消息)
+            skipped++;
+        }
+    }
+
+    metrics_counter_add(xs_server_metrics.kafka_events, applied);
+    metrics_counter_add(xs_server_metrics.kafka_skipped, skipped);
+    metrics_counter_add(xs_server_metrics.kafka_duplicates, duplicates);
+
+    LOGGER_TRACE("[kafka-%d] batch=%d applied=%d skipped=%d duplicates=%d", thrdno, count, applied, skipped, duplicates);
+}
+
+
+static int kafka_consumer_api_load (kafkatools_consumer_api_t *api, const char *libktsofile)
+{
+    void *handle;
+    char *error;
+
+    handle = dlopen(libktsofile, RTLD_LAZY);
+    if (! handle) {
+        LOGGER_ERROR("dlopen fail: %s (%s)", dlerror(), libktsofile);
+        return (-1);
+    }
+
+    /* Clear any existing error */
+    dlerror();
+
+    api->kt_get_rdkafka_version = dlsym(handle, "kafkatools_get_rdkafka_version");
+    api->kt_consumer_create = dlsym(handle, "kafkatools_consumer_create");
+    api->kt_consumer_subscribe = dlsym(handle, "kafkatools_consumer_subscribe");
+    api->kt_consumer_destroy = dlsym(handle, "kafkatools_consumer_destroy");
+    api->kt_consumer_get_errstr = dlsym(handle, "kafkatools_consumer_get_errstr");
+    api->kt_consumer_get_stats = dlsym(handle, "kafkatools_consumer_get_stats");
+
+    if ((error = dlerror()) != NULL) {
+        LOGGER_ERROR("dlsym fail: %s", error);
+
+        dlclose(handle);
+        return (-1);
+    }
+
+    LOGGER_INFO("librdkafka version: %s", api->kt_get_rdkafka_version());
+
+    api->handle = handle;
+    return 0;
+}
+
+
+extern XS_RESULT XS_kafka_ingest_start (const xs_appopts_t *opts, mirror_index mirror, XS_kafka_ingest *outIngest)
+{
+    XS_kafka_ingest ingest;
+
+    char group_id[XS_SERVERID_MAXLEN + 16];
+
+    *outIngest = 0;
+
+    ingest = (XS_kafka_ingest) mem_alloc_zero(1, sizeof(xs_kafka_ingest_t));
+
+    ingest->mirror = mirror;
+
+    if (kafka_consumer_api_load(&ingest->api, opts->kafkalib) != 0) {
+        mem_free(ingest);
+        return XS_ERROR;
+    }
+
+    snprintf(group_id, sizeof(group_id), "xsync-server-%s", opts->serverid);
+
+    do {
+        const char *names[] = {
+            "bootstrap.servers",
+            "group.id",
+            "auto.offset.reset",
+            0
+        };
+
+        const char *values[] = {
+            opts->kafka_brokers,
+            group_id,
+            "earliest",
+            0
+        };
+
+        if (ingest->api.kt_consumer_create(names, values, XSYNC_SERVER_KAFKA_THREADS, 0,
+                kafka_ingest_batch_cb, ingest, &ingest->api.consumer) != KAFKATOOLS_SUCCESS) {
+            LOGGER_ERROR("kafkatools_consumer_create fail (bootstrap.servers=%s)", opts->kafka_brokers);
+
+            dlclose(ingest->api.handle);
+            mem_free(ingest);
+            return XS_ERROR;
+        }
+    } while (0);
+
+    if (ingest->api.kt_consumer_subscribe(ingest->api.consumer, opts->kafka_topics) != KAFKATOOLS_SUCCESS) {
+        LOGGER_ERROR("kafkatools_consumer_subscribe fail: %s", ingest->api.kt_consumer_get_errstr(ingest->api.consumer));
+
+        XS_kafka_ingest_stop(ingest);
+        return XS_ERROR;
+    }
+
+    LOGGER_INFO("kafka ingest: brokers=%s topics=%s group=%s threads=%d",
+        opts->kafka_brokers, opts->kafka_topics, group_id, XSYNC_SERVER_KAFKA_THREADS);
+
+    *outIngest = ingest;
+
+    return XS_SUCCESS;
+}
+
+
+extern void XS_kafka_ingest_stop (XS_kafka_ingest ingest)
+{
+    if (ingest->api.consumer) {
+        LOGGER_DEBUG("kafkatools_consumer_destroy");
+
+        ingest->api.kt_consumer_destroy(ingest->api.consumer);
+        ingest->api.consumer = 0;
+    }
+
+    if (ingest->api.handle) {
+        dlclose(ingest->api.handle);
+        ingest->api.handle = 0;
+    }
+
+    mem_free(ingest);
+}
+
+
+extern void XS_kafka_ingest_stats (XS_kafka_ingest ingest, kafkatools_consumer_stats_t *stats)
+{
+    ingest->api.kt_consumer_get_stats(ingest->api.consumer, stats);
+}
@@ -0,0 +1,79 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: kafka_ingest.h
+ *   从 kafka 批量读取客户端的事件消息 (evrecord) 合并到镜像索引,
+ *   服务端不必为每个事件处理一次 RPC.
+ *
+ *   libkafkatools.so.1 在运行时加载 (与客户端相同), 没有指定 --kafka
+ *   时不加载.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-27
+ *
+ * @update: 2018-11-27 10:21:45
+ */
+
+#ifndef KAFKA_INGEST_H_INCLUDED
+#define KAFKA_INGEST_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "server_api.h"
+#include "mirror_index.h"
+
+#include "../kafkatools/kafkatools.h"
+
+
+typedef struct xs_kafka_ingest_t * XS_kafka_ingest;
+
+
+/**
+ * XS_kafka_ingest_start
+ *   加载 opts->kafkalib, 以消费者组 "xsync-server-$serverid" 订阅
+ *   opts->kafka_topics, 启动 XSYNC_SERVER_KAFKA_THREADS 个消费线程.
+ *   每个服务器的组不同, 所以每个服务器都得到全部事件.
+ */
+extern XS_RESULT XS_kafka_ingest_start (const xs_appopts_t *opts, mirror_index mirror, XS_kafka_ingest *outIngest);
+
+
+/**
+ * XS_kafka_ingest_stop
+ *   停止消费, 提交最后的偏移, 卸载库
+ */
+extern void XS_kafka_ingest_stop (XS_kafka_ingest ingest);
+
+
+extern void XS_kafka_ingest_stats (XS_kafka_ingest ingest, kafkatools_consumer_stats_t *stats);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* KAFKA_INGEST_H_INCLUDED */
@@ -0,0 +1,506 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: mirror_index.c
+ *   服务端的镜像索引 (see "mirror_index.h")
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-27
+ *
+ * @update: 2018-11-30 20:48:03
+ */
+
+#include "server_api.h"
+
+#include "mirror_index.h"
+#include "server_metrics.h"
+
+#include "../common/rbtree.h"
+
+
+typedef struct mirror_file_t
+{
+    struct rb_node rbnode;
+
+    /* pathtab 中文件的 id (持有一个引用) */
+    uint32_t fileid;
+
+    uint32_t mask;
+    uint32_t changes;
+
+    uint64_t time_us;
+
+    /* 最后合并的客户端事件序号, 0 表示没有 */
+    uint64_t seq;
+
+    /* 最后一次同步完成的时间, 0 表示没有 */
+    uint64_t synced_us;
+} mirror_file_t;
+
+
+/* 组: 一个客户端的一个监视目录 */
+typedef struct mirror_group_t
+{
+    struct rb_node rbnode;
+
+    struct rb_root files;
+    uint32_t nfiles;
+
+    uint16_t clientid_len;
+    uint16_t pathid_len;
+
+    /* clientid '\0' pathid '\0' */
+    char key[0];
+} mirror_group_t;
+
+
+typedef struct mirror_gkey_t
+{
+    const char *clientid;
+    int clientid_len;
+
+    const char *pathid;
+    int pathid_len;
+} mirror_gkey_t;
+
+
+typedef struct mirror_shard_t
+{
+    thread_lock_t lock;
+
+    struct rb_root groups;
+} mirror_shard_t;
+
+
+typedef struct mirror_index_t
+{
+    pathtab_t *pathtab;
+
+    ref_counter_t ngroups;
+    ref_counter_t nfiles;
+
+    mirror_shard_t shards[MIRROR_INDEX_SHARDS];
+} mirror_index_t;
+
+
+static inline int mirror_strcmp (const char *a, int alen, const char *b, int blen)
+{
+    int c = memcmp(a, b, (alen < blen? alen : blen));
+
+    return (c? c : (alen - blen));
+}
+
+
+static inline int mirror_group_cmp (const mirror_gkey_t *key, const mirror_group_t *group)
+{
+    int c = mirror_strcmp(key->clientid, key->clientid_len, group->key, group->clientid_len);
+
+    if (! c) {
+        c = mirror_strcmp(key->pathid, key->pathid_len, group->key + group->clientid_len + 1, group->pathid_len);
+    }
+
+    return c;
+}
+
+RB_TREE_DEFINE(mirror_group_tree, mirror_group_t, rbnode, mirror_gkey_t, mirror_group_cmp)
+
+
+static inline int mirror_file_cmp (const uint32_t *fileid, const mirror_file_t *file)
+{
+    return (*fileid < file->fileid? -1 : (*fileid > file->fileid? 1 : 0));
+}
+
+RB_TREE_DEFINE(mirror_file_tree, mirror_file_t, rbnode, uint32_t, mirror_file_cmp)
+
+
+static mirror_shard_t * mirror_shard_of (mirror_index_t *index, const mirror_gkey_t *key)
+{
+    int i;
+
+    uint32_t h = 2166136261U;
+
+    /* 只按 clientid: 同一个客户端的组在一个分片 */
+    for (i = 0; i < key->clientid_len; i++) {
+        h = (h ^ (unsigned char) key->clientid[i]) * 16777619U;
+    }
+
+    return &index->shards[h % MIRROR_INDEX_SHARDS];
+}
+
+
+static int mirror_time_cmp (const void *a, const void *b)
+{
+    uint64_t ta = *(const uint64_t *) a;
+    uint64_t tb = *(const uint64_t *) b;
+
+    return (ta < tb? -1 : (ta > tb? 1 : 0));
+}
+
+
+/**
+ * 在分片锁内调用: 组的文件超过 MIRROR_GROUP_MAXFILES 时淘汰最旧的 1/8
+ *   (keep 除外). 排序的代价分摊到之后的插入
+ */
+static void mirror_group_evict (mirror_index_t *index, mirror_group_t *group, mirror_file_t *keep)
+{
+    uint32_t i = 0, want, evicted = 0;
+    uint64_t cutoff, *times;
+
+    mirror_file_t *file, *next;
+
+    times = (uint64_t *) mem_alloc_unset(sizeof(uint64_t) * group->nfiles);
+
+    for (file = mirror_file_tree_first(&group->files); file; file = mirror_file_tree_next(file)) {
+        times[i++] = file->time_us;
+    }
+
+    qsort(times, i, sizeof(uint64_t), mirror_time_cmp);
+
+    want = group->nfiles / 8 + 1;
+    cutoff = times[want - 1];
+
+    mem_free(times);
+
+    for (file = mirror_file_tree_first(&group->files); file && evicted < want; file = next) {
+        next = mirror_file_tree_next(file);
+
+        if (file != keep && file->time_us <= cutoff) {
+            mirror_file_tree_erase(&group->files, file);
+
+            pathtab_release(index->pathtab, file->fileid);
+            mem_free(file);
+
+            group->nfiles--;
+            evicted++;
+
+            __interlock_sub(&index->nfiles);
+        }
+    }
+
+    metrics_counter_add(xs_server_metrics.mirror_evicted, evicted);
+}
+
+
+extern XS_RESULT XS_mirror_index_create (pathtab_t *pathtab, mirror_index *outindex)
+{
+    int i;
+
+    mirror_index_t *index = (mirror_index_t *) mem_alloc_zero(1, sizeof(mirror_index_t));
+
+    index->pathtab = pathtab;
+
+    for (i = 0; i < MIRROR_INDEX_SHARDS; i++) {
+        if (threadlock_init(&index->shards[i].lock) != 0) {
+            LOGGER_FATAL("threadlock_init error");
+
+            while (i-- > 0) {
+                threadlock_destroy(&index->shards[i].lock);
+            }
+
+            mem_free(index);
+            return XS_ERROR;
+        }
+
+        rb_root_init(&index->shards[i].groups);
+    }
+
+    *outindex = index;
+
+    return XS_SUCCESS;
+}
+
+
+extern void XS_mirror_index_free (mirror_index index)
+{
+    int i;
+
+    mirror_group_t *group;
+    mirror_file_t *file;
+
+    for (i = 0; i < MIRROR_INDEX_SHARDS; i++) {
+        mirror_shard_t *shard = &index->shards[i];
+
+        while ((group = mirror_group_tree_first(&shard->groups)) != 0) {
+            mirror_group_tree_erase(&shard->groups, group);
+
+            while ((file = mirror_file_tree_first(&group->files)) != 0) {
+                mirror_file_tree_erase(&group->files, file);
+
+                pathtab_release(index->pathtab, file->fileid);
+                mem_free(file);
+            }
+
+            mem_free(group);
+        }
+
+        threadlock_destroy(&shard->lock);
+    }
+
+    mem_free(index);
+}
+
+
+extern int XS_mirror_index_apply (mirror_index index, const evrecord_t *rec)
+{
+    uint32_t dirid, fileid;
+
+    mirror_gkey_t key;
+    mirror_shard_t *shard;
+    mirror_group_t *group;
+    mirror_file_t *file;
+
+    struct rb_node *parent;
+    struct rb_node **link;
+
+    if ((rec->fields & (EVRECORD_F_CLIENTID | EVRECORD_F_PATHID | EVRECORD_F_PATH | EVRECORD_F_FILE)) !=
+        (EVRECORD_F_CLIENTID | EVRECORD_F_PATHID | EVRECORD_F_PATH | EVRECORD_F_FILE)) {
+        return MIRROR_APPLY_IGNORED;
+    }
+
+    if (! rec->clientid.len || ! rec->pathid.len || ! rec->file.len ||
+        rec->clientid.len > XSYNC_CLIENTID_MAXLEN || rec->pathid.len > 0xFFFF) {
+        return MIRROR_APPLY_IGNORED;
+    }
+
+    /* 文件路径驻留: 目录节点由同一目录的全部文件共用 */
+    dirid = pathtab_intern_path(index->pathtab, rec->path.str, (int) rec->path.len);
+    if (dirid == PATHTAB_NONE) {
+        return MIRROR_APPLY_IGNORED;
+    }
+
+    fileid = pathtab_intern(index->pathtab, dirid, rec->file.str, (int) rec->file.len);
+
+    pathtab_release(index->pathtab, dirid);
+
+    if (fileid == PATHTAB_NONE) {
+        return MIRROR_APPLY_ENOMEM;
+    }
+
+    key.clientid = rec->clientid.str;
+    key.clientid_len = (int) rec->clientid.len;
+    key.pathid = rec->pathid.str;
+    key.pathid_len = (int) rec->pathid.len;
+
+    shard = mirror_shard_of(index, &key);
+
+    threadlock_lock(&shard->lock);
+
+    group = mirror_group_tree_lookup(&shard->groups, &key, &parent, &link);
+
+    if (! group) {
+        group = (mirror_group_t *) mem_alloc_zero(1, sizeof(mirror_group_t) + key.clientid_len + key.pathid_len + 2);
+
+        group->clientid_len = (uint16_t) key.clientid_len;
+        group->pathid_len = (uint16_t) key.pathid_len;
+
+        memcpy(group->key, key.clientid, key.clientid_len);
+        memcpy(group->key + key.clientid_len + 1, key.pathid, key.pathid_len);
+
+        rb_root_init(&group->files);
+
+        mirror_group_tree_link(&shard->groups, group, parent, link);
+
+        __interlock_add(&index->ngroups);
+    }
+
+    file = mirror_file_tree_lookup(&group->files, &fileid, &parent, &link);
+
+    if (file) {
+        /* 已经记录的文件: 释放多余的引用 */
+        pathtab_release(index->pathtab, fileid);
+    } else {
+        file = (mirror_file_t *) mem_alloc_zero(1, sizeof(mirror_file_t));
+
+        file->fileid = fileid;
+
+        mirror_file_tree_link(&group->files, file, parent, link);
+
+        __interlock_add(&index->nfiles);
+
+        if (++group->nfiles > MIRROR_GROUP_MAXFILES) {
+            mirror_group_evict(index, group, file);
+        }
+    }
+
+    if ((rec->fields & EVRECORD_F_SEQ) && rec->seq) {
+        if (rec->seq <= file->seq) {
+            threadlock_unlock(&shard->lock);
+            return MIRROR_APPLY_DUPLICATE;
+        }
+
+        file->seq = rec->seq;
+    }
+
+    /* 同一个分区的消息按顺序到达, 但重新消费时可能收到旧的事件 */
+    if (rec->time_us >= file->time_us) {
+        file->mask = rec->mask;
+        file->time_us = rec->time_us;
+    }
+
+    file->changes++;
+
+    threadlock_unlock(&shard->lock);
+
+    return MIRROR_APPLY_OK;
+}
+
+
+/* 在分片锁内调用: 遍历一个组中 since_us 之后变化的文件. 回调要求停止时返回 1 */
+static int mirror_group_changed (mirror_index_t *index, mirror_group_t *group, uint64_t since_us,
+    mirror_change_cb cb, void *arg, int *count)
+{
+    mirror_file_t *file;
+    mirror_change_t change;
+
+    char pathbuf[XSYNC_PATHFILE_MAXLEN + 1];
+
+    for (file = mirror_file_tree_first(&group->files); file; file = mirror_file_tree_next(file)) {
+        if (file->time_us < since_us) {
+            continue;
+        }
+
+        if (pathtab_path(index->pathtab, file->fileid, pathbuf, sizeof(pathbuf)) < 0) {
+            continue;
+        }
+
+        change.path = pathbuf;
+        change.mask = file->mask;
+        change.time_us = file->time_us;
+        change.changes = file->changes;
+        change.synced_us = file->synced_us;
+
+        (*count)++;
+
+        if (cb(&change, arg)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+extern int XS_mirror_index_changed (mirror_index index, const char *clientid, const char *pathid,
+    uint64_t since_us, mirror_change_cb cb, void *arg)
+{
+    int count = 0;
+
+    mirror_gkey_t key;
+    mirror_shard_t *shard;
+    mirror_group_t *group;
+
+    key.clientid = clientid;
+    key.clientid_len = (int) strlen(clientid);
+    key.pathid = pathid;
+    key.pathid_len = (pathid? (int) strlen(pathid) : 0);
+
+    shard = mirror_shard_of(index, &key);
+
+    threadlock_lock(&shard->lock);
+
+    if (pathid) {
+        group = mirror_group_tree_find(&shard->groups, &key);
+
+        if (group) {
+            mirror_group_changed(index, group, since_us, cb, arg, &count);
+        }
+    } else {
+        // 客户端的全部组
+        for (group = mirror_group_tree_first(&shard->groups); group; group = mirror_group_tree_next(group)) {
+            if (! mirror_strcmp(key.clientid, key.clientid_len, group->key, group->clientid_len) &&
+                mirror_group_changed(index, group, since_us, cb, arg, &count)) {
+                break;
+            }
+        }
+    }
+
+    threadlock_unlock(&shard->lock);
+
+    return count;
+}
+
+
+extern int XS_mirror_index_synced (mirror_index index, const char *clientid, const char *pathfile, uint64_t time_us)
+{
+    int marked = 0;
+    uint32_t fileid;
+
+    mirror_gkey_t key;
+    mirror_shard_t *shard;
+    mirror_group_t *group;
+    mirror_file_t *file;
+
+    fileid = pathtab_intern_path(index->pathtab, pathfile, (int) strlen(pathfile));
+
+    if (fileid == PATHTAB_NONE) {
+        return 0;
+    }
+
+    key.clientid = clientid;
+    key.clientid_len = (int) strlen(clientid);
+    key.pathid = 0;
+    key.pathid_len = 0;
+
+    shard = mirror_shard_of(index, &key);
+
+    threadlock_lock(&shard->lock);
+
+    for (group = mirror_group_tree_first(&shard->groups); group; group = mirror_group_tree_next(group)) {
+        if (mirror_strcmp(key.clientid, key.clientid_len, group->key, group->clientid_len)) {
+            continue;
+        }
+
+        file = mirror_file_tree_find(&group->files, &fileid);
+
+        if (file) {
+            file->synced_us = time_us;
+            marked++;
+        }
+    }
+
+    threadlock_unlock(&shard->lock);
+
+    if (marked) {
+        metrics_counter_inc(xs_server_metrics.mirror_synced);
+    }
+
+    // 索引中没有的路径: 释放时删除节点
+    pathtab_release(index->pathtab, fileid);
+
+    return marked;
+}
+
+
+extern int64_t XS_mirror_index_groups (mirror_index index)
+{
+    return __interlock_get(&index->ngroups);
+}
+
+
+extern int64_t XS_mirror_index_files (mirror_index index)
+{
+    return __interlock_get(&index->nfiles);
+}
@@ -0,0 +1,157 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: mirror_index.h
+ *   服务端的镜像索引: 从 kafka 事件消息 (evrecord) 得知每个客户端的
+ *   每个监视目录 (clientid, pathid) 下有哪些文件发生了变化.
+ *
+ *   索引按 (clientid, pathid) 分组, 组按 clientid 的哈希分布在
+ *   MIRROR_INDEX_SHARDS 个分片中 (同一个客户端的组在一个分片), 每个
+ *   分片一把锁. 文件路径在 pathtab 中驻留, 组内的文件按路径 id 排序
+ *   (整数比较), 每个文件只记录最后一次事件和最后一次同步完成的时间.
+ *
+ *   每组最多 MIRROR_GROUP_MAXFILES 个文件, 超过时淘汰最旧的 1/8.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-27
+ *
+ * @update: 2018-11-30 20:48:03
+ */
+
+#ifndef MIRROR_INDEX_H_INCLUDED
+#define MIRROR_INDEX_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+
+#include "../common/pathtab.h"
+#include "../common/evrecord.h"
+
+
+#ifndef MIRROR_INDEX_SHARDS
+#  define MIRROR_INDEX_SHARDS    64
+#endif
+
+#ifndef MIRROR_GROUP_MAXFILES
+#  define MIRROR_GROUP_MAXFILES  65536
+#endif
+
+
+typedef struct mirror_index_t * mirror_index;
+
+
+/**
+ * 文件最后一次变化. path 只在回调期间有效
+ */
+typedef struct mirror_change_t
+{
+    const char *path;
+
+    /* 最后一次事件的 inotify 掩码和时间 (微秒) */
+    uint32_t mask;
+    uint64_t time_us;
+
+    /* 事件次数 */
+    uint32_t changes;
+
+    /* 服务端最后一次同步完成的时间 (微秒), 0 表示没有同步过 */
+    uint64_t synced_us;
+} mirror_change_t;
+
+
+typedef int (*mirror_change_cb) (const mirror_change_t *change, void *arg);
+
+
+/**
+ * XS_mirror_index_create
+ *   创建镜像索引. 文件路径驻留在 pathtab 中 (可以与其他模块共用)
+ */
+extern XS_RESULT XS_mirror_index_create (pathtab_t *pathtab, mirror_index *outindex);
+
+extern void XS_mirror_index_free (mirror_index index);
+
+
+#define MIRROR_APPLY_OK          1
+#define MIRROR_APPLY_IGNORED     0
+#define MIRROR_APPLY_DUPLICATE   2
+#define MIRROR_APPLY_ENOMEM    (-1)
+
+/**
+ * XS_mirror_index_apply
+ *   把一个事件记录合并到索引. 没有 clientid, pathid 或者文件名的记录
+ *   被忽略. 带 seq 的记录不大于文件已经合并的 seq 时是重复的 (客户端
+ *   重放或者重试), 不合并. 可以在多个线程中同时调用.
+ *
+ * returns:
+ *   MIRROR_APPLY_OK        - 合并
+ *   MIRROR_APPLY_IGNORED   - 忽略
+ *   MIRROR_APPLY_DUPLICATE - 重复的记录
+ *   MIRROR_APPLY_ENOMEM    - 内存不足
+ */
+extern int XS_mirror_index_apply (mirror_index index, const evrecord_t *rec);
+
+
+/**
+ * XS_mirror_index_changed
+ *   遍历 (clientid, pathid) 下 since_us 之后 (含) 变化的文件. pathid 为 0
+ *   时遍历客户端的全部组. 回调返回非 0 时停止. 遍历期间持有分片的锁,
+ *   回调中不能修改索引.
+ *
+ * returns:
+ *   回调的文件数
+ */
+extern int XS_mirror_index_changed (mirror_index index, const char *clientid, const char *pathid,
+    uint64_t since_us, mirror_change_cb cb, void *arg);
+
+
+/**
+ * XS_mirror_index_synced
+ *   服务端收到客户端文件 pathfile (客户端的绝对路径) 的全部内容之后
+ *   记录同步完成的时间. 索引中没有这个文件时不记录.
+ *
+ * returns:
+ *   记录的组数
+ */
+extern int XS_mirror_index_synced (mirror_index index, const char *clientid, const char *pathfile, uint64_t time_us);
+
+
+/**
+ * 组数 (clientid, pathid) 和文件数
+ */
+extern int64_t XS_mirror_index_groups (mirror_index index);
+
+extern int64_t XS_mirror_index_files (mirror_index index);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* MIRROR_INDEX_H_INCLUDED */
@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-23 09:36:50
  */
 
 #include "server.h"
@@ -133,6 +133,19 @@ int main (int argc, char *argv[])
         }
     }
 
+    /**
+     * 异步日志必须在 daemon() 之后启动: fork 不复制写线程
+     */
+    if (opts.log_async != -1) {
+        logger_async_start(XSYNC_LOGGER_ASYNC_RINGSIZE, opts.log_async, opts.log_file);
+    }
+
+    if (opts.trace_sample > 0) {
+        if (evtrace_open(opts.trace_file, XSYNC_EVTRACE_CAPACITY, opts.trace_sample) != 0) {
+            LOGGER_ERROR("evtrace open fail: %s", opts.trace_file);
+        }
+    }
+
     /**
      * 注册信号处理函数
      */
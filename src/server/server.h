@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 16:02:37
  */
 
 #ifndef SERVER_H_INCLUDED
@@ -49,6 +49,7 @@ extern "C" {
 #include "../common/cshell.h"
 #include "../common/common_util.h"
 #include "../common/readconf.h"
+#include "../common/evtrace.h"
 
 /**
  * print usage for app
@@ -89,6 +90,18 @@ void print_usage(void)
         "\t                                    \033[35m 'stderr' - using appender stderr\033[0m\n"
         "\t                                    \033[35m 'syslog' - using appender syslog\033[0m\n"
         "\n"
+        "\t-Y, --log-async=<POLICY[,FILE]> \033[35m asynchronous logging. POLICY when ring is full:\033[0m\n"
+        "\t                                    \033[35m 'drop'  - drop records and report the count (default)\033[0m\n"
+        "\t                                    \033[35m 'block' - wait for the background writer\033[0m\n"
+        "\t                                    \033[35m FILE: append to FILE directly instead of log4c appender\033[0m\n"
+        "\n"
+        "\t-M, --metrics=<ADDR>         \033[35m serve metrics in prometheus text format on ADDR:\033[0m\n"
+        "\t                                    \033[35m 'unix:/path/to/sock' - unix domain socket\033[0m\n"
+        "\t                                    \033[35m 'host:port' - tcp, or 'port' for 127.0.0.1:port\033[0m\n"
+        "\n"
+        "\t-T, --trace=<RATE[,FILE]>    \033[35m trace 1 of every RATE events into ring FILE (default: /tmp/" APP_NAME ".trace)\033[0m\n"
+        "\t                                    \033[35m see per-stage latency by: xsync-evtrace FILE\033[0m\n"
+        "\n"
         "\t-i, --server-id=<ID>         \033[35m specify an unique numberic identifier for server. '1' (default)\033[0m\n"
         "\n"
         "\t-n, --magic=<NUMBER>         \033[35m specify magic number for server. '%s' (default)\033[0m\n"
@@ -111,6 +124,14 @@ void print_usage(void)
         "\n"
         "\t-a, --redis-auth=<PASSWORD>  \033[35m redis cluster password if required.\033[0m\n"
         "\n"
+        "\t-c, --chunk-store=<PATH>     \033[35m specify absolute path to chunk store for dedup. '../chunks/' (default)\033[0m\n"
+        "\n"
+        "\t-d, --data-root=<PATH>       \033[35m specify absolute path to save synced files of clients. '../data/' (default)\033[0m\n"
+        "\n"
+        "\t-k, --kafka=<BROKERS>        \033[35m consume client events from kafka into mirror index. for example:\033[0m\n"
+        "\t                                    \033[35m'localhost:9092'\033[0m\n"
+        "\t-o, --kafka-topics=<TOPICS>  \033[35m event topics to consume, comma separated ('^' for regex). '%s' (default)\033[0m\n"
+        "\n"
         "\t-D, --daemon                 \033[35m run as daemon process.\033[0m\n"
         "\t-K, --kill                   \033[35m kill all processes for this program.\033[0m\n"
         "\t-L, --list                   \033[35m list of pids for this program.\033[0m\n"
@@ -122,7 +143,8 @@ void print_usage(void)
         XSYNC_SERVER_THREADS,
         XSYNC_SERVER_QUEUES,
         XSYNC_SERVER_EVENTS,
-        XSYNC_SERVER_SOMAXCONN);
+        XSYNC_SERVER_SOMAXCONN,
+        XSYNC_SERVER_KAFKA_TOPICS);
 
 #ifdef DEBUG
     printf("\033[31m**** Caution: DEBUG compiling mode only used in develop stage ! ****\033[0m\n");
@@ -159,6 +181,7 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
     opts->somaxconn = XSYNC_SERVER_SOMAXCONN;
     opts->maxevents = XSYNC_SERVER_EVENTS;
     opts->timeout_ms = 1000;
+    opts->log_async = -1;
 
     // 默认参数
     strcpy(opts->host, "0.0.0.0");
@@ -169,6 +192,8 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
 
     opts->magic = (ub4) atoi(XSYNC_MAGIC_DEFAULT);
 
+    strcpy(opts->kafka_topics, XSYNC_SERVER_KAFKA_TOPICS);
+
     do {
         /**
          * get default real path for xsync-server.conf
@@ -184,6 +209,13 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
             exit(-1);
         }
 
+        /* libkafkatools.so.1 与程序在同一目录 */
+        ret = snprintf(opts->kafkalib, sizeof(opts->kafkalib), "%slibkafkatools.so.1", buff);
+        if (ret < 10 || ret >= sizeof(opts->kafkalib)) {
+            fprintf(stderr, "\033[1;31m[error]\033[0m invalid app path: %s\n", buff);
+            exit(-1);
+        }
+
         *strrchr(buff, '/') = 0;
         *(strrchr(buff, '/') + 1) = 0;
 
@@ -198,6 +230,18 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
             fprintf(stderr, "\033[1;31m[error]\033[0m invalid log4c path: %s\n", buff);
             exit(-1);
         }
+
+        ret = snprintf(opts->chunkstore, sizeof(opts->chunkstore), "%schunks/", buff);
+        if (ret < 10 || ret >= sizeof(opts->chunkstore)) {
+            fprintf(stderr, "\033[1;31m[error]\033[0m invalid chunk store path: %s\n", buff);
+            exit(-1);
+        }
+
+        ret = snprintf(opts->dataroot, sizeof(opts->dataroot), "%sdata/", buff);
+        if (ret < 10 || ret >= sizeof(opts->dataroot)) {
+            fprintf(stderr, "\033[1;31m[error]\033[0m invalid data root path: %s\n", buff);
+            exit(-1);
+        }
     } while(0);
 
     do {
@@ -214,6 +258,9 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
             {"log4c-rcpath", required_argument, 0, 'O'},
             {"priority", required_argument, 0, 'P'},
             {"appender", required_argument, 0, 'A'},
+            {"log-async", optional_argument, 0, 'Y'},
+            {"metrics", required_argument, 0, 'M'},
+            {"trace", required_argument, 0, 'T'},
             {"server-id", required_argument, 0, 'i'},
             {"magic", required_argument, 0, 'n'},
             {"host", required_argument, 0, 's'},
@@ -224,6 +271,10 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
             {"somaxconn", required_argument, 0, 'm'},
             {"redis-cluster", required_argument, 0, 'r'},
             {"redis-auth", required_argument, 0, 'a'},
+            {"chunk-store", required_argument, 0, 'c'},
+            {"data-root", required_argument, 0, 'd'},
+            {"kafka", required_argument, 0, 'k'},
+            {"kafka-topics", required_argument, 0, 'o'},
             {"daemon", no_argument, 0, 'D'},
             {"kill", no_argument, 0, 'K'},
             {"list", no_argument, 0, 'L'},
@@ -231,7 +282,7 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
             {0, 0, 0, 0}
         };
 
-        while ((ch = getopt_long_only(argc, argv, "DhIKLVC:O:P:A:s:p:t:q:e:m:r:a:", lopts, &index)) != -1) {
+        while ((ch = getopt_long_only(argc, argv, "DhIKLVC:O:P:A:Y::M:T:s:p:t:q:e:m:r:a:c:d:k:o:", lopts, &index)) != -1) {
             switch (ch) {
             case '?':
                 fprintf(stderr, "\033[1;31m[error]\033[0m option not defined.\n");
@@ -377,6 +428,80 @@ void xs_appopts_initiate (int argc, char *argv[], xs_appopts_t *opts)
                 }
                 break;
 
+            case 'c':
+                /* chunk store 不一定已经存在, 必须是绝对路径 */
+                ret = snprintf(opts->chunkstore, sizeof(opts->chunkstore), "%s", optarg);
+                if (*optarg != '/' || ret < 2 || ret >= sizeof(opts->chunkstore)) {
+                    fprintf(stderr, "\033[1;31m[error]\033[0m invalid chunk store path: \033[31m%s\033[0m\n", optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'd':
+                /* 必须是绝对路径, 以 '/' 结尾 */
+                ret = snprintf(opts->dataroot, sizeof(opts->dataroot), "%s%s", optarg,
+                    optarg[strlen(optarg) - 1] == '/'? "" : "/");
+                if (*optarg != '/' || ret < 2 || ret >= sizeof(opts->dataroot)) {
+                    fprintf(stderr, "\033[1;31m[error]\033[0m invalid data root path: \033[31m%s\033[0m\n", optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'Y':
+                opts->log_async = LOGGER_ASYNC_DROP;
+
+                if (optarg) {
+                    char *logfile = strchr(optarg, ',');
+
+                    if (logfile) {
+                        *logfile++ = 0;
+
+                        ret = snprintf(opts->log_file, sizeof(opts->log_file), "%s", logfile);
+                        if (ret <= 0 || ret >= sizeof(opts->log_file)) {
+                            fprintf(stderr, "\033[1;31m[error]\033[0m invalid log file: \033[31m%s\033[0m\n", logfile);
+                            exit(-1);
+                        }
+                    }
+
+                    opts->log_async = logger_async_policy_from_string(optarg);
+                    if (opts->log_async == -1) {
+                        fprintf(stderr, "\033[1;31m[error]\033[0m invalid log-async policy: \033[31m%s\033[0m\n", optarg);
+                        exit(-1);
+                    }
+                }
+                break;
+
+            case 'M':
+                ret = snprintf(opts->metrics, sizeof(opts->metrics), "%s", optarg);
+                if (ret <= 0 || ret >= sizeof(opts->metrics)) {
+                    fprintf(stderr, "\033[1;31m[error]\033[0m invalid metrics address: \033[31m%s\033[0m\n", optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'T':
+                if (evtrace_parse_option(optarg, &opts->trace_sample, opts->trace_file, sizeof(opts->trace_file), "/tmp/" APP_NAME ".trace") == -1) {
+                    fprintf(stderr, "\033[1;31m[error]\033[0m invalid trace: \033[31m%s\033[0m\n", optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'k':
+                ret = snprintf(opts->kafka_brokers, sizeof(opts->kafka_brokers), "%s", optarg);
+                if (ret <= 0 || ret >= sizeof(opts->kafka_brokers)) {
+                    fprintf(stderr, "\033[1;31m[error]\033[0m invalid kafka brokers: \033[31m%s\033[0m\n", optarg);
+                    exit(-1);
+                }
+                break;
+
+            case 'o':
+                ret = snprintf(opts->kafka_topics, sizeof(opts->kafka_topics), "%s", optarg);
+                if (ret <= 0 || ret >= sizeof(opts->kafka_topics)) {
+                    fprintf(stderr, "\033[1;31m[error]\033[0m invalid kafka topics: \033[31m%s\033[0m\n", optarg);
+                    exit(-1);
+                }
+                break;
+
             case 'I':
                 interactive = 1;
                 break;
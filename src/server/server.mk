@@ -3,7 +3,7 @@
 #
 # @version: 0.4.4
 # @create: 2018-05-18 14:00:00
-# @update: 2018-11-09 14:59:24
+# @update: 2018-11-27 10:21:45
 #######################################################################
 
 # !!! DO NOT change APPNAME and VERSION only when you make sure do that !
@@ -41,13 +41,25 @@ SOURCES := \
     server_api.c \
     server_conf.c \
     client_session.c \
-    file_entry.c
+    client_conn.c \
+    file_entry.c \
+    chunk_store.c \
+    entrydb.c \
+    server_metrics.c \
+    mirror_index.c \
+    kafka_ingest.c
 
 
 # see "../xsync-config.h" for definitions
 #   If the macro NDEBUG is defined at the moment <assert.h> was last
 #     included, the macro assert() generates no code, and hence does
 #     nothing at all.
+#
+#  XSYNC_HAVE_ZSTD
+#  XSYNC_HAVE_LZ4
+#    enable zstd/lz4 for XSYN compression (see "../xsync-compress.h"),
+#    also need add libzstd.a/liblz4.a to TGT_LDLIBS. zlib is always used.
+#
 SRC_DEFS := DEBUG \
 	XSYNC_SERVER_APPNAME='"${APPNAME}"' \
 	XSYNC_SERVER_VERSION='"${VERSION}"' \
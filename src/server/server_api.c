@@ -30,11 +30,12 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 16:02:37
  */
 
 #include "server_api.h"
 #include "server_conf.h"
+#include "server_metrics.h"
 
 
 __attribute__((used))
@@ -299,6 +300,7 @@ extern XS_RESULT XS_server_create (xs_appopts_t *opts, XS_server *outServer)
     LOGGER_TRACE("hlist_init client_session");
     for (i = 0; i <= XSYNC_CLIENT_SESSION_HASHMAX; i++) {
         INIT_HLIST_HEAD(&server->client_hlist[i]);
+        INIT_HLIST_HEAD(&server->conn_hlist[i]);
     }
 
     LOGGER_INFO("serverid=%s threads=%d queues=%d timeout_ms=%d", opts->serverid, THREADS, QUEUES, TIMEOUTMS);
@@ -333,6 +335,15 @@ extern XS_RESULT XS_server_create (xs_appopts_t *opts, XS_server *outServer)
         exit(XS_ERROR);
     }
 
+    // 注册统计指标, 启动本地统计服务
+    XS_server_metrics_register(server);
+
+    if (opts->metrics[0]) {
+        if (metrics_serve_start(opts->metrics) != 0) {
+            LOGGER_ERROR("metrics serve start fail: %s", opts->metrics);
+        }
+    }
+
     LOGGER_DEBUG("epollet_conf_init(%s:%s): somaxconn=%d maxevents=%d", opts->host, opts->port, BACKLOGS, MAXEVENTS);
     do {
         if (epollet_conf_init(&server->epconf, opts->host, opts->port, BACKLOGS, MAXEVENTS, server->msgbuf, sizeof server->msgbuf) == -1) {
@@ -347,15 +358,44 @@ extern XS_RESULT XS_server_create (xs_appopts_t *opts, XS_server *outServer)
         server->epconf.epcb_warn = epcb_event_warn;
         server->epconf.epcb_error = epcb_event_error;
         server->epconf.epcb_new_peer = epcb_event_new_peer;
-        server->epconf.epcb_accept = epcb_event_accept;
         server->epconf.epcb_reject = epcb_event_reject;
         */
+        server->epconf.epcb_accept = epcb_event_accept;
         server->epconf.epcb_pollin = epcb_event_pollin;
-        //server->epconf.epcb_pollout = epcb_event_pollout;
+        server->epconf.epcb_pollout = epcb_event_pollout;
 
         LOGGER_INFO("epollet_conf_init: %s", server->msgbuf);
     } while (0);
 
+    if (XS_chunk_store_create(opts->chunkstore, &server->chunkstore) != XS_SUCCESS) {
+        LOGGER_FATAL("XS_chunk_store_create fail: %s", opts->chunkstore);
+        xs_server_delete((void*) server);
+        exit(XS_ERROR);
+    }
+
+    strcpy(server->dataroot, opts->dataroot);
+
+    server->pathtab = pathtab_create();
+    if (! server->pathtab) {
+        LOGGER_FATAL("pathtab_create error: Out of memory");
+        xs_server_delete((void*) server);
+        exit(XS_ERROR);
+    }
+
+    if (opts->kafka_brokers[0]) {
+        if (XS_mirror_index_create(server->pathtab, &server->mirror) != XS_SUCCESS) {
+            LOGGER_FATAL("XS_mirror_index_create fail");
+            xs_server_delete((void*) server);
+            exit(XS_ERROR);
+        }
+
+        if (XS_kafka_ingest_start(opts, server->mirror, &server->kafka_ingest) != XS_SUCCESS) {
+            LOGGER_FATAL("XS_kafka_ingest_start fail: %s", opts->kafka_brokers);
+            xs_server_delete((void*) server);
+            exit(XS_ERROR);
+        }
+    }
+
     memcpy(server->host, opts->host, sizeof(opts->host));
     server->port = atoi(opts->port);
 
@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 16:02:37
  */
 
 #ifndef SERVER_API_H_INCLUDED
@@ -87,6 +87,30 @@ typedef struct xs_appopts_t
     char port[XSYNC_PORTNUMB_MAXLEN + 1];
 
     char config[XSYNC_PATHFILE_MAXLEN + 1];
+
+    /* LOGGER_ASYNC_DROP, LOGGER_ASYNC_BLOCK; -1: 同步日志 */
+    int log_async;
+    char log_file[XSYNC_PATHFILE_MAXLEN + 1];
+
+    /* 本地统计服务地址: "unix:/path", "host:port" 或者 "port". 空: 不启动 */
+    char metrics[XSYNC_PATHFILE_MAXLEN + 1];
+
+    /* 事件跟踪: 每 trace_sample 个事件跟踪 1 个, 写入 trace_file. 0: 不跟踪 */
+    int trace_sample;
+    char trace_file[XSYNC_PATHFILE_MAXLEN + 1];
+
+    /* path to chunk store for dedup */
+    char chunkstore[XSYNC_PATHFILE_MAXLEN + 1];
+
+    /* 客户端同步的文件保存到 dataroot/clientid/ 下, 以 '/' 结尾 */
+    char dataroot[XSYNC_PATHFILE_MAXLEN + 1];
+
+    /* 从 kafka 读取事件到镜像索引: brokers 为空时不启动 */
+    char kafka_brokers[1020];
+    char kafka_topics[1020];
+
+    /* path to libkafkatools.so.1 */
+    char kafkalib[XSYNC_PATHFILE_MAXLEN + 1];
 } xs_appopts_t;
 
 
@@ -30,20 +30,26 @@
  *
  * @create: 2018-02-02
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 15:10:22
  */
 
 #include "server_api.h"
 #include "server_conf.h"
+#include "server_metrics.h"
+#include "client_conn.h"
 
 #include "../common/readconf.h"
 #include "../common/common_util.h"
+#include "../common/evtrace.h"
 
 
 extern void xs_server_delete (void *pv)
 {
     XS_server server = (XS_server) pv;
 
+    // 统计服务的回调引用 pool, 必须先停止
+    metrics_serve_stop();
+
     LOGGER_TRACE("pause and destroy timer");
     mul_timer_pause();
     if (mul_timer_destroy() != 0) {
@@ -61,6 +67,9 @@ extern void xs_server_delete (void *pv)
         threadpool_destroy(server->pool, 0);
     }
 
+    // 工作线程已经停止, 不再写跟踪记录
+    evtrace_close();
+
     if (server->thread_args) {
         int i;
         perthread_data *pdata;
@@ -80,8 +89,48 @@ extern void xs_server_delete (void *pv)
         mem_free_s((void**) &server->thread_args);
     }
 
+    do {
+        int hash;
+        struct hlist_node *hp, *hn;
+
+        LOGGER_TRACE("free client_conn");
+
+        for (hash = 0; hash <= XSYNC_CLIENT_SESSION_HASHMAX; hash++) {
+            hlist_for_each_safe(hp, hn, &server->conn_hlist[hash]) {
+                xs_client_conn_t *conn = hlist_entry(hp, xs_client_conn_t, i_hash);
+
+                hlist_del(&conn->i_hash);
+
+                XS_client_conn_free(conn);
+            }
+        }
+    } while (0);
+
     XS_server_clear_client_sessions(server);
 
+    if (server->chunkstore) {
+        LOGGER_DEBUG("XS_chunk_store_free");
+        XS_chunk_store_free(server->chunkstore);
+        server->chunkstore = 0;
+    }
+
+    // 消费线程使用镜像索引, 必须先停止
+    if (server->kafka_ingest) {
+        LOGGER_DEBUG("XS_kafka_ingest_stop");
+        XS_kafka_ingest_stop(server->kafka_ingest);
+        server->kafka_ingest = 0;
+    }
+
+    if (server->mirror) {
+        XS_mirror_index_free(server->mirror);
+        server->mirror = 0;
+    }
+
+    if (server->pathtab) {
+        pathtab_free(server->pathtab);
+        server->pathtab = 0;
+    }
+
     LOGGER_DEBUG("server: RedisConnFree");
     RedisConnFree(&server->redisconn);
 
@@ -30,7 +30,7 @@
  *
  * @create: 2018-02-02
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 16:02:37
  */
 
 #ifndef SERVER_CONF_H_INCLUDED
@@ -41,6 +41,7 @@ extern "C" {
 #endif
 
 #include "client_session.h"
+#include "kafka_ingest.h"
 
 /**
  * xs_server_t type
@@ -103,6 +104,32 @@ typedef struct xs_server_t
      */
     struct hlist_head client_hlist[XSYNC_CLIENT_SESSION_HASHMAX + 1];
 
+    /**
+     * hlist for client_conn: key 为 sockfd, 只在 epoll 线程中使用
+     */
+    struct hlist_head conn_hlist[XSYNC_CLIENT_SESSION_HASHMAX + 1];
+
+    /**
+     * content-addressed chunk store for dedup
+     */
+    XS_chunk_store chunkstore;
+
+    /**
+     * 文件条目 (xs_file_entry_t) 的路径表, 全部会话共用
+     */
+    pathtab_t *pathtab;
+
+    /**
+     * 客户端同步的文件的根目录 (以 '/' 结尾)
+     */
+    char dataroot[XSYNC_PATHFILE_MAXLEN + 1];
+
+    /**
+     * 镜像索引: 从 kafka 读到的每个客户端目录下变化的文件
+     */
+    mirror_index mirror;
+    XS_kafka_ingest kafka_ingest;
+
     /**
      * msg buffer
      */
@@ -30,15 +30,21 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 20:48:03
  */
 
 #include "server_api.h"
 #include "server_conf.h"
+#include "server_metrics.h"
+#include "entrydb.h"
+#include "client_conn.h"
 
 #include "../common/common_util.h"
+#include "../common/evtrace.h"
 #include "../redisapi/redis_api.h"
 
+#include "../xsync-compress.h"
+
 
 int epcb_event_trace (struct epollet_event_t *event)
 {
@@ -65,78 +71,1175 @@ int epcb_event_new_peer (struct epollet_event_t *event)
 }
 
 
-int epcb_event_accept (struct epollet_event_t *event)
+#define epcb_conn_hash(sfd)  ((int) ((sfd) & XSYNC_CLIENT_SESSION_HASHMAX))
+
+
+static xs_client_conn_t * epcb_conn_find (XS_server server, int sfd)
 {
+    struct hlist_node *hp;
+
+    hlist_for_each(hp, &server->conn_hlist[epcb_conn_hash(sfd)]) {
+        xs_client_conn_t *conn = hlist_entry(hp, xs_client_conn_t, i_hash);
+
+        if (conn->sockfd == sfd) {
+            return conn;
+        }
+    }
+
     return 0;
 }
 
 
+static void epcb_conn_free (xs_client_conn_t *conn)
+{
+    hlist_del(&conn->i_hash);
+
+    XS_client_conn_free(conn);
+}
+
+
+/**
+ * 关闭连接. epollet 在 EPOLLERR/EPOLLHUP 时直接关闭 socket, 留下的连接
+ *   对象在 sockfd 被重新使用 (accept) 时释放
+ */
+static void epcb_conn_close (XS_server server, xs_client_conn_t *conn)
+{
+    close(conn->sockfd);
+
+    epcb_conn_free(conn);
+}
+
+
+int epcb_event_accept (struct epollet_event_t *event)
+{
+    XS_server server = (XS_server) event->arg;
+
+    xs_client_conn_t *conn = epcb_conn_find(server, event->clientfd);
+
+    if (conn) {
+        // 上一个使用这个 sockfd 的连接没有经过 pollin 关闭
+        epcb_conn_free(conn);
+    }
+
+    conn = XS_client_conn_create(event->clientfd);
+
+    hlist_add_head(&conn->i_hash, &server->conn_hlist[epcb_conn_hash(event->clientfd)]);
+
+    LOGGER_DEBUG("accept peer(%s:%s): sock(%d)", event->hbuf, event->sbuf, event->clientfd);
+
+    return 1;
+}
+
+
 int epcb_event_reject (struct epollet_event_t *event)
 {
     return 0;
 }
 
 
-int epcb_event_pollin (struct epollet_event_t *event)
+/**
+ * 在流上应答: 切分为 DATA 帧, end 不为 0 时最后的帧带 END.
+ *   streamid = 0 时直接写消息 (不经过 XMUX)
+ */
+static int epcb_conn_reply (xs_client_conn_t *conn, ub8 streamid, const ub1 *data, ub4 len, int end)
 {
-    off_t total = 0;
+    XSMuxFrame_t frame;
+    ub1 head[XS_MUX_FRAME_HEAD_SIZE];
 
-    int next = 1;
-    int count = 0;
+    ub4 cb;
 
-    int len = sizeof(event->msg) - 1;
+    if (! streamid) {
+        return XS_client_conn_send(conn, data, len);
+    }
 
-    int sfd = event->clientfd;
+    do {
+        cb = (len > XSYNC_MUX_FRAME_MAXSIZE? XSYNC_MUX_FRAME_MAXSIZE : len);
 
-    // 读光缓冲区
+        XSMuxFrameBuild(&frame, streamid, XS_MUX_FRAME_DATA, (end && cb == len)? XS_MUX_FLAG_END : 0, 0, cb, head);
 
-    while (next && (count = readlen_next(sfd, event->msg, sizeof event->msg, &next)) >= 0) {
-        if (count > 0) {
-            total += count;
+        if (XS_client_conn_send(conn, head, XS_MUX_FRAME_HEAD_SIZE) != 0 ||
+            XS_client_conn_send(conn, data, cb) != 0) {
+            return (-1);
         }
+
+        data += cb;
+        len -= cb;
+    } while (len);
+
+    return 0;
+}
+
+
+/**
+ * 流上的消息处理的返回值:
+ *   EPCB_STREAM_OK      - 成功
+ *   EPCB_STREAM_RESET   - 拒绝这个流 (RESET), 不影响连接上的其他流
+ *   EPCB_STREAM_CLOSE   - 连接出错
+ */
+#define EPCB_STREAM_OK       0
+#define EPCB_STREAM_RESET    (-1)
+#define EPCB_STREAM_CLOSE    (-2)
+
+
+static int epcb_stream_entry (XS_server server, xs_client_conn_t *conn, xs_conn_stream_t *stream);
+
+
+/**
+ * 把这一批块中从 planhead 开始连续到达的块按文件顺序加入文件条目
+ */
+static void epcb_chunk_plan_append (xs_conn_stream_t *stream)
+{
+    while (stream->planhead < stream->nplan && stream->plan[stream->planhead].done) {
+        xs_conn_chunk_t *pc = &stream->plan[stream->planhead++];
+
+        XS_file_entry_add_chunk(stream->entry, pc->offset, pc->length, pc->digest);
     }
+}
 
-    if (! next) {
-        printf("read %ju bytes ok.\n", total);
 
-        if (total == XS_CONNECT_REQ_SIZE) {
-            XSConnectReq_t xconReq;
+/**
+ * 流上的 XCHK: 记录这一批块, 块索引中已经存在的块从其他文件 (或者文件
+ *   自己还没有重写的部分) 复制到文件条目的对应位置. 复制失败的块改为
+ *   缺失, 由客户端用 XSYN 传输
+ */
+static int epcb_chunk_plan (XS_server server, xs_client_conn_t *conn, xs_conn_stream_t *stream,
+    const XSChunkNegotiateReq_t *req, const XSChunkDesc_t *descs, ub1 *bitmap, ub4 *missing)
+{
+    ub4 i;
+    ub8 offset = req->offset;
 
-            XS_BOOL isOK = XSConnectRequestParse((ub1 *) event->msg, &xconReq);
+    xs_conn_chunk_t *plan;
 
-            if ( isOK ) {
-                printf("%s\n", XSConnectRequestOutput(&xconReq, xconReq.password, event->msg, sizeof event->msg));
-            }
+    char buf[XSYNC_BUFSIZE];
+    char entryfile[PATH_MAX];
+
+    for (i = 0; i < req->chunks; i++) {
+        if (descs[i].length == 0 || descs[i].length > XSYNC_CHUNK_MAX_SIZE) {
+            LOGGER_WARN("sock(%d): XCHK invalid chunk length(%u) on stream(%ju)", conn->sockfd, descs[i].length, stream->streamid);
+            return EPCB_STREAM_RESET;
         }
-    } else if (count < 0) {
-        // Closing the descriptor will make epoll remove it from
-        //  the set of descriptors which are monitored
-        snprintf(event->msg, len, "client close socket(%d)", sfd);
-        event->msg[len] = 0;
+    }
 
-        printf(event->msg);
+    if (! stream->entry && epcb_stream_entry(server, conn, stream) != 0) {
+        return EPCB_STREAM_RESET;
+    }
 
-        close(sfd);
+    if (pathtab_path(stream->entry->paths, stream->entry->pathid, entryfile, sizeof(entryfile)) <= 0) {
+        return EPCB_STREAM_RESET;
+    }
 
-        return 1;
+    plan = XS_client_conn_stream_plan(stream, req->chunks);
+
+    for (i = 0; i < req->chunks; i++) {
+        xs_conn_chunk_t *pc = &plan[i];
+
+        pc->offset = offset;
+        pc->length = descs[i].length;
+        memcpy(pc->digest, descs[i].digest, XS_CHUNK_HASH_SIZE);
+
+        offset += pc->length;
+
+        if (XS_CHUNK_BITMAP_TEST(bitmap, i)) {
+            continue;
+        }
+
+        if (XS_chunk_store_copyto(server->chunkstore, pc->digest, pc->length, entryfile,
+                stream->entry->wofd, pc->offset, stream->entry->wrpos, buf, sizeof(buf)) != XS_SUCCESS) {
+            XS_CHUNK_BITMAP_SET(bitmap, i);
+            (*missing)++;
+            continue;
+        }
+
+        pc->done = 1;
+
+        stream->dirty = 1;
+
+        if (pc->offset + pc->length > stream->endpos) {
+            stream->endpos = pc->offset + pc->length;
+        }
+
+        if (stream->endpos > stream->entry->wrpos) {
+            stream->entry->wrpos = stream->endpos;
+        }
+
+        __interlock_add(&server->chunkstore->dedup_chunks);
+        __sync_add_and_fetch(&server->chunkstore->dedup_bytes, (ub8) pc->length);
+
+        metrics_counter_inc(xs_server_metrics.chunks_deduped);
+        metrics_counter_add(xs_server_metrics.bytes_deduped, (uint64_t) pc->length);
     }
 
-    // rearm the socket. 注册事件用于 write
-    if (epollout_mod(event->epollfd, event->clientfd, event->msg, sizeof event->msg) == -1) {
-        close(sfd);
+    epcb_chunk_plan_append(stream);
+
+    return EPCB_STREAM_OK;
+}
+
+
+/**
+ * XCHK: 检查块是否在块存储中存在, 返回缺失块位图.
+ *   在流上时 entryid 必须是流 id, 应答也在这个流上; 已经存在的块在
+ *   应答之前写入流的文件条目 (epcb_chunk_plan)
+ */
+static int epcb_chunk_negotiate (XS_server server, xs_client_conn_t *conn, xs_conn_stream_t *stream, ub1 *msg, ub4 msglen)
+{
+    XSChunkNegotiateReq_t req;
+    XSChunkNegotiateReply_t reply;
+
+    XSChunkDesc_t *descs;
+    ub1 *replybuf;
+
+    ub4 missing;
+    int len, ret;
+
+    int sfd = conn->sockfd;
+
+    ub8 streamid = (stream? stream->streamid : 0);
+
+    if (msglen < XS_CHUNK_NEGOTIATE_REQ_SIZE ||
+        ! XSChunkNegotiateReqParse(msg, &req, 0) ||
+        msglen != XS_CHUNK_NEGOTIATE_REQ_SIZE + req.datalen) {
+        LOGGER_WARN("sock(%d): invalid XCHK request (%u bytes)", sfd, msglen);
+        return EPCB_STREAM_RESET;
+    }
+
+    if (streamid && (req.session != conn->session || req.entryid != streamid)) {
+        LOGGER_WARN("sock(%d): XCHK not match stream(%ju)", sfd, streamid);
+        return EPCB_STREAM_RESET;
+    }
+
+    descs = (XSChunkDesc_t *) mem_alloc_unset(sizeof(XSChunkDesc_t) * (req.chunks + 1));
+
+    if (! XSChunkNegotiateReqParse(msg, &req, descs)) {
+        LOGGER_WARN("sock(%d): bad XCHK checksum", sfd);
+        mem_free(descs);
+        return EPCB_STREAM_RESET;
+    }
+
+    len = XS_CHUNK_NEGOTIATE_REPLY_SIZE + XS_CHUNK_BITMAP_SIZE(req.chunks);
+    replybuf = (ub1 *) mem_alloc_zero(1, len);
+
+    missing = XS_chunk_store_negotiate(server->chunkstore, descs, req.chunks, replybuf + XS_CHUNK_NEGOTIATE_REPLY_SIZE);
+
+    if (stream) {
+        ret = epcb_chunk_plan(server, conn, stream, &req, descs, replybuf + XS_CHUNK_NEGOTIATE_REPLY_SIZE, &missing);
+
+        if (ret != EPCB_STREAM_OK) {
+            mem_free(replybuf);
+            mem_free(descs);
+            return ret;
+        }
+    }
+
+    XSChunkNegotiateReplyBuild(&reply, req.session, req.entryid, req.chunks, missing, replybuf + XS_CHUNK_NEGOTIATE_REPLY_SIZE, replybuf);
+
+    ret = epcb_conn_reply(conn, streamid, replybuf, len, 0);
+
+    LOGGER_DEBUG("sock(%d): XCHK entryid=%ju chunks=%u missing=%u", sfd, req.entryid, req.chunks, missing);
+
+    mem_free(replybuf);
+    mem_free(descs);
+
+    return (ret == 0? EPCB_STREAM_OK : EPCB_STREAM_CLOSE);
+}
+
+
+/**
+ * XLGB: 批量注册文件条目, 一次返回全部 entryid.
+ *   在流上时应答带 END (请求流只有一次请求和应答)
+ */
+static int epcb_log_batch (XS_server server, xs_client_conn_t *conn, ub8 streamid, ub1 *msg, ub4 msglen)
+{
+    XSLogBatchReq_t req;
+    XSLogBatchReply_t reply;
+    XSLogBatchEntry_t *entries;
+
+    XSLogBatchEntry_t entry;
+
+    const char **pathfiles;
+    char *paths, *pathbuf;
+    char pathfile[XSYNC_PATHFILE_MAXLEN + 1];
+
+    ub1 *pbuf, *pend, *replybuf;
+    ub8 *entryids;
+
+    ub4 i, pathlen;
+    size_t size;
+    int len, ret, ok;
+
+    int sfd = conn->sockfd;
 
-        printf(event->msg);
+    if (msglen < XS_LOGBATCH_REQ_SIZE ||
+        ! XSLogBatchReqParse(msg, &req, 0) ||
+        msglen != XS_LOGBATCH_REQ_SIZE + req.datalen ||
+        ! XSLogBatchReqParse(msg, &req, 1)) {
+        LOGGER_WARN("sock(%d): invalid XLGB request (%u bytes)", sfd, msglen);
+        return EPCB_STREAM_RESET;
+    }
+
+    if (streamid && (req.session != conn->session || strcmp(req.clientid, conn->client->clientid))) {
+        LOGGER_WARN("sock(%d): XLGB not match session on stream(%ju)", sfd, streamid);
+        return EPCB_STREAM_RESET;
+    }
+
+    // 第一遍: 校验条目, 计算还原全部路径需要的字节
+    pbuf = msg + XS_LOGBATCH_REQ_SIZE;
+    pend = pbuf + req.datalen;
+
+    size = 0;
+    pathlen = 0;
+
+    for (i = 0; i < req.entries; i++) {
+        pathlen = XSLogBatchEntryNext(&pbuf, pend, &entry, pathfile, pathlen);
+
+        if (! pathlen) {
+            LOGGER_WARN("sock(%d): invalid XLGB entry(%u)", sfd, i);
+            return EPCB_STREAM_RESET;
+        }
+
+        size += pathlen + 1;
+    }
+
+    if (pbuf != pend) {
+        LOGGER_WARN("sock(%d): invalid XLGB entries", sfd);
+        return EPCB_STREAM_RESET;
+    }
+
+    entries = (XSLogBatchEntry_t *) mem_alloc_unset(sizeof(XSLogBatchEntry_t) * (req.entries + 1));
+    pathfiles = (const char **) mem_alloc_unset(sizeof(char *) * (req.entries + 1));
+    entryids = (ub8 *) mem_alloc_unset(sizeof(ub8) * (req.entries + 1));
+    paths = (char *) mem_alloc_unset(size + 1);
+
+    // 第二遍: 还原路径
+    pbuf = msg + XS_LOGBATCH_REQ_SIZE;
+    pathbuf = paths;
+    pathlen = 0;
+
+    for (i = 0; i < req.entries; i++) {
+        pathlen = XSLogBatchEntryNext(&pbuf, pend, &entries[i], pathfile, pathlen);
+
+        memcpy(pathbuf, pathfile, pathlen + 1);
+        pathfiles[i] = pathbuf;
+        pathbuf += pathlen + 1;
+    }
+
+    ok = XS_entrydb_register_batch(&server->redisconn, server->serverid, req.clientid,
+        entries, pathfiles, req.entries, entryids);
+
+    len = XS_LOGBATCH_REPLY_SIZE + req.entries * sizeof(ub8);
+    replybuf = (ub1 *) mem_alloc_zero(1, len);
+
+    XSLogBatchReplyBuild(&reply, req.session, entryids, req.entries, replybuf);
+
+    ret = epcb_conn_reply(conn, streamid, replybuf, len, 1);
+
+    LOGGER_DEBUG("sock(%d): XLGB client=%s entries=%u registered=%d", sfd, req.clientid, req.entries, ok);
+
+    mem_free(replybuf);
+    mem_free(paths);
+    mem_free(entryids);
+    mem_free(pathfiles);
+    mem_free(entries);
+
+    return (ret == 0? EPCB_STREAM_OK : EPCB_STREAM_CLOSE);
+}
+
+
+/**
+ * 客户端的路径不能包含 "." 和 ".." 目录, 也不能是目录
+ */
+static int epcb_entry_path_valid (const char *pathfile)
+{
+    const char *p = pathfile;
 
-        exit(-1);
+    size_t n;
+
+    if (! *p || p[strlen(p) - 1] == '/') {
+        return 0;
     }
 
-    printf("epcb_event_pollin success\n");
+    for (;;) {
+        const char *q = strchr(p, '/');
+
+        n = (q? (size_t) (q - p) : strlen(p));
+
+        if ((n == 1 && p[0] == '.') || (n == 2 && p[0] == '.' && p[1] == '.')) {
+            return 0;
+        }
+
+        if (! q) {
+            break;
+        }
+
+        p = q + 1;
+    }
 
     return 1;
 }
 
 
-int epcb_event_pollout (struct epollet_event_t *event)
+/**
+ * 打开流的文件条目: 会话中没有时, 由 entrydb 查到客户端注册的路径,
+ *   文件保存到 dataroot/clientid/pathfile
+ */
+static int epcb_stream_entry (XS_server server, xs_client_conn_t *conn, xs_conn_stream_t *stream)
 {
+    XS_file_entry entry;
+
+    if (stream->streamid & XS_MUX_REQUEST_STREAM) {
+        // 请求流只承载命令, 不对应文件条目
+        LOGGER_WARN("sock(%d): stream(%ju) is a request stream", conn->sockfd, stream->streamid);
+        return (-1);
+    }
+
+    entry = XS_client_session_find_entry(conn->client, stream->streamid);
+
+    if (! entry) {
+        int len;
+
+        char pathfile[XSYNC_PATHFILE_MAXLEN + 1];
+        char entryfile[PATH_MAX];
+
+        len = XS_entrydb_lookup(&server->redisconn, server->serverid, conn->client->clientid, stream->streamid, pathfile, sizeof(pathfile));
+
+        if (len <= 0) {
+            LOGGER_WARN("sock(%d): stream(%ju) not registered", conn->sockfd, stream->streamid);
+            return (-1);
+        }
+
+        if (! epcb_entry_path_valid(pathfile)) {
+            LOGGER_WARN("sock(%d): stream(%ju) invalid path: %s", conn->sockfd, stream->streamid, pathfile);
+            return (-1);
+        }
+
+        len = snprintf(entryfile, sizeof(entryfile), "%s%s", conn->client->path_prefix, pathfile + (*pathfile == '/'));
+        if (len <= 0 || len >= sizeof(entryfile)) {
+            LOGGER_WARN("sock(%d): stream(%ju) path too long: %s", conn->sockfd, stream->streamid, pathfile);
+            return (-1);
+        }
+
+        if (XS_file_entry_create(server->pathtab, entryfile, &entry) != XS_SUCCESS) {
+            return (-1);
+        }
+
+        entry->entryid = stream->streamid;
+
+        // 文件将被重写: 原来的清单只用于还没有重写的部分
+        XS_chunk_store_begin(server->chunkstore, entryfile);
+        entry->chunkstore = server->chunkstore;
+
+        XS_client_session_add_entry(conn->client, entry);
+    }
+
+    if (XS_file_entry_open(entry, S_IRGRP | S_IROTH) == -1) {
+        return (-1);
+    }
+
+    stream->entry = entry;
+
     return 0;
 }
+
+
+/**
+ * XSYN: 文件数据写入流的文件条目. 只写入 (不 fdatasync), 确认在一次读取
+ *   处理完之后统一进行. 压缩的数据先解压; XCHK 协商的缺失块先校验摘要,
+ *   写入之后加入文件条目的块 (流结束时提交为文件清单)
+ */
+static int epcb_sync_file (XS_server server, xs_client_conn_t *conn, xs_conn_stream_t *stream, ub1 *msg, ub4 msglen)
+{
+    XSSyncFileReq_t req;
+
+    ub1 *data = msg + XS_SYNC_REQ_SIZE;
+
+    ub4 off, datalen;
+    ssize_t rc;
+
+    xs_conn_chunk_t *pc = 0;
+
+    if (! XSSyncFileReqParse(msg, &req) || msglen != XS_SYNC_REQ_SIZE + req.datalen) {
+        LOGGER_WARN("sock(%d): invalid XSYN on stream(%ju)", conn->sockfd, stream->streamid);
+        return EPCB_STREAM_RESET;
+    }
+
+    if (req.session != conn->session || req.entryid != stream->streamid) {
+        LOGGER_WARN("sock(%d): XSYN not match stream(%ju)", conn->sockfd, stream->streamid);
+        return EPCB_STREAM_RESET;
+    }
+
+    datalen = req.datalen;
+
+    if (req.codec != XS_CODEC_NONE) {
+        if (req.codec != (conn->bitflags & XS_CAPFLAG_COMPRESS_MASK) || req.rawlen > XS_CONN_STREAM_MSGMAX) {
+            LOGGER_WARN("sock(%d): XSYN codec(%u) not accepted on stream(%ju)", conn->sockfd, req.codec, stream->streamid);
+            return EPCB_STREAM_RESET;
+        }
+
+        data = XS_client_conn_rawbuf(conn, req.rawlen);
+
+        if (XS_decompress_chunk(&conn->decompressor, req.codec, msg + XS_SYNC_REQ_SIZE, req.datalen, data, req.rawlen) != XS_SUCCESS) {
+            LOGGER_WARN("sock(%d): XSYN %s decompress failed on stream(%ju)", conn->sockfd, XS_codec_name(req.codec), stream->streamid);
+            return EPCB_STREAM_RESET;
+        }
+
+        datalen = req.rawlen;
+    }
+
+    if (! stream->entry && epcb_stream_entry(server, conn, stream) != 0) {
+        return EPCB_STREAM_RESET;
+    }
+
+    if (stream->plan && datalen) {
+        pc = XS_client_conn_stream_plan_find(stream, req.offset, datalen);
+
+        if (pc) {
+            ub1 md[XS_CHUNK_HASH_SIZE];
+
+            SHA256(data, (size_t) datalen, md);
+
+            if (memcmp(md, pc->digest, XS_CHUNK_HASH_SIZE)) {
+                LOGGER_WARN("sock(%d): XSYN chunk digest mismatched at offset=%ju on stream(%ju)", conn->sockfd, req.offset, stream->streamid);
+                return EPCB_STREAM_RESET;
+            }
+        }
+    }
+
+    for (off = 0; off < datalen; off += (ub4) rc) {
+        rc = pwrite(stream->entry->wofd, data + off, datalen - off, (off_t) (req.offset + off));
+
+        if (rc < 0 && errno == EINTR) {
+            rc = 0;
+        } else if (rc <= 0) {
+            LOGGER_ERROR("pwrite error(%d): %s. (entryid=%ju)", errno, strerror(errno), stream->streamid);
+            return EPCB_STREAM_RESET;
+        }
+    }
+
+    if (datalen) {
+        stream->dirty = 1;
+
+        metrics_counter_add(xs_server_metrics.bytes_written, (uint64_t) datalen);
+    }
+
+    if (pc) {
+        pc->done = 1;
+
+        metrics_counter_inc(xs_server_metrics.chunks_written);
+
+        epcb_chunk_plan_append(stream);
+    }
+
+    if (req.offset + datalen > stream->endpos) {
+        stream->endpos = req.offset + datalen;
+    }
+
+    if (stream->endpos > stream->entry->wrpos) {
+        stream->entry->wrpos = stream->endpos;
+    }
+
+    return EPCB_STREAM_OK;
+}
+
+
+/**
+ * 流上第一个消息的总字节. 返回 0 需要更多数据, -1 不认识的消息或者
+ *   超过 XS_CONN_STREAM_MSGMAX
+ */
+static int epcb_stream_message_size (const ub1 *msg, ub4 len)
+{
+    ub4 size;
+
+    if (len < 8) {
+        return 0;
+    }
+
+    size = (ub4) BO_bytes_betoh_i32((void *) (msg + 4));
+
+    if (! memcmp(msg, XS_MSGID_XSYN.c, 4)) {
+        size += XS_SYNC_REQ_SIZE;
+    } else if (! memcmp(msg, XS_MSGID_XCHK.c, 4)) {
+        size += XS_CHUNK_NEGOTIATE_REQ_SIZE;
+    } else if (! memcmp(msg, XS_MSGID_XLGB.c, 4)) {
+        size += XS_LOGBATCH_REQ_SIZE;
+    } else {
+        return (-1);
+    }
+
+    return (size <= XS_CONN_STREAM_MSGMAX? (int) size : -1);
+}
+
+
+/**
+ * 处理流的消息缓冲中全部完整的消息
+ */
+static int epcb_stream_dispatch (XS_server server, xs_client_conn_t *conn, xs_conn_stream_t *stream)
+{
+    int msglen, ret = EPCB_STREAM_OK;
+
+    while (ret == EPCB_STREAM_OK) {
+        ub1 *msg = stream->msgbuf;
+
+        msglen = epcb_stream_message_size(msg, stream->msglen);
+
+        if (msglen < 0) {
+            LOGGER_WARN("sock(%d): invalid message on stream(%ju)", conn->sockfd, stream->streamid);
+            return EPCB_STREAM_RESET;
+        }
+
+        if (msglen == 0 || (ub4) msglen > stream->msglen) {
+            break;
+        }
+
+        if (! memcmp(msg, XS_MSGID_XSYN.c, 4)) {
+            ret = epcb_sync_file(server, conn, stream, msg, (ub4) msglen);
+        } else if (! memcmp(msg, XS_MSGID_XCHK.c, 4)) {
+            ret = epcb_chunk_negotiate(server, conn, stream, msg, (ub4) msglen);
+        } else {
+            ret = epcb_log_batch(server, conn, stream->streamid, msg, (ub4) msglen);
+        }
+
+        if (ret == EPCB_STREAM_OK) {
+            XS_client_conn_stream_consume(conn, stream, (ub4) msglen);
+        }
+    }
+
+    if (ret == EPCB_STREAM_OK && stream->ended && stream->msglen) {
+        LOGGER_WARN("sock(%d): stream(%ju) ended with partial message", conn->sockfd, stream->streamid);
+        return EPCB_STREAM_RESET;
+    }
+
+    return ret;
+}
+
+
+/**
+ * 拒绝流: 客户端丢弃流上未发送的数据, 从确认的位置重新开始.
+ *   文件条目保留在会话中
+ */
+static int epcb_stream_reset (xs_client_conn_t *conn, xs_conn_stream_t *stream)
+{
+    XSMuxFrame_t frame;
+    ub1 replybuf[XS_MUX_FRAME_HEAD_SIZE];
+
+    XSMuxFrameBuild(&frame, stream->streamid, XS_MUX_FRAME_RESET, 0, 0, 0, replybuf);
+
+    LOGGER_WARN("sock(%d): reset stream(%ju)", conn->sockfd, stream->streamid);
+
+    XS_client_conn_stream_free(conn, stream);
+
+    return XS_client_conn_send(conn, replybuf, XS_MUX_FRAME_HEAD_SIZE);
+}
+
+
+/**
+ * 流结束: 由条目的路径还原客户端的路径 (去掉 dataroot/clientid), 在镜像
+ *   索引中记录同步完成. pathtab 还原的路径是规范的, 前缀也按规范比较
+ */
+static void epcb_mirror_synced (XS_server server, xs_client_conn_t *conn, XS_file_entry entry)
+{
+    int i, n = 0;
+
+    char prefix[XSYNC_PATHFILE_MAXLEN + 1];
+    char entryfile[PATH_MAX];
+
+    const char *p = conn->client->path_prefix;
+
+    for (i = 0; p[i] && n < (int) sizeof(prefix) - 1; i++) {
+        if (p[i] != '/' || ! n || prefix[n - 1] != '/') {
+            prefix[n++] = p[i];
+        }
+    }
+
+    if (n > 1 && prefix[n - 1] == '/') {
+        n--;
+    }
+
+    prefix[n] = 0;
+
+    if (pathtab_path(entry->paths, entry->pathid, entryfile, sizeof(entryfile)) <= n ||
+        strncmp(entryfile, prefix, n) || entryfile[n] != '/') {
+        return;
+    }
+
+    XS_mirror_index_synced(server->mirror, conn->client->clientid, entryfile + n, metrics_now_us());
+}
+
+
+/**
+ * 归还处理完的流窗口. 写入过文件的流先 fdatasync, 结束的流截断文件到
+ *   最后写入的位置, 然后关闭文件条目, 释放流.
+ */
+static int epcb_stream_acks (XS_server server, xs_client_conn_t *conn)
+{
+    struct list_head *list, *next;
+
+    XSMuxFrame_t frame;
+    ub1 replybuf[XS_MUX_FRAME_HEAD_SIZE];
+
+    list_for_each_safe(list, next, &conn->acklist) {
+        xs_conn_stream_t *stream = list_entry(list, xs_conn_stream_t, i_ack);
+
+        list_del(list);
+        stream->acking = 0;
+
+        if (stream->entry && stream->ended) {
+            struct stat sb;
+
+            if (fstat(stream->entry->wofd, &sb) == 0 && (ub8) sb.st_size > stream->endpos) {
+                // 客户端的文件变短了 (截断之后重新同步)
+                if (ftruncate(stream->entry->wofd, (off_t) stream->endpos) == 0) {
+                    stream->dirty = 1;
+                } else {
+                    LOGGER_ERROR("ftruncate error(%d): %s. (entryid=%ju)", errno, strerror(errno), stream->streamid);
+                }
+            }
+        }
+
+        if (stream->dirty) {
+            if (fdatasync(stream->entry->wofd) != 0) {
+                LOGGER_ERROR("fdatasync error(%d): %s. (entryid=%ju)", errno, strerror(errno), stream->streamid);
+
+                if (epcb_stream_reset(conn, stream) != 0) {
+                    return (-1);
+                }
+
+                continue;
+            }
+
+            stream->dirty = 0;
+        }
+
+        if (stream->ackbytes) {
+            XSMuxFrameBuild(&frame, stream->streamid, XS_MUX_FRAME_WINDOW, 0, stream->ackbytes, 0, replybuf);
+
+            if (XS_client_conn_send(conn, replybuf, XS_MUX_FRAME_HEAD_SIZE) != 0) {
+                return (-1);
+            }
+
+            stream->ackbytes = 0;
+        }
+
+        if (stream->ended) {
+            if (stream->entry) {
+                stream->entry->offset = (int64_t) stream->endpos;
+
+                // 文件已经落盘: 提交收到的块作为文件清单
+                XS_file_entry_commit_chunks(stream->entry);
+
+                if (server->mirror) {
+                    epcb_mirror_synced(server, conn, stream->entry);
+                }
+
+                XS_client_session_remove_entry(conn->client, stream->entry);
+            }
+
+            XS_client_conn_stream_free(conn, stream);
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * XMUX: 处理客户端的一个多路复用帧. DATA 帧的负载进入流的消息缓冲,
+ *   完整的消息立即处理; 流窗口在 epcb_stream_acks 中归还, 连接窗口由
+ *   调用者在处理完一次读到的全部帧之后归还.
+ *
+ *   trace 不为 0 时记录第一个 DATA 帧的流 id.
+ */
+static int epcb_mux_frame (XS_server server, xs_client_conn_t *conn, ub1 *msg, ub4 msglen, ub8 *consumed, evtrace_rec_t *trace)
+{
+    XSMuxFrame_t frame;
+
+    xs_conn_stream_t *stream;
+
+    ub1 replybuf[XS_MUX_FRAME_HEAD_SIZE];
+
+    int ret;
+
+    if (! XSMuxFrameParse(msg, &frame) || msglen != XS_MUX_FRAME_HEAD_SIZE + frame.datalen) {
+        LOGGER_WARN("sock(%d): invalid XMUX frame", conn->sockfd);
+        return (-1);
+    }
+
+    if (frame.type == XS_MUX_FRAME_PING) {
+        if (! (frame.flags & XS_MUX_FLAG_ACK)) {
+            XSMuxFrameBuild(&frame, 0, XS_MUX_FRAME_PING, XS_MUX_FLAG_ACK, 0, 0, replybuf);
+
+            return XS_client_conn_send(conn, replybuf, XS_MUX_FRAME_HEAD_SIZE);
+        }
+
+        return 0;
+    }
+
+    stream = (frame.streamid? XS_client_conn_stream_find(conn, frame.streamid) : 0);
+
+    if (frame.type == XS_MUX_FRAME_RESET) {
+        // 客户端放弃了流
+        if (stream) {
+            XS_client_conn_stream_free(conn, stream);
+        }
+
+        return 0;
+    }
+
+    if (frame.type != XS_MUX_FRAME_DATA) {
+        // 服务端的应答不受窗口限制, 忽略 WINDOW
+        return 0;
+    }
+
+    if (! frame.streamid || ! conn->client) {
+        LOGGER_WARN("sock(%d): XMUX DATA before XCON or on stream 0", conn->sockfd);
+        return (-1);
+    }
+
+    *consumed += frame.datalen;
+
+    if (trace && ! trace->id) {
+        trace->id = frame.streamid;
+    }
+
+    if (! stream) {
+        stream = XS_client_conn_stream_open(conn, frame.streamid);
+    }
+
+    if (XS_client_conn_stream_recv(stream, msg + XS_MUX_FRAME_HEAD_SIZE, frame.datalen) != 0) {
+        LOGGER_WARN("sock(%d): stream(%ju) exceeds window", conn->sockfd, frame.streamid);
+        return epcb_stream_reset(conn, stream);
+    }
+
+    if (frame.flags & XS_MUX_FLAG_END) {
+        stream->ended = 1;
+
+        // 没有数据的 END 帧也要进入确认队列, 以便释放流
+        XS_client_conn_stream_consume(conn, stream, 0);
+    }
+
+    ret = epcb_stream_dispatch(server, conn, stream);
+
+    if (ret == EPCB_STREAM_RESET) {
+        return epcb_stream_reset(conn, stream);
+    }
+
+    return (ret == EPCB_STREAM_OK? 0 : (-1));
+}
+
+
+/* 镜像索引中 kafka 报告变化之后还没有同步完成的文件 */
+static int epcb_mirror_unsynced (const mirror_change_t *change, void *arg)
+{
+    if (change->time_us > change->synced_us) {
+        (*(int *) arg)++;
+    }
+
+    return 0;
+}
+
+
+/**
+ * 客户端 ID 用作目录名
+ */
+static int epcb_clientid_valid (const char *clientid)
+{
+    size_t len = strnlen(clientid, XSYNC_CLIENTID_MAXLEN + 1);
+
+    if (len == 0 || len > XSYNC_CLIENTID_MAXLEN || strchr(clientid, '/') ||
+        ! strcmp(clientid, ".") || ! strcmp(clientid, "..")) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * XCON: 验证魔数, 协商压缩算法, 建立会话
+ */
+static int epcb_connect_reply (XS_server server, xs_client_conn_t *conn, const XSConnectReq_t *req)
+{
+    XSConnectReply_t reply;
+
+    ub1 replybuf[XS_CONNECT_ACCEPT_REPLY_SIZE];
+
+    int sfd = conn->sockfd;
+
+    const char *clientid = (const char *) req->clientid;
+
+    if (req->magic != server->magic || conn->client || ! epcb_clientid_valid(clientid)) {
+        LOGGER_WARN("sock(%d): reject client '%.*s': %s", sfd, XSYNC_CLIENTID_MAXLEN, clientid,
+            req->magic != server->magic? "bad magic" : (conn->client? "duplicate XCON" : "bad clientid"));
+
+        XSConnectReplyRejectBuild(&reply, (ub4) XS_E_PARAM, replybuf);
+        sendlen(sfd, (const char *) replybuf, XS_CONNECT_REJECT_REPLY_SIZE);
+
+        return (-1);
+    } else {
+        XS_client_session client;
+
+        ub4 codec = XS_compress_choose(req->capflags, XS_compress_capflags());
+
+        ub4 bitflags = codec | (req->capflags & XS_CAPFLAG_MUX);
+
+        ub8 session = (ub8) __interlock_add(&server->session_counter);
+
+        if (XS_client_session_create(clientid, server->dataroot, session, &client) != XS_SUCCESS) {
+            return (-1);
+        }
+
+        hlist_add_head(&client->i_hash, &server->client_hlist[session & XSYNC_CLIENT_SESSION_HASHMAX]);
+
+        conn->client = client;
+        conn->session = session;
+        conn->bitflags = bitflags;
+
+        XSConnectReplyAcceptBuild(&reply, req->magic ^ req->randnum, (ub8) time(0), session, bitflags, replybuf);
+
+        if (XS_client_conn_send(conn, replybuf, XS_CONNECT_ACCEPT_REPLY_SIZE) != 0) {
+            return (-1);
+        }
+
+        metrics_counter_inc(xs_server_metrics.connections_accepted);
+
+        LOGGER_INFO("sock(%d): accept client '%s': session=%ju codec=%s", sfd, clientid, session, XS_codec_name(codec));
+
+        if (server->mirror) {
+            int unsynced = 0;
+
+            XS_mirror_index_changed(server->mirror, clientid, 0, 0, epcb_mirror_unsynced, &unsynced);
+
+            if (unsynced) {
+                LOGGER_INFO("sock(%d): client '%s' has %d files changed (kafka) but not synced", sfd, clientid, unsynced);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * 最大的消息: XCHK/XLGB 最大请求或者一个 XMUX 帧 (包括帧头)
+ */
+#define EPCB_XCHK_MAXSIZE    (XS_CHUNK_NEGOTIATE_REQ_SIZE + XS_CHUNK_DESC_SIZE * XSYNC_CHUNK_NEGOTIATE_MAX)
+#define EPCB_XLGB_MAXSIZE    (XS_LOGBATCH_REQ_SIZE + XSYNC_LOGBATCH_MAXSIZE)
+#define EPCB_XMUX_MAXSIZE    (XS_MUX_FRAME_HEAD_SIZE + XSYNC_MUX_FRAME_MAXSIZE)
+
+#define EPCB_MAX(a, b)       ((a) > (b)? (a) : (b))
+
+#define EPCB_MSGBUF_MAXSIZE  \
+    EPCB_MAX(EPCB_MAX(EPCB_XCHK_MAXSIZE, EPCB_XLGB_MAXSIZE), EPCB_XMUX_MAXSIZE)
+
+/* 一次 read 的字节 */
+#define EPCB_READ_SIZE       16384
+
+
+/**
+ * 接收缓冲中第一个消息的总字节.
+ *   返回 0 需要更多数据才能确定, -1 不认识的消息或者超过最大的消息
+ */
+static int epcb_message_size (const ub1 *msg, ub4 len)
+{
+    ub4 datalen;
+
+    if (len < 8) {
+        return 0;
+    }
+
+    if (! memcmp(msg, XS_MSGID_XCON.c, 4)) {
+        return XS_CONNECT_REQ_SIZE;
+    }
+
+    datalen = (ub4) BO_bytes_betoh_i32((void *) (msg + 4));
+
+    if (! memcmp(msg, XS_MSGID_XMUX.c, 4)) {
+        return (datalen <= XSYNC_MUX_FRAME_MAXSIZE? (int) (XS_MUX_FRAME_HEAD_SIZE + datalen) : -1);
+    }
+
+    if (! memcmp(msg, XS_MSGID_XCHK.c, 4)) {
+        return (datalen <= EPCB_XCHK_MAXSIZE - XS_CHUNK_NEGOTIATE_REQ_SIZE? (int) (XS_CHUNK_NEGOTIATE_REQ_SIZE + datalen) : -1);
+    }
+
+    if (! memcmp(msg, XS_MSGID_XLGB.c, 4)) {
+        return (datalen <= XSYNC_LOGBATCH_MAXSIZE? (int) (XS_LOGBATCH_REQ_SIZE + datalen) : -1);
+    }
+
+    return (-1);
+}
+
+
+/**
+ * 处理接收缓冲中全部完整的消息, 不完整的消息留在缓冲中等待下次读取.
+ *   返回 0 成功, -1 关闭连接
+ */
+static int epcb_conn_dispatch (XS_server server, xs_client_conn_t *conn, ub8 *consumed, evtrace_rec_t *trace)
+{
+    int msglen, err = 0;
+
+    ub1 *msg;
+
+    while (! err) {
+        msg = XS_client_conn_rxdata(conn);
+
+        msglen = epcb_message_size(msg, XS_client_conn_rxbytes(conn));
+
+        if (msglen < 0) {
+            LOGGER_WARN("sock(%d): invalid message", conn->sockfd);
+            return (-1);
+        }
+
+        if (msglen == 0 || (ub4) msglen > XS_client_conn_rxbytes(conn)) {
+            // 不完整
+            break;
+        }
+
+        if (! memcmp(msg, XS_MSGID_XMUX.c, 4)) {
+            err = epcb_mux_frame(server, conn, msg, (ub4) msglen, consumed, trace);
+        } else if (! memcmp(msg, XS_MSGID_XCON.c, 4)) {
+            XSConnectReq_t xconReq;
+
+            if (! XSConnectRequestParse(msg, &xconReq)) {
+                LOGGER_WARN("sock(%d): invalid XCON request", conn->sockfd);
+                return (-1);
+            }
+
+            err = epcb_connect_reply(server, conn, &xconReq);
+        } else if (! memcmp(msg, XS_MSGID_XCHK.c, 4)) {
+            err = (epcb_chunk_negotiate(server, conn, 0, msg, (ub4) msglen) == EPCB_STREAM_OK? 0 : (-1));
+        } else {
+            err = (epcb_log_batch(server, conn, 0, msg, (ub4) msglen) == EPCB_STREAM_OK? 0 : (-1));
+        }
+
+        XS_client_conn_consume(conn, (ub4) msglen);
+    }
+
+    return err;
+}
+
+
+int epcb_event_pollin (struct epollet_event_t *event)
+{
+    int next = 1;
+    int count = 0;
+    int err = 0;
+
+    ub8 consumed = 0;
+
+    ub1 rdbuf[EPCB_READ_SIZE];
+
+    int sfd = event->clientfd;
+
+    XS_server server = (XS_server) event->arg;
+
+    xs_client_conn_t *conn = epcb_conn_find(server, sfd);
+
+    evtrace_rec_t *trace;
+
+    if (! conn) {
+        conn = XS_client_conn_create(sfd);
+        hlist_add_head(&conn->i_hash, &server->conn_hlist[epcb_conn_hash(sfd)]);
+    }
+
+    trace = evtrace_begin(0);
+    evtrace_stamp(trace, EVTRACE_SRV_RECV);
+
+    // 读光缓冲区: 完整的消息立即处理, 不完整的留在连接的接收缓冲
+    while (! err && next && (count = readlen_next(sfd, (char *) rdbuf, sizeof(rdbuf), &next)) >= 0) {
+        if (count > 0) {
+            metrics_counter_add(xs_server_metrics.bytes_received, (uint64_t) count);
+
+            err = XS_client_conn_recv(conn, rdbuf, (ub4) count, EPCB_MSGBUF_MAXSIZE + EPCB_READ_SIZE);
+
+            if (! err) {
+                err = epcb_conn_dispatch(server, conn, &consumed, trace);
+            }
+        }
+    }
+
+    if (! err && count >= 0) {
+        evtrace_stamp(trace, EVTRACE_SRV_WRITE);
+
+        // 数据持久化之后归还流窗口
+        err = epcb_stream_acks(server, conn);
+
+        if (! err && consumed) {
+            // 归还连接窗口
+            XSMuxFrame_t frame;
+            ub1 replybuf[XS_MUX_FRAME_HEAD_SIZE];
+
+            XSMuxFrameBuild(&frame, 0, XS_MUX_FRAME_WINDOW, 0, (ub4) consumed, 0, replybuf);
+
+            err = XS_client_conn_send(conn, replybuf, XS_MUX_FRAME_HEAD_SIZE);
+        }
+    }
+
+    if (err || count < 0) {
+        // 连接出错的记录不写入
+        evtrace_free(trace);
+
+        // Closing the descriptor will make epoll remove it from
+        //  the set of descriptors which are monitored
+        LOGGER_DEBUG("close socket(%d)", sfd);
+
+        epcb_conn_close(server, conn);
+        return 1;
+    }
+
+    evtrace_stamp(trace, EVTRACE_SRV_ACK);
+
+    if (trace && trace->id) {
+        evtrace_commit(trace);
+    }
+    evtrace_free(trace);
+
+    // rearm the socket: 有没有发完的应答时等待可写
+    if (XS_client_conn_txpending(conn)) {
+        err = epollout_mod(event->epollfd, sfd, event->msg, sizeof event->msg);
+    } else {
+        err = epollin_mod(event->epollfd, sfd, event->msg, sizeof event->msg);
+    }
+
+    if (err == -1) {
+        LOGGER_ERROR("sock(%d): %s", sfd, event->msg);
+
+        epcb_conn_close(server, conn);
+    }
+
+    return 1;
+}
+
+
+/**
+ * 发送缓冲中的应答发完之后重新等待读
+ */
+int epcb_event_pollout (struct epollet_event_t *event)
+{
+    int ret, sfd = event->clientfd;
+
+    XS_server server = (XS_server) event->arg;
+
+    xs_client_conn_t *conn = epcb_conn_find(server, sfd);
+
+    if (! conn) {
+        ret = epollin_mod(event->epollfd, sfd, event->msg, sizeof event->msg);
+    } else {
+        ret = XS_client_conn_flush(conn);
+
+        if (ret == 1) {
+            ret = epollin_mod(event->epollfd, sfd, event->msg, sizeof event->msg);
+        } else if (ret == 0) {
+            ret = epollout_mod(event->epollfd, sfd, event->msg, sizeof event->msg);
+        }
+
+        if (ret == -1) {
+            epcb_conn_close(server, conn);
+            return 1;
+        }
+    }
+
+    if (ret == -1) {
+        LOGGER_ERROR("sock(%d): %s", sfd, event->msg);
+        close(sfd);
+    }
+
+    return 1;
+}
@@ -0,0 +1,155 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: server_metrics.c
+ *   xsync-server 的运行统计指标
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-22
+ *
+ * @update: 2018-11-30 20:48:03
+ */
+
+#include "server_api.h"
+#include "server_conf.h"
+
+#include "server_metrics.h"
+
+
+xs_server_metrics_t xs_server_metrics = {
+    .connections_accepted = -1,
+    .bytes_received = -1,
+    .chunks_written = -1,
+    .bytes_written = -1,
+    .chunk_write_seconds = -1,
+    .chunks_deduped = -1,
+    .bytes_deduped = -1,
+    .entries_registered = -1,
+    .redis_rtt_seconds = -1,
+    .redis_errors = -1,
+    .queue_depth = -1,
+    .kafka_events = -1,
+    .kafka_skipped = -1,
+    .kafka_duplicates = -1,
+    .mirror_evicted = -1,
+    .mirror_synced = -1,
+    .mirror_files = -1,
+    .kafka_partitions = -1
+};
+
+
+static int64_t server_queue_depth (void *arg)
+{
+    XS_server server = (XS_server) arg;
+
+    int unused = threadpool_unused_queues(server->pool);
+
+    return (unused < 0? 0 : server->queues - unused);
+}
+
+
+static int64_t server_mirror_files (void *arg)
+{
+    XS_server server = (XS_server) arg;
+
+    return (server->mirror? XS_mirror_index_files(server->mirror) : 0);
+}
+
+
+static int64_t server_kafka_partitions (void *arg)
+{
+    XS_server server = (XS_server) arg;
+
+    kafkatools_consumer_stats_t stats;
+
+    if (! server->kafka_ingest) {
+        return 0;
+    }
+
+    XS_kafka_ingest_stats(server->kafka_ingest, &stats);
+
+    return stats.partitions;
+}
+
+
+void XS_server_metrics_register (struct xs_server_t *server)
+{
+    xs_server_metrics_t *m = &xs_server_metrics;
+
+    m->connections_accepted = metrics_counter_register("xsync_server_connections_accepted_total",
+        "client connections accepted");
+
+    m->bytes_received = metrics_counter_register("xsync_server_bytes_received_total",
+        "bytes read from client connections");
+
+    m->chunks_written = metrics_counter_register("xsync_server_chunks_written_total",
+        "chunks received with XSYN and written to files");
+
+    m->bytes_written = metrics_counter_register("xsync_server_bytes_written_total",
+        "bytes written to files");
+
+    m->chunks_deduped = metrics_counter_register("xsync_server_chunks_deduped_total",
+        "chunks found in chunk index and copied to files instead of transferred");
+
+    m->bytes_deduped = metrics_counter_register("xsync_server_bytes_deduped_total",
+        "bytes of chunks found in chunk index");
+
+    m->entries_registered = metrics_counter_register("xsync_server_entries_registered_total",
+        "file entries registered by XLGB");
+
+    m->redis_errors = metrics_counter_register("xsync_server_redis_errors_total",
+        "failed redis requests");
+
+    m->queue_depth = metrics_gauge_register("xsync_server_queue_depth",
+        "tasks waiting in threadpool queue", server_queue_depth, server);
+
+    m->kafka_events = metrics_counter_register("xsync_server_kafka_events_total",
+        "kafka event records applied to mirror index");
+
+    m->kafka_skipped = metrics_counter_register("xsync_server_kafka_skipped_total",
+        "kafka messages that are not event records");
+
+    m->kafka_duplicates = metrics_counter_register("xsync_server_kafka_duplicates_total",
+        "kafka event records dropped because the file already has a newer seq");
+
+    m->mirror_evicted = metrics_counter_register("xsync_server_mirror_evicted_total",
+        "files evicted from mirror index by the per-group cap");
+
+    m->mirror_synced = metrics_counter_register("xsync_server_mirror_synced_total",
+        "mirror index files marked as synced by this server");
+
+    m->mirror_files = metrics_gauge_register("xsync_server_mirror_files",
+        "files in mirror index", server_mirror_files, server);
+
+    m->kafka_partitions = metrics_gauge_register("xsync_server_kafka_partitions",
+        "kafka partitions assigned to this server", server_kafka_partitions, server);
+
+    m->chunk_write_seconds = metrics_histogram_register("xsync_server_chunk_write_seconds",
+        "time to append and fdatasync one file manifest to the chunk journal");
+
+    m->redis_rtt_seconds = metrics_histogram_register("xsync_server_redis_rtt_seconds",
+        "redis request round trip time");
+}
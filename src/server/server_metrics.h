@@ -0,0 +1,106 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: server_metrics.h
+ *   xsync-server 的运行统计指标 (see "../common/metrics.h")
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-22
+ *
+ * @update: 2018-11-30 20:48:03
+ */
+
+#ifndef SERVER_METRICS_H_INCLUDED
+#define SERVER_METRICS_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "../common/metrics.h"
+
+
+/**
+ * 指标 id. 注册之前全部为 -1 (更新为空操作)
+ */
+typedef struct xs_server_metrics_t
+{
+    /* 接受的客户端连接 */
+    int connections_accepted;
+
+    /* 从客户端读到的字节数 */
+    int bytes_received;
+
+    /* XSYN 收到并写入文件的块数; 写入文件的字节数 */
+    int chunks_written;
+    int bytes_written;
+
+    /* 一个文件清单写入块索引日志并落盘的时间 */
+    int chunk_write_seconds;
+
+    /* 块索引中已经存在 (不用传输, 从其他文件复制) 的块数和字节数 */
+    int chunks_deduped;
+    int bytes_deduped;
+
+    /* XLGB 注册成功的文件条目 */
+    int entries_registered;
+
+    /* redis 请求往返时间和失败次数 */
+    int redis_rtt_seconds;
+    int redis_errors;
+
+    /* 任务队列深度: 导出时取值 */
+    int queue_depth;
+
+    /* 从 kafka 合并到镜像索引的事件, 不能解码的消息, 重复 (seq) 的事件 */
+    int kafka_events;
+    int kafka_skipped;
+    int kafka_duplicates;
+
+    /* 镜像索引按组上限淘汰的文件, 标记为同步完成的文件 */
+    int mirror_evicted;
+    int mirror_synced;
+
+    /* 镜像索引的文件数和 kafka 分配的分区数: 导出时取值 */
+    int mirror_files;
+    int kafka_partitions;
+} xs_server_metrics_t;
+
+
+extern xs_server_metrics_t xs_server_metrics;
+
+
+/**
+ * 注册全部服务端指标. 必须在工作线程启动之前调用
+ */
+extern void XS_server_metrics_register (struct xs_server_t *server);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* SERVER_METRICS_H_INCLUDED */
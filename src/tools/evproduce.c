@@ -0,0 +1,283 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: evproduce.c
+ *   xsync-evproduce: 向 kafka 写入二进制的客户端事件记录 (evrecord),
+ *   用于测试服务端的 kafka 合并 (-k/-o) 和镜像索引
+ *
+ *   写入 --count 个文件 (file-0 ~ file-N) 的 IN_CLOSE_WRITE 事件, 序号
+ *   1 ~ N; 然后重新写入前 --dups 个记录 (序号不变), 服务端应当把它们
+ *   计为重复 (xsync_server_kafka_duplicates_total). 消息的 key 是
+ *   clientid, 同一个客户端的记录在一个分区, 按顺序到达.
+ *
+ *   $ xsync-evproduce -b localhost:9092 -t xsync-events -c test-client -n 1000 -d 100
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-30
+ *
+ * @update: 2018-11-30 20:48:03
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include <librdkafka/rdkafka.h>
+
+#include "../common/evrecord.h"
+
+
+#define EP_APPNAME           "xsync-evproduce"
+
+
+static struct
+{
+    char brokers[256];
+    char topic[256];
+    char clientid[64];
+    char pathid[64];
+    char path[256];
+
+    int count;
+    int dups;
+} ep_opts;
+
+
+static rd_kafka_t *ep_rk;
+
+/* 投递成功和失败的消息数 */
+static int ep_delivered, ep_failed;
+
+
+static uint64_t ep_now_us (void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static void ep_print_usage (void)
+{
+    printf("Usage: %s [Options]\n"
+        "  produce binary event records to kafka for xsync-server ingest tests.\n\n"
+        "  -b, --brokers=LIST       kafka bootstrap servers. 'localhost:9092' (default)\n"
+        "  -t, --topic=NAME         kafka topic (required)\n"
+        "  -c, --clientid=ID        client id of the records. 'test-client' (default)\n"
+        "  -i, --pathid=ID          watch path id of the records. 'test' (default)\n"
+        "  -p, --path=DIR           directory of the files, ends with '/'. '/tmp/xsync-test/' (default)\n"
+        "  -n, --count=N            files (records with distinct seq). 1000 (default)\n"
+        "  -d, --dups=N             records produced again with the same seq. 0 (default)\n"
+        "  -h, --help               print this help\n",
+        EP_APPNAME);
+}
+
+
+static void ep_parse_opts (int argc, char *argv[])
+{
+    int ch;
+
+    const struct option lopts[] = {
+        {"brokers", required_argument, 0, 'b'},
+        {"topic", required_argument, 0, 't'},
+        {"clientid", required_argument, 0, 'c'},
+        {"pathid", required_argument, 0, 'i'},
+        {"path", required_argument, 0, 'p'},
+        {"count", required_argument, 0, 'n'},
+        {"dups", required_argument, 0, 'd'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    strcpy(ep_opts.brokers, "localhost:9092");
+    strcpy(ep_opts.clientid, "test-client");
+    strcpy(ep_opts.pathid, "test");
+    strcpy(ep_opts.path, "/tmp/xsync-test/");
+
+    ep_opts.count = 1000;
+
+    while ((ch = getopt_long(argc, argv, "b:t:c:i:p:n:d:h", lopts, 0)) != -1) {
+        switch (ch) {
+        case 'b':
+            snprintf(ep_opts.brokers, sizeof(ep_opts.brokers), "%s", optarg);
+            break;
+        case 't':
+            snprintf(ep_opts.topic, sizeof(ep_opts.topic), "%s", optarg);
+            break;
+        case 'c':
+            snprintf(ep_opts.clientid, sizeof(ep_opts.clientid), "%s", optarg);
+            break;
+        case 'i':
+            snprintf(ep_opts.pathid, sizeof(ep_opts.pathid), "%s", optarg);
+            break;
+        case 'p':
+            snprintf(ep_opts.path, sizeof(ep_opts.path), "%s", optarg);
+            break;
+        case 'n':
+            ep_opts.count = atoi(optarg);
+            break;
+        case 'd':
+            ep_opts.dups = atoi(optarg);
+            break;
+        case 'h':
+            ep_print_usage();
+            exit(0);
+        default:
+            ep_print_usage();
+            exit(-1);
+        }
+    }
+
+    if (! ep_opts.topic[0] || ep_opts.count < 1 || ep_opts.dups < 0 || ep_opts.dups > ep_opts.count) {
+        fprintf(stderr, "invalid options: topic is required, count >= 1, 0 <= dups <= count\n");
+        exit(-1);
+    }
+}
+
+
+static void ep_delivery_cb (rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void *opaque)
+{
+    if (rkmessage->err) {
+        fprintf(stderr, "delivery fail: %s\n", rd_kafka_err2str(rkmessage->err));
+        ep_failed++;
+    } else {
+        ep_delivered++;
+    }
+}
+
+
+static int ep_produce (rd_kafka_topic_t *rkt, int i)
+{
+    int len;
+
+    evrecord_t rec;
+
+    char file[32];
+    unsigned char buf[1024];
+
+    bzero(&rec, sizeof(rec));
+
+    rec.fields = EVRECORD_F_TYPE | EVRECORD_F_TIME | EVRECORD_F_CLIENTID | EVRECORD_F_MASK |
+        EVRECORD_F_PATHID | EVRECORD_F_PATH | EVRECORD_F_FILE | EVRECORD_F_SEQ;
+
+    rec.type = 1;
+    rec.time_us = ep_now_us();
+    rec.mask = IN_CLOSE_WRITE;
+    rec.seq = (uint64_t) i + 1;
+
+    snprintf(file, sizeof(file), "file-%d", i);
+
+    evrecord_set_str(&rec.clientid, ep_opts.clientid, strlen(ep_opts.clientid));
+    evrecord_set_str(&rec.pathid, ep_opts.pathid, strlen(ep_opts.pathid));
+    evrecord_set_str(&rec.path, ep_opts.path, strlen(ep_opts.path));
+    evrecord_set_str(&rec.file, file, strlen(file));
+
+    len = evrecord_encode(&rec, buf, sizeof(buf));
+    if (len < 0) {
+        fprintf(stderr, "evrecord_encode: buffer too small\n");
+        return (-1);
+    }
+
+    while (rd_kafka_produce(rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
+            buf, (size_t) len, ep_opts.clientid, strlen(ep_opts.clientid), 0) == -1) {
+        if (rd_kafka_last_error() != RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+            fprintf(stderr, "rd_kafka_produce: %s\n", rd_kafka_err2str(rd_kafka_last_error()));
+            return (-1);
+        }
+
+        rd_kafka_poll(ep_rk, 100);
+    }
+
+    return 0;
+}
+
+
+int main (int argc, char *argv[])
+{
+    int i;
+
+    char errstr[256];
+
+    rd_kafka_conf_t *conf;
+    rd_kafka_topic_t *rkt;
+
+    ep_parse_opts(argc, argv);
+
+    conf = rd_kafka_conf_new();
+
+    if (rd_kafka_conf_set(conf, "bootstrap.servers", ep_opts.brokers, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+        fprintf(stderr, "rd_kafka_conf_set: %s\n", errstr);
+        exit(-1);
+    }
+
+    rd_kafka_conf_set_dr_msg_cb(conf, ep_delivery_cb);
+
+    ep_rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
+    if (! ep_rk) {
+        fprintf(stderr, "rd_kafka_new: %s\n", errstr);
+        exit(-1);
+    }
+
+    rkt = rd_kafka_topic_new(ep_rk, ep_opts.topic, 0);
+    if (! rkt) {
+        fprintf(stderr, "rd_kafka_topic_new: %s\n", rd_kafka_err2str(rd_kafka_last_error()));
+        rd_kafka_destroy(ep_rk);
+        exit(-1);
+    }
+
+    for (i = 0; i < ep_opts.count; i++) {
+        if (ep_produce(rkt, i) != 0) {
+            break;
+        }
+
+        rd_kafka_poll(ep_rk, 0);
+    }
+
+    // 重复的记录: 序号不变
+    for (i = 0; i < ep_opts.dups && ep_failed == 0; i++) {
+        if (ep_produce(rkt, i) != 0) {
+            break;
+        }
+
+        rd_kafka_poll(ep_rk, 0);
+    }
+
+    rd_kafka_flush(ep_rk, 30000);
+
+    rd_kafka_topic_destroy(rkt);
+    rd_kafka_destroy(ep_rk);
+
+    printf("%s: topic=%s clientid=%s records=%d dups=%d delivered=%d failed=%d\n", EP_APPNAME,
+        ep_opts.topic, ep_opts.clientid, ep_opts.count, ep_opts.dups, ep_delivered, ep_failed);
+
+    return ((ep_failed || ep_delivered != ep_opts.count + ep_opts.dups)? 1 : 0);
+}
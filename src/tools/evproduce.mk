@@ -0,0 +1,39 @@
+#######################################################################
+# @file: evproduce.mk
+#   xsync-evproduce: produce binary event records to kafka (ingest tests)
+#
+# @version: 0.4.4
+# @create: 2018-11-30 20:48:03
+# @update: 2018-11-30 20:48:03
+#######################################################################
+prefix = .
+
+APPNAME := xsync-evproduce
+VERSION := 0.4.4
+
+TARGET := ${APPNAME}-${VERSION}
+
+
+LIB_PREFIX := ${TARGET_DIR}/../libs/lib
+
+TGT_LDFLAGS := \
+	-L${TARGET_DIR}/../libs/lib
+
+TGT_LDLIBS  := \
+	-lrdkafka \
+	${LIB_PREFIX}/libz.a \
+	-lrt \
+	-lpthread
+
+
+SOURCES := \
+	evproduce.c
+
+
+SRC_DEFS := NDEBUG
+
+
+SRC_INCDIRS := \
+    . \
+	.. \
+	../common
@@ -0,0 +1,263 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: evtrace_stat.c
+ *   xsync-evtrace: 读取 --trace 写出的 ring 文件, 打印每个阶段的延迟百分位
+ *
+ *   $ xsync-evtrace /tmp/xsync-client.trace
+ *   $ xsync-evtrace -r /tmp/xsync-server.trace | head
+ *
+ *   每一行是一个阶段相对于同一记录中上一个已记录阶段的耗时,
+ *   total 是第一个阶段到最后一个阶段的耗时. 单位: 微秒.
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-23
+ *
+ * @update: 2018-11-23 16:20:08
+ */
+
+#include "../common/evtrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+
+typedef struct evtrace_samples_t
+{
+    uint64_t *values;
+    size_t count;
+    size_t capacity;
+} evtrace_samples_t;
+
+
+/* 每个阶段一组 + total */
+static evtrace_samples_t samples[EVTRACE_STAGES + 1];
+
+
+static void samples_add (evtrace_samples_t *smp, uint64_t value)
+{
+    if (smp->count == smp->capacity) {
+        smp->capacity = smp->capacity? smp->capacity * 2 : 1024;
+        smp->values = (uint64_t *) realloc(smp->values, smp->capacity * sizeof(uint64_t));
+        if (! smp->values) {
+            fprintf(stderr, "out of memory\n");
+            exit(-1);
+        }
+    }
+
+    smp->values[smp->count++] = value;
+}
+
+
+static int cmp_uint64 (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+static double percentile_us (const evtrace_samples_t *smp, double pct)
+{
+    size_t i = (size_t) (pct * (smp->count - 1) + 0.5);
+
+    return smp->values[i] / 1000.0;
+}
+
+
+static void record_add (const evtrace_rec_t *rec, void *arg)
+{
+    int s, prev = -1;
+    int raw = *(int *) arg;
+
+    if (raw) {
+        printf("%ju %u", (uintmax_t) rec->id, rec->pid);
+    }
+
+    for (s = 0; s < EVTRACE_STAGES; s++) {
+        if (! (rec->stages & (1U << s))) {
+            continue;
+        }
+
+        if (prev != -1) {
+            uint64_t delta = rec->ts[s] > rec->ts[prev]? rec->ts[s] - rec->ts[prev] : 0;
+
+            samples_add(&samples[s], delta);
+
+            if (raw) {
+                printf(" %s=%.1f", evtrace_stage_names[s], delta / 1000.0);
+            }
+        }
+
+        prev = s;
+    }
+
+    for (s = 0; s < EVTRACE_STAGES; s++) {
+        if (rec->stages & (1U << s)) {
+            break;
+        }
+    }
+
+    if (prev > s) {
+        samples_add(&samples[EVTRACE_STAGES], rec->ts[prev] - rec->ts[s]);
+
+        if (raw) {
+            printf(" total=%.1f", (rec->ts[prev] - rec->ts[s]) / 1000.0);
+        }
+    }
+
+    if (raw) {
+        printf("\n");
+    }
+}
+
+
+static int load_ring (const char *ringfile, int raw)
+{
+    int fd;
+    struct stat st;
+    void *addr;
+
+    uint64_t n;
+
+    const evtrace_hdr_t *hdr;
+
+    fd = open(ringfile, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "%s: %s\n", ringfile, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    if ((size_t) st.st_size < sizeof(evtrace_hdr_t)) {
+        fprintf(stderr, "%s: not a trace file\n", ringfile);
+        close(fd);
+        return -1;
+    }
+
+    addr = mmap(0, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap: %s\n", ringfile, strerror(errno));
+        return -1;
+    }
+
+    hdr = (const evtrace_hdr_t *) addr;
+
+    if (memcmp(hdr->magic, EVTRACE_MAGIC, 8) || hdr->version != EVTRACE_VERSION ||
+        hdr->recsize != sizeof(evtrace_rec_t) ||
+        (size_t) st.st_size != sizeof(evtrace_hdr_t) + hdr->capacity * sizeof(evtrace_rec_t)) {
+        fprintf(stderr, "%s: bad trace file header\n", ringfile);
+        munmap(addr, (size_t) st.st_size);
+        return -1;
+    }
+
+    n = evtrace_ring_foreach(hdr, record_add, &raw);
+
+    fprintf(stderr, "%s: %ju records (written=%ju, capacity=%ju)\n",
+        ringfile, (uintmax_t) n, (uintmax_t) hdr->head, (uintmax_t) hdr->capacity);
+
+    munmap(addr, (size_t) st.st_size);
+    return 0;
+}
+
+
+static void print_stat (const char *name, evtrace_samples_t *smp)
+{
+    if (! smp->count) {
+        return;
+    }
+
+    qsort(smp->values, smp->count, sizeof(uint64_t), cmp_uint64);
+
+    printf("%-10s %10zu %10.1f %10.1f %10.1f %10.1f %12.1f\n", name, smp->count,
+        percentile_us(smp, 0.50),
+        percentile_us(smp, 0.90),
+        percentile_us(smp, 0.99),
+        percentile_us(smp, 0.999),
+        smp->values[smp->count - 1] / 1000.0);
+}
+
+
+static void print_usage (const char *app)
+{
+    printf("Usage: %s [-r] TRACEFILE...\n"
+        "  print per-stage latency percentiles (microseconds) of ring files written by --trace.\n"
+        "  -r  also dump every record: id pid stage=usec ...\n", app);
+}
+
+
+int main (int argc, char *argv[])
+{
+    int i, s, raw = 0, files = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (! strcmp(argv[i], "-r")) {
+            raw = 1;
+        } else if (! strcmp(argv[i], "-h") || ! strcmp(argv[i], "--help")) {
+            print_usage(argv[0]);
+            return 0;
+        }
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            if (load_ring(argv[i], raw) == 0) {
+                files++;
+            }
+        }
+    }
+
+    if (! files) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    printf("%-10s %10s %10s %10s %10s %10s %12s\n", "stage", "count", "p50", "p90", "p99", "p99.9", "max");
+
+    for (s = 0; s < EVTRACE_STAGES; s++) {
+        print_stat(evtrace_stage_names[s], &samples[s]);
+    }
+
+    print_stat("total", &samples[EVTRACE_STAGES]);
+
+    for (s = 0; s <= EVTRACE_STAGES; s++) {
+        free(samples[s].values);
+    }
+
+    return 0;
+}
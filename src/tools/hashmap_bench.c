@@ -0,0 +1,243 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: hashmap_bench.c
+ *   xsync-hashmap-bench: common/hashmap 的 put/get/miss/remove 耗时
+ *
+ *   键是长短混合的路径 (客户端的 "pathid/file" 和服务端的全路径),
+ *   每个 hashmap_create_ex 的哈希函数各测一遍. 结果按操作输出秒数:
+ *
+ *     keys      hash      put       get x5    miss      remove
+ *     200000    murmur    0.022s    0.041s    0.006s    0.008s
+ *
+ *   与旧实现 (crc32 + 链表) 比较时, 用旧的 hashmap.c 编译同一个程序:
+ *
+ *   $ git show 1cf618e^:src/common/hashmap.c > /tmp/hashmap_old.c
+ *   $ gcc -O2 -I common tools/hashmap_bench.c /tmp/hashmap_old.c -DHMAP_BENCH_NOEX -o /tmp/bench-old
+ *
+ *   $ xsync-hashmap-bench -n 200000 -n 1000000
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-30
+ *
+ * @update: 2018-11-30 20:48:03
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "../common/hashmap.h"
+
+
+#define HB_APPNAME           "xsync-hashmap-bench"
+
+/* 最多测试几种键数 */
+#define HB_SIZES_MAX         8
+
+/* get 的轮数 */
+#define HB_GET_ROUNDS        5
+
+
+static const char *hb_dirs[] = {
+    "log",
+    "var/log/nginx",
+    "data/app/2018/11/30/shard-07",
+    "home/xsync/watch/very/deep/directory/tree/for/long/keys"
+};
+
+
+static double hb_now (void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* 长短混合的键: 短键放在槽内, 长键按引用保存 */
+static char ** hb_make_keys (int count, const char *prefix)
+{
+    int i;
+
+    char **keys = (char **) calloc(count, sizeof(char *));
+
+    for (i = 0; i < count; i++) {
+        char buf[256];
+
+        if (i % 2) {
+            snprintf(buf, sizeof(buf), "%s%x", prefix, i);
+        } else {
+            snprintf(buf, sizeof(buf), "/%s/%s/file-%08d.dat", prefix,
+                hb_dirs[i % (sizeof(hb_dirs) / sizeof(hb_dirs[0]))], i);
+        }
+
+        keys[i] = strdup(buf);
+    }
+
+    return keys;
+}
+
+
+static void hb_free_keys (char **keys, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        free(keys[i]);
+    }
+
+    free(keys);
+}
+
+
+static void hb_run (int count, int hashfunc, const char *hashname)
+{
+    int i, r, hits = 0;
+
+    double t0, tput, tget, tmiss, tremove;
+
+    void_ptr value;
+    hmap_t map;
+
+    char **keys = hb_make_keys(count, "k");
+    char **misses = hb_make_keys(count, "m");
+
+#ifdef HMAP_BENCH_NOEX
+    map = hashmap_create();
+    (void) hashfunc;
+#else
+    map = hashmap_create_ex(hashfunc, 0);
+#endif
+
+    t0 = hb_now();
+    for (i = 0; i < count; i++) {
+        if (hashmap_put(map, keys[i], (void_ptr) keys[i]) != HMAP_S_OK) {
+            fprintf(stderr, "hashmap_put fail: %s\n", keys[i]);
+            exit(-1);
+        }
+    }
+    tput = hb_now() - t0;
+
+    t0 = hb_now();
+    for (r = 0; r < HB_GET_ROUNDS; r++) {
+        for (i = 0; i < count; i++) {
+            if (hashmap_get(map, keys[i], &value) == HMAP_S_OK && value == (void_ptr) keys[i]) {
+                hits++;
+            }
+        }
+    }
+    tget = hb_now() - t0;
+
+    t0 = hb_now();
+    for (i = 0; i < count; i++) {
+        if (hashmap_get(map, misses[i], &value) == HMAP_S_OK) {
+            hits = -1;
+        }
+    }
+    tmiss = hb_now() - t0;
+
+    t0 = hb_now();
+    for (i = 0; i < count; i++) {
+        hashmap_remove(map, keys[i], &value);
+    }
+    tremove = hb_now() - t0;
+
+    if (hits != count * HB_GET_ROUNDS || hashmap_size(map) != 0) {
+        fprintf(stderr, "hashmap verify fail: hits=%d size=%d\n", hits, hashmap_size(map));
+        exit(-1);
+    }
+
+    printf("%-9d %-9s %.3fs    %.3fs    %.3fs    %.3fs\n", count, hashname, tput, tget, tmiss, tremove);
+
+    hashmap_destroy(map, 0, 0);
+
+    hb_free_keys(keys, count);
+    hb_free_keys(misses, count);
+}
+
+
+static void hb_print_usage (void)
+{
+    printf("Usage: %s [Options]\n"
+        "  time common/hashmap put/get/miss/remove with mixed short and long path keys.\n\n"
+        "  -n, --keys=N             number of keys, can be given up to %d times. 200000 and 1000000 (default)\n"
+        "  -h, --help               print this help\n",
+        HB_APPNAME, HB_SIZES_MAX);
+}
+
+
+int main (int argc, char *argv[])
+{
+    int ch, i, nsizes = 0;
+
+    int sizes[HB_SIZES_MAX];
+
+    const struct option lopts[] = {
+        {"keys", required_argument, 0, 'n'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while ((ch = getopt_long(argc, argv, "n:h", lopts, 0)) != -1) {
+        switch (ch) {
+        case 'n':
+            if (nsizes < HB_SIZES_MAX && atoi(optarg) > 0) {
+                sizes[nsizes++] = atoi(optarg);
+            }
+            break;
+        case 'h':
+            hb_print_usage();
+            exit(0);
+        default:
+            hb_print_usage();
+            exit(-1);
+        }
+    }
+
+    if (! nsizes) {
+        sizes[nsizes++] = 200000;
+        sizes[nsizes++] = 1000000;
+    }
+
+    printf("keys      hash      put       get x%d    miss      remove\n", HB_GET_ROUNDS);
+
+    for (i = 0; i < nsizes; i++) {
+#ifdef HMAP_BENCH_NOEX
+        hb_run(sizes[i], 0, "old");
+#else
+        hb_run(sizes[i], HMAP_HASH_MURMUR64A, "murmur");
+        hb_run(sizes[i], HMAP_HASH_FNV1A, "fnv1a");
+        hb_run(sizes[i], HMAP_HASH_CRC32, "crc32");
+#endif
+    }
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#######################################################################
+# @file: hashmap_bench.mk
+#   xsync-hashmap-bench: common/hashmap put/get/miss/remove timings
+#
+# @version: 0.4.4
+# @create: 2018-11-30 20:48:03
+# @update: 2018-11-30 20:48:03
+#######################################################################
+prefix = .
+
+APPNAME := xsync-hashmap-bench
+VERSION := 0.4.4
+
+TARGET := ${APPNAME}-${VERSION}
+
+
+LIB_PREFIX := ${TARGET_DIR}/../libs/lib
+
+TGT_LDLIBS  := \
+	${LIB_PREFIX}/libcommon.a \
+	-lrt \
+	-lpthread
+
+
+SOURCES := \
+	hashmap_bench.c
+
+
+SRC_DEFS := NDEBUG
+
+
+SRC_INCDIRS := \
+    . \
+	.. \
+	../common
@@ -0,0 +1,1044 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: loadgen.c
+ *   xsync-loadgen: xsync-server 负载生成和吞吐量测试
+ *
+ *   模拟大量并发客户端: 每个连接完成 XCON 握手之后, 以 XMUX DATA 帧
+ *   (负载为 XSYN 包头 + 文件数据) 连续发送文件, 服务端的 WINDOW 帧
+ *   作为确认. 每个连接在途的字节不超过 --window, 可以按 --rate 限速.
+ *   被服务端关闭的连接 100 毫秒后重连.
+ *
+ *   结束时输出:
+ *     - 接受的连接数和每秒接受的连接数, 握手延迟
+ *     - 每秒确认的帧数和 MB/s (文件数据字节)
+ *     - 帧确认延迟 p50/p90/p99/p99.9 (发送到收到 WINDOW)
+ *     - 服务端进程的 CPU (读 /proc/PID/stat)
+ *
+ *   $ xsync-loadgen -s 127.0.0.1 -p 8960 -c 2000 -t 4 -r 1048576 -d 30
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-24
+ *
+ * @update: 2018-11-24 10:12:36
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../xsync-error.h"
+#include "../xsync-config.h"
+#include "../xsync-protocol.h"
+
+#include "../common/metrics.h"
+
+
+#define LG_APPNAME           "xsync-loadgen"
+
+#define LG_CLOSED            0
+#define LG_CONNECTING        1
+#define LG_HANDSHAKE         2
+#define LG_READY             3
+
+/* 连接被关闭之后重连的间隔 */
+#define LG_RECONNECT_US      100000
+
+/* 工作线程的轮询间隔: 限速和重连的精度 */
+#define LG_TICK_MS           5
+
+#define LG_EVENTS_MAX        256
+
+
+typedef struct lg_opts_t
+{
+    char host[XSYNC_HOSTNAME_MAXLEN + 1];
+    char port[XSYNC_PORTNUMB_MAXLEN + 1];
+
+    ub4 magic;
+
+    int connections;
+    int threads;
+
+    /* 每秒新建的连接数. 0: 同时建立 */
+    int ramp;
+
+    /* 每个连接每秒发送的文件字节. 0: 不限 */
+    ub8 rate;
+
+    ub8 filesize;
+    ub4 chunk;
+
+    /* 每个连接在途 (未确认) 的最大字节 */
+    ub4 window;
+
+    int seconds;
+
+    pid_t serverpid;
+
+    char metrics[128];
+} lg_opts_t;
+
+
+typedef struct lg_conn_t
+{
+    int fd;
+    int id;
+    int state;
+    int pollout;
+
+    int epfd;
+
+    ub8 t_start;
+    ub8 retry_at;
+
+    ub4 replymagic;
+    ub8 session;
+
+    /* 当前发送的文件 (流) 和偏移 */
+    ub8 entryid;
+    ub8 offset;
+
+    /* 当前发送的消息: 头部 (XCON 请求或者 XMUX + XSYN 头) 加 txdata 字节的负载 */
+    ub1 ctl[XS_CONNECT_REQ_SIZE + XS_MUX_FRAME_HEAD_SIZE + XS_SYNC_REQ_SIZE];
+    int txhead;
+    int txlen;
+    int txoff;
+
+    ub1 rxbuf[XS_CONNECT_ACCEPT_REPLY_SIZE];
+    int rxlen;
+    ub4 rxskip;
+
+    /* 在途的帧的发送时间 (FIFO) 和字节 */
+    ub8 *sent;
+    int qhead;
+    int qcount;
+    int qcap;
+
+    ub4 inflight;
+
+    /* 令牌桶 (字节) */
+    double tokens;
+    ub8 t_fill;
+} lg_conn_t;
+
+
+typedef struct lg_thread_t
+{
+    pthread_t thread;
+
+    int epfd;
+
+    int nconns;
+    lg_conn_t *conns;
+} lg_thread_t;
+
+
+static lg_opts_t lg_opts;
+
+static volatile int lg_running = 1;
+
+static volatile ub8 lg_entryid = 0;
+
+static volatile ub8 lg_last_accept_us = 0;
+
+static ub8 lg_begin_us = 0;
+
+/* 所有连接共享的文件数据 */
+static ub1 lg_payload[XSYNC_MUX_FRAME_MAXSIZE];
+
+
+static struct lg_metrics_t
+{
+    int conn_accepted;
+    int conn_rejected;
+    int conn_failed;
+    int conn_closed;
+    int frames_acked;
+    int bytes_acked;
+    int files_done;
+    int connect_seconds;
+    int ack_seconds;
+} lg_ids;
+
+
+static ub8 lg_now_us (void)
+{
+    return (ub8) metrics_now_us();
+}
+
+
+static void lg_register_metrics (void)
+{
+    lg_ids.conn_accepted = metrics_counter_register("xsync_loadgen_connections_accepted_total", "Connections accepted by server (XCON).");
+    lg_ids.conn_rejected = metrics_counter_register("xsync_loadgen_connections_rejected_total", "Connections rejected by server (XCON).");
+    lg_ids.conn_failed = metrics_counter_register("xsync_loadgen_connections_failed_total", "Connections failed before handshake.");
+    lg_ids.conn_closed = metrics_counter_register("xsync_loadgen_connections_closed_total", "Ready connections closed by server or error.");
+    lg_ids.frames_acked = metrics_counter_register("xsync_loadgen_frames_acked_total", "XMUX DATA frames acknowledged by WINDOW.");
+    lg_ids.bytes_acked = metrics_counter_register("xsync_loadgen_bytes_acked_total", "File data bytes acknowledged by server.");
+    lg_ids.files_done = metrics_counter_register("xsync_loadgen_files_total", "Files completely sent.");
+    lg_ids.connect_seconds = metrics_histogram_register("xsync_loadgen_connect_seconds", "Time from connect() to XCON accept reply.");
+    lg_ids.ack_seconds = metrics_histogram_register("xsync_loadgen_ack_seconds", "Time from sending a DATA frame to its WINDOW.");
+}
+
+
+static void lg_conn_set_pollout (lg_conn_t *conn, int pollout)
+{
+    struct epoll_event ev;
+
+    if (conn->pollout != pollout) {
+        ev.events = EPOLLIN | (pollout? EPOLLOUT : 0);
+        ev.data.ptr = conn;
+
+        if (epoll_ctl(conn->epfd, EPOLL_CTL_MOD, conn->fd, &ev) == 0) {
+            conn->pollout = pollout;
+        }
+    }
+}
+
+
+static void lg_conn_close (lg_conn_t *conn, ub8 now)
+{
+    if (conn->fd != -1) {
+        epoll_ctl(conn->epfd, EPOLL_CTL_DEL, conn->fd, 0);
+        close(conn->fd);
+        conn->fd = -1;
+    }
+
+    if (conn->state == LG_READY) {
+        metrics_counter_inc(lg_ids.conn_closed);
+    } else if (conn->state != LG_CLOSED) {
+        metrics_counter_inc(lg_ids.conn_failed);
+    }
+
+    conn->state = LG_CLOSED;
+    conn->pollout = 0;
+
+    conn->txhead = conn->txlen = conn->txoff = 0;
+    conn->rxlen = 0;
+    conn->rxskip = 0;
+
+    conn->qhead = conn->qcount = 0;
+    conn->inflight = 0;
+
+    // 未发完的文件丢弃, 重连之后发送新文件
+    conn->entryid = 0;
+    conn->offset = 0;
+
+    conn->retry_at = now + LG_RECONNECT_US;
+}
+
+
+static void lg_conn_open (lg_conn_t *conn, ub8 now)
+{
+    int fd, err, on = 1;
+
+    struct addrinfo hints, *res = 0;
+    struct epoll_event ev;
+
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    conn->t_start = now;
+    conn->state = LG_CONNECTING;
+
+    err = getaddrinfo(lg_opts.host, lg_opts.port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "getaddrinfo(%s:%s): %s\n", lg_opts.host, lg_opts.port, gai_strerror(err));
+        lg_conn_close(conn, now);
+        return;
+    }
+
+    fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        freeaddrinfo(res);
+        lg_conn_close(conn, now);
+        return;
+    }
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    conn->fd = fd;
+
+    if (connect(fd, res->ai_addr, res->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        freeaddrinfo(res);
+        lg_conn_close(conn, now);
+        return;
+    }
+
+    freeaddrinfo(res);
+
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = conn;
+
+    if (epoll_ctl(conn->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        lg_conn_close(conn, now);
+        return;
+    }
+
+    conn->pollout = 1;
+}
+
+
+/**
+ * 连接完成: 准备 XCON 请求
+ */
+static void lg_conn_handshake (lg_conn_t *conn, ub8 now)
+{
+    int err = 0;
+    socklen_t len = (socklen_t) sizeof(err);
+
+    ub4 randnum;
+
+    char clientid[XSYNC_CLIENTID_MAXLEN + 1];
+    char password[XSYNC_PASSWORD_MAXLEN + 1];
+
+    XSConnectReq_t req;
+
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err) {
+        lg_conn_close(conn, now);
+        return;
+    }
+
+    snprintf(clientid, sizeof(clientid), "%s-%d", LG_APPNAME, conn->id);
+    snprintf(password, sizeof(password), "loadgen");
+
+    randnum = (ub4) rand();
+
+    conn->replymagic = lg_opts.magic ^ randnum;
+
+    XSConnectRequestBuild(&req, clientid, password, lg_opts.magic, (ub8) time(0), randnum, XS_CAPFLAG_MUX, conn->ctl);
+
+    conn->txhead = XS_CONNECT_REQ_SIZE;
+    conn->txlen = XS_CONNECT_REQ_SIZE;
+    conn->txoff = 0;
+
+    conn->state = LG_HANDSHAKE;
+}
+
+
+/**
+ * 准备下一个 DATA 帧. 窗口或者令牌不够时返回 0
+ */
+static int lg_conn_next_frame (lg_conn_t *conn, ub8 now)
+{
+    ub4 datalen;
+    ub1 flags = 0;
+
+    XSMuxFrame_t frame;
+    XSSyncFileReq_t req;
+
+    if (! conn->entryid) {
+        conn->entryid = __sync_add_and_fetch(&lg_entryid, 1);
+        conn->offset = 0;
+    }
+
+    datalen = lg_opts.chunk;
+    if (conn->offset + datalen >= lg_opts.filesize) {
+        datalen = (ub4) (lg_opts.filesize - conn->offset);
+        flags = XS_MUX_FLAG_END;
+    }
+
+    if (conn->inflight + XS_SYNC_REQ_SIZE + datalen > lg_opts.window || conn->qcount == conn->qcap) {
+        return 0;
+    }
+
+    if (lg_opts.rate) {
+        conn->tokens += (double) (now - conn->t_fill) * lg_opts.rate / 1000000.0;
+        conn->t_fill = now;
+
+        if (conn->tokens > lg_opts.chunk) {
+            conn->tokens = lg_opts.chunk;
+        }
+
+        if (conn->tokens < datalen) {
+            return 0;
+        }
+
+        conn->tokens -= datalen;
+    }
+
+    XSMuxFrameBuild(&frame, conn->entryid, XS_MUX_FRAME_DATA, flags, 0, XS_SYNC_REQ_SIZE + datalen, conn->ctl);
+    XSSyncFileReqBuild(&req, conn->session, conn->entryid, conn->offset, datalen, XS_CODEC_NONE, datalen,
+        conn->ctl + XS_MUX_FRAME_HEAD_SIZE);
+
+    conn->txhead = XS_MUX_FRAME_HEAD_SIZE + XS_SYNC_REQ_SIZE;
+    conn->txlen = conn->txhead + (int) datalen;
+    conn->txoff = 0;
+
+    conn->sent[(conn->qhead + conn->qcount) % conn->qcap] = now;
+    conn->qcount++;
+
+    conn->inflight += XS_SYNC_REQ_SIZE + datalen;
+
+    conn->offset += datalen;
+
+    if (flags & XS_MUX_FLAG_END) {
+        metrics_counter_inc(lg_ids.files_done);
+        conn->entryid = 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * 发送当前消息, 然后在窗口和令牌允许时继续发送
+ */
+static void lg_conn_pump (lg_conn_t *conn, ub8 now)
+{
+    for (;;) {
+        ssize_t rc;
+
+        struct iovec iov[2];
+        struct msghdr msg;
+        int niov = 0;
+
+        if (conn->txoff == conn->txlen) {
+            conn->txhead = conn->txlen = conn->txoff = 0;
+
+            if (conn->state != LG_READY || ! lg_conn_next_frame(conn, now)) {
+                lg_conn_set_pollout(conn, 0);
+                return;
+            }
+        }
+
+        if (conn->txoff < conn->txhead) {
+            iov[niov].iov_base = conn->ctl + conn->txoff;
+            iov[niov].iov_len = conn->txhead - conn->txoff;
+            niov++;
+        }
+
+        if (conn->txlen > conn->txhead) {
+            int off = (conn->txoff > conn->txhead? conn->txoff - conn->txhead : 0);
+
+            iov[niov].iov_base = lg_payload + off;
+            iov[niov].iov_len = conn->txlen - conn->txhead - off;
+            niov++;
+        }
+
+        bzero(&msg, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = niov;
+
+        rc = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+
+        if (rc > 0) {
+            conn->txoff += (int) rc;
+        } else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            lg_conn_set_pollout(conn, 1);
+            return;
+        } else if (rc < 0 && errno == EINTR) {
+            continue;
+        } else {
+            lg_conn_close(conn, now);
+            return;
+        }
+    }
+}
+
+
+static void lg_conn_on_window (lg_conn_t *conn, const XSMuxFrame_t *frame, ub8 now)
+{
+    if (! frame->streamid) {
+        // 连接窗口
+        return;
+    }
+
+    if (conn->qcount) {
+        metrics_histogram_observe(lg_ids.ack_seconds, now - conn->sent[conn->qhead]);
+
+        conn->qhead = (conn->qhead + 1) % conn->qcap;
+        conn->qcount--;
+    }
+
+    conn->inflight = (conn->inflight > frame->window? conn->inflight - frame->window : 0);
+
+    metrics_counter_inc(lg_ids.frames_acked);
+
+    if (frame->window > XS_SYNC_REQ_SIZE) {
+        metrics_counter_add(lg_ids.bytes_acked, frame->window - XS_SYNC_REQ_SIZE);
+    }
+}
+
+
+static void lg_conn_recv (lg_conn_t *conn, ub8 now)
+{
+    ssize_t rc;
+
+    ub1 skipbuf[4096];
+
+    XSMuxFrame_t frame;
+    XSConnectReply_t reply;
+
+    for (;;) {
+        if (conn->rxskip) {
+            rc = recv(conn->fd, skipbuf, conn->rxskip < sizeof(skipbuf)? conn->rxskip : sizeof(skipbuf), 0);
+
+            if (rc > 0) {
+                conn->rxskip -= (ub4) rc;
+                continue;
+            }
+        } else {
+            int need = XS_MUX_FRAME_HEAD_SIZE;
+
+            if (conn->state == LG_HANDSHAKE) {
+                need = XS_CONNECT_REJECT_REPLY_SIZE;
+
+                if (conn->rxlen >= XS_CONNECT_REJECT_REPLY_SIZE && ! memcmp(conn->rxbuf, XS_MSGID_XCON.c, 4)) {
+                    need = XS_CONNECT_ACCEPT_REPLY_SIZE;
+                }
+            }
+
+            rc = recv(conn->fd, conn->rxbuf + conn->rxlen, need - conn->rxlen, 0);
+
+            if (rc > 0) {
+                conn->rxlen += (int) rc;
+
+                if (conn->rxlen < need) {
+                    continue;
+                }
+
+                if (conn->state == LG_HANDSHAKE) {
+                    if (need == XS_CONNECT_REJECT_REPLY_SIZE) {
+                        if (! memcmp(conn->rxbuf, XS_MSGID_XCON.c, 4)) {
+                            continue;
+                        }
+
+                        metrics_counter_inc(lg_ids.conn_rejected);
+
+                        conn->state = LG_CLOSED;
+                        lg_conn_close(conn, now);
+                        return;
+                    }
+
+                    conn->rxlen = 0;
+
+                    if (! XSConnectReplyAcceptParse(conn->rxbuf, &reply) || reply.magic != conn->replymagic) {
+                        metrics_counter_inc(lg_ids.conn_rejected);
+
+                        conn->state = LG_CLOSED;
+                        lg_conn_close(conn, now);
+                        return;
+                    }
+
+                    conn->session = reply.session;
+                    conn->state = LG_READY;
+                    conn->t_fill = now;
+                    conn->tokens = 0;
+
+                    metrics_counter_inc(lg_ids.conn_accepted);
+                    metrics_histogram_observe(lg_ids.connect_seconds, now - conn->t_start);
+
+                    lg_last_accept_us = now;
+
+                    lg_conn_pump(conn, now);
+
+                    if (conn->state != LG_READY) {
+                        return;
+                    }
+
+                    continue;
+                }
+
+                conn->rxlen = 0;
+
+                if (! XSMuxFrameParse(conn->rxbuf, &frame)) {
+                    lg_conn_close(conn, now);
+                    return;
+                }
+
+                conn->rxskip = frame.datalen;
+
+                if (frame.type == XS_MUX_FRAME_WINDOW) {
+                    lg_conn_on_window(conn, &frame, now);
+                }
+
+                continue;
+            }
+        }
+
+        if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            lg_conn_close(conn, now);
+            return;
+        }
+
+        if (errno != EINTR) {
+            return;
+        }
+    }
+}
+
+
+static void * lg_thread_run (void *arg)
+{
+    int i, n;
+
+    lg_thread_t *thr = (lg_thread_t *) arg;
+
+    struct epoll_event events[LG_EVENTS_MAX];
+
+    while (lg_running) {
+        ub8 now = lg_now_us();
+
+        for (i = 0; i < thr->nconns; i++) {
+            lg_conn_t *conn = &thr->conns[i];
+
+            if (conn->state == LG_CLOSED) {
+                if (now >= conn->retry_at) {
+                    lg_conn_open(conn, now);
+                }
+            } else if (conn->state == LG_READY && ! conn->pollout) {
+                lg_conn_pump(conn, now);
+            }
+        }
+
+        n = epoll_wait(thr->epfd, events, LG_EVENTS_MAX, LG_TICK_MS);
+
+        now = lg_now_us();
+
+        for (i = 0; i < n; i++) {
+            lg_conn_t *conn = (lg_conn_t *) events[i].data.ptr;
+
+            if (conn->state == LG_CONNECTING) {
+                if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                    lg_conn_handshake(conn, now);
+                }
+            }
+
+            if (conn->state != LG_CLOSED && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                lg_conn_recv(conn, now);
+            }
+
+            if (conn->state == LG_HANDSHAKE || (conn->state == LG_READY && (events[i].events & EPOLLOUT))) {
+                lg_conn_pump(conn, now);
+            }
+        }
+    }
+
+    for (i = 0; i < thr->nconns; i++) {
+        lg_conn_t *conn = &thr->conns[i];
+
+        if (conn->fd != -1) {
+            close(conn->fd);
+            conn->fd = -1;
+        }
+
+        free(conn->sent);
+    }
+
+    return 0;
+}
+
+
+/**
+ * 进程的 CPU 时间 (秒): /proc/PID/stat 的 utime + stime
+ */
+static double lg_proc_cputime (pid_t pid)
+{
+    FILE *fp;
+    char path[64], buf[1024];
+    char *p;
+
+    unsigned long utime = 0, stime = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+
+    fp = fopen(path, "r");
+    if (! fp) {
+        return -1;
+    }
+
+    p = fgets(buf, sizeof(buf), fp);
+    fclose(fp);
+
+    // 跳过 "pid (comm)"
+    if (! p || ! (p = strrchr(buf, ')'))) {
+        return -1;
+    }
+
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+
+/**
+ * 查找名为 xsync-server* 的进程
+ */
+static pid_t lg_find_server (void)
+{
+    DIR *dir;
+    struct dirent *ent;
+
+    pid_t pid = 0;
+
+    dir = opendir("/proc");
+    if (! dir) {
+        return 0;
+    }
+
+    while (! pid && (ent = readdir(dir)) != 0) {
+        FILE *fp;
+        char path[300], comm[64];
+
+        if (ent->d_name[0] < '1' || ent->d_name[0] > '9') {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/proc/%s/comm", ent->d_name);
+
+        fp = fopen(path, "r");
+        if (fp) {
+            if (fgets(comm, sizeof(comm), fp) && ! strncmp(comm, XSYNC_SERVER_APPNAME, strlen(XSYNC_SERVER_APPNAME))) {
+                pid = (pid_t) atoi(ent->d_name);
+            }
+            fclose(fp);
+        }
+    }
+
+    closedir(dir);
+
+    return pid;
+}
+
+
+static void lg_on_signal (int signo)
+{
+    lg_running = 0;
+}
+
+
+static void lg_print_usage (void)
+{
+    printf("Usage: %s [Options]\n"
+        "  simulate concurrent clients streaming files to xsync-server over XCON/XMUX/XSYN.\n\n"
+        "  -s, --host=HOST          server host. '127.0.0.1' (default)\n"
+        "  -p, --port=PORT          server port. '8960' (default)\n"
+        "  -n, --magic=NUMBER       server magic. '%s' (default)\n"
+        "  -c, --connections=N      concurrent clients. 100 (default)\n"
+        "  -t, --threads=N          worker threads. 4 (default)\n"
+        "  -R, --ramp=N             new connections per second, 0 for all at once. 0 (default)\n"
+        "  -r, --rate=BYTES         file bytes per second per connection, 0 for unlimited. 0 (default)\n"
+        "  -f, --filesize=BYTES     size of each streamed file. 1048576 (default)\n"
+        "  -b, --chunk=BYTES        file bytes per DATA frame. 16384 (default)\n"
+        "  -w, --window=BYTES       max unacknowledged bytes per connection. %d (default)\n"
+        "  -d, --duration=SECONDS   test duration. 30 (default)\n"
+        "  -P, --server-pid=PID     server process for cpu usage. find '%s*' (default)\n"
+        "  -M, --metrics=ADDR       serve loadgen metrics in prometheus text format on ADDR\n"
+        "  -h, --help               print this help\n",
+        LG_APPNAME, XSYNC_MAGIC_DEFAULT, XSYNC_MUX_STREAM_WINDOW, XSYNC_SERVER_APPNAME);
+}
+
+
+static void lg_parse_opts (int argc, char *argv[])
+{
+    int ch;
+
+    const struct option lopts[] = {
+        {"host", required_argument, 0, 's'},
+        {"port", required_argument, 0, 'p'},
+        {"magic", required_argument, 0, 'n'},
+        {"connections", required_argument, 0, 'c'},
+        {"threads", required_argument, 0, 't'},
+        {"ramp", required_argument, 0, 'R'},
+        {"rate", required_argument, 0, 'r'},
+        {"filesize", required_argument, 0, 'f'},
+        {"chunk", required_argument, 0, 'b'},
+        {"window", required_argument, 0, 'w'},
+        {"duration", required_argument, 0, 'd'},
+        {"server-pid", required_argument, 0, 'P'},
+        {"metrics", required_argument, 0, 'M'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    bzero(&lg_opts, sizeof(lg_opts));
+
+    strcpy(lg_opts.host, "127.0.0.1");
+    strcpy(lg_opts.port, "8960");
+
+    lg_opts.magic = (ub4) atoi(XSYNC_MAGIC_DEFAULT);
+    lg_opts.connections = 100;
+    lg_opts.threads = 4;
+    lg_opts.filesize = 1048576;
+    lg_opts.chunk = 16384;
+    lg_opts.window = XSYNC_MUX_STREAM_WINDOW;
+    lg_opts.seconds = 30;
+
+    while ((ch = getopt_long(argc, argv, "s:p:n:c:t:R:r:f:b:w:d:P:M:h", lopts, 0)) != -1) {
+        switch (ch) {
+        case 's':
+            snprintf(lg_opts.host, sizeof(lg_opts.host), "%s", optarg);
+            break;
+        case 'p':
+            snprintf(lg_opts.port, sizeof(lg_opts.port), "%s", optarg);
+            break;
+        case 'n':
+            lg_opts.magic = (ub4) atoi(optarg);
+            break;
+        case 'c':
+            lg_opts.connections = atoi(optarg);
+            break;
+        case 't':
+            lg_opts.threads = atoi(optarg);
+            break;
+        case 'R':
+            lg_opts.ramp = atoi(optarg);
+            break;
+        case 'r':
+            lg_opts.rate = (ub8) strtoull(optarg, 0, 10);
+            break;
+        case 'f':
+            lg_opts.filesize = (ub8) strtoull(optarg, 0, 10);
+            break;
+        case 'b':
+            lg_opts.chunk = (ub4) strtoul(optarg, 0, 10);
+            break;
+        case 'w':
+            lg_opts.window = (ub4) strtoul(optarg, 0, 10);
+            break;
+        case 'd':
+            lg_opts.seconds = atoi(optarg);
+            break;
+        case 'P':
+            lg_opts.serverpid = (pid_t) atoi(optarg);
+            break;
+        case 'M':
+            snprintf(lg_opts.metrics, sizeof(lg_opts.metrics), "%s", optarg);
+            break;
+        case 'h':
+            lg_print_usage();
+            exit(0);
+        default:
+            lg_print_usage();
+            exit(-1);
+        }
+    }
+
+    if (lg_opts.connections < 1 || lg_opts.threads < 1 || lg_opts.seconds < 1 || lg_opts.filesize < 1 ||
+        lg_opts.chunk < 1 || lg_opts.chunk + XS_SYNC_REQ_SIZE > XSYNC_MUX_FRAME_MAXSIZE ||
+        lg_opts.window < lg_opts.chunk + XS_SYNC_REQ_SIZE) {
+        fprintf(stderr, "invalid options: chunk must be in [1, %d], window >= chunk + %d\n",
+            XSYNC_MUX_FRAME_MAXSIZE - XS_SYNC_REQ_SIZE, XS_SYNC_REQ_SIZE);
+        exit(-1);
+    }
+
+    if (lg_opts.threads > lg_opts.connections) {
+        lg_opts.threads = lg_opts.connections;
+    }
+}
+
+
+static void lg_report (double elapsed, double srvcpu, double mycpu)
+{
+    uint64_t accepted = metrics_counter_get(lg_ids.conn_accepted);
+    uint64_t bytes = metrics_counter_get(lg_ids.bytes_acked);
+    uint64_t frames = metrics_counter_get(lg_ids.frames_acked);
+
+    double accept_secs = (lg_last_accept_us > lg_begin_us? (lg_last_accept_us - lg_begin_us) / 1000000.0 : 0);
+
+    printf("\n* %s: %s:%s connections=%d threads=%d rate=%ju filesize=%ju chunk=%u window=%u duration=%.1fs\n",
+        LG_APPNAME, lg_opts.host, lg_opts.port, lg_opts.connections, lg_opts.threads,
+        (uintmax_t) lg_opts.rate, (uintmax_t) lg_opts.filesize, lg_opts.chunk, lg_opts.window, elapsed);
+
+    printf("connections: accepted=%ju rejected=%ju failed=%ju closed=%ju accepted/s=%.1f\n",
+        (uintmax_t) accepted,
+        (uintmax_t) metrics_counter_get(lg_ids.conn_rejected),
+        (uintmax_t) metrics_counter_get(lg_ids.conn_failed),
+        (uintmax_t) metrics_counter_get(lg_ids.conn_closed),
+        (accept_secs > 0? accepted / accept_secs : 0.0));
+
+    printf("connect(us): p50=%ju p99=%ju\n",
+        (uintmax_t) metrics_histogram_quantile(lg_ids.connect_seconds, 0.50),
+        (uintmax_t) metrics_histogram_quantile(lg_ids.connect_seconds, 0.99));
+
+    printf("ingest: frames=%ju frames/s=%.1f MB/s=%.2f files=%ju\n",
+        (uintmax_t) frames, frames / elapsed, bytes / elapsed / 1048576.0,
+        (uintmax_t) metrics_counter_get(lg_ids.files_done));
+
+    printf("ack(us): p50=%ju p90=%ju p99=%ju p99.9=%ju\n",
+        (uintmax_t) metrics_histogram_quantile(lg_ids.ack_seconds, 0.50),
+        (uintmax_t) metrics_histogram_quantile(lg_ids.ack_seconds, 0.90),
+        (uintmax_t) metrics_histogram_quantile(lg_ids.ack_seconds, 0.99),
+        (uintmax_t) metrics_histogram_quantile(lg_ids.ack_seconds, 0.999));
+
+    if (srvcpu >= 0) {
+        printf("server(pid=%d) cpu: %.1f%% (%.2fs)", (int) lg_opts.serverpid, srvcpu * 100 / elapsed, srvcpu);
+        if (bytes) {
+            printf(" %.1fms/GB", srvcpu * 1000 / (bytes / 1073741824.0));
+        }
+        printf("\n");
+    } else {
+        printf("server cpu: n/a (use --server-pid)\n");
+    }
+
+    printf("loadgen cpu: %.1f%%\n", mycpu * 100 / elapsed);
+}
+
+
+int main (int argc, char *argv[])
+{
+    int i, t;
+
+    lg_thread_t *thrs;
+
+    struct rlimit rl;
+
+    double srvcpu0 = -1, srvcpu = -1, mycpu0, elapsed;
+    uint64_t lastbytes = 0;
+
+    lg_parse_opts(argc, argv);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, lg_on_signal);
+    signal(SIGTERM, lg_on_signal);
+
+    // 每个连接一个文件描述符
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t) lg_opts.connections + 64) {
+        rl.rlim_cur = (rlim_t) lg_opts.connections + 64;
+        if (rl.rlim_max < rl.rlim_cur) {
+            rl.rlim_max = rl.rlim_cur;
+        }
+
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+            fprintf(stderr, "setrlimit(RLIMIT_NOFILE=%ju): %s\n", (uintmax_t) rl.rlim_cur, strerror(errno));
+        }
+    }
+
+    for (i = 0; i < (int) sizeof(lg_payload); i++) {
+        lg_payload[i] = (ub1) ('a' + i % 26);
+    }
+
+    srand((unsigned int) time(0) ^ (unsigned int) getpid());
+
+    lg_register_metrics();
+
+    if (lg_opts.metrics[0] && metrics_serve_start(lg_opts.metrics) != 0) {
+        fprintf(stderr, "metrics serve start fail: %s\n", lg_opts.metrics);
+    }
+
+    if (! lg_opts.serverpid) {
+        lg_opts.serverpid = lg_find_server();
+    }
+
+    if (lg_opts.serverpid) {
+        srvcpu0 = lg_proc_cputime(lg_opts.serverpid);
+    }
+
+    mycpu0 = lg_proc_cputime(getpid());
+
+    lg_begin_us = lg_now_us();
+
+    thrs = (lg_thread_t *) calloc(lg_opts.threads, sizeof(lg_thread_t));
+
+    for (t = 0, i = 0; t < lg_opts.threads; t++) {
+        int k;
+        lg_thread_t *thr = &thrs[t];
+
+        thr->epfd = epoll_create1(0);
+        thr->nconns = lg_opts.connections / lg_opts.threads + (t < lg_opts.connections % lg_opts.threads? 1 : 0);
+        thr->conns = (lg_conn_t *) calloc(thr->nconns, sizeof(lg_conn_t));
+
+        for (k = 0; k < thr->nconns; k++, i++) {
+            lg_conn_t *conn = &thr->conns[k];
+
+            conn->fd = -1;
+            conn->id = i + 1;
+            conn->epfd = thr->epfd;
+            conn->state = LG_CLOSED;
+
+            // 每帧至少 XS_SYNC_REQ_SIZE + 1 字节, 在途的帧数不超过窗口能容纳的帧数
+            conn->qcap = (int) (lg_opts.window / (XS_SYNC_REQ_SIZE + 1)) + 1;
+            conn->sent = (ub8 *) calloc(conn->qcap, sizeof(ub8));
+
+            conn->retry_at = lg_begin_us + (lg_opts.ramp > 0? (ub8) i * 1000000 / lg_opts.ramp : 0);
+        }
+
+        if (pthread_create(&thr->thread, 0, lg_thread_run, thr) != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(errno));
+            exit(-1);
+        }
+    }
+
+    for (t = 0; t < lg_opts.seconds && lg_running; t++) {
+        uint64_t bytes;
+
+        sleep(1);
+
+        bytes = metrics_counter_get(lg_ids.bytes_acked);
+
+        fprintf(stderr, "[%3ds] accepted=%ju closed=%ju MB/s=%.2f ack-p99=%juus\n", t + 1,
+            (uintmax_t) metrics_counter_get(lg_ids.conn_accepted),
+            (uintmax_t) metrics_counter_get(lg_ids.conn_closed),
+            (bytes - lastbytes) / 1048576.0,
+            (uintmax_t) metrics_histogram_quantile(lg_ids.ack_seconds, 0.99));
+
+        lastbytes = bytes;
+    }
+
+    elapsed = (lg_now_us() - lg_begin_us) / 1000000.0;
+
+    if (srvcpu0 >= 0) {
+        srvcpu = lg_proc_cputime(lg_opts.serverpid);
+        srvcpu = (srvcpu >= 0? srvcpu - srvcpu0 : -1);
+    }
+
+    lg_running = 0;
+
+    for (t = 0; t < lg_opts.threads; t++) {
+        pthread_join(thrs[t].thread, 0);
+        close(thrs[t].epfd);
+        free(thrs[t].conns);
+    }
+
+    free(thrs);
+
+    lg_report(elapsed, srvcpu, lg_proc_cputime(getpid()) - mycpu0);
+
+    metrics_serve_stop();
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+#######################################################################
+# @file: loadgen.mk
+#   xsync-loadgen: server load generator and throughput benchmark
+#
+# @version: 0.4.4
+# @create: 2018-11-24 10:12:36
+# @update: 2018-11-24 10:12:36
+#######################################################################
+prefix = .
+
+APPNAME := xsync-loadgen
+VERSION := 0.4.4
+
+TARGET := ${APPNAME}-${VERSION}
+
+
+LIB_PREFIX := ${TARGET_DIR}/../libs/lib
+
+TGT_LDLIBS  := \
+	${LIB_PREFIX}/libcommon.a \
+	${LIB_PREFIX}/liblog4c.a \
+	${LIB_PREFIX}/libexpat.a \
+	${LIB_PREFIX}/libz.a \
+	-lrt \
+	-lpthread
+
+
+SOURCES := \
+	loadgen.c
+
+
+SRC_DEFS := NDEBUG
+
+
+SRC_INCDIRS := \
+    . \
+	.. \
+	../common
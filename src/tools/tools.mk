@@ -0,0 +1,37 @@
+#######################################################################
+# @file: tools.mk
+#   xsync-evtrace: per-stage latency report for --trace ring files
+#
+# @version: 0.4.4
+# @create: 2018-11-23 09:36:50
+# @update: 2018-11-23 09:36:50
+#######################################################################
+prefix = .
+
+APPNAME := xsync-evtrace
+VERSION := 0.4.4
+
+TARGET := ${APPNAME}-${VERSION}
+
+
+LIB_PREFIX := ${TARGET_DIR}/../libs/lib
+
+TGT_LDLIBS  := \
+	${LIB_PREFIX}/libcommon.a \
+	${LIB_PREFIX}/liblog4c.a \
+	${LIB_PREFIX}/libexpat.a \
+	-lrt \
+	-lpthread
+
+
+SOURCES := \
+	evtrace_stat.c
+
+
+SRC_DEFS := NDEBUG
+
+
+SRC_INCDIRS := \
+    . \
+	.. \
+	../common
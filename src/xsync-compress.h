@@ -0,0 +1,524 @@
+/***********************************************************************
+* COPYRIGHT (C) 2018 PEPSTACK, PEPSTACK.COM
+*
+* THIS SOFTWARE IS PROVIDED 'AS-IS', WITHOUT ANY EXPRESS OR IMPLIED
+* WARRANTY. IN NO EVENT WILL THE AUTHORS BE HELD LIABLE FOR ANY DAMAGES
+* ARISING FROM THE USE OF THIS SOFTWARE.
+*
+* PERMISSION IS GRANTED TO ANYONE TO USE THIS SOFTWARE FOR ANY PURPOSE,
+* INCLUDING COMMERCIAL APPLICATIONS, AND TO ALTER IT AND REDISTRIBUTE IT
+* FREELY, SUBJECT TO THE FOLLOWING RESTRICTIONS:
+*
+*  THE ORIGIN OF THIS SOFTWARE MUST NOT BE MISREPRESENTED; YOU MUST NOT
+*  CLAIM THAT YOU WROTE THE ORIGINAL SOFTWARE. IF YOU USE THIS SOFTWARE
+*  IN A PRODUCT, AN ACKNOWLEDGMENT IN THE PRODUCT DOCUMENTATION WOULD
+*  BE APPRECIATED BUT IS NOT REQUIRED.
+*
+*  ALTERED SOURCE VERSIONS MUST BE PLAINLY MARKED AS SUCH, AND MUST NOT
+*  BE MISREPRESENTED AS BEING THE ORIGINAL SOFTWARE.
+*
+*  THIS NOTICE MAY NOT BE REMOVED OR ALTERED FROM ANY SOURCE DISTRIBUTION.
+***********************************************************************/
+
+/**
+ * @file: xsync-compress.h
+ *   per-chunk compression for XSYN data (zstd / lz4 / zlib)
+ *
+ *   编译时定义 XSYNC_HAVE_ZSTD, XSYNC_HAVE_LZ4 并链接 libzstd.a, liblz4.a
+ *     启用对应算法. zlib 总是可用 (deps/zlib-1.2.11).
+ *
+ * @author: master@pepstack.com
+ *
+ * @version: 0.4.4
+ *
+ * @create: 2018-11-13
+ *
+ * @update: 2018-11-13 16:42:08
+ */
+
+#ifndef XSYNC_COMPRESS_H_
+#define XSYNC_COMPRESS_H_
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+#include <zlib.h>
+
+#ifdef XSYNC_HAVE_ZSTD
+#  include <zstd.h>
+#endif
+
+#ifdef XSYNC_HAVE_LZ4
+#  include <lz4.h>
+#endif
+
+#include "./common/memapi.h"
+
+#include "xsync-error.h"
+#include "xsync-config.h"
+#include "xsync-protocol.h"
+
+
+/**
+ * 压缩结果小于原始数据的这个比例 (%) 才使用压缩数据, 否则发送原始数据
+ */
+#ifndef XSYNC_COMPRESS_MIN_SAVING
+#  define XSYNC_COMPRESS_MIN_SAVING     8
+#endif
+
+/**
+ * 连续多少个块的统计作为一次调整压缩级别的依据
+ */
+#ifndef XSYNC_COMPRESS_ADAPT_WINDOW
+#  define XSYNC_COMPRESS_ADAPT_WINDOW   16
+#endif
+
+/**
+ * 一个文件的前几个块都无法压缩时, 文件余下的块不再尝试压缩
+ */
+#ifndef XSYNC_COMPRESS_PROBE_CHUNKS
+#  define XSYNC_COMPRESS_PROBE_CHUNKS   2
+#endif
+
+
+/**
+ * 本地支持的压缩算法
+ */
+__no_warning_unused(static)
+inline ub4 XS_compress_capflags (void)
+{
+    ub4 capflags = XS_CAPFLAG_ZLIB;
+
+#ifdef XSYNC_HAVE_LZ4
+    capflags |= XS_CAPFLAG_LZ4;
+#endif
+
+#ifdef XSYNC_HAVE_ZSTD
+    capflags |= XS_CAPFLAG_ZSTD;
+#endif
+
+    return capflags;
+}
+
+
+/**
+ * 服务端选择双方都支持的最好的算法: zstd > lz4 > zlib
+ */
+__no_warning_unused(static)
+inline ub4 XS_compress_choose (ub4 client_capflags, ub4 server_capflags)
+{
+    ub4 both = client_capflags & server_capflags & XS_CAPFLAG_COMPRESS_MASK;
+
+    if (both & XS_CAPFLAG_ZSTD) {
+        return XS_CODEC_ZSTD;
+    }
+
+    if (both & XS_CAPFLAG_LZ4) {
+        return XS_CODEC_LZ4;
+    }
+
+    if (both & XS_CAPFLAG_ZLIB) {
+        return XS_CODEC_ZLIB;
+    }
+
+    return XS_CODEC_NONE;
+}
+
+
+__no_warning_unused(static)
+inline const char * XS_codec_name (ub4 codec)
+{
+    switch (codec) {
+    case XS_CODEC_ZLIB:
+        return "zlib";
+    case XS_CODEC_LZ4:
+        return "lz4";
+    case XS_CODEC_ZSTD:
+        return "zstd";
+    }
+
+    return "none";
+}
+
+
+/**
+ * 已经压缩过的文件类型, 不再压缩
+ */
+__no_warning_unused(static)
+int XS_compress_skip_file (const char *pathname)
+{
+    static const char *exts[] = {
+        ".gz", ".tgz", ".bz2", ".xz", ".txz", ".zst", ".lz4", ".lzma", ".z",
+        ".zip", ".7z", ".rar", ".jar", ".war", ".apk", ".rpm", ".deb",
+        ".jpg", ".jpeg", ".png", ".gif", ".webp", ".heic",
+        ".mp3", ".aac", ".ogg", ".flac", ".mp4", ".mkv", ".avi", ".mov", ".webm",
+        ".parquet", ".orc",
+        0
+    };
+
+    const char *ext;
+    int i;
+
+    ext = strrchr(pathname, '.');
+    if (! ext || strchr(ext, '/')) {
+        return 0;
+    }
+
+    for (i = 0; exts[i]; i++) {
+        if (! strcasecmp(ext, exts[i])) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * xs_compressor_t
+ *
+ *   每个发送线程 (连接) 一个, 不可多线程共享.
+ *
+ *   自适应级别: 每 XSYNC_COMPRESS_ADAPT_WINDOW 个块比较压缩耗时和发送耗时.
+ *     压缩耗时 > 发送耗时: CPU 是瓶颈, 降低级别;
+ *     压缩耗时 < 发送耗时的一半: 网络是瓶颈, 提高级别.
+ */
+typedef struct xs_compressor_t
+{
+    ub4 codec;
+
+    int level;
+    int minlevel;
+    int maxlevel;
+
+    /* 当前文件: 连续无法压缩的块数, 超过则文件余下部分不再压缩 */
+    int incompressible;
+    int skipfile;
+
+    /* window statistics */
+    int samples;
+    ub8 compress_ns;
+    ub8 send_ns;
+    ub8 rawbytes;
+    ub8 compbytes;
+
+    /* total statistics */
+    ub8 total_rawbytes;
+    ub8 total_compbytes;
+
+    z_stream zstrm;
+    int zstrm_inited;
+
+#ifdef XSYNC_HAVE_ZSTD
+    ZSTD_CCtx *zcctx;
+    ZSTD_DCtx *zdctx;
+#endif
+} xs_compressor_t;
+
+
+__no_warning_unused(static)
+inline ub8 XS_compress_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ub8) ts.tv_sec * 1000000000ULL + (ub8) ts.tv_nsec;
+}
+
+
+__no_warning_unused(static)
+void XS_compressor_init (xs_compressor_t *cmp, ub4 codec)
+{
+    bzero(cmp, sizeof(*cmp));
+
+    cmp->codec = codec;
+
+    switch (codec) {
+    case XS_CODEC_ZLIB:
+        cmp->minlevel = 1;
+        cmp->maxlevel = 9;
+        cmp->level = 3;
+        break;
+
+    case XS_CODEC_LZ4:
+        /* level 映射为 acceleration = maxlevel + 1 - level */
+        cmp->minlevel = 1;
+        cmp->maxlevel = 9;
+        cmp->level = 8;
+        break;
+
+    case XS_CODEC_ZSTD:
+        cmp->minlevel = 1;
+        cmp->maxlevel = 12;
+        cmp->level = 3;
+        break;
+
+    default:
+        cmp->codec = XS_CODEC_NONE;
+        break;
+    }
+}
+
+
+__no_warning_unused(static)
+void XS_compressor_uninit (xs_compressor_t *cmp)
+{
+    if (cmp->zstrm_inited) {
+        deflateEnd(&cmp->zstrm);
+        cmp->zstrm_inited = 0;
+    }
+
+#ifdef XSYNC_HAVE_ZSTD
+    if (cmp->zcctx) {
+        ZSTD_freeCCtx(cmp->zcctx);
+        cmp->zcctx = 0;
+    }
+
+    if (cmp->zdctx) {
+        ZSTD_freeDCtx(cmp->zdctx);
+        cmp->zdctx = 0;
+    }
+#endif
+}
+
+
+/**
+ * 开始一个新文件: 根据扩展名决定是否跳过压缩
+ */
+__no_warning_unused(static)
+inline void XS_compressor_begin_file (xs_compressor_t *cmp, const char *pathname)
+{
+    cmp->incompressible = 0;
+    cmp->skipfile = (pathname && XS_compress_skip_file(pathname));
+}
+
+
+/**
+ * 压缩后的最大尺寸
+ */
+__no_warning_unused(static)
+inline size_t XS_compress_bound (ub4 codec, size_t rawlen)
+{
+    switch (codec) {
+    case XS_CODEC_ZLIB:
+        return (size_t) compressBound((uLong) rawlen);
+
+#ifdef XSYNC_HAVE_LZ4
+    case XS_CODEC_LZ4:
+        return (size_t) LZ4_compressBound((int) rawlen);
+#endif
+
+#ifdef XSYNC_HAVE_ZSTD
+    case XS_CODEC_ZSTD:
+        return ZSTD_compressBound(rawlen);
+#endif
+    }
+
+    return rawlen;
+}
+
+
+/**
+ * XS_compressor_compress
+ *   压缩一个块到 dst.
+ *
+ *   返回压缩后的字节数, 同时 *codec 为实际使用的算法.
+ *   返回 0 表示不压缩 (*codec = XS_CODEC_NONE): 调用者直接发送原始数据.
+ */
+__no_warning_unused(static)
+size_t XS_compressor_compress (xs_compressor_t *cmp, const ub1 *src, size_t srclen, ub1 *dst, size_t dstcap, ub4 *codec)
+{
+    size_t complen = 0;
+    ub8 t0;
+
+    *codec = XS_CODEC_NONE;
+
+    if (cmp->codec == XS_CODEC_NONE || cmp->skipfile || srclen < 64) {
+        return 0;
+    }
+
+    t0 = XS_compress_now_ns();
+
+    switch (cmp->codec) {
+    case XS_CODEC_ZLIB:
+        if (! cmp->zstrm_inited) {
+            bzero(&cmp->zstrm, sizeof(cmp->zstrm));
+
+            if (deflateInit(&cmp->zstrm, cmp->level) != Z_OK) {
+                return 0;
+            }
+
+            cmp->zstrm_inited = 1;
+        } else if (deflateReset(&cmp->zstrm) != Z_OK || deflateParams(&cmp->zstrm, cmp->level, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return 0;
+        }
+
+        cmp->zstrm.next_in = (Bytef *) src;
+        cmp->zstrm.avail_in = (uInt) srclen;
+        cmp->zstrm.next_out = (Bytef *) dst;
+        cmp->zstrm.avail_out = (uInt) dstcap;
+
+        if (deflate(&cmp->zstrm, Z_FINISH) == Z_STREAM_END) {
+            complen = (size_t) cmp->zstrm.total_out;
+        }
+        break;
+
+#ifdef XSYNC_HAVE_LZ4
+    case XS_CODEC_LZ4:
+        do {
+            int cb = LZ4_compress_fast((const char *) src, (char *) dst, (int) srclen, (int) dstcap, cmp->maxlevel + 1 - cmp->level);
+
+            if (cb > 0) {
+                complen = (size_t) cb;
+            }
+        } while (0);
+        break;
+#endif
+
+#ifdef XSYNC_HAVE_ZSTD
+    case XS_CODEC_ZSTD:
+        if (! cmp->zcctx) {
+            cmp->zcctx = ZSTD_createCCtx();
+        }
+
+        if (cmp->zcctx) {
+            size_t cb = ZSTD_compressCCtx(cmp->zcctx, dst, dstcap, src, srclen, cmp->level);
+
+            if (! ZSTD_isError(cb)) {
+                complen = cb;
+            }
+        }
+        break;
+#endif
+    }
+
+    cmp->compress_ns += XS_compress_now_ns() - t0;
+
+    if (complen == 0 || complen * 100 > srclen * (100 - XSYNC_COMPRESS_MIN_SAVING)) {
+        /* 无法压缩 */
+        if (++cmp->incompressible >= XSYNC_COMPRESS_PROBE_CHUNKS) {
+            cmp->skipfile = 1;
+        }
+
+        cmp->rawbytes += srclen;
+        cmp->compbytes += srclen;
+
+        return 0;
+    }
+
+    cmp->incompressible = 0;
+
+    cmp->rawbytes += srclen;
+    cmp->compbytes += complen;
+
+    *codec = cmp->codec;
+
+    return complen;
+}
+
+
+/**
+ * XS_compressor_adapt
+ *   每发送完成一个块调用, 报告本次发送的耗时 (纳秒). 窗口结束时调整级别.
+ */
+__no_warning_unused(static)
+void XS_compressor_adapt (xs_compressor_t *cmp, ub8 send_ns)
+{
+    cmp->send_ns += send_ns;
+
+    if (++cmp->samples < XSYNC_COMPRESS_ADAPT_WINDOW) {
+        return;
+    }
+
+    if (cmp->compress_ns > cmp->send_ns) {
+        /* cpu bound */
+        if (cmp->level > cmp->minlevel) {
+            cmp->level--;
+        }
+    } else if (cmp->compress_ns * 2 < cmp->send_ns) {
+        /* network bound: 压缩得更小 */
+        if (cmp->level < cmp->maxlevel) {
+            cmp->level++;
+        }
+    }
+
+    cmp->total_rawbytes += cmp->rawbytes;
+    cmp->total_compbytes += cmp->compbytes;
+
+    cmp->samples = 0;
+    cmp->compress_ns = 0;
+    cmp->send_ns = 0;
+    cmp->rawbytes = 0;
+    cmp->compbytes = 0;
+}
+
+
+/**
+ * XS_decompress_chunk
+ *   服务端解压 XSYN 数据. 返回解压的字节数, 必须等于 rawlen, 否则出错.
+ */
+__no_warning_unused(static)
+XS_RESULT XS_decompress_chunk (xs_compressor_t *cmp, ub4 codec, const ub1 *src, size_t srclen, ub1 *dst, size_t rawlen)
+{
+    switch (codec) {
+    case XS_CODEC_NONE:
+        if (srclen != rawlen) {
+            return XS_E_PARAM;
+        }
+
+        memcpy(dst, src, rawlen);
+        return XS_SUCCESS;
+
+    case XS_CODEC_ZLIB:
+        do {
+            uLongf outlen = (uLongf) rawlen;
+
+            if (uncompress((Bytef *) dst, &outlen, (const Bytef *) src, (uLong) srclen) != Z_OK || outlen != (uLongf) rawlen) {
+                return XS_ERROR;
+            }
+        } while (0);
+        return XS_SUCCESS;
+
+#ifdef XSYNC_HAVE_LZ4
+    case XS_CODEC_LZ4:
+        if (LZ4_decompress_safe((const char *) src, (char *) dst, (int) srclen, (int) rawlen) != (int) rawlen) {
+            return XS_ERROR;
+        }
+        return XS_SUCCESS;
+#endif
+
+#ifdef XSYNC_HAVE_ZSTD
+    case XS_CODEC_ZSTD:
+        do {
+            size_t cb;
+
+            if (! cmp->zdctx) {
+                cmp->zdctx = ZSTD_createDCtx();
+            }
+
+            if (! cmp->zdctx) {
+                return XS_E_OUTMEM;
+            }
+
+            cb = ZSTD_decompressDCtx(cmp->zdctx, dst, rawlen, src, srclen);
+
+            if (ZSTD_isError(cb) || cb != rawlen) {
+                return XS_ERROR;
+            }
+        } while (0);
+        return XS_SUCCESS;
+#endif
+    }
+
+    return XS_E_NOTIMP;
+}
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* XSYNC_COMPRESS_H_ */
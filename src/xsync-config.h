@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-24
  *
- * @update: 2018-11-09 14:59:24
+ * @update: 2018-11-30 20:05:37
  */
 
 #ifndef XSYNC_CONFIG_H_
@@ -124,6 +124,60 @@ extern "C"
 #define XSYNC_CLIENT_THREADS_MAX        16
 #endif
 
+/**
+ * 成批过滤文件的最大事件数: 连续读到的 inotify 事件 (或者 sweep 的文件)
+ *   攒成一批, 一次调用脚本 filter_files (see LuaCtxCallBatch)
+ */
+#ifndef XSYNC_FILTER_BATCH_MAXNUM
+#  define XSYNC_FILTER_BATCH_MAXNUM     64
+#endif
+
+/**
+ * 检查脚本 (events-filter.lua 和 require 的模块) 是否修改的间隔毫秒.
+ *   修改之后重新加载脚本, 不重启监视
+ */
+#ifndef XSYNC_LUA_RELOAD_CHECK_MS
+#  define XSYNC_LUA_RELOAD_CHECK_MS     500
+#endif
+
+/**
+ * 监视目录 (watch_config) 修改时只添加和删除变化的 pathid 目录.
+ *   检查 watch_config 修改时间的间隔毫秒
+ */
+#ifndef XSYNC_WATCH_RECONF_CHECK_MS
+#  define XSYNC_WATCH_RECONF_CHECK_MS   1000
+#endif
+
+/**
+ * 监视修复队列 (see "client/watch_repair.h"): 最多等待修复的目录数,
+ *   第一次重试的退避毫秒 (每次加倍, 最大 XSYNC_WATCH_REPAIR_BACKOFF_MAXMS),
+ *   最多重试次数 (之后放弃, 由 sweep 重新发现没有监视的目录)
+ */
+#ifndef XSYNC_WATCH_REPAIR_MAXNUM
+#  define XSYNC_WATCH_REPAIR_MAXNUM     4096
+#endif
+
+#ifndef XSYNC_WATCH_REPAIR_BACKOFF_MS
+#  define XSYNC_WATCH_REPAIR_BACKOFF_MS      200
+#endif
+
+#ifndef XSYNC_WATCH_REPAIR_BACKOFF_MAXMS
+#  define XSYNC_WATCH_REPAIR_BACKOFF_MAXMS   60000
+#endif
+
+#ifndef XSYNC_WATCH_REPAIR_MAXRETRY
+#  define XSYNC_WATCH_REPAIR_MAXRETRY   10
+#endif
+
+/**
+ * 启动时并行遍历监视目录的线程数 (see "client/watch_crawl.h").
+ *   1 表示由 inotifytools_watch_recursively 逐个目录添加.
+ *   脚本定义了 inotify_watch_on_query/ready/error 时不并行
+ */
+#ifndef XSYNC_WATCH_CRAWL_THREADS
+#  define XSYNC_WATCH_CRAWL_THREADS     8
+#endif
+
 /**
  * default sweep interval for xclient in seconds ( 0 - never )
  */
@@ -159,6 +213,20 @@ extern "C"
 #endif
 
 
+/**
+ * only for xsync server:
+ *   从 kafka 读取事件 (--kafka) 的消费线程数和默认的 topic.
+ *   默认订阅全部不以 '_' 开头的 topic (不包括 __consumer_offsets)
+ */
+#ifndef XSYNC_SERVER_KAFKA_THREADS
+#  define XSYNC_SERVER_KAFKA_THREADS    4
+#endif
+
+#ifndef XSYNC_SERVER_KAFKA_TOPICS
+#  define XSYNC_SERVER_KAFKA_TOPICS     "^[^_].*"
+#endif
+
+
 /**
  * 绝对不可以更改下面的值!!
  * for both server and client
@@ -275,6 +343,296 @@ extern "C"
 #endif
 
 
+/**
+ * content-defined chunking (FastCDC) for both server and client
+ *
+ *   绝对不可以在客户端和服务端使用不同的值! 否则同样内容的文件切分出的块不同,
+ *     去重失效.
+ *
+ *   MIN <= AVG <= MAX, AVG 必须是 2 的整数次幂
+ */
+#ifndef XSYNC_CHUNK_MIN_SIZE
+#  define XSYNC_CHUNK_MIN_SIZE          16384
+#endif
+
+#ifndef XSYNC_CHUNK_AVG_SIZE
+#  define XSYNC_CHUNK_AVG_SIZE          65536
+#endif
+
+#ifndef XSYNC_CHUNK_MAX_SIZE
+#  define XSYNC_CHUNK_MAX_SIZE          262144
+#endif
+
+
+/**
+ * only for xsync client:
+ *   文件小于这个值不分块, 直接整体传输
+ */
+#ifndef XSYNC_CHUNK_FILE_MINSIZE
+#  define XSYNC_CHUNK_FILE_MINSIZE      XSYNC_CHUNK_MAX_SIZE
+#endif
+
+
+/**
+ * 一次 XCHK 协商最多携带的块数目
+ */
+#ifndef XSYNC_CHUNK_NEGOTIATE_MAX
+#  define XSYNC_CHUNK_NEGOTIATE_MAX     1024
+#endif
+
+
+/**
+ * 一次 XLGB 批量注册最多携带的条目数目和条目字节 (不包括包头)
+ */
+#ifndef XSYNC_LOGBATCH_MAX
+#  define XSYNC_LOGBATCH_MAX            4096
+#endif
+
+#ifndef XSYNC_LOGBATCH_MAXSIZE
+#  define XSYNC_LOGBATCH_MAXSIZE        1048576
+#endif
+
+
+/**
+ * 客户端合并注册: 各线程提交的条目在每个服务器上排队, 由第一个等待
+ *   结果的线程一次发送最多这么多条目 (一个 XLGB)
+ */
+#ifndef XSYNC_LOGBATCH_COALESCE_MAX
+#  define XSYNC_LOGBATCH_COALESCE_MAX   1024
+#endif
+
+
+/**
+ * only for xsync client:
+ *   按行发送文件到 kafka (on_event_task 返回 kafka_lines = "1") 的行分隔符
+ */
+#ifndef XSYNC_KAFKA_LINEBREAK
+#  define XSYNC_KAFKA_LINEBREAK         "\n"
+#endif
+
+
+/**
+ * only for xsync client:
+ *   后台刷新 kafka topic 分区数的间隔 (毫秒). kafka_config() 可以用
+ *   metadata_refresh_ms 指定, "0" 表示不刷新
+ */
+#ifndef XSYNC_KAFKA_METADATA_REFRESH_MS
+#  define XSYNC_KAFKA_METADATA_REFRESH_MS   "30000"
+#endif
+
+
+/**
+ * only for xsync client:
+ *   kafka 事件消息的日志 (检查点) 超过这个大小时压缩;
+ *   日志写入之后最多经过 XSYNC_KAFKA_JOURNAL_SYNC_MS 毫秒落盘 (fdatasync),
+ *   0 表示每条记录都落盘
+ */
+#ifndef XSYNC_KAFKA_JOURNAL_MAXSIZE
+#  define XSYNC_KAFKA_JOURNAL_MAXSIZE   67108864
+#endif
+
+#ifndef XSYNC_KAFKA_JOURNAL_SYNC_MS
+#  define XSYNC_KAFKA_JOURNAL_SYNC_MS   1000
+#endif
+
+
+/**
+ * only for xsync client:
+ *   同步发送 kafka 事件消息时等待投递报告的最长时间 (毫秒);
+ *   投递失败的消息每 XSYNC_KAFKA_RETRY_SECONDS 秒由工作线程重新发送,
+ *   每次最多 XSYNC_KAFKA_RETRY_BATCH 条
+ */
+#ifndef XSYNC_KAFKA_DELIVERY_TIMEOUT_MS
+#  define XSYNC_KAFKA_DELIVERY_TIMEOUT_MS   30000
+#endif
+
+#ifndef XSYNC_KAFKA_RETRY_SECONDS
+#  define XSYNC_KAFKA_RETRY_SECONDS     60
+#endif
+
+#ifndef XSYNC_KAFKA_RETRY_BATCH
+#  define XSYNC_KAFKA_RETRY_BATCH       256
+#endif
+
+
+/**
+ * only for xsync server:
+ *
+ *   XSYNC_CHUNK_STORE_HASHMAX = 2^n - 1
+ */
+#ifndef XSYNC_CHUNK_STORE_HASHMAX
+#  define XSYNC_CHUNK_STORE_HASHMAX     65535
+#endif
+
+/**
+ * only for xsync server:
+ *   块索引的文件清单日志超过这个大小 (并且超过全部清单的 2 倍) 时压缩
+ */
+#ifndef XSYNC_CHUNK_JOURNAL_MAXSIZE
+#  define XSYNC_CHUNK_JOURNAL_MAXSIZE   67108864
+#endif
+
+
+/**
+ * 多路复用 (XMUX) 流控参数, for both server and client
+ *
+ *   XSYNC_MUX_STREAM_WINDOW: 每个流 (entryid) 初始的发送窗口字节
+ *   XSYNC_MUX_CONN_WINDOW:   每个连接初始的发送窗口字节 (所有流共享)
+ *   XSYNC_MUX_FRAME_MAXSIZE: 一个 DATA 帧最大的负载字节
+ *   XSYNC_MUX_QUANTUM:       轮询调度时每个流一轮最多发送的字节.
+ *                              小文件一轮即可发完, 不会被大文件阻塞
+ */
+#ifndef XSYNC_MUX_STREAM_WINDOW
+#  define XSYNC_MUX_STREAM_WINDOW       524288
+#endif
+
+#ifndef XSYNC_MUX_CONN_WINDOW
+#  define XSYNC_MUX_CONN_WINDOW         4194304
+#endif
+
+#ifndef XSYNC_MUX_FRAME_MAXSIZE
+#  define XSYNC_MUX_FRAME_MAXSIZE       65536
+#endif
+
+#ifndef XSYNC_MUX_QUANTUM
+#  define XSYNC_MUX_QUANTUM             16384
+#endif
+
+/* 服务端处理完整的消息之后才归还流窗口: 流窗口必须容纳一个最大块的 XSYN */
+#if XSYNC_MUX_STREAM_WINDOW < XSYNC_CHUNK_MAX_SIZE + 40
+#  error "XSYNC_MUX_STREAM_WINDOW too small for XSYNC_CHUNK_MAX_SIZE"
+#endif
+
+
+/**
+ * only for xsync client:
+ *   每个流排队未发送的最大字节. 超过之后写入线程等待 (背压)
+ */
+#ifndef XSYNC_MUX_STREAM_QUEUE_MAX
+#  define XSYNC_MUX_STREAM_QUEUE_MAX    1048576
+#endif
+
+
+/**
+ * for both server and client:
+ *
+ *   XSYNC_MUX_STREAM_HASHMAX = 2^n - 1
+ */
+#ifndef XSYNC_MUX_STREAM_HASHMAX
+#  define XSYNC_MUX_STREAM_HASHMAX      255
+#endif
+
+
+/**
+ * only for xsync client: 一个文件同时同步到多个服务器 (fanout)
+ *
+ *   XSYNC_FANOUT_BLOCK_SIZE:   一次读文件的字节 (一个 XSYN 消息的数据)
+ *   XSYNC_FANOUT_CACHE_BLOCKS: 缓存最近读取的块, 稍慢的服务器从缓存取数据,
+ *                                不必重新读文件. 缓存应不小于
+ *                                XSYNC_MUX_STREAM_QUEUE_MAX + XSYNC_MUX_STREAM_WINDOW
+ *   XSYNC_FANOUT_CHUNK_BLOCKS: 分块传输的文件的缓存块数. 一批 XCHK 的块不超过
+ *                                这个缓存 (少一个块), 缺失的块从缓存发送
+ *   XSYNC_FANOUT_PENDING_MAX:  每个服务器未确认的 XSYN 消息的最大数目
+ *   XSYNC_FANOUT_STALL_MS:     全部服务器都没有新的确认超过这个时间则不再等待,
+ *                                没有完成的部分在文件下一次同步时断点续传
+ *   XSYNC_FANOUT_REQUEST_MS:   等待 XLGB 注册应答的最长时间
+ */
+#ifndef XSYNC_FANOUT_BLOCK_SIZE
+#  define XSYNC_FANOUT_BLOCK_SIZE       65536
+#endif
+
+#ifndef XSYNC_FANOUT_CACHE_BLOCKS
+#  define XSYNC_FANOUT_CACHE_BLOCKS     32
+#endif
+
+#ifndef XSYNC_FANOUT_CHUNK_BLOCKS
+#  define XSYNC_FANOUT_CHUNK_BLOCKS     128
+#endif
+
+#if (XSYNC_FANOUT_CHUNK_BLOCKS - 1) * XSYNC_FANOUT_BLOCK_SIZE < XSYNC_CHUNK_MAX_SIZE * 2
+#  error "XSYNC_FANOUT_CHUNK_BLOCKS too small for XSYNC_CHUNK_MAX_SIZE"
+#endif
+
+#ifndef XSYNC_FANOUT_PENDING_MAX
+#  define XSYNC_FANOUT_PENDING_MAX      64
+#endif
+
+#ifndef XSYNC_FANOUT_STALL_MS
+#  define XSYNC_FANOUT_STALL_MS         30000
+#endif
+
+#ifndef XSYNC_FANOUT_REQUEST_MS
+#  define XSYNC_FANOUT_REQUEST_MS       10000
+#endif
+
+
+/**
+ * only for xsync client:
+ *   每个服务器上文件条目的确认偏移 (断点续传) 的日志超过这个大小时压缩;
+ *   日志写入之后最多经过 XSYNC_SYNC_PROGRESS_SYNC_MS 毫秒落盘
+ */
+#ifndef XSYNC_SYNC_PROGRESS_MAXSIZE
+#  define XSYNC_SYNC_PROGRESS_MAXSIZE   16777216
+#endif
+
+#ifndef XSYNC_SYNC_PROGRESS_SYNC_MS
+#  define XSYNC_SYNC_PROGRESS_SYNC_MS   1000
+#endif
+
+
+/**
+ * only for xsync client: 连接管理 (conn_reactor)
+ *
+ *   XSYNC_RECONNECT_MIN_MS/MAX_MS: 重连的指数退避区间 (毫秒)
+ *   XSYNC_HEARTBEAT_INTERVAL_MS:   空闲多久发送一次 PING
+ *   XSYNC_HEARTBEAT_TIMEOUT_MS:    多久没有收到任何数据认为连接断开
+ *   XSYNC_REACTOR_TICK_MS:         reactor 检查定时任务的间隔
+ */
+#ifndef XSYNC_RECONNECT_MIN_MS
+#  define XSYNC_RECONNECT_MIN_MS        500
+#endif
+
+#ifndef XSYNC_RECONNECT_MAX_MS
+#  define XSYNC_RECONNECT_MAX_MS        60000
+#endif
+
+#ifndef XSYNC_HEARTBEAT_INTERVAL_MS
+#  define XSYNC_HEARTBEAT_INTERVAL_MS   10000
+#endif
+
+#ifndef XSYNC_HEARTBEAT_TIMEOUT_MS
+#  define XSYNC_HEARTBEAT_TIMEOUT_MS    35000
+#endif
+
+#ifndef XSYNC_REACTOR_TICK_MS
+#  define XSYNC_REACTOR_TICK_MS         100
+#endif
+
+
+/**
+ * 异步日志 (--log-async)
+ *   XSYNC_LOGGER_ASYNC_RINGSIZE: 每个写日志线程的 ring 大小 (2 的幂).
+ *                                ring 满时按 drop 或 block 策略处理
+ */
+#ifndef XSYNC_LOGGER_ASYNC_RINGSIZE
+#  define XSYNC_LOGGER_ASYNC_RINGSIZE   1048576
+#endif
+
+
+/**
+ * 事件跟踪 (--trace)
+ *   XSYNC_EVTRACE_CAPACITY: 跟踪 ring 文件的记录数, 写满后覆盖最旧的记录
+ *   XSYNC_EVTRACE_SAMPLE:   缺省采样率, 每 N 个事件跟踪 1 个
+ */
+#ifndef XSYNC_EVTRACE_CAPACITY
+#  define XSYNC_EVTRACE_CAPACITY        65536
+#endif
+
+#ifndef XSYNC_EVTRACE_SAMPLE
+#  define XSYNC_EVTRACE_SAMPLE          100
+#endif
+
+
 #if defined(__cplusplus)
 }
 #endif
@@ -30,7 +30,7 @@
  *
  * @create: 2018-01-29
  *
- * @update: 2018-11-07 10:20:15
+ * @update: 2018-11-30 18:10:52
  */
 
 /***********************************************************************
@@ -40,10 +40,16 @@
  *
  *     XLOG  客户端发起开始文件条目请求        XSLogEntryReq_t
  *
+ *     XLGB  客户端发起批量注册文件条目请求    XSLogBatchReq_t
+ *
  *     XSYN  客户端发起传输文件条目请求        XSSyncFileReq_t
  *
  *     XCMD  客户端发起让服务器执行命令请求    XSCommandReq_t
  *
+ *     XCHK  客户端发起文件块哈希协商请求      XSChunkNegotiateReq_t
+ *
+ *     XMUX  多路复用帧 (双向)                 XSMuxFrame_t
+ *
  **********************************************************************/
 
 /**********************************************************************
@@ -155,6 +161,50 @@ static union {
     ub4 msgid;
 } XS_MSGID_XCMD = {{'X','C','M','D'}};
 
+__attribute__((used))
+static union {
+    /* big endian */
+    char c[4];
+    ub4 msgid;
+} XS_MSGID_XCHK = {{'X','C','H','K'}};
+
+__attribute__((used))
+static union {
+    /* big endian */
+    char c[4];
+    ub4 msgid;
+} XS_MSGID_XMUX = {{'X','M','U','X'}};
+
+__attribute__((used))
+static union {
+    /* big endian */
+    char c[4];
+    ub4 msgid;
+} XS_MSGID_XLGB = {{'X','L','G','B'}};
+
+
+/***********************************************************************
+ * 能力标识 (capflags, bitflags)
+ *
+ *   XCON 请求的 capflags 是客户端支持的全部能力; 服务端在 XCON 应答的
+ *   bitflags 中返回双方都支持并被选用的能力 (压缩算法只选一个).
+ *
+ *   压缩算法标识同时作为 XSYN 包头的 codec 值.
+ **********************************************************************/
+#define XS_CAPFLAG_ZLIB              0x00000001
+#define XS_CAPFLAG_LZ4               0x00000002
+#define XS_CAPFLAG_ZSTD              0x00000004
+
+#define XS_CAPFLAG_COMPRESS_MASK     0x000000ff
+
+/* 连接支持 XMUX 多路复用帧 */
+#define XS_CAPFLAG_MUX               0x00000100
+
+#define XS_CODEC_NONE                0
+#define XS_CODEC_ZLIB                XS_CAPFLAG_ZLIB
+#define XS_CODEC_LZ4                 XS_CAPFLAG_LZ4
+#define XS_CODEC_ZSTD                XS_CAPFLAG_ZSTD
+
 
 /***********************************************************************
  * XSConnectReq_t
@@ -181,7 +231,7 @@ static union {
  * 64  ... password (16 bytes)
  * 72                                               |78:'\0'|79:pwlen
  * --------------------------------+--------------------------------
- * 80:      reserved               |84        ub4 crc32_checksum
+ * 80:      capflags               |84        ub4 crc32_checksum
  * -----------------------------------------------------------------
  * 88
  **********************************************************************/
@@ -211,7 +261,10 @@ typedef struct XSConnectReq_t
 
             ub1 password[XSYNC_PASSWORD_MAXLEN + 2];
 
-            ub4 reserved;
+            union {
+                ub4 reserved;
+                ub4 capflags;       /* 客户端支持的能力: XS_CAPFLAG_* */
+            };
 
             ub4 crc32_checksum;
         };
@@ -252,7 +305,7 @@ typedef struct XSConnectReply_t
             ub4 magic;              /* 结果代码: 根据请求的 randnum 和 magic 计算得到的魔数 */
 
             ub4 server_version;     /* xsync-server version */
-            ub4 bitflags;           /* 附加参数标识: 指定启用的编码, 加密, 压缩, 备用服务等. 默认 0 */
+            ub4 bitflags;           /* 附加参数标识: 指定启用的编码, 加密, 压缩 (XS_CAPFLAG_*), 备用服务等. 默认 0 */
 
             ub8 server_utctime;     /* xsync-server time */
 
@@ -316,11 +369,135 @@ typedef struct XSLogEntryReq_t
 #endif
 
 
+/**********************************************************************
+ * XLGB Command Request
+ *   批量注册条目命令. 一个请求携带多个文件条目, 服务端一次返回全部条目
+ *   的 entryid. 目录扫描发现大量新文件时, 不必为每个文件往返一次.
+ *
+ *   路径做前缀压缩: 每个条目只保存与前一个条目路径相同的前缀字节数
+ *   (prefixlen) 和其余的后缀 (suffixlen 字节, 不以 '\0' 结尾). 客户端按
+ *   路径排序之后发送, 同一目录下的文件只传输文件名.
+ *
+ * 0
+ * --------------------------------+--------------------------------
+ * 0       msgid = XLGB            |4          datalen
+ * --------------------------------+--------------------------------
+ * 8                          session ( 8 bytes)
+ * --------------------------------+--------------------------------
+ * 16      entries                 |20         crc32_checksum
+ * --------------------------------+--------------------------------
+ * 24                  clientid (XSYNC_CLIENTID_MAXLEN + 4 bytes)
+ * -----------------------------------------------------------------
+ * 64  entries * (XSLogBatchEntry_t + suffix) ...
+ *
+ *   crc32_checksum 校验全部条目 (不包括包头)
+ *
+ * XSLogBatchEntry_t:
+ * --------------------------------+--------------------------------
+ * 0                          exptime ( 8 bytes)
+ * 8                          modtime ( 8 bytes)
+ * 16                        filesize ( 8 bytes)
+ * 24                         filemd5 (16 bytes)
+ * --------------------------------+--------------------------------
+ * 40      prefixlen | suffixlen   |44  suffix (suffixlen bytes) ...
+ * -----------------------------------------------------------------
+ *********************************************************************/
+#define XS_LOGBATCH_REQ_SIZE        64
+
+#define XS_LOGBATCH_ENTRY_SIZE      44
+
+#ifdef _MSC_VER
+#  pragma pack(1)
+#endif
+
+typedef struct XSLogBatchReq_t
+{
+    union {
+        struct {
+            ub4 msgid;              /* XLGB */
+            ub4 datalen;            /* data body length in bytes NOT including sizeof head */
+
+            ub8 session;
+
+            ub4 entries;            /* 条目数目: 不超过 XSYNC_LOGBATCH_MAX */
+            ub4 crc32_checksum;     /* 校验值: 全部条目 */
+
+            char clientid[XSYNC_CLIENTID_MAXLEN + 4];
+        };
+
+        ub1 head[XS_LOGBATCH_REQ_SIZE];
+    };
+} GNUC_PACKED ARM_PACKED XSLogBatchReq_t;
+
+
+typedef struct XSLogBatchEntry_t
+{
+    union {
+        struct {
+            ub8 exptime;            /* 文件过期时间: 0 不过期 */
+
+            ub8 modtime;            /* 文件最后修改时间 */
+
+            ub8 filesize;           /* 文件最后字节尺寸 */
+
+            ub1 filemd5[16];        /* 文件最后 md5: 16 字节表示 */
+
+            ub2 prefixlen;          /* 与前一个条目路径相同的前缀字节 */
+            ub2 suffixlen;          /* 后缀字节: 路径长度 = prefixlen + suffixlen */
+        };
+
+        ub1 head[XS_LOGBATCH_ENTRY_SIZE];
+    };
+} GNUC_PACKED ARM_PACKED XSLogBatchEntry_t;
+
+#ifdef _MSC_VER
+#  pragma pack()
+#endif
+
+
+/**********************************************************************
+ * XLGB Command Reply
+ *   按请求中条目的顺序返回 entryid. entryid = 0 表示这个条目注册失败.
+ *
+ *   datalen = entries * 8
+ *********************************************************************/
+#define XS_LOGBATCH_REPLY_SIZE      24
+
+#ifdef _MSC_VER
+#  pragma pack(1)
+#endif
+
+typedef struct XSLogBatchReply_t
+{
+    union {
+        struct {
+            ub4 msgid;              /* XLGB */
+            ub4 datalen;            /* entryids length in bytes */
+
+            ub8 session;
+
+            ub4 entries;            /* 条目数目: 同请求 */
+            ub4 failed;             /* 注册失败的条目数目 */
+
+            ub1 entryids[0];        /* entries * ub8 (big endian) */
+        };
+
+        ub1 head[XS_LOGBATCH_REPLY_SIZE];
+    };
+} GNUC_PACKED ARM_PACKED XSLogBatchReply_t;
+
+#ifdef _MSC_VER
+#  pragma pack()
+#endif
+
+
 /**********************************************************************
  * XSYN Command Request
  *   数据同步命令. 每个数据包的包头都是这个结构 (固定 40 个字节大小).
  *   datalen 是本次传输文件数据的字节数, 不包括此包头.
  *
+ *   codec 不为 XS_CODEC_NONE 时, 数据是压缩的块, rawlen 是解压后的字节数.
+ *
  *********************************************************************/
 #define XS_SYNC_REQ_SIZE    40
 
@@ -337,8 +514,15 @@ typedef struct XSSyncFileReq_t
 
             ub8 session;
 
-            ub4 reserved1;          /* 0 */
-            ub4 reserved2;          /* 0 */
+            union {
+                ub4 reserved1;
+                ub4 codec;          /* 压缩算法: XS_CODEC_*, 0 不压缩 */
+            };
+
+            union {
+                ub4 reserved2;
+                ub4 rawlen;         /* 压缩前字节数 */
+            };
 
             ub8 entryid;            /* 条目 ID */
 
@@ -353,6 +537,192 @@ typedef struct XSSyncFileReq_t
 #  pragma pack()
 #endif
 
+/**********************************************************************
+ * XCHK Command Request
+ *   块哈希协商命令. 客户端按内容切分文件 (FastCDC) 之后, 先发送各块的
+ *   SHA-256 摘要和长度, 服务端回答哪些块在块存储中不存在. 客户端只用
+ *   XSYN 传输缺失的块 (offset = 块在文件中的偏移), 已存在的块既不传输
+ *   也不在服务端重复写入.
+ *
+ * 0
+ * --------------------------------+--------------------------------
+ * 0       msgid = XCHK            |4          datalen
+ * --------------------------------+--------------------------------
+ * 8                          session ( 8 bytes)
+ * --------------------------------+--------------------------------
+ * 16                         entryid ( 8 bytes)
+ * --------------------------------+--------------------------------
+ * 24                offset of the first chunk ( 8 bytes)
+ * --------------------------------+--------------------------------
+ * 32      chunks                  |36         crc32_checksum
+ * -----------------------------------------------------------------
+ * 40  chunks * XSChunkDesc_t ...
+ *
+ *   datalen = chunks * XS_CHUNK_DESC_SIZE
+ *   crc32_checksum 校验全部块描述 (不包括包头)
+ *********************************************************************/
+#define XS_CHUNK_HASH_SIZE          32
+
+#define XS_CHUNK_NEGOTIATE_REQ_SIZE    40
+
+#define XS_CHUNK_DESC_SIZE          40
+
+#ifdef _MSC_VER
+#  pragma pack(1)
+#endif
+
+typedef struct XSChunkNegotiateReq_t
+{
+    union {
+        struct {
+            ub4 msgid;              /* XCHK */
+            ub4 datalen;            /* data body length in bytes NOT including sizeof head */
+
+            ub8 session;
+
+            ub8 entryid;            /* 条目 ID */
+
+            ub8 offset;             /* 第一个块在文件中的偏移字节 */
+
+            ub4 chunks;             /* 块描述数目: 不超过 XSYNC_CHUNK_NEGOTIATE_MAX */
+            ub4 crc32_checksum;     /* 校验值: 全部块描述 */
+        };
+
+        ub1 head[XS_CHUNK_NEGOTIATE_REQ_SIZE];
+    };
+} GNUC_PACKED ARM_PACKED XSChunkNegotiateReq_t;
+
+
+typedef struct XSChunkDesc_t
+{
+    union {
+        struct {
+            ub1 digest[XS_CHUNK_HASH_SIZE];  /* SHA-256 of chunk */
+
+            ub4 length;             /* 块字节数 */
+            ub4 flags;              /* 0 */
+        };
+
+        ub1 head[XS_CHUNK_DESC_SIZE];
+    };
+} GNUC_PACKED ARM_PACKED XSChunkDesc_t;
+
+#ifdef _MSC_VER
+#  pragma pack()
+#endif
+
+
+/**********************************************************************
+ * XCHK Command Reply
+ *   服务端返回缺失块的位图: 第 i 位为 1 表示第 i 块不存在, 需要客户端传输.
+ *
+ *   datalen = (chunks + 7) / 8
+ *********************************************************************/
+#define XS_CHUNK_NEGOTIATE_REPLY_SIZE    32
+
+#define XS_CHUNK_BITMAP_SIZE(chunks)    (((chunks) + 7) / 8)
+
+#define XS_CHUNK_BITMAP_SET(bitmap, i)    ((bitmap)[(i) >> 3] |= (ub1) (1 << ((i) & 7)))
+#define XS_CHUNK_BITMAP_TEST(bitmap, i)    ((bitmap)[(i) >> 3] & (ub1) (1 << ((i) & 7)))
+
+#ifdef _MSC_VER
+#  pragma pack(1)
+#endif
+
+typedef struct XSChunkNegotiateReply_t
+{
+    union {
+        struct {
+            ub4 msgid;              /* XCHK */
+            ub4 datalen;            /* bitmap length in bytes */
+
+            ub8 session;
+
+            ub8 entryid;
+
+            ub4 chunks;             /* 块数目: 同请求 */
+            ub4 missing;            /* 缺失的块数目 */
+
+            ub1 bitmap[0];          /* 缺失块位图 */
+        };
+
+        ub1 head[XS_CHUNK_NEGOTIATE_REPLY_SIZE];
+    };
+} GNUC_PACKED ARM_PACKED XSChunkNegotiateReply_t;
+
+#ifdef _MSC_VER
+#  pragma pack()
+#endif
+
+
+/**********************************************************************
+ * XMUX Frame
+ *   多路复用帧. 一个连接上同时传输多个文件: 每个文件条目是一个流,
+ *   streamid = entryid. streamid = 0 表示连接本身.
+ *   最高位为 1 的 streamid 是请求流 (XS_MUX_REQUEST_STREAM): 只有一次
+ *   请求 (例如 XLGB) 和一次应答, 不对应文件条目.
+ *
+ *   DATA:   负载是流上的消息 (XSYN/XCHK 等), 可以被切分为多个帧.
+ *           flags 含有 XS_MUX_FLAG_END 表示流的最后一个帧.
+ *   WINDOW: 接收方消费了数据之后, 增加发送方的窗口 (window 字节).
+ *           streamid = 0 时增加连接的窗口.
+ *   RESET:  接收方拒绝这个流, 发送方丢弃流上未发送的数据.
+ *   PING:   心跳 (streamid = 0). 收到不带 ACK 的 PING 必须回应带 ACK 的 PING.
+ *
+ *   发送方任何时候在一个流上发送的字节不能超过流的窗口和连接的窗口.
+ *
+ * 0
+ * --------------------------------+--------------------------------
+ * 0       msgid = XMUX            |4          datalen
+ * --------------------------------+--------------------------------
+ * 8                     streamid = entryid ( 8 bytes)
+ * --------------------------------+--------------------------------
+ * 16 type |17 flags|18 reserved   |20         window
+ * -----------------------------------------------------------------
+ * 24  datalen bytes payload ...
+ *
+ *********************************************************************/
+#define XS_MUX_FRAME_HEAD_SIZE    24
+
+#define XS_MUX_REQUEST_STREAM     ((ub8) 0x8000000000000000ULL)
+
+#define XS_MUX_FRAME_DATA         0
+#define XS_MUX_FRAME_WINDOW       1
+#define XS_MUX_FRAME_RESET        2
+#define XS_MUX_FRAME_PING         3
+
+#define XS_MUX_FLAG_END           0x01
+#define XS_MUX_FLAG_ACK           0x02
+
+#ifdef _MSC_VER
+#  pragma pack(1)
+#endif
+
+typedef struct XSMuxFrame_t
+{
+    union {
+        struct {
+            ub4 msgid;              /* XMUX */
+            ub4 datalen;            /* payload length in bytes NOT including sizeof head */
+
+            ub8 streamid;           /* 流 ID = entryid */
+
+            ub1 type;               /* XS_MUX_FRAME_* */
+            ub1 flags;              /* XS_MUX_FLAG_* */
+            ub2 reserved;
+
+            ub4 window;             /* WINDOW 帧: 窗口增量 */
+        };
+
+        ub1 head[XS_MUX_FRAME_HEAD_SIZE];
+    };
+} GNUC_PACKED ARM_PACKED XSMuxFrame_t;
+
+#ifdef _MSC_VER
+#  pragma pack()
+#endif
+
+
 
 /**********************************************************************
  * XSVersion_t:
@@ -474,6 +844,7 @@ ub1 * XSConnectRequestBuild (XSConnectReq_t *req,
     uint32_t magic,
     ub8 utctime,
     ub4 randnum,
+    ub4 capflags,
     ub1 *chunk)
 {
     ub4 b;
@@ -509,7 +880,7 @@ ub1 * XSConnectRequestBuild (XSConnectReq_t *req,
 
     RC4_encrypt_string((char *) req->password, pwlen, (char *) chunk, b);
 
-    req->reserved = 0;
+    req->capflags = capflags;
 
     /**
      * write to send buffer
@@ -543,7 +914,7 @@ ub1 * XSConnectRequestBuild (XSConnectReq_t *req,
         memcpy(pbuf, req->password, XSYNC_PASSWORD_MAXLEN + 2);
         pbuf += XSYNC_PASSWORD_MAXLEN + 2;
 
-        b = BO_i32_htobe(req->reserved);
+        b = BO_i32_htobe(req->capflags);
         memcpy(pbuf, &b, sizeof(b));
         pbuf += sizeof(b);
 
@@ -625,8 +996,8 @@ inline XS_BOOL XSConnectRequestParse (ub1 *chunk, XSConnectReq_t *req)
 
     pbuf = chunk + sizeof(ub4) * 4 + sizeof(ub8) + XSYNC_CLIENTID_MAXLEN + XSYNC_PASSWORD_MAXLEN + 4 * sizeof(ub1);
 
-    // reserved
-    req->reserved = (ub4) BO_bytes_betoh_i32(pbuf);
+    // capflags
+    req->capflags = (ub4) BO_bytes_betoh_i32(pbuf);
     pbuf += sizeof(ub4);
 
     /* crcsum */
@@ -653,14 +1024,16 @@ inline const char * XSConnectRequestOutput (const XSConnectReq_t *req, void * pa
         "  version  = [%s]\n"
         "  utctime  = [%ju]\n"
         "  clientid = [%s]\n"
-        "  password = [%s]\n",
+        "  password = [%s]\n"
+        "  capflags = [0x%08x]\n",
         req->head[0], req->head[1], req->head[2], req->head[3],
         req->magic,
         req->randnum,
         ver.verstring,
         req->client_utctime,
         req->clientid,
-        (password ? (const char *) password : "(null)"));
+        (password ? (const char *) password : "(null)"),
+        req->capflags);
 
     output[outsize - 1] = 0;
 
@@ -699,29 +1072,886 @@ ub1 * XSConnectReplyAcceptBuild (XSConnectReply_t *reply,
     ub4 magic,
     ub8 utctime,
     ub8 session,
+    ub4 bitflags,
     ub1 *chunk)
 {
+    ub4 b;
+    ub8 b2;
+
+    ub1 *pbuf = chunk;
+
     XSVersion_t appver;
 
     bzero(reply, sizeof(*reply));
 
     reply->msgid = XS_MSGID_XCON.msgid;
 
-    reply->magic = 0;
+    reply->magic = magic;
 
     reply->server_version = build_version_from_string(XSYNC_SERVER_VERSION, &appver);
-    reply->bitflags = 0;
+    reply->bitflags = bitflags;
 
     reply->server_utctime = utctime;
     reply->session = session;
 
     reply->paramslen = 0;
 
-    //reply->crc32_checksum = ();
+    memcpy(pbuf, &reply->msgid, sizeof(reply->msgid));
+    pbuf += sizeof(reply->msgid);
+
+    b = BO_i32_htobe(reply->magic);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b = BO_i32_htobe(reply->server_version);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b = BO_i32_htobe(reply->bitflags);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b2 = BO_i64_htobe(reply->server_utctime);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b2 = BO_i64_htobe(reply->session);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b = BO_i32_htobe(reply->paramslen);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    reply->crc32_checksum = (ub4) crc32(0L, (const unsigned char *) chunk, XS_CONNECT_ACCEPT_REPLY_SIZE - sizeof(ub4));
+
+    b = BO_i32_htobe(reply->crc32_checksum);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
 
     return chunk;
 }
 
+
+/**
+ * XSConnectReplyAcceptParse
+ *   解析服务端接受连接的应答 (XS_CONNECT_ACCEPT_REPLY_SIZE 字节)
+ */
+__no_warning_unused(static)
+XS_BOOL XSConnectReplyAcceptParse (ub1 *chunk, XSConnectReply_t *reply)
+{
+    ub1 *pbuf = chunk;
+
+    ub4 crcsum = (ub4) crc32(0L, (const unsigned char *) chunk, XS_CONNECT_ACCEPT_REPLY_SIZE - sizeof(ub4));
+
+    bzero(reply, sizeof(*reply));
+
+    memcpy(&reply->msgid, pbuf, sizeof(reply->msgid));
+    pbuf += sizeof(ub4);
+
+    if (reply->msgid != XS_MSGID_XCON.msgid) {
+        return XS_FALSE;
+    }
+
+    reply->crc32_checksum = (ub4) BO_bytes_betoh_i32(chunk + XS_CONNECT_ACCEPT_REPLY_SIZE - sizeof(ub4));
+
+    if (crcsum != reply->crc32_checksum) {
+        return XS_FALSE;
+    }
+
+    reply->magic = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    reply->server_version = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    reply->bitflags = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    reply->server_utctime = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    reply->session = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    reply->paramslen = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    return XS_TRUE;
+}
+
+
+/**
+ * XSSyncFileReqBuild
+ *   写入 XSYN 包头 (XS_SYNC_REQ_SIZE 字节), 数据 (datalen 字节) 紧随其后
+ */
+__no_warning_unused(static)
+ub1 * XSSyncFileReqBuild (XSSyncFileReq_t *req,
+    ub8 session,
+    ub8 entryid,
+    ub8 offset,
+    ub4 datalen,
+    ub4 codec,
+    ub4 rawlen,
+    ub1 *chunk)
+{
+    ub4 b;
+    ub8 b2;
+
+    ub1 *pbuf = chunk;
+
+    bzero(req, sizeof(*req));
+
+    req->msgid = XS_MSGID_XSYN.msgid;
+    req->datalen = datalen;
+    req->session = session;
+    req->codec = codec;
+    req->rawlen = rawlen;
+    req->entryid = entryid;
+    req->offset = offset;
+
+    memcpy(pbuf, &req->msgid, sizeof(req->msgid));
+    pbuf += sizeof(req->msgid);
+
+    b = BO_i32_htobe(req->datalen);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b2 = BO_i64_htobe(req->session);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b = BO_i32_htobe(req->codec);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b = BO_i32_htobe(req->rawlen);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b2 = BO_i64_htobe(req->entryid);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b2 = BO_i64_htobe(req->offset);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    return chunk;
+}
+
+
+__no_warning_unused(static)
+XS_BOOL XSSyncFileReqParse (ub1 *chunk, XSSyncFileReq_t *req)
+{
+    ub1 *pbuf = chunk;
+
+    bzero(req, sizeof(*req));
+
+    memcpy(&req->msgid, pbuf, sizeof(req->msgid));
+    pbuf += sizeof(ub4);
+
+    if (req->msgid != XS_MSGID_XSYN.msgid) {
+        return XS_FALSE;
+    }
+
+    req->datalen = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    req->session = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    req->codec = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    req->rawlen = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    req->entryid = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    req->offset = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    if (req->codec == XS_CODEC_NONE && req->rawlen != 0 && req->rawlen != req->datalen) {
+        return XS_FALSE;
+    }
+
+    return XS_TRUE;
+}
+
+
+/**
+ * XSChunkNegotiateReqBuild
+ *   写入 XCHK 请求到 chunk, 总长度 = XS_CHUNK_NEGOTIATE_REQ_SIZE + req->datalen
+ */
+__no_warning_unused(static)
+ub1 * XSChunkNegotiateReqBuild (XSChunkNegotiateReq_t *req,
+    ub8 session,
+    ub8 entryid,
+    ub8 offset,
+    const XSChunkDesc_t *descs,
+    ub4 chunks,
+    ub1 *chunk)
+{
+    ub4 i, b;
+    ub8 b2;
+
+    ub1 *pbuf = chunk + XS_CHUNK_NEGOTIATE_REQ_SIZE;
+
+    bzero(req, sizeof(*req));
+
+    req->msgid = XS_MSGID_XCHK.msgid;
+    req->datalen = chunks * XS_CHUNK_DESC_SIZE;
+    req->session = session;
+    req->entryid = entryid;
+    req->offset = offset;
+    req->chunks = chunks;
+
+    /* body: chunk descriptors */
+    for (i = 0; i < chunks; i++) {
+        memcpy(pbuf, descs[i].digest, XS_CHUNK_HASH_SIZE);
+        pbuf += XS_CHUNK_HASH_SIZE;
+
+        b = BO_i32_htobe(descs[i].length);
+        memcpy(pbuf, &b, sizeof(b));
+        pbuf += sizeof(b);
+
+        b = BO_i32_htobe(descs[i].flags);
+        memcpy(pbuf, &b, sizeof(b));
+        pbuf += sizeof(b);
+    }
+
+    req->crc32_checksum = (ub4) crc32(0L, (const unsigned char *) chunk + XS_CHUNK_NEGOTIATE_REQ_SIZE, req->datalen);
+
+    /* head */
+    pbuf = chunk;
+
+    memcpy(pbuf, &req->msgid, sizeof(req->msgid));
+    pbuf += sizeof(req->msgid);
+
+    b = BO_i32_htobe(req->datalen);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b2 = BO_i64_htobe(req->session);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b2 = BO_i64_htobe(req->entryid);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b2 = BO_i64_htobe(req->offset);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b = BO_i32_htobe(req->chunks);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b = BO_i32_htobe(req->crc32_checksum);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    return chunk;
+}
+
+
+/**
+ * XSChunkNegotiateReqParse
+ *   解析 XCHK 请求包头. 如果 descs 不为 0, 同时解析并校验块描述
+ *   (chunk 必须包含完整的 datalen 字节).
+ */
+__no_warning_unused(static)
+XS_BOOL XSChunkNegotiateReqParse (ub1 *chunk, XSChunkNegotiateReq_t *req, XSChunkDesc_t *descs)
+{
+    ub4 i;
+    ub1 *pbuf = chunk;
+
+    bzero(req, sizeof(*req));
+
+    memcpy(&req->msgid, pbuf, sizeof(req->msgid));
+    pbuf += sizeof(ub4);
+
+    if (req->msgid != XS_MSGID_XCHK.msgid) {
+        return XS_FALSE;
+    }
+
+    req->datalen = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    req->session = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    req->entryid = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    req->offset = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    req->chunks = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    req->crc32_checksum = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    if (req->chunks > XSYNC_CHUNK_NEGOTIATE_MAX || req->datalen != req->chunks * XS_CHUNK_DESC_SIZE) {
+        return XS_FALSE;
+    }
+
+    if (descs) {
+        if (req->crc32_checksum != (ub4) crc32(0L, (const unsigned char *) pbuf, req->datalen)) {
+            return XS_FALSE;
+        }
+
+        for (i = 0; i < req->chunks; i++) {
+            memcpy(descs[i].digest, pbuf, XS_CHUNK_HASH_SIZE);
+            pbuf += XS_CHUNK_HASH_SIZE;
+
+            descs[i].length = (ub4) BO_bytes_betoh_i32(pbuf);
+            pbuf += sizeof(ub4);
+
+            descs[i].flags = (ub4) BO_bytes_betoh_i32(pbuf);
+            pbuf += sizeof(ub4);
+        }
+    }
+
+    return XS_TRUE;
+}
+
+
+/**
+ * XSChunkNegotiateReplyBuild
+ *   总长度 = XS_CHUNK_NEGOTIATE_REPLY_SIZE + XS_CHUNK_BITMAP_SIZE(chunks)
+ */
+__no_warning_unused(static)
+ub1 * XSChunkNegotiateReplyBuild (XSChunkNegotiateReply_t *reply,
+    ub8 session,
+    ub8 entryid,
+    ub4 chunks,
+    ub4 missing,
+    const ub1 *bitmap,
+    ub1 *chunk)
+{
+    ub4 b;
+    ub8 b2;
+
+    ub1 *pbuf = chunk;
+
+    bzero(reply, sizeof(*reply));
+
+    reply->msgid = XS_MSGID_XCHK.msgid;
+    reply->datalen = XS_CHUNK_BITMAP_SIZE(chunks);
+    reply->session = session;
+    reply->entryid = entryid;
+    reply->chunks = chunks;
+    reply->missing = missing;
+
+    memcpy(pbuf, &reply->msgid, sizeof(reply->msgid));
+    pbuf += sizeof(reply->msgid);
+
+    b = BO_i32_htobe(reply->datalen);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b2 = BO_i64_htobe(reply->session);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b2 = BO_i64_htobe(reply->entryid);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b = BO_i32_htobe(reply->chunks);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b = BO_i32_htobe(reply->missing);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    if (pbuf != bitmap) {
+        memmove(pbuf, bitmap, reply->datalen);
+    }
+
+    return chunk;
+}
+
+
+__no_warning_unused(static)
+XS_BOOL XSChunkNegotiateReplyParse (ub1 *chunk, XSChunkNegotiateReply_t *reply)
+{
+    ub1 *pbuf = chunk;
+
+    bzero(reply, sizeof(*reply));
+
+    memcpy(&reply->msgid, pbuf, sizeof(reply->msgid));
+    pbuf += sizeof(ub4);
+
+    if (reply->msgid != XS_MSGID_XCHK.msgid) {
+        return XS_FALSE;
+    }
+
+    reply->datalen = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    reply->session = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    reply->entryid = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    reply->chunks = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    reply->missing = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    if (reply->datalen != XS_CHUNK_BITMAP_SIZE(reply->chunks) || reply->missing > reply->chunks) {
+        return XS_FALSE;
+    }
+
+    return XS_TRUE;
+}
+
+
+/**
+ * XSLogBatchReqBuild
+ *   写入 XLGB 请求到 chunk (最多 chunksize 字节). pathfiles 应当按路径排序,
+ *   entries 的 prefixlen 和 suffixlen 由本函数计算.
+ *
+ * returns:
+ *   写入的总字节 = XS_LOGBATCH_REQ_SIZE + req->datalen
+ *   0 - chunk 空间不足或者路径无效
+ */
+__no_warning_unused(static)
+ub4 XSLogBatchReqBuild (XSLogBatchReq_t *req,
+    ub8 session,
+    const char *clientid,
+    XSLogBatchEntry_t *entries,
+    const char **pathfiles,
+    ub4 count,
+    ub1 *chunk,
+    ub4 chunksize)
+{
+    ub4 i, b, pathlen, prevlen = 0;
+    ub8 b2;
+    ub2 b1;
+
+    const char *prev = 0;
+
+    ub1 *pbuf = chunk + XS_LOGBATCH_REQ_SIZE;
+    ub1 *pend = chunk + chunksize;
+
+    if (chunksize < XS_LOGBATCH_REQ_SIZE || count > XSYNC_LOGBATCH_MAX) {
+        return 0;
+    }
+
+    bzero(req, sizeof(*req));
+
+    req->msgid = XS_MSGID_XLGB.msgid;
+    req->session = session;
+    req->entries = count;
+
+    strncpy(req->clientid, clientid, XSYNC_CLIENTID_MAXLEN);
+
+    /* body: entries with prefix compressed path */
+    for (i = 0; i < count; i++) {
+        XSLogBatchEntry_t *entry = &entries[i];
+
+        pathlen = (ub4) strlen(pathfiles[i]);
+        if (pathlen == 0 || pathlen > XSYNC_PATHFILE_MAXLEN) {
+            return 0;
+        }
+
+        b = 0;
+        if (prev) {
+            /* 后缀至少 1 字节 */
+            prevlen = (pathlen - 1 < prevlen? pathlen - 1 : prevlen);
+
+            while (b < prevlen && prev[b] == pathfiles[i][b]) {
+                b++;
+            }
+        }
+
+        entry->prefixlen = (ub2) b;
+        entry->suffixlen = (ub2) (pathlen - b);
+
+        if (pend - pbuf < (ssize_t) (XS_LOGBATCH_ENTRY_SIZE + entry->suffixlen)) {
+            return 0;
+        }
+
+        b2 = BO_i64_htobe(entry->exptime);
+        memcpy(pbuf, &b2, sizeof(b2));
+        pbuf += sizeof(b2);
+
+        b2 = BO_i64_htobe(entry->modtime);
+        memcpy(pbuf, &b2, sizeof(b2));
+        pbuf += sizeof(b2);
+
+        b2 = BO_i64_htobe(entry->filesize);
+        memcpy(pbuf, &b2, sizeof(b2));
+        pbuf += sizeof(b2);
+
+        memcpy(pbuf, entry->filemd5, sizeof(entry->filemd5));
+        pbuf += sizeof(entry->filemd5);
+
+        b1 = BO_i16_htobe(entry->prefixlen);
+        memcpy(pbuf, &b1, sizeof(b1));
+        pbuf += sizeof(b1);
+
+        b1 = BO_i16_htobe(entry->suffixlen);
+        memcpy(pbuf, &b1, sizeof(b1));
+        pbuf += sizeof(b1);
+
+        memcpy(pbuf, pathfiles[i] + entry->prefixlen, entry->suffixlen);
+        pbuf += entry->suffixlen;
+
+        prev = pathfiles[i];
+        prevlen = pathlen;
+    }
+
+    req->datalen = (ub4) (pbuf - chunk - XS_LOGBATCH_REQ_SIZE);
+
+    if (req->datalen > XSYNC_LOGBATCH_MAXSIZE) {
+        return 0;
+    }
+
+    req->crc32_checksum = (ub4) crc32(0L, (const unsigned char *) chunk + XS_LOGBATCH_REQ_SIZE, req->datalen);
+
+    /* head */
+    pbuf = chunk;
+
+    memcpy(pbuf, &req->msgid, sizeof(req->msgid));
+    pbuf += sizeof(req->msgid);
+
+    b = BO_i32_htobe(req->datalen);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b2 = BO_i64_htobe(req->session);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b = BO_i32_htobe(req->entries);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b = BO_i32_htobe(req->crc32_checksum);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    memcpy(pbuf, req->clientid, sizeof(req->clientid));
+    pbuf += sizeof(req->clientid);
+
+    return XS_LOGBATCH_REQ_SIZE + req->datalen;
+}
+
+
+/**
+ * XSLogBatchReqParse
+ *   解析 XLGB 请求包头. chunk 包含完整的 datalen 字节时 verify 为 1
+ *   同时校验全部条目.
+ */
+__no_warning_unused(static)
+XS_BOOL XSLogBatchReqParse (ub1 *chunk, XSLogBatchReq_t *req, int verify)
+{
+    ub1 *pbuf = chunk;
+
+    bzero(req, sizeof(*req));
+
+    memcpy(&req->msgid, pbuf, sizeof(req->msgid));
+    pbuf += sizeof(ub4);
+
+    if (req->msgid != XS_MSGID_XLGB.msgid) {
+        return XS_FALSE;
+    }
+
+    req->datalen = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    req->session = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    req->entries = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    req->crc32_checksum = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    memcpy(req->clientid, pbuf, XSYNC_CLIENTID_MAXLEN);
+    req->clientid[XSYNC_CLIENTID_MAXLEN] = 0;
+    pbuf += sizeof(req->clientid);
+
+    if (req->entries > XSYNC_LOGBATCH_MAX ||
+        req->datalen > XSYNC_LOGBATCH_MAXSIZE ||
+        req->datalen < req->entries * XS_LOGBATCH_ENTRY_SIZE) {
+        return XS_FALSE;
+    }
+
+    if (verify && req->crc32_checksum != (ub4) crc32(0L, (const unsigned char *) pbuf, req->datalen)) {
+        return XS_FALSE;
+    }
+
+    return XS_TRUE;
+}
+
+
+/**
+ * XSLogBatchEntryNext
+ *   从 *ppbuf 解析下一个条目并还原路径. pathfile 保存着前一个条目的路径
+ *   (第一次调用时内容任意), 返回时替换为本条目的路径 ('\0' 结尾).
+ *   *ppbuf 前进到下一个条目.
+ *
+ * returns:
+ *   本条目路径的长度
+ *   0 - 条目无效
+ */
+__no_warning_unused(static)
+ub4 XSLogBatchEntryNext (ub1 **ppbuf, const ub1 *pend, XSLogBatchEntry_t *entry, char pathfile[XSYNC_PATHFILE_MAXLEN + 1], ub4 prevlen)
+{
+    ub4 pathlen;
+    ub1 *pbuf = *ppbuf;
+
+    if (pend - pbuf < XS_LOGBATCH_ENTRY_SIZE) {
+        return 0;
+    }
+
+    entry->exptime = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    entry->modtime = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    entry->filesize = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    memcpy(entry->filemd5, pbuf, sizeof(entry->filemd5));
+    pbuf += sizeof(entry->filemd5);
+
+    entry->prefixlen = (ub2) BO_bytes_betoh_i16(pbuf);
+    pbuf += sizeof(ub2);
+
+    entry->suffixlen = (ub2) BO_bytes_betoh_i16(pbuf);
+    pbuf += sizeof(ub2);
+
+    pathlen = (ub4) entry->prefixlen + entry->suffixlen;
+
+    if (entry->prefixlen > prevlen || entry->suffixlen == 0 ||
+        pathlen > XSYNC_PATHFILE_MAXLEN ||
+        pend - pbuf < (ssize_t) entry->suffixlen ||
+        memchr(pbuf, 0, entry->suffixlen)) {
+        return 0;
+    }
+
+    memcpy(pathfile + entry->prefixlen, pbuf, entry->suffixlen);
+    pathfile[pathlen] = 0;
+    pbuf += entry->suffixlen;
+
+    *ppbuf = pbuf;
+
+    return pathlen;
+}
+
+
+/**
+ * XSLogBatchReplyBuild
+ *   总长度 = XS_LOGBATCH_REPLY_SIZE + entries * 8
+ */
+__no_warning_unused(static)
+ub1 * XSLogBatchReplyBuild (XSLogBatchReply_t *reply,
+    ub8 session,
+    const ub8 *entryids,
+    ub4 entries,
+    ub1 *chunk)
+{
+    ub4 i, b;
+    ub8 b2;
+
+    ub1 *pbuf = chunk;
+
+    bzero(reply, sizeof(*reply));
+
+    reply->msgid = XS_MSGID_XLGB.msgid;
+    reply->datalen = entries * sizeof(ub8);
+    reply->session = session;
+    reply->entries = entries;
+
+    for (i = 0; i < entries; i++) {
+        if (! entryids[i]) {
+            reply->failed++;
+        }
+    }
+
+    memcpy(pbuf, &reply->msgid, sizeof(reply->msgid));
+    pbuf += sizeof(reply->msgid);
+
+    b = BO_i32_htobe(reply->datalen);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b2 = BO_i64_htobe(reply->session);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    b = BO_i32_htobe(reply->entries);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b = BO_i32_htobe(reply->failed);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    for (i = 0; i < entries; i++) {
+        b2 = BO_i64_htobe(entryids[i]);
+        memcpy(pbuf, &b2, sizeof(b2));
+        pbuf += sizeof(b2);
+    }
+
+    return chunk;
+}
+
+
+/**
+ * XSLogBatchReplyParse
+ *   解析 XLGB 应答. 如果 entryids 不为 0, 同时解析全部 entryid
+ *   (chunk 必须包含完整的 datalen 字节).
+ */
+__no_warning_unused(static)
+XS_BOOL XSLogBatchReplyParse (ub1 *chunk, XSLogBatchReply_t *reply, ub8 *entryids)
+{
+    ub4 i;
+    ub1 *pbuf = chunk;
+
+    bzero(reply, sizeof(*reply));
+
+    memcpy(&reply->msgid, pbuf, sizeof(reply->msgid));
+    pbuf += sizeof(ub4);
+
+    if (reply->msgid != XS_MSGID_XLGB.msgid) {
+        return XS_FALSE;
+    }
+
+    reply->datalen = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    reply->session = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    reply->entries = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    reply->failed = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    if (reply->entries > XSYNC_LOGBATCH_MAX ||
+        reply->datalen != reply->entries * sizeof(ub8) ||
+        reply->failed > reply->entries) {
+        return XS_FALSE;
+    }
+
+    if (entryids) {
+        for (i = 0; i < reply->entries; i++) {
+            entryids[i] = (ub8) BO_bytes_betoh_i64(pbuf);
+            pbuf += sizeof(ub8);
+        }
+    }
+
+    return XS_TRUE;
+}
+
+
+/**
+ * XSMuxFrameBuild
+ *   写入 XMUX 帧头 (XS_MUX_FRAME_HEAD_SIZE 字节), 负载 (datalen 字节) 紧随其后
+ */
+__no_warning_unused(static)
+ub1 * XSMuxFrameBuild (XSMuxFrame_t *frame,
+    ub8 streamid,
+    ub1 type,
+    ub1 flags,
+    ub4 window,
+    ub4 datalen,
+    ub1 *chunk)
+{
+    ub4 b;
+    ub8 b2;
+
+    ub1 *pbuf = chunk;
+
+    bzero(frame, sizeof(*frame));
+
+    frame->msgid = XS_MSGID_XMUX.msgid;
+    frame->datalen = datalen;
+    frame->streamid = streamid;
+    frame->type = type;
+    frame->flags = flags;
+    frame->window = window;
+
+    memcpy(pbuf, &frame->msgid, sizeof(frame->msgid));
+    pbuf += sizeof(frame->msgid);
+
+    b = BO_i32_htobe(frame->datalen);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    b2 = BO_i64_htobe(frame->streamid);
+    memcpy(pbuf, &b2, sizeof(b2));
+    pbuf += sizeof(b2);
+
+    *pbuf++ = frame->type;
+    *pbuf++ = frame->flags;
+    *pbuf++ = 0;
+    *pbuf++ = 0;
+
+    b = BO_i32_htobe(frame->window);
+    memcpy(pbuf, &b, sizeof(b));
+    pbuf += sizeof(b);
+
+    return chunk;
+}
+
+
+__no_warning_unused(static)
+XS_BOOL XSMuxFrameParse (ub1 *chunk, XSMuxFrame_t *frame)
+{
+    ub1 *pbuf = chunk;
+
+    bzero(frame, sizeof(*frame));
+
+    memcpy(&frame->msgid, pbuf, sizeof(frame->msgid));
+    pbuf += sizeof(ub4);
+
+    if (frame->msgid != XS_MSGID_XMUX.msgid) {
+        return XS_FALSE;
+    }
+
+    frame->datalen = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    frame->streamid = (ub8) BO_bytes_betoh_i64(pbuf);
+    pbuf += sizeof(ub8);
+
+    frame->type = *pbuf++;
+    frame->flags = *pbuf++;
+    pbuf += sizeof(ub2);
+
+    frame->window = (ub4) BO_bytes_betoh_i32(pbuf);
+    pbuf += sizeof(ub4);
+
+    if (frame->type > XS_MUX_FRAME_PING || frame->datalen > XSYNC_MUX_FRAME_MAXSIZE) {
+        return XS_FALSE;
+    }
+
+    if (frame->type != XS_MUX_FRAME_DATA && frame->datalen != 0) {
+        return XS_FALSE;
+    }
+
+    return XS_TRUE;
+}
+
+
 #if defined(__cplusplus)
 }
 #endif
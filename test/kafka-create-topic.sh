@@ -0,0 +1,19 @@
+#!/bin/bash
+#################################################
+_file=$(readlink -f $0)
+_cdir=$(dirname $_file)
+_name=$(basename $_file)
+
+# java-1.8 and later
+
+if [ "$#" = "0" ]; then
+    echo "no topic specified !"
+    echo "$_name topic [partitions]"
+    exit 1
+fi
+
+partitions=${2:-4}
+
+echo "create kafka topic: topic=$1 partitions=$partitions"
+
+export PATH="${_cdir}/kafka/libs:$PATH" && ${_cdir}/kafka/bin/kafka-topics.sh --zookeeper=localhost:2181 --create --replication-factor=1 --partitions=$partitions --topic="$1"
@@ -0,0 +1,74 @@
+#!/bin/bash
+#################################################
+_file=$(readlink -f $0)
+_cdir=$(dirname $_file)
+_name=$(basename $_file)
+
+# 测试 xsync-server 的 kafka 合并和镜像索引:
+#   xsync-evproduce 写入 count 个文件的事件和 dups 个重复 (序号相同) 的事件,
+#   然后比较服务端 metrics 的增量:
+#     xsync_server_kafka_events_total      += count
+#     xsync_server_kafka_duplicates_total  += dups
+#     xsync_server_mirror_files            += count (每次用新的 clientid)
+#
+# 需要本机的 kafka (kafka-start.sh) 和这样启动的服务端:
+#   xsync-server -k localhost:9092 -o topic -M 127.0.0.1:9108 ...
+
+if [ "$#" = "0" ]; then
+    echo "no topic specified !"
+    echo "$_name topic [count] [dups] [metrics]"
+    exit 1
+fi
+
+topic="$1"
+count=${2:-1000}
+dups=${3:-100}
+metrics=${4:-127.0.0.1:9108}
+
+evproduce="${_cdir}/../target/xsync-evproduce-0.4.4"
+
+if [ ! -x "$evproduce" ]; then
+    echo "$evproduce not found: make in src first"
+    exit 1
+fi
+
+clientid="ingest-test-$$"
+
+metric() {
+    curl -s "http://$metrics/metrics" | awk -v m="$1" '$1 == m { print $2 }'
+}
+
+events0=$(metric xsync_server_kafka_events_total)
+dups0=$(metric xsync_server_kafka_duplicates_total)
+files0=$(metric xsync_server_mirror_files)
+
+if [ -z "$events0" ] || [ -z "$files0" ]; then
+    echo "no kafka metrics from $metrics: server not started with -k/-o/-M ?"
+    exit 1
+fi
+
+echo "produce: topic=$topic clientid=$clientid count=$count dups=$dups"
+
+"$evproduce" -b localhost:9092 -t "$topic" -c "$clientid" -n $count -d $dups || exit 1
+
+# 服务端按批消费, 等待增量到齐
+for i in $(seq 1 30); do
+    events=$(metric xsync_server_kafka_events_total)
+    duplicates=$(metric xsync_server_kafka_duplicates_total)
+    files=$(metric xsync_server_mirror_files)
+
+    if [ $((events - events0)) -ge $count ] && [ $((duplicates - dups0)) -ge $dups ]; then
+        break
+    fi
+
+    sleep 1
+done
+
+echo "events: +$((events - events0)) duplicates: +$((duplicates - dups0)) mirror_files: +$((files - files0))"
+
+if [ $((events - events0)) -ne $count ] || [ $((duplicates - dups0)) -ne $dups ] || [ $((files - files0)) -ne $count ]; then
+    echo "FAIL: expect events +$count, duplicates +$dups, mirror_files +$count"
+    exit 1
+fi
+
+echo "OK"